@@ -3369,6 +3369,12 @@ void amd64g_dirtyhelper_CPUID_avx2 ( VexGuestAMD64State* st,
       case 0x00000007:
          switch (old_ecx) {
             /* Don't advertise FSGSBASE support, bit 0 in EBX.  */
+            /* Nor any AVX-512 subset (EBX bits 16, 17, 30, 31 and so
+               on): there is no EVEX decoding, and the guest state has
+               neither ZMM nor opmask registers.  Code that picks its
+               implementation at run time, e.g. through function
+               multiversioning, therefore selects its AVX2 variant
+               without needing to be told. */
             case 0x00000000: SET_ABCD(0x00000000, 0x000027aa,
                                       0x00000000, 0x00000000); break;
             default:         SET_ABCD(0x00000000, 0x00000000,
@@ -205,7 +205,7 @@ IRSB* bb_to_IR (
 {
    Long       delta;
    Int        i, n_instrs, first_stmt_idx;
-   Bool       resteerOK, debug_print;
+   Bool       resteerOK, resteerUOK, debug_print;
    DisResult  dres;
    IRStmt*    imark;
    IRStmt*    nop;
@@ -215,7 +215,9 @@ IRSB* bb_to_IR (
    IRSB*      irsb;
    Addr       guest_IP_curr_instr;
    IRConst*   guest_IP_bbstart_IRConst = NULL;
-   Int        n_cond_resteers_allowed = 2;
+   Int        n_cond_resteers_allowed = vex_control.guest_chase_cond
+                                           ? vex_control.guest_chase_cond_max
+                                           : 0;
 
    Bool (*resteerOKfn)(void*,Addr) = NULL;
 
@@ -227,6 +229,8 @@ IRSB* bb_to_IR (
    vassert(vex_control.guest_max_insns <= 100);
    vassert(vex_control.guest_chase_thresh >= 0);
    vassert(vex_control.guest_chase_thresh < vex_control.guest_max_insns);
+   vassert(vex_control.guest_chase_cond_max >= 0);
+   vassert(vex_control.guest_chase_cond_max <= 8);
    vassert(guest_word_type == Ity_I32 || guest_word_type == Ity_I64);
 
    if (guest_word_type == Ity_I32) {
@@ -294,26 +298,39 @@ IRSB* bb_to_IR (
       vassert(n_instrs < guest_max_insns_really);
 
       /* Regardless of what chase_into_ok says, is chasing permissible
-         at all right now?  Set resteerOKfn accordingly. */
-      resteerOK 
+         at all right now?  Set resteerOKfn accordingly.  Unconditional
+         chases are limited by guest_chase_thresh.  Conditional ones
+         are not: they leave a side exit for the unlikely direction and
+         so do not hide any block-ending jump, which means they remain
+         useful even to tools that set guest_chase_thresh to zero.
+         They only need room for one more insn after the branch. */
+      resteerUOK
          = toBool(
               n_instrs < vex_control.guest_chase_thresh
               /* we can't afford to have a resteer once we're on the
                  last extent slot. */
               && vge->n_used < 3
            );
+      resteerOK
+         = toBool(
+              resteerUOK
+              || (n_cond_resteers_allowed > 0
+                  && n_instrs + 1 < guest_max_insns_really
+                  && vge->n_used < 3)
+           );
 
       resteerOKfn
          = resteerOK ? chase_into_ok : const_False;
 
       /* n_cond_resteers_allowed keeps track of whether we're still
          allowing dis_instr_fn to chase conditional branches.  It
-         starts (at 2) and gets decremented each time dis_instr_fn
-         tells us it has chased a conditional branch.  We then
-         decrement it, and use it to tell later calls to dis_instr_fn
-         whether or not it is allowed to chase conditional
-         branches. */
-      vassert(n_cond_resteers_allowed >= 0 && n_cond_resteers_allowed <= 2);
+         starts at guest_chase_cond_max (or zero if guest_chase_cond
+         is off) and gets decremented each time dis_instr_fn tells us
+         it has chased a conditional branch.  We use it to tell later
+         calls to dis_instr_fn whether or not it is allowed to chase
+         conditional branches. */
+      vassert(n_cond_resteers_allowed >= 0
+              && n_cond_resteers_allowed <= vex_control.guest_chase_cond_max);
 
       /* This is the IP of the instruction we're just about to deal
          with. */
@@ -375,6 +392,32 @@ IRSB* bb_to_IR (
                             host_endness,
                             sigill_diag );
 
+      /* resteerOKfn only says whether a destination may be chased, not
+         what kind of branch gets there.  If we only meant to allow a
+         conditional chase but got an unconditional one, throw the
+         insn's IR away (keeping the IMark) and do it again with
+         chasing disabled.  This is rare: it only happens for direct
+         jumps and calls, and the extra temporaries are harmless. */
+      if (dres.whatNext == Dis_ResteerU && !resteerUOK) {
+         irsb->stmts_used = first_stmt_idx + 1;
+         resteerOK   = False;
+         resteerOKfn = const_False;
+         dres = dis_instr_fn ( irsb,
+                               resteerOKfn,
+                               False,
+                               callback_opaque,
+                               guest_code,
+                               delta,
+                               guest_IP_curr_instr,
+                               arch_guest,
+                               archinfo_guest,
+                               abiinfo_both,
+                               host_endness,
+                               sigill_diag );
+         vassert(dres.whatNext != Dis_ResteerU
+                 && dres.whatNext != Dis_ResteerC);
+      }
+
       /* stay sane ... */
       vassert(dres.whatNext == Dis_StopHere
               || dres.whatNext == Dis_Continue
@@ -489,18 +532,33 @@ IRSB* bb_to_IR (
             }
             /* figure out a new delta to continue at. */
             vassert(resteerOKfn(callback_opaque,dres.continueAt));
-            delta = dres.continueAt - guest_IP_bbstart;
-            /* we now have to start a new extent slot. */
-            vge->n_used++;
-            vassert(vge->n_used <= 3);
-            vge->base[vge->n_used-1] = dres.continueAt;
-            vge->len[vge->n_used-1] = 0;
+            if (dres.whatNext == Dis_ResteerC
+                && dres.continueAt == guest_IP_bbstart + delta) {
+               /* A forward branch assumed not taken: we carry on with
+                  the next insn, so the current extent just keeps
+                  growing and no slot is used up. */
+            } else {
+               delta = dres.continueAt - guest_IP_bbstart;
+               /* we now have to start a new extent slot. */
+               vge->n_used++;
+               vassert(vge->n_used <= 3);
+               vge->base[vge->n_used-1] = dres.continueAt;
+               vge->len[vge->n_used-1] = 0;
+            }
             n_resteers++;
             d_resteers++;
             if (0 && (n_resteers & 0xFF) == 0)
             vex_printf("resteer[%d,%d] to 0x%lx (delta = %lld)\n",
                        n_resteers, d_resteers,
                        dres.continueAt, delta);
+            if (n_instrs >= guest_max_insns_really) {
+               /* A verbose insn may have lowered the limit under us.
+                  The insn's final Put of the IP holds continueAt, so
+                  just stop there. */
+               irsb->next = IRExpr_Get(offB_GUEST_IP, guest_word_type);
+               irsb->offsIP = offB_GUEST_IP;
+               goto done;
+            }
             break;
          default:
             vpanic("bb_to_IR");
@@ -346,6 +346,11 @@ typedef
       // Only for SSSE3 capable hosts:
       Asse_PSHUFB,
       Asse_PMADDUBSW,
+      // Only for SSE4.1 (SSE4.2 for CMPGT64S) capable hosts:
+      Asse_MUL32,
+      Asse_MAX32S, Asse_MIN32S, Asse_MAX32U, Asse_MIN32U,
+      Asse_MAX16U, Asse_MIN16U, Asse_MAX8S, Asse_MIN8S,
+      Asse_CMPEQ64, Asse_CMPGT64S,
       // Only for F16C capable hosts:
       Asse_F32toF16, // F32 to F16 conversion, aka vcvtps2ph
       Asse_F16toF32, // F16 to F32 conversion, aka vcvtph2ps
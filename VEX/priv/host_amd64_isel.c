@@ -3671,28 +3671,45 @@ static HReg iselVecExpr_wrk ( ISelEnv* env, const IRExpr* e )
          return dst;
       }
 
-      case Iop_Mul32x4:    fn = (HWord)h_generic_calc_Mul32x4;
-                           goto do_SseAssistedBinary;
-      case Iop_Max32Sx4:   fn = (HWord)h_generic_calc_Max32Sx4;
-                           goto do_SseAssistedBinary;
-      case Iop_Min32Sx4:   fn = (HWord)h_generic_calc_Min32Sx4;
-                           goto do_SseAssistedBinary;
-      case Iop_Max32Ux4:   fn = (HWord)h_generic_calc_Max32Ux4;
-                           goto do_SseAssistedBinary;
-      case Iop_Min32Ux4:   fn = (HWord)h_generic_calc_Min32Ux4;
-                           goto do_SseAssistedBinary;
-      case Iop_Max16Ux8:   fn = (HWord)h_generic_calc_Max16Ux8;
-                           goto do_SseAssistedBinary;
-      case Iop_Min16Ux8:   fn = (HWord)h_generic_calc_Min16Ux8;
-                           goto do_SseAssistedBinary;
-      case Iop_Max8Sx16:   fn = (HWord)h_generic_calc_Max8Sx16;
-                           goto do_SseAssistedBinary;
-      case Iop_Min8Sx16:   fn = (HWord)h_generic_calc_Min8Sx16;
-                           goto do_SseAssistedBinary;
-      case Iop_CmpEQ64x2:  fn = (HWord)h_generic_calc_CmpEQ64x2;
-                           goto do_SseAssistedBinary;
-      case Iop_CmpGT64Sx2: fn = (HWord)h_generic_calc_CmpGT64Sx2;
-                           goto do_SseAssistedBinary;
+      case Iop_Mul32x4:    op = Asse_MUL32;
+                           fn = (HWord)h_generic_calc_Mul32x4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max32Sx4:   op = Asse_MAX32S;
+                           fn = (HWord)h_generic_calc_Max32Sx4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min32Sx4:   op = Asse_MIN32S;
+                           fn = (HWord)h_generic_calc_Min32Sx4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max32Ux4:   op = Asse_MAX32U;
+                           fn = (HWord)h_generic_calc_Max32Ux4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min32Ux4:   op = Asse_MIN32U;
+                           fn = (HWord)h_generic_calc_Min32Ux4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max16Ux8:   op = Asse_MAX16U;
+                           fn = (HWord)h_generic_calc_Max16Ux8;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min16Ux8:   op = Asse_MIN16U;
+                           fn = (HWord)h_generic_calc_Min16Ux8;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max8Sx16:   op = Asse_MAX8S;
+                           fn = (HWord)h_generic_calc_Max8Sx16;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min8Sx16:   op = Asse_MIN8S;
+                           fn = (HWord)h_generic_calc_Min8Sx16;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_CmpEQ64x2:  op = Asse_CMPEQ64;
+                           fn = (HWord)h_generic_calc_CmpEQ64x2;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_CmpGT64Sx2: op = Asse_CMPGT64S;
+                           fn = (HWord)h_generic_calc_CmpGT64Sx2;
+                           goto do_Sse4OrAssistedBinary;
+      do_Sse4OrAssistedBinary:
+         /* SSE4.1 and SSE4.2 have no hwcaps of their own, but every host
+            with AVX has both. */
+         if (env->hwcaps & VEX_HWCAPS_AMD64_AVX)
+            goto do_SseReRg;
+         goto do_SseAssistedBinary;
       case Iop_Perm32x4:   fn = (HWord)h_generic_calc_Perm32x4;
                            goto do_SseAssistedBinary;
       case Iop_QNarrowBin32Sto16Ux8:
@@ -4235,28 +4252,44 @@ static void iselDVecExpr_wrk ( /*OUT*/HReg* rHi, /*OUT*/HReg* rLo,
          return;
       }
 
-      case Iop_Mul32x8:    fn = (HWord)h_generic_calc_Mul32x4;
-                           goto do_SseAssistedBinary;
-      case Iop_Max32Sx8:   fn = (HWord)h_generic_calc_Max32Sx4;
-                           goto do_SseAssistedBinary;
-      case Iop_Min32Sx8:   fn = (HWord)h_generic_calc_Min32Sx4;
-                           goto do_SseAssistedBinary;
-      case Iop_Max32Ux8:   fn = (HWord)h_generic_calc_Max32Ux4;
-                           goto do_SseAssistedBinary;
-      case Iop_Min32Ux8:   fn = (HWord)h_generic_calc_Min32Ux4;
-                           goto do_SseAssistedBinary;
-      case Iop_Max16Ux16:  fn = (HWord)h_generic_calc_Max16Ux8;
-                           goto do_SseAssistedBinary;
-      case Iop_Min16Ux16:  fn = (HWord)h_generic_calc_Min16Ux8;
-                           goto do_SseAssistedBinary;
-      case Iop_Max8Sx32:   fn = (HWord)h_generic_calc_Max8Sx16;
-                           goto do_SseAssistedBinary;
-      case Iop_Min8Sx32:   fn = (HWord)h_generic_calc_Min8Sx16;
-                           goto do_SseAssistedBinary;
-      case Iop_CmpEQ64x4:  fn = (HWord)h_generic_calc_CmpEQ64x2;
-                           goto do_SseAssistedBinary;
-      case Iop_CmpGT64Sx4: fn = (HWord)h_generic_calc_CmpGT64Sx2;
-                           goto do_SseAssistedBinary;
+      case Iop_Mul32x8:    op = Asse_MUL32;
+                           fn = (HWord)h_generic_calc_Mul32x4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max32Sx8:   op = Asse_MAX32S;
+                           fn = (HWord)h_generic_calc_Max32Sx4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min32Sx8:   op = Asse_MIN32S;
+                           fn = (HWord)h_generic_calc_Min32Sx4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max32Ux8:   op = Asse_MAX32U;
+                           fn = (HWord)h_generic_calc_Max32Ux4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min32Ux8:   op = Asse_MIN32U;
+                           fn = (HWord)h_generic_calc_Min32Ux4;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max16Ux16:  op = Asse_MAX16U;
+                           fn = (HWord)h_generic_calc_Max16Ux8;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min16Ux16:  op = Asse_MIN16U;
+                           fn = (HWord)h_generic_calc_Min16Ux8;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Max8Sx32:   op = Asse_MAX8S;
+                           fn = (HWord)h_generic_calc_Max8Sx16;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_Min8Sx32:   op = Asse_MIN8S;
+                           fn = (HWord)h_generic_calc_Min8Sx16;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_CmpEQ64x4:  op = Asse_CMPEQ64;
+                           fn = (HWord)h_generic_calc_CmpEQ64x2;
+                           goto do_Sse4OrAssistedBinary;
+      case Iop_CmpGT64Sx4: op = Asse_CMPGT64S;
+                           fn = (HWord)h_generic_calc_CmpGT64Sx2;
+                           goto do_Sse4OrAssistedBinary;
+      do_Sse4OrAssistedBinary:
+         /* See comment on the V128 case in iselVecExpr_wrk. */
+         if (env->hwcaps & VEX_HWCAPS_AMD64_AVX)
+            goto do_SseReRg;
+         goto do_SseAssistedBinary;
       do_SseAssistedBinary: {
          /* RRRufff!  RRRufff code is what we're generating here.  Oh
             well. */
@@ -953,12 +953,14 @@ HInstrArray* doRegisterAllocation_v3(
       /* ------------ Sanity checks ------------ */
 
       /* Sanity checks are relatively expensive. So they are done only once
-         every 17 instructions, and just before the last instruction. */
+         every 17 instructions, and just before the last instruction.  They
+         walk all the vregs, so in fast mode, where the block is huge, only
+         the last one is kept, or this would be quadratic. */
       Bool do_sanity_check
          = toBool(
               SANITY_CHECKS_EVERY_INSTR
               || ii == instrs_in->arr_used - 1
-              || (ii > 0 && (ii % 17) == 0)
+              || (!con->fast && ii > 0 && (ii % 17) == 0)
            );
 
       if (do_sanity_check) {
@@ -1330,8 +1332,26 @@ HInstrArray* doRegisterAllocation_v3(
       /* ------ Post-instruction actions. ------ */
       /* Free rregs which:
          - Have been reserved and whose hard live range ended.
-         - Have been bound to vregs whose live range ended. */
-      for (UInt r_idx = 0; r_idx < n_rregs; r_idx++) {
+         - Have been bound to vregs whose live range ended.
+         Both kinds of live range can only end at an instruction which
+         mentions the register, so in fast mode only the rregs that this
+         one mentions, directly or through its vregs, are looked at. */
+      ULong to_visit = ~0ULL;
+      if (con->fast) {
+         to_visit = reg_usage[ii].rRead | reg_usage[ii].rWritten;
+         for (UInt j = 0; j < reg_usage[ii].n_vRegs; j++) {
+            UInt v_idx = hregIndex(reg_usage[ii].vRegs[j]);
+            if (vreg_state[v_idx].disp == Assigned) {
+               to_visit |= 1ULL << hregIndex(vreg_state[v_idx].rreg);
+            }
+         }
+      }
+      if (n_rregs < 64) {
+         to_visit &= (1ULL << n_rregs) - 1;
+      }
+      while (to_visit != 0) {
+         UInt r_idx = ULong__minIndex(to_visit);
+         to_visit &= to_visit - 1;
          RRegState*   rreg     = &rreg_state[r_idx];
          RRegLRState* rreg_lrs = &rreg_lr_state[r_idx];
          switch (rreg->disp) {
@@ -503,6 +503,11 @@ typedef
 
       /* 32/64bit mode */
       Bool mode64;
+
+      /* Allocate a very large block quickly: fewer sanity checks, and
+         per-instruction work which does not grow with the number of
+         registers.  The code produced is the same.  Only honoured by v3. */
+      Bool fast;
    }
    RegAllocControl;
 
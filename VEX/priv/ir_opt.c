@@ -3930,13 +3930,37 @@ static AvailExpr* irExpr_to_AvailExpr ( IRExpr* e, Bool allowLoadsToBeCSEd )
 }
 
 
+/* Is this "Add/Sub(tmp, const)"?  On amd64 and x86 such an expression
+   usually ends up folded into the addressing mode of the load or store
+   that uses it, so commoning it up only costs a register. */
+static Bool isAddrArith ( const IRExpr* e )
+{
+   if (e->tag != Iex_Binop)
+      return False;
+   switch (e->Iex.Binop.op) {
+      case Iop_Add32: case Iop_Sub32: case Iop_Add64: case Iop_Sub64:
+         break;
+      default:
+         return False;
+   }
+   return e->Iex.Binop.arg1->tag == Iex_RdTmp
+          && e->Iex.Binop.arg2->tag == Iex_Const;
+}
+
 /* The BB is modified in-place.  Returns True if any changes were
    made.  The caller can choose whether or not loads should be CSEd.
    In the normal course of things we don't do that, since CSEing loads
    is something of a dodgy proposition if the guest program is doing
-   some screwy stuff to do with races and spinloops. */
+   some screwy stuff to do with races and spinloops.
 
-static Bool do_cse_BB ( IRSB* bb, Bool allowLoadsToBeCSEd )
+   |instrumented| tunes the pass for code that a tool has added helper
+   calls to: nothing is kept available across a dirty call, since the
+   call clobbers all the caller-saved registers and the value would
+   have to be spilled, and address arithmetic is left alone, as
+   described at isAddrArith. */
+
+static Bool do_cse_BB_wrk ( IRSB* bb, Bool allowLoadsToBeCSEd,
+                            Bool instrumented )
 {
    Int        i, j, paranoia;
    IRTemp     t, q;
@@ -4000,6 +4024,11 @@ static Bool do_cse_BB ( IRSB* bb, Bool allowLoadsToBeCSEd )
             if (!aenv->inuse[j])
                continue;
             ae = (AvailExpr*)aenv->key[j];
+            if (instrumented && st->tag == Ist_Dirty) {
+               aenv->inuse[j] = False;
+               aenv->key[j]   = (HWord)NULL;
+               continue;
+            }
             if (ae->tag != GetIt && ae->tag != Load) 
                continue;
             invalidate = False;
@@ -4054,6 +4083,9 @@ static Bool do_cse_BB ( IRSB* bb, Bool allowLoadsToBeCSEd )
       if (st->tag != Ist_WrTmp)
          continue;
 
+      if (instrumented && isAddrArith(st->Ist.WrTmp.data))
+         continue;
+
       t = st->Ist.WrTmp.tmp;
       eprime = irExpr_to_AvailExpr(st->Ist.WrTmp.data, allowLoadsToBeCSEd);
       /* ignore if not of AvailExpr form */
@@ -4095,6 +4127,17 @@ static Bool do_cse_BB ( IRSB* bb, Bool allowLoadsToBeCSEd )
    return anyDone;
 }
 
+static Bool do_cse_BB ( IRSB* bb, Bool allowLoadsToBeCSEd )
+{
+   return do_cse_BB_wrk( bb, allowLoadsToBeCSEd, False/*!instrumented*/ );
+}
+
+Bool do_cse_instrumented_BB ( IRSB* bb )
+{
+   return do_cse_BB_wrk( bb, False/*!allowLoadsToBeCSEd*/,
+                         True/*instrumented*/ );
+}
+
 
 /*---------------------------------------------------------------*/
 /*--- Add32/Sub32 chain collapsing                            ---*/
@@ -61,6 +61,12 @@ IRSB* cprop_BB ( IRSB* );
 extern
 void do_deadcode_BB ( IRSB* bb );
 
+/* Do a common subexpression elimination pass suited to instrumented
+   code.  Loads are not CSEd.  bb is destructively modified.  Returns
+   True if any changes were made. */
+extern
+Bool do_cse_instrumented_BB ( IRSB* bb );
+
 /* The tree-builder.  Make (approximately) maximal safe trees.  bb is
    destructively modified.  Returns (unrelatedly, but useful later on)
    the guest address of the highest addressed byte from any insn in
@@ -186,7 +186,9 @@ void LibVEX_default_VexControl ( /*OUT*/ VexControl* vcon )
    vcon->guest_max_insns                = 60;
    vcon->guest_chase_thresh             = 10;
    vcon->guest_chase_cond               = False;
+   vcon->guest_chase_cond_max           = 2;
    vcon->regalloc_version               = 3;
+   vcon->regalloc_fast_thresh           = 1000;
 }
 
 
@@ -226,7 +228,10 @@ void LibVEX_Init (
    vassert(vcon->guest_chase_thresh < vcon->guest_max_insns);
    vassert(vcon->guest_chase_cond == True 
            || vcon->guest_chase_cond == False);
+   vassert(vcon->guest_chase_cond_max >= 0);
+   vassert(vcon->guest_chase_cond_max <= 8);
    vassert(vcon->regalloc_version == 2 || vcon->regalloc_version == 3);
+   vassert(vcon->regalloc_fast_thresh >= 0);
 
    /* Check that Vex has been built with sizes of basic types as
       stated in priv/libvex_basictypes.h.  Failure of any of these is
@@ -308,6 +313,48 @@ void LibVEX_Init (
 UInt s390_host_hwcaps;
 
 
+/* Translation-time profiling.  'phase_t0' is the clock reading at
+   the end of the previous stage; each stage's time runs from there
+   to its own end, so nothing between stages goes unaccounted. */
+static ULong phase_t0;
+
+static inline void phase_start ( const VexTranslateArgs* vta )
+{
+   if (UNLIKELY(vta->phase_stats != NULL))
+      phase_t0 = vta->phase_clock();
+}
+
+/* Returns the stage's time, or zero if not profiling. */
+static inline ULong phase_end ( const VexTranslateArgs* vta, VexPhase ph )
+{
+   if (UNLIKELY(vta->phase_stats != NULL)) {
+      ULong now = vta->phase_clock();
+      ULong t   = now - phase_t0;
+      vta->phase_stats->count[ph]++;
+      vta->phase_stats->time[ph] += t;
+      phase_t0 = now;
+      return t;
+   }
+   return 0;
+}
+
+/* Exported to library client. */
+
+const HChar* LibVEX_ppVexPhase ( VexPhase ph )
+{
+   switch (ph) {
+      case VexPhase_Decode:     return "decode";
+      case VexPhase_Opt:        return "iropt";
+      case VexPhase_Instrument: return "instrument";
+      case VexPhase_Cleanup:    return "cleanup";
+      case VexPhase_Isel:       return "isel";
+      case VexPhase_RegAlloc:   return "regalloc";
+      case VexPhase_Assemble:   return "assemble";
+      default:                  return "VexPhase???";
+   }
+}
+
+
 /* Exported to library client. */
 
 IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
@@ -358,6 +405,8 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
       s390_host_hwcaps = vta->archinfo_host.hwcaps;
    }
 
+   phase_start(vta);
+
    /* First off, check that the guest and host insn sets
       are supported. */
 
@@ -580,6 +629,7 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
                      szB_GUEST_IP );
 
    vexAllocSanityCheck();
+   phase_end(vta, VexPhase_Decode);
 
    if (irsb == NULL) {
       /* Access failure. */
@@ -627,6 +677,7 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
    irsb = do_iropt_BB ( irsb, specHelper, preciseMemExnsFn, *pxControl,
                               vta->guest_bytes_addr,
                               vta->arch_guest );
+   phase_end(vta, VexPhase_Opt);
 
    // JRS 2016 Aug 03: Sanity checking is expensive, we already checked
    // the output of the front end, and iropt never screws up the IR by
@@ -660,7 +711,8 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
                               vta->guest_extents,
                               &vta->archinfo_host,
                               guest_word_type, host_word_type);
-      
+   phase_end(vta, VexPhase_Instrument);
+
    if (vex_traceflags & VEX_TRACE_INST) {
       vex_printf("\n------------------------" 
                    " After instrumentation "
@@ -680,9 +732,15 @@ IRSB* LibVEX_FrontEnd ( /*MOD*/ VexTranslateArgs* vta,
    if (vta->instrument1 || vta->instrument2) {
       do_deadcode_BB( irsb );
       irsb = cprop_BB( irsb );
+      /* Tools often recompute the same guard or shadow value several
+         times in one block.  Common those up, and propagate the copies
+         that leaves behind. */
+      if (vex_control.iropt_level > 0 && do_cse_instrumented_BB( irsb ))
+         irsb = cprop_BB( irsb );
       do_deadcode_BB( irsb );
       sanityCheckIRSB( irsb, "after post-instrumentation cleanup",
                        True/*must be flat*/, guest_word_type );
+      phase_end(vta, VexPhase_Cleanup);
    }
 
    vexAllocSanityCheck();
@@ -1056,6 +1114,7 @@ static void libvex_BackEnd ( const VexTranslateArgs *vta,
                     max_ga );
 
    vexAllocSanityCheck();
+   phase_end(vta, VexPhase_Isel);
 
    if (vex_traceflags & VEX_TRACE_VCODE)
       vex_printf("\n");
@@ -1074,7 +1133,9 @@ static void libvex_BackEnd ( const VexTranslateArgs *vta,
       .univ = rRegUniv, .getRegUsage = getRegUsage, .mapRegs = mapRegs,
       .genSpill = genSpill, .genReload = genReload, .genMove = genMove,
       .directReload = directReload, .guest_sizeB = guest_sizeB,
-      .ppInstr = ppInstr, .ppReg = ppReg, .mode64 = mode64};
+      .ppInstr = ppInstr, .ppReg = ppReg, .mode64 = mode64,
+      .fast = vex_control.regalloc_fast_thresh > 0
+              && vcode->arr_used >= vex_control.regalloc_fast_thresh};
    switch (vex_control.regalloc_version) {
    case 2:
       rcode = doRegisterAllocation_v2(vcode, &con);
@@ -1087,6 +1148,12 @@ static void libvex_BackEnd ( const VexTranslateArgs *vta,
    }
 
    vexAllocSanityCheck();
+   { ULong t = phase_end(vta, VexPhase_RegAlloc);
+     if (con.fast && vta->phase_stats != NULL) {
+        vta->phase_stats->ra_fast_count++;
+        vta->phase_stats->ra_fast_time += t;
+     }
+   }
 
    if (vex_traceflags & VEX_TRACE_RCODE) {
       vex_printf("\n------------------------" 
@@ -1156,6 +1223,7 @@ static void libvex_BackEnd ( const VexTranslateArgs *vta,
    *(vta->host_bytes_used) = out_used;
 
    vexAllocSanityCheck();
+   phase_end(vta, VexPhase_Assemble);
 
    vexSetAllocModeTEMP_and_clear();
 
@@ -516,13 +516,25 @@ typedef
          successor. A setting of zero disables chasing.  */
       Int guest_chase_thresh;
       /* EXPERIMENTAL: chase across conditional branches?  Not all
-         front ends honour this.  Default: NO. */
+         front ends honour this.  Default: NO.  Unlike unconditional
+         chasing, this is not limited by guest_chase_thresh. */
       Bool guest_chase_cond;
+      /* If guest_chase_cond is set, how many conditional branches
+         may be chased in one superblock?  Each leaves a side exit.
+         Default=2. */
+      Int guest_chase_cond_max;
       /* Register allocator version. Allowed values are:
          - '2': previous, good and slow implementation.
          - '3': current, faster implementation; perhaps producing slightly worse
                 spilling decisions. */
       UInt regalloc_version;
+      /* Blocks of at least this many host insns (before allocation) are
+         register-allocated in a faster mode, which does fewer of its
+         periodic sanity checks.  It matters for big, heavily instrumented
+         blocks, where those checks make allocation time grow with the
+         square of the block size.  Only honoured by version 3.
+         Default=1000.  A setting of zero disables it. */
+      Int regalloc_fast_thresh;
    }
    VexControl;
 
@@ -673,6 +685,37 @@ typedef
    VexGuestExtents;
 
 
+/* The stages of the compilation pipeline, for translation-time
+   profiling (see 'phase_stats' in VexTranslateArgs). */
+typedef
+   enum {
+      VexPhase_Decode=0,  /* guest code to IR */
+      VexPhase_Opt,       /* pre-instrumentation IR optimisation */
+      VexPhase_Instrument,/* the instrument1/instrument2 callbacks */
+      VexPhase_Cleanup,   /* post-instrumentation IR optimisation */
+      VexPhase_Isel,      /* instruction selection */
+      VexPhase_RegAlloc,  /* register allocation */
+      VexPhase_Assemble,  /* assembly into the output buffer */
+      VexPhase_N
+   }
+   VexPhase;
+
+/* Accumulated per-stage counts and times.  Owned by the caller, and
+   only ever added to by Vex. */
+typedef
+   struct {
+      ULong count[VexPhase_N];
+      ULong time[VexPhase_N];
+      /* The register allocations done in fast mode (see
+         regalloc_fast_thresh), and their part of time[VexPhase_RegAlloc]. */
+      ULong ra_fast_count;
+      ULong ra_fast_time;
+   }
+   VexPhaseStats;
+
+extern const HChar* LibVEX_ppVexPhase ( VexPhase );
+
+
 /* A structure to carry arguments for LibVEX_Translate.  There are so
    many of them, it seems better to have a structure. */
 typedef
@@ -769,6 +812,15 @@ typedef
          translation? */
       Bool    addProfInc;
 
+      /* IN: profiling: if 'phase_stats' is non-NULL, the time spent
+         in each stage of the pipeline, as measured by 'phase_clock',
+         is accumulated into it, together with a count of the number
+         of times each stage ran.  The clock's units are up to the
+         caller.  'phase_clock' is ignored if 'phase_stats' is
+         NULL. */
+      ULong   (*phase_clock)(void);
+      VexPhaseStats* phase_stats;
+
       /* IN: address of the dispatcher entry points.  Describes the
          places where generated code should jump to at the end of each
          bb.
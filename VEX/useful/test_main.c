@@ -264,6 +264,8 @@ int main ( int argc, char** argv )
       vta.preamble_function = NULL;
       vta.traceflags      = TEST_FLAGS;
       vta.addProfInc      = False;
+      vta.phase_clock     = NULL;
+      vta.phase_stats     = NULL;
       vta.sigill_diag     = True;
 
       vta.disp_cp_chain_me_to_slowEP = (void*)0x12345678;
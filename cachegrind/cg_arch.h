@@ -52,6 +52,13 @@ Bool VG_(str_clo_cache_opt)(const HChar *arg,
                             cache_t* clo_D1c,
                             cache_t* clo_LLc);
 
+// Parses optval, the "<size>,<assoc>,<line_size>" argument of the cache
+// option opt, into *cache.  Exits with an error if it is malformed or
+// describes a cache the simulator cannot handle.  For cache levels that
+// only some tools simulate, and so are not known to VG_(str_clo_cache_opt).
+void VG_(parse_cache_opt)(cache_t* cache, const HChar* opt,
+                          const HChar* optval);
+
 // Checks the correctness of the auto-detected caches.
 // If a cache has been configured by command line options, it
 // replaces the equivalent auto-detected cache.
@@ -0,0 +1,72 @@
+
+/*--------------------------------------------------------------------*/
+/*--- The binary cachegrind.out format.                cg_binfmt.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Cachegrind, a Valgrind tool for cache
+   profiling programs.
+
+   Copyright (C) 2002-2017 Nicholas Nethercote
+      njn@valgrind.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __CG_BINFMT_H
+#define __CG_BINFMT_H
+
+// Written by Cachegrind with --cachegrind-out-format=binary, and read and
+// written by cg_merge.  It holds exactly what the text format holds, but
+// file and function names are stored once each and the counts are
+// varints, so files are several times smaller and much quicker to parse.
+//
+// All integers are unsigned LEB128 varints.  A string is a varint length
+// followed by that many bytes, with no terminating NUL.  The layout is:
+//
+//    magic       the 8 bytes of CG_BIN_MAGIC
+//    n_desc      varint, followed by n_desc strings: the "desc:" lines
+//    cmd         string: the "cmd:" line
+//    events      string: the "events:" line
+//    n_events    varint: the number of counts on each line
+//    records     each starts with one of the tag bytes below
+//
+// Line records give the line number as a zig-zag coded delta from the
+// previous line record of the same function, which is small since lines
+// are written in ascending order.
+
+#define CG_BIN_MAGIC       "cgbin01\n"
+#define CG_BIN_MAGIC_LEN   8
+
+// n_events varints: the summary counts.  Always the last record.
+#define CG_BIN_END    0
+// A string, which gets the next string number, starting from zero.
+#define CG_BIN_STR    1
+// A string number: the file of the following lines.
+#define CG_BIN_FL     2
+// A string number: the function of the following lines.  Resets the
+// line number used for line deltas to zero.
+#define CG_BIN_FN     3
+// A varint line delta, then n_events varint counts.
+#define CG_BIN_LINE   4
+
+#endif   // __CG_BINFMT_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -39,12 +39,15 @@
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
 #include "pub_tool_oset.h"
+#include "pub_tool_threadstate.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_xarray.h"
+#include "pub_tool_wordfm.h"
 #include "pub_tool_clientstate.h"
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
 
 #include "cg_arch.h"
+#include "cg_binfmt.h"
 #include "cg_sim.c"
 #include "cg_branchpred.c"
 
@@ -61,7 +64,11 @@
 
 static Bool  clo_cache_sim  = True;  /* do cache simulation? */
 static Bool  clo_branch_sim = False; /* do branch simulation? */
+static Bool  clo_cache_threads = False; /* private L1s per thread? */
+static Int   clo_prefetch = PREFETCH_NONE;
+static Long  clo_prefetch_degree = 2;
 static const HChar* clo_cachegrind_out_file = "cachegrind.out.%p";
+static Bool  clo_binary_out = False; /* --cachegrind-out-format=binary? */
 
 /*------------------------------------------------------------*/
 /*--- Cachesim configuration                               ---*/
@@ -77,7 +84,8 @@ typedef
    struct {
       ULong a;  /* total # memory accesses of this kind */
       ULong m1; /* misses in the first level cache */
-      ULong mL; /* misses in the second level cache */
+      ULong mM; /* misses in the mid-level cache, if any */
+      ULong mL; /* misses in the last level cache */
    }
    CacheCC;
 
@@ -109,6 +117,7 @@ typedef struct {
    CacheCC  Dw;  /* Data write/modify counts */
    BranchCC Bc;  /* Conditional branch counts */
    BranchCC Bi;  /* Indirect branch counts */
+   SimCC    Dx;  /* Counts of the optional simulation models */
 } LineCC;
 
 // First compare file, then fn, then line.
@@ -269,17 +278,23 @@ static LineCC* get_lineCC(Addr origAddr)
       lineCC->loc.line = loc.line;
       lineCC->Ir.a     = 0;
       lineCC->Ir.m1    = 0;
+      lineCC->Ir.mM    = 0;
       lineCC->Ir.mL    = 0;
       lineCC->Dr.a     = 0;
       lineCC->Dr.m1    = 0;
+      lineCC->Dr.mM    = 0;
       lineCC->Dr.mL    = 0;
       lineCC->Dw.a     = 0;
       lineCC->Dw.m1    = 0;
+      lineCC->Dw.mM    = 0;
       lineCC->Dw.mL    = 0;
       lineCC->Bc.b     = 0;
       lineCC->Bc.mp    = 0;
       lineCC->Bi.b     = 0;
       lineCC->Bi.mp    = 0;
+      lineCC->Dx.coh   = 0;
+      lineCC->Dx.pf    = 0;
+      lineCC->Dx.pfc   = 0;
       VG_(OSetGen_Insert)(CC_table, lineCC);
    }
 
@@ -334,7 +349,8 @@ void log_1IrGen_0D_cache_access(InstrInfo* n)
    //VG_(printf)("1IrGen_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
    //             n, n->instr_addr, n->instr_len);
    cachesim_I1_doref_Gen(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.mM,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 }
 
@@ -344,7 +360,8 @@ void log_1IrNoX_0D_cache_access(InstrInfo* n)
    //VG_(printf)("1IrNoX_0D :  CCaddr=0x%010lx,  iaddr=0x%010lx,  isize=%lu\n",
    //             n, n->instr_addr, n->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.mM,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 }
 
@@ -356,10 +373,12 @@ void log_2IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2)
    //            n,  n->instr_addr,  n->instr_len,
    //            n2, n2->instr_addr, n2->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.mM,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
    cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
+			 &n2->parent->Ir.m1, &n2->parent->Ir.mM,
+			 &n2->parent->Ir.mL);
    n2->parent->Ir.a++;
 }
 
@@ -373,13 +392,16 @@ void log_3IrNoX_0D_cache_access(InstrInfo* n, InstrInfo* n2, InstrInfo* n3)
    //            n2, n2->instr_addr, n2->instr_len,
    //            n3, n3->instr_addr, n3->instr_len);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.mM,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
    cachesim_I1_doref_NoX(n2->instr_addr, n2->instr_len,
-			 &n2->parent->Ir.m1, &n2->parent->Ir.mL);
+			 &n2->parent->Ir.m1, &n2->parent->Ir.mM,
+			 &n2->parent->Ir.mL);
    n2->parent->Ir.a++;
    cachesim_I1_doref_NoX(n3->instr_addr, n3->instr_len,
-			 &n3->parent->Ir.m1, &n3->parent->Ir.mL);
+			 &n3->parent->Ir.m1, &n3->parent->Ir.mM,
+			 &n3->parent->Ir.mL);
    n3->parent->Ir.a++;
 }
 
@@ -390,11 +412,13 @@ void log_1IrNoX_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    //            "                               daddr=0x%010lx,  dsize=%lu\n",
    //            n, n->instr_addr, n->instr_len, data_addr, data_size);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.mM,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+   cachesim_D1_doref(n->instr_addr, data_addr, data_size, /*is_write*/False,
+                     &n->parent->Dr.m1, &n->parent->Dr.mM, &n->parent->Dr.mL,
+                     &n->parent->Dx);
    n->parent->Dr.a++;
 }
 
@@ -405,11 +429,13 @@ void log_1IrNoX_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
    //            "                               daddr=0x%010lx,  dsize=%lu\n",
    //            n, n->instr_addr, n->instr_len, data_addr, data_size);
    cachesim_I1_doref_NoX(n->instr_addr, n->instr_len,
-			 &n->parent->Ir.m1, &n->parent->Ir.mL);
+			 &n->parent->Ir.m1, &n->parent->Ir.mM,
+			 &n->parent->Ir.mL);
    n->parent->Ir.a++;
 
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+   cachesim_D1_doref(n->instr_addr, data_addr, data_size, /*is_write*/True,
+                     &n->parent->Dw.m1, &n->parent->Dw.mM, &n->parent->Dw.mL,
+                     &n->parent->Dx);
    n->parent->Dw.a++;
 }
 
@@ -421,8 +447,9 @@ void log_0Ir_1Dr_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
    //VG_(printf)("0Ir_1Dr:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
    //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dr.m1, &n->parent->Dr.mL);
+   cachesim_D1_doref(n->instr_addr, data_addr, data_size, /*is_write*/False,
+                     &n->parent->Dr.m1, &n->parent->Dr.mM, &n->parent->Dr.mL,
+                     &n->parent->Dx);
    n->parent->Dr.a++;
 }
 
@@ -432,8 +459,9 @@ void log_0Ir_1Dw_cache_access(InstrInfo* n, Addr data_addr, Word data_size)
 {
    //VG_(printf)("0Ir_1Dw:  CCaddr=0x%010lx,  daddr=0x%010lx,  dsize=%lu\n",
    //            n, data_addr, data_size);
-   cachesim_D1_doref(data_addr, data_size, 
-                     &n->parent->Dw.m1, &n->parent->Dw.mL);
+   cachesim_D1_doref(n->instr_addr, data_addr, data_size, /*is_write*/True,
+                     &n->parent->Dw.m1, &n->parent->Dw.mM, &n->parent->Dw.mL,
+                     &n->parent->Dx);
    n->parent->Dw.a++;
 }
 
@@ -504,6 +532,7 @@ typedef
    enum { 
       Ev_IrNoX,  // Instruction read not crossing cache lines
       Ev_IrGen,  // Generic Ir, not being detected as IrNoX
+      Ev_IrHit,  // IrNoX known to hit I1, see addEvent_Ir
       Ev_Dr,     // Data read
       Ev_Dw,     // Data write
       Ev_Dm,     // Data modify (read then write)
@@ -521,6 +550,8 @@ typedef
          } IrGen;
          struct {
          } IrNoX;
+         struct {
+         } IrHit;
          struct {
             IRAtom* ea;
             Int     szB;
@@ -589,6 +620,10 @@ typedef
 
       /* The output SB being constructed. */
       IRSB* sbOut;
+
+      /* I1 line of the last instruction fetch so far in the SB. */
+      Bool  have_iline;
+      UWord iline;
    }
    CgState;
 
@@ -641,6 +676,9 @@ static void showEvent ( Event* ev )
       case Ev_IrNoX:
          VG_(printf)("IrNoX %p\n", ev->inode);
          break;
+      case Ev_IrHit:
+         VG_(printf)("IrHit %p\n", ev->inode);
+         break;
       case Ev_Dr:
          VG_(printf)("Dr %p %d EA=", ev->inode, ev->Ev.Dr.szB);
          ppIRExpr(ev->Ev.Dr.ea); 
@@ -688,6 +726,30 @@ InstrInfo* setup_InstrInfo ( CgState* cgs, Addr instr_addr, UInt instr_len )
 }
 
 
+#if defined(VG_BIGENDIAN)
+# define CGEndness Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+# define CGEndness Iend_LE
+#else
+# error "Unknown endianness"
+#endif
+
+/* Generate IR to increment the Ir count of inode's line. */
+static void addInlineIrCount ( CgState* cgs, InstrInfo* inode )
+{
+   IRExpr* addr = mkIRExpr_HWord( (HWord)&inode->parent->Ir.a );
+   IRTemp  t1   = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+   IRTemp  t2   = newIRTemp(cgs->sbOut->tyenv, Ity_I64);
+
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(t1, IRExpr_Load(CGEndness, Ity_I64, addr)) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_WrTmp(t2, IRExpr_Binop(Iop_Add64, IRExpr_RdTmp(t1),
+                                                IRExpr_Const(IRConst_U64(1)))) );
+   addStmtToIRSB( cgs->sbOut,
+                  IRStmt_Store(CGEndness, addr, IRExpr_RdTmp(t2)) );
+}
+
 /* Generate code for all outstanding memory events, and mark the queue
    empty.  Code is generated into cgs->bbOut, and this activity
    'consumes' slots in cgs->sbInfo. */
@@ -808,6 +870,11 @@ static void flushEvents ( CgState* cgs )
                i++;
             }
             break;
+         case Ev_IrHit:
+            /* Just count it, inline. */
+            addInlineIrCount( cgs, ev->inode );
+            i++;
+            continue;
          case Ev_IrGen:
             if (clo_cache_sim) {
 	       helperName = "log_1IrGen_0D_cache_access";
@@ -874,22 +941,38 @@ static void flushEvents ( CgState* cgs )
    cgs->events_used = 0;
 }
 
+/* Only instruction fetches touch I1, a fetch leaves its line in the MRU
+   way of its set, and no other thread can run in the middle of a
+   superblock.  So a fetch from the I1 line of the previous fetch in the
+   same superblock is bound to hit: it is an Ev_IrHit, which is just
+   counted inline, without a call to the simulator.  An IrGen leaves
+   both of its lines MRU, and the second one is remembered. */
 static void addEvent_Ir ( CgState* cgs, InstrInfo* inode )
 {
    Event* evt;
+   UWord  first_line = inode->instr_addr >> I1.line_size_bits;
+   UWord  last_line  = (inode->instr_addr + inode->instr_len - 1)
+                       >> I1.line_size_bits;
+
    if (cgs->events_used == N_EVENTS)
       flushEvents(cgs);
    tl_assert(cgs->events_used >= 0 && cgs->events_used < N_EVENTS);
    evt = &cgs->events[cgs->events_used];
    init_Event(evt);
    evt->inode    = inode;
-   if (cachesim_is_IrNoX(inode->instr_addr, inode->instr_len)) {
+   if (clo_cache_sim && cgs->have_iline
+       && first_line == cgs->iline && last_line == cgs->iline) {
+      evt->tag = Ev_IrHit;
+      distinct_instrsNoX++;
+   } else if (cachesim_is_IrNoX(inode->instr_addr, inode->instr_len)) {
       evt->tag = Ev_IrNoX;
       distinct_instrsNoX++;
    } else {
       evt->tag = Ev_IrGen;
       distinct_instrsGen++;
    }
+   cgs->have_iline = True;
+   cgs->iline      = last_line;
    cgs->events_used++;
 }
 
@@ -1087,6 +1170,8 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
    cgs.events_used = 0;
    cgs.sbInfo      = get_SB_info(sbIn, (Addr)closure->readdr);
    cgs.sbInfo_i    = 0;
+   cgs.have_iline  = False;
+   cgs.iline       = 0;
 
    if (DEBUG_CG)
       VG_(printf)("\n\n---------- cg_instrument ----------\n");
@@ -1359,6 +1444,7 @@ IRSB* cg_instrument ( VgCallbackClosure* closure,
 static cache_t clo_I1_cache = UNDEFINED_CACHE;
 static cache_t clo_D1_cache = UNDEFINED_CACHE;
 static cache_t clo_LL_cache = UNDEFINED_CACHE;
+static cache_t clo_ML_cache = UNDEFINED_CACHE;
 
 /*------------------------------------------------------------*/
 /*--- cg_fini() and related function                       ---*/
@@ -1371,14 +1457,153 @@ static CacheCC  Dr_total;
 static CacheCC  Dw_total;
 static BranchCC Bc_total;
 static BranchCC Bi_total;
+static SimCC    Dx_total;
+
+// The most counts a line can have: Ir, the 8 other cache counts, the 4
+// branch counts, and the 6 counts of the optional cache levels and models.
+#define MAX_LINE_COUNTS 19
+
+// Gather the counts of one line, or of the totals, in the order given by
+// the "events:" line.  Returns the number of counts.
+static Int gather_counts(ULong* cc, const CacheCC* Ir, const CacheCC* Dr,
+                         const CacheCC* Dw, const BranchCC* Bc,
+                         const BranchCC* Bi, const SimCC* Dx)
+{
+   Int n = 0;
+
+   cc[n++] = Ir->a;
+   if (clo_cache_sim) {
+      cc[n++] = Ir->m1;  cc[n++] = Ir->mL;
+      cc[n++] = Dr->a;   cc[n++] = Dr->m1;  cc[n++] = Dr->mL;
+      cc[n++] = Dw->a;   cc[n++] = Dw->m1;  cc[n++] = Dw->mL;
+   }
+   if (clo_branch_sim) {
+      cc[n++] = Bc->b;   cc[n++] = Bc->mp;
+      cc[n++] = Bi->b;   cc[n++] = Bi->mp;
+   }
+   // The optional cache levels and models follow the standard events.
+   if (clo_cache_sim) {
+      if (clo_ML_cache.size != -1) {
+         cc[n++] = Ir->mM;  cc[n++] = Dr->mM;  cc[n++] = Dw->mM;
+      }
+      if (clo_prefetch != PREFETCH_NONE) {
+         cc[n++] = Dx->pf;  cc[n++] = Dx->pfc;
+      }
+      if (clo_cache_threads)
+         cc[n++] = Dx->coh;
+   }
+   tl_assert(n <= MAX_LINE_COUNTS);
+   return n;
+}
+
+static void fprint_counts(VgFile* fp, const ULong* cc, Int n)
+{
+   Int i;
+   for (i = 0; i < n; i++)
+      VG_(fprintf)(fp, " %llu", cc[i]);
+   VG_(fprintf)(fp, "\n");
+}
+
+/*------------------------------------------------------------*/
+/*--- Binary output (see cg_binfmt.h)                      ---*/
+/*------------------------------------------------------------*/
+
+typedef struct {
+   Int   fd;
+   Bool  failed;
+   Int   used;
+   UWord n_strs;
+   UChar buf[65536];
+} BinOut;
+
+static BinOut bin_out;
+
+static void bin_flush(BinOut* b)
+{
+   Int done = 0;
+   while (!b->failed && done < b->used) {
+      Int n = VG_(write)(b->fd, b->buf + done, b->used - done);
+      if (n <= 0)
+         b->failed = True;
+      else
+         done += n;
+   }
+   b->used = 0;
+}
+
+static void bin_bytes(BinOut* b, const void* p, Int len)
+{
+   const UChar* s = p;
+   while (len > 0) {
+      Int n = sizeof(b->buf) - b->used;
+      if (n == 0) {
+         bin_flush(b);
+         n = sizeof(b->buf);
+      }
+      if (n > len)
+         n = len;
+      VG_(memcpy)(b->buf + b->used, s, n);
+      b->used += n;
+      s       += n;
+      len     -= n;
+   }
+}
+
+static void bin_varint(BinOut* b, ULong u)
+{
+   // At most 10 bytes;  flush first if they might not fit.
+   if (b->used + 10 > sizeof(b->buf))
+      bin_flush(b);
+   while (u >= 0x80) {
+      b->buf[b->used++] = (UChar)(u | 0x80);
+      u >>= 7;
+   }
+   b->buf[b->used++] = (UChar)u;
+}
+
+static void bin_string(BinOut* b, const HChar* s)
+{
+   Int len = VG_(strlen)(s);
+   bin_varint(b, len);
+   bin_bytes(b, s, len);
+}
+
+static void bin_counts(BinOut* b, const ULong* cc, Int n)
+{
+   Int i;
+   for (i = 0; i < n; i++)
+      bin_varint(b, cc[i]);
+}
+
+// Files and functions are both stored in the string table, which maps
+// each string (by address, since they are unique) to its number.
+static UWord bin_string_num(BinOut* b, WordFM* nums, const HChar* s)
+{
+   UWord num;
+   if (!VG_(lookupFM)(nums, NULL, &num, (UWord)s)) {
+      num = b->n_strs++;
+      VG_(addToFM)(nums, (UWord)s, num);
+      bin_varint(b, CG_BIN_STR);
+      bin_string(b, s);
+   }
+   return num;
+}
+
+/*------------------------------------------------------------*/
 
 static void fprint_CC_table_and_calc_totals(void)
 {
-   Int     i;
-   VgFile  *fp;
+   Int     i, n;
+   VgFile  *fp = NULL;
+   BinOut  *b = &bin_out;
+   WordFM  *nums = NULL;
    HChar   *currFile = NULL;
    const HChar *currFn = NULL;
+   Int     prevLine = 0;
    LineCC* lineCC;
+   ULong   cc[MAX_LINE_COUNTS];
+   HChar   desc[3 + (sizeof(LL.desc_line) + 32)];
+   HChar   events[256];
 
    // Setup output filename.  Nb: it's important to do this now, ie. as late
    // as possible.  If we do it at start-up and the program forks and the
@@ -1388,9 +1613,22 @@ static void fprint_CC_table_and_calc_totals(void)
    HChar* cachegrind_out_file =
       VG_(expand_file_name)("--cachegrind-out-file", clo_cachegrind_out_file);
 
-   fp = VG_(fopen)(cachegrind_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
-                                        VKI_S_IRUSR|VKI_S_IWUSR);
-   if (fp == NULL) {
+   if (clo_binary_out) {
+      SysRes sres = VG_(open)(cachegrind_out_file,
+                              VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                              VKI_S_IRUSR|VKI_S_IWUSR);
+      if (!sr_isError(sres)) {
+         b->fd     = sr_Res(sres);
+         b->failed = False;
+         b->used   = 0;
+         b->n_strs = 0;
+         nums = VG_(newFM)(VG_(malloc), "cg.fprint.1", VG_(free), NULL);
+      }
+   } else {
+      fp = VG_(fopen)(cachegrind_out_file, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                                           VKI_S_IRUSR|VKI_S_IWUSR);
+   }
+   if (fp == NULL && nums == NULL) {
       // If the file can't be opened for whatever reason (conflict
       // between multiple cachegrinded processes?), give up now.
       VG_(umsg)("error: can't open cache simulation output file '%s'\n",
@@ -1398,37 +1636,85 @@ static void fprint_CC_table_and_calc_totals(void)
       VG_(umsg)("       ... so simulation results will be missing.\n");
       VG_(free)(cachegrind_out_file);
       return;
-   } else {
-      VG_(free)(cachegrind_out_file);
    }
 
    // "desc:" lines (giving I1/D1/LL cache configuration).  The spaces after
    // the 2nd colon makes cg_annotate's output look nicer.
-   VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
-                     "desc: D1 cache:         %s\n"
-                     "desc: LL cache:         %s\n",
-                     I1.desc_line, D1.desc_line, LL.desc_line);
+   if (fp) {
+      VG_(fprintf)(fp,  "desc: I1 cache:         %s\n"
+                        "desc: D1 cache:         %s\n"
+                        "desc: LL cache:         %s\n",
+                        I1.desc_line, D1.desc_line, LL.desc_line);
+      if (ML_enabled)
+         VG_(fprintf)(fp, "desc: ML cache:         %s\n", ML.desc_line);
+   } else {
+      bin_bytes(b, CG_BIN_MAGIC, CG_BIN_MAGIC_LEN);
+      bin_varint(b, ML_enabled ? 4 : 3);
+      VG_(sprintf)(desc, "desc: I1 cache:         %s", I1.desc_line);
+      bin_string(b, desc);
+      VG_(sprintf)(desc, "desc: D1 cache:         %s", D1.desc_line);
+      bin_string(b, desc);
+      VG_(sprintf)(desc, "desc: LL cache:         %s", LL.desc_line);
+      bin_string(b, desc);
+      if (ML_enabled) {
+         VG_(sprintf)(desc, "desc: ML cache:         %s", ML.desc_line);
+         bin_string(b, desc);
+      }
+   }
 
    // "cmd:" line
-   VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
-   for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
-      HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
-      VG_(fprintf)(fp, " %s", arg);
+   if (fp) {
+      VG_(fprintf)(fp, "cmd: %s", VG_(args_the_exename));
+      for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+         HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+         VG_(fprintf)(fp, " %s", arg);
+      }
+      VG_(fprintf)(fp, "\n");
+   } else {
+      Int len = 5 + VG_(strlen)(VG_(args_the_exename));
+      for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+         HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+         len += 1 + VG_(strlen)(arg);
+      }
+      bin_varint(b, len);
+      bin_bytes(b, "cmd: ", 5);
+      bin_bytes(b, VG_(args_the_exename), VG_(strlen)(VG_(args_the_exename)));
+      for (i = 0; i < VG_(sizeXA)( VG_(args_for_client) ); i++) {
+         HChar* arg = * (HChar**) VG_(indexXA)( VG_(args_for_client), i );
+         bin_bytes(b, " ", 1);
+         bin_bytes(b, arg, VG_(strlen)(arg));
+      }
    }
+
    // "events:" line
    if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "Bc Bcm Bi Bim\n");
+      VG_(strcpy)(events, "events: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
+                          "Bc Bcm Bi Bim");
    }
    else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw "
-                                  "\n");
+      VG_(strcpy)(events, "events: Ir I1mr ILmr Dr D1mr DLmr Dw D1mw DLmw ");
    }
    else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp, "\nevents: Ir Bc Bcm Bi Bim\n");
+      VG_(strcpy)(events, "events: Ir Bc Bcm Bi Bim");
    }
    else {
-      VG_(fprintf)(fp, "\nevents: Ir\n");
+      VG_(strcpy)(events, "events: Ir");
+   }
+   if (clo_cache_sim) {
+      if (clo_ML_cache.size != -1)
+         VG_(strcat)(events, " IMmr DMmr DMmw");
+      if (clo_prefetch != PREFETCH_NONE)
+         VG_(strcat)(events, " Pf Pfc");
+      if (clo_cache_threads)
+         VG_(strcat)(events, " D1mc");
+   }
+   n = gather_counts(cc, &Ir_total, &Dr_total, &Dw_total,
+                     &Bc_total, &Bi_total, &Dx_total);
+   if (fp) {
+      VG_(fprintf)(fp, "%s\n", events);
+   } else {
+      bin_string(b, events);
+      bin_varint(b, n);
    }
 
    // Traverse every lineCC
@@ -1442,7 +1728,13 @@ static void fprint_CC_table_and_calc_totals(void)
       // the whole strings would have to be checked.
       if ( lineCC->loc.file != currFile ) {
          currFile = lineCC->loc.file;
-         VG_(fprintf)(fp, "fl=%s\n", currFile);
+         if (fp) {
+            VG_(fprintf)(fp, "fl=%s\n", currFile);
+         } else {
+            UWord num = bin_string_num(b, nums, currFile);
+            bin_varint(b, CG_BIN_FL);
+            bin_varint(b, num);
+         }
          distinct_files++;
          just_hit_a_new_file = True;
       }
@@ -1452,44 +1744,29 @@ static void fprint_CC_table_and_calc_totals(void)
       // in the old file, hence the just_hit_a_new_file test).
       if ( just_hit_a_new_file || lineCC->loc.fn != currFn ) {
          currFn = lineCC->loc.fn;
-         VG_(fprintf)(fp, "fn=%s\n", currFn);
+         if (fp) {
+            VG_(fprintf)(fp, "fn=%s\n", currFn);
+         } else {
+            UWord num = bin_string_num(b, nums, currFn);
+            bin_varint(b, CG_BIN_FN);
+            bin_varint(b, num);
+            prevLine = 0;
+         }
          distinct_fns++;
       }
 
       // Print the LineCC
-      if (clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL,
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else if (clo_cache_sim && !clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu %llu %llu"
-                             " %llu %llu %llu"
-                             " %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, lineCC->Ir.m1, lineCC->Ir.mL, 
-                            lineCC->Dr.a, lineCC->Dr.m1, lineCC->Dr.mL,
-                            lineCC->Dw.a, lineCC->Dw.m1, lineCC->Dw.mL);
-      }
-      else if (!clo_cache_sim && clo_branch_sim) {
-         VG_(fprintf)(fp,  "%d %llu"
-                             " %llu %llu %llu %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a, 
-                            lineCC->Bc.b, lineCC->Bc.mp, 
-                            lineCC->Bi.b, lineCC->Bi.mp);
-      }
-      else {
-         VG_(fprintf)(fp,  "%d %llu\n",
-                            lineCC->loc.line,
-                            lineCC->Ir.a);
+      n = gather_counts(cc, &lineCC->Ir, &lineCC->Dr, &lineCC->Dw,
+                        &lineCC->Bc, &lineCC->Bi, &lineCC->Dx);
+      if (fp) {
+         VG_(fprintf)(fp, "%d", lineCC->loc.line);
+         fprint_counts(fp, cc, n);
+      } else {
+         Long delta = (Long)lineCC->loc.line - prevLine;
+         bin_varint(b, CG_BIN_LINE);
+         bin_varint(b, ((ULong)delta << 1) ^ (ULong)(delta >> 63));
+         bin_counts(b, cc, n);
+         prevLine = lineCC->loc.line;
       }
 
       // Update summary stats
@@ -1506,48 +1783,35 @@ static void fprint_CC_table_and_calc_totals(void)
       Bc_total.mp += lineCC->Bc.mp;
       Bi_total.b  += lineCC->Bi.b;
       Bi_total.mp += lineCC->Bi.mp;
+      Ir_total.mM += lineCC->Ir.mM;
+      Dr_total.mM += lineCC->Dr.mM;
+      Dw_total.mM += lineCC->Dw.mM;
+      Dx_total.coh += lineCC->Dx.coh;
+      Dx_total.pf  += lineCC->Dx.pf;
+      Dx_total.pfc += lineCC->Dx.pfc;
 
       distinct_lines++;
    }
 
    // Summary stats must come after rest of table, since we calculate them
    // during traversal.  */
-   if (clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else if (clo_cache_sim && !clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu"
-                        " %llu %llu %llu\n",
-                        Ir_total.a, Ir_total.m1, Ir_total.mL,
-                        Dr_total.a, Dr_total.m1, Dr_total.mL,
-                        Dw_total.a, Dw_total.m1, Dw_total.mL);
-   }
-   else if (!clo_cache_sim && clo_branch_sim) {
-      VG_(fprintf)(fp,  "summary:"
-                        " %llu"
-                        " %llu %llu %llu %llu\n", 
-                        Ir_total.a,
-                        Bc_total.b, Bc_total.mp, 
-                        Bi_total.b, Bi_total.mp);
-   }
-   else {
-      VG_(fprintf)(fp, "summary:"
-                        " %llu\n", 
-                        Ir_total.a);
+   n = gather_counts(cc, &Ir_total, &Dr_total, &Dw_total,
+                     &Bc_total, &Bi_total, &Dx_total);
+   if (fp) {
+      VG_(fprintf)(fp, "summary:");
+      fprint_counts(fp, cc, n);
+      VG_(fclose)(fp);
+   } else {
+      bin_varint(b, CG_BIN_END);
+      bin_counts(b, cc, n);
+      bin_flush(b);
+      VG_(close)(b->fd);
+      VG_(deleteFM)(nums, NULL, NULL);
+      if (b->failed)
+         VG_(umsg)("error: failed to write cache simulation output file "
+                   "'%s'\n", cachegrind_out_file);
    }
-
-   VG_(fclose)(fp);
+   VG_(free)(cachegrind_out_file);
 }
 
 static UInt ULong_width(ULong n)
@@ -1595,6 +1859,8 @@ static void cg_fini(Int exitcode)
       miss numbers */
    if (clo_cache_sim) {
       VG_(umsg)(fmt, "I1  misses:   ", Ir_total.m1);
+      if (ML_enabled)
+         VG_(umsg)(fmt, "MLi misses:   ", Ir_total.mM);
       VG_(umsg)(fmt, "LLi misses:   ", Ir_total.mL);
 
       if (0 == Ir_total.a) Ir_total.a = 1;
@@ -1608,6 +1874,7 @@ static void cg_fini(Int exitcode)
        * determine the width of columns 2 & 3. */
       D_total.a  = Dr_total.a  + Dw_total.a;
       D_total.m1 = Dr_total.m1 + Dw_total.m1;
+      D_total.mM = Dr_total.mM + Dw_total.mM;
       D_total.mL = Dr_total.mL + Dw_total.mL;
 
       /* Make format string, getting width right for numbers */
@@ -1618,8 +1885,22 @@ static void cg_fini(Int exitcode)
                      D_total.a, Dr_total.a, Dw_total.a);
       VG_(umsg)(fmt, "D1  misses:   ",
                      D_total.m1, Dr_total.m1, Dw_total.m1);
+      if (ML_enabled)
+         VG_(umsg)(fmt, "MLd misses:   ",
+                        D_total.mM, Dr_total.mM, Dw_total.mM);
       VG_(umsg)(fmt, "LLd misses:   ",
                      D_total.mL, Dr_total.mL, Dw_total.mL);
+      if (clo_cache_threads || clo_prefetch != PREFETCH_NONE) {
+         VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+         if (clo_cache_threads)
+            VG_(umsg)(fmt, "D1c misses:   ", Dx_total.coh);
+         if (clo_prefetch != PREFETCH_NONE) {
+            VG_(umsg)(fmt, "Prefetches:   ", Dx_total.pf);
+            VG_(umsg)(fmt, "Pf covered:   ", Dx_total.pfc);
+         }
+         VG_(sprintf)(fmt, "%%s %%,%dllu  (%%,%dllu rd   + %%,%dllu wr)\n",
+                           l1, l2, l3);
+      }
 
       if (0 == D_total.a)  D_total.a = 1;
       if (0 == Dr_total.a) Dr_total.a = 1;
@@ -1636,9 +1917,16 @@ static void cg_fini(Int exitcode)
 
       /* LL overall results */
 
-      LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
-      LL_total_r = Dr_total.m1 + Ir_total.m1;
-      LL_total_w = Dw_total.m1;
+      // With a mid-level cache, only its misses reach LL.
+      if (ML_enabled) {
+         LL_total   = Dr_total.mM + Dw_total.mM + Ir_total.mM;
+         LL_total_r = Dr_total.mM + Ir_total.mM;
+         LL_total_w = Dw_total.mM;
+      } else {
+         LL_total   = Dr_total.m1 + Dw_total.m1 + Ir_total.m1;
+         LL_total_r = Dr_total.m1 + Ir_total.m1;
+         LL_total_w = Dw_total.m1;
+      }
       VG_(umsg)(fmt, "LL refs:      ",
                      LL_total, LL_total_r, LL_total_w);
 
@@ -1742,14 +2030,41 @@ void cg_discard_superblock_info ( Addr orig_addr64, VexGuestExtents vge )
 
 static Bool cg_process_cmd_line_option(const HChar* arg)
 {
+   const HChar* tmp_str;
+
    if (VG_(str_clo_cache_opt)(arg,
                               &clo_I1_cache,
                               &clo_D1_cache,
                               &clo_LL_cache)) {}
 
    else if VG_STR_CLO( arg, "--cachegrind-out-file", clo_cachegrind_out_file) {}
+   else if VG_STR_CLO( arg, "--cachegrind-out-format", tmp_str) {
+      if      (VG_(strcmp)(tmp_str, "text") == 0)
+         clo_binary_out = False;
+      else if (VG_(strcmp)(tmp_str, "binary") == 0)
+         clo_binary_out = True;
+      else
+         VG_(fmsg_bad_option)(arg, "Unknown output format '%s'\n", tmp_str);
+   }
    else if VG_BOOL_CLO(arg, "--cache-sim",  clo_cache_sim)  {}
    else if VG_BOOL_CLO(arg, "--branch-sim", clo_branch_sim) {}
+   else if VG_BOOL_CLO(arg, "--cache-threads", clo_cache_threads) {}
+   else if VG_STR_CLO(arg, "--ML", tmp_str) {
+      VG_(parse_cache_opt)(&clo_ML_cache, arg, tmp_str);
+   }
+   else if VG_STR_CLO(arg, "--prefetch", tmp_str) {
+      if      (VG_(strcmp)(tmp_str, "none") == 0)
+         clo_prefetch = PREFETCH_NONE;
+      else if (VG_(strcmp)(tmp_str, "next-line") == 0)
+         clo_prefetch = PREFETCH_NEXT_LINE;
+      else if (VG_(strcmp)(tmp_str, "stride") == 0)
+         clo_prefetch = PREFETCH_STRIDE;
+      else if (VG_(strcmp)(tmp_str, "both") == 0)
+         clo_prefetch = PREFETCH_BOTH;
+      else
+         VG_(fmsg_bad_option)(arg, "Unknown prefetcher '%s'\n", tmp_str);
+   }
+   else if VG_BINT_CLO(arg, "--prefetch-degree", clo_prefetch_degree, 1, 16) {}
    else
       return False;
 
@@ -1762,7 +2077,16 @@ static void cg_print_usage(void)
    VG_(printf)(
 "    --cache-sim=yes|no               collect cache stats? [yes]\n"
 "    --branch-sim=yes|no              collect branch prediction stats? [no]\n"
+"    --cache-threads=yes|no           simulate private I1/D1 caches per thread,\n"
+"                                     with a shared LL? [no]\n"
+"    --ML=<size>,<assoc>,<line_size>  simulate a mid-level cache between\n"
+"                                     the L1s and LL [none]\n"
+"    --prefetch=none|next-line|stride|both\n"
+"                                     prefetch data into ML, or LL [none]\n"
+"    --prefetch-degree=<n>            lines each prefetch runs ahead [2]\n"
 "    --cachegrind-out-file=<file>     output file name [cachegrind.out.%%p]\n"
+"    --cachegrind-out-format=text|binary\n"
+"                                     format of the output file [text]\n"
    );
 }
 
@@ -1798,11 +2122,22 @@ static void cg_pre_clo_init(void)
                                    cg_fini);
 
    VG_(needs_superblock_discards)(cg_discard_superblock_info);
+   VG_(needs_lazy_debuginfo)();
    VG_(needs_command_line_options)(cg_process_cmd_line_option,
                                    cg_print_usage,
                                    cg_print_debug_usage);
 }
 
+static void cg_pre_thread_ll_create(ThreadId parent, ThreadId child)
+{
+   cachesim_new_thread(child);
+}
+
+static void cg_start_client_code(ThreadId tid, ULong blocks_done)
+{
+   cachesim_switch_thread(tid);
+}
+
 static void cg_post_clo_init(void)
 {
    cache_t I1c, D1c, LLc; 
@@ -1833,6 +2168,8 @@ static void cg_post_clo_init(void)
    // cache lines at any cache level
    min_line_size = (I1c.line_size < D1c.line_size) ? I1c.line_size : D1c.line_size;
    min_line_size = (LLc.line_size < min_line_size) ? LLc.line_size : min_line_size;
+   if (clo_ML_cache.size != -1 && clo_ML_cache.line_size < min_line_size)
+      min_line_size = clo_ML_cache.line_size;
 
    Int largest_load_or_store_size
       = VG_(machine_get_size_of_largest_guest_register)();
@@ -1848,7 +2185,21 @@ static void cg_post_clo_init(void)
       VG_(exit)(1);
    }
 
-   cachesim_initcaches(I1c, D1c, LLc);
+   if (!clo_cache_sim)
+      clo_cache_threads = False;
+   if (!clo_cache_sim)
+      clo_prefetch = PREFETCH_NONE;
+   cachesim_initcaches(I1c, D1c,
+                       clo_ML_cache.size != -1 ? &clo_ML_cache : NULL, LLc,
+                       clo_cache_threads);
+   cachesim_initprefetch(clo_prefetch, clo_prefetch_degree);
+   if (ML_enabled && VG_(clo_verbosity) >= 2)
+      VG_(umsg)("  ML: %'d B, %d-way, %d B lines\n", clo_ML_cache.size,
+                clo_ML_cache.assoc, clo_ML_cache.line_size);
+   if (clo_cache_threads) {
+      VG_(track_pre_thread_ll_create)(cg_pre_thread_ll_create);
+      VG_(track_start_client_code)(cg_start_client_code);
+   }
 }
 
 VG_DETERMINE_INTERFACE_VERSION(cg_pre_clo_init)
@@ -40,6 +40,8 @@
 #include <string.h>
 #include <ctype.h>
 
+#include "cg_binfmt.h"
+
 typedef  signed long   Word;
 typedef  unsigned long UWord;
 typedef  unsigned char Bool;
@@ -48,6 +50,7 @@ typedef  unsigned char Bool;
 typedef  signed int    Int;
 typedef  unsigned int  UInt;
 typedef  unsigned long long int ULong;
+typedef  signed long long int   Long;
 typedef  signed char   Char;
 typedef  size_t        SizeT;
 
@@ -120,12 +123,14 @@ typedef
       FILE* fp;
       UInt  lno;
       char* filename;
+      Bool  binary;  // lno counts records, not lines
    }
    SOURCE;
 
 static void printSrcLoc ( SOURCE* s )
 {
-   fprintf(stderr, "%s: near %s line %u\n", argv0, s->filename, s->lno-1);
+   fprintf(stderr, "%s: near %s %s %u\n", argv0, s->filename,
+                   s->binary ? "record" : "line", s->lno-1);
 }
 
 __attribute__((noreturn))
@@ -547,25 +552,20 @@ static Bool addCountsToMap ( SOURCE* s,
    }
 }
 
-static
-void handle_counts ( SOURCE* s,
-                     CacheProfFile* cpf, 
-                     const char* fi, const char* fn, const char* newCountsStr )
+// Find the inner map for (fi, fn), creating it if necessary.  The parsers
+// cache the result in *pCountsMap until the file or function changes, so
+// that the outer map is searched once per function rather than once per
+// line.
+static WordFM* find_counts_map ( SOURCE* s,
+                                 CacheProfFile* cpf,
+                                 const char* fi, const char* fn,
+                                 /*MOD*/WordFM** pCountsMap )
 {
    WordFM* countsMap;
-   Bool    freeNewCounts;
-   UWord   lnno;
-   Counts* newCounts;
-   FileFn* topKey; 
-
-   if (0)  printf("%s %s %s\n", fi, fn, newCountsStr );
-
-   // parse the numbers
-   newCounts = splitUpCountsLine( s, &lnno, newCountsStr );
+   FileFn* topKey;
 
-   // Did we get the right number?
-   if (newCounts->n_counts != cpf->n_events)
-      goto oom;
+   if (*pCountsMap)
+      return *pCountsMap;
 
    // allocate the key
    topKey = malloc(sizeof(FileFn));
@@ -574,33 +574,65 @@ void handle_counts ( SOURCE* s,
       topKey->fn_name = strdup(fn);
    }
    if (! (topKey && topKey->fi_name && topKey->fn_name))
-      mallocFail(s, "handle_counts:");
+      mallocFail(s, "find_counts_map:");
 
    // search for it
    if (lookupFM( cpf->outerMap, (Word*)(&countsMap), (Word)topKey )) {
-      // found it.  Merge in new counts
-      freeNewCounts = addCountsToMap( s, countsMap, lnno, newCounts );
       ddel_FileFn(topKey);
    } else {
       // not found in the top map.  Create new entry
       countsMap = newFM( malloc, free, cmp_unboxed_UWord );
       if (!countsMap)
-         goto oom;
+         mallocFail(s, "find_counts_map:");
       addToFM( cpf->outerMap, (Word)topKey, (Word)countsMap );
-      freeNewCounts = addCountsToMap( s, countsMap, lnno, newCounts );
    }
 
+   *pCountsMap = countsMap;
+   return countsMap;
+}
+
+// Add newCounts for line lnno of (fi, fn).  Takes ownership of newCounts.
+static
+void add_line_counts ( SOURCE* s,
+                       CacheProfFile* cpf,
+                       const char* fi, const char* fn,
+                       /*MOD*/WordFM** pCountsMap,
+                       UWord lnno, Counts* newCounts )
+{
+   WordFM* countsMap;
+   Bool    freeNewCounts;
+
+   // Did we get the right number?
+   if (newCounts->n_counts != cpf->n_events)
+      parseError(s, "# counts doesn't match # events");
+
+   countsMap = find_counts_map( s, cpf, fi, fn, pCountsMap );
+   freeNewCounts = addCountsToMap( s, countsMap, lnno, newCounts );
+
    // also add to running summary total
    addCounts( s, cpf->summary, newCounts );
 
    // if safe to do so, free up the count vector
    if (freeNewCounts)
       ddel_Counts(newCounts);
+}
 
-   return;
+static
+void handle_counts ( SOURCE* s,
+                     CacheProfFile* cpf, 
+                     const char* fi, const char* fn,
+                     /*MOD*/WordFM** pCountsMap,
+                     const char* newCountsStr )
+{
+   UWord   lnno;
+   Counts* newCounts;
 
-  oom:
-   parseError(s, "# counts doesn't match # events");
+   if (0)  printf("%s %s %s\n", fi, fn, newCountsStr );
+
+   // parse the numbers
+   newCounts = splitUpCountsLine( s, &lnno, newCountsStr );
+
+   add_line_counts( s, cpf, fi, fn, pCountsMap, lnno, newCounts );
 }
 
 
@@ -620,6 +652,7 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
    Counts*        summaryRead; 
    char*          curr_fn = strdup("???");
    char*          curr_fl = strdup("???");
+   WordFM*        curr_map = NULL;
    const char*    line;
 
    cpf = new_CacheProfFile( NULL, NULL, NULL, 0, NULL, NULL, NULL );
@@ -699,19 +732,21 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
          parseError(s, "parse_CacheProfFile: eof before SUMMARY line");
 
       if (isdigit(line[0])) {
-         handle_counts(s, cpf, curr_fl, curr_fn, line);
+         handle_counts(s, cpf, curr_fl, curr_fn, &curr_map, line);
          continue;
       }
       else
       if (streqn(line, "fn=", 3)) {
          free(curr_fn);
          curr_fn = strdup(line+3);
+         curr_map = NULL;
          continue;
       }
       else
       if (streqn(line, "fl=", 3)) {
          free(curr_fl);
          curr_fl = strdup(line+3);
+         curr_map = NULL;
          continue;
       }
       else
@@ -765,6 +800,313 @@ static CacheProfFile* parse_CacheProfFile ( SOURCE* s )
 }
 
 
+//------------------------------------------------------------------//
+//--- The binary format (see cg_binfmt.h)                        ---//
+//------------------------------------------------------------------//
+
+static int bin_getc ( SOURCE* s )
+{
+   int ch = getc(s->fp);
+   if (ch == EOF) {
+      if (ferror(s->fp)) {
+         perror(argv0);
+         barf(s, "I/O error while reading input file");
+      }
+      parseError(s, "parse_CacheProfFile_bin: unexpected end of file");
+   }
+   return ch;
+}
+
+static ULong bin_get_varint ( SOURCE* s )
+{
+   ULong u = 0;
+   Int   shift = 0;
+   while (1) {
+      int ch = bin_getc(s);
+      if (shift > 63)
+         parseError(s, "parse_CacheProfFile_bin: overlong varint");
+      u |= (ULong)(ch & 0x7F) << shift;
+      if ((ch & 0x80) == 0)
+         return u;
+      shift += 7;
+   }
+}
+
+static char* bin_get_string ( SOURCE* s )
+{
+   ULong len = bin_get_varint(s);
+   char* str;
+   if (len > 0x7FFFFFFF)
+      parseError(s, "parse_CacheProfFile_bin: string too long");
+   str = malloc(len + 1);
+   if (str == NULL)
+      mallocFail(s, "bin_get_string:");
+   if (fread(str, 1, len, s->fp) != len) {
+      if (ferror(s->fp)) {
+         perror(argv0);
+         barf(s, "I/O error while reading input file");
+      }
+      parseError(s, "parse_CacheProfFile_bin: unexpected end of file");
+   }
+   str[len] = 0;
+   return str;
+}
+
+static Counts* bin_get_counts ( SOURCE* s, Int n_counts )
+{
+   Int     i;
+   Counts* counts = new_Counts_Zeroed( n_counts );
+   if (counts == NULL)
+      mallocFail(s, "bin_get_counts:");
+   for (i = 0; i < n_counts; i++)
+      counts->counts[i] = bin_get_varint(s);
+   return counts;
+}
+
+/* As parse_CacheProfFile, but for the binary format.  The magic number
+   has already been read. */
+static CacheProfFile* parse_CacheProfFile_bin ( SOURCE* s )
+{
+   Int            i;
+   ULong          n_desc;
+   char*          p;
+   CacheProfFile* cpf;
+   Counts*        summaryRead;
+   char**         strs = NULL;
+   UInt           n_strs = 0, strs_size = 0;
+   const char*    curr_fn = "???";
+   const char*    curr_fl = "???";
+   WordFM*        curr_map = NULL;
+   Long           lnno = 0;
+
+   cpf = new_CacheProfFile( NULL, NULL, NULL, 0, NULL, NULL, NULL );
+   if (cpf == NULL)
+      mallocFail(s, "parse_CacheProfFile_bin(1)");
+
+   // "desc:", "cmd:" and "events:" lines
+   n_desc = bin_get_varint(s);
+   if (n_desc == 0)
+      parseError(s, "parse_CacheProfFile_bin: no DESC lines present");
+   if (n_desc > 10000)
+      parseError(s, "parse_CacheProfFile_bin: too many DESC lines");
+   cpf->desc_lines = malloc( (1+n_desc) * sizeof(char*) );
+   if (cpf->desc_lines == NULL)
+      mallocFail(s, "parse_CacheProfFile_bin(2)");
+   for (i = 0; i < n_desc; i++)
+      cpf->desc_lines[i] = bin_get_string(s);
+   cpf->desc_lines[n_desc] = NULL;
+
+   cpf->cmd_line = bin_get_string(s);
+   if (!streqn(cpf->cmd_line, "cmd: ", 5))
+      parseError(s, "parse_CacheProfFile_bin: no CMD line present");
+
+   cpf->events_line = bin_get_string(s);
+   if (!streqn(cpf->events_line, "events: ", 8))
+      parseError(s, "parse_CacheProfFile_bin: no EVENTS line present");
+
+   // the stated number of events must agree with the events line
+   cpf->n_events = bin_get_varint(s);
+   i = 0;
+   for (p = &cpf->events_line[6]; *p; p++) {
+      if (p[0] == ' ' && isalpha(p[1]))
+         i++;
+   }
+   if (i != cpf->n_events)
+      parseError(s, "parse_CacheProfFile_bin: wrong # events");
+
+   cpf->summary = new_Counts_Zeroed( cpf->n_events );
+   if (cpf->summary == NULL)
+      mallocFail(s, "parse_CacheProfFile_bin(3)");
+
+   cpf->outerMap = newFM ( malloc, free, cmp_FileFn );
+   if (cpf->outerMap == NULL)
+      mallocFail(s, "parse_CacheProfFile_bin(4)");
+
+   // process records
+   while (1) {
+      int   tag = bin_getc(s);
+      ULong u;
+      s->lno++;
+
+      if (tag == CG_BIN_LINE) {
+         u = bin_get_varint(s);
+         lnno += (Long)(u >> 1) ^ -(Long)(u & 1);
+         add_line_counts(s, cpf, curr_fl, curr_fn, &curr_map,
+                         (UWord)lnno, bin_get_counts(s, cpf->n_events));
+      }
+      else
+      if (tag == CG_BIN_STR) {
+         if (n_strs >= strs_size) {
+            strs_size = strs_size ? 2 * strs_size : 1000;
+            strs = realloc(strs, strs_size * sizeof *strs);
+            if (strs == NULL)
+               mallocFail(s, "parse_CacheProfFile_bin(5)");
+         }
+         strs[n_strs++] = bin_get_string(s);
+      }
+      else
+      if (tag == CG_BIN_FL || tag == CG_BIN_FN) {
+         u = bin_get_varint(s);
+         if (u >= n_strs)
+            parseError(s, "parse_CacheProfFile_bin: undefined string");
+         if (tag == CG_BIN_FL) {
+            curr_fl = strs[u];
+         } else {
+            curr_fn = strs[u];
+            lnno = 0;
+         }
+         curr_map = NULL;
+      }
+      else
+      if (tag == CG_BIN_END) {
+         break;
+      }
+      else
+         parseError(s, "parse_CacheProfFile_bin: unknown record");
+   }
+
+   // check the summary counts are as expected
+   summaryRead = bin_get_counts( s, cpf->n_events );
+   for (i = 0; i < summaryRead->n_counts; i++) {
+      if (summaryRead->counts[i] != cpf->summary->counts[i]) {
+         parseError(s, "parse_CacheProfFile_bin: "
+                       "computed vs stated SUMMARY counts mismatch");
+      }
+   }
+   ddel_Counts(summaryRead);
+
+   // there should be nothing more
+   if (getc(s->fp) != EOF)
+      parseError(s, "parse_CacheProfFile_bin: "
+                    "extraneous content after SUMMARY record");
+
+   for (i = 0; i < n_strs; i++)
+      free(strs[i]);
+   free(strs);
+
+   // All looks OK
+   return cpf;
+}
+
+static void bin_put_varint ( FILE* f, ULong u )
+{
+   while (u >= 0x80) {
+      putc((int)(u | 0x80) & 0xFF, f);
+      u >>= 7;
+   }
+   putc((int)u, f);
+}
+
+static void bin_put_string ( FILE* f, const char* str )
+{
+   size_t len = strlen(str);
+   bin_put_varint(f, len);
+   fwrite(str, 1, len, f);
+}
+
+static void bin_put_counts ( FILE* f, Counts* c )
+{
+   Int i;
+   for (i = 0; i < c->n_counts; i++)
+      bin_put_varint(f, c->counts[i]);
+}
+
+static Word cmp_string ( Word s1, Word s2 )
+{
+   return strcmp((const char*)s1, (const char*)s2);
+}
+
+// Return the number of 'str' in the string table, first defining it if
+// necessary.  'nums' maps strings (owned by the profile) to numbers, and
+// holds *n_nums of them.
+static UWord bin_put_string_num ( FILE* f, WordFM* nums, /*MOD*/UWord* n_nums,
+                                  const char* str )
+{
+   UWord num;
+   if (!lookupFM( nums, (Word*)&num, (Word)str )) {
+      num = (*n_nums)++;
+      addToFM( nums, (Word)str, (Word)num );
+      putc(CG_BIN_STR, f);
+      bin_put_string(f, str);
+   }
+   return num;
+}
+
+static void show_CacheProfFile_bin ( FILE* f, CacheProfFile* cpf )
+{
+   Int     n_desc;
+   char**  d;
+   FileFn* topKey;
+   WordFM* topVal;
+   UWord   subKey;
+   Counts* subVal;
+   WordFM* nums;
+   const char* currFile = NULL;
+   UWord   num, n_nums = 0;
+   Long    prevLine, delta;
+
+   nums = newFM( malloc, free, cmp_string );
+   if (nums == NULL) {
+      fprintf(stderr, "%s: out of memory in show_CacheProfFile_bin\n", argv0);
+      exit(2);
+   }
+
+   fwrite(CG_BIN_MAGIC, 1, CG_BIN_MAGIC_LEN, f);
+   for (n_desc = 0, d = cpf->desc_lines; *d; d++)
+      n_desc++;
+   bin_put_varint(f, n_desc);
+   for (d = cpf->desc_lines; *d; d++)
+      bin_put_string(f, *d);
+   bin_put_string(f, cpf->cmd_line);
+   bin_put_string(f, cpf->events_line);
+   bin_put_varint(f, cpf->n_events);
+
+   // The outer map is sorted by file name, so each file need only be
+   // given once.
+   initIterFM( cpf->outerMap );
+   while (nextIterFM( cpf->outerMap, (Word*)(&topKey), (Word*)(&topVal) )) {
+      if (currFile == NULL || !streq(currFile, topKey->fi_name)) {
+         currFile = topKey->fi_name;
+         num = bin_put_string_num( f, nums, &n_nums, currFile );
+         putc(CG_BIN_FL, f);
+         bin_put_varint(f, num);
+      }
+      num = bin_put_string_num( f, nums, &n_nums, topKey->fn_name );
+      putc(CG_BIN_FN, f);
+      bin_put_varint(f, num);
+
+      prevLine = 0;
+      initIterFM( topVal );
+      while (nextIterFM( topVal, (Word*)(&subKey), (Word*)(&subVal) )) {
+         delta = (Long)subKey - prevLine;
+         prevLine = (Long)subKey;
+         putc(CG_BIN_LINE, f);
+         bin_put_varint(f, ((ULong)delta << 1) ^ (ULong)(delta >> 63));
+         bin_put_counts(f, subVal);
+      }
+      doneIterFM( topVal );
+   }
+   doneIterFM( cpf->outerMap );
+
+   putc(CG_BIN_END, f);
+   bin_put_counts(f, cpf->summary);
+
+   deleteFM( nums, NULL, NULL );
+}
+
+// Is the file open on s->fp a binary profile?  Leaves s->fp positioned
+// after the magic number if so, or at the start if not.
+static Bool is_binary_CacheProfFile ( SOURCE* s )
+{
+   char magic[CG_BIN_MAGIC_LEN];
+   if (fread(magic, 1, CG_BIN_MAGIC_LEN, s->fp) == CG_BIN_MAGIC_LEN
+       && 0 == memcmp(magic, CG_BIN_MAGIC, CG_BIN_MAGIC_LEN))
+      return True;
+   rewind(s->fp);
+   return False;
+}
+
+
 static void merge_CacheProfInfo ( SOURCE* s,
                                   /*MOD*/CacheProfFile* dst,
                                   CacheProfFile* src )
@@ -851,8 +1193,10 @@ static void usage ( void )
 {
    fprintf(stderr, "%s: Merges multiple cachegrind output files into one\n", 
                    argv0);
-   fprintf(stderr, "%s: usage: %s [-o outfile] [files-to-merge]\n", 
+   fprintf(stderr, "%s: usage: %s [-b] [-o outfile] [files-to-merge]\n", 
                    argv0, argv0);
+   fprintf(stderr, "%s:   -b: write the binary format rather than text\n",
+                   argv0);
    exit(1);
 }
 
@@ -865,6 +1209,7 @@ int main ( int argc, char** argv )
    FILE*          outfile = NULL;
    char*          outfilename = NULL;
    Int            outfileix = 0;
+   Bool           binary_out = False;
 
    if (argv[0])
       argv0 = argv[0];
@@ -899,17 +1244,27 @@ int main ( int argc, char** argv )
          i += 1;
          continue;
       }
+      if (streq(argv[i], "-b")) {
+         binary_out = True;
+         continue;
+      }
 
       fprintf(stderr, "%s: parsing %s\n", argv0, argv[i]);
       src.lno      = 1;
       src.filename = argv[i];
+      src.binary   = False;
       src.fp       = fopen(src.filename, "r");
       if (!src.fp) {
          perror(argv0);
          barf(&src, "Cannot open input file");
       }
       assert(src.fp);
-      cpfTmp = parse_CacheProfFile( &src );
+      if (is_binary_CacheProfFile( &src )) {
+         src.binary = True;
+         cpfTmp = parse_CacheProfFile_bin( &src );
+      } else {
+         cpfTmp = parse_CacheProfFile( &src );
+      }
       fclose(src.fp);
 
       /* If this isn't the first file, merge */
@@ -934,7 +1289,7 @@ int main ( int argc, char** argv )
 
       /* Write the output. */
       if (outfilename) {
-         outfile = fopen(outfilename, "w");
+         outfile = fopen(outfilename, binary_out ? "wb" : "w");
          if (!outfile) {
             fprintf(stderr, "%s: can't create output file %s\n", 
                             argv0, outfilename);
@@ -945,7 +1300,10 @@ int main ( int argc, char** argv )
          outfile = stdout;
       }
 
-      show_CacheProfFile( outfile, cpf );
+      if (binary_out)
+         show_CacheProfFile_bin( outfile, cpf );
+      else
+         show_CacheProfFile( outfile, cpf );
       if (ferror(outfile)) {
          fprintf(stderr, "%s: error writing output file %s\n", 
                          argv0, outfilename ? outfilename : "(stdout)" );
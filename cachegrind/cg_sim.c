@@ -167,28 +167,398 @@ static cache_t2 LL;
 static cache_t2 I1;
 static cache_t2 D1;
 
-static void cachesim_initcaches(cache_t I1c, cache_t D1c, cache_t LLc)
+/* Optional mid-level cache (--ML), between the L1s and LL, like the
+   private L2 of most current cores.  When it is enabled only ML misses
+   go on to LL, so the LL misses remain the misses that reach memory. */
+static Bool     ML_enabled = False;
+static cache_t2 ML;
+
+/* Counts of the optional models that are not per-level misses. */
+typedef struct {
+   ULong coh;   /* D1 misses on lines invalidated by another thread */
+   ULong pf;    /* lines prefetched */
+   ULong pfc;   /* D1 misses that hit a line prefetched for them */
+} SimCC;
+
+/* Multi-threaded simulation (--cache-threads=yes).  Every guest thread
+   gets private I1 and D1 caches, and a private ML if there is one; LL
+   stays shared.  I1, D1 and ML above always hold the caches of the
+   thread that is currently running, so the single-threaded fast paths
+   are unchanged; the other threads' caches are parked in
+   thread_caches[] and swapped in by cachesim_switch_thread.
+
+   Coherence follows a write-invalidate scheme (MESI reduced to "line
+   present or not"): a write by one thread knocks the line out of
+   every other thread's D1 and ML.  The invalidated way is moved to the
+   LRU position and tagged with INVALID_TAG_BIT, so that it is the next
+   victim of that set and a later miss on the same block can be
+   recognised and counted as a coherence miss. */
+
+#define INVALID_TAG_BIT  ((UWord)1 << (sizeof(UWord) * 8 - 1))
+
+typedef struct {
+   Bool     in_use;
+   cache_t2 I1;
+   cache_t2 D1;
+   cache_t2 ML;
+} ThreadCaches;
+
+static Bool          cachesim_mt = False;
+static ThreadId      cachesim_cur_tid = 1;
+static ThreadCaches* thread_caches = NULL;   /* [VG_N_THREADS] */
+static cache_t       cachesim_I1c, cachesim_D1c, cachesim_MLc;
+
+/* Prefetching (--prefetch).  The prefetcher fills ML, or LL when there
+   is no ML, as the L2 streamers of real cores do.  The next-line
+   prefetcher follows each miss there, and each first use of a
+   prefetched line, with the next lines of the same page.  The stride
+   prefetcher keeps the last address and stride of the data accesses of
+   each instruction in a small table indexed by the instruction address,
+   and once the stride has come twice in a row fetches the lines that
+   many strides ahead.  A prefetched line keeps PREFETCH_TAG_BIT in its
+   tag until a D1 miss uses it, which is then counted as covered by the
+   prefetch. */
+
+#define PREFETCH_NONE       0
+#define PREFETCH_NEXT_LINE  1
+#define PREFETCH_STRIDE     2
+#define PREFETCH_BOTH       3
+
+#define PREFETCH_TAG_BIT    ((UWord)1 << (sizeof(UWord) * 8 - 2))
+
+/* The next-line prefetcher does not cross pages of this size. */
+#define PREFETCH_PAGE_SHIFT 12
+
+#define N_STRIDE_ENTRIES    256
+
+typedef struct {
+   Addr pc;
+   Addr last;
+   Word stride;
+   UInt confirmed;
+} StrideEntry;
+
+static Int         cachesim_pf_kind   = PREFETCH_NONE;
+static Int         cachesim_pf_degree = 2;
+static StrideEntry stride_table[N_STRIDE_ENTRIES];
+
+/* Set if D1 references must take the out-of-line path. */
+static Bool        cachesim_D1_slow = False;
+
+/* MLc is NULL when there is no mid-level cache. */
+static void cachesim_initcaches(cache_t I1c, cache_t D1c,
+                                const cache_t* MLc, cache_t LLc,
+                                Bool per_thread)
 {
    cachesim_initcache(I1c, &I1);
    cachesim_initcache(D1c, &D1);
    cachesim_initcache(LLc, &LL);
+   if (MLc) {
+      ML_enabled = True;
+      cachesim_MLc = *MLc;
+      cachesim_initcache(*MLc, &ML);
+   }
+
+   if (per_thread) {
+      cachesim_mt  = True;
+      cachesim_D1_slow = True;
+      cachesim_I1c = I1c;
+      cachesim_D1c = D1c;
+      thread_caches = VG_(calloc)("cg.sim.ci.2", VG_N_THREADS,
+                                  sizeof(ThreadCaches));
+      /* The caches initialised above belong to the root thread. */
+      thread_caches[cachesim_cur_tid].in_use = True;
+   }
+}
+
+static void cachesim_initprefetch(Int kind, Int degree)
+{
+   cachesim_pf_kind   = kind;
+   cachesim_pf_degree = degree;
+   if (kind != PREFETCH_NONE)
+      cachesim_D1_slow = True;
 }
 
+static void cachesim_reset_cache(cache_t2* c)
+{
+   Int i;
+   for (i = 0; i < c->sets * c->assoc; i++)
+      c->tags[i] = 0;
+}
+
+/* A new thread is about to run in slot tid: give it cold caches. */
+static void cachesim_new_thread(ThreadId tid)
+{
+   ThreadCaches* tc = &thread_caches[tid];
+
+   if (tid == cachesim_cur_tid) {
+      cachesim_reset_cache(&I1);
+      cachesim_reset_cache(&D1);
+      if (ML_enabled)
+         cachesim_reset_cache(&ML);
+   } else if (tc->in_use) {
+      cachesim_reset_cache(&tc->I1);
+      cachesim_reset_cache(&tc->D1);
+      if (ML_enabled)
+         cachesim_reset_cache(&tc->ML);
+   } else {
+      cachesim_initcache(cachesim_I1c, &tc->I1);
+      cachesim_initcache(cachesim_D1c, &tc->D1);
+      if (ML_enabled)
+         cachesim_initcache(cachesim_MLc, &tc->ML);
+      tc->in_use = True;
+   }
+}
+
+static void cachesim_switch_thread(ThreadId tid)
+{
+   if (tid == cachesim_cur_tid)
+      return;
+   if (!thread_caches[tid].in_use)
+      cachesim_new_thread(tid);
+
+   thread_caches[cachesim_cur_tid].I1 = I1;
+   thread_caches[cachesim_cur_tid].D1 = D1;
+   thread_caches[cachesim_cur_tid].ML = ML;
+   I1 = thread_caches[tid].I1;
+   D1 = thread_caches[tid].D1;
+   ML = thread_caches[tid].ML;
+   cachesim_cur_tid = tid;
+}
+
+/* Drop block from c, if present, leaving an invalid marker in the
+   LRU way of its set. */
+static void cachesim_invalidate_block(cache_t2* c, UWord block)
+{
+   UWord* set = &(c->tags[(block & c->sets_min_1) * c->assoc]);
+   Int    i, j;
+
+   for (i = 0; i < c->assoc; i++) {
+      if ((set[i] & ~PREFETCH_TAG_BIT) == block) {
+         for (j = i; j < c->assoc - 1; j++)
+            set[j] = set[j + 1];
+         set[c->assoc - 1] = block | INVALID_TAG_BIT;
+         return;
+      }
+   }
+}
+
+/* Was block invalidated in c by another thread's write, without the
+   marker having been evicted since?  The marker is consumed. */
+static Bool cachesim_block_was_invalidated(cache_t2* c, UWord block)
+{
+   UWord* set = &(c->tags[(block & c->sets_min_1) * c->assoc]);
+   Int    i;
+
+   for (i = c->assoc - 1; i >= 0; i--) {
+      if (set[i] == (block | INVALID_TAG_BIT)) {
+         set[i] = 0;
+         return True;
+      }
+   }
+   return False;
+}
+
+static Bool cachesim_D1_block_mt(UWord block, Bool is_write, Bool* coh)
+{
+   Bool     miss;
+   ThreadId tid;
+
+   if (cachesim_block_was_invalidated(&D1, block))
+      *coh = True;
+   miss = cachesim_setref_is_miss(&D1, block & D1.sets_min_1, block);
+
+   if (is_write) {
+      /* ML blocks are in ML line units */
+      UWord mblock = (block << D1.line_size_bits) >> ML.line_size_bits;
+
+      for (tid = 1; tid < VG_N_THREADS; tid++) {
+         if (tid == cachesim_cur_tid || !thread_caches[tid].in_use)
+            continue;
+         cachesim_invalidate_block(&thread_caches[tid].D1, block);
+         if (ML_enabled)
+            cachesim_invalidate_block(&thread_caches[tid].ML, mblock);
+      }
+   }
+   return miss;
+}
+
+/* The first level missed: look up the outer levels. */
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_Gen(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_outer_doref(Addr a, UChar size, ULong* mM, ULong* mL)
+{
+   if (UNLIKELY(ML_enabled)) {
+      if (!cachesim_ref_is_miss(&ML, a, size))
+         return;
+      (*mM)++;
+   }
+   if (cachesim_ref_is_miss(&LL, a, size))
+      (*mL)++;
+}
+
+/* If block sits in c as an unused prefetch, turn it into an ordinary
+   line and return True. */
+static Bool cachesim_claim_prefetched(cache_t2* c, UWord block)
+{
+   UWord* set = &(c->tags[(block & c->sets_min_1) * c->assoc]);
+   Int    i;
+
+   for (i = 0; i < c->assoc; i++) {
+      if (set[i] == (block | PREFETCH_TAG_BIT)) {
+         set[i] = block;
+         return True;
+      }
+   }
+   return False;
+}
+
+/* Bring block into the prefetch target c unless it is there already.
+   A line prefetched into ML is fetched through LL, as a demand miss
+   would be. */
+static void cachesim_prefetch_line(cache_t2* c, UWord block, SimCC* x)
+{
+   UWord* set = &(c->tags[(block & c->sets_min_1) * c->assoc]);
+   Int    i;
+
+   for (i = 0; i < c->assoc; i++) {
+      if ((set[i] & ~PREFETCH_TAG_BIT) == block)
+         return;
+   }
+   for (i = c->assoc - 1; i > 0; i--)
+      set[i] = set[i - 1];
+   set[0] = block | PREFETCH_TAG_BIT;
+   x->pf++;
+
+   if (c != &LL) {
+      UWord lblock = (block << c->line_size_bits) >> LL.line_size_bits;
+      cachesim_setref_is_miss(&LL, lblock & LL.sets_min_1, lblock);
+   }
+}
+
+static void cachesim_prefetch_next_lines(cache_t2* c, UWord block, SimCC* x)
+{
+   Int shift = PREFETCH_PAGE_SHIFT - c->line_size_bits;
+   Int i;
+
+   if (shift <= 0)
+      return;
+   for (i = 1; i <= cachesim_pf_degree; i++) {
+      if ((block + i) >> shift != block >> shift)
+         break;
+      cachesim_prefetch_line(c, block + i, x);
+   }
+}
+
+static void cachesim_train_stride(Addr pc, Addr a, SimCC* x)
+{
+   StrideEntry* e = &stride_table[(pc ^ (pc >> 8)) & (N_STRIDE_ENTRIES - 1)];
+   cache_t2*    c = ML_enabled ? &ML : &LL;
+   UWord        cur, block;
+   Word         delta;
+   Int          i;
+
+   if (e->pc != pc) {
+      e->pc        = pc;
+      e->last      = a;
+      e->stride    = 0;
+      e->confirmed = 0;
+      return;
+   }
+   delta = (Word)(a - e->last);
+   if (delta != 0 && delta == e->stride) {
+      if (e->confirmed < 2)
+         e->confirmed++;
+   } else {
+      e->confirmed = 0;
+   }
+   e->stride = delta;
+   e->last   = a;
+   if (e->confirmed < 2)
+      return;
+
+   cur = a >> c->line_size_bits;
+   for (i = 1; i <= cachesim_pf_degree; i++) {
+      block = (a + i * delta) >> c->line_size_bits;
+      if (block != cur)
+         cachesim_prefetch_line(c, block, x);
+   }
+}
+
+/* As cachesim_outer_doref, but D1 misses may be covered by a prefetch,
+   and may trigger the next-line prefetcher. */
+static void cachesim_outer_doref_pf(Addr a, UChar size,
+                                    ULong* mM, ULong* mL, SimCC* x)
+{
+   cache_t2* c      = ML_enabled ? &ML : &LL;
+   ULong*    c_miss = ML_enabled ? mM : mL;
+   ULong     before = *c_miss;
+   UWord     block1 =  a         >> c->line_size_bits;
+   UWord     block2 = (a+size-1) >> c->line_size_bits;
+   Bool      covered;
+
+   covered = cachesim_claim_prefetched(c, block1);
+   if (block1 != block2)
+      covered = cachesim_claim_prefetched(c, block2) || covered;
+
+   cachesim_outer_doref(a, size, mM, mL);
+
+   if (covered)
+      x->pfc++;
+   if ((covered || *c_miss != before)
+       && (cachesim_pf_kind & PREFETCH_NEXT_LINE))
+      cachesim_prefetch_next_lines(c, block2, x);
+}
+
+/* D1 reference with --cache-threads or --prefetch. */
+static __attribute__((noinline))
+void cachesim_D1_doref_slow(Addr pc, Addr a, UChar size, Bool is_write,
+                            ULong* m1, ULong* mM, ULong* mL, SimCC* x)
+{
+   Bool miss;
+
+   if (cachesim_mt) {
+      UWord block1 =  a         >> D1.line_size_bits;
+      UWord block2 = (a+size-1) >> D1.line_size_bits;
+      Bool  coh = False;
+
+      /* always do both, as state is updated as side effect */
+      miss = cachesim_D1_block_mt(block1, is_write, &coh);
+      if (block1 != block2)
+         miss = cachesim_D1_block_mt(block2, is_write, &coh) || miss;
+      if (miss && coh)
+         x->coh++;
+   } else {
+      miss = cachesim_ref_is_miss(&D1, a, size);
+   }
+
+   if (miss) {
+      (*m1)++;
+      if (cachesim_pf_kind != PREFETCH_NONE)
+         cachesim_outer_doref_pf(a, size, mM, mL, x);
+      else
+         cachesim_outer_doref(a, size, mM, mL);
+   }
+   if (cachesim_pf_kind & PREFETCH_STRIDE)
+      cachesim_train_stride(pc, a, x);
+}
+
+__attribute__((always_inline))
+static __inline__
+void cachesim_I1_doref_Gen(Addr a, UChar size,
+                           ULong* m1, ULong* mM, ULong *mL)
 {
    if (cachesim_ref_is_miss(&I1, a, size)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
-         (*mL)++;
+      cachesim_outer_doref(a, size, mM, mL);
    }
 }
 
 // common special case IrNoX
 __attribute__((always_inline))
 static __inline__
-void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_I1_doref_NoX(Addr a, UChar size,
+                           ULong* m1, ULong* mM, ULong *mL)
 {
    UWord block  = a >> I1.line_size_bits;
    UInt  I1_set = block & I1.sets_min_1;
@@ -197,20 +567,30 @@ void cachesim_I1_doref_NoX(Addr a, UChar size, ULong* m1, ULong *mL)
    if (cachesim_setref_is_miss(&I1, I1_set, block)) {
       UInt  LL_set = block & LL.sets_min_1;
       (*m1)++;
+      if (UNLIKELY(ML_enabled)) {
+         cachesim_outer_doref(a, size, mM, mL);
+         return;
+      }
       // can use block as tag as L1I and LL cache line sizes are equal
       if (cachesim_setref_is_miss(&LL, LL_set, block))
          (*mL)++;
    }
 }
 
+/* pc is the address of the accessing instruction, for the stride
+   prefetcher. */
 __attribute__((always_inline))
 static __inline__
-void cachesim_D1_doref(Addr a, UChar size, ULong* m1, ULong *mL)
+void cachesim_D1_doref(Addr pc, Addr a, UChar size, Bool is_write,
+                       ULong* m1, ULong* mM, ULong *mL, SimCC* x)
 {
+   if (UNLIKELY(cachesim_D1_slow)) {
+      cachesim_D1_doref_slow(pc, a, size, is_write, m1, mM, mL, x);
+      return;
+   }
    if (cachesim_ref_is_miss(&D1, a, size)) {
       (*m1)++;
-      if (cachesim_ref_is_miss(&LL, a, size))
-         (*mL)++;
+      cachesim_outer_doref(a, size, mM, mL);
    }
 }
 
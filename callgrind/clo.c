@@ -524,6 +524,9 @@ Bool CLG_(process_cmd_line_option)(const HChar* arg)
 
    else if VG_INT_CLO( arg, "--dump-every-bb", CLG_(clo).dump_every_bb) {}
 
+   else if VG_BINT_CLO(arg, "--sample-every", CLG_(clo).sample_every,
+                       0, 1000000000) {}
+
    else if VG_BOOL_CLO(arg, "--collect-alloc",   CLG_(clo).collect_alloc) {}
    else if VG_BOOL_CLO(arg, "--collect-systime", CLG_(clo).collect_systime) {}
    else if VG_BOOL_CLO(arg, "--collect-bus",     CLG_(clo).collect_bus) {}
@@ -583,6 +586,8 @@ void CLG_(print_usage)(void)
 "    --collect-alloc=no|yes    Collect memory allocation info? [no]\n"
 #endif
 "    --collect-systime=no|yes  Collect system call time info? [no]\n"
+"    --sample-every=<count>    Only sample the call stack every <count>\n"
+"                              instructions [0=never, i.e. exact costs]\n"
 
 "\n   cost entity separation options:\n"
 "    --separate-threads=no|yes Separate data per thread [no]\n"
@@ -660,6 +665,7 @@ void CLG_(set_clo_defaults)(void)
   CLG_(clo).instrument_atstart = True;
   CLG_(clo).simulate_cache = False;
   CLG_(clo).simulate_branch = False;
+  CLG_(clo).sample_every = 0;
 
   /* Call graph */
   CLG_(clo).pop_on_jump = False;
@@ -267,6 +267,23 @@ Context* CLG_(get_cxt)(fn_node** fn)
 }
 
 
+/* Direct-mapped cache of context changes on calls: calling <fn> from
+ * context <from> enters context <cxt>.  Contexts and functions are never
+ * freed, so entries stay valid.
+ */
+#define N_CALL_CXT_ENTRIES 4096
+
+typedef struct {
+  Context* from;
+  fn_node* fn;
+  Context* cxt;
+} call_cxt_entry;
+
+static call_cxt_entry call_cxts[N_CALL_CXT_ENTRIES];
+
+#define call_cxt_idx(from, fn) \
+   ((((UWord)(from) >> 4) ^ ((UWord)(fn) >> 3)) & (N_CALL_CXT_ENTRIES-1))
+
 /**
  * Change execution context by calling a new function from current context
  * Pushing 0x0 specifies a marker for a signal handler entry
@@ -274,7 +291,9 @@ Context* CLG_(get_cxt)(fn_node** fn)
 void CLG_(push_cxt)(fn_node* fn)
 {
   call_stack* cs = &CLG_(current_call_stack);
-  Int fn_entries;
+  Context* from_cxt = CLG_(current_state).cxt;
+  call_cxt_entry* ce;
+  Int fn_entries, size;
 
   CLG_DEBUG(5, "+ push_cxt(fn '%s'): old ctx %d\n", 
 	    fn ? fn->name : "0x0",
@@ -321,7 +340,31 @@ void CLG_(push_cxt)(fn_node* fn)
 
   CLG_(current_fn_stack).top++;
   *(CLG_(current_fn_stack).top) = fn;
-  CLG_(current_state).cxt = CLG_(get_cxt)(CLG_(current_fn_stack).top);
+
+  /* The new context is fn followed by the first size-1 functions of the
+   * caller's context, if that has as many, or holds the whole stack (it
+   * is shorter than its own function asked for).  Then it only depends
+   * on the caller's context, and repeated calls along the same edge can
+   * skip hashing and comparing the whole context, which with high
+   * --separate-callers is the cost of every call.
+   */
+  ce = &call_cxts[call_cxt_idx(from_cxt, fn)];
+  if (fn && from_cxt && (ce->from == from_cxt) && (ce->fn == fn)) {
+    CLG_(current_state).cxt = ce->cxt;
+  }
+  else {
+    CLG_(current_state).cxt = CLG_(get_cxt)(CLG_(current_fn_stack).top);
+    if (fn && from_cxt) {
+      size = fn->separate_callers+1;
+      if (size<=0) { size = -size+1; }
+      if ((from_cxt->size + 1 >= size) ||
+	  (from_cxt->size < from_cxt->fn[0]->separate_callers + 1)) {
+	ce->from = from_cxt;
+	ce->fn   = fn;
+	ce->cxt  = CLG_(current_state).cxt;
+      }
+    }
+  }
 
   CLG_DEBUG(5, "- push_cxt(fn '%s'): new cxt %d, fn_sp %ld\n",
 	    fn ? fn->name : "0x0",
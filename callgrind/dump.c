@@ -1475,6 +1475,22 @@ static void print_bbccs(const HChar* trigger, Bool only_current_thread)
 }
 
 
+/* With --sample-every, there is only the one profile of all threads,
+ * and each dump gets a file of its own. */
+static void print_samples(const HChar* trigger)
+{
+  Int i;
+
+  CLG_ASSERT(dumps_initialized);
+  i = VG_(sprintf)(filename, "%s", out_file);
+  if (trigger)
+    VG_(sprintf)(filename+i, ".%d", out_counter);
+
+  CLG_DEBUG(2, "  print_samples '%s'\n", filename);
+  CLG_(dump_samples)(filename);
+}
+
+
 void CLG_(dump_profile)(const HChar* trigger, Bool only_current_thread)
 {
    CLG_DEBUG(2, "+ dump_profile(Trigger '%s')\n",
@@ -1489,7 +1505,10 @@ void CLG_(dump_profile)(const HChar* trigger, Bool only_current_thread)
 
    out_counter++;
 
-   print_bbccs(trigger, only_current_thread);
+   if (CLG_(clo).sample_every > 0)
+      print_samples(trigger);
+   else
+      print_bbccs(trigger, only_current_thread);
 
    bbs_done = CLG_(stat).bb_executions++;
 
@@ -110,6 +110,7 @@ struct _CommandLineOptions {
   Bool instrument_atstart;  /* Instrument at start? */
   Bool simulate_cache;      /* Call into cache simulator ? */
   Bool simulate_branch;     /* Call into branch prediction simulator ? */
+  ULong sample_every;       /* Sample call stack every xxx instrs (0=off) */
 
   /* Call graph generation */
   Bool pop_on_jump;       /* Handle a jump between functions as ret+call */
@@ -689,6 +690,7 @@ void CLG_(collectBlockInfo)(IRSB* bbIn, UInt*, UInt*, Bool*);
 void CLG_(set_instrument_state)(const HChar*,Bool);
 void CLG_(dump_profile)(const HChar* trigger,Bool only_current_thread);
 void CLG_(zero_all_cost)(Bool only_current_thread);
+void CLG_(dump_samples)(const HChar* filename);
 Int CLG_(get_dump_counter)(void);
 void CLG_(fini)(Int exitcode);
 
@@ -38,6 +38,8 @@
 #include "pub_tool_threadstate.h"
 #include "pub_tool_gdbserver.h"
 #include "pub_tool_transtab.h"       // VG_(discard_translations_safely)
+#include "pub_tool_execontext.h"
+#include "pub_tool_xtree.h"
 
 #include "cg_branchpred.c"
 
@@ -949,6 +951,146 @@ void addBBSetupCall(ClgState* clgs)
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Sampling (--sample-every)                            ---*/
+/*------------------------------------------------------------*/
+
+/* With --sample-every=<n>, blocks are not given the full
+ * instrumentation.  Each one only subtracts its instruction count from
+ * sample_left, and when that goes negative, sample_hit() charges the
+ * instructions of the elapsed periods to the current call stack of the
+ * guest.  The stack is unwound by Valgrind from the guest registers,
+ * as is done for errors, so it is only as deep as --num-callers.
+ *
+ * The samples are kept in an XTree, which also writes them out in
+ * callgrind format with inclusive costs for the call arcs.
+ */
+
+static Word   sample_left;
+static XTree* sample_xt = NULL;
+static ULong  sample_periods = 0;   /* total periods elapsed */
+
+static void sample_init(void* value)
+{
+   *(ULong*)value = 0;
+}
+
+static void sample_add(void* to, const void* value)
+{
+   *(ULong*)to += *(const ULong*)value;
+}
+
+static void sample_sub(void* from, const void* value)
+{
+   *(ULong*)from -= *(const ULong*)value;
+}
+
+static const HChar* sample_img(const void* value)
+{
+   static HChar buf[21];
+
+   VG_(sprintf)(buf, "%llu", *(const ULong*)value);
+   return buf;
+}
+
+static void sample_new_xt(void)
+{
+   if (sample_xt)
+      VG_(XT_delete)(sample_xt);
+   sample_xt = VG_(XT_create)(VG_(malloc), "cl.main.snx.1", VG_(free),
+                              sizeof(ULong), sample_init,
+                              sample_add, sample_sub,
+                              VG_(XT_filter_maybe_below_main));
+}
+
+/* Called at the start of a block which made sample_left negative.
+ * The guest registers still are those on entry to the block. */
+static VG_REGPARM(0)
+void sample_hit(void)
+{
+   ULong periods = 0, cost;
+
+   while (sample_left < 0) {
+      sample_left += CLG_(clo).sample_every;
+      periods++;
+   }
+   sample_periods += periods;
+
+   if (!CLG_(current_state).collect) return;
+
+   cost = periods * CLG_(clo).sample_every;
+   VG_(XT_add_to_ec)(sample_xt,
+                     VG_(record_ExeContext)(VG_(get_running_tid)(), 0),
+                     &cost);
+}
+
+/* Writes the samples since the last dump, and starts over. */
+void CLG_(dump_samples)(const HChar* filename)
+{
+   VG_(XT_callgrind_print)(sample_xt, filename, "Ir", sample_img);
+   sample_new_xt();
+}
+
+static
+IRSB* sample_instrument(IRSB* sbIn, IRType hWordTy)
+{
+   Int      i, instrs = 0;
+   IRSB*    sbOut;
+   IRTemp   left, newleft, guard;
+   IRDirty* di;
+   Bool     is64 = (hWordTy == Ity_I64);
+
+   for (i = 0; i < sbIn->stmts_used; i++)
+      if (sbIn->stmts[i]->tag == Ist_IMark) instrs++;
+
+   sbOut = deepCopyIRSBExceptStmts(sbIn);
+
+   // Copy verbatim any IR preamble preceding the first IMark
+   i = 0;
+   while (i < sbIn->stmts_used && sbIn->stmts[i]->tag != Ist_IMark) {
+      addStmtToIRSB( sbOut, sbIn->stmts[i] );
+      i++;
+   }
+
+   if (instrs > 0) {
+      // sample_left -= instrs; if (sample_left < 0) sample_hit();
+      left    = newIRTemp(sbOut->tyenv, hWordTy);
+      newleft = newIRTemp(sbOut->tyenv, hWordTy);
+      guard   = newIRTemp(sbOut->tyenv, Ity_I1);
+      addStmtToIRSB( sbOut,
+                     IRStmt_WrTmp(left,
+                                  IRExpr_Load(CLGEndness, hWordTy,
+                                              mkIRExpr_HWord(
+                                                 (HWord)&sample_left))) );
+      addStmtToIRSB( sbOut,
+                     IRStmt_WrTmp(newleft,
+                                  IRExpr_Binop(is64 ? Iop_Sub64 : Iop_Sub32,
+                                               IRExpr_RdTmp(left),
+                                               mkIRExpr_HWord(instrs))) );
+      addStmtToIRSB( sbOut,
+                     IRStmt_Store(CLGEndness,
+                                  mkIRExpr_HWord((HWord)&sample_left),
+                                  IRExpr_RdTmp(newleft)) );
+      addStmtToIRSB( sbOut,
+                     IRStmt_WrTmp(guard,
+                                  IRExpr_Binop(is64 ? Iop_CmpLT64S
+                                                    : Iop_CmpLT32S,
+                                               IRExpr_RdTmp(newleft),
+                                               mkIRExpr_HWord(0))) );
+      di = unsafeIRDirty_0_N( 0, "sample_hit",
+                              VG_(fnptr_to_fnentry)( &sample_hit ),
+                              mkIRExprVec_0() );
+      di->guard = IRExpr_RdTmp(guard);
+      addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
+   }
+
+   for (/*use current i*/; i < sbIn->stmts_used; i++)
+      addStmtToIRSB( sbOut, sbIn->stmts[i] );
+
+   return sbOut;
+}
+
+
 static
 IRSB* CLG_(instrument)( VgCallbackClosure* closure,
                         IRSB* sbIn,
@@ -977,6 +1119,9 @@ IRSB* CLG_(instrument)( VgCallbackClosure* closure,
        return sbIn;
    }
 
+   if (CLG_(clo).sample_every > 0)
+      return sample_instrument(sbIn, hWordTy);
+
    CLG_DEBUG(3, "+ instrument(BB %#lx)\n", (Addr)closure->readdr);
 
    /* Set up SB for instrumented IR */
@@ -1423,6 +1568,9 @@ void CLG_(zero_all_cost)(Bool only_current_thread)
   else
     CLG_(forall_threads)(zero_thread_cost);
 
+  if (sample_xt)
+    sample_new_xt();
+
   if (VG_(clo_verbosity) > 1)
     VG_(message)(Vg_DebugMsg, "  ...done\n");
 }
@@ -1893,6 +2041,19 @@ void finish(void)
   CLG_(dump_profile)(0, False);
 
   if (VG_(clo_verbosity) == 0) return;
+
+  if (CLG_(clo).sample_every > 0) {
+    ULong instrs = sample_periods * CLG_(clo).sample_every
+                   + (CLG_(clo).sample_every - sample_left);
+    l1 = ULong_width(instrs);
+    VG_(sprintf)(fmt, "%%s %%,%dllu\n", l1);
+    VG_(message)(Vg_UserMsg, "Sampled every %llu instructions\n",
+                 CLG_(clo).sample_every);
+    VG_(message)(Vg_UserMsg, "\n");
+    VG_(umsg)(fmt, "I   refs:     ", instrs);
+    VG_(umsg)(fmt, "Samples:      ", sample_periods);
+    return;
+  }
   
   if (VG_(clo_stats)) {
     VG_(message)(Vg_DebugMsg, "\n");
@@ -2007,6 +2168,18 @@ void CLG_(post_clo_init)(void)
       VG_(clo_vex_control).guest_chase_thresh = 0; // cannot be overridden.
    }
    
+   if (CLG_(clo).sample_every > 0) {
+      if (CLG_(clo).simulate_cache || CLG_(clo).simulate_branch) {
+         VG_(message)(Vg_UserMsg,
+                      "--sample-every does not support simulations\n"
+                      "=> switching off --cache-sim and --branch-sim\n");
+         CLG_(clo).simulate_cache = False;
+         CLG_(clo).simulate_branch = False;
+      }
+      sample_left = CLG_(clo).sample_every;
+      sample_new_xt();
+   }
+
    CLG_DEBUG(1, "  dump threads: %s\n", CLG_(clo).separate_threads ? "Yes":"No");
    CLG_DEBUG(1, "  call sep. : %d\n", CLG_(clo).separate_callers);
    CLG_DEBUG(1, "  rec. sep. : %d\n", CLG_(clo).separate_recursions);
@@ -279,14 +279,22 @@
 
 /* Max number of segments we can track.  On Android, virtual address
    space is limited, so keep a low limit -- 5000 x sizef(NSegment) is
-   360KB. */
-#if defined(VGPV_arm_linux_android) \
-    || defined(VGPV_x86_linux_android) \
-    || defined(VGPV_mips32_linux_android) \
-    || defined(VGPV_arm64_linux_android)
-# define VG_N_SEGMENTS 5000
-#else
-# define VG_N_SEGMENTS 30000
+   360KB.  On 64-bit hosts allow for guests with very many mappings
+   (the array is in .bss, so pages beyond the ones in use cost only
+   address space).  The array has to be static, since it is needed
+   before any allocator exists, so a different limit can only be had
+   by rebuilding with -DVG_N_SEGMENTS=<n> in CPPFLAGS. */
+#if !defined(VG_N_SEGMENTS)
+# if defined(VGPV_arm_linux_android) \
+     || defined(VGPV_x86_linux_android) \
+     || defined(VGPV_mips32_linux_android) \
+     || defined(VGPV_arm64_linux_android)
+#  define VG_N_SEGMENTS 5000
+# elif VG_WORDSIZE == 8
+#  define VG_N_SEGMENTS 262144
+# else
+#  define VG_N_SEGMENTS 30000
+# endif
 #endif
 
 /* Array [0 .. nsegments_used-1] of all mappings. */
@@ -332,6 +340,14 @@ static Addr aspacem_cStart = 0;
 // Where aspacem will start looking for Valgrind space
 static Addr aspacem_vStart = 0;
 
+// No free segment lies between aspacem_cStart (resp. aspacem_vStart)
+// and these addresses, so VG_(am_get_advisory) can start its search
+// here instead, rather than stepping over every mapping below.
+// add_segment lowers them whenever it creates a free segment.  Not
+// used on Solaris, where the search runs downwards.
+static Addr aspacem_cFreeHint = 0;
+static Addr aspacem_vFreeHint = 0;
+
 
 #define AM_SANITY_CHECK                                      \
    do {                                                      \
@@ -710,6 +726,19 @@ static Bool maybe_merge_nsegments ( NSegment* s1, const NSegment* s2 )
 }
 
 
+/* Remove the N segments starting at index I, sliding the ones above
+   down to fill the hole. */
+
+static void remove_nsegments ( Int i, Int n )
+{
+   Int j;
+   aspacem_assert(n >= 0 && i >= 0 && i + n <= nsegments_used);
+   for (j = i; j < nsegments_used - n; j++)
+      nsegments[j] = nsegments[j+n];
+   nsegments_used -= n;
+}
+
+
 /* Sanity-check and canonicalise the segment array (merge mergable
    segments).  Returns True if any segments were merged. */
 
@@ -749,6 +778,26 @@ static Bool preen_nsegments ( void )
 }
 
 
+/* Merge the segment at index I with its neighbours, if possible.
+   This is all add_segment needs: it replaces a range with one
+   segment, so only the two boundaries of that segment can have
+   become mergeable.  Unlike preen_nsegments, it does not scan the
+   whole array, which matters when there are very many segments. */
+
+static void preen_nsegments_around ( Int i )
+{
+   aspacem_assert(i >= 0 && i < nsegments_used);
+   aspacem_assert(sane_NSegment(&nsegments[i]));
+
+   if (i+1 < nsegments_used
+       && maybe_merge_nsegments(&nsegments[i], &nsegments[i+1]))
+      remove_nsegments(i+1, 1);
+   if (i > 0
+       && maybe_merge_nsegments(&nsegments[i-1], &nsegments[i]))
+      remove_nsegments(i, 1);
+}
+
+
 /* Check the segment array corresponds with the kernel's view of
    memory layout.  sync_check_ok returns True if no anomalies were
    found, else False.  In the latter case the mismatching segments are
@@ -1081,6 +1130,10 @@ inline static Int find_nsegment_idx ( Addr a )
    static Addr cache_pageno[N_CACHE];
    static Int  cache_segidx[N_CACHE];
    static Bool cache_inited = False;
+   /* The segment found by the previous lookup.  Unlike the page
+      cache, this hits for any address in the segment, which helps
+      when walking through a large mapping page by page. */
+   static Int  last_segidx = 0;
 
 #  ifdef N_Q_M_STATS
    static UWord n_q = 0;
@@ -1092,6 +1145,11 @@ inline static Int find_nsegment_idx ( Addr a )
 
    UWord ix;
 
+   if (last_segidx < nsegments_used
+       && nsegments[last_segidx].start <= a
+       && a <= nsegments[last_segidx].end)
+      return last_segidx;
+
    if (LIKELY(cache_inited)) {
       /* do nothing */
    } else {
@@ -1111,6 +1169,7 @@ inline static Int find_nsegment_idx ( Addr a )
        && a <= nsegments[cache_segidx[ix]].end) {
       /* hit */
       /* aspacem_assert( cache_segidx[ix] == find_nsegment_idx_WRK(a) ); */
+      last_segidx = cache_segidx[ix];
       return cache_segidx[ix];
    }
    /* miss */
@@ -1119,6 +1178,7 @@ inline static Int find_nsegment_idx ( Addr a )
 #  endif
    cache_segidx[ix] = find_nsegment_idx_WRK(a);
    cache_pageno[ix] = a >> 12;
+   last_segidx = cache_segidx[ix];
    return cache_segidx[ix];
 #  undef N_CACHE
 }
@@ -1466,15 +1526,21 @@ static void add_segment ( const NSegment* seg )
       ML_(am_dec_refcount)(nsegments[i].fnIdx);
    delta = iHi - iLo;
    aspacem_assert(delta >= 0);
-   if (delta > 0) {
-      for (i = iLo; i < nsegments_used-delta; i++)
-         nsegments[i] = nsegments[i+delta];
-      nsegments_used -= delta;
-   }
+   if (delta > 0)
+      remove_nsegments(iLo+1, delta);
 
    nsegments[iLo] = *seg;
 
-   (void)preen_nsegments();
+   if (seg->kind == SkFree) {
+      if (sStart < aspacem_cFreeHint) aspacem_cFreeHint = sStart;
+      if (sStart < aspacem_vFreeHint) aspacem_vFreeHint = sStart;
+   }
+
+   /* Only the neighbours of the new segment can need merging.  At
+      high sanity levels, check (and preen) the whole array. */
+   preen_nsegments_around(iLo);
+   if (VG_(clo_sanity_level) >= 3)
+      (void)preen_nsegments();
    if (0) VG_(am_show_nsegments)(0,"AFTER preen (add_segment)");
 }
 
@@ -1900,6 +1966,7 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
       found. */
    Int floatIdx = -1;
    Int fixedIdx = -1;
+   Int firstFreeIdx = -1;
 
    aspacem_assert(nsegments_used > 0);
 
@@ -1977,7 +2044,12 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
    /* Don't waste time looking for a fixed match if not requested to. */
    fixed_not_required = req->rkind == MAny || req->rkind == MAlign;
 
+#if defined(VGO_solaris)
    i = find_nsegment_idx(startPoint);
+#else
+   Addr* freeHint = forClient ? &aspacem_cFreeHint : &aspacem_vFreeHint;
+   i = find_nsegment_idx(*freeHint > startPoint ? *freeHint : startPoint);
+#endif
 
 #if defined(VGO_solaris)
 #  define UPDATE_INDEX(index)                               \
@@ -2011,6 +2083,9 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
          continue;
       }
 
+      if (firstFreeIdx == -1)
+         firstFreeIdx = i;
+
       holeStart = nsegments[i].start;
       holeEnd   = nsegments[i].end;
 
@@ -2052,6 +2127,14 @@ Addr VG_(am_get_advisory) ( const MapRequest*  req,
    if (floatIdx >= 0) 
       aspacem_assert(nsegments[floatIdx].kind == SkFree);
 
+#if !defined(VGO_solaris)
+   /* Everything from the start point up to the first hole we found is
+      in use.  (If the search wrapped before finding a hole, the hole
+      lies below the start point and tells us nothing.) */
+   if (firstFreeIdx >= 0 && nsegments[firstFreeIdx].start >= startPoint)
+      *freeHint = nsegments[firstFreeIdx].start;
+#endif
+
    AM_SANITY_CHECK;
 
    /* Now see if we found anything which can satisfy the request. */
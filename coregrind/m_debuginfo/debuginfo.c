@@ -52,6 +52,7 @@
 #include "pub_core_execontext.h"
 #include "pub_core_stacktrace.h" // VG_(get_StackTrace) XXX: circular dependency
 #include "pub_core_ume.h"
+#include "pub_core_tooliface.h"  // VG_(needs).lazy_debuginfo
 
 #include "priv_misc.h"           /* dinfo_zalloc/free */
 #include "priv_image.h"
@@ -223,6 +224,10 @@ static inline UInt ROL32 ( UInt x, UInt n )
    linked list of DebugInfos. */
 static DebugInfo* debugInfo_list = NULL;
 
+/* How many DebugInfos have .deferred set.  Lets queries skip looking
+   for them in the common case where there are none. */
+static UInt n_deferred_DebugInfos = 0;
+
 
 /* Find 'di' in the debugInfo_list and move it one step closer to the
    front of the list, so as to make subsequent searches for it
@@ -344,6 +349,8 @@ static void free_DebugInfo ( DebugInfo* di )
    if (di->loctab)       ML_(dinfo_free)(di->loctab);
    if (di->loctab_fndn_ix) ML_(dinfo_free)(di->loctab_fndn_ix);
    if (di->inltab)       ML_(dinfo_free)(di->inltab);
+   if (di->inlseg)       ML_(dinfo_free)(di->inlseg);
+   if (di->inlseg_cov)   ML_(dinfo_free)(di->inlseg_cov);
    if (di->cfsi_base)    ML_(dinfo_free)(di->cfsi_base);
    if (di->cfsi_m_ix)    ML_(dinfo_free)(di->cfsi_m_ix);
    if (di->cfsi_rd)      ML_(dinfo_free)(di->cfsi_rd);
@@ -472,6 +479,10 @@ static void discard_or_archive_DebugInfo ( DebugInfo* di )
          if (curr->have_dinfo) {
             VG_(redir_notify_delete_DebugInfo)( curr );
          }
+         if (curr->deferred) {
+            vg_assert(n_deferred_DebugInfos > 0);
+            n_deferred_DebugInfos--;
+         }
          if (archive) {
             /* Adjust the epoch markers appropriately. */
             di->last_epoch = VG_(current_DiEpoch)();
@@ -491,6 +502,9 @@ static void discard_or_archive_DebugInfo ( DebugInfo* di )
 }
 
 
+static Bool DebugInfo_maps_overlap ( const DebugInfo* di,
+                                     Addr start, SizeT len );
+
 /* Repeatedly scan debugInfo_list, looking for DebugInfos with text
    AVMAs intersecting [start,start+length), and call discard_DebugInfo
    to get rid of them.  This modifies the list, hence the multiple
@@ -509,6 +523,13 @@ static Bool discard_syms_in_range ( Addr start, SizeT length )
       while (True) {
          if (curr == NULL)
             break;
+         if (curr->deferred) {
+            /* No text range yet, so go by the mappings. */
+            if (DebugInfo_maps_overlap(curr, start, length)) {
+               found = True;
+               break;
+            }
+         } else
          if (is_DebugInfo_archived(curr)
              || !curr->text_present
              || (curr->text_present
@@ -571,6 +592,20 @@ static Bool do_DebugInfos_overlap ( const DebugInfo* di1, const DebugInfo* di2 )
 }
 
 
+/* Does any mapping of 'di' intersect [start,+len) ? */
+static Bool DebugInfo_maps_overlap ( const DebugInfo* di,
+                                     Addr start, SizeT len )
+{
+   Word i;
+   for (i = 0; i < VG_(sizeXA)(di->fsm.maps); i++) {
+      const DebugInfoMapping* map = VG_(indexXA)(di->fsm.maps, i);
+      if (ranges_overlap(map->avma, map->size, start, len))
+         return True;
+   }
+   return False;
+}
+
+
 /* Discard or archive all elements of debugInfo_list whose .mark bit is set.
 */
 static void discard_or_archive_marked_DebugInfos ( void )
@@ -933,40 +968,13 @@ static void truncate_DebugInfoMapping_overlaps
    update the FSM and determine when an accept state has been reached.
 */
 
-/* When the sequence of observations causes a DebugInfoFSM to move
-   into the accept state, call here to actually get the debuginfo read
-   in.  Returns a ULong whose purpose is described in comments 
-   preceding VG_(di_notify_mmap) just below.
-*/
-static ULong di_notify_ACHIEVE_ACCEPT_STATE ( struct _DebugInfo* di )
+/* Read the symbols and debug info for 'di', whose mappings are
+   already de-overlapped, and notify m_redir of them.  If 'di' is still
+   allocated it becomes active.  Returns True on success. */
+static Bool read_DebugInfo ( struct _DebugInfo* di )
 {
-   ULong di_handle;
-   Bool  ok;
+   Bool ok;
 
-   advance_current_DiEpoch("di_notify_ACHIEVE_ACCEPT_STATE");
-
-   vg_assert(di->fsm.filename);
-   TRACE_SYMTAB("\n");
-   TRACE_SYMTAB("------ start ELF OBJECT "
-                "-------------------------"
-                "------------------------------\n");
-   TRACE_SYMTAB("------ name = %s\n", di->fsm.filename);
-   TRACE_SYMTAB("\n");
-
-   /* We're going to read symbols and debug info for the avma
-      ranges specified in the _DebugInfoFsm mapping array. First
-      get rid of any other DebugInfos which overlap any of those
-      ranges (to avoid total confusion).  But only those valid in
-     the current epoch.  We don't want to discard archived DebugInfos. */
-   discard_DebugInfos_which_overlap_with( di );
-
-   /* The DebugInfoMappings that now exist in the FSM may involve
-      overlaps.  This confuses ML_(read_elf_debug_info), and may cause
-      it to compute wrong biases.  So de-overlap them now.
-      See http://bugzilla.mozilla.org/show_bug.cgi?id=788974 */
-   truncate_DebugInfoMapping_overlaps( di, di->fsm.maps );
-
-   /* And acquire new info. */
 #  if defined(VGO_linux) || defined(VGO_solaris)
    ok = ML_(read_elf_debug_info)( di );
 #  elif defined(VGO_darwin)
@@ -991,11 +999,12 @@ static ULong di_notify_ACHIEVE_ACCEPT_STATE ( struct _DebugInfo* di )
 
       // Mark di's first epoch point as a valid epoch.  Because its
       // last_epoch value is still invalid, this changes di's state from
-      // "allocated" to "active".
-      vg_assert(is_DebugInfo_allocated(di));
-      di->first_epoch = VG_(current_DiEpoch)();
+      // "allocated" to "active".  A deferred di was made active when
+      // it was mapped, and keeps that epoch.
+      if (is_DebugInfo_allocated(di))
+         di->first_epoch = VG_(current_DiEpoch)();
       vg_assert(is_DebugInfo_active(di));
-      show_epochs("di_notify_ACHIEVE_ACCEPT_STATE success");
+      show_epochs("read_DebugInfo success");
 
       /* notify m_redir about it */
       TRACE_SYMTAB("\n------ Notifying m_redir ------\n");
@@ -1003,17 +1012,129 @@ static ULong di_notify_ACHIEVE_ACCEPT_STATE ( struct _DebugInfo* di )
       /* Note that we succeeded */
       di->have_dinfo = True;
       vg_assert(di->handle > 0);
-      di_handle = di->handle;
 
    } else {
       TRACE_SYMTAB("\n------ ELF reading failed ------\n");
       /* Something went wrong (eg. bad ELF file).  Should we delete
          this DebugInfo?  No - it contains info on the rw/rx
-         mappings, at least. */
-      di_handle = 0;
+         mappings, at least.  But a deferred one goes back to being
+         merely allocated, as it would have been if read at once. */
+      di->first_epoch = DiEpoch_INVALID();
       vg_assert(di->have_dinfo == False);
    }
 
+   return ok;
+}
+
+
+/* Can the reading of 'di' be put off until it is queried? */
+static Bool can_defer_DebugInfo ( const DebugInfo* di )
+{
+   /* Archived DebugInfos must be complete, as their mappings and
+      perhaps their files are gone by the time they are queried. */
+   return VG_(needs).lazy_debuginfo
+          && !VG_(clo_keep_debuginfo)
+          && VG_(redir_can_defer_DebugInfo)( di->fsm.filename );
+}
+
+/* Do the reading that was put off for 'di'. */
+static void load_deferred_DebugInfo ( DebugInfo* di )
+{
+   vg_assert(di->deferred);
+   vg_assert(n_deferred_DebugInfos > 0);
+   di->deferred = False;
+   n_deferred_DebugInfos--;
+
+   TRACE_SYMTAB("\n");
+   TRACE_SYMTAB("------ start deferred ELF OBJECT "
+                "----------------------------------------------\n");
+   TRACE_SYMTAB("------ name = %s\n", di->fsm.filename);
+   (void) read_DebugInfo( di );
+   TRACE_SYMTAB("------ end deferred ELF OBJECT "
+                "------------------------------------------------\n");
+}
+
+/* Read any deferred DebugInfo with a mapping containing 'a', ahead of
+   a query about 'a'. */
+static void load_deferred_DebugInfos_at ( Addr a )
+{
+   DebugInfo* di;
+   if (LIKELY(n_deferred_DebugInfos == 0))
+      return;
+   /* Reading may run queries that reorder the list, so start again
+      after each one. */
+   do {
+      for (di = debugInfo_list; di; di = di->next) {
+         if (di->deferred && DebugInfo_maps_overlap(di, a, 1))
+            break;
+      }
+      if (di)
+         load_deferred_DebugInfo( di );
+   } while (di);
+}
+
+void VG_(di_load_deferred_DebugInfos) ( void )
+{
+   DebugInfo* di;
+   if (LIKELY(n_deferred_DebugInfos == 0))
+      return;
+   while (n_deferred_DebugInfos > 0) {
+      for (di = debugInfo_list; !di->deferred; di = di->next)
+         ;
+      load_deferred_DebugInfo( di );
+   }
+}
+
+
+/* When the sequence of observations causes a DebugInfoFSM to move
+   into the accept state, call here to actually get the debuginfo read
+   in, or to put that off until it is queried.  Returns a ULong whose
+   purpose is described in comments preceding VG_(di_notify_mmap) just
+   below.
+*/
+static ULong di_notify_ACHIEVE_ACCEPT_STATE ( struct _DebugInfo* di )
+{
+   ULong di_handle;
+
+   advance_current_DiEpoch("di_notify_ACHIEVE_ACCEPT_STATE");
+
+   vg_assert(di->fsm.filename);
+   TRACE_SYMTAB("\n");
+   TRACE_SYMTAB("------ start ELF OBJECT "
+                "-------------------------"
+                "------------------------------\n");
+   TRACE_SYMTAB("------ name = %s\n", di->fsm.filename);
+   TRACE_SYMTAB("\n");
+
+   /* We're going to read symbols and debug info for the avma
+      ranges specified in the _DebugInfoFsm mapping array. First
+      get rid of any other DebugInfos which overlap any of those
+      ranges (to avoid total confusion).  But only those valid in
+     the current epoch.  We don't want to discard archived DebugInfos. */
+   discard_DebugInfos_which_overlap_with( di );
+
+   /* The DebugInfoMappings that now exist in the FSM may involve
+      overlaps.  This confuses ML_(read_elf_debug_info), and may cause
+      it to compute wrong biases.  So de-overlap them now.
+      See http://bugzilla.mozilla.org/show_bug.cgi?id=788974 */
+   truncate_DebugInfoMapping_overlaps( di, di->fsm.maps );
+
+   /* And acquire new info, now or when it is first wanted.  A deferred
+      di is active from here on, so that queries in this epoch find
+      it. */
+   if (can_defer_DebugInfo(di)) {
+      TRACE_SYMTAB("\n------ Reading deferred ------\n");
+      vg_assert(is_DebugInfo_allocated(di));
+      di->first_epoch = VG_(current_DiEpoch)();
+      di->deferred = True;
+      n_deferred_DebugInfos++;
+      di_handle = di->handle;
+   } else if (read_DebugInfo( di )) {
+      di_handle = di->handle;
+   } else {
+      di_handle = 0;
+   }
+
    TRACE_SYMTAB("\n");
    TRACE_SYMTAB("------ name = %s\n", di->fsm.filename);
    TRACE_SYMTAB("------ end ELF OBJECT "
@@ -1751,10 +1872,9 @@ struct _InlIPCursor {
    Addr eip;             // Cursor used to describe calls at eip.
    DebugInfo* di;        // DebugInfo describing inlined calls at eip
 
-   Word    inltab_lopos; // The inlined fn calls covering eip are in
-   Word    inltab_hipos; // di->inltab[inltab_lopos..inltab_hipos].
-                         // Note that not all inlined fn calls in this range
-                         // are necessarily covering eip.
+   const UInt* cov;      // The inltab positions of the inlined fn calls
+   UInt  n_cov;          // covering eip are cov[0 .. n_cov-1], deepest
+   UInt  next_cov;       // level first.  next_cov is the next one to use.
 
    Int   curlevel;       // Current level to describe.
                          // 0 means to describe eip itself.
@@ -1775,10 +1895,8 @@ static Bool is_bottom(const InlIPCursor *iipc)
 
 Bool VG_(next_IIPC)(InlIPCursor *iipc)
 {
-   Word i;
-   DiInlLoc *hinl = NULL;
-   Word hinl_pos = -1;
    DebugInfo *di;
+   Word hinl_pos = -1;
 
    if (iipc == NULL)
       return False;
@@ -1788,17 +1906,15 @@ Bool VG_(next_IIPC)(InlIPCursor *iipc)
       return False;
    }
 
+   /* The next level is the deepest one below curlevel.  If several
+      calls at that level cover eip, the first one in inltab is used. */
    di = iipc->di;
-   for (i = iipc->inltab_lopos; i <= iipc->inltab_hipos; i++) {
-      if (di->inltab[i].addr_lo <= iipc->eip 
-          && iipc->eip < di->inltab[i].addr_hi
-          && di->inltab[i].level < iipc->curlevel
-          && (!hinl || hinl->level < di->inltab[i].level)) {
-         hinl = &di->inltab[i];
-         hinl_pos = i;
-      }
-   }
-   
+   while (iipc->next_cov < iipc->n_cov
+          && di->inltab[iipc->cov[iipc->next_cov]].level >= iipc->curlevel)
+      iipc->next_cov++;
+   if (iipc->next_cov < iipc->n_cov)
+      hinl_pos = iipc->cov[iipc->next_cov++];
+
    iipc->cur_inltab = iipc->next_inltab;
    iipc->next_inltab = hinl_pos;
    if (iipc->next_inltab < 0)
@@ -1813,80 +1929,176 @@ Bool VG_(next_IIPC)(InlIPCursor *iipc)
 static void search_all_loctabs ( DiEpoch ep, Addr ptr,
                                  /*OUT*/DebugInfo** pdi, /*OUT*/Word* locno );
 
-/* Returns the position after which eip would be inserted in inltab.
-   (-1 if eip should be inserted before position 0).
-   This is the highest position with an addr_lo <= eip.
-   As inltab is sorted on addr_lo, dichotomic search can be done
-   (note that inltab might have duplicates addr_lo). */
-static Word inltab_insert_pos (DebugInfo *di, Addr eip)
+/* True if inltab entry a comes before entry b in the inlseg_cov list of
+   a piece covered by both: deepest level first, then in inltab order. */
+static Bool inl_cov_before ( const DebugInfo* di, UInt a, UInt b )
 {
-   Word mid, 
-        lo = 0, 
-        hi = di->inltab_used-1;
-   while (lo <= hi) {
-      mid      = (lo + hi) / 2;
-      if (eip < di->inltab[mid].addr_lo) { hi = mid-1; continue; } 
-      if (eip > di->inltab[mid].addr_lo) { lo = mid+1; continue; }
-      lo = mid; break;
+   if (di->inltab[a].level != di->inltab[b].level)
+      return di->inltab[a].level > di->inltab[b].level;
+   return a < b;
+}
+
+/* Builds di->inlseg and di->inlseg_cov from di->inltab, which is sorted
+   on addr_lo.  This sweeps over the boundaries of the inltab entries,
+   keeping the entries covering the current piece in 'active', in
+   inlseg_cov order.  The active set is small (at most the depth of
+   inlining, give or take overlapping ranges), so the total cost is
+   about the size of inltab times the inlining depth. */
+static void build_inl_index ( DebugInfo* di )
+{
+   XArray* segs   = VG_(newXA)(ML_(dinfo_zalloc), "di.build_inl_index.1",
+                               ML_(dinfo_free), sizeof(DiInlSeg));
+   XArray* cov    = VG_(newXA)(ML_(dinfo_zalloc), "di.build_inl_index.2",
+                               ML_(dinfo_free), sizeof(UInt));
+   XArray* active = VG_(newXA)(ML_(dinfo_zalloc), "di.build_inl_index.3",
+                               ML_(dinfo_free), sizeof(UInt));
+   UWord   next = 0; // next inltab entry to become active
+   Word    i, j, n_active;
+   UInt*   act;
+   DiInlSeg seg;
+
+   vg_assert(di->inltab_used > 0);
+   vg_assert(di->inltab_used < (UWord)(UInt)-1);
+
+   while (next < di->inltab_used || VG_(sizeXA)(active) > 0) {
+      /* The next boundary: the first end of an active entry, or the
+         start of the next entry, whichever comes first. */
+      Addr b = next < di->inltab_used ? di->inltab[next].addr_lo : (Addr)-1;
+      n_active = VG_(sizeXA)(active);
+      for (i = 0; i < n_active; i++) {
+         UInt e = *(UInt*)VG_(indexXA)(active, i);
+         if (di->inltab[e].addr_hi < b)
+            b = di->inltab[e].addr_hi;
+      }
+
+      /* Drop the entries ending at b ... */
+      for (i = j = 0; i < n_active; i++) {
+         UInt e = *(UInt*)VG_(indexXA)(active, i);
+         if (di->inltab[e].addr_hi > b)
+            *(UInt*)VG_(indexXA)(active, j++) = e;
+      }
+      VG_(dropTailXA)(active, n_active - j);
+
+      /* ... and insert those starting at b, keeping the order. */
+      while (next < di->inltab_used && di->inltab[next].addr_lo == b) {
+         UInt e = next++;
+         VG_(addToXA)(active, &e);
+         n_active = VG_(sizeXA)(active);
+         act = VG_(indexXA)(active, 0);
+         for (i = n_active - 1; i > 0 && inl_cov_before(di, e, act[i-1]); i--)
+            act[i] = act[i-1];
+         act[i] = e;
+      }
+
+      seg.addr_lo = b;
+      seg.cov_ix = VG_(sizeXA)(cov);
+      n_active = VG_(sizeXA)(active);
+      for (i = 0; i < n_active; i++)
+         VG_(addToXA)(cov, VG_(indexXA)(active, i));
+      VG_(addToXA)(segs, &seg);
    }
 
-   while (lo <= di->inltab_used-1 && di->inltab[lo].addr_lo <= eip)
-      lo++;
-#if 0
-   for (mid = 0; mid <= di->inltab_used-1; mid++)
-      if (eip < di->inltab[mid].addr_lo)
-         break;
-   vg_assert (lo - 1 == mid - 1);
-#endif
+   /* The last piece is the one after the end of all entries. */
+   vg_assert(VG_(sizeXA)(segs) > 0);
+   vg_assert(((DiInlSeg*)VG_(indexXA)(segs, VG_(sizeXA)(segs) - 1))->cov_ix
+             == VG_(sizeXA)(cov));
+
+   di->inlseg_used = VG_(sizeXA)(segs);
+   di->inlseg = ML_(dinfo_zalloc)("di.build_inl_index.4",
+                                  di->inlseg_used * sizeof(DiInlSeg));
+   VG_(memcpy)(di->inlseg, VG_(indexXA)(segs, 0),
+               di->inlseg_used * sizeof(DiInlSeg));
+   di->inlseg_cov = ML_(dinfo_zalloc)("di.build_inl_index.5",
+                                      (VG_(sizeXA)(cov) + 1) * sizeof(UInt));
+   if (VG_(sizeXA)(cov) > 0)
+      VG_(memcpy)(di->inlseg_cov, VG_(indexXA)(cov, 0),
+                  VG_(sizeXA)(cov) * sizeof(UInt));
+   VG_(deleteXA)(segs);
+   VG_(deleteXA)(cov);
+   VG_(deleteXA)(active);
+}
+
+/* Returns the piece of di->inlseg containing eip, or -1 if eip is
+   before all of them. */
+static Word inlseg_search ( const DebugInfo* di, Addr eip )
+{
+   Word mid,
+        lo = 0,
+        hi = di->inlseg_used-1;
+   while (lo <= hi) {
+      mid = (lo + hi) / 2;
+      if (eip < di->inlseg[mid].addr_lo) { hi = mid-1; continue; }
+      lo = mid+1;
+   }
    return lo - 1;
 }
 
+/* Caching of the (epoch, eip) -> (DebugInfo, piece) lookups done when
+   creating an InlIPCursor.  Stack traces are described over and over
+   with the same IPs, and the search through all the loctabs is what
+   costs most for an eip in an inlined call. */
+#define N_INL_CACHE 509
+
+typedef
+   struct {
+      DiEpoch    ep;   // (ep, eip) are the key; eip == 0 is never cached
+      Addr       eip;
+      DebugInfo* di;   // NULL if no inlined call covers eip
+      Word       seg;
+   }
+   Inl_CacheEnt;
+
+static Inl_CacheEnt inl_cache[N_INL_CACHE];
+
+static void inl_cache__invalidate ( void ) {
+   VG_(memset)(&inl_cache, 0, sizeof(inl_cache));
+}
+
 InlIPCursor* VG_(new_IIPC)(DiEpoch ep, Addr eip)
 {
    DebugInfo*  di;
    Word        locno;
-   Word        i;
+   Word        seg;
    InlIPCursor *ret;
    Bool        avail;
+   Inl_CacheEnt* ce;
 
    if (!VG_(clo_read_inline_info))
       return NULL; // No way we can find inlined calls.
 
-   /* Search the DebugInfo for (ep, eip) */
-   search_all_loctabs ( ep, eip, &di, &locno );
-   if (di == NULL || di->inltab_used == 0)
-      return NULL; // No di (with inltab) containing eip.
-
-   /* Search the entry in di->inltab with the highest addr_lo that
-      contains eip. */
-   /* We start from the highest pos in inltab after which eip would
-      be inserted. */
-   for (i = inltab_insert_pos (di, eip); i >= 0; i--) {
-      if (di->inltab[i].addr_lo <= eip && eip < di->inltab[i].addr_hi) {
-         break;
+   ce = &inl_cache[(eip ^ ep.n) % N_INL_CACHE];
+   if (ce->eip == eip && ce->ep.n == ep.n && eip != 0) {
+      di = ce->di;
+      seg = ce->seg;
+   } else {
+      /* Search the DebugInfo for (ep, eip) */
+      search_all_loctabs ( ep, eip, &di, &locno );
+      seg = -1;
+      if (di != NULL && di->inltab_used > 0) {
+         if (di->inlseg == NULL)
+            build_inl_index (di);
+         seg = inlseg_search (di, eip);
       }
-      /* Stop the backward scan when reaching an addr_lo which
-         cannot anymore contain eip : we know that all ranges before
-         i also cannot contain eip. */
-      if (di->inltab[i].addr_lo < eip - di->maxinl_codesz)
-         return NULL;
-   }
-   
-   if (i < 0)
-      return NULL; // No entry containing eip.
-
-   /* We have found the highest entry containing eip.
-      Build a cursor. */
+      if (seg < 0 || seg + 1 >= di->inlseg_used
+          || di->inlseg[seg+1].cov_ix == di->inlseg[seg].cov_ix)
+         di = NULL; // No entry containing eip.
+      ce->ep = ep;
+      ce->eip = eip;
+      ce->di = di;
+      ce->seg = seg;
+   }
+
+   if (di == NULL)
+      return NULL; // No di with an inlined call containing eip.
+
+   /* Build a cursor over the entries covering eip. */
+   vg_assert(seg + 1 < di->inlseg_used);
    ret = ML_(dinfo_zalloc) ("dinfo.new_IIPC", sizeof(*ret));
    ret->eip = eip;
    ret->di = di;
-   ret->inltab_hipos = i;
-   for (i = ret->inltab_hipos - 1; i >= 0; i--) {
-     
-      if (di->inltab[i].addr_lo < eip - di->maxinl_codesz)
-         break; /* Similar stop backward scan logic as above. */
-   }
-   ret->inltab_lopos = i + 1;
+   ret->cov = &di->inlseg_cov[di->inlseg[seg].cov_ix];
+   ret->n_cov = di->inlseg[seg+1].cov_ix - di->inlseg[seg].cov_ix;
+   ret->next_cov = 0;
    ret->curlevel = MAX_LEVEL;
    ret->cur_inltab = -1;
    ret->next_inltab = -1;
@@ -1925,6 +2137,7 @@ static void search_all_symtabs ( DiEpoch ep, Addr ptr,
    DebugInfo* di;
    Bool       inRange;
 
+   load_deferred_DebugInfos_at( ptr );
    for (di = debugInfo_list; di != NULL; di = di->next) {
 
       if (!is_DI_valid_for_epoch(di, ep))
@@ -1985,6 +2198,7 @@ static void search_all_loctabs ( DiEpoch ep, Addr ptr,
 {
    Word       lno;
    DebugInfo* di;
+   load_deferred_DebugInfos_at( ptr );
    for (di = debugInfo_list; di != NULL; di = di->next) {
       if (!is_DI_valid_for_epoch(di, ep))
          continue;
@@ -2357,10 +2571,12 @@ Bool VG_(get_objname) ( DiEpoch ep, Addr a, const HChar** objname )
    for (di = debugInfo_list; di != NULL; di = di->next) {
       if (!is_DI_valid_for_epoch(di, ep))
          continue;
-      if (di->text_present
-          && di->text_size > 0
-          && di->text_avma <= a 
-          && a < di->text_avma + di->text_size) {
+      /* The name alone is no reason to read a deferred DebugInfo. */
+      if ((di->text_present
+           && di->text_size > 0
+           && di->text_avma <= a 
+           && a < di->text_avma + di->text_size)
+          || (di->deferred && ML_(find_rx_mapping)(di, a, a) != NULL)) {
          *objname = di->fsm.filename;
          return True;
       }
@@ -2390,6 +2606,7 @@ DebugInfo* VG_(find_DebugInfo) ( DiEpoch ep, Addr a )
    static UWord n_search = 0;
    DebugInfo* di;
    n_search++;
+   load_deferred_DebugInfos_at( a );
    for (di = debugInfo_list; di != NULL; di = di->next) {
       if (!is_DI_valid_for_epoch(di, ep))
          continue;
@@ -2487,6 +2704,8 @@ Bool VG_(lookup_symbol_SLOW)(DiEpoch ep,
 #  if defined(VG_PLAT_USES_PPCTOC)
    require_pToc = True;
 #  endif
+   /* Deferred DebugInfos don't know their sonames yet. */
+   VG_(di_load_deferred_DebugInfos)();
    for (si = debugInfo_list; si; si = si->next) {
       if (debug)
          VG_(printf)("lookup_symbol_SLOW: considering %s\n", si->soname);
@@ -2936,6 +3155,7 @@ static void find_DiCfSI ( /*OUT*/DebugInfo** diP,
 
    DiEpoch curr_epoch = VG_(current_DiEpoch)();
 
+   load_deferred_DebugInfos_at( ip );
    for (di = debugInfo_list; di != NULL; di = di->next) {
       Word j;
       n_steps++;
@@ -3028,9 +3248,11 @@ static void find_DiCfSI ( /*OUT*/DebugInfo** diP,
    Also, the cache is invalidated when new debuginfo is read due to
    an mmap or some debuginfo is discarded due to an munmap. */
 
-// Prime number, giving about 6Kbytes cache on 32 bits,
-//                           12Kbytes cache on 64 bits.
-#define N_CFSI_M_CACHE 509
+// Prime number, giving about 48Kbytes cache on 32 bits,
+//                           96Kbytes cache on 64 bits.  Big programs
+// unwind through many more distinct IPs than fit in a few hundred
+// entries.
+#define N_CFSI_M_CACHE 4093
 
 typedef
    struct { Addr ip; DebugInfo* di; DiCfSI_m* cfsi_m; }
@@ -4001,6 +4223,7 @@ Bool consider_vars_in_frame ( /*MOD*/XArray* /* of HChar */ dname1,
    if (debug)
       VG_(printf)("QQQQ: cvif: ip,sp,fp %#lx,%#lx,%#lx\n", ip,sp,fp);
    /* first, find the DebugInfo that pertains to 'ip'. */
+   load_deferred_DebugInfos_at( ip );
    for (di = debugInfo_list; di; di = di->next) {
       n_steps++;
       if (!is_DI_valid_for_epoch(di, ep))
@@ -4140,6 +4363,7 @@ Bool VG_(get_data_description)(
       Loop over the DebugInfos we have.  Check data_addr against the
       outermost scope of all of them, as that should be a global
       scope. */
+   load_deferred_DebugInfos_at( data_addr );
    for (di = debugInfo_list; di != NULL; di = di->next) {
       OSet*        global_scope;
       Word         gs_size;
@@ -4564,6 +4788,8 @@ VG_(di_get_global_blocks_from_dihandle) ( ULong di_handle, Bool  arrays_only )
       given handle.  This is considered an error on the part of the
       caller. */
    vg_assert(di != NULL);
+   if (di->deferred)
+      load_deferred_DebugInfo( di );
 
    /* we'll put the collected variables in here. */
    gvars = VG_(newXA)( ML_(dinfo_zalloc), "di.debuginfo.dggbfd.1",
@@ -4805,6 +5031,7 @@ VgSectKind VG_(DebugInfo_sect_kind)( /*OUT*/const HChar** objname, Addr a)
    DebugInfo* di;
    VgSectKind res = Vg_SectUnknown;
 
+   load_deferred_DebugInfos_at( a );
    for (di = debugInfo_list; di != NULL; di = di->next) {
 
       if (0)
@@ -4899,6 +5126,7 @@ UInt VG_(debuginfo_generation) (void)
 static void caches__invalidate ( void ) {
    cfsi_m_cache__invalidate();
    sym_name_cache__invalidate();
+   inl_cache__invalidate();
    debuginfo_generation++;
 }
 
@@ -41,6 +41,7 @@
 #include "pub_core_libcprint.h"
 #include "pub_core_libcproc.h"     /* VG_(read_millisecond_timer) */
 #include "pub_core_libcfile.h"
+#include "pub_core_aspacemgr.h"    /* VG_(am_mmap_file_float_valgrind) */
 #include "priv_misc.h"             /* dinfo_zalloc/free/strdup */
 #include "priv_image.h"            /* self */
 
@@ -57,6 +58,15 @@
 
 #define COMPRESSED_SLICE_ARRAY_GROW_SIZE 64
 
+/* Local files up to this size are mapped whole rather than read
+   through the cache.  On 32-bit hosts this is kept small so that big
+   debuginfo files don't use up the address space the readers need. */
+#if VG_WORDSIZE == 8
+#  define MAP_MAX_SIZE          ((SizeT)1 << 40)
+#else
+#  define MAP_MAX_SIZE          ((SizeT)64 << 20)
+#endif
+
 /* An entry in the cache. */
 typedef
    struct {
@@ -102,6 +112,10 @@ struct _DiImage {
    SizeT size;
    // Real size of image
    SizeT real_size;
+   // For local files, the whole file mapped read-only, or NULL if it
+   // could not be mapped.  When non-NULL, offsets below real_size are
+   // read from here and the cache only holds decompressed slices.
+   const UChar* map;
    // The number of entries used.  0 .. CACHE_N_ENTRIES
    UInt  ces_used;
    // Pointers to the entries.  ces[0 .. ces_used-1] are non-NULL.
@@ -804,6 +818,8 @@ static UChar get_slowcase ( DiImage* img, DiOffT off )
 // This is called a lot, so do the usual fast/slow split stuff on it. */
 static inline UChar get ( DiImage* img, DiOffT off )
 {
+   if (img->map != NULL && off < img->real_size)
+      return img->map[off];
    /* Most likely case is, it's in the ces[0] position. */
    /* ML_(img_from_local_file) requests a read for ces[0] when
       creating the image.  Hence slot zero is always non-NULL, so we
@@ -851,9 +867,21 @@ DiImage* ML_(img_from_local_file)(const HChar* fullpath)
    img->cslc            = NULL;
    img->cslc_size       = 0;
    img->cslc_used       = 0;
+   img->map             = NULL;
    /* img->ces is already zeroed out */
    vg_assert(img->source.fd >= 0);
 
+   /* Map the file if possible, since then reads are plain loads and
+      readers jumping around a big file cost no system calls.  Files
+      that can't be mapped (some network filesystems refuse) are read
+      through the cache instead. */
+   if (size <= MAP_MAX_SIZE) {
+      SysRes sres = VG_(am_mmap_file_float_valgrind)(size, VKI_PROT_READ,
+                                                     img->source.fd, 0);
+      if (!sr_isError(sres))
+         img->map = (const UChar*)(Addr)sr_Res(sres);
+   }
+
    /* Force the zeroth entry to be the first chunk of the file.
       That's likely to be the first part that's requested anyway, and
       loading it at this point forcing img->cent[0] to always be
@@ -944,6 +972,7 @@ DiImage* ML_(img_from_di_server)(const HChar* filename,
    img->cslc            = NULL;
    img->cslc_size       = 0;
    img->cslc_used       = 0;
+   img->map             = NULL;
 
    /* img->ces is already zeroed out */
    vg_assert(img->source.fd >= 0);
@@ -1006,6 +1035,11 @@ void ML_(img_done)(DiImage* img)
       /* Close the file; nothing else to do. */
       vg_assert(img->source.session_id == 0);
       VG_(close)(img->source.fd);
+      if (img->map != NULL) {
+         SysRes sres = VG_(am_munmap_valgrind)((Addr)img->map,
+                                               img->real_size);
+         vg_assert(!sr_isError(sres));
+      }
    } else {
       /* Close the socket.  The server can detect this and will scrub
          the connection when it happens, so there's no need to tell it
@@ -1083,6 +1117,10 @@ void ML_(img_get)(/*OUT*/void* dst,
    vg_assert(img != NULL);
    vg_assert(size > 0);
    ensure_valid(img, offset, size, "ML_(img_get)");
+   if (img->map != NULL && offset + size <= img->real_size) {
+      VG_(memcpy)(dst, &img->map[offset], size);
+      return;
+   }
    SizeT i;
    for (i = 0; i < size; i++) {
       ((UChar*)dst)[i] = get(img, offset + i);
@@ -1095,6 +1133,12 @@ SizeT ML_(img_get_some)(/*OUT*/void* dst,
    vg_assert(img != NULL);
    vg_assert(size > 0);
    ensure_valid(img, offset, size, "ML_(img_get_some)");
+   if (img->map != NULL && offset < img->real_size) {
+      SizeT nAvail = (SizeT)(img->real_size - offset);
+      if (size > nAvail) size = nAvail;
+      VG_(memcpy)(dst, &img->map[offset], size);
+      return size;
+   }
    UChar* dstU = (UChar*)dst;
    /* Use |get| in the normal way to get the first byte of the range.
       This guarantees to put the cache entry containing |offset| in
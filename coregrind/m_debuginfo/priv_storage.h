@@ -153,6 +153,16 @@ typedef
    }
    DiInlLoc;
 
+/* A piece of the address space over which the set of inltab entries
+   covering an address does not change.  It ends where the next piece
+   starts.  See inlseg in struct _DebugInfo. */
+typedef
+   struct {
+      Addr addr_lo;  /* lowest address of the piece */
+      UInt cov_ix;   /* the entries covering it start at inlseg_cov[cov_ix] */
+   }
+   DiInlSeg;
+
 /* --------------------- CF INFO --------------------- */
 
 /* DiCfSI: a structure to summarise DWARF2/3 CFA info for the code
@@ -668,6 +678,12 @@ struct _DebugInfo {
       by VG_(di_notify_mmap) and its immediate helpers. */
    struct _DebugInfoFSM fsm;
 
+   /* True if the ::fsm has reached an accept state but, because the
+      tool asked for VG_(needs_lazy_debuginfo), reading has been put off
+      until the first query for an address in one of the mappings.
+      The DebugInfo is already active; .have_dinfo is still False. */
+   Bool deferred;
+
    /* Once the ::fsm has reached an accept state -- typically, when
       both a rw? and r?x mapping for .filename have been observed --
       we can go on to read the symbol tables and debug info.
@@ -925,6 +941,15 @@ struct _DebugInfo {
    UWord   inltab_used;
    UWord   inltab_size;
    SizeT   maxinl_codesz;
+   /* An index of inltab giving the inlined calls covering an address,
+      built when first needed.  inlseg[0 .. inlseg_used-1] are pieces of
+      the address range of inltab, sorted on addr_lo.  The inltab
+      entries covering piece i are inlseg_cov[inlseg[i].cov_ix ..
+      inlseg[i+1].cov_ix - 1], deepest level first.  The last piece is
+      covered by nothing, it only ends the one before it. */
+   DiInlSeg* inlseg;
+   UWord   inlseg_used;
+   UInt*   inlseg_cov;
 
    /* A set of expandable arrays to store CFI summary info records.
       The machine specific information (i.e. the DiCfSI_m struct)
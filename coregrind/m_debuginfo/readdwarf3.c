@@ -4497,8 +4497,15 @@ static void trace_debug_abbrev (const DebugInfo* di,
    }
 }
 
+/* Objects are read one at a time, as the client maps them, and each
+   must be complete before code from it runs; so there is never a
+   batch of objects to hand to other processes.  Within an object the
+   CUs are not independent either: DIEs refer to each other across CUs
+   (DW_FORM_ref_addr, .debug_types, the alt file), and the TyEnt
+   array is only resolved and deduplicated once all of them are in.
+   Hence the CUs are read in sequence in this one process. */
 static
-void new_dwarf3_reader_wrk ( 
+void new_dwarf3_reader_wrk (
    DebugInfo* di,
    __attribute__((noreturn)) void (*barf)( const HChar* ),
    DiSlice escn_debug_info,      DiSlice escn_debug_types,
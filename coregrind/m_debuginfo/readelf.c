@@ -3225,7 +3225,11 @@ Bool ML_(read_elf_debug_info) ( struct _DebugInfo* di )
          /* The new reader: read the DIEs in .debug_info to acquire
             information on variable types and locations or inline info.
             But only if the tool asks for it, or the user requests it on
-            the command line. */
+            the command line.  All the CUs are read here rather than on
+            demand through .gdb_index or .debug_names, because the
+            variable and inline tables are searched by address with the
+            rest of the DebugInfo, and those in turn are built and
+            canonicalised once per object. */
          if (VG_(clo_read_var_info) /* the user or tool asked for it */
              || VG_(clo_read_inline_info)) {
             ML_(new_dwarf3_reader)(
@@ -2372,7 +2372,13 @@ void ML_(finish_CFSI_arrays) ( struct _DebugInfo* di )
 
 
 /* Canonicalise the tables held by 'di', in preparation for use.  Call
-   this after finishing adding entries to these tables. */
+   this after finishing adding entries to these tables.
+
+   The results are not saved for later runs.  They hold avmas, which
+   include this mapping's bias, and pointers into di's string and
+   filename pools; and reading the object also sets up redirections
+   and the section bounds from how it was mapped this time, so a saved
+   copy would still need the ELF read to be used. */
 void ML_(canonicaliseTables) ( struct _DebugInfo* di )
 {
    canonicaliseSymtab ( di );
@@ -33,9 +33,11 @@
 #include "pub_core_threadstate.h"      // For VG_N_THREADS
 #include "pub_core_debuginfo.h"
 #include "pub_core_debuglog.h"
+#include "pub_core_deduppoolalloc.h"
 #include "pub_core_errormgr.h"
 #include "pub_core_execontext.h"
 #include "pub_core_gdbserver.h"
+#include "pub_core_hashtable.h"
 #include "pub_core_libcbase.h"
 #include "pub_core_libcassert.h"
 #include "pub_core_libcfile.h"
@@ -77,6 +79,12 @@ static Error* errors = NULL;
    of the searches done by is_suppressible_error(). */
 static Supp* suppressions = NULL;
 
+/* Length of 'suppressions'. */
+static UInt n_suppressions = 0;
+
+/* Source of Supp.mru stamps. */
+static ULong supp_mru_clock = 0;
+
 /* Running count of unsuppressed errors detected. */
 static UInt n_errs_found = 0;
 
@@ -112,6 +120,11 @@ static UWord em_supplist_searches = 0;
    searching. */
 static UWord em_supplist_cmps = 0;
 
+/* Stats: number of suppression list searches answered from the
+   per-ExeContext memo, and number of memo entries computed. */
+static UWord em_suppmemo_hits = 0;
+static UWord em_suppmemo_builds = 0;
+
 /*------------------------------------------------------------*/
 /*--- Error type                                           ---*/
 /*------------------------------------------------------------*/
@@ -226,8 +239,11 @@ typedef
    (0..)) for 'skind'. */
 struct _Supp {
    struct _Supp* next;
+   struct _Supp* prev;
    Int count;     // The number of times this error has been suppressed.
    HChar* sname;  // The name by which the suppression is referred to.
+   ULong mru;     // Stamp of the last move to the head of 'suppressions':
+                  // the list is always in decreasing 'mru' order.
 
    // Index in VG_(clo_suppressions) giving filename from which suppression
    // was read, and the lineno in this file where sname was read.
@@ -1460,7 +1476,12 @@ static void load_one_suppressions_file ( Int clo_suppressions_i )
       }
 
       supp->next = suppressions;
+      supp->prev = NULL;
+      if (suppressions)
+         suppressions->prev = supp;
+      supp->mru = ++supp_mru_clock;
       suppressions = supp;
+      n_suppressions++;
    }
    VG_(free)(buf);
    VG_(close)(fd);
@@ -1485,6 +1506,7 @@ void VG_(load_suppressions) ( void )
 {
    Int i;
    suppressions = NULL;
+   n_suppressions = 0;
    for (i = 0; i < VG_(sizeXA)(VG_(clo_suppressions)); i++) {
       if (VG_(clo_verbosity) > 1) {
          VG_(dmsg)("Reading suppressions file: %s\n", 
@@ -1654,6 +1676,71 @@ static HChar* grow_names(IPtoFunOrObjCompleter* ip2fo, SizeT needed)
    return ip2fo->names + ip2fo->names_free;
 }
 
+/* Function and object names of IPs, as matched against suppressions,
+   shared by all the stacks looked at: getting a function name means a
+   symbol search and a Z-demangling, which is too slow to repeat for
+   every error from the same code.  Direct-mapped on (epoch, IP), with
+   the names kept in ip_names_pool.  NULL means not worked out yet.
+   check_memo_epoch() flushes it together with the suppression memo. */
+#define N_IP_NAME_CACHE 4093
+
+typedef
+   struct {
+      Addr         ip;
+      DiEpoch      epoch;
+      const HChar* fun;
+      const HChar* obj;
+   }
+   IPNameCacheEnt;
+
+static IPNameCacheEnt ip_name_cache[N_IP_NAME_CACHE];
+static DedupPoolAlloc* ip_names_pool = NULL;
+
+static const HChar* ip_name ( DiEpoch ep, Addr ip, Bool needFun )
+{
+   IPNameCacheEnt* ce
+      = &ip_name_cache[(ip ^ ((UWord)ep.n << 7)) % N_IP_NAME_CACHE];
+   const HChar**   slot;
+   const HChar*    name;
+   Bool            ok;
+
+   if (ce->ip != ip || ce->epoch.n != ep.n) {
+      ce->ip    = ip;
+      ce->epoch = ep;
+      ce->fun   = NULL;
+      ce->obj   = NULL;
+   }
+   slot = needFun ? &ce->fun : &ce->obj;
+   if (*slot == NULL) {
+      // Nb: C++-mangled names are used in suppressions.  Do, though,
+      // Z-demangle them, since otherwise it's possible to wind
+      // up comparing "malloc" in the suppression against
+      // "_vgrZU_libcZdsoZa_malloc" in the backtrace, and the
+      // two of them need to be made to match.
+      if (needFun)
+         ok = VG_(get_fnname_no_cxx_demangle)(ep, ip, &name, NULL);
+      else
+         ok = VG_(get_objname)(ep, ip, &name);
+      if (!ok)
+         name = "???";
+      if (ip_names_pool == NULL)
+         ip_names_pool = VG_(newDedupPA)(16000, 1, VG_(malloc),
+                                         "errormgr.ipn.1", VG_(free));
+      *slot = VG_(allocEltDedupPA)(ip_names_pool, VG_(strlen)(name) + 1,
+                                   name);
+   }
+   return *slot;
+}
+
+static void flush_ip_names ( void )
+{
+   VG_(memset)(ip_name_cache, 0, sizeof(ip_name_cache));
+   if (ip_names_pool != NULL) {
+      VG_(deleteDedupPA)(ip_names_pool);
+      ip_names_pool = NULL;
+   }
+}
+
 /* foComplete returns the function name or object name for ixInput.
    If needFun, returns the function name for this input
    else returns the object name for this input.
@@ -1686,16 +1773,7 @@ static HChar* foComplete(IPtoFunOrObjCompleter* ip2fo,
          vg_assert (!VG_(clo_read_inline_info));
          /* Get the function name into 'caller_name', or "???"
             if unknown. */
-         // Nb: C++-mangled names are used in suppressions.  Do, though,
-         // Z-demangle them, since otherwise it's possible to wind
-         // up comparing "malloc" in the suppression against
-         // "_vgrZU_libcZdsoZa_malloc" in the backtrace, and the
-         // two of them need to be made to match.
-         if (!VG_(get_fnname_no_cxx_demangle)(ip2fo->epoch,
-                                              ip2fo->ips[ixInput],
-                                              &caller,
-                                              NULL))
-            caller = "???";
+         caller = ip_name(ip2fo->epoch, ip2fo->ips[ixInput], True);
       } else {
          /* Get the object name into 'caller_name', or "???"
             if unknown. */
@@ -1713,8 +1791,7 @@ static HChar* foComplete(IPtoFunOrObjCompleter* ip2fo,
             last_expand_pos_ips is the last offset in fun/obj where
             ips[pos_ips] has been expanded. */
 
-         if (!VG_(get_objname)(ip2fo->epoch, ip2fo->ips[pos_ips], &caller))
-            caller = "???";
+         caller = ip_name(ip2fo->epoch, ip2fo->ips[pos_ips], False);
 
          // Have all inlined calls pointing at this object name
          for (i = last_expand_pos_ips - ip2fo->n_offsets_per_ip[pos_ips] + 1;
@@ -1946,6 +2023,100 @@ Bool supp_matches_error(const Supp* su, const Error* err)
 
 /////////////////////////////////////////////////////
 
+/* Suppressions whose callers match the stack of one ExeContext, so that
+   a later error with the same stack only needs the (cheap) kind checks
+   of those few.  Worked out the second time a stack is looked up: for a
+   stack seen only once, the plain search, which does not look at the
+   callers of suppressions of the wrong kind, is cheaper.  The names a
+   stack is matched against can change when debuginfo is loaded or
+   discarded, which always starts a new DiEpoch, and then
+   check_memo_epoch() drops everything. */
+typedef
+   struct _SuppMemo {
+      struct _SuppMemo* next;
+      UWord  ecu;       // key: the ExeContext's unique number
+      Int    n_supps;   // -1 if the stack has been looked up only once
+      Supp** supps;     // the n_supps matching suppressions
+   }
+   SuppMemo;
+
+static VgHashTable* supp_memo = NULL;
+static DiEpoch      supp_memo_epoch;
+
+static void free_SuppMemo ( void* v )
+{
+   SuppMemo* memo = v;
+   if (memo->supps) VG_(free)(memo->supps);
+   VG_(free)(memo);
+}
+
+static void check_memo_epoch ( void )
+{
+   DiEpoch ep = VG_(current_DiEpoch)();
+
+   if (supp_memo != NULL && supp_memo_epoch.n == ep.n)
+      return;
+   if (supp_memo != NULL) {
+      VG_(HT_destruct)(supp_memo, free_SuppMemo);
+      flush_ip_names();
+   }
+   supp_memo = VG_(HT_construct)("errormgr.supp_memo");
+   supp_memo_epoch = ep;
+}
+
+static void init_IPtoFunOrObjCompleter ( IPtoFunOrObjCompleter* ip2fo,
+                                         ExeContext* where )
+{
+   ip2fo->epoch = VG_(get_ExeContext_epoch)(where);
+   ip2fo->ips = VG_(get_ExeContext_StackTrace)(where);
+   ip2fo->n_ips = VG_(get_ExeContext_n_ips)(where);
+   ip2fo->n_ips_expanded = 0;
+   ip2fo->n_expanded = 0;
+   ip2fo->sz_offsets = 0;
+   ip2fo->n_offsets_per_ip = NULL;
+   ip2fo->fun_offsets = NULL;
+   ip2fo->obj_offsets = NULL;
+   ip2fo->names = NULL;
+   ip2fo->names_szB = 0;
+   ip2fo->names_free = 0;
+}
+
+static void build_SuppMemo ( SuppMemo* memo, ExeContext* where )
+{
+   IPtoFunOrObjCompleter ip2fo;
+   Supp* su;
+   Int   n = 0;
+
+   em_suppmemo_builds++;
+   memo->supps = VG_(malloc)("errormgr.bsm.1",
+                             (n_suppressions + 1) * sizeof(Supp*));
+   init_IPtoFunOrObjCompleter(&ip2fo, where);
+   for (su = suppressions; su != NULL; su = su->next) {
+      em_supplist_cmps++;
+      if (supp_matches_callers(&ip2fo, su))
+         memo->supps[n++] = su;
+   }
+   clearIPtoFunOrObjCompleter(NULL, &ip2fo);
+   memo->n_supps = n;
+   memo->supps = VG_(realloc)("errormgr.bsm.2", memo->supps,
+                              (n + 1) * sizeof(Supp*));
+}
+
+/* Moves su to the head of 'suppressions'. */
+static void move_supp_to_front ( Supp* su )
+{
+   su->mru = ++supp_mru_clock;
+   if (su->prev == NULL)
+      return;
+   su->prev->next = su->next;
+   if (su->next)
+      su->next->prev = su->prev;
+   su->prev = NULL;
+   su->next = suppressions;
+   suppressions->prev = su;
+   suppressions = su;
+}
+
 /* Does an error context match a suppression?  ie is this a suppressible
    error?  If so, return a pointer to the Supp record, otherwise NULL.
    Tries to minimise the number of symbol searches since they are expensive.  
@@ -1953,7 +2124,8 @@ Bool supp_matches_error(const Supp* su, const Error* err)
 static Supp* is_suppressible_error ( const Error* err )
 {
    Supp* su;
-   Supp* su_prev;
+   Supp* best;
+   Int   i;
 
    IPtoFunOrObjCompleter ip2fo;
    /* Conceptually, ip2fo contains an array of function names and an array of
@@ -1973,24 +2145,49 @@ static Supp* is_suppressible_error ( const Error* err )
    /* stats gathering */
    em_supplist_searches++;
 
+   check_memo_epoch();
+
+   /* With the matching traced, always do the full search, as that is
+      what the trace shows. */
+   if (!DEBUG_ERRORMGR && VG_(debugLog_getLevel)() < 4) {
+      UWord     ecu  = VG_(get_ECU_from_ExeContext)(err->where);
+      SuppMemo* memo = VG_(HT_lookup)(supp_memo, ecu);
+
+      if (memo == NULL) {
+         memo = VG_(malloc)("errormgr.ise.1", sizeof(SuppMemo));
+         memo->ecu = ecu;
+         memo->n_supps = -1;
+         memo->supps = NULL;
+         VG_(HT_add_node)(supp_memo, memo);
+      } else {
+         if (memo->n_supps == -1)
+            build_SuppMemo(memo, err->where);
+         else
+            em_suppmemo_hits++;
+         /* The full search would find the first matching suppression
+            in the list, which is the one with the highest mru. */
+         best = NULL;
+         for (i = 0; i < memo->n_supps; i++) {
+            su = memo->supps[i];
+            em_supplist_cmps++;
+            if ((best == NULL || su->mru > best->mru)
+                && supp_matches_error(su, err))
+               best = su;
+         }
+         if (best) {
+            (void)VG_TDICT_CALL(tool_update_extra_suppression_use, err, best);
+            move_supp_to_front(best);
+         }
+         return best;
+      }
+   }
+
    /* Prepare the lazy input completer. */
-   ip2fo.epoch = VG_(get_ExeContext_epoch)(err->where);
-   ip2fo.ips = VG_(get_ExeContext_StackTrace)(err->where);
-   ip2fo.n_ips = VG_(get_ExeContext_n_ips)(err->where);
-   ip2fo.n_ips_expanded = 0;
-   ip2fo.n_expanded = 0;
-   ip2fo.sz_offsets = 0;
-   ip2fo.n_offsets_per_ip = NULL;
-   ip2fo.fun_offsets = NULL;
-   ip2fo.obj_offsets = NULL;
-   ip2fo.names = NULL;
-   ip2fo.names_szB = 0;
-   ip2fo.names_free = 0;
+   init_IPtoFunOrObjCompleter(&ip2fo, err->where);
 
    /* See if the error context matches any suppression. */
    if (DEBUG_ERRORMGR || VG_(debugLog_getLevel)() >= 4)
      VG_(dmsg)("errormgr matching begin\n");
-   su_prev = NULL;
    for (su = suppressions; su != NULL; su = su->next) {
       em_supplist_cmps++;
       if (supp_matches_error(su, err) 
@@ -2000,16 +2197,10 @@ static Supp* is_suppressible_error ( const Error* err )
          (void)VG_TDICT_CALL(tool_update_extra_suppression_use, err, su);
          /* Move this entry to the head of the list
             in the hope of making future searches cheaper. */
-         if (su_prev) {
-            vg_assert(su_prev->next == su);
-            su_prev->next = su->next;
-            su->next = suppressions;
-            suppressions = su;
-         }
+         move_supp_to_front(su);
          clearIPtoFunOrObjCompleter(su, &ip2fo);
          return su;
       }
-      su_prev = su;
    }
    clearIPtoFunOrObjCompleter(NULL, &ip2fo);
    return NULL;      /* no matches */
@@ -2027,6 +2218,10 @@ void VG_(print_errormgr_stats) ( void )
       " errormgr: %'lu errlist searches, %'lu comparisons during search\n",
       em_errlist_searches, em_errlist_cmps
    );
+   VG_(dmsg)(
+      " errormgr: %'lu supplist searches from memo, %'lu memo entries\n",
+      em_suppmemo_hits, em_suppmemo_builds
+   );
 }
 
 /*--------------------------------------------------------------------*/
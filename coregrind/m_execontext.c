@@ -54,7 +54,14 @@
    to keep the load factor below 1.0.
 
    The idea is only to ever store any one context once, so as to save
-   space and make exact comparisons faster. */
+   space and make exact comparisons faster.
+
+   Contexts are not stored as (parent, IP) pairs sharing their
+   prefixes, although deep stacks often differ only in the top frame.
+   VG_(get_ExeContext_StackTrace) hands the ips out as a plain array,
+   which tools and the error manager index directly; and each record
+   starts from a fresh unwind of the whole stack, which costs more than
+   hashing the IPs it produces. */
 
 
 /* Primes for the hash table */
@@ -894,6 +894,188 @@ Int VG_(fork) ( void )
 #  endif
 }
 
+/* ---------------------------------------------------------------------
+   Writer processes
+   ------------------------------------------------------------------ */
+
+/* The write ends of the pipes to the live writers.  A new writer
+   closes them all, since a writer holding another's pipe open would
+   stop that one from ever seeing end of file. */
+#define VG_MAX_WRITERS 8
+
+static Int writer_fds[VG_MAX_WRITERS];
+static Int n_writers = 0;
+
+static void forget_writer ( Int fd )
+{
+   Int i;
+
+   for (i = 0; i < n_writers; i++) {
+      if (writer_fds[i] == fd) {
+         writer_fds[i] = writer_fds[--n_writers];
+         return;
+      }
+   }
+   vg_assert2(0, "forget_writer: %d is not a writer's pipe", fd);
+}
+
+/* The default writer body: copies the pipe to out_fd. */
+static void writer_copy ( Int in_fd, Int out_fd )
+{
+   const SizeT size = 1024 * 1024;
+   UChar* buf = VG_(malloc)("libcproc.writer_copy", size);
+
+   while (True) {
+      Int n = VG_(read)(in_fd, buf, size);
+      Int done;
+      if (n == -VKI_EINTR)
+         continue;
+      if (n <= 0)
+         break;
+      for (done = 0; done < n; ) {
+         Int w = VG_(write)(out_fd, buf + done, n - done);
+         if (w == -VKI_EINTR)
+            continue;
+         if (w <= 0)
+            VG_(exit_now)(1);
+         done += w;
+      }
+   }
+   VG_(free)(buf);
+}
+
+Int VG_(start_writer) ( Int out_fd, SizeT pipe_szB,
+                        void (*body)(Int in_fd, Int out_fd),
+                        /*OUT*/Int* pid )
+{
+   Int fds[2], child, i;
+
+   if (n_writers >= VG_MAX_WRITERS)
+      return -1;
+   if (VG_(pipe)(fds) != 0)
+      return -1;
+   /* Out of the guest's way: in the low fds, a guest that closes all
+      its fds would close the pipe, and a guest exec would inherit the
+      write end and keep the writer from ever seeing end of file. */
+   fds[0] = VG_(safe_fd)(fds[0]);
+   fds[1] = VG_(safe_fd)(fds[1]);
+#  if defined(VKI_F_SETPIPE_SZ)
+   /* Only a hint: fails harmlessly on kernels without F_SETPIPE_SZ or
+      if it exceeds /proc/sys/fs/pipe-max-size. */
+   if (pipe_szB > 0)
+      VG_(fcntl)(fds[1], VKI_F_SETPIPE_SZ, pipe_szB);
+#  endif
+
+   child = VG_(fork)();
+   if (child < 0) {
+      VG_(close)(fds[0]);
+      VG_(close)(fds[1]);
+      return -1;
+   }
+   if (child == 0) {
+      vki_sigset_t all;
+
+      /* Signals are meant for the guest, not for us. */
+      VG_(sigfillset)(&all);
+      VG_(sigprocmask)(VKI_SIG_SETMASK, &all, NULL);
+      VG_(close)(fds[1]);
+      for (i = 0; i < n_writers; i++)
+         VG_(close)(writer_fds[i]);
+      n_writers = 0;
+      if (body != NULL)
+         body(fds[0], out_fd);
+      else
+         writer_copy(fds[0], out_fd);
+      /* Not VG_(exit), which would also shut down the gdbserver that
+         belongs to our parent. */
+      VG_(exit_now)(0);
+   }
+
+   VG_(close)(fds[0]);
+   writer_fds[n_writers++] = fds[1];
+   *pid = child;
+   return fds[1];
+}
+
+static Int wait_for_child ( Int pid )
+{
+   Int status;
+
+   while (True) {
+      Int r = VG_(waitpid)(pid, &status, 0);
+      if (r == pid)
+         return status;
+      if (r != -VKI_EINTR)
+         return -1;
+   }
+}
+
+Int VG_(finish_writer) ( Int fd, Int pid )
+{
+   forget_writer(fd);
+   VG_(close)(fd);
+   return wait_for_child(pid);
+}
+
+void VG_(abandon_writer) ( Int fd )
+{
+   forget_writer(fd);
+   VG_(close)(fd);
+}
+
+/* ---------------------------------------------------------------------
+   Helper processes
+   ------------------------------------------------------------------ */
+
+Int VG_(start_helper) ( void (*body)(Int out_fd, void* opaque),
+                        void* opaque, /*OUT*/Int* pid )
+{
+   Int fds[2], child, i;
+
+   if (VG_(pipe)(fds) != 0)
+      return -1;
+   /* Out of the guest's way, as for the writers. */
+   fds[0] = VG_(safe_fd)(fds[0]);
+   fds[1] = VG_(safe_fd)(fds[1]);
+
+   child = VG_(fork)();
+   if (child < 0) {
+      VG_(close)(fds[0]);
+      VG_(close)(fds[1]);
+      return -1;
+   }
+   if (child == 0) {
+      vki_sigset_t async;
+
+      /* Signals are meant for the guest, but a fault while the helper
+         pokes at memory must still reach the fault catcher: blocking a
+         synchronous signal would get us killed instead. */
+      VG_(sigfillset)(&async);
+      VG_(sigdelset)(&async, VKI_SIGSEGV);
+      VG_(sigdelset)(&async, VKI_SIGBUS);
+      VG_(sigdelset)(&async, VKI_SIGILL);
+      VG_(sigdelset)(&async, VKI_SIGFPE);
+      VG_(sigprocmask)(VKI_SIG_SETMASK, &async, NULL);
+      VG_(close)(fds[0]);
+      /* Don't keep the writers' pipes open behind their backs. */
+      for (i = 0; i < n_writers; i++)
+         VG_(close)(writer_fds[i]);
+      n_writers = 0;
+      body(fds[1], opaque);
+      VG_(exit_now)(0);
+   }
+
+   VG_(close)(fds[1]);
+   *pid = child;
+   return fds[0];
+}
+
+Int VG_(finish_helper) ( Int fd, Int pid )
+{
+   VG_(close)(fd);
+   return wait_for_child(pid);
+}
+
 /* ---------------------------------------------------------------------
    Timing stuff
    ------------------------------------------------------------------ */
@@ -944,6 +1126,20 @@ UInt VG_(read_millisecond_timer) ( void )
    return (now - base) / 1000;
 }
 
+ULong VG_(read_nanosecond_timer) ( void )
+{
+#  if defined(VGO_linux) || defined(VGO_solaris)
+   SysRes res;
+   struct vki_timespec ts_now;
+   res = VG_(do_syscall2)(__NR_clock_gettime, VKI_CLOCK_MONOTONIC,
+                          (UWord)&ts_now);
+   if (sr_isError(res) == 0)
+      return ts_now.tv_sec * 1000000000ULL + ts_now.tv_nsec;
+#  endif
+   /* No nanosecond clock; fall back to the millisecond one. */
+   return VG_(read_millisecond_timer)() * 1000000ULL;
+}
+
 Int VG_(gettimeofday)(struct vki_timeval *tv, struct vki_timezone *tz)
 {
    SysRes res;
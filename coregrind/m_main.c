@@ -174,10 +174,11 @@ static void usage_NORETURN ( Bool debug_help )
 "    --allow-mismatched-debuginfo=no|yes  [no]\n"
 "                              for the above two flags only, accept debuginfo\n"
 "                              objects that don't \"match\" the main object\n"
-"    --smc-check=none|stack|all|all-non-file [all-non-file]\n"
+"    --smc-check=none|stack|all|all-non-file|protect [all-non-file]\n"
 "                              checks for self-modifying code: none, only for\n"
-"                              code found in stacks, for all code, or for all\n"
-"                              code except that from file-backed mappings\n"
+"                              code found in stacks, for all code, for all\n"
+"                              code except that from file-backed mappings, or\n"
+"                              by write-protecting pages holding code (Linux)\n"
 "    --read-inline-info=yes|no read debug info about inlined function calls\n"
 "                              and use it to do better stack traces.\n"
 "                              [yes] on Linux/Android/Solaris for the tools\n"
@@ -209,6 +210,8 @@ static void usage_NORETURN ( Bool debug_help )
 "           more sectors may increase performance, but use more memory.\n"
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
 "           basic block [0, meaning use tool provided default]\n"
+"    --transtab-keep-hot=<number> percentage of a recycled sector of the\n"
+"           translated code cache kept for its hot translations [25]\n"
 "    --aspace-minaddr=0xPP     avoid mapping memory below 0xPP [guessed]\n"
 "    --valgrind-stacksize=<number> size of valgrind (host) thread's stack\n"
 "                               (in bytes) ["
@@ -229,6 +232,8 @@ static void usage_NORETURN ( Bool debug_help )
 "                  NOTE: stack scanning is only available on arm-linux.\n"
 "    --unw-stack-scan-frames=<number>   Max number of frames that can be\n"
 "                  recovered by stack scanning [5]\n"
+"    --unw-fp=no|yes           unwind by following the frame pointer chain\n"
+"                              where CFI agrees with it (amd64 only) [no]\n"
 "    --resync-filter=no|yes|verbose [yes on MacOS, no on other OSes]\n"
 "              attempt to avoid expensive address-space-resync operations\n"
 "    --max-threads=<number>    maximum number of threads that valgrind can\n"
@@ -245,6 +250,8 @@ static void usage_NORETURN ( Bool debug_help )
 "    --profile-flags=<XXXXXXXX> ditto, but for profiling (X = 0|1) [00000000]\n"
 "    --profile-interval=<number> show profile every <number> event checks\n"
 "                                [0, meaning only at the end of the run]\n"
+"    --profile-sbs-out=<file>  also write the end-of-run SB profile to <file>\n"
+"    --profile-sbs-in=<file>   load an SB profile for the tool to consult\n"
 "    --trace-notbelow=<number> only show BBs above <number> [999999999]\n"
 "    --trace-notabove=<number> only show BBs below <number> [0]\n"
 "    --trace-syscalls=no|yes   show all system calls? [no]\n"
@@ -273,6 +280,7 @@ static void usage_NORETURN ( Bool debug_help )
 "    --vex-guest-max-insns=<1..100>         [50]\n"
 "    --vex-guest-chase-thresh=<0..99>       [10]\n"
 "    --vex-guest-chase-cond=no|yes          [no]\n"
+"    --vex-guest-chase-cond-max=<0..8>      [2]\n"
 "    Precise exception control.  Possible values for 'mode' are as follows\n"
 "      and specify the minimum set of registers guaranteed to be correct\n"
 "      immediately prior to memory access instructions:\n"
@@ -298,6 +306,7 @@ static void usage_NORETURN ( Bool debug_help )
 "        (Nb: you need --trace-notbelow and/or --trace-notabove\n"
 "             with --trace-flags for full details)\n"
 "    --vex-regalloc-version=2|3             [3]\n"
+"    --vex-regalloc-fast-thresh=<0..15000>  [1000]\n"
 "\n"
 "  debugging options for Valgrind tools that report errors\n"
 "    --dump-error=<number>     show translation for basic block associated\n"
@@ -701,6 +710,8 @@ void main_process_cmd_line_options( void )
       else if VG_BINT_CLO(arg, "--avg-transtab-entry-size",
                                VG_(clo_avg_transtab_entry_size),
                                50, 5000) {}
+      else if VG_BINT_CLO(arg, "--transtab-keep-hot",
+                               VG_(clo_transtab_keep_hot), 0, 50) {}
       else if VG_BINT_CLO(arg, "--merge-recursive-frames",
                                VG_(clo_merge_recursive_frames), 0,
                                VG_DEEPEST_BACKTRACE) {}
@@ -713,6 +724,8 @@ void main_process_cmd_line_options( void )
                           VG_(clo_smc_check), Vg_SmcAll) {}
       else if VG_XACT_CLO(arg, "--smc-check=all-non-file",
                           VG_(clo_smc_check), Vg_SmcAllNonFile) {}
+      else if VG_XACT_CLO(arg, "--smc-check=protect",
+                          VG_(clo_smc_check), Vg_SmcProtect) {}
 
       else if VG_USETX_CLO (arg, "--kernel-variant",
                             "bproc,"
@@ -734,6 +747,8 @@ void main_process_cmd_line_options( void )
                        VG_(clo_vex_control).iropt_level, 0, 2) {}
       else if VG_BINT_CLO(arg, "--vex-regalloc-version",
                        VG_(clo_vex_control).regalloc_version, 2, 3) {}
+      else if VG_BINT_CLO(arg, "--vex-regalloc-fast-thresh",
+                       VG_(clo_vex_control).regalloc_fast_thresh, 0, 15000) {}
 
       else if VG_STRINDEX_CLO(arg, "--vex-iropt-register-updates",
                                    pxStrings, ix) {
@@ -767,6 +782,8 @@ void main_process_cmd_line_options( void )
                        VG_(clo_vex_control).guest_chase_thresh, 0, 99) {}
       else if VG_BOOL_CLO(arg, "--vex-guest-chase-cond",
                        VG_(clo_vex_control).guest_chase_cond) {}
+      else if VG_BINT_CLO(arg, "--vex-guest-chase-cond-max",
+                       VG_(clo_vex_control).guest_chase_cond_max, 0, 8) {}
 
       else if VG_INT_CLO(arg, "--log-fd", tmp_log_fd) {
          log_to = VgLogTo_Fd;
@@ -880,6 +897,14 @@ void main_process_cmd_line_options( void )
       else if VG_INT_CLO (arg, "--profile-interval",
                           VG_(clo_profyle_interval)) {}
 
+      else if VG_STR_CLO (arg, "--profile-sbs-out",
+                          VG_(clo_profyle_sbs_out)) {
+         VG_(clo_profyle_sbs) = True;
+      }
+
+      else if VG_STR_CLO (arg, "--profile-sbs-in",
+                          VG_(clo_profyle_sbs_in)) {}
+
       else if VG_XACT_CLO(arg, "--gen-suppressions=no",
                                VG_(clo_gen_suppressions), 0) {}
       else if VG_XACT_CLO(arg, "--gen-suppressions=yes",
@@ -891,6 +916,7 @@ void main_process_cmd_line_options( void )
                           VG_(clo_unw_stack_scan_thresh), 0, 100) {}
       else if VG_BINT_CLO(arg, "--unw-stack-scan-frames",
                           VG_(clo_unw_stack_scan_frames), 0, 32) {}
+      else if VG_BOOL_CLO(arg, "--unw-fp", VG_(clo_unw_fp)) {}
 
       else if VG_XACT_CLO(arg, "--resync-filter=no",
                                VG_(clo_resync_filter), 0) {}
@@ -970,6 +996,19 @@ void main_process_cmd_line_options( void )
          "You must define a non nul exit error code, with --error-exitcode=...\n");
    }
 
+#  if !defined(VGO_linux)
+   if (VG_(clo_smc_check) == Vg_SmcProtect) {
+      VG_(fmsg_bad_option)("--smc-check=protect",
+                           "--smc-check=protect is only available on Linux.\n");
+   }
+#  endif
+   if (VG_(clo_smc_check) == Vg_SmcProtect && VG_(clo_sanity_level) >= 3) {
+      /* The sync checks would find pages we write-protected behind
+         aspacem's back. */
+      VG_(fmsg_bad_option)("--smc-check=protect",
+         "Can't use --smc-check=protect with --sanity-level=3 or above.\n");
+   }
+
 #  if !defined(VGO_darwin)
    if (VG_(clo_resync_filter) != 0) {
       VG_(fmsg_bad_option)("--resync-filter=yes or =verbose", 
@@ -1699,6 +1738,15 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
    VG_(debugLog)(1, "main", "Initialise TT/TC\n");
    VG_(init_tt_tc)();
 
+   //--------------------------------------------------------------
+   // Load an SB profile from an earlier run, if asked
+   //   p: main_process_cmd_line_options() [for VG_(clo_profyle_sbs_in)]
+   //--------------------------------------------------------------
+   if (VG_(clo_profyle_sbs_in) != NULL) {
+      VG_(debugLog)(1, "main", "Load SB profile\n");
+      VG_(load_SB_profile)();
+   }
+
    //--------------------------------------------------------------
    // Initialise the redirect table.
    //   p: init_tt_tc [so it can call VG_(search_transtab) safely]
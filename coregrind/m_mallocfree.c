@@ -70,6 +70,15 @@ static void cc_analyse_alloc_arena ( ArenaId aid ); /* fwds */
 // dynamically.  This is its initial size.
 #define SBLOCKS_SIZE_INITIAL 50
 
+// The core arena, which the tools allocate from, keeps freed blocks
+// with payloads up to QUICK_MAX_PSZB on a list per payload size, up to
+// QUICK_MAX_BLOCKS on each, and hands them straight out again.  They
+// stay in use as far as the rest of the arena is concerned, so they
+// are not merged with their neighbours while cached.
+#define QUICK_MAX_PSZB       256
+#define N_QUICK_LISTS        (QUICK_MAX_PSZB / VG_MIN_MALLOC_SZB + 1)
+#define QUICK_MAX_BLOCKS     256
+
 typedef UChar UByte;
 
 /* Layout of an in-use block:
@@ -209,6 +218,11 @@ typedef
       // Smaller size superblocks are splittable and can be reclaimed when all
       // their blocks are freed.
       Block*       freelist[N_MALLOC_LISTS];
+      // Cached in-use blocks, for arenas where 'quick' is set.  The next
+      // block of a list is in the first word of the payload.
+      Bool         quick;
+      Block*       quicklist[N_QUICK_LISTS];
+      UInt         quicklist_n[N_QUICK_LISTS];
       // A dynamically expanding, ordered array of (pointers to)
       // superblocks in the arena.  If this array is expanded, which
       // is rare, the previous space it occupies is simply abandoned.
@@ -241,6 +255,7 @@ typedef
       ULong        stats__tot_blocks; /* total # blocks alloc'd */
       ULong        stats__tot_bytes; /* total # bytes alloc'd */
       ULong        stats__nsearches; /* total # freelist checks */
+      ULong        stats__nquick; /* # blocks alloc'd from a quicklist */
       // If profiling, when should the next profile happen at
       // (in terms of stats__bytes_on_loan_max) ?
       SizeT        next_profile_at;
@@ -601,6 +616,11 @@ void arena_init ( ArenaId aid, const HChar* name, SizeT rz_szB,
    a->min_sblock_szB = min_sblock_szB;
    a->min_unsplittable_sblock_szB = min_unsplittable_sblock_szB;
    for (i = 0; i < N_MALLOC_LISTS; i++) a->freelist[i] = NULL;
+   a->quick = ( VG_AR_CORE == aid ? True : False );
+   for (i = 0; i < N_QUICK_LISTS; i++) {
+      a->quicklist[i]   = NULL;
+      a->quicklist_n[i] = 0;
+   }
 
    a->sblocks                  = & a->sblocks_initial[0];
    a->sblocks_size             = SBLOCKS_SIZE_INITIAL;
@@ -619,6 +639,7 @@ void arena_init ( ArenaId aid, const HChar* name, SizeT rz_szB,
    a->stats__tot_blocks        = 0;
    a->stats__tot_bytes         = 0;
    a->stats__nsearches         = 0;
+   a->stats__nquick            = 0;
    a->next_profile_at          = 25 * 1000 * 1000;
    vg_assert(sizeof(a->sblocks_initial) 
              == SBLOCKS_SIZE_INITIAL * sizeof(Superblock*));
@@ -635,7 +656,7 @@ void VG_(print_all_arena_stats) ( void )
                    "%llu/%llu unsplit/split sb unmmap'd,  "
                    "%'13lu/%'13lu max/curr,  "
                    "%10llu/%10llu totalloc-blocks/bytes,"
-                   "  %10llu searches %lu rzB\n",
+                   "  %10llu searches %llu quick %lu rzB\n",
                    a->name,
                    a->stats__bytes_mmaped_max, a->stats__bytes_mmaped,
                    a->stats__nreclaim_unsplit, a->stats__nreclaim_split,
@@ -643,6 +664,7 @@ void VG_(print_all_arena_stats) ( void )
                    a->stats__bytes_on_loan,
                    a->stats__tot_blocks, a->stats__tot_bytes,
                    a->stats__nsearches,
+                   a->stats__nquick,
                    a->rz_szB
       );
    }
@@ -1757,6 +1779,25 @@ void* VG_(arena_malloc) ( ArenaId aid, const HChar* cc, SizeT req_pszB )
    // this allocation; it isn't optional.
    vg_assert(cc);
 
+   // Small blocks freed recently are reused as they are.  They are still
+   // counted as on loan, so only the totals change.
+   if (a->quick && req_pszB <= QUICK_MAX_PSZB
+       && a->quicklist[req_pszB / VG_MIN_MALLOC_SZB] != NULL) {
+      lno = req_pszB / VG_MIN_MALLOC_SZB;
+      b = a->quicklist[lno];
+      v = get_block_payload(a, b);
+      a->quicklist[lno] = *(Block**)v;
+      a->quicklist_n[lno]--;
+      if (VG_(clo_profile_heap))
+         set_cc(b, cc);
+      a->stats__tot_blocks += (ULong)1;
+      a->stats__tot_bytes  += (ULong)req_pszB;
+      a->stats__nquick++;
+      INNER_REQUEST
+         (VALGRIND_MALLOCLIKE_BLOCK(v, req_pszB, a->rz_szB, False));
+      return v;
+   }
+
    // Scan through all the big-enough freelists for a block.
    //
    // Nb: this scanning might be expensive in some cases.  Eg. if you
@@ -2108,6 +2149,25 @@ void VG_(arena_free) ( ArenaId aid, void* ptr )
 
    b_bszB   = get_bszB(b);
    b_pszB   = bszB_to_pszB(a, b_bszB);
+
+   /* Keep small blocks for reuse by VG_(arena_malloc), if there is
+      room.  Only blocks whose payload is exactly a list's size are
+      kept, so that any of them can serve a request of that size. */
+   if (a->quick && b_pszB <= QUICK_MAX_PSZB && b_pszB >= VG_MIN_MALLOC_SZB
+       && (b_pszB & (VG_MIN_MALLOC_SZB-1)) == 0
+       && a->quicklist_n[b_pszB / VG_MIN_MALLOC_SZB] < QUICK_MAX_BLOCKS) {
+      b_listno = b_pszB / VG_MIN_MALLOC_SZB;
+      VG_(memset)(ptr, 0xDD, (SizeT)b_pszB);
+      *(Block**)ptr = a->quicklist[b_listno];
+      a->quicklist[b_listno] = b;
+      a->quicklist_n[b_listno]++;
+      if (VG_(clo_profile_heap))
+         set_cc(b, "admin.quicklist");
+      INNER_REQUEST(VALGRIND_FREELIKE_BLOCK(ptr, 0));
+      INNER_REQUEST(VALGRIND_MAKE_MEM_DEFINED(ptr, sizeof(Block*)));
+      return;
+   }
+
    sb       = findSb( a, b );
 
    a->stats__bytes_on_loan -= b_pszB;
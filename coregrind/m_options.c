@@ -97,6 +97,8 @@ UChar  VG_(clo_trace_flags)    = 0; // 00000000b
 Bool   VG_(clo_profyle_sbs)    = False;
 UChar  VG_(clo_profyle_flags)  = 0; // 00000000b
 ULong  VG_(clo_profyle_interval) = 0;
+const HChar* VG_(clo_profyle_sbs_out) = NULL;
+const HChar* VG_(clo_profyle_sbs_in)  = NULL;
 Int    VG_(clo_trace_notbelow) = -1;  // unspecified
 Int    VG_(clo_trace_notabove) = -1;  // unspecified
 Bool   VG_(clo_trace_syscalls) = False;
@@ -146,6 +148,7 @@ Bool   VG_(clo_dsymutil)       = True;
 Bool   VG_(clo_sigill_diag)    = True;
 UInt   VG_(clo_unw_stack_scan_thresh) = 0; /* disabled by default */
 UInt   VG_(clo_unw_stack_scan_frames) = 5;
+Bool   VG_(clo_unw_fp) = False;
 
 // Set clo_smc_check so that it provides transparent self modifying
 // code support for "correct" programs at the smallest achievable
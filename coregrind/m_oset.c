@@ -119,6 +119,7 @@ struct _OSet {
    SizeT       maxEltSize; // for node_pa, must be > 0. Otherwise unused.
    UInt        nElems;     // number of elements in the tree
    AvlNode*    root;       // root node
+   AvlNode*    lastHit;    // node found by the last lookup, or NULL
 
    AvlNode*    nodeStack[STACK_MAX];   // Iterator node stack
    Int          numStack[STACK_MAX];   // Iterator num stack
@@ -309,6 +310,7 @@ AvlTree* VG_(OSetGen_Create)(PtrdiffT keyOff, OSetCmp_t cmp,
    t->maxEltSize = 0; // Just in case it would be wrongly used.
    t->nElems   = 0;
    t->root     = NULL;
+   t->lastHit  = NULL;
    stackClear(t);
 
    return t;
@@ -356,6 +358,7 @@ AvlTree* VG_(OSetGen_EmptyClone) (const AvlTree* os)
    t->maxEltSize = os->maxEltSize;
    t->nElems   = 0;
    t->root     = NULL;
+   t->lastHit  = NULL;
    stackClear(t);
 
    return t;
@@ -567,6 +570,68 @@ void VG_(OSetWord_Insert)(AvlTree* t, UWord val)
    VG_(OSetGen_Insert)(t, node);
 }
 
+// Builds a perfectly balanced tree from the n nodes of es[], which are
+// in ascending order, and returns its root and its height.  The left
+// half never has more nodes than the right, so the heights of the two
+// halves differ by at most one, as AVL requires.
+static AvlNode* avl_build(void* const* es, Word n, /*OUT*/Int* height)
+{
+   AvlNode* root;
+   Int      hl, hr;
+   Word     mid;
+
+   if (n == 0) {
+      *height = 0;
+      return NULL;
+   }
+   mid           = (n - 1) / 2;
+   root          = node_of_elem(es[mid]);
+   root->left    = avl_build(es, mid, &hl);
+   root->right   = avl_build(es + mid + 1, n - mid - 1, &hr);
+   root->balance = hr - hl;
+   *height       = 1 + (hl > hr ? hl : hr);
+   return root;
+}
+
+void VG_(OSetGen_BulkLoad)(AvlTree* t, void* const* es, Word n)
+{
+   Int  height;
+   Word i;
+
+   vg_assert(t);
+   vg_assert(t->root == NULL);
+   vg_assert(n >= 0 && n <= 0xFFFFFFFFUL);
+   for (i = 1; i < n; i++) {
+      const void*    k    = t->cmp ? slow_key_of_node(t, node_of_elem(es[i-1]))
+                                   : fast_key_of_node(node_of_elem(es[i-1]));
+      const AvlNode* next = node_of_elem(es[i]);
+      vg_assert2((t->cmp ? slow_cmp(t, k, next) : fast_cmp(k, next)) < 0,
+                 "OSetGen_BulkLoad: elements not in strictly ascending "
+                 "order");
+   }
+   t->root     = avl_build(es, n, &height);
+   t->nElems   = n;
+   t->stackTop = 0;  // So the iterator can't get out of sync
+}
+
+void VG_(OSetWord_BulkLoad)(AvlTree* t, const UWord* vals, Word n)
+{
+   void** es;
+   Word   i;
+
+   vg_assert(n >= 0);
+   if (n == 0)
+      return;
+   es = t->alloc_fn(t->cc, n * sizeof(void*));
+   for (i = 0; i < n; i++) {
+      Word* node = VG_(OSetGen_AllocNode)(t, sizeof(UWord));
+      *node = vals[i];
+      es[i] = node;
+   }
+   VG_(OSetGen_BulkLoad)(t, es, n);
+   t->free_fn(es);
+}
+
 /*--------------------------------------------------------------------*/
 /*--- Lookup                                                       ---*/
 /*--------------------------------------------------------------------*/
@@ -603,12 +668,18 @@ static AvlNode* avl_lookup(const AvlTree* t, const void* k)
    }
 }
 
-// Find the *element* in t matching k, or NULL if not found.
-void* VG_(OSetGen_Lookup)(const AvlTree* t, const void* k)
+// Find the *element* in t matching k, or NULL if not found.  Lookups
+// often repeat the previous key, so the node last found is tried first.
+void* VG_(OSetGen_Lookup)(AvlTree* t, const void* k)
 {
    AvlNode* n;
    vg_assert(t);
+   n = t->lastHit;
+   if (n && (t->cmp ? slow_cmp(t, k, n) : fast_cmp(k, n)) == 0)
+      return elem_of_node(n);
    n = avl_lookup(t, k);
+   if (n)
+      t->lastHit = n;
    return ( n ? elem_of_node(n) : NULL );
 }
 
@@ -620,20 +691,24 @@ void* VG_(OSetGen_LookupWithCmp)(AvlTree* t, const void* k, OSetCmp_t cmp)
    void* e;
    OSetCmp_t tmpcmp;
    vg_assert(t);
+   // Don't use or update the last-hit cache: several elements may match
+   // k under cmp, and this must find the same one as a tree search would.
+   AvlNode* n;
    tmpcmp = t->cmp;
    t->cmp = cmp;
-   e = VG_(OSetGen_Lookup)(t, k);
+   n = avl_lookup(t, k);
+   e = ( n ? elem_of_node(n) : NULL );
    t->cmp = tmpcmp;
    return e;
 }
 
 // Is there an element matching k?
-Bool VG_(OSetGen_Contains)(const AvlTree* t, const void* k)
+Bool VG_(OSetGen_Contains)(AvlTree* t, const void* k)
 {
    return (NULL != VG_(OSetGen_Lookup)(t, k));
 }
 
-Bool VG_(OSetWord_Contains)(const AvlTree* t, UWord val)
+Bool VG_(OSetWord_Contains)(AvlTree* t, UWord val)
 {
    return (NULL != VG_(OSetGen_Lookup)(t, &val));
 }
@@ -773,6 +848,8 @@ void* VG_(OSetGen_Remove)(AvlTree* t, const void* k)
    AvlNode* n = avl_lookup(t, k);
    if (n) {
       avl_remove(t, n);
+      if (t->lastHit == n)
+         t->lastHit = NULL;
       t->nElems--;
       t->stackTop = 0;     // So the iterator can't get out of sync
       return elem_of_node(n);
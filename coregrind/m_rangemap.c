@@ -52,12 +52,13 @@ struct _RangeMap {
    const HChar* cc;                    /* cost centre for alloc */
    Free_Fn_t free_fn;                  /* free fn */
    XArray* ranges;
+   Word last;                          /* index found by the last find */
 };
 
 
 /* fwds */
-static void preen (/*MOD*/RangeMap* rm);
-static Word find ( const RangeMap* rm, UWord key );
+static void preen_around (/*MOD*/RangeMap* rm, Word iMin, Word iMax);
+static Word find ( RangeMap* rm, UWord key );
 static void split_at ( /*MOD*/RangeMap* rm, UWord key );
 static void show ( const RangeMap* rm );
 
@@ -75,6 +76,7 @@ RangeMap* VG_(newRangeMap) ( Alloc_Fn_t alloc_fn,
    rm->cc       = cc;
    rm->free_fn  = free_fn;
    rm->ranges = VG_(newXA)( alloc_fn, cc, free_fn, sizeof(Range) );
+   rm->last   = 0;
    /* Add the initial range */
    Range r;
    r.key_min = UWORD_MIN;
@@ -110,11 +112,84 @@ void VG_(bindRangeMap) ( RangeMap* rm,
       Range* rng = VG_(indexXA)(rm->ranges, i);
       rng->val = val;
    }
-   preen(rm);
+   preen_around(rm, iMin, iMax);
+}
+
+/* Appends [key_min, key_max] -> val to |ranges|, which is in ascending
+   order and ends at key_min-1, merging it into the last range if that
+   has the same value. */
+static void add_merged ( /*MOD*/XArray* ranges,
+                         UWord key_min, UWord key_max, UWord val )
+{
+   Word n = VG_(sizeXA)(ranges);
+   if (n > 0) {
+      Range* prev = VG_(indexXA)(ranges, n-1);
+      vg_assert(prev->key_max + 1 == key_min);
+      if (prev->val == val) {
+         prev->key_max = key_max;
+         return;
+      }
+   }
+   Range r;
+   r.key_min = key_min;
+   r.key_max = key_max;
+   r.val     = val;
+   VG_(addToXA)(ranges, &r);
+}
+
+/* Appends the old bindings of [key_min, key_max] to |ranges|.  |*oi| is
+   an index into |old| at or before the range holding key_min;  it is
+   left at the range holding key_max, so that consecutive calls for
+   ascending key ranges walk |old| once in all. */
+static void add_old ( /*MOD*/XArray* ranges, const XArray* old,
+                      /*MOD*/Word* oi, UWord key_min, UWord key_max )
+{
+   while (True) {
+      const Range* rng = VG_(indexXA)(old, *oi);
+      if (rng->key_max < key_min) {
+         (*oi)++;
+         continue;
+      }
+      add_merged(ranges, rng->key_min < key_min ? key_min : rng->key_min,
+                 rng->key_max > key_max ? key_max : rng->key_max, rng->val);
+      if (rng->key_max >= key_max)
+         return;
+      (*oi)++;
+   }
+}
+
+void VG_(bindRangeMapSorted) ( RangeMap* rm, Word n,
+                               const UWord* key_mins, const UWord* key_maxs,
+                               const UWord* vals )
+{
+   XArray* old    = rm->ranges;
+   XArray* ranges = VG_(newXA)( rm->alloc_fn, rm->cc, rm->free_fn,
+                                sizeof(Range) );
+   Word    oi     = 0;
+   UWord   next   = UWORD_MIN;   /* first key not yet written */
+   Bool    full   = False;       /* has UWORD_MAX been written? */
+   Word    j;
+   VG_(hintSizeXA)(ranges, VG_(sizeXA)(old) + 2*n + 1);
+   for (j = 0; j < n; j++) {
+      vg_assert(key_mins[j] <= key_maxs[j]);
+      vg_assert(!full && key_mins[j] >= next);
+      if (key_mins[j] > next)
+         add_old(ranges, old, &oi, next, key_mins[j] - 1);
+      add_merged(ranges, key_mins[j], key_maxs[j], vals[j]);
+      if (key_maxs[j] == UWORD_MAX)
+         full = True;
+      else
+         next = key_maxs[j] + 1;
+   }
+   if (!full)
+      add_old(ranges, old, &oi, next, UWORD_MAX);
+   VG_(deleteXA)(old);
+   rm->ranges = ranges;
+   rm->last   = 0;
 }
 
 void VG_(lookupRangeMap) ( /*OUT*/UWord* key_min, /*OUT*/UWord* key_max,
-                           /*OUT*/UWord* val, const RangeMap* rm, UWord key )
+                           /*OUT*/UWord* val, RangeMap* rm, UWord key )
 {
    Word   i   = find(rm, key);
    Range* rng = (Range*)VG_(indexXA)(rm->ranges, i);
@@ -143,28 +218,43 @@ void VG_(indexRangeMap) ( /*OUT*/UWord* key_min, /*OUT*/UWord* key_max,
 
 /* Helper functions, not externally visible. */
 
-static void preen (/*MOD*/RangeMap* rm)
+/* Merges the ranges iMin .. iMax, which have all just been bound to the
+   same value, with each other and with their neighbours where those
+   have that value too.  Everything else was already merged, so that
+   restores the invariant that no two adjacent ranges have the same
+   value without visiting the whole map. */
+static void preen_around (/*MOD*/RangeMap* rm, Word iMin, Word iMax)
 {
-   Word    i;
    XArray* ranges = rm->ranges;
-   for (i = 0; i < VG_(sizeXA)(ranges) - 1; i++) {
-      Range* rng0 = VG_(indexXA)(ranges, i+0);
-      Range* rng1 = VG_(indexXA)(ranges, i+1);
-      if (rng0->val != rng1->val)
-         continue;
-      rng0->key_max = rng1->key_max;
-      VG_(removeIndexXA)(ranges, i+1);
-      /* Back up one, so as not to miss an opportunity to merge with
-         the entry after this one. */
-      i--;
-   }
+   Word    size   = VG_(sizeXA)(ranges);
+   UWord   val    = ((Range*)VG_(indexXA)(ranges, iMin))->val;
+   if (iMin > 0 && ((Range*)VG_(indexXA)(ranges, iMin-1))->val == val)
+      iMin--;
+   if (iMax < size-1 && ((Range*)VG_(indexXA)(ranges, iMax+1))->val == val)
+      iMax++;
+   if (iMin == iMax)
+      return;
+   Range* rng0 = VG_(indexXA)(ranges, iMin);
+   Range* rng1 = VG_(indexXA)(ranges, iMax);
+   rng0->key_max = rng1->key_max;
+   for (; iMax > iMin; iMax--)
+      VG_(removeIndexXA)(ranges, iMin+1);
 }
 
-static Word find ( const RangeMap* rm, UWord key )
+static Word find ( RangeMap* rm, UWord key )
 {
    XArray* ranges = rm->ranges;
    Word    lo     = 0;
    Word    hi     = VG_(sizeXA)(ranges);
+   /* Lookups tend to come in runs for the same range, so try the one
+      found last time first.  The index may be stale after a bind, but
+      the ranges partition the key space, so if it holds |key| it is
+      the right answer regardless. */
+   if (rm->last < hi) {
+      Range* last_rng = (Range*)VG_(indexXA)(ranges, rm->last);
+      if (key >= last_rng->key_min && key <= last_rng->key_max)
+         return rm->last;
+   }
    while (True) {
       /* The unsearched space is lo .. hi inclusive */
       if (lo > hi) {
@@ -179,6 +269,7 @@ static Word find ( const RangeMap* rm, UWord key )
       UWord  key_mid_max = mid_rng->key_max;
       if (key < key_mid_min) { hi = mid-1; continue; }
       if (key > key_mid_max) { lo = mid+1; continue; }
+      rm->last = mid;
       return mid;
    }
 }
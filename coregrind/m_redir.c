@@ -382,6 +382,144 @@ static HChar const* advance_to_comma ( HChar const* c ) {
    return c;
 }
 
+/* The specs of one generate_and_add_actives call whose soname pattern
+   matched, indexed by function name so that each symbol only has to be
+   compared against the few specs that could match it.  Specs whose
+   function pattern has no wildcard are looked up exactly, in 'exact'
+   (sorted by name).  The others are bucketed in 'wild' by the first
+   character of their literal prefix, the part before the first
+   wildcard, with empty prefixes in bucket 0; bucket b is
+   wild[wild_start[b] .. wild_start[b+1]-1]. */
+typedef
+   struct {
+      Spec* sp;
+      Int   ord;        /* position in the spec list */
+      Int   prefix_len; /* literal chars before the first wildcard */
+   }
+   SpecRef;
+
+typedef
+   struct {
+      SpecRef* exact;
+      Int      n_exact;
+      SpecRef* wild;
+      Int      wild_start[258];
+      /* Scratch space for the matches of one name. */
+      SpecRef* hits;
+   }
+   SpecIndex;
+
+static Int specref_cmp_name ( const void* v1, const void* v2 )
+{
+   const SpecRef* r1 = v1;
+   const SpecRef* r2 = v2;
+   Int cmp = VG_(strcmp)(r1->sp->from_fnpatt, r2->sp->from_fnpatt);
+   if (cmp != 0)
+      return cmp;
+   return r1->ord < r2->ord ? -1 : r1->ord > r2->ord ? 1 : 0;
+}
+
+static Int wild_bucket ( const SpecRef* r )
+{
+   return r->prefix_len == 0 ? 0 : 1 + (UChar)r->sp->from_fnpatt[0];
+}
+
+/* Index the marked specs, of which there are n_marked. */
+static void build_spec_index ( SpecIndex* ix, Spec* specs, Int n_marked )
+{
+   Spec* sp;
+   Int   ord, i, n_wild = 0;
+
+   ix->exact   = dinfo_zalloc("redir.bsi.1", n_marked * sizeof(SpecRef));
+   ix->wild    = dinfo_zalloc("redir.bsi.2", n_marked * sizeof(SpecRef));
+   ix->hits    = dinfo_zalloc("redir.bsi.3", n_marked * sizeof(SpecRef));
+   ix->n_exact = 0;
+   VG_(memset)(ix->wild_start, 0, sizeof(ix->wild_start));
+
+   for (sp = specs, ord = 0; sp; sp = sp->next, ord++) {
+      if (!sp->mark)
+         continue;
+      const HChar* p = sp->from_fnpatt;
+      while (*p && *p != '*' && *p != '?')
+         p++;
+      SpecRef r = { sp, ord, (Int)(p - sp->from_fnpatt) };
+      if (*p == 0) {
+         ix->exact[ix->n_exact++] = r;
+      } else {
+         ix->wild[n_wild++] = r;
+         ix->wild_start[wild_bucket(&r) + 1]++;
+      }
+   }
+   VG_(ssort)(ix->exact, ix->n_exact, sizeof(SpecRef), specref_cmp_name);
+
+   /* Counting sort of the wildcard specs into their buckets, keeping
+      them in list order within each bucket. */
+   for (i = 1; i < 258; i++)
+      ix->wild_start[i] += ix->wild_start[i-1];
+   { SpecRef* tmp = ix->hits;
+     Int      next[257];
+     VG_(memcpy)(tmp, ix->wild, n_wild * sizeof(SpecRef));
+     VG_(memcpy)(next, ix->wild_start, sizeof(next));
+     for (i = 0; i < n_wild; i++)
+        ix->wild[next[wild_bucket(&tmp[i])]++] = tmp[i];
+   }
+}
+
+static void free_spec_index ( SpecIndex* ix )
+{
+   dinfo_free(ix->exact);
+   dinfo_free(ix->wild);
+   dinfo_free(ix->hits);
+}
+
+/* Find the specs whose function pattern matches 'name', in spec list
+   order.  They are left in ix->hits; returns how many there are. */
+static Int match_spec_index ( SpecIndex* ix, const HChar* name )
+{
+   Int n_hits = 0, lo, hi, i, b;
+
+   /* Exact names: find the first entry not below 'name'. */
+   lo = 0;
+   hi = ix->n_exact;
+   while (lo < hi) {
+      Int mid = lo + (hi - lo) / 2;
+      if (VG_(strcmp)(ix->exact[mid].sp->from_fnpatt, name) < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   for (i = lo;
+        i < ix->n_exact && VG_(strcmp)(ix->exact[i].sp->from_fnpatt, name) == 0;
+        i++)
+      ix->hits[n_hits++] = ix->exact[i];
+
+   /* Wildcard patterns with an empty prefix, then those whose prefix
+      starts like 'name'. */
+   for (b = 0; b < 2; b++) {
+      Int bucket = b == 0 ? 0 : 1 + (UChar)name[0];
+      for (i = ix->wild_start[bucket]; i < ix->wild_start[bucket+1]; i++) {
+         const SpecRef* r = &ix->wild[i];
+         if (VG_(strncmp)(r->sp->from_fnpatt, name, r->prefix_len) == 0
+             && VG_(string_match)(r->sp->from_fnpatt, name))
+            ix->hits[n_hits++] = *r;
+      }
+   }
+
+   /* Back into list order, so that conflicting bindings are resolved
+      as they would be by trying each spec in turn.  There are rarely
+      more than one or two hits. */
+   for (i = 1; i < n_hits; i++) {
+      SpecRef r = ix->hits[i];
+      Int     j = i;
+      while (j > 0 && ix->hits[j-1].ord > r.ord) {
+         ix->hits[j] = ix->hits[j-1];
+         j--;
+      }
+      ix->hits[j] = r;
+   }
+   return n_hits;
+}
+
 /* Notify m_redir of the arrival of a new DebugInfo.  This is fairly
    complex, but the net effect is to (1) add a new entry to the
    topspecs list, and (2) figure out what new binding are now active,
@@ -732,6 +870,12 @@ void VG_(redir_notify_new_DebugInfo)( const DebugInfo* newdi )
       topSpecs against ALL symbols in topSpecs (that is, a cross
       product of ALL known specs against ALL known symbols).
    */
+   /* Case (1) needs the symbols of every object already mapped, so
+      finish reading any whose reading was put off.  Each of them is
+      notified to us in turn, and so joins topSpecs. */
+   if (specList)
+      VG_(di_load_deferred_DebugInfos)();
+
    /* Case (1) */
    for (ts = topSpecs; ts; ts = ts->next) {
       if (ts->seginfo)
@@ -762,6 +906,36 @@ void VG_(redir_notify_new_DebugInfo)( const DebugInfo* newdi )
    handle_require_text_symbols(newdi);
 }
 
+/* Can the reading of the object in 'filename' be put off until
+   something queries it?  Only if nothing here needs its symbols when it
+   is mapped: no specs are known that could bind to them, nor any
+   --require-text-symbol= checks, and it is not one of the objects whose
+   symbols are searched for load notifiers or kludge variables.  If
+   specs appear later, VG_(redir_notify_new_DebugInfo) reads the
+   deferred objects before binding them. */
+Bool VG_(redir_can_defer_DebugInfo)( const HChar* filename )
+{
+   const HChar* basename = VG_(basename)(filename);
+   TopSpec*     ts;
+
+   for (ts = topSpecs; ts; ts = ts->next)
+      if (ts->specs)
+         return False;
+   if (VG_(sizeXA)(VG_(clo_req_tsyms)) > 0)
+      return False;
+   if (SimHintiS(SimHint_no_nptl_pthread_stackcache, VG_(clo_sim_hints)))
+      return False;
+   /* vgpreload_core holds the freeres and ifunc load notifiers. */
+   if (VG_(strncmp)(basename, "vgpreload_", 10) == 0)
+      return False;
+#  if defined(VGP_x86_linux)
+   /* ld.so provides _dl_sysinfo_int80; see handle_maybe_load_notifier. */
+   if (VG_(strncmp)(basename, "ld-", 3) == 0)
+      return False;
+#  endif
+   return True;
+}
+
 /* Add a new target for an indirect function. Adds a new redirection
    for the indirection function with address old_from that redirects
    the ordinary function with address new_from to the target address
@@ -806,15 +980,17 @@ void generate_and_add_actives (
    Spec*   sp;
    Bool    anyMark, isText, isIFunc, isGlobal;
    Active  act;
-   Int     nsyms, i;
+   Int     nsyms, i, j, n_marked, n_hits;
    SymAVMAs  sym_avmas;
    const HChar*  sym_name_pri;
    const HChar** sym_names_sec;
+   SpecIndex ix;
 
    /* First figure out which of the specs match the seginfo's soname.
       Also clear the 'done' bits, so that after the main loop below
       tell which of the Specs really did get done. */
    anyMark = False;
+   n_marked = 0;
    for (sp = specs; sp; sp = sp->next) {
       sp->done = False;
       const HChar *soname = VG_(DebugInfo_get_soname)(di);
@@ -831,12 +1007,19 @@ void generate_and_add_actives (
 
       sp->mark = VG_(string_match)( sp->from_sopatt, soname );
       anyMark = anyMark || sp->mark;
+      if (sp->mark)
+         n_marked++;
    }
 
    /* shortcut: if none of the sonames match, there will be no bindings. */
    if (!anyMark)
       return;
 
+   /* Big objects have hundreds of thousands of symbols, so rather than
+      trying every marked spec on each of them, index the specs by
+      function name. */
+   build_spec_index( &ix, specs, n_marked );
+
    /* Iterate outermost over the symbols in the seginfo, in the hope
       of trashing the caches less. */
    nsyms = VG_(DebugInfo_syms_howmany)( di );
@@ -854,11 +1037,11 @@ void generate_and_add_actives (
          if (!isText)
             continue;
 
-         for (sp = specs; sp; sp = sp->next) {
-            if (!sp->mark)
-               continue; /* soname doesn't match */
-            if (VG_(string_match)( sp->from_fnpatt, *names )
-		&& (sp->isGlobal == False || isGlobal == True)) {
+         n_hits = match_spec_index( &ix, *names );
+         for (j = 0; j < n_hits; j++) {
+            sp = ix.hits[j].sp;
+            vg_assert(sp->mark);
+            if (sp->isGlobal == False || isGlobal == True) {
                /* got a new binding.  Add to collection. */
                act.from_addr   = sym_avmas.main;
                act.to_addr     = sp->to_addr;
@@ -883,12 +1066,14 @@ void generate_and_add_actives (
                }
 
             }
-         } /* for (sp = specs; sp; sp = sp->next) */
+         } /* for (j = 0; j < n_hits; j++) */
 
       } /* iterating over names[] */
       free_symname_array(names_init, &twoslots[0]);
    } /* for (i = 0; i < nsyms; i++)  */
 
+   free_spec_index( &ix );
+
    /* Now, finally, look for Specs which were marked to be done, but
       didn't get matched.  If any such are mandatory we must abort the
       system at this point. */
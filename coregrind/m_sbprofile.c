@@ -30,10 +30,13 @@
 /* Contributed by Julian Seward <jseward@acm.org> */
 
 #include "pub_core_basics.h"
+#include "pub_core_vki.h"
 #include "pub_core_transtab.h"
 #include "pub_core_libcbase.h"
 #include "pub_core_libcprint.h"
 #include "pub_core_libcassert.h"
+#include "pub_core_libcfile.h"
+#include "pub_core_mallocfree.h"
 #include "pub_core_debuginfo.h"
 #include "pub_core_translate.h"
 #include "pub_core_options.h"
@@ -196,6 +199,53 @@ void show_SB_profile ( const SBProfEntry tops[], UInt n_tops,
 }
 
 
+/* Write the profile to the --profile-sbs-out file, one block per
+   line, in a form that is easy for scripts to read and that
+   VG_(load_SB_profile) reads back.  The symbol goes last since it
+   may contain spaces. */
+static void write_SB_profile ( const SBProfEntry tops[], UInt n_tops,
+                               ULong score_total )
+{
+   HChar*  filename;
+   VgFile* fp;
+   UInt    r;
+
+   filename = VG_(expand_file_name)("--profile-sbs-out",
+                                    VG_(clo_profyle_sbs_out));
+   fp = VG_(fopen)(filename, VKI_O_CREAT|VKI_O_WRONLY|VKI_O_TRUNC,
+                   VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IROTH);
+   if (fp == NULL) {
+      VG_(umsg)("Error: can not open SB profile output file `%s'\n",
+                filename);
+      VG_(free)(filename);
+      return;
+   }
+
+   DiEpoch cur_ep = VG_(current_DiEpoch)();
+
+   VG_(fprintf)(fp, "# Valgrind SB profile, format 1\n");
+   VG_(fprintf)(fp, "# total score %llu\n", score_total);
+   VG_(fprintf)(fp, "# guest_addr exec_count score guest_bytes "
+                    "host_bytes symbol\n");
+   for (r = 0; r < n_tops; r++) {
+      if (tops[r].addr == 0)
+         continue;
+      if (tops[r].score == 0)
+         continue;
+
+      const HChar *name;
+      VG_(get_fnname_w_offset)(cur_ep, tops[r].addr, &name);
+
+      VG_(fprintf)(fp, "0x%lx %llu %llu %u %u %s\n",
+                   tops[r].addr, tops[r].count, tops[r].score,
+                   tops[r].guest_szB, tops[r].host_szB, name);
+   }
+
+   VG_(fclose)(fp);
+   VG_(free)(filename);
+}
+
+
 /* Get and print a profile.  Also, zero out the counters so that if we
    call it again later, the second call will only show new work done
    since the first call.  ecs_done == 0 is taken to mean this is a
@@ -206,13 +256,145 @@ void VG_(get_and_show_SB_profile) ( ULong ecs_done )
 #  define N_MAX_END 200
    /* The number of blocks to show for a mid-run profile. */
 #  define N_MAX_INTERVAL 20
+   /* The number of blocks to write to the --profile-sbs-out file. */
+#  define N_MAX_EXPORT 5000
    vg_assert(N_MAX_INTERVAL <= N_MAX_END);
-   SBProfEntry tops[N_MAX_END];
-   Int nToShow = ecs_done == 0  ? N_MAX_END  : N_MAX_INTERVAL;
-   ULong score_total = VG_(get_SB_profile)(tops, nToShow);
+   vg_assert(N_MAX_END <= N_MAX_EXPORT);
+   Bool  export  = ecs_done == 0 && VG_(clo_profyle_sbs_out) != NULL;
+   Int   nToShow = ecs_done == 0  ? N_MAX_END  : N_MAX_INTERVAL;
+   Int   nToGet  = export ? N_MAX_EXPORT : nToShow;
+   SBProfEntry* tops = VG_(malloc)("sbprofile.gasSp.1",
+                                   nToGet * sizeof(SBProfEntry));
+   ULong score_total = VG_(get_SB_profile)(tops, nToGet);
+   /* tops[] is sorted by descending score, so its first nToShow
+      entries are the ones a smaller request would have produced. */
    show_SB_profile(tops, nToShow, score_total, ecs_done);
+   if (export)
+      write_SB_profile(tops, nToGet, score_total);
+   VG_(free)(tops);
 #  undef N_MAX_END
 #  undef N_MAX_INTERVAL
+#  undef N_MAX_EXPORT
+}
+
+
+/*====================================================================*/
+/*=== Loading a profile from a previous run                        ===*/
+/*====================================================================*/
+
+typedef
+   struct {
+      Addr  addr;
+      ULong count;
+   }
+   LoadedSB;
+
+/* The blocks from the --profile-sbs-in file, sorted by address. */
+static LoadedSB* loaded   = NULL;
+static UInt      n_loaded = 0;
+
+static Int cmp_LoadedSB ( const void* v1, const void* v2 )
+{
+   const LoadedSB* sb1 = v1;
+   const LoadedSB* sb2 = v2;
+   if (sb1->addr < sb2->addr) return -1;
+   if (sb1->addr > sb2->addr) return 1;
+   return 0;
+}
+
+static void bad_profile_line ( const HChar* filename, Int lineno )
+{
+   VG_(fmsg)("malformed line %d in SB profile file '%s'\n",
+             lineno, filename);
+   VG_(exit)(1);
+}
+
+void VG_(load_SB_profile) ( void )
+{
+   const HChar* filename = VG_(clo_profyle_sbs_in);
+   SysRes sres;
+   Int    fd, lineno;
+   Long   size;
+   HChar  *buf, *p, *end;
+   UInt   n_alloc;
+
+   vg_assert(filename != NULL);
+   vg_assert(loaded == NULL);
+
+   sres = VG_(open)(filename, VKI_O_RDONLY, 0);
+   if (sr_isError(sres)) {
+      VG_(fmsg)("can't open SB profile file '%s'\n", filename);
+      VG_(exit)(1);
+   }
+   fd   = sr_Res(sres);
+   size = VG_(fsize)(fd);
+   if (size < 0) {
+      VG_(fmsg)("can't read SB profile file '%s'\n", filename);
+      VG_(exit)(1);
+   }
+   buf = VG_(malloc)("sbprofile.load.1", size + 1);
+   if (VG_(read)(fd, buf, size) != size) {
+      VG_(fmsg)("can't read SB profile file '%s'\n", filename);
+      VG_(exit)(1);
+   }
+   VG_(close)(fd);
+   buf[size] = 0;
+
+   n_alloc = 0;
+   lineno  = 0;
+   for (p = buf; *p != 0; p = end) {
+      HChar* eol = VG_(strchr)(p, '\n');
+      end = eol == NULL ? p + VG_(strlen)(p) : eol + 1;
+      if (eol != NULL)
+         *eol = 0;
+      lineno++;
+
+      while (VG_(isspace)(*p))
+         p++;
+      if (*p == 0 || *p == '#')
+         continue;
+
+      HChar* q;
+      Addr   addr = (Addr)VG_(strtoull16)(p, &q);
+      if (q == p || !VG_(isspace)(*q))
+         bad_profile_line(filename, lineno);
+      p = q;
+      ULong  count = VG_(strtoull10)(p, &q);
+      if (q == p)
+         bad_profile_line(filename, lineno);
+
+      if (n_loaded == n_alloc) {
+         n_alloc = n_alloc == 0 ? 256 : 2 * n_alloc;
+         loaded  = VG_(realloc)("sbprofile.load.2", loaded,
+                                n_alloc * sizeof(LoadedSB));
+      }
+      loaded[n_loaded].addr  = addr;
+      loaded[n_loaded].count = count;
+      n_loaded++;
+   }
+   VG_(free)(buf);
+
+   VG_(ssort)(loaded, n_loaded, sizeof(LoadedSB), cmp_LoadedSB);
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(umsg)("Loaded SB profile of %u blocks from '%s'\n",
+                n_loaded, filename);
+}
+
+ULong VG_(get_SB_profile_count) ( Addr addr )
+{
+   Int lo = 0, hi = (Int)n_loaded - 1;
+
+   while (lo <= hi) {
+      Int mid = lo + (hi - lo) / 2;
+      if (addr < loaded[mid].addr)
+         hi = mid - 1;
+      else if (addr > loaded[mid].addr)
+         lo = mid + 1;
+      else
+         return loaded[mid].count;
+   }
+   return 0;
 }
 
 
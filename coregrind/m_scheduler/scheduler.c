@@ -47,6 +47,18 @@
    the_BigLock, and re-takes it when it becomes runnable again (either
    because the syscall finished, or we took a signal).
 
+   There is no mode in which a tool can opt out of this.  Almost all
+   core state assumes the_BigLock is held without saying so: the
+   translation table and the per-thread fast cache that points into
+   it, the malloc arenas, the address space manager, the error
+   manager, debuginfo and ExeContext tables.  Guest-level atomicity
+   (LOCK-prefixed insns, LL/SC) is also only modelled correctly
+   because no other thread can touch memory between the load and the
+   store.  Letting threads run concurrently would mean auditing and
+   locking all of that, not just the scheduler, so a tool that wants
+   per-thread throughput has to get it from cheaper instrumentation
+   instead.
+
    VG_(scheduler) therefore runs in each thread.  It returns only when
    the thread is exiting, either because it exited itself, or it was
    told to exit by another thread.
@@ -105,8 +117,14 @@
 
 /* Defines the thread-scheduling timeslice, in terms of the number of
    basic blocks we attempt to run each thread for.  Smaller values
-   give finer interleaving but much increased scheduling overheads. */
-#define SCHEDULING_QUANTUM   100000
+   give finer interleaving but much increased scheduling overheads.
+   Each thread starts with SCHEDULING_QUANTUM; a thread that uses up
+   a whole slice without spinning has its next slice doubled, up to
+   SCHEDULING_QUANTUM_MAX, and one that yields in a spin loop has it
+   halved, down to SCHEDULING_QUANTUM_MIN. */
+#define SCHEDULING_QUANTUM       100000
+#define SCHEDULING_QUANTUM_MIN   (SCHEDULING_QUANTUM / 16)
+#define SCHEDULING_QUANTUM_MAX   (SCHEDULING_QUANTUM * 4)
 
 /* If False, a fault is Valgrind-internal (ie, a bug) */
 Bool VG_(in_generated_code) = False;
@@ -130,6 +148,12 @@ static void mostly_clear_thread_record ( ThreadId tid );
 static ULong n_scheduling_events_MINOR = 0;
 static ULong n_scheduling_events_MAJOR = 0;
 
+/* Stats: number of times the_BigLock was acquired by a thread other
+   than the one that last held it.  last_BigLock_tid tracks the
+   latter. */
+static ULong stats__n_handoffs = 0;
+static ThreadId last_BigLock_tid = VG_INVALID_THREADID;
+
 /* Stats: number of XIndirs looked up in the fast cache, the number of hits in
    ways 1, 2 and 3, and the number of misses.  The number of hits in way 0 isn't
    recorded because it can be computed from these five numbers. */
@@ -152,8 +176,20 @@ static ULong stats__n_xIndir_misses = 0;
 static UInt sanity_fast_count = 0;
 static UInt sanity_slow_count = 0;
 
+static void print_thread_sched_stats ( ThreadId tid )
+{
+   const ThreadState *tst = &VG_(threads)[tid];
+   VG_(message)(Vg_DebugMsg,
+                "scheduler: thread %u: %'llu timeslices, %'llu handoffs, "
+                "quantum %d\n",
+                tid, tst->sched_slices, tst->sched_handoffs,
+                tst->sched_quantum);
+}
+
 void VG_(print_scheduler_stats)(void)
 {
+   ThreadId tid;
+
    VG_(message)(Vg_DebugMsg,
       "scheduler: %'llu event checks.\n", bbs_done );
 
@@ -178,7 +214,16 @@ void VG_(print_scheduler_stats)(void)
    VG_(message)(Vg_DebugMsg,
       "scheduler: %'llu/%'llu major/minor sched events.\n",
       n_scheduling_events_MAJOR, n_scheduling_events_MINOR);
-   VG_(message)(Vg_DebugMsg, 
+   VG_(message)(Vg_DebugMsg,
+      "scheduler: %'llu big lock handoffs.\n", stats__n_handoffs);
+   /* Exited threads were reported by VG_(exit_thread).  At shutdown
+      the last thread is already marked Empty but still running. */
+   for (tid = 1; tid < VG_N_THREADS; tid++) {
+      if (VG_(threads)[tid].status != VgTs_Empty
+          || tid == VG_(running_tid))
+         print_thread_sched_stats(tid);
+   }
+   VG_(message)(Vg_DebugMsg,
                 "   sanity: %u cheap, %u expensive checks.\n",
                 sanity_fast_count, sanity_slow_count );
 }
@@ -313,6 +358,9 @@ ThreadId VG_(alloc_ThreadState) ( void )
       if (VG_(threads)[i].status == VgTs_Empty) {
 	 VG_(threads)[i].status = VgTs_Init;
 	 VG_(threads)[i].exitreason = VgSrc_None;
+         VG_(threads)[i].sched_quantum = SCHEDULING_QUANTUM;
+         VG_(threads)[i].sched_slices = 0;
+         VG_(threads)[i].sched_handoffs = 0;
          if (VG_(threads)[i].thread_name)
             VG_(free)(VG_(threads)[i].thread_name);
          VG_(threads)[i].thread_name = NULL;
@@ -361,6 +409,12 @@ void VG_(acquire_BigLock)(ThreadId tid, const HChar* who)
    vg_assert(VG_(running_tid) == VG_INVALID_THREADID);
    VG_(running_tid) = tid;
 
+   if (last_BigLock_tid != tid) {
+      tst->sched_handoffs++;
+      stats__n_handoffs++;
+      last_BigLock_tid = tid;
+   }
+
    { Addr gsp = VG_(get_SP)(tid);
       if (NULL != VG_(tdict).track_new_mem_stack_w_ECU)
          VG_(unknown_SP_update_w_ECU)(gsp, gsp, 0/*unknown origin*/);
@@ -449,6 +503,9 @@ void VG_(exit_thread)(ThreadId tid)
    vg_assert(VG_(is_running_thread)(tid));
    vg_assert(VG_(is_exiting)(tid));
 
+   if (VG_(clo_stats))
+      print_thread_sched_stats(tid);
+
    mostly_clear_thread_record(tid);
    VG_(running_tid) = VG_INVALID_THREADID;
 
@@ -1164,11 +1221,17 @@ void handle_chain_me ( ThreadId tid, void* place_to_chain, Bool toFastEP )
                                  ip, False/*dont_upd_fast_cache*/ );
    if (!found) {
       /* Not found; we need to request a translation. */
+      ULong recycled = VG_(get_sectors_recycled)();
       if (VG_(translate)( tid, ip, /*debug*/False, 0/*not verbose*/, 
                           bbs_done, True/*allow redirection*/ )) {
          found = VG_(search_transtab)( NULL, &to_sNo, &to_tteNo,
                                        ip, False ); 
          vg_assert2(found, "handle_chain_me: missing tt_fast entry");
+         /* If that recycled a sector, place_to_chain may now be in
+            some other translation's code.  Chaining is only an
+            optimisation, so skip it. */
+         if (VG_(get_sectors_recycled)() != recycled)
+            return;
       } else {
 	 // If VG_(translate)() fails, it's because it had to throw a
 	 // signal because the client jumped to a bad address.  That
@@ -1280,6 +1343,8 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 {
    /* Holds the remaining size of this thread's "timeslice". */
    Int dispatch_ctr = 0;
+   /* Did the thread yield in a spin loop during this timeslice? */
+   Bool spun = False;
 
    ThreadState *tst = VG_(get_ThreadState)(tid);
    static Bool vgdb_startup_action_done = False;
@@ -1363,7 +1428,7 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
    
    vg_assert(VG_(is_running_thread)(tid));
 
-   dispatch_ctr = SCHEDULING_QUANTUM;
+   dispatch_ctr = tst->sched_quantum;
 
    while (!VG_(is_exiting)(tid)) {
 
@@ -1387,6 +1452,21 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 	 /* 3 Aug 06: doing sys__nsleep works but crashes some apps.
             sys_yield also helps the problem, whilst not crashing apps. */
 
+         /* A thread that ran its whole slice is CPU-bound, so let it
+            run longer before the next handoff; one that was spinning
+            is waiting for another thread, so hand over sooner. */
+         tst->sched_slices++;
+         if (spun) {
+            tst->sched_quantum /= 2;
+            if (tst->sched_quantum < SCHEDULING_QUANTUM_MIN)
+               tst->sched_quantum = SCHEDULING_QUANTUM_MIN;
+         } else {
+            tst->sched_quantum *= 2;
+            if (tst->sched_quantum > SCHEDULING_QUANTUM_MAX)
+               tst->sched_quantum = SCHEDULING_QUANTUM_MAX;
+         }
+         spun = False;
+
 	 VG_(release_BigLock)(tid, VgTs_Yielding, 
                                    "VG_(scheduler):timeslice");
 	 /* ------------ now we don't have The Lock ------------ */
@@ -1414,7 +1494,7 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
 	 n_scheduling_events_MAJOR++;
 
 	 /* Figure out how many bbs to ask vg_run_innerloop to do. */
-         dispatch_ctr = SCHEDULING_QUANTUM;
+         dispatch_ctr = tst->sched_quantum;
 
 	 /* paranoia ... */
 	 vg_assert(tst->tid == tid);
@@ -1543,6 +1623,7 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
             thread swap. */
          if (dispatch_ctr > 300)
             dispatch_ctr = 300;
+         spun = True;
 	 break;
 
       case VG_TRC_INNER_COUNTERZERO:
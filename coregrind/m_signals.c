@@ -225,6 +225,7 @@
 #include "pub_core_syscall.h"
 #include "pub_core_syswrap.h"
 #include "pub_core_tooliface.h"
+#include "pub_core_translate.h"     // VG_(smc_handle_write_fault)
 #include "pub_core_coredump.h"
 
 
@@ -2748,6 +2749,12 @@ void sync_signalhandler_from_kernel ( ThreadId tid,
          so carry on panicking. */
    }
 
+   /* A write to a page that --smc-check=protect write-protected:
+      once it has been unprotected, restart the write. */
+   if (sigNo == VKI_SIGSEGV && info->si_code == VKI_SEGV_ACCERR
+       && VG_(smc_handle_write_fault)(tid, (Addr)info->VKI_SIGINFO_si_addr))
+      return;
+
    if (extend_stack_if_appropriate(tid, info)) {
       /* Stack extension occurred, so we don't need to do anything else; upon
          returning from this function, we'll restart the host (hence guest)
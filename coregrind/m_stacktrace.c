@@ -502,6 +502,34 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
 #if defined(VGP_amd64_linux) || defined(VGP_amd64_darwin) \
     || defined(VGP_amd64_solaris)
 
+/* With --unw-fp=yes, the result of checking the fp chain against CFI
+   is cached per IP in the same way as on x86 (see the comment on the
+   x86 fp_CF_verif_cache).  Only FPUNWIND entries are used to skip
+   CFI; otherwise CFI is tried first as usual. */
+#define N_FP_CF_VERIF 1021
+#define FPUNWIND 0
+#define NOINFO   1
+#define CFUNWIND 2
+
+static Addr fp_CF_verif_cache [N_FP_CF_VERIF];
+static UInt fp_CF_verif_generation = 0;
+
+/* Follows the %rbp chain one frame up from uregs, if %rbp looks like
+   a frame in the stack.  The caller checks the result. */
+static inline Bool fp_unwind ( D3UnwindRegs* uregs, Addr fp_min, Addr fp_max )
+{
+   /* Note: re "- 1 * sizeof(UWord)", need to take account of the
+      fact that we are prodding at & ((UWord*)fp)[1]. */
+   if (!(fp_min <= uregs->xbp && uregs->xbp <= fp_max - 1 * sizeof(UWord)
+         && VG_IS_8_ALIGNED(uregs->xbp)))
+      return False;
+   uregs->xip = (((UWord*)uregs->xbp)[1]);
+   uregs->xsp = uregs->xbp + sizeof(Addr) /*saved %rbp*/
+                           + sizeof(Addr) /*ra*/;
+   uregs->xbp = (((UWord*)uregs->xbp)[0]);
+   return True;
+}
+
 UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
                                /*OUT*/Addr* ips, UInt max_n_ips,
                                /*OUT*/Addr* sps, /*OUT*/Addr* fps,
@@ -565,6 +593,12 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
    } 
 #  endif
 
+   if (VG_(clo_unw_fp)
+       && UNLIKELY (fp_CF_verif_generation != VG_(debuginfo_generation)())) {
+      fp_CF_verif_generation = VG_(debuginfo_generation)();
+      VG_(memset)(&fp_CF_verif_cache, 0, sizeof(fp_CF_verif_cache));
+   }
+
    /* fp is %rbp.  sp is %rsp.  ip is %rip. */
 
    ips[0] = uregs.xip;
@@ -617,6 +651,50 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
 
       /* Try to derive a new (ip,sp,fp) triple from the current set. */
 
+      /* With --unw-fp=yes, follow the fp chain where it is known to
+         agree with CFI, and when this IP hasn't been checked yet, do
+         both and remember whether they agree.  Frames whose fp looks
+         invalid fall through to CFI. */
+      if (VG_(clo_unw_fp)) {
+         UWord hash = uregs.xip % N_FP_CF_VERIF;
+         Addr  xip = uregs.xip;
+         Addr  xip_verif = xip ^ fp_CF_verif_cache [hash];
+         D3UnwindRegs fp_uregs = uregs;
+         Bool  fp_ok = fp_unwind( &fp_uregs, fp_min, fp_max );
+
+         if (xip_verif == FPUNWIND && fp_ok) {
+            uregs = fp_uregs;
+         } else if (xip_verif > CFUNWIND
+                    && VG_(use_CF_info)( &uregs, fp_min, fp_max )) {
+            fp_CF_verif_cache [hash]
+               = xip ^ (fp_ok && fp_uregs.xip == uregs.xip
+                              && fp_uregs.xsp == uregs.xsp
+                              && fp_uregs.xbp == uregs.xbp
+                        ? FPUNWIND : CFUNWIND);
+         } else {
+            if (xip_verif > CFUNWIND)
+               fp_CF_verif_cache [hash] = xip ^ NOINFO;
+            goto no_fp_cache;
+         }
+         if (0 == uregs.xip || 1 == uregs.xip) break;
+         if (old_xsp >= uregs.xsp) {
+            if (debug)
+               VG_(printf) ("     FC end of stack old_xsp %p >= xsp %p\n",
+                            (void*)old_xsp, (void*)uregs.xsp);
+            break;
+         }
+         if (sps) sps[i] = uregs.xsp;
+         if (fps) fps[i] = uregs.xbp;
+         ips[i++] = uregs.xip - 1; /* -1: refer to calling insn, not the RA */
+         if (debug)
+            VG_(printf)("     ipsV[%d]=%#08lx rbp %#08lx rsp %#08lx\n",
+                        i-1, ips[i-1], uregs.xbp, uregs.xsp);
+         uregs.xip = uregs.xip - 1; /* as per comment at the head of this loop */
+         RECURSIVE_MERGE(cmrf,ips,i);
+         continue;
+      }
+     no_fp_cache:
+
       /* First off, see if there is any CFI info to hand which can
          be used. */
       if ( VG_(use_CF_info)( &uregs, fp_min, fp_max ) ) {
@@ -712,6 +790,11 @@ UInt VG_(get_StackTrace_wrk) ( ThreadId tid_if_known,
    return n_found;
 }
 
+#undef N_FP_CF_VERIF
+#undef FPUNWIND
+#undef NOINFO
+#undef CFUNWIND
+
 #endif
 
 /* -----------------------ppc32/64 ---------------------- */
@@ -301,6 +301,11 @@ DECL_TEMPLATE(linux, sys_bpf);
 // Linux-specific (new in Linux 4.11)
 DECL_TEMPLATE(linux, sys_statx);
 
+// Linux-specific (new in Linux 5.1)
+DECL_TEMPLATE(linux, sys_io_uring_setup);
+DECL_TEMPLATE(linux, sys_io_uring_enter);
+DECL_TEMPLATE(linux, sys_io_uring_register);
+
 /* ---------------------------------------------------------------------
    Wrappers for sockets and ipc-ery.  These are split into standalone
    procedures because x86-linux hides them inside multiplexors
@@ -330,6 +335,11 @@ extern void ML_(linux_PRE_setregset) ( ThreadId, long, long );
 extern void ML_(linux_POST_traceme)  ( ThreadId );
 extern void ML_(linux_POST_getregset)( ThreadId, long, long );
 
+// Remembers where the guest mapped the queues of an io_uring fd.
+extern void ML_(linux_POST_io_uring_mmap) ( Int fd, Off64T offset, Addr a );
+// Forgets an io_uring fd once it is closed.
+extern void ML_(linux_POST_io_uring_close) ( Int fd );
+
 #undef TId
 #undef UW
 #undef SR
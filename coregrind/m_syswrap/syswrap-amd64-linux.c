@@ -862,6 +862,10 @@ static SyscallTableEntry syscall_table[] = {
 
    LINXY(__NR_statx,             sys_statx),             // 332
 
+   LINXY(__NR_io_uring_setup,    sys_io_uring_setup),    // 425
+   LINXY(__NR_io_uring_enter,    sys_io_uring_enter),    // 426
+   LINX_(__NR_io_uring_register, sys_io_uring_register), // 427
+
    LINX_(__NR_membarrier,        sys_membarrier),        // 324
 };
 
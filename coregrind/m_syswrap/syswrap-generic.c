@@ -39,6 +39,7 @@
 #include "pub_core_debuginfo.h"     // VG_(di_notify_*)
 #include "pub_core_aspacemgr.h"
 #include "pub_core_transtab.h"      // VG_(discard_translations)
+#include "pub_core_translate.h"     // VG_(smc_*)
 #include "pub_core_xarray.h"
 #include "pub_core_clientstate.h"   // VG_(brk_base), VG_(brk_limit)
 #include "pub_core_debuglog.h"
@@ -64,6 +65,9 @@
 
 #include "priv_types_n_macros.h"
 #include "priv_syswrap-generic.h"
+#if defined(VGO_linux)
+#include "priv_syswrap-linux.h"     // ML_(linux_POST_io_uring_mmap/close)
+#endif
 
 #include "config.h"
 
@@ -187,6 +191,7 @@ static void notify_core_of_mmap(Addr a, SizeT len, UInt prot,
    len = VG_PGROUNDUP(len);
 
    d = VG_(am_notify_client_mmap)( a, len, prot, flags, fd, offset );
+   VG_(smc_forget_range)( a, len );
 
    if (d)
       VG_(discard_translations)( a, (ULong)len,
@@ -244,6 +249,7 @@ ML_(notify_core_and_tool_of_munmap) ( Addr a, SizeT len )
 
    page_align_addr_and_len(&a, &len);
    d = VG_(am_notify_munmap)(a, len);
+   VG_(smc_forget_range)( a, len );
    VG_TRACK( die_mem_munmap, a, len );
    VG_(di_notify_munmap)( a, len );
    if (d)
@@ -261,6 +267,8 @@ ML_(notify_core_and_tool_of_mprotect) ( Addr a, SizeT len, Int prot )
 
    page_align_addr_and_len(&a, &len);
    d = VG_(am_notify_mprotect)(a, len, prot);
+   if (ww)
+      VG_(smc_notify_mprotect)( a, len );
    VG_TRACK( change_mem_mprotect, a, len, rr, ww, xx );
    VG_(di_notify_mprotect)( a, len, prot );
    if (d)
@@ -1282,6 +1290,8 @@ static Addr do_brk ( Addr newbrk, ThreadId tid )
       if (seg->hasT)
          VG_(discard_translations)( newbrk, VG_(brk_limit) - newbrk, 
                                     "do_brk(shrink)" );
+      VG_(smc_pre_syscall_write)( tid, newbrk, VG_(brk_limit) - newbrk );
+      VG_(smc_forget_range)( newbrk, VG_(brk_limit) - newbrk );
       /* Since we're being lazy and not unmapping pages, we have to
          zero out the area, so that if the area later comes back into
          circulation, it will be filled with zeroes, as if it really
@@ -2409,6 +2419,10 @@ ML_(generic_PRE_sys_mmap) ( ThreadId tid,
          di_handle /* so the tool can refer to the read debuginfo later,
                       if it wants. */
       );
+#     if defined(VGO_linux)
+      if (!(arg4 & VKI_MAP_ANONYMOUS))
+         ML_(linux_POST_io_uring_mmap)( (Int)arg5, arg6, (Addr)sr_Res(sres) );
+#     endif
    }
 
    /* Stay sane */
@@ -2662,6 +2676,10 @@ PRE(sys_mremap)
                     unsigned long, old_addr, unsigned long, old_size,
                     unsigned long, new_size, unsigned long, flags);
    }
+   /* Whatever becomes of the old pages, they must not stay
+      write-protected for --smc-check=protect. */
+   VG_(smc_pre_syscall_write)( tid, (Addr)ARG1, ARG2 );
+   VG_(smc_forget_range)( (Addr)ARG1, ARG2 );
    SET_STATUS_from_SysRes( 
       do_mremap((Addr)ARG1, ARG2, (Addr)ARG5, ARG3, ARG4, tid) 
    );
@@ -3243,6 +3261,9 @@ PRE(sys_close)
 POST(sys_close)
 {
    if (VG_(clo_track_fds)) ML_(record_fd_close)(ARG1);
+#  if defined(VGO_linux)
+   ML_(linux_POST_io_uring_close)(ARG1);
+#  endif
 }
 
 PRE(sys_dup)
@@ -3685,6 +3685,337 @@ POST(sys_statx)
    POST_MEM_WRITE( ARG5, sizeof(struct vki_statx) );
 }
 
+/* ---------------------------------------------------------------------
+   io_uring wrappers
+   ------------------------------------------------------------------ */
+
+/* An io_uring passes its requests in a submission queue that the guest
+   maps from the io_uring fd and shares with the kernel.  To tell the tool
+   about the memory the kernel reads and writes for these requests,
+   io_uring_enter walks the entries it submits, so we remember the
+   parameters given by io_uring_setup for each io_uring fd and the
+   addresses at which the guest mapped its submission queue. */
+typedef
+   struct _IoUring {
+      struct _IoUring* next;
+      Int  fd;
+      struct vki_io_uring_params params;
+      Addr sq_ring;  /* 0 if not mapped (yet) */
+      Addr sqes;     /* 0 if not mapped (yet) */
+   }
+   IoUring;
+
+static IoUring* io_urings = NULL;
+
+static IoUring* find_io_uring ( Int fd )
+{
+   IoUring* r;
+   for (r = io_urings; r != NULL; r = r->next)
+      if (r->fd == fd)
+         return r;
+   return NULL;
+}
+
+/* Called by the mmap wrapper for each successful mapping of a file. */
+void ML_(linux_POST_io_uring_mmap) ( Int fd, Off64T offset, Addr a )
+{
+   IoUring* r = find_io_uring(fd);
+   if (r == NULL)
+      return;
+   if (offset == VKI_IORING_OFF_SQ_RING)
+      r->sq_ring = a;
+   else if (offset == VKI_IORING_OFF_SQES)
+      r->sqes = a;
+}
+
+/* Called by the close wrapper for each successful close. */
+void ML_(linux_POST_io_uring_close) ( Int fd )
+{
+   IoUring** prev;
+   IoUring*  r;
+   for (prev = &io_urings; *prev != NULL; prev = &(*prev)->next) {
+      r = *prev;
+      if (r->fd == fd) {
+         *prev = r->next;
+         VG_(free)(r);
+         return;
+      }
+   }
+}
+
+/* Tells the tool about the memory accessed by the kernel for sqe.  The
+   pre events are given when the sqe is submitted.  As completions are
+   seen by the guest without any syscall, buffers filled by the kernel are
+   marked as written when the sqe is submitted too: the guest may only
+   look at them once the request has completed.  With
+   IOSQE_BUFFER_SELECT, the kernel reads into a buffer that it picks from
+   those the guest provided, not at addr, so there is nothing to say. */
+static void io_uring_sqe_mem ( ThreadId tid, const struct vki_io_uring_sqe *sqe,
+                               Bool pre )
+{
+   struct vki_iovec *iov;
+   struct vki_msghdr *msg;
+   UInt i;
+   Bool buffer_select = (sqe->flags & VKI_IOSQE_BUFFER_SELECT) != 0;
+
+   switch (sqe->opcode) {
+   case VKI_IORING_OP_READV:
+      if (buffer_select)
+         break;
+      iov = (struct vki_iovec *)(Addr)sqe->addr;
+      if (pre)
+         PRE_MEM_READ( "io_uring_enter(READV)", sqe->addr,
+                       sqe->len * sizeof(struct vki_iovec) );
+      if (!ML_(safe_to_deref)(iov, sqe->len * sizeof(struct vki_iovec)))
+         break;
+      for (i = 0; i < sqe->len; i++) {
+         if (pre)
+            PRE_MEM_WRITE( "io_uring_enter(READV(iov[i]))",
+                           (Addr)iov[i].iov_base, iov[i].iov_len );
+         else
+            POST_MEM_WRITE( (Addr)iov[i].iov_base, iov[i].iov_len );
+      }
+      break;
+
+   case VKI_IORING_OP_WRITEV:
+      if (!pre)
+         break;
+      iov = (struct vki_iovec *)(Addr)sqe->addr;
+      PRE_MEM_READ( "io_uring_enter(WRITEV)", sqe->addr,
+                    sqe->len * sizeof(struct vki_iovec) );
+      if (!ML_(safe_to_deref)(iov, sqe->len * sizeof(struct vki_iovec)))
+         break;
+      for (i = 0; i < sqe->len; i++)
+         PRE_MEM_READ( "io_uring_enter(WRITEV(iov[i]))",
+                       (Addr)iov[i].iov_base, iov[i].iov_len );
+      break;
+
+   case VKI_IORING_OP_READ_FIXED:
+   case VKI_IORING_OP_READ:
+   case VKI_IORING_OP_RECV:
+      if (buffer_select)
+         break;
+      if (pre)
+         PRE_MEM_WRITE( "io_uring_enter(READ)", sqe->addr, sqe->len );
+      else
+         POST_MEM_WRITE( sqe->addr, sqe->len );
+      break;
+
+   case VKI_IORING_OP_WRITE_FIXED:
+   case VKI_IORING_OP_WRITE:
+   case VKI_IORING_OP_SEND:
+      if (pre)
+         PRE_MEM_READ( "io_uring_enter(WRITE)", sqe->addr, sqe->len );
+      break;
+
+   case VKI_IORING_OP_SENDMSG:
+      msg = (struct vki_msghdr *)(Addr)sqe->addr;
+      if (pre)
+         ML_(generic_PRE_sys_sendmsg)( tid, "io_uring_enter(SENDMSG)", msg );
+      break;
+
+   case VKI_IORING_OP_RECVMSG:
+      msg = (struct vki_msghdr *)(Addr)sqe->addr;
+      /* A selected buffer replaces msg_iov, but the kernel still fills in
+         the name, control and flags: a zero length skips the iovecs. */
+      if (pre && !buffer_select)
+         ML_(generic_PRE_sys_recvmsg)( tid, "io_uring_enter(RECVMSG)", msg );
+      else if (!pre)
+         ML_(generic_POST_sys_recvmsg)( tid, "io_uring_enter(RECVMSG)", msg,
+                                        buffer_select ? 0 : ~0U );
+      break;
+
+   case VKI_IORING_OP_TIMEOUT:
+   case VKI_IORING_OP_LINK_TIMEOUT:
+      if (pre)
+         PRE_MEM_READ( "io_uring_enter(TIMEOUT)", sqe->addr,
+                       sizeof(struct vki_timespec) );
+      break;
+
+   case VKI_IORING_OP_NOP:
+   case VKI_IORING_OP_FSYNC:
+   case VKI_IORING_OP_POLL_ADD:
+   case VKI_IORING_OP_POLL_REMOVE:
+   case VKI_IORING_OP_SYNC_FILE_RANGE:
+   case VKI_IORING_OP_TIMEOUT_REMOVE:
+   case VKI_IORING_OP_ASYNC_CANCEL:
+   case VKI_IORING_OP_FALLOCATE:
+   case VKI_IORING_OP_CLOSE:
+   case VKI_IORING_OP_FADVISE:
+   case VKI_IORING_OP_MADVISE:
+      break;
+
+   default:
+      if (pre)
+         VG_(message)(Vg_DebugMsg,
+                      "Warning: unhandled io_uring_enter opcode: %u\n",
+                      sqe->opcode);
+      break;
+   }
+}
+
+/* Gives the pre or post events for the n sqes following the one at
+   index first in the submission queue array of r. */
+static void io_uring_sq_mem ( ThreadId tid, IoUring* r, UInt first, UInt n,
+                              Bool pre )
+{
+   const struct vki_io_sqring_offsets *off = &r->params.sq_off;
+   const UInt *mask, *array;
+   const struct vki_io_uring_sqe *sqes;
+   UInt i, idx;
+
+   if (r->sq_ring == 0 || r->sqes == 0)
+      return;
+   mask = (const UInt *)(r->sq_ring + off->ring_mask);
+   array = (const UInt *)(r->sq_ring + off->array);
+   sqes = (const struct vki_io_uring_sqe *)r->sqes;
+   if (!ML_(safe_to_deref)(mask, sizeof(UInt))
+       || !ML_(safe_to_deref)(array, r->params.sq_entries * sizeof(UInt))
+       || !ML_(safe_to_deref)(sqes, r->params.sq_entries
+                                    * sizeof(struct vki_io_uring_sqe)))
+      return;
+   for (i = 0; i < n; i++) {
+      idx = array[(first + i) & *mask];
+      if (idx < r->params.sq_entries)
+         io_uring_sqe_mem(tid, &sqes[idx], pre);
+   }
+}
+
+PRE(sys_io_uring_setup)
+{
+   PRINT("sys_io_uring_setup ( %" FMT_REGWORD "u, %#" FMT_REGWORD "x )",
+         ARG1, ARG2);
+   PRE_REG_READ2(long, "io_uring_setup", unsigned int, entries,
+                 struct vki_io_uring_params *, p);
+   PRE_MEM_READ( "io_uring_setup(p)", ARG2,
+                 offsetof(struct vki_io_uring_params, sq_off) );
+   PRE_MEM_WRITE( "io_uring_setup(p)", ARG2,
+                  sizeof(struct vki_io_uring_params) );
+}
+POST(sys_io_uring_setup)
+{
+   IoUring* r;
+
+   vg_assert(SUCCESS);
+   if (!ML_(fd_allowed)(RES, "io_uring_setup", tid, True)) {
+      VG_(close)(RES);
+      SET_STATUS_Failure( VKI_EMFILE );
+      return;
+   }
+   if (VG_(clo_track_fds))
+      ML_(record_fd_open_nameless) (tid, RES);
+   POST_MEM_WRITE( ARG2, sizeof(struct vki_io_uring_params) );
+
+   /* A closed io_uring fd can be reused by a newer io_uring. */
+   r = find_io_uring(RES);
+   if (r == NULL) {
+      r = VG_(malloc)("syswrap.io_uring_setup.1", sizeof(IoUring));
+      r->fd = RES;
+      r->next = io_urings;
+      io_urings = r;
+   }
+   VG_(memcpy)(&r->params, (void *)(Addr)ARG2,
+               sizeof(struct vki_io_uring_params));
+   r->sq_ring = 0;
+   r->sqes = 0;
+   /* With a kernel polling thread, sqes are consumed without
+      io_uring_enter: we cannot tell the tool about them. */
+   if (r->params.flags & VKI_IORING_SETUP_SQPOLL)
+      VG_(message)(Vg_DebugMsg,
+                   "Warning: io_uring_setup with IORING_SETUP_SQPOLL: "
+                   "memory accessed by submitted requests is not checked\n");
+}
+
+PRE(sys_io_uring_enter)
+{
+   IoUring* r;
+   const UInt *head, *tail;
+   UInt n;
+
+   *flags |= SfMayBlock;
+   PRINT("sys_io_uring_enter ( %" FMT_REGWORD "u, %" FMT_REGWORD "u, %"
+         FMT_REGWORD "u, %#" FMT_REGWORD "x, %#" FMT_REGWORD "x, %"
+         FMT_REGWORD "u )", ARG1, ARG2, ARG3, ARG4, ARG5, ARG6);
+   PRE_REG_READ6(long, "io_uring_enter",
+                 unsigned int, fd, unsigned int, to_submit,
+                 unsigned int, min_complete, unsigned int, flags,
+                 const vki_sigset_t *, sig, vki_size_t, sigsz);
+   if (ARG5 != 0)
+      PRE_MEM_READ( "io_uring_enter(sig)", ARG5, ARG6 );
+
+   /* The kernel takes at most to_submit sqes, from the head of the
+      submission queue up to its tail. */
+   r = find_io_uring(ARG1);
+   if (r == NULL || ARG2 == 0 || r->sq_ring == 0)
+      return;
+   head = (const UInt *)(r->sq_ring + r->params.sq_off.head);
+   tail = (const UInt *)(r->sq_ring + r->params.sq_off.tail);
+   if (!ML_(safe_to_deref)(head, sizeof(UInt))
+       || !ML_(safe_to_deref)(tail, sizeof(UInt)))
+      return;
+   n = *tail - *head;
+   if (n > ARG2)
+      n = ARG2;
+   io_uring_sq_mem(tid, r, *head, n, True);
+}
+POST(sys_io_uring_enter)
+{
+   IoUring* r;
+   const UInt *head;
+
+   /* RES is the number of sqes consumed, which immediately precede the
+      new head of the submission queue. */
+   r = find_io_uring(ARG1);
+   if (r == NULL || RES == 0 || r->sq_ring == 0)
+      return;
+   head = (const UInt *)(r->sq_ring + r->params.sq_off.head);
+   if (!ML_(safe_to_deref)(head, sizeof(UInt)))
+      return;
+   io_uring_sq_mem(tid, r, *head - RES, RES, False);
+}
+
+PRE(sys_io_uring_register)
+{
+   struct vki_io_uring_files_update *up;
+
+   PRINT("sys_io_uring_register ( %" FMT_REGWORD "u, %" FMT_REGWORD "u, %#"
+         FMT_REGWORD "x, %" FMT_REGWORD "u )", ARG1, ARG2, ARG3, ARG4);
+   PRE_REG_READ4(long, "io_uring_register",
+                 unsigned int, fd, unsigned int, opcode,
+                 void *, arg, unsigned int, nr_args);
+   switch (ARG2) {
+   case VKI_IORING_REGISTER_BUFFERS:
+      PRE_MEM_READ( "io_uring_register(BUFFERS)", ARG3,
+                    ARG4 * sizeof(struct vki_iovec) );
+      break;
+   case VKI_IORING_REGISTER_FILES:
+      PRE_MEM_READ( "io_uring_register(FILES)", ARG3,
+                    ARG4 * sizeof(__vki_s32) );
+      break;
+   case VKI_IORING_REGISTER_FILES_UPDATE:
+      up = (struct vki_io_uring_files_update *)(Addr)ARG3;
+      PRE_MEM_READ( "io_uring_register(FILES_UPDATE)", ARG3,
+                    sizeof(struct vki_io_uring_files_update) );
+      if (ML_(safe_to_deref)(up, sizeof(struct vki_io_uring_files_update)))
+         PRE_MEM_READ( "io_uring_register(FILES_UPDATE(fds))",
+                       (Addr)up->fds, ARG4 * sizeof(__vki_s32) );
+      break;
+   case VKI_IORING_REGISTER_EVENTFD:
+   case VKI_IORING_REGISTER_EVENTFD_ASYNC:
+      PRE_MEM_READ( "io_uring_register(EVENTFD)", ARG3, sizeof(__vki_s32) );
+      break;
+   case VKI_IORING_UNREGISTER_BUFFERS:
+   case VKI_IORING_UNREGISTER_FILES:
+   case VKI_IORING_UNREGISTER_EVENTFD:
+      break;
+   default:
+      VG_(message)(Vg_DebugMsg,
+                   "Warning: unhandled io_uring_register opcode: %lu\n",
+                   ARG2);
+      break;
+   }
+}
+
 /* ---------------------------------------------------------------------
    utime wrapper
    ------------------------------------------------------------------ */
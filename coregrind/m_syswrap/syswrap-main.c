@@ -1686,6 +1686,10 @@ void VG_(client_syscall) ( ThreadId tid, UInt trc )
 
    tst = VG_(get_ThreadState)(tid);
 
+   /* A syscall restarted after an interruption does not always go
+      through VG_(post_syscall): forget the buffers of the last one. */
+   VG_(smc_post_syscall)(tid);
+
    /* BEGIN ensure root thread's stack is suitably mapped */
    /* In some rare circumstances, we may do the syscall without the
       bottom page of the stack being mapped, because the stack pointer
@@ -2069,6 +2073,9 @@ void VG_(post_syscall) (ThreadId tid)
    tst = VG_(get_ThreadState)(tid);
    sci = & syscallInfo[tid];
 
+   /* The kernel is done with the buffers of the syscall. */
+   VG_(smc_post_syscall)(tid);
+
    /* m_signals.sigvgkill_handler might call here even when not in
       a syscall. */
    if (sci->status.what == SsIdle || sci->status.what == SsHandToKernel) {
@@ -1022,6 +1022,9 @@ static SyscallTableEntry syscall_table[] = {
    LINXY(__NR_memfd_create,      sys_memfd_create),     // 360
 
    LINXY(__NR_statx,             sys_statx),            // 383
+   LINXY(__NR_io_uring_setup,    sys_io_uring_setup),   // 425
+   LINXY(__NR_io_uring_enter,    sys_io_uring_enter),   // 426
+   LINX_(__NR_io_uring_register, sys_io_uring_register), // 427
 };
 
 SyscallTableEntry* ML_(get_linux_syscall_entry) ( UInt sysno )
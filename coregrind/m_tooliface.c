@@ -97,6 +97,7 @@ VgNeeds VG_(needs) = {
    .print_stats          = False,
    .info_location        = False,
    .var_info	         = False,
+   .lazy_debuginfo       = False,
    .malloc_replacement   = False,
    .xml_output           = False,
    .final_IR_tidy_pass   = False
@@ -225,6 +226,7 @@ NEEDS(libc_freeres)
 NEEDS(cxx_freeres)
 NEEDS(core_errors)
 NEEDS(var_info)
+NEEDS(lazy_debuginfo)
 
 void VG_(needs_superblock_discards)(
    void (*discard)(Addr, VexGuestExtents)
@@ -39,7 +39,13 @@
 #include "pub_core_libcbase.h"
 #include "pub_core_libcassert.h"
 #include "pub_core_libcprint.h"
+#include "pub_core_libcproc.h"    // VG_(read_nanosecond_timer)
+#include "pub_core_mallocfree.h"  // VG_(malloc), VG_(free)
 #include "pub_core_options.h"
+#include "pub_core_oset.h"
+#include "pub_core_syscall.h"     // VG_(do_syscall3)
+#include "pub_core_vkiscnums.h"   // __NR_mprotect
+#include "pub_core_xarray.h"
 
 #include "pub_core_debuginfo.h"  // VG_(get_fnname_w_offset)
 #include "pub_core_redir.h"      // VG_(redir_do_lookup)
@@ -77,6 +83,16 @@ static ULong n_PX_VexRegUpdUnwindregsAtMemAccess = 0;
 static ULong n_PX_VexRegUpdAllregsAtMemAccess    = 0;
 static ULong n_PX_VexRegUpdAllregsAtEachInsn     = 0;
 
+/* For --smc-check=protect. */
+static ULong n_smc_protects = 0;
+static ULong n_smc_faults   = 0;
+static ULong n_smc_syscall  = 0;
+static ULong n_smc_giveups  = 0;
+
+/* Time and count per stage of the Vex pipeline.  Only collected with
+   --stats=yes, as it costs a couple of clock reads per stage. */
+static VexPhaseStats phase_stats;
+
 void VG_(print_translation_stats) ( void )
 {
    UInt n_SP_updates = n_SP_updates_new_fast + n_SP_updates_new_generic_known
@@ -111,6 +127,42 @@ void VG_(print_translation_stats) ( void )
        "  AllRegs %'llu,  AllRegsAllInsns %'llu\n",
        n_PX_VexRegUpdSpAtMemAccess, n_PX_VexRegUpdUnwindregsAtMemAccess,
        n_PX_VexRegUpdAllregsAtMemAccess, n_PX_VexRegUpdAllregsAtEachInsn);
+
+   if (VG_(clo_smc_check) == Vg_SmcProtect)
+      VG_(message)
+         (Vg_DebugMsg,
+          "translate: smc-check=protect: %'llu pages protected, "
+          "%'llu write faults, %'llu syscall writes, %'llu given up\n",
+          n_smc_protects, n_smc_faults, n_smc_syscall, n_smc_giveups);
+
+   { ULong total = 0;
+     Int   ph;
+     for (ph = 0; ph < VexPhase_N; ph++)
+        total += phase_stats.time[ph];
+     if (total == 0) {
+        VG_(message)(Vg_DebugMsg,
+                     "translate: phase times not collected "
+                     "(needs --stats=yes)\n");
+     } else {
+        for (ph = 0; ph < VexPhase_N; ph++) {
+           ULong n = phase_stats.count[ph];
+           ULong t = phase_stats.time[ph];
+           VG_(message)(Vg_DebugMsg,
+                        "translate: %-10s %'12llu runs, %'10llu us "
+                        "(%4.1f%%), %'6llu ns/run\n",
+                        LibVEX_ppVexPhase(ph), n, t / 1000,
+                        t * 100.0 / total, n == 0 ? 0 : t / n);
+        }
+        if (phase_stats.ra_fast_count > 0)
+           VG_(message)(Vg_DebugMsg,
+                        "translate:   of which fast regalloc %'8llu runs, "
+                        "%'10llu us, %'6llu ns/run\n",
+                        phase_stats.ra_fast_count,
+                        phase_stats.ra_fast_time / 1000,
+                        phase_stats.ra_fast_time
+                           / phase_stats.ra_fast_count);
+     }
+   }
 }
 
 /*------------------------------------------------------------*/
@@ -791,6 +843,243 @@ static Bool translations_allowable_from_seg ( NSegment const* seg, Addr addr )
 }
 
 
+/*------------------------------------------------------------*/
+/*--- --smc-check=protect                                  ---*/
+/*------------------------------------------------------------*/
+
+/* With --smc-check=protect, code translated from writable memory that
+   is neither file-backed nor on a stack gets no self-check.  Instead
+   the host page holding it is made read-only, behind aspacem's back:
+   the guest and aspacem still consider it writable.  The first write
+   to the page then faults, and the SIGSEGV handler gives the page its
+   permissions back, discards its translations and restarts the write.
+   So a JIT that writes its code once pays for one fault per page,
+   rather than a checksum every time the code runs.  A page that keeps
+   being written to, typically because it mixes code and data, is not
+   protected again and its code gets self-checks, as with
+   --smc-check=all-non-file. */
+
+typedef
+   struct {
+      Addr page;      // key
+      UInt n_faults;  // times written to since its code was translated
+      Bool prot;      // currently write-protected by us
+   }
+   SmcPage;
+
+/* A page written to this many times gets self-checks from then on. */
+#define SMC_MAX_FAULTS 8
+
+static OSet* smc_pages = NULL;   // of SmcPage, ordered by page
+
+/* A buffer the kernel may be writing to on behalf of a syscall of tid.
+   The syscall can block, and meanwhile another thread can translate
+   code from the buffer's pages: protecting them then would make the
+   kernel's write fail with EFAULT, so they are left alone until the
+   syscall is over. */
+typedef
+   struct {
+      ThreadId tid;
+      Addr     start;
+      Addr     last;
+   }
+   SmcSyscallWrite;
+
+static XArray* smc_syscall_writes = NULL;   // of SmcSyscallWrite
+
+static UInt seg_prot ( NSegment const* seg )
+{
+   return (seg->hasR ? VKI_PROT_READ  : 0)
+          | (seg->hasW ? VKI_PROT_WRITE : 0)
+          | (seg->hasX ? VKI_PROT_EXEC  : 0);
+}
+
+static Bool smc_set_host_prot ( Addr page, UInt prot )
+{
+   SysRes sres = VG_(do_syscall3)(__NR_mprotect, page, VKI_PAGE_SIZE, prot);
+   return !sr_isError(sres);
+}
+
+static Bool smc_in_syscall_write ( Addr page )
+{
+   Word i, n;
+
+   if (smc_syscall_writes == NULL)
+      return False;
+   n = VG_(sizeXA)(smc_syscall_writes);
+   for (i = 0; i < n; i++) {
+      SmcSyscallWrite* w = VG_(indexXA)(smc_syscall_writes, i);
+      if (page <= w->last && page + VKI_PAGE_SIZE - 1 >= w->start)
+         return True;
+   }
+   return False;
+}
+
+/* Write-protect all pages overlapping [a, a+len).  Returns False if
+   that could not be done for some page, in which case the code needs
+   a self-check. */
+static Bool smc_protect_range ( Addr a, SizeT len )
+{
+   Addr page;
+   Addr last = VG_PGROUNDDN(a + (len == 0 ? 0 : len - 1));
+
+   if (smc_pages == NULL)
+      smc_pages = VG_(OSetGen_Create)(offsetof(SmcPage, page), NULL,
+                                      VG_(malloc), "smc.pages.1", VG_(free));
+
+   for (page = VG_PGROUNDDN(a); page <= last; page += VKI_PAGE_SIZE) {
+      SmcPage* p = VG_(OSetGen_Lookup)(smc_pages, &page);
+      if (p == NULL) {
+         p = VG_(OSetGen_AllocNode)(smc_pages, sizeof(SmcPage));
+         p->page     = page;
+         p->n_faults = 0;
+         p->prot     = False;
+         VG_(OSetGen_Insert)(smc_pages, p);
+      }
+      if (p->n_faults >= SMC_MAX_FAULTS)
+         return False;
+      if (p->prot)
+         continue;
+      NSegment const* seg = VG_(am_find_nsegment)(page);
+      if (seg == NULL || smc_in_syscall_write(page))
+         return False;
+      if (seg->hasW
+          && !smc_set_host_prot(page, seg_prot(seg) & ~VKI_PROT_WRITE)) {
+         p->n_faults = SMC_MAX_FAULTS;
+         n_smc_giveups++;
+         return False;
+      }
+      /* A page the guest cannot write to needs no mprotect now, but
+         must be protected if it is ever made writable. */
+      p->prot = True;
+      n_smc_protects++;
+   }
+   return True;
+}
+
+/* Give a protected page its write permission back, and discard the
+   code translated from it. */
+static void smc_unprotect_page ( SmcPage* p, NSegment const* seg )
+{
+   if (seg->hasW)
+      smc_set_host_prot(p->page, seg_prot(seg));
+   p->prot = False;
+   if (++p->n_faults == SMC_MAX_FAULTS)
+      n_smc_giveups++;
+   VG_(discard_translations)(p->page, VKI_PAGE_SIZE, "smc-check=protect");
+}
+
+Bool VG_(smc_handle_write_fault) ( ThreadId tid, Addr a )
+{
+   if (smc_pages == NULL)
+      return False;
+
+   Addr page = VG_PGROUNDDN(a);
+   SmcPage* p = VG_(OSetGen_Lookup)(smc_pages, &page);
+   if (p == NULL || !p->prot)
+      return False;
+   NSegment const* seg = VG_(am_find_nsegment)(page);
+   if (seg == NULL || !seg->hasW)
+      return False;   // a real fault: the guest cannot write there either
+
+   smc_unprotect_page(p, seg);
+   n_smc_faults++;
+   /* The translation doing the write may itself have been discarded,
+      and may carry on running stale code until its end.  Make the
+      thread leave generated code at the next block boundary, rather
+      than chaining into more blocks before noticing. */
+   VG_(threads)[tid].arch.vex.host_EvC_COUNTER = 0;
+   return True;
+}
+
+/* Calls 'fn' for each tracked page overlapping [a, a+len). */
+static void smc_for_pages_in ( Addr a, SizeT len,
+                               void (*fn)(SmcPage*, NSegment const*) )
+{
+   if (smc_pages == NULL || len == 0)
+      return;
+
+   Addr start = VG_PGROUNDDN(a);
+   Addr last  = VG_PGROUNDDN(a + len - 1);
+   SmcPage* p;
+
+   VG_(OSetGen_ResetIterAt)(smc_pages, &start);
+   while ((p = VG_(OSetGen_Next)(smc_pages)) != NULL && p->page <= last) {
+      NSegment const* seg = VG_(am_find_nsegment)(p->page);
+      fn(p, seg);
+   }
+}
+
+static void smc_unprotect_for_syscall ( SmcPage* p, NSegment const* seg )
+{
+   if (p->prot && seg != NULL) {
+      smc_unprotect_page(p, seg);
+      n_smc_syscall++;
+   }
+}
+
+void VG_(smc_pre_syscall_write) ( ThreadId tid, Addr a, SizeT len )
+{
+   SmcSyscallWrite w;
+
+   if (VG_(clo_smc_check) != Vg_SmcProtect || len == 0)
+      return;
+   if (smc_syscall_writes == NULL)
+      smc_syscall_writes = VG_(newXA)(VG_(malloc), "smc.syscall_writes.1",
+                                      VG_(free), sizeof(SmcSyscallWrite));
+   w.tid   = tid;
+   w.start = a;
+   w.last  = a + len - 1;
+   VG_(addToXA)(smc_syscall_writes, &w);
+   smc_for_pages_in(a, len, smc_unprotect_for_syscall);
+}
+
+void VG_(smc_post_syscall) ( ThreadId tid )
+{
+   Word i;
+
+   if (smc_syscall_writes == NULL)
+      return;
+   for (i = VG_(sizeXA)(smc_syscall_writes) - 1; i >= 0; i--) {
+      SmcSyscallWrite* w = VG_(indexXA)(smc_syscall_writes, i);
+      if (w->tid == tid)
+         VG_(removeIndexXA)(smc_syscall_writes, i);
+   }
+}
+
+static void smc_reprotect ( SmcPage* p, NSegment const* seg )
+{
+   if (p->prot && seg != NULL && seg->hasW
+       && !smc_set_host_prot(p->page, seg_prot(seg) & ~VKI_PROT_WRITE)) {
+      /* Cannot happen, as the guest's own mprotect just succeeded. */
+      smc_unprotect_page(p, seg);
+   }
+}
+
+void VG_(smc_notify_mprotect) ( Addr a, SizeT len )
+{
+   smc_for_pages_in(a, len, smc_reprotect);
+}
+
+void VG_(smc_forget_range) ( Addr a, SizeT len )
+{
+   if (smc_pages == NULL || len == 0)
+      return;
+
+   Addr start = VG_PGROUNDDN(a);
+   Addr last  = VG_PGROUNDDN(a + len - 1);
+   SmcPage* p;
+
+   while (True) {
+      VG_(OSetGen_ResetIterAt)(smc_pages, &start);
+      p = VG_(OSetGen_Next)(smc_pages);
+      if (p == NULL || p->page > last)
+         break;
+      VG_(OSetGen_Remove)(smc_pages, &p->page);
+      VG_(OSetGen_FreeNode)(smc_pages, p);
+   }
+}
+
 /* Produce a bitmask stating which of the supplied extents needs a
    self-check.  See documentation of
    VexTranslateArgs::needs_self_check for more details about the
@@ -870,6 +1159,25 @@ static UInt needs_self_check ( void* closureV,
                }
                break;
             }
+            case Vg_SmcProtect: {
+               /* as all-non-file, except that code which is neither
+                  on this thread's stack nor on a page too often
+                  written to is protected instead of checked */
+               if (!segA) {
+                  segA = VG_(am_find_nsegment)(addr);
+               }
+               if (segA && segA->kind == SkFileC && segA->start <= addr
+                   && (len == 0 || addr + len <= segA->end + 1)) {
+                  /* in a file-mapped segment; skip the check */
+                  break;
+               }
+               NSegment const* segSP
+                  = VG_(am_find_nsegment)(VG_(get_SP)(closure->tid));
+               if (segA == NULL || segA == segSP
+                   || !smc_protect_range(addr, len))
+                  check = True;
+               break;
+            }
             default:
                vg_assert(0);
          }
@@ -1780,6 +2088,8 @@ Bool VG_(translate) ( ThreadId tid,
    vta.traceflags        = verbosity;
    vta.sigill_diag       = VG_(clo_sigill_diag);
    vta.addProfInc        = VG_(clo_profyle_sbs) && kind != T_NoRedir;
+   vta.phase_clock       = VG_(read_nanosecond_timer);
+   vta.phase_stats       = VG_(clo_stats) ? &phase_stats : NULL;
 
    /* Set up the dispatch continuation-point info.  If this is a
       no-redir translation then it cannot be chained, and the chain-me
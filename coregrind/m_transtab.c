@@ -53,6 +53,16 @@
 /*--- Management of the FIFO-based translation table+cache. ---*/
 /*-------------------------------------------------------------*/
 
+/* Translations live only as long as the process.  They are not
+   saved for later runs of the same executable because the host code
+   is not relocatable: tools embed the addresses of state they
+   allocate while instrumenting (cachegrind's InstrInfo, datagrind's
+   block definitions) as constants, chaining patches absolute
+   addresses of other translations into it, and the guest addresses it
+   is keyed by move with ASLR.  Reusing it would need every tool to
+   describe those constants so they could be rebuilt, which is most
+   of the cost of instrumenting anyway. */
+
 /* Nr of sectors provided via command line parameter. */
 UInt VG_(clo_num_transtab_sectors) = N_SECTORS_DEFAULT;
 /* Nr of sectors.
@@ -63,6 +73,10 @@ static SECno n_sectors = 0;
    provided default. */
 UInt VG_(clo_avg_transtab_entry_size) = 0;
 
+/* How much of a recycled sector, in percent, may be given to the hot
+   translations it held.  0 means to throw them all away. */
+UInt VG_(clo_transtab_keep_hot) = 25;
+
 /*------------------ CONSTANTS ------------------*/
 /* Number of entries in hash table of each sector.  This needs to be a prime
    number to work properly, it must be <= 65535 (so that a TTE index
@@ -176,6 +190,14 @@ typedef
                are profiling. */
             ULong    count;
             UShort   weight;
+            UShort   code_len; // host code size, for SB profile exports
+            /* Not profiling-only, despite the name of the struct:
+               the low 16 bits of recycle_epoch when the translation
+               was last looked up, which tells the sector recycler it
+               is still in use, and the offset of its profile counter
+               increment, or NO_PROF_INC, so that it can be moved. */
+            UShort   last_used;
+            UShort   offs_profInc;
          } prof; // if status == InUse
          TTEno next_empty_tte; // if status != InUse
       } usage;
@@ -449,6 +471,16 @@ static Int    youngest_sector = INV_SNO;
    at startup and does not change. */
 static Int    tc_sector_szQ = 0;
 
+/* Bumped, skipping zero, each time a sector is recycled.  A
+   translation stamped with the current value has been looked up since
+   the last recycle, which also flushed the fast cache, so it ran at
+   least once since then. */
+static UShort recycle_epoch = 1;
+
+/* TTEntryC.usage.prof.offs_profInc for code without a profile
+   counter increment. */
+#define NO_PROF_INC 0xFFFF
+
 
 /* A list of sector numbers, in the order which they should be
    searched to find translations.  This is an optimisation to be used
@@ -515,6 +547,10 @@ static ULong n_dump_count = 0;
 static ULong n_dump_osize = 0;
 static ULong n_sectors_recycled = 0;
 
+/* Number/tsize of translations kept when their sector was recycled. */
+static ULong n_keep_count = 0;
+static ULong n_keep_tsize = 0;
+
 /* Number/osize of translations discarded due to requests to do so. */
 static ULong n_disc_count = 0;
 static ULong n_disc_osize = 0;
@@ -995,11 +1031,14 @@ static void unchain_one ( VexArch arch_host, VexEndness endness_host,
 
 /* The specified block is about to be deleted.  Update the preds and
    succs of its associated blocks accordingly.  This includes undoing
-   any chained jumps to this block. */
+   any chained jumps to this block.  If 'moving', the block's code is
+   about to be moved rather than deleted, so its own chained jumps,
+   which may be pc-relative, are undone too. */
 static
 void unchain_in_preparation_for_deletion ( VexArch arch_host,
                                            VexEndness endness_host,
-                                           SECno here_sNo, TTEno here_tteNo )
+                                           SECno here_sNo, TTEno here_tteNo,
+                                           Bool moving )
 {
    if (DEBUG_TRANSTAB)
       VG_(printf)("QQQ unchain_in_prep %u.%u...\n", here_sNo, here_tteNo);
@@ -1051,6 +1090,13 @@ void unchain_in_preparation_for_deletion ( VexArch arch_host,
            break;
       }
       vg_assert(j < m); // "ie must be findable"
+      if (moving) {
+         UChar* to_slow_EP = (UChar*)to_tteC->tcptr;
+         UChar* to_fast_EP = to_slow_EP + evCheckSzB;
+         unchain_one(arch_host, endness_host,
+                     InEdgeArr__index(&to_tteC->in_edges, j),
+                     to_fast_EP, to_slow_EP);
+      }
       InEdgeArr__deleteIndex(&to_tteC->in_edges, j);
    }
 
@@ -1543,11 +1589,87 @@ static void add_to_empty_tt_list (SECno sNo, TTEno tteno)
    sectors[sNo].empty_tt_list = tteno;
 }
 
+static TTEno tt_add_in_sector ( SECno y,
+                                const VexGuestExtents* vge,
+                                Addr         entry,
+                                const UChar* code,
+                                UInt         code_len,
+                                Int          offs_profInc,
+                                UShort       weight );
+
+/* A translation that survives the recycling of its sector. */
+typedef
+   struct {
+      TTEntryH h;      // its guest extents; .status is not used
+      Addr     entry;
+      ULong*   tcptr;  // its host code, in the sector being recycled
+      ULong    count;
+      UShort   code_len;
+      UShort   offs_profInc;
+      UShort   weight;
+   }
+   KeptTTE;
+
+/* Recycling a sector throws away hot translations along with cold
+   ones, and a program whose working set is bigger than the whole
+   cache then keeps retranslating its hottest code.  So the
+   translations of sector sno that were used since the previous
+   recycle, as many as fit in VG_(clo_transtab_keep_hot) percent of a
+   sector, are moved to the front of it instead, and so survive until
+   it is recycled again.  This is safe because host code is position
+   independent once unchained, as it is generated into a temporary
+   buffer anyway; only the profile counter increment, if any, has to
+   be patched again.  Marks the chosen ones in kept[] and returns them
+   in host code order, which is the order they must be moved in. */
+static XArray* /* of KeptTTE */ choose_hot_translations ( SECno sno,
+                                                         Bool* kept )
+{
+   const Sector* sec  = &sectors[sno];
+   Word  max_nQ  = ((Word)tc_sector_szQ * VG_(clo_transtab_keep_hot)) / 100;
+   Int   max_n   = (N_TTES_PER_SECTOR * VG_(clo_transtab_keep_hot)) / 100;
+   Word  nQ      = 0;
+   XArray* res   = NULL;
+
+   for (Word i = 0; i < VG_(sizeXA)(sec->host_extents); i++) {
+      const HostExtent* hx = VG_(indexXA)(sec->host_extents, i);
+      if (HostExtent__is_dead(hx, sec))
+         continue;
+      TTEno tteNo = hx->tteNo;
+      const TTEntryC* tteC = &sec->ttC[tteNo];
+      if (sec->ttH[tteNo].status != InUse
+          || tteC->usage.prof.last_used != recycle_epoch)
+         continue;
+      Word reqdQ = (hx->len + 7) >> 3;
+      if (nQ + reqdQ > max_nQ)
+         continue;
+
+      KeptTTE k;
+      k.h            = sec->ttH[tteNo];
+      k.entry        = tteC->entry;
+      k.tcptr        = tteC->tcptr;
+      k.count        = tteC->usage.prof.count;
+      k.code_len     = tteC->usage.prof.code_len;
+      k.offs_profInc = tteC->usage.prof.offs_profInc;
+      k.weight       = tteC->usage.prof.weight;
+      vg_assert(k.code_len == hx->len);
+      if (res == NULL)
+         res = VG_(newXA)(ttaux_malloc, "transtab.choose_hot_translations",
+                          ttaux_free, sizeof(KeptTTE));
+      VG_(addToXA)(res, &k);
+      kept[tteNo] = True;
+      nQ += reqdQ;
+      if (VG_(sizeXA)(res) >= max_n)
+         break;
+   }
+   return res;
+}
+
 static void initialiseSector ( SECno sno )
 {
    UInt i;
    SysRes  sres;
    Sector* sec;
+   XArray* keep = NULL; /* of KeptTTE */
    vg_assert(isValidSector(sno));
 
    { Bool sane = sanity_check_sector_search_order();
@@ -1644,7 +1766,17 @@ static void initialiseSector ( SECno sno )
       vg_assert(sec->ttC != NULL);
       vg_assert(sec->ttH != NULL);
       vg_assert(sec->tc_next != NULL);
-      n_dump_count += sec->tt_n_inuse;
+
+      Bool* kept = NULL;
+      if (VG_(clo_transtab_keep_hot) > 0) {
+         kept = ttaux_malloc("transtab.initialiseSector(kept)",
+                             N_TTES_PER_SECTOR * sizeof(Bool));
+         VG_(memset)(kept, 0, N_TTES_PER_SECTOR * sizeof(Bool));
+         keep = choose_hot_translations(sno, kept);
+      }
+      if (++recycle_epoch == 0)
+         recycle_epoch = 1;
+      n_dump_count += sec->tt_n_inuse - (keep ? VG_(sizeXA)(keep) : 0);
 
       VexArch     arch_host = VexArch_INVALID;
       VexArchInfo archinfo_host;
@@ -1660,16 +1792,21 @@ static void initialiseSector ( SECno sno )
          if (sec->ttH[ei].status == InUse) {
             vg_assert(sec->ttC[ei].n_tte2ec >= 1);
             vg_assert(sec->ttC[ei].n_tte2ec <= 3);
-            n_dump_osize += TTEntryH__osize(&sec->ttH[ei]);
+            /* A kept translation is only unchained.  The tool must
+               not hear of it, as its code stays in use. */
+            if (kept == NULL || !kept[ei])
+               n_dump_osize += TTEntryH__osize(&sec->ttH[ei]);
             /* Tell the tool too. */
-            if (VG_(needs).superblock_discards) {
+            if (VG_(needs).superblock_discards
+                && (kept == NULL || !kept[ei])) {
                VexGuestExtents vge_tmp;
                TTEntryH__to_VexGuestExtents( &vge_tmp, &sec->ttH[ei] );
                VG_TDICT_CALL( tool_discard_superblock_info,
                               sec->ttC[ei].entry, vge_tmp );
             }
             unchain_in_preparation_for_deletion(arch_host,
-                                                endness_host, sno, ei);
+                                                endness_host, sno, ei,
+                                                kept != NULL && kept[ei]);
          } else {
             vg_assert(sec->ttC[ei].n_tte2ec == 0);
          }
@@ -1682,6 +1819,8 @@ static void initialiseSector ( SECno sno )
 
       if (DEBUG_TRANSTAB) VG_(printf)("QQQ unlink-entire-sector: %d END\n",
                                       sno);
+      if (kept)
+         ttaux_free(kept);
 
       /* Free up the eclass structures. */
       for (EClassNo e = 0; e < ECLASS_N; e++) {
@@ -1720,89 +1859,50 @@ static void initialiseSector ( SECno sno )
 
    invalidateFastCache();
 
+   if (keep) {
+      for (Word w = 0; w < VG_(sizeXA)(keep); w++) {
+         const KeptTTE* k = VG_(indexXA)(keep, w);
+         VexGuestExtents vge;
+         TTEntryH__to_VexGuestExtents(&vge, &k->h);
+         TTEno tteNo
+            = tt_add_in_sector(sno, &vge, k->entry, (const UChar*)k->tcptr,
+                               k->code_len,
+                               k->offs_profInc == NO_PROF_INC
+                                  ? -1 : k->offs_profInc,
+                               k->weight);
+         sec->ttC[tteNo].usage.prof.count = k->count;
+         n_keep_tsize += k->code_len;
+      }
+      n_keep_count += VG_(sizeXA)(keep);
+      if (VG_(clo_stats) || VG_(debugLog_getLevel)() >= 1)
+         VG_(dmsg)("transtab: " "kept     %ld hot translations in sector %d\n",
+                   VG_(sizeXA)(keep), sno);
+      VG_(deleteXA)(keep);
+   }
+
    { Bool sane = sanity_check_sector_search_order();
      vg_assert(sane);
    }
 }
 
-/* Add a translation of vge to TT/TC.  The translation is temporarily
-   in code[0 .. code_len-1].
-
-   pre: youngest_sector points to a valid (although possibly full)
-   sector.
-*/
-void VG_(add_to_transtab)( const VexGuestExtents* vge,
-                           Addr             entry,
-                           Addr             code,
-                           UInt             code_len,
-                           Bool             is_self_checking,
-                           Int              offs_profInc,
-                           UInt             n_guest_instrs )
+/* Put a translation of vge into sector y, which must have room for
+   it, copying the host code from code[0 .. code_len-1].  The code may
+   lie in y itself, at or above y's allocation point.  Returns the
+   translation's tt slot. */
+static TTEno tt_add_in_sector ( SECno y,
+                              const VexGuestExtents* vge,
+                              Addr         entry,
+                              const UChar* code,
+                              UInt         code_len,
+                              Int          offs_profInc,
+                              UShort       weight )
 {
-   Int    tcAvailQ, reqdQ, y;
+   Int    tcAvailQ, reqdQ;
    ULong  *tcptr, *tcptr2;
-   UChar* srcP;
    UChar* dstP;
 
-   vg_assert(init_done);
-   vg_assert(vge->n_used >= 1 && vge->n_used <= 3);
-
-   /* 60000: should agree with N_TMPBUF in m_translate.c. */
-   vg_assert(code_len > 0 && code_len < 60000);
-
-   /* Generally stay sane */
-   vg_assert(n_guest_instrs < 200); /* it can be zero, tho */
-
-   if (DEBUG_TRANSTAB)
-      VG_(printf)("add_to_transtab(entry = 0x%lx, len = %u) ...\n",
-                  entry, code_len);
-
-   n_in_count++;
-   n_in_tsize += code_len;
-   n_in_osize += vge_osize(vge);
-   if (is_self_checking)
-      n_in_sc_count++;
-
-   y = youngest_sector;
-   vg_assert(isValidSector(y));
-
-   if (sectors[y].tc == NULL)
-      initialiseSector(y);
-
-   /* Try putting the translation in this sector. */
    reqdQ = (code_len + 7) >> 3;
 
-   /* Will it fit in tc? */
-   tcAvailQ = ((ULong*)(&sectors[y].tc[tc_sector_szQ]))
-              - ((ULong*)(sectors[y].tc_next));
-   vg_assert(tcAvailQ >= 0);
-   vg_assert(tcAvailQ <= tc_sector_szQ);
-
-   if (tcAvailQ < reqdQ 
-       || sectors[y].tt_n_inuse >= N_TTES_PER_SECTOR) {
-      /* No.  So move on to the next sector.  Either it's never been
-         used before, in which case it will get its tt/tc allocated
-         now, or it has been used before, in which case it is set to be
-         empty, hence throwing out the oldest sector. */
-      vg_assert(tc_sector_szQ > 0);
-      Int tt_loading_pct = (100 * sectors[y].tt_n_inuse) 
-                           / N_HTTES_PER_SECTOR;
-      Int tc_loading_pct = (100 * (tc_sector_szQ - tcAvailQ)) 
-                           / tc_sector_szQ;
-      if (VG_(clo_stats) || VG_(debugLog_getLevel)() >= 1) {
-         VG_(dmsg)("transtab: "
-                   "declare  sector %d full "
-                   "(TT loading %2d%%, TC loading %2d%%, avg tce size %d)\n",
-                   y, tt_loading_pct, tc_loading_pct,
-                   8 * (tc_sector_szQ - tcAvailQ)/sectors[y].tt_n_inuse);
-      }
-      youngest_sector++;
-      if (youngest_sector >= n_sectors)
-         youngest_sector = 0;
-      y = youngest_sector;
-      initialiseSector(y);
-   }
-
    /* Be sure ... */
    tcAvailQ = ((ULong*)(&sectors[y].tc[tc_sector_szQ]))
               - ((ULong*)(sectors[y].tc_next));
@@ -1818,8 +1918,7 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
    vg_assert(tcptr <= &sectors[y].tc[tc_sector_szQ]);
 
    dstP = (UChar*)tcptr;
-   srcP = (UChar*)code;
-   VG_(memcpy)(dstP, srcP, code_len);
+   VG_(memmove)(dstP, code, code_len);
    sectors[y].tc_next += reqdQ;
    sectors[y].tt_n_inuse++;
 
@@ -1835,14 +1934,10 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
    TTEntryH__init(&sectors[y].ttH[tteix]);
    sectors[y].ttC[tteix].tcptr  = tcptr;
    sectors[y].ttC[tteix].usage.prof.count  = 0;
-
-   sectors[y].ttC[tteix].usage.prof.weight
-      = False
-           ? // Count guest instrs (assumes all side exits are untaken)
-             (n_guest_instrs == 0 ? 1 : n_guest_instrs)
-           : // Counts some (not very good) approximation to host instructions
-             (code_len == 0 ? 1 : (code_len / 4));
-
+   sectors[y].ttC[tteix].usage.prof.weight = weight;
+   sectors[y].ttC[tteix].usage.prof.code_len = (UShort)code_len;
+   sectors[y].ttC[tteix].usage.prof.offs_profInc
+      = offs_profInc == -1 ? NO_PROF_INC : (UShort)offs_profInc;
    sectors[y].ttC[tteix].entry  = entry;
    TTEntryH__from_VexGuestExtents( &sectors[y].ttH[tteix], vge );
    sectors[y].ttH[tteix].status = InUse;
@@ -1902,6 +1997,94 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
 
    /* Note the eclass numbers for this translation. */
    upd_eclasses_after_add( &sectors[y], tteix );
+
+   return tteix;
+}
+
+/* Add a translation of vge to TT/TC.  The translation is temporarily
+   in code[0 .. code_len-1].
+
+   pre: youngest_sector points to a valid (although possibly full)
+   sector.
+*/
+void VG_(add_to_transtab)( const VexGuestExtents* vge,
+                           Addr             entry,
+                           Addr             code,
+                           UInt             code_len,
+                           Bool             is_self_checking,
+                           Int              offs_profInc,
+                           UInt             n_guest_instrs )
+{
+   Int    tcAvailQ, reqdQ, y;
+
+   vg_assert(init_done);
+   vg_assert(vge->n_used >= 1 && vge->n_used <= 3);
+
+   /* 60000: should agree with N_TMPBUF in m_translate.c. */
+   vg_assert(code_len > 0 && code_len < 60000);
+
+   /* Generally stay sane */
+   vg_assert(n_guest_instrs < 200); /* it can be zero, tho */
+
+   if (DEBUG_TRANSTAB)
+      VG_(printf)("add_to_transtab(entry = 0x%lx, len = %u) ...\n",
+                  entry, code_len);
+
+   n_in_count++;
+   n_in_tsize += code_len;
+   n_in_osize += vge_osize(vge);
+   if (is_self_checking)
+      n_in_sc_count++;
+
+   y = youngest_sector;
+   vg_assert(isValidSector(y));
+
+   if (sectors[y].tc == NULL)
+      initialiseSector(y);
+
+   /* Try putting the translation in this sector. */
+   reqdQ = (code_len + 7) >> 3;
+
+   /* Will it fit in tc? */
+   tcAvailQ = ((ULong*)(&sectors[y].tc[tc_sector_szQ]))
+              - ((ULong*)(sectors[y].tc_next));
+   vg_assert(tcAvailQ >= 0);
+   vg_assert(tcAvailQ <= tc_sector_szQ);
+
+   if (tcAvailQ < reqdQ 
+       || sectors[y].tt_n_inuse >= N_TTES_PER_SECTOR) {
+      /* No.  So move on to the next sector.  Either it's never been
+         used before, in which case it will get its tt/tc allocated
+         now, or it has been used before, in which case it is set to be
+         empty, hence throwing out the oldest sector. */
+      vg_assert(tc_sector_szQ > 0);
+      Int tt_loading_pct = (100 * sectors[y].tt_n_inuse) 
+                           / N_HTTES_PER_SECTOR;
+      Int tc_loading_pct = (100 * (tc_sector_szQ - tcAvailQ)) 
+                           / tc_sector_szQ;
+      if (VG_(clo_stats) || VG_(debugLog_getLevel)() >= 1) {
+         VG_(dmsg)("transtab: "
+                   "declare  sector %d full "
+                   "(TT loading %2d%%, TC loading %2d%%, avg tce size %d)\n",
+                   y, tt_loading_pct, tc_loading_pct,
+                   8 * (tc_sector_szQ - tcAvailQ)/sectors[y].tt_n_inuse);
+      }
+      youngest_sector++;
+      if (youngest_sector >= n_sectors)
+         youngest_sector = 0;
+      y = youngest_sector;
+      initialiseSector(y);
+   }
+
+   tt_add_in_sector( y, vge, entry, (const UChar*)code, code_len,
+                     offs_profInc,
+                     False
+                        ? // Count guest instrs (assumes all side exits
+                          // are untaken)
+                          (n_guest_instrs == 0 ? 1 : n_guest_instrs)
+                        : // Counts some (not very good) approximation
+                          // to host instructions
+                          (code_len == 0 ? 1 : (code_len / 4)) );
 }
 
 
@@ -1941,6 +2124,7 @@ Bool VG_(search_transtab) ( /*OUT*/Addr*  res_hcode,
          if (tti < N_TTES_PER_SECTOR
              && sectors[sno].ttC[tti].entry == guest_addr) {
             /* found it */
+            sectors[sno].ttC[tti].usage.prof.last_used = recycle_epoch;
             if (upd_cache)
                setFastCacheEntry( 
                   guest_addr, sectors[sno].ttC[tti].tcptr );
@@ -2039,7 +2223,8 @@ static void delete_tte ( /*OUT*/Addr* ga_deleted,
    *ga_deleted = tteH->vge_base[0];
 
    /* Unchain .. */
-   unchain_in_preparation_for_deletion(arch_host, endness_host, secNo, tteno);
+   unchain_in_preparation_for_deletion(arch_host, endness_host, secNo, tteno,
+                                       False/*!moving*/);
 
    /* Deal with the ec-to-tte links first. */
    for (i = 0; i < tteC->n_tte2ec; i++) {
@@ -2671,6 +2856,11 @@ UInt VG_(get_bbs_translated) ( void )
    return n_in_count;
 }
 
+ULong VG_(get_sectors_recycled) ( void )
+{
+   return n_sectors_recycled;
+}
+
 UInt VG_(get_bbs_discarded_or_dumped) ( void )
 {
    return n_disc_count + n_dump_count;
@@ -2682,8 +2872,9 @@ void VG_(print_tt_tc_stats) ( void )
       "    tt/tc: %'llu tt lookups requiring %'llu probes\n",
       n_full_lookups, n_lookup_probes );
    VG_(message)(Vg_DebugMsg,
-      "    tt/tc: %'llu fast-cache updates, %'llu flushes\n",
-      n_fast_updates, n_fast_flushes );
+      "    tt/tc: %'llu fast-cache updates, %'llu flushes "
+      "(%d sets x 4 ways)\n",
+      n_fast_updates, n_fast_flushes, VG_TT_FAST_SETS );
 
    VG_(message)(Vg_DebugMsg,
                 " transtab: new        %'llu "
@@ -2697,6 +2888,10 @@ void VG_(print_tt_tc_stats) ( void )
                 " transtab: dumped     %'llu (%'llu -> ?" "?) "
                 "(sectors recycled %'llu)\n",
                 n_dump_count, n_dump_osize, n_sectors_recycled );
+   VG_(message)(Vg_DebugMsg,
+                " transtab: kept       %'llu (tsize %'llu) "
+                "when recycling sectors\n",
+                n_keep_count, n_keep_tsize );
    VG_(message)(Vg_DebugMsg,
                 " transtab: discarded  %'llu (%'llu -> ?" "?)\n",
                 n_disc_count, n_disc_osize );
@@ -2732,8 +2927,11 @@ ULong VG_(get_SB_profile) ( SBProfEntry tops[], UInt n_tops )
       ttes.  tops contains pointers to the most-used n_tops blocks, in
       descending order (viz, tops[0] is the highest scorer). */
    for (s = 0; s < n_tops; s++) {
-      tops[s].addr  = 0;
-      tops[s].score = 0;
+      tops[s].addr      = 0;
+      tops[s].score     = 0;
+      tops[s].count     = 0;
+      tops[s].guest_szB = 0;
+      tops[s].host_szB  = 0;
    }
 
    score_total = 0;
@@ -2767,8 +2965,11 @@ ULong VG_(get_SB_profile) ( SBProfEntry tops[], UInt n_tops )
          if (r < n_tops) {
             for (s = n_tops-1; s > r; s--)
                tops[s] = tops[s-1];
-            tops[r].addr  = sectors[sno].ttC[i].entry;
-            tops[r].score = score( &sectors[sno].ttC[i] );
+            tops[r].addr      = sectors[sno].ttC[i].entry;
+            tops[r].score     = score( &sectors[sno].ttC[i] );
+            tops[r].count     = sectors[sno].ttC[i].usage.prof.count;
+            tops[r].guest_szB = TTEntryH__osize( &sectors[sno].ttH[i] );
+            tops[r].host_szB  = sectors[sno].ttC[i].usage.prof.code_len;
          }
       }
    }
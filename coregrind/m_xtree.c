@@ -220,9 +220,82 @@ struct _XTree {
    XT_shared* shared;
 
    HChar* tmp_data; /* temporary buffer, to insert new elements. */
-   XArray* data; /* of elements of size dataSzB */
+
+   /* The data elements, of size dataSzB, in chunks of XT_CHUNK_N
+      elements.  See XT_chunk. */
+   UInt n_data;     /* nr of elements. */
+   UInt chunks_sz;  /* size of chunks (in nr of elements). */
+   struct _XT_chunk** chunks;
 };
 
+/* The chunks holding the data of an XTree are shared between the xt and
+   its snapshots, and a shared chunk is copied only when the xt modifies
+   one of its elements.  Taking a snapshot so only copies the chunk
+   pointers, and the data of the next snapshot only costs the chunks
+   modified in between, rather than the whole data of each snapshot. */
+#define XT_CHUNK_N 256
+
+typedef
+   struct _XT_chunk {
+      UWord nrRef; /* nr of XTrees referencing this chunk. */
+      /* Followed by XT_CHUNK_N elements of size dataSzB. */
+   }
+   XT_chunk;
+
+static XT_chunk* new_chunk (XTree* xt)
+{
+   XT_chunk* chunk = xt->alloc_fn(xt->cc, sizeof(XT_chunk)
+                                  + XT_CHUNK_N * xt->dataSzB);
+   chunk->nrRef = 1;
+   return chunk;
+}
+
+static UInt n_chunks (const XTree* xt)
+{
+   return (xt->n_data + XT_CHUNK_N - 1) / XT_CHUNK_N;
+}
+
+/* Returns the data of xecu, for reading only. */
+static void* xt_data (const XTree* xt, Xecu xecu)
+{
+   vg_assert(xecu < xt->n_data);
+   return (HChar*)(xt->chunks[xecu / XT_CHUNK_N] + 1)
+      + (xecu % XT_CHUNK_N) * xt->dataSzB;
+}
+
+/* Returns the data of xecu, for modification: its chunk is first copied
+   if it is shared with a snapshot. */
+static void* xt_data_w (XTree* xt, Xecu xecu)
+{
+   XT_chunk** chunk = &xt->chunks[xecu / XT_CHUNK_N];
+
+   if ((*chunk)->nrRef > 1) {
+      XT_chunk* copy = new_chunk(xt);
+      VG_(memcpy)(copy + 1, *chunk + 1, XT_CHUNK_N * xt->dataSzB);
+      (*chunk)->nrRef--;
+      *chunk = copy;
+   }
+   return xt_data(xt, xecu);
+}
+
+/* Appends value to the data of xt, and returns its xecu. */
+static Xecu xt_add_data (XTree* xt, const void* value)
+{
+   if (xt->n_data % XT_CHUNK_N == 0) {
+      const UInt chunk_nr = xt->n_data / XT_CHUNK_N;
+
+      if (chunk_nr >= xt->chunks_sz) {
+         xt->chunks_sz = xt->chunks_sz == 0 ? 16 : 2 * xt->chunks_sz;
+         xt->chunks = VG_(realloc)(xt->cc, xt->chunks,
+                                   xt->chunks_sz * sizeof(XT_chunk*));
+      }
+      xt->chunks[chunk_nr] = new_chunk(xt);
+   }
+   xt->n_data++;
+   VG_(memcpy)(xt_data_w(xt, xt->n_data - 1), value, xt->dataSzB);
+   return xt->n_data - 1;
+}
+
 
 XTree* VG_(XT_create) ( Alloc_Fn_t alloc_fn,
                         const HChar* cc,
@@ -256,7 +329,9 @@ XTree* VG_(XT_create) ( Alloc_Fn_t alloc_fn,
    xt->shared = new_XT_shared(alloc_fn, cc, free_fn);
    addRef_XT_shared(xt->shared);
    xt->tmp_data = alloc_fn(cc, xt->dataSzB);
-   xt->data =  VG_(newXA)(alloc_fn, cc, free_fn, dataSzB);
+   xt->n_data = 0;
+   xt->chunks_sz = 0;
+   xt->chunks = NULL;
 
    return xt;
 }
@@ -272,7 +347,16 @@ XTree* VG_(XT_snapshot)(XTree* xt)
    *nxt = *xt;
    addRef_XT_shared(nxt->shared);
    nxt->tmp_data = nxt->alloc_fn(nxt->cc, nxt->dataSzB);
-   nxt->data = VG_(cloneXA)(nxt->cc, xt->data);
+   nxt->chunks_sz = n_chunks(xt);
+   nxt->chunks = NULL;
+   if (nxt->chunks_sz > 0) {
+      nxt->chunks = nxt->alloc_fn(nxt->cc,
+                                  nxt->chunks_sz * sizeof(XT_chunk*));
+      for (UInt i = 0; i < nxt->chunks_sz; i++) {
+         nxt->chunks[i] = xt->chunks[i];
+         nxt->chunks[i]->nrRef++;
+      }
+   }
 
    return nxt;
 }
@@ -283,7 +367,13 @@ void VG_(XT_delete) ( XTree* xt )
 
    release_XT_shared(xt->shared);
    xt->free_fn(xt->tmp_data);
-   VG_(deleteXA)(xt->data);
+   for (UInt i = 0; i < n_chunks(xt); i++) {
+      vg_assert(xt->chunks[i]->nrRef > 0);
+      if (--xt->chunks[i]->nrRef == 0)
+         xt->free_fn(xt->chunks[i]);
+   }
+   if (xt->chunks != NULL)
+      xt->free_fn(xt->chunks);
    xt->free_fn(xt);
 }
 
@@ -324,7 +414,7 @@ static Xecu find_or_insert (XTree* xt, ExeContext* ec)
       }
       xt->init_data_fn(xt->tmp_data);
       VG_(addToXA)(shared->xec, &xe);
-      shared->d4ecu2xecu[d4ecu] = (UInt)VG_(addToXA)(xt->data, xt->tmp_data);
+      shared->d4ecu2xecu[d4ecu] = xt_add_data(xt, xt->tmp_data);
    } 
 
    return shared->d4ecu2xecu[d4ecu];
@@ -333,7 +423,7 @@ static Xecu find_or_insert (XTree* xt, ExeContext* ec)
 Xecu VG_(XT_add_to_ec) (XTree* xt, ExeContext* ec, const void* value)
 {
    Xecu xecu = find_or_insert(xt, ec);
-   void* data = VG_(indexXA)(xt->data, xecu);
+   void* data = xt_data_w(xt, xecu);
 
    xt->add_data_fn(data, value);
    return xecu;
@@ -342,7 +432,7 @@ Xecu VG_(XT_add_to_ec) (XTree* xt, ExeContext* ec, const void* value)
 Xecu VG_(XT_sub_from_ec) (XTree* xt, ExeContext* ec, const void* value)
 {
    Xecu xecu = find_or_insert(xt, ec);
-   void* data = VG_(indexXA)(xt->data, xecu);
+   void* data = xt_data_w(xt, xecu);
 
    xt->sub_data_fn(data, value);
    return xecu;
@@ -350,13 +440,13 @@ Xecu VG_(XT_sub_from_ec) (XTree* xt, ExeContext* ec, const void* value)
 
 void VG_(XT_add_to_xecu) (XTree* xt, Xecu xecu, const void* value)
 {
-   void* data = VG_(indexXA)(xt->data, xecu);
+   void* data = xt_data_w(xt, xecu);
    xt->add_data_fn(data, value);
 }
 
 void VG_(XT_sub_from_xecu) (XTree* xt, Xecu xecu, const void* value)
 {
-   void* data = VG_(indexXA)(xt->data, xecu);
+   void* data = xt_data_w(xt, xecu);
    xt->sub_data_fn(data, value);
 }
 
@@ -422,6 +512,114 @@ static void FP_pos_str(VgFile* fp, const HChar* name, UInt pos,
       FP("%s=(%u)\n", name, pos);
 }
 
+/* Dir+Filename/Line number/Function name of an IP, as printed in
+   callgrind format.  The nr are numbers identifying the strings in the
+   filename and fnname dedup pools.  Each IP of the tree is symbolised
+   once per print, as the callers near the bottom of the stacks are
+   shared by most of them. */
+typedef
+   struct _IP_FLF {
+      struct _IP_FLF* next;
+      Addr         ip;         // key
+      DiEpoch      ep;
+      UInt         linenum;
+      UInt         filename_nr;
+      UInt         fnname_nr;
+      const HChar* filename;
+      const HChar* fnname;
+   }
+   IP_FLF;
+
+/* State of one XT_callgrind_print. */
+typedef
+   struct {
+      XTree*          xt;
+      VgHashTable*    ip_flf;        // of IP_FLF
+      DedupPoolAlloc* fnname_ddpa;   // string numbers of fn names
+      DedupPoolAlloc* filename_ddpa; // string numbers of file names
+      DedupPoolAlloc* names_ddpa;    // storage of the above strings
+      HChar*          filename_buf;
+      UInt            filename_buf_size;
+   }
+   CgPrint;
+
+static Word cmp_IP_FLF ( const void* node1, const void* node2 )
+{
+   const IP_FLF* flf1 = node1;
+   const IP_FLF* flf2 = node2;
+   return flf1->ep.n == flf2->ep.n ? 0 : 1;
+}
+
+static const HChar* cg_name (CgPrint* cgp, const HChar* name)
+{
+   return VG_(allocEltDedupPA)(cgp->names_ddpa, VG_(strlen)(name) + 1, name);
+}
+
+/* Returns the Dir+Filename/Line number/Function name for ip.
+   *filename_new and *fnname_new are set to True the first time the
+   filename/fnname are encountered. */
+static const IP_FLF* cg_ip_flf (CgPrint* cgp, DiEpoch ep, Addr ip,
+                                Bool* filename_new, Bool* fnname_new)
+{
+   IP_FLF  key;
+   IP_FLF* flf;
+   const HChar* filename_dir;
+   const HChar* filename_name;
+   const HChar* fnname;
+   UInt    needed_size;
+
+   key.ip = ip;
+   key.ep = ep;
+   flf = VG_(HT_gen_lookup)(cgp->ip_flf, &key, cmp_IP_FLF);
+   if (flf != NULL) {
+      *filename_new = False;
+      *fnname_new = False;
+      return flf;
+   }
+
+   flf = cgp->xt->alloc_fn(cgp->xt->cc, sizeof(IP_FLF));
+   flf->ip = ip;
+   flf->ep = ep;
+   if (!VG_(get_filename_linenum)(ep, ip,
+                                  &filename_name,
+                                  &filename_dir,
+                                  &flf->linenum)) {
+      filename_name = "UnknownFile???";
+      filename_dir = "";
+      flf->linenum = 0;
+   }
+   needed_size = VG_(strlen)(filename_dir) + 1
+      + VG_(strlen)(filename_name) + 1;
+   if (cgp->filename_buf_size < needed_size) {
+      cgp->filename_buf_size = needed_size;
+      cgp->filename_buf = VG_(realloc)(cgp->xt->cc, cgp->filename_buf,
+                                       cgp->filename_buf_size);
+   }
+   VG_(strcpy)(cgp->filename_buf, filename_dir);
+   if (cgp->filename_buf[0] != '\0') {
+      VG_(strcat)(cgp->filename_buf, "/");
+   }
+   VG_(strcat)(cgp->filename_buf, filename_name);
+   flf->filename_nr = VG_(allocStrDedupPA)(cgp->filename_ddpa,
+                                           cgp->filename_buf,
+                                           filename_new);
+   flf->filename = cg_name(cgp, cgp->filename_buf);
+
+   /* Instead of unknown fnname ???, this could use instead:
+      VG_(sprintf)(unknown_fn, "%p", (void*)ip);
+      but that creates a lot of (useless) nodes at least for
+      valgrind self-hosting. */
+   if (!VG_(get_fnname)(ep, ip, &fnname))
+      fnname = "UnknownFn???";
+   flf->fnname_nr = VG_(allocStrDedupPA)(cgp->fnname_ddpa,
+                                         fnname,
+                                         fnname_new);
+   flf->fnname = cg_name(cgp, fnname);
+
+   VG_(HT_add_node)(cgp->ip_flf, flf);
+   return flf;
+}
+
 void VG_(XT_callgrind_print)
      (XTree* xt,
       const HChar* outfilename,
@@ -431,20 +629,24 @@ void VG_(XT_callgrind_print)
    UInt n_xecu;
    XT_shared* shared = xt->shared;
    VgFile* fp = xt_open(outfilename);
-   DedupPoolAlloc* fnname_ddpa;
-   DedupPoolAlloc* filename_ddpa;
-   HChar* filename_buf = NULL;
-   UInt filename_buf_size = 0;
-   const HChar* filename_dir;
-   const HChar* filename_name;
+   CgPrint cgp;
+   // The "fl=" file, given by the last fl= line.  cfi= and fl= lines are
+   // only needed when the file changes.
+   UInt cur_filename_nr = (UInt)-1;
 
    if (fp == NULL)
       return;
 
-   fnname_ddpa = VG_(newDedupPA)(16000, 1, xt->alloc_fn,
-                                 "XT_callgrind_print.fn", xt->free_fn);
-   filename_ddpa = VG_(newDedupPA)(16000, 1, xt->alloc_fn,
-                                   "XT_callgrind_print.fl", xt->free_fn);
+   cgp.xt = xt;
+   cgp.ip_flf = VG_(HT_construct)("XT_callgrind_print.ip");
+   cgp.fnname_ddpa = VG_(newDedupPA)(16000, 1, xt->alloc_fn,
+                                     "XT_callgrind_print.fn", xt->free_fn);
+   cgp.filename_ddpa = VG_(newDedupPA)(16000, 1, xt->alloc_fn,
+                                       "XT_callgrind_print.fl", xt->free_fn);
+   cgp.names_ddpa = VG_(newDedupPA)(16000, 1, xt->alloc_fn,
+                                    "XT_callgrind_print.nm", xt->free_fn);
+   cgp.filename_buf = NULL;
+   cgp.filename_buf_size = 0;
 
    FP("# callgrind format\n");
    FP("version: 1\n");
@@ -484,69 +686,19 @@ void VG_(XT_callgrind_print)
    }
    xt->init_data_fn(xt->tmp_data); // to compute totals
 
-   n_xecu = VG_(sizeXA)(xt->data);
+   n_xecu = xt->n_data;
    vg_assert (n_xecu <= VG_(sizeXA)(shared->xec));
    for (Xecu xecu = 0; xecu < n_xecu; xecu++) {
       xec* xe = (xec*)VG_(indexXA)(shared->xec, xecu);
       if (xe->n_ips_sel == 0)
          continue;
 
-      const HChar* img = img_value(VG_(indexXA)(xt->data, xecu));
-     
-      // CALLED_FLF gets the Dir+Filename/Line number/Function name for ips[n]
-      // in the variables called_filename/called_linenum/called_fnname.
-      // The booleans called_filename_new/called_fnname_new are set to True
-      // the first time the called_filename/called_fnname are encountered.
-      // The called_filename_nr/called_fnname_nr are numbers identifying
-      // the strings  called_filename/called_fnname.
-#define CALLED_FLF(n)                                                   \
-      if ((n) < 0                                                       \
-          || !VG_(get_filename_linenum)(ep, ips[(n)],                   \
-                                        &filename_name,                 \
-                                        &filename_dir,                  \
-                                        &called_linenum)) {             \
-         filename_name = "UnknownFile???";                              \
-         called_linenum = 0;                                            \
-      }                                                                 \
-      if ((n) < 0                                                       \
-          || !VG_(get_fnname)(ep, ips[(n)], &called_fnname)) {          \
-         called_fnname = "UnknownFn???";                                \
-      }                                                                 \
-      {                                                                 \
-         UInt needed_size = VG_(strlen)(filename_dir) + 1               \
-            + VG_(strlen)(filename_name) + 1;                           \
-         if (filename_buf_size < needed_size) {                         \
-            filename_buf_size = needed_size;                            \
-            filename_buf = VG_(realloc)(xt->cc, filename_buf,           \
-                                        filename_buf_size);             \
-         }                                                              \
-      }                                                                 \
-      VG_(strcpy)(filename_buf, filename_dir);                          \
-      if (filename_buf[0] != '\0') {                                    \
-         VG_(strcat)(filename_buf, "/");                                \
-      }                                                                 \
-      VG_(strcat)(filename_buf, filename_name);                         \
-      called_filename_nr = VG_(allocStrDedupPA)(filename_ddpa,          \
-                                                filename_buf,           \
-                                                &called_filename_new);  \
-      called_filename = filename_buf;                                   \
-      called_fnname_nr = VG_(allocStrDedupPA)(fnname_ddpa,              \
-                                              called_fnname,            \
-                                              &called_fnname_new);
-
-      /* Instead of unknown fnname ???, CALLED_FLF could use instead:
-         VG_(sprintf)(unknown_fn, "%p", (void*)ips[(n)]);
-         but that creates a lot of (useless) nodes at least for
-         valgrind self-hosting. */
-      
+      const HChar* img = img_value(xt_data(xt, xecu));
+
       if (img) {
-         const HChar* called_filename;
-         UInt called_filename_nr;
+         const IP_FLF* called;
          Bool called_filename_new; // True the first time we see this filename.
-         const HChar* called_fnname;
-         UInt called_fnname_nr;
          Bool called_fnname_new; // True the first time we see this fnname.
-         UInt called_linenum;
          UInt prev_linenum;
 
          const Addr* ips = VG_(get_ExeContext_StackTrace)(xe->ec) + xe->top;
@@ -559,26 +711,34 @@ void VG_(XT_callgrind_print)
             VG_(pp_ExeContext)(xe->ec);
             VG_(printf)("\n");
          }
-         xt->add_data_fn(xt->tmp_data, VG_(indexXA)(xt->data, xecu));
-         CALLED_FLF(ips_idx);
+         xt->add_data_fn(xt->tmp_data, xt_data(xt, xecu));
+         called = cg_ip_flf(&cgp, ep, ips[ips_idx],
+                            &called_filename_new, &called_fnname_new);
          for (;
               ips_idx >= 0;
               ips_idx--) {
-            FP_pos_str(fp, "fl", called_filename_nr,
-                       called_filename, called_filename_new);
-            FP_pos_str(fp, "fn", called_fnname_nr,
-                       called_fnname, called_fnname_new);
+            if (called->filename_nr != cur_filename_nr) {
+               FP_pos_str(fp, "fl", called->filename_nr,
+                          called->filename, called_filename_new);
+               cur_filename_nr = called->filename_nr;
+            }
+            FP_pos_str(fp, "fn", called->fnname_nr,
+                       called->fnname, called_fnname_new);
             if (ips_idx == 0)
-               FP("%u %s\n", called_linenum, img);
+               FP("%u %s\n", called->linenum, img);
             else
-               FP("%u\n", called_linenum); //no self cost.
-            prev_linenum = called_linenum;
+               FP("%u\n", called->linenum); //no self cost.
+            prev_linenum = called->linenum;
             if (ips_idx >= 1) {
-               CALLED_FLF(ips_idx-1);
-               FP_pos_str(fp, "cfi", called_filename_nr,
-                          called_filename, called_filename_new);
-               FP_pos_str(fp, "cfn", called_fnname_nr,
-                          called_fnname, called_fnname_new);
+               called = cg_ip_flf(&cgp, ep, ips[ips_idx-1],
+                                  &called_filename_new, &called_fnname_new);
+               if (called->filename_nr != cur_filename_nr)
+                  FP_pos_str(fp, "cfi", called->filename_nr,
+                             called->filename, called_filename_new);
+               else
+                  vg_assert(!called_filename_new);
+               FP_pos_str(fp, "cfn", called->fnname_nr,
+                          called->fnname, called_fnname_new);
                called_filename_new = False;
                called_fnname_new = False;
                /* Giving a call count of 0 allows kcachegrind to hide the calls
@@ -586,7 +746,7 @@ void VG_(XT_callgrind_print)
                   calls column the nr of stacktrace containing this arc, which
                   is very confusing. So, the less bad is to give a 0 call
                   count. */
-               FP("calls=0 %u\n", called_linenum);
+               FP("calls=0 %u\n", called->linenum);
                FP("%u %s\n", prev_linenum, img);
             }
          }
@@ -603,9 +763,11 @@ void VG_(XT_callgrind_print)
       in the output file. */
    FP("totals: %s\n", img_value(xt->tmp_data));
    VG_(fclose)(fp);
-   VG_(deleteDedupPA)(fnname_ddpa);
-   VG_(deleteDedupPA)(filename_ddpa);
-   VG_(free)(filename_buf);
+   VG_(HT_destruct)(cgp.ip_flf, xt->free_fn);
+   VG_(deleteDedupPA)(cgp.fnname_ddpa);
+   VG_(deleteDedupPA)(cgp.filename_ddpa);
+   VG_(deleteDedupPA)(cgp.names_ddpa);
+   VG_(free)(cgp.filename_buf);
 }
 
 
@@ -744,15 +906,90 @@ static void ms_make_groups (UInt depth, Ms_Ec* ms_ec, UInt n_ec, SizeT sig_sz,
    VG_(ssort)(*groups, *n_groups, sizeof(Ms_Group), ms_group_revcmp_total);
 }
 
+/* A massif output file.  The descriptions of the IPs are kept from one
+   snapshot to the next, as most of the tree is the same in all of them.
+   They are dropped when the debug info changes, i.e. the epoch. */
+typedef
+   struct {
+      VgFile*         fp;
+      VgHashTable*    ip_desc;    // of IP_Desc
+      DiEpoch         ep;         // the epoch of ip_desc
+      DedupPoolAlloc* desc_ddpa;  // storage of the descriptions
+   }
+   Ms_File;
+
+/* Descriptions of an IP: one per inlined call, the last one being
+   that of the function containing the IP. */
+typedef
+   struct _IP_Desc {
+      struct _IP_Desc* next;
+      Addr          ip;   // key
+      UInt          n_desc;
+      const HChar** desc;
+   }
+   IP_Desc;
+
+static void free_IP_Desc (void* v)
+{
+   IP_Desc* ipd = v;
+   VG_(free)(ipd->desc);
+   VG_(free)(ipd);
+}
+
+static void ms_file_new_epoch (Ms_File* msf)
+{
+   if (msf->ip_desc != NULL) {
+      VG_(HT_destruct)(msf->ip_desc, free_IP_Desc);
+      VG_(deleteDedupPA)(msf->desc_ddpa);
+   }
+   msf->ip_desc = VG_(HT_construct)("XT_massif.ip_desc");
+   msf->desc_ddpa = VG_(newDedupPA)(16000, 1, VG_(malloc),
+                                    "XT_massif.desc", VG_(free));
+   msf->ep = VG_(current_DiEpoch)();
+}
+
+static const IP_Desc* ms_ip_desc (Ms_File* msf, DiEpoch ep, Addr ip)
+{
+   IP_Desc* ipd = VG_(HT_lookup)(msf->ip_desc, ip);
+   InlIPCursor *iipc;
+   UInt sz_desc = 1;
+
+   if (ipd != NULL)
+      return ipd;
+
+   ipd = VG_(malloc)("XT_massif.ipd", sizeof(IP_Desc));
+   ipd->ip = ip;
+   ipd->n_desc = 0;
+   ipd->desc = VG_(malloc)("XT_massif.ipd", sz_desc * sizeof(HChar*));
+   iipc = VG_(new_IIPC)(ep, ip);
+   while (True) {
+      const HChar* buf = VG_(describe_IP)(ep, ip, iipc);
+
+      if (ipd->n_desc == sz_desc) {
+         sz_desc *= 2;
+         ipd->desc = VG_(realloc)("XT_massif.ipd", ipd->desc,
+                                  sz_desc * sizeof(HChar*));
+      }
+      ipd->desc[ipd->n_desc++]
+         = VG_(allocEltDedupPA)(msf->desc_ddpa, VG_(strlen)(buf) + 1, buf);
+      if (!VG_(next_IIPC)(iipc))
+         break;
+   }
+   VG_(delete_IIPC)(iipc);
+   VG_(HT_add_node)(msf->ip_desc, ipd);
+   return ipd;
+}
+
 /* Output the given group (located in an xtree at the given depth).
    indent tells by how much to indent the information output for the group.
    indent can be bigger than depth when outputting a group that is made
    of one or more inlined calls: all inlined calls are output with the
    same depth but with one more indent for each inlined call.  */
-static void ms_output_group (VgFile* fp, UInt depth, UInt indent,
+static void ms_output_group (Ms_File* msf, UInt depth, UInt indent,
                              Ms_Group* group, SizeT sig_sz,
                              double sig_pct_threshold)
 {
+   VgFile* fp = msf->fp;
    UInt i;
    Ms_Group* groups;
    UInt n_groups;
@@ -785,30 +1022,24 @@ static void ms_output_group (VgFile* fp, UInt depth, UInt indent,
 
    Addr cur_ip = group->ms_ec->ips[depth];
 
-   InlIPCursor *iipc = VG_(new_IIPC)(cur_ep, cur_ip);
+   const IP_Desc* ipd = ms_ip_desc(msf, cur_ep, cur_ip);
 
-   while (True) {
-      const HChar* buf = VG_(describe_IP)(cur_ep, cur_ip, iipc);
-      Bool is_inlined = VG_(next_IIPC)(iipc);
+   for (i = 0; i < ipd->n_desc; i++) {
+      Bool is_inlined = i + 1 < ipd->n_desc;
 
       FP("%*s" "n%u: %lu %s\n",
          (Int)(indent + 1), "",
          is_inlined ? 1 : n_groups, // Inlined frames always have one child.
          group->total,
-         buf);
+         ipd->desc[i]);
 
-      if (!is_inlined) {
-         break;
-      }
-
-      indent++;
+      if (is_inlined)
+         indent++;
    }
 
-   VG_(delete_IIPC)(iipc);
-
    /* Output sub groups of this group. */
    for (i = 0; i < n_groups; i++)
-      ms_output_group(fp, depth+1, indent+1, &groups[i], sig_sz,
+      ms_output_group(msf, depth+1, indent+1, &groups[i], sig_sz,
                       sig_pct_threshold);
 
    VG_(free)(groups);
@@ -822,7 +1053,7 @@ static void prepare_ms_ec (XTree* xt,
 {
    XT_shared* shared = xt->shared;
    const UInt n_xecu = VG_(sizeXA)(shared->xec);
-   const UInt n_data_xecu = VG_(sizeXA)(xt->data);
+   const UInt n_data_xecu = xt->n_data;
    Ms_Ec* ms_ec = VG_(malloc)("XT_massif_print.ms_ec", n_xecu * sizeof(Ms_Ec));
    UInt n_xecu_sel = 0; // Nr of xecu that are selected for output.
 
@@ -838,14 +1069,14 @@ static void prepare_ms_ec (XTree* xt,
       xec* xe = (xec*)VG_(indexXA)(shared->xec, xecu);
 
       if (xecu >= n_data_xecu)
-         continue; // No data for this xecu in xt->data.
+         continue; // No data for this xecu in xt.
       ms_ec[n_xecu_sel].n_ips = xe->n_ips_sel;
       if (ms_ec[n_xecu_sel].n_ips == 0)
          continue;
             
       ms_ec[n_xecu_sel].ips = VG_(get_ExeContext_StackTrace)(xe->ec) + xe->top;
       ms_ec[n_xecu_sel].report_value
-         = (*report_value)(VG_(indexXA)(xt->data, xecu));
+         = (*report_value)(xt_data(xt, xecu));
       *top_total += ms_ec[n_xecu_sel].report_value;
 
       n_xecu_sel++;
@@ -864,6 +1095,7 @@ MsFile* VG_(XT_massif_open)
 {
    UInt i;
    VgFile* fp = xt_open(outfilename);
+   Ms_File* msf;
    
    if (fp == NULL)
       return NULL; // xt_open reported the error.
@@ -886,27 +1118,41 @@ MsFile* VG_(XT_massif_open)
 
    FP("time_unit: %s\n", time_unit);
 
-   return fp;
+   msf = VG_(malloc)("XT_massif_open", sizeof(Ms_File));
+   msf->fp = fp;
+   msf->ip_desc = NULL;
+   ms_file_new_epoch(msf);
+   return msf;
 }
 
 void VG_(XT_massif_close)(MsFile* fp)
 {
-   if (fp == NULL)
+   Ms_File* msf = fp;
+
+   if (msf == NULL)
       return; // Error should have been reported by  VG_(XT_massif_open)
 
-   VG_(fclose)(fp);
+   VG_(fclose)(msf->fp);
+   VG_(HT_destruct)(msf->ip_desc, free_IP_Desc);
+   VG_(deleteDedupPA)(msf->desc_ddpa);
+   VG_(free)(msf);
 }
 
 void VG_(XT_massif_print) 
-     (MsFile* fp,
+     (MsFile* mf,
       XTree* xt,
       const Massif_Header* header,
       ULong (*report_value)(const void* value))
 {
+   Ms_File* msf = mf;
+   VgFile* fp;
    UInt i;
 
-   if (fp == NULL)
+   if (msf == NULL)
       return; // Normally  VG_(XT_massif_open) already reported an error.
+   fp = msf->fp;
+   if (msf->ep.n != VG_(current_DiEpoch)().n)
+      ms_file_new_epoch(msf);
 
    /* Compute/prepare Snapshot totals/data/... */
    ULong top_total;
@@ -929,14 +1175,14 @@ void VG_(XT_massif_print)
    } else {
       /* For non detailed snapshot, compute total directly from the xec. */
       const XT_shared* shared = xt->shared;
-      const UInt n_xecu = VG_(sizeXA)(xt->data);
+      const UInt n_xecu = xt->n_data;
       top_total = 0;
       
       for (UInt xecu = 0; xecu < n_xecu; xecu++) {
          xec* xe = (xec*)VG_(indexXA)(shared->xec, xecu);
          if (xe->n_ips_sel == 0)
             continue;
-         top_total += (*report_value)(VG_(indexXA)(xt->data, xecu));
+         top_total += (*report_value)(xt_data(xt, xecu));
       }
    }
 
@@ -981,7 +1227,7 @@ void VG_(XT_massif_print)
       /* Output depth 0 groups. */
       DMSG(1, "XT_massif_print outputing %u depth 0 groups\n", n_groups);
       for (i = 0; i < n_groups; i++)
-         ms_output_group(fp, 0, 0, &groups[i], sig_sz, header->sig_threshold);
+         ms_output_group(msf, 0, 0, &groups[i], sig_sz, header->sig_threshold);
 
       VG_(free)(groups);
       VG_(free)(ms_ec);
@@ -80,6 +80,11 @@ extern void VG_(di_notify_vm_protect)( Addr a, SizeT len, UInt prot );
 
 extern void VG_(di_discard_ALL_debuginfo)( void );
 
+/* When the tool has asked for VG_(needs_lazy_debuginfo), objects are
+   not read when mapped, but when first queried.  This reads all those
+   still waiting, for when their symbols are needed regardless. */
+extern void VG_(di_load_deferred_DebugInfos)( void );
+
 /* Like VG_(get_fnname), but it does not do C++ demangling nor Z-demangling
  * nor below-main renaming.
  * It should not be used for any names that will be shown to users.
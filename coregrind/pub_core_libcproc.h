@@ -78,6 +78,11 @@ extern void    VG_(env_remove_valgrind_env_stuff) ( HChar** env,
                                                     void (*free_fn) (void *) );
 extern HChar **VG_(env_clone)    ( HChar **env_clone );
 
+// Monotonic wallclock time in nanoseconds, from an arbitrary origin.
+// Finer-grained than VG_(read_millisecond_timer), for timing short
+// stretches of Valgrind's own work.
+extern ULong VG_(read_nanosecond_timer) ( void );
+
 // misc
 extern Int  VG_(getgroups)( Int size, UInt* list );
 extern Int  VG_(ptrace)( Int request, Int pid, void *addr, void *data );
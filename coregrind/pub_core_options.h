@@ -178,6 +178,13 @@ extern UChar VG_(clo_profyle_flags);
    this-many back edges (event checks).  default: zero (== show
    profiling results only at the end of the run. */
 extern ULong VG_(clo_profyle_interval);
+/* DEBUG: if doing SB profiling, also write the end-of-run profile to
+   this file in a machine-readable form.  Implies SB profiling.
+   default: NULL (== don't) */
+extern const HChar* VG_(clo_profyle_sbs_out);
+/* Load a profile previously written by --profile-sbs-out=, for tools
+   to query with VG_(get_SB_profile_count).  default: NULL */
+extern const HChar* VG_(clo_profyle_sbs_in);
 
 /* DEBUG: if tracing codegen, be quiet until after this bb */
 extern Int   VG_(clo_trace_notbelow);
@@ -332,6 +339,10 @@ extern UInt VG_(clo_num_transtab_sectors);
    provided default. */
 extern UInt VG_(clo_avg_transtab_entry_size);
 
+/* Percentage of a recycled sector that may be used to keep its hot
+   translations.  0 means to discard them all. */
+extern UInt VG_(clo_transtab_keep_hot);
+
 /* Only client requested fixed mapping can be done below 
    VG_(clo_aspacem_minAddr). */
 extern Addr VG_(clo_aspacem_minAddr);
@@ -352,8 +363,10 @@ typedef
       Vg_SmcStack, // generate s-c-t's for code found in stacks
                    // (this is the default)
       Vg_SmcAll,   // make all translations self-checking.
-      Vg_SmcAllNonFile // make all translations derived from
+      Vg_SmcAllNonFile, // make all translations derived from
                    // non-file-backed memory self checking
+      Vg_SmcProtect // as Vg_SmcAllNonFile, but write-protect the
+                   // pages instead of checking, where possible
    } 
    VgSmc;
 
@@ -408,6 +421,12 @@ extern UInt VG_(clo_unw_stack_scan_thresh);
    low by default.  Default: 5 */
 extern UInt VG_(clo_unw_stack_scan_frames);
 
+/* On amd64, unwind a frame by following the frame pointer chain when,
+   the first time its IP was unwound, CFI gave the same result.  This
+   is much cheaper for code built with -fno-omit-frame-pointer.
+   Default: False */
+extern Bool VG_(clo_unw_fp);
+
 /* Controls the resync-filter on MacOS.  Has no effect on Linux.
    0=disabled [default on Linux]   "no"
    1=enabled  [default on MacOS]   "yes"
@@ -65,6 +65,11 @@
 /* Notify the module of a new DebugInfo (called from m_debuginfo). */
 extern void VG_(redir_notify_new_DebugInfo)( const DebugInfo* );
 
+/* Can m_debuginfo put off reading the object in the given file until it
+   is queried?  False if the object's symbols are needed here as soon as
+   it is mapped. */
+extern Bool VG_(redir_can_defer_DebugInfo)( const HChar* filename );
+
 /* Notify the module of the disappearance of a DebugInfo (also called
    from m_debuginfo). */
 extern void VG_(redir_notify_delete_DebugInfo)( const DebugInfo* );
@@ -1,6 +1,7 @@
 
 /*--------------------------------------------------------------------*/
-/*--- For printing superblock profiles        pub_core_sbprofile.h ---*/
+/*--- For printing and loading superblock profiles.                ---*/
+/*---                                         pub_core_sbprofile.h ---*/
 /*--------------------------------------------------------------------*/
 
 /*
@@ -33,6 +34,7 @@
 #define __PUB_CORE_SBPROFILE_H
 
 #include "pub_core_basics.h"   // VG_ macro
+#include "pub_tool_sbprofile.h"
 
 /* Get and print a profile.  Also, zero out the counters so that if we
    call it again later, the second call will only show new work done
@@ -40,6 +42,11 @@
    run-end profile. */
 void VG_(get_and_show_SB_profile) ( ULong ecs_done );
 
+/* Read the profile named by --profile-sbs-in=, for use by
+   VG_(get_SB_profile_count).  Exits on a missing or malformed
+   file. */
+void VG_(load_SB_profile) ( void );
+
 #endif   // __PUB_CORE_SBPROFILE_H
 
 /*--------------------------------------------------------------------*/
@@ -405,6 +405,13 @@ typedef struct {
    Bool               sched_jmpbuf_valid;
    VG_MINIMAL_JMP_BUF(sched_jmpbuf);
 
+   /* Length in bbs of this thread's next timeslice, adapted by the
+      scheduler, plus the number of timeslices it has used up and the
+      number of times it took the_BigLock over from another thread. */
+   Int   sched_quantum;
+   ULong sched_slices;
+   ULong sched_handoffs;
+
    /* This thread's name. NULL, if no name. */
    HChar *thread_name;
    UInt ptrace;
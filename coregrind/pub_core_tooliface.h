@@ -92,6 +92,7 @@ typedef
       Bool print_stats;
       Bool info_location;
       Bool var_info;
+      Bool lazy_debuginfo;
       Bool malloc_replacement;
       Bool xml_output;
       Bool final_IR_tidy_pass;
@@ -48,6 +48,23 @@ Bool VG_(translate) ( ThreadId tid,
 
 extern void VG_(print_translation_stats) ( void );
 
+// --smc-check=protect support.  Called for a SIGSEGV writing to 'a':
+// if that is a page we write-protected, makes it writable again,
+// discards its translations and returns True, and the write can be
+// restarted.
+extern Bool VG_(smc_handle_write_fault) ( ThreadId tid, Addr a );
+// Unprotects the range before the kernel writes to it on behalf of a
+// syscall of tid, which would otherwise fail with EFAULT, and keeps it
+// unprotected until VG_(smc_post_syscall)(tid).
+extern void VG_(smc_pre_syscall_write) ( ThreadId tid, Addr a, SizeT len );
+// The syscall of tid is over: its buffers may be protected again.
+extern void VG_(smc_post_syscall) ( ThreadId tid );
+// The guest changed the permissions of the range: protect again those
+// tracked pages that it turned writable.
+extern void VG_(smc_notify_mprotect) ( Addr a, SizeT len );
+// The range was unmapped or mapped afresh.
+extern void VG_(smc_forget_range) ( Addr a, SizeT len );
+
 #endif   // __PUB_CORE_TRANSLATE_H
 
 /*--------------------------------------------------------------------*/
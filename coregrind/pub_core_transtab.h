@@ -205,6 +205,11 @@ extern void VG_(print_tt_tc_stats) ( void );
 extern UInt VG_(get_bbs_translated) ( void );
 extern UInt VG_(get_bbs_discarded_or_dumped) ( void );
 
+// Number of times a sector has been recycled.  Recycling moves or
+// overwrites host code, so a host code address, such as a place to
+// chain, obtained before it must not be used after it.
+extern ULong VG_(get_sectors_recycled) ( void );
+
 /* Add to / search the auxiliary, small, unredirected translation
    table. */
 
@@ -222,6 +227,9 @@ Bool VG_(search_unredir_transtab) ( /*OUT*/Addr*  result,
 typedef struct _SBProfEntry {
    Addr   addr;
    ULong  score;
+   ULong  count;      // number of times the block was entered
+   UInt   guest_szB;  // guest code covered by the translation
+   UInt   host_szB;   // size of the (instrumented) host code
 } SBProfEntry;
 
 extern ULong VG_(get_SB_profile) ( SBProfEntry tops[], UInt n_tops );
@@ -74,9 +74,23 @@
    (address ^ (address >>u VG_TT_FAST_BITS))[VG_TT_FAST_BITS-1+1 : 0+1]'.
 
    On s390x the rightmost bit of an instruction address is zero, so the arm32
-   scheme is used. */
-
-#define VG_TT_FAST_BITS 13
+   scheme is used.
+
+   The number of sets is fixed when Valgrind is built, since the dispatchers
+   use VG_TT_FAST_BITS and VG_TT_FAST_MASK as immediates.  Programs whose hot
+   code overflows the default cache -- visible as a high miss count in the
+   "indir transfers" line of --stats=yes -- can be served by a build with,
+   for example, CPPFLAGS=-DVG_TT_FAST_BITS=15.  Each set takes 64 bytes on
+   64-bit hosts, so that is 2MB rather than the default 512KB.  The ppc and
+   arm64 dispatchers encode VG_TT_FAST_MASK in a 16-bit immediate, which
+   limits VG_TT_FAST_BITS to 16. */
+
+#ifndef VG_TT_FAST_BITS
+# define VG_TT_FAST_BITS 13
+#endif
+#if VG_TT_FAST_BITS < 8 || VG_TT_FAST_BITS > 16
+# error "VG_TT_FAST_BITS must be in the range 8 .. 16"
+#endif
 #define VG_TT_FAST_SETS (1 << VG_TT_FAST_BITS)
 #define VG_TT_FAST_MASK ((VG_TT_FAST_SETS) - 1)
 
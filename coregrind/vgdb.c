@@ -134,6 +134,24 @@ char *vgdb_prefix_default(void)
    return prefix;
 }
 
+/* Pipe used to wake up the invoke_gdbserver_in_valgrind thread as soon
+   as there is new data for valgrind, rather than letting it find out at
+   its next periodic check.  Both ends are non blocking: if the pipe is
+   full, a wake up is already pending. */
+static int invoker_wakeup[2] = {-1, -1};
+
+static
+void wake_up_invoker(void)
+{
+   char c = 0;
+   ssize_t nrw;
+
+   if (invoker_wakeup[1] != -1) {
+      nrw = write(invoker_wakeup[1], &c, 1);
+      (void) nrw;
+   }
+}
+
 /* add nrw to the written_by_vgdb field of shared32 or shared64 */
 static
 void add_written(int nrw)
@@ -144,6 +162,7 @@ void add_written(int nrw)
       shared64->written_by_vgdb += nrw;
    else
       assert(0);
+   wake_up_invoker();
 }
 
 static int shared_mem_fd = -1;
@@ -199,115 +218,166 @@ void map_vgdbshared(char* shared_mem)
 
 }
 
+/* Waits till wake_up_invoker is called or ms milliseconds have
+   elapsed. */
+static
+void wait_invoker_wakeup(int ms)
+{
+   struct pollfd pollfd;
+   char buf[64];
+
+   pollfd.fd = invoker_wakeup[0];
+   pollfd.events = POLLIN;
+   pollfd.revents = 0;
+   if (poll(&pollfd, 1, ms) > 0)
+      while (read(invoker_wakeup[0], buf, sizeof(buf)) > 0)
+         ;
+}
+
+/* Returns the nr of ms from now till t, 0 if t is in the past. */
+static
+int ms_till(const struct timeval *now, const struct timeval *t)
+{
+   long long us;
+
+   us = (t->tv_sec - now->tv_sec) * 1000000LL + (t->tv_usec - now->tv_usec);
+   if (us <= 0)
+      return 0;
+   return (int) ((us + 999) / 1000);
+}
+
 /* This function loops till shutting_down becomes true.  In this loop,
    it verifies if valgrind process is reading the characters written
-   by vgdb.  The verification is done every max_invoke_ms ms.  If
-   valgrind is not reading characters, it will use invoker_invoke_gdbserver
-   to ensure that the gdbserver code is called soon by valgrind. */
+   by vgdb.  If valgrind has not read any of the characters pending for
+   it during max_invoke_ms ms, it will use invoker_invoke_gdbserver
+   to ensure that the gdbserver code is called soon by valgrind.
+   The thread is woken up each time vgdb writes data for valgrind, so
+   the max_invoke_ms delay is counted from the write (or from the last
+   progress of valgrind), not from the next periodical check. */
 static int max_invoke_ms = 100;
 #define NEVER 99999999
 static int cmd_time_out = NEVER;
 static
 void *invoke_gdbserver_in_valgrind(void *v_pid)
 {
-   struct timeval cmd_max_end_time;
+   struct timeval cmd_max_end_time = { 0, 0 };
    Bool cmd_started = False;
+   struct timeval pending_since;
    struct timeval invoke_time;
+   struct timeval now;
 
    int pid = *(int *)v_pid;
-   int written_by_vgdb_before_sleep;
-   int seen_by_valgrind_before_sleep;
+   int written_by_vgdb;
+   int seen_by_valgrind;
+   int last_written = VS_written_by_vgdb;
+   int last_seen = VS_seen_by_valgrind;
 
    int invoked_written = -1;
-   unsigned int usecs;
+   int wait_ms;
 
    pthread_cleanup_push(invoker_cleanup_restore_and_detach, v_pid);
 
+   gettimeofday(&pending_since, NULL);
    while (!shutting_down) {
-      written_by_vgdb_before_sleep = VS_written_by_vgdb;
-      seen_by_valgrind_before_sleep = VS_seen_by_valgrind;
+      written_by_vgdb = VS_written_by_vgdb;
+      seen_by_valgrind = VS_seen_by_valgrind;
+      gettimeofday(&now, NULL);
       DEBUG(3,
-            "written_by_vgdb_before_sleep %d "
-            "seen_by_valgrind_before_sleep %d\n",
-            written_by_vgdb_before_sleep,
-            seen_by_valgrind_before_sleep);
-      if (cmd_time_out != NEVER
-          && !cmd_started
-          && written_by_vgdb_before_sleep > seen_by_valgrind_before_sleep) {
-         /* A command was started. Record the time at which it was started. */
-         DEBUG(1, "IO for command started\n");
-         gettimeofday(&cmd_max_end_time, NULL);
-         cmd_max_end_time.tv_sec += cmd_time_out;
-         cmd_started = True;
-      }
-      if (max_invoke_ms > 0) {
-         usecs = 1000 * max_invoke_ms;
-         gettimeofday(&invoke_time, NULL);
-         invoke_time.tv_sec += max_invoke_ms / 1000;
-         invoke_time.tv_usec += 1000 * (max_invoke_ms % 1000);
-         invoke_time.tv_sec += invoke_time.tv_usec / (1000 * 1000);
-         invoke_time.tv_usec = invoke_time.tv_usec % (1000 * 1000);
-      } else {
-         usecs = 0;
-      }
-      if (cmd_started) {
-         // 0 usecs here means the thread just has to check gdbserver eats
-         // the characters in <= cmd_time_out seconds.
-         // We will just wait by 1 second max at a time.
-         if (usecs == 0 || usecs > 1000 * 1000)
-            usecs = 1000 * 1000;
+            "written_by_vgdb %d "
+            "seen_by_valgrind %d "
+            "invoked_written %d\n",
+            written_by_vgdb,
+            seen_by_valgrind,
+            invoked_written);
+
+      if (written_by_vgdb != last_written || seen_by_valgrind != last_seen) {
+         // Something happened => restart timer check.
+         if (cmd_started) {
+            DEBUG(2, "some IO was done => restart command\n");
+            cmd_started = False;
+         }
+         /* The delay before invoking restarts when valgrind made progress
+            or when data arrives while valgrind had read everything. */
+         if (seen_by_valgrind != last_seen || last_written <= last_seen)
+            pending_since = now;
+         last_written = written_by_vgdb;
+         last_seen = seen_by_valgrind;
       }
-      usleep(usecs);
-
-      /* If nothing happened during our sleep, let's try to wake up valgrind
-         or check for cmd time out. */
-      if (written_by_vgdb_before_sleep == VS_written_by_vgdb
-          && seen_by_valgrind_before_sleep == VS_seen_by_valgrind
-          && VS_written_by_vgdb > VS_seen_by_valgrind) {
-         struct timeval now;
-         gettimeofday(&now, NULL);
-         DEBUG(2,
-               "after sleep "
-               "written_by_vgdb %d "
-               "seen_by_valgrind %d "
-               "invoked_written %d\n",
-               VS_written_by_vgdb,
-               VS_seen_by_valgrind,
-               invoked_written);
+
+      if (written_by_vgdb > seen_by_valgrind) {
          /* if the pid does not exist anymore, we better stop */
          if (kill(pid, 0) != 0)
            XERROR(errno,
                   "invoke_gdbserver_in_valgrind: "
                   "check for pid %d existence failed\n", pid);
+         if (cmd_time_out != NEVER && !cmd_started) {
+            /* A command was started. Record the time at which it was
+               started. */
+            DEBUG(1, "IO for command started\n");
+            cmd_max_end_time = now;
+            cmd_max_end_time.tv_sec += cmd_time_out;
+            cmd_started = True;
+         }
          if (cmd_started) {
             if (timercmp(&now, &cmd_max_end_time, >))
                XERROR(0,
                       "pid %d did not handle a command in %d seconds\n",
                       pid, cmd_time_out);
          }
-         if (max_invoke_ms > 0 && timercmp (&now, &invoke_time, >=)) {
-            /* only need to wake up if the nr written has changed since
-               last invoke. */
-            if (invoked_written != written_by_vgdb_before_sleep) {
-               if (invoker_invoke_gdbserver(pid)) {
-                  /* If invoke successful, no need to invoke again
-                     for the same value of written_by_vgdb_before_sleep. */
-                  invoked_written = written_by_vgdb_before_sleep;
+
+         if (max_invoke_ms > 0) {
+            invoke_time = pending_since;
+            invoke_time.tv_sec += max_invoke_ms / 1000;
+            invoke_time.tv_usec += 1000 * (max_invoke_ms % 1000);
+            invoke_time.tv_sec += invoke_time.tv_usec / (1000 * 1000);
+            invoke_time.tv_usec = invoke_time.tv_usec % (1000 * 1000);
+            wait_ms = ms_till(&now, &invoke_time);
+            if (wait_ms == 0) {
+               /* only need to wake up if the nr written has changed since
+                  last invoke. */
+               if (invoked_written != written_by_vgdb) {
+                  DEBUG(2, "invoking gdbserver after %d ms\n", max_invoke_ms);
+                  if (invoker_invoke_gdbserver(pid)) {
+                     /* If invoke successful, no need to invoke again
+                        for the same value of written_by_vgdb. */
+                     invoked_written = written_by_vgdb;
+                  }
                }
+               pending_since = now;
+               wait_ms = max_invoke_ms;
             }
+         } else {
+            wait_ms = 1000;
          }
+         // We will just wait by 1 second max at a time, to check
+         // gdbserver eats the characters in <= cmd_time_out seconds.
+         if (cmd_started && wait_ms > 1000)
+            wait_ms = 1000;
       } else {
-         // Something happened => restart timer check.
-         if (cmd_time_out != NEVER) {
-            DEBUG(2, "some IO was done => restart command\n");
-            cmd_started = False;
-         }
+         wait_ms = max_invoke_ms > 0 ? max_invoke_ms : 1000;
       }
+
+      wait_invoker_wakeup(wait_ms);
    }
    pthread_cleanup_pop(0);
    return NULL;
 }
 
+/* Creates the invoke_gdbserver_in_valgrind thread, and the pipe used to
+   wake it up. */
+static pthread_t invoke_gdbserver_in_valgrind_thread;
+static
+void start_invoker(int *pid)
+{
+   if (pipe(invoker_wakeup) != 0)
+      XERROR(errno, "error creating invoker wake up pipe\n");
+   if (fcntl(invoker_wakeup[0], F_SETFL, O_NONBLOCK) != 0
+       || fcntl(invoker_wakeup[1], F_SETFL, O_NONBLOCK) != 0)
+      XERROR(errno, "error setting invoker wake up pipe non blocking\n");
+   pthread_create(&invoke_gdbserver_in_valgrind_thread, NULL,
+                  invoke_gdbserver_in_valgrind, (void *) pid);
+}
+
 static
 int open_fifo(const char* name, int flags, const char* desc)
 {
@@ -657,7 +727,6 @@ static int sighup = 0;
 static int sigusr1 = 0;
 static int sigalrm = 0;
 static int sigusr1_fd = -1;
-static pthread_t invoke_gdbserver_in_valgrind_thread;
 
 static
 void received_signal(int signum)
@@ -804,6 +873,8 @@ void close_connection(int to_pid, int from_pid)
          otherwise, valgrind will stop abnormally with SIGSTOP. */
       (void) alarm(3);
 
+      /* shutting_down is set: let the invoker notice it now. */
+      wake_up_invoker();
       DEBUG(1, "joining with invoke_gdbserver_in_valgrind_thread\n");
       join = pthread_join(invoke_gdbserver_in_valgrind_thread, NULL);
       if (join != 0)
@@ -828,8 +899,7 @@ void gdb_relay(int pid)
    fflush(stderr);
 
    if (max_invoke_ms > 0)
-      pthread_create(&invoke_gdbserver_in_valgrind_thread, NULL,
-                     invoke_gdbserver_in_valgrind, (void *) &pid);
+      start_invoker(&pid);
    to_pid = open_fifo(from_gdb_to_pid, O_WRONLY, "write to pid");
    acquire_lock(shared_mem_fd, pid);
 
@@ -951,8 +1021,7 @@ void standalone_send_commands(int pid,
 
 
    if (max_invoke_ms > 0 || cmd_time_out != NEVER)
-      pthread_create(&invoke_gdbserver_in_valgrind_thread, NULL,
-                     invoke_gdbserver_in_valgrind, (void *) &pid);
+      start_invoker(&pid);
 
    to_pid = open_fifo(from_gdb_to_pid, O_WRONLY, "write to pid");
    acquire_lock(shared_mem_fd, pid);
@@ -32,6 +32,7 @@
 
 #include "pub_tool_basics.h"
 #include "pub_tool_clientstate.h"
+#include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcfile.h"
@@ -40,12 +41,23 @@
 #include "pub_tool_machine.h"      // VG_(fnptr_to_fnentry)
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
+#include "pub_tool_poolalloc.h"
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_wordfm.h"
 
 #define HISTOGRAM_SIZE_LIMIT 1024
 
+// Blocks larger than HISTOGRAM_SIZE_LIMIT get a coarser histogram, with one
+// count per 2^clo_histo_gran_shift bytes (see --histogram-granularity), if
+// clo_histo_gran is not zero.
+static UInt clo_histo_gran       = 64;
+static UInt clo_histo_gran_shift = 6;
+
+// If not zero, only a sample of the blocks smaller than this many bytes is
+// tracked (see --sample-bytes).
+static UInt clo_sample_bytes     = 0;
+
 //------------------------------------------------------------//
 //--- Globals                                              ---//
 //------------------------------------------------------------//
@@ -81,10 +93,17 @@ typedef
       ULong       allocd_at; /* instruction number */
       ULong       reads_bytes;
       ULong       writes_bytes;
-      /* Approx histogram, one byte per payload byte.  Counts latch up
-         therefore at 0xFFFF.  Can be NULL if the block is resized or if
-         the block is larger than HISTOGRAM_SIZE_LIMIT. */
-      UShort*     histoW; /* [0 .. req_szB-1] */
+      /* How many blocks this one stands for: 1, unless --sample-bytes is
+         in use and the block is smaller than the sampling interval.  All
+         the block's contributions to the stats are multiplied by it. */
+      ULong       weight;
+      /* Approx histogram, one count per 2^histo_shift payload bytes.
+         Counts latch up therefore at 0xFFFF.  histo_shift is 0 if the
+         block is not larger than HISTOGRAM_SIZE_LIMIT, and
+         clo_histo_gran_shift otherwise.  Can be NULL if the block is
+         resized or if the block is large and --histogram-granularity=0. */
+      UShort*     histoW; /* [0 .. n_histo(req_szB, histo_shift)-1] */
+      UInt        histo_shift;
    }
    Block;
 
@@ -92,6 +111,12 @@ typedef
    overlapping blocks. */
 static WordFM* interval_tree = NULL;  /* WordFM* Block* void */
 
+// Nr of histogram entries for a block of szB bytes.
+static inline SizeT n_histo ( SizeT szB, UInt histo_shift )
+{
+   return (szB + (1 << histo_shift) - 1) >> histo_shift;
+}
+
 /* Here's the comparison function.  Since the tree is required
 to contain non-zero sized, non-overlapping blocks, it's good
 enough to consider any overlap as a match. */
@@ -110,9 +135,20 @@ static Word interval_tree_Cmp ( UWord k1, UWord k2 )
 static Block* fbc_cache0 = NULL;
 static Block* fbc_cache1 = NULL;
 
+// Direct-mapped cache of 64-byte granules known to overlap no block, for
+// find_Block_containing.  Most accesses are not to tracked blocks, even
+// more so with --sample-bytes, and otherwise each costs a search of the
+// interval tree.  Adding a block to the tree invalidates the whole cache,
+// by bumping fbc_neg_gen.
+#define FBC_NEG_SHIFT 6
+#define N_FBC_NEG     4096
+static struct { UWord granule; UWord gen; } fbc_neg[N_FBC_NEG];
+static UWord fbc_neg_gen = 1;
+
 static UWord stats__n_fBc_cached = 0;
 static UWord stats__n_fBc_uncached = 0;
 static UWord stats__n_fBc_notfound = 0;
+static UWord stats__n_fBc_negcached = 0;
 
 static Block* find_Block_containing ( Addr a )
 {
@@ -133,6 +169,14 @@ static Block* find_Block_containing ( Addr a )
       stats__n_fBc_cached++;
       return fbc_cache0;
    }
+   UWord granule = a >> FBC_NEG_SHIFT;
+   UWord neg_ix  = granule % N_FBC_NEG;
+   if (LIKELY(fbc_neg[neg_ix].granule == granule
+              && fbc_neg[neg_ix].gen == fbc_neg_gen)) {
+      stats__n_fBc_notfound++;
+      stats__n_fBc_negcached++;
+      return NULL;
+   }
    Block fake;
    fake.payload = a;
    fake.req_szB = 1;
@@ -141,6 +185,13 @@ static Block* find_Block_containing ( Addr a )
    Bool found = VG_(lookupFM)( interval_tree,
                                &foundkey, &foundval, (UWord)&fake );
    if (!found) {
+      // If no block overlaps the whole granule, remember that.
+      fake.payload = granule << FBC_NEG_SHIFT;
+      fake.req_szB = 1 << FBC_NEG_SHIFT;
+      if (!VG_(lookupFM)( interval_tree, NULL, NULL, (UWord)&fake )) {
+         fbc_neg[neg_ix].granule = granule;
+         fbc_neg[neg_ix].gen     = fbc_neg_gen;
+      }
       stats__n_fBc_notfound++;
       return NULL;
    }
@@ -169,6 +220,66 @@ static void delete_Block_starting_at ( Addr a )
 }
 
 
+//------------------------------------------------------------//
+//--- Sampling                                             ---//
+//------------------------------------------------------------//
+
+// With --sample-bytes=<n>, blocks of at least n bytes are all tracked, and
+// the smaller ones are sampled by bytes allocated, as heapprof does.  The
+// bytes of the small blocks form a stream in which sample points are
+// placed at random intervals averaging n bytes, so a block of S bytes
+// holds an average of S/n of them.  A block holding k points is tracked
+// with weight k*n/S, rounded up or down at random so that its mean is
+// kept, which makes every count an unbiased estimate.  Blocks left
+// untracked, and those whose weight rounds to zero, cost neither a stack
+// trace nor access counting; they are only remembered in
+// untracked_blocks, so that they can be freed and resized.
+
+typedef
+   struct _Untracked {
+      struct _Untracked* next;
+      Addr               payload;
+      SizeT              req_szB;
+   }
+   Untracked;
+
+static VgHashTable* untracked_blocks = NULL;   /* Untracked */
+static PoolAlloc*   untracked_pa     = NULL;
+
+static UInt  sample_seed = 0;
+static SizeT sample_left = 0;   // bytes up to the next sample point
+
+static SizeT sample_gap ( void )
+{
+   // Uniform in [1, 2n-1], so the mean is n.  Varying the gap stops
+   // sampling from falling into step with a regular allocation pattern.
+   return 1 + VG_(random)(&sample_seed) % (2 * clo_sample_bytes - 1);
+}
+
+// The weight to track a new block of szB bytes with, 0 if it is not to be
+// tracked.
+static ULong sample_weight ( SizeT szB )
+{
+   ULong k = 0, kn;
+   SizeT off = 0;
+
+   if (clo_sample_bytes == 0 || szB >= clo_sample_bytes)
+      return 1;
+
+   while (szB - off >= sample_left) {
+      off += sample_left;
+      k++;
+      sample_left = sample_gap();
+   }
+   sample_left -= szB - off;
+   if (k == 0)
+      return 0;
+
+   kn = k * clo_sample_bytes;
+   return kn / szB + (VG_(random)(&sample_seed) % szB < kn % szB ? 1 : 0);
+}
+
+
 //------------------------------------------------------------//
 //--- a FM of allocation points (APs)                      ---//
 //------------------------------------------------------------//
@@ -209,7 +320,8 @@ typedef
       /* Histogram information.  We maintain a histogram aggregated for
          all retiring Blocks allocated by this AP, but only if:
          - this AP has only ever allocated objects of one size
-         - that size is <= HISTOGRAM_SIZE_LIMIT
+         - that size is <= HISTOGRAM_SIZE_LIMIT, or the blocks have a
+           coarser histogram (see Block)
          What we need therefore is a mechanism to see if this AP
          has only ever allocated blocks of one size.
 
@@ -220,7 +332,8 @@ typedef
       */
       enum { Unknown=999, Exactly, Mixed } xsize_tag;
       SizeT xsize;
-      UInt* histo; /* [0 .. xsize-1] */
+      UInt  histo_shift; /* as in Block */
+      UInt* histo; /* [0 .. n_histo(xsize, histo_shift)-1] */
    }
    APInfo;
 
@@ -284,11 +397,12 @@ static void intro_Block ( Block* bk )
 
    // Update global stats first.
 
-   g_total_blocks++;
-   g_total_bytes += bk->req_szB;
+   ULong w = bk->weight;
+   g_total_blocks += w;
+   g_total_bytes += w * bk->req_szB;
 
-   g_curr_blocks++;
-   g_curr_bytes += bk->req_szB;
+   g_curr_blocks += w;
+   g_curr_bytes += w * bk->req_szB;
    if (g_curr_bytes > g_max_bytes) {
       g_max_blocks = g_curr_blocks;
       g_max_bytes = g_curr_bytes;
@@ -297,11 +411,11 @@ static void intro_Block ( Block* bk )
 
    // Now update APInfo stats.
 
-   api->total_blocks++;
-   api->total_bytes += bk->req_szB;
+   api->total_blocks += w;
+   api->total_bytes += w * bk->req_szB;
 
-   api->curr_blocks++;
-   api->curr_bytes += bk->req_szB;
+   api->curr_blocks += w;
+   api->curr_bytes += w * bk->req_szB;
    if (api->curr_bytes > api->max_bytes) {
       api->max_blocks = api->curr_blocks;
       api->max_bytes  = api->curr_bytes;
@@ -331,6 +445,8 @@ static void retire_Block ( Block* bk, Bool because_freed )
    api = (APInfo*)valW;
    tl_assert(api->ap == bk->ap);
 
+   ULong w = bk->weight;
+
    // update stats following this free.
    if (0)
       VG_(printf)("ec %p  api->c_by_l %llu  bk->rszB %llu\n",
@@ -341,28 +457,28 @@ static void retire_Block ( Block* bk, Bool because_freed )
       check_for_peak();
 
       // Then update global stats.
-      tl_assert(g_curr_blocks >= 1);
-      tl_assert(g_curr_bytes >= bk->req_szB);
-      g_curr_blocks--;
-      g_curr_bytes -= bk->req_szB;
+      tl_assert(g_curr_blocks >= w);
+      tl_assert(g_curr_bytes >= w * bk->req_szB);
+      g_curr_blocks -= w;
+      g_curr_bytes -= w * bk->req_szB;
 
       // Then update APInfo stats.
-      tl_assert(api->curr_blocks >= 1);
-      tl_assert(api->curr_bytes >= bk->req_szB);
-      api->curr_blocks--;
-      api->curr_bytes -= bk->req_szB;
+      tl_assert(api->curr_blocks >= w);
+      tl_assert(api->curr_bytes >= w * bk->req_szB);
+      api->curr_blocks -= w;
+      api->curr_bytes -= w * bk->req_szB;
 
       api->freed_blocks++;
    }
 
    tl_assert(bk->allocd_at <= g_curr_instrs);
-   api->total_lifetimes_instrs += (g_curr_instrs - bk->allocd_at);
+   api->total_lifetimes_instrs += w * (g_curr_instrs - bk->allocd_at);
 
    // access counts
-   api->reads_bytes += bk->reads_bytes;
-   api->writes_bytes += bk->writes_bytes;
-   g_reads_bytes += bk->reads_bytes;
-   g_writes_bytes += bk->writes_bytes;
+   api->reads_bytes += w * bk->reads_bytes;
+   api->writes_bytes += w * bk->writes_bytes;
+   g_reads_bytes += w * bk->reads_bytes;
+   g_writes_bytes += w * bk->writes_bytes;
 
    // histo stuff.  First, do state transitions for xsize/xsize_tag.
    switch (api->xsize_tag) {
@@ -376,9 +492,10 @@ static void retire_Block ( Block* bk, Bool because_freed )
          if (0) VG_(printf)("api %p   -->  Exactly(%lu)\n", api, api->xsize);
          // and allocate the histo
          if (bk->histoW) {
-            api->histo = VG_(malloc)("dh.retire_Block.1",
-                                     api->xsize * sizeof(UInt));
-            VG_(memset)(api->histo, 0, api->xsize * sizeof(UInt));
+            SizeT n = n_histo(api->xsize, bk->histo_shift);
+            api->histo_shift = bk->histo_shift;
+            api->histo = VG_(malloc)("dh.retire_Block.1", n * sizeof(UInt));
+            VG_(memset)(api->histo, 0, n * sizeof(UInt));
          }
          break;
 
@@ -409,12 +526,13 @@ static void retire_Block ( Block* bk, Bool because_freed )
    // the data for the AP
    if (api->xsize_tag == Exactly && api->histo && bk->histoW) {
       tl_assert(api->xsize == bk->req_szB);
+      tl_assert(api->histo_shift == bk->histo_shift);
       UWord i;
-      for (i = 0; i < api->xsize; i++) {
+      for (i = 0; i < n_histo(api->xsize, api->histo_shift); i++) {
          // FIXME: do something better in case of overflow of api->histo[..]
          // Right now, at least don't let it overflow/wrap around
-         if (api->histo[i] <= 0xFFFE0000)
-            api->histo[i] += (UInt)bk->histoW[i];
+         ULong h = api->histo[i] + w * bk->histoW[i];
+         api->histo[i] = h <= 0xFFFFFFFF ? (UInt)h : 0xFFFFFFFF;
       }
       if (0) VG_(printf)("fold in, AP = %p\n", api);
    }
@@ -432,11 +550,12 @@ static void retire_Block ( Block* bk, Bool because_freed )
 #endif
 }
 
-/* This handles block resizing.  When a block with AP 'ec' has a
-   size change of 'delta', call here to update the APInfo. */
-static void resize_Block(ExeContext* ec, SizeT old_req_szB, SizeT new_req_szB)
+/* This handles block resizing.  When a block with AP 'ec' and weight 'w'
+   has a size change of 'delta', call here to update the APInfo. */
+static void resize_Block(ExeContext* ec, SizeT old_req_szB, SizeT new_req_szB,
+                         ULong w)
 {
-   Long    delta = (Long)new_req_szB - (Long)old_req_szB;
+   Long    delta = ((Long)new_req_szB - (Long)old_req_szB) * (Long)w;
    APInfo* api   = NULL;
    UWord   keyW  = 0;
    UWord   valW  = 0;
@@ -466,8 +585,8 @@ static void resize_Block(ExeContext* ec, SizeT old_req_szB, SizeT new_req_szB)
 
    // Update global stats first.
 
-   g_total_blocks++;
-   g_total_bytes += new_req_szB;
+   g_total_blocks += w;
+   g_total_bytes += w * new_req_szB;
 
    g_curr_blocks += 0;  // unchanged
    g_curr_bytes += delta;
@@ -479,8 +598,8 @@ static void resize_Block(ExeContext* ec, SizeT old_req_szB, SizeT new_req_szB)
 
    // Now update APInfo stats.
 
-   api->total_blocks++;
-   api->total_bytes += new_req_szB;
+   api->total_blocks += w;
+   api->total_bytes += w * new_req_szB;
 
    api->curr_blocks += 0;  // unchanged
    api->curr_bytes += delta;
@@ -521,6 +640,15 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
       /* slop_szB = 0; */
    }
 
+   ULong weight = sample_weight(req_szB);
+   if (weight == 0) {
+      Untracked* ub = VG_(allocEltPA)(untracked_pa);
+      ub->payload = (Addr)p;
+      ub->req_szB = req_szB;
+      VG_(HT_add_node)(untracked_blocks, ub);
+      return p;
+   }
+
    // Make new Block, add to interval_tree.
    Block* bk = VG_(malloc)("dh.new_block.1", sizeof(Block));
    bk->payload      = (Addr)p;
@@ -529,16 +657,20 @@ void* new_block ( ThreadId tid, void* p, SizeT req_szB, SizeT req_alignB,
    bk->allocd_at    = g_curr_instrs;
    bk->reads_bytes  = 0;
    bk->writes_bytes = 0;
-   // set up histogram array, if the block isn't too large
+   bk->weight       = weight;
+   // set up histogram array, per byte if the block isn't too large
    bk->histoW = NULL;
-   if (req_szB <= HISTOGRAM_SIZE_LIMIT) {
-      bk->histoW = VG_(malloc)("dh.new_block.2", req_szB * sizeof(UShort));
-      VG_(memset)(bk->histoW, 0, req_szB * sizeof(UShort));
+   bk->histo_shift = req_szB <= HISTOGRAM_SIZE_LIMIT ? 0 : clo_histo_gran_shift;
+   if (req_szB <= HISTOGRAM_SIZE_LIMIT || clo_histo_gran > 0) {
+      SizeT n = n_histo(req_szB, bk->histo_shift);
+      bk->histoW = VG_(malloc)("dh.new_block.2", n * sizeof(UShort));
+      VG_(memset)(bk->histoW, 0, n * sizeof(UShort));
    }
 
    Bool present = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
    tl_assert(!present);
    fbc_cache0 = fbc_cache1 = NULL;
+   fbc_neg_gen++;
 
    intro_Block(bk);
 
@@ -555,7 +687,13 @@ void die_block ( void* p, Bool custom_free )
    Block* bk = find_Block_containing( (Addr)p );
 
    if (!bk) {
-     return; // bogus free
+     Untracked* ub = untracked_blocks
+                     ? VG_(HT_remove)(untracked_blocks, (UWord)p) : NULL;
+     if (ub) {
+        VG_(cli_free)(p);
+        VG_(freeEltPA)(untracked_pa, ub);
+     }
+     return; // untracked or bogus free
    }
 
    tl_assert(bk->req_szB > 0);
@@ -593,7 +731,27 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
    // Find the old block.
    Block* bk = find_Block_containing( (Addr)p_old );
    if (!bk) {
-      return NULL;   // bogus realloc
+      Untracked* ub = untracked_blocks
+                      ? VG_(HT_lookup)(untracked_blocks, (UWord)p_old) : NULL;
+      if (!ub) {
+         return NULL;   // bogus realloc
+      }
+      // An untracked block stays untracked.
+      if (new_req_szB <= ub->req_szB) {
+         ub->req_szB = new_req_szB;
+         return p_old;
+      }
+      p_new = VG_(cli_malloc)(VG_(clo_alignment), new_req_szB);
+      if (!p_new) {
+         return NULL;
+      }
+      VG_(memcpy)(p_new, p_old, ub->req_szB);
+      VG_(cli_free)(p_old);
+      VG_(HT_remove)(untracked_blocks, (UWord)p_old);
+      ub->payload = (Addr)p_new;
+      ub->req_szB = new_req_szB;
+      VG_(HT_add_node)(untracked_blocks, ub);
+      return p_new;
    }
 
    tl_assert(bk->req_szB > 0);
@@ -616,7 +774,7 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
    if (new_req_szB <= bk->req_szB) {
 
       // New size is smaller or same; block not moved.
-      resize_Block(bk->ap, bk->req_szB, new_req_szB);
+      resize_Block(bk->ap, bk->req_szB, new_req_szB, bk->weight);
       bk->req_szB = new_req_szB;
       return p_old;
 
@@ -642,7 +800,7 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
       // is still alive
 
       // Update the metadata.
-      resize_Block(bk->ap, bk->req_szB, new_req_szB);
+      resize_Block(bk->ap, bk->req_szB, new_req_szB, bk->weight);
       bk->payload = (Addr)p_new;
       bk->req_szB = new_req_szB;
 
@@ -651,6 +809,7 @@ void* renew_block ( ThreadId tid, void* p_old, SizeT new_req_szB )
          = VG_(addToFM)( interval_tree, (UWord)bk, (UWord)0/*no val*/);
       tl_assert(!present);
       fbc_cache0 = fbc_cache1 = NULL;
+      fbc_neg_gen++;
 
       return p_new;
    }
@@ -718,6 +877,10 @@ static void* dh_realloc ( ThreadId tid, void* p_old, SizeT new_szB )
 static SizeT dh_malloc_usable_size ( ThreadId tid, void* p )
 {
    Block* bk = find_Block_containing( (Addr)p );
+   if (!bk && untracked_blocks) {
+      Untracked* ub = VG_(HT_lookup)(untracked_blocks, (UWord)p);
+      return ub ? ub->req_szB : 0;
+   }
    return bk ? bk->req_szB : 0;
 }
 
@@ -736,6 +899,11 @@ void inc_histo_for_block ( Block* bk, Addr addr, UWord szB )
    if (offMax1 > bk->req_szB)
       offMax1 = bk->req_szB;
    //VG_(printf)("%lu %lu   (size of block %lu)\n", offMin, offMax1, bk->req_szB);
+   if (bk->histo_shift > 0) {
+      // Count one access for each histogram entry the access touches.
+      offMin  = offMin >> bk->histo_shift;
+      offMax1 = ((offMax1 - 1) >> bk->histo_shift) + 1;
+   }
    for (i = offMin; i < offMax1; i++) {
       UShort n = bk->histoW[i];
       if (n < 0xFFFF) n++;
@@ -1080,6 +1248,17 @@ static Bool dh_process_cmd_line_option(const HChar* arg)
 {
    if VG_STR_CLO(arg, "--dhat-out-file", clo_dhat_out_file) {}
 
+   else if VG_BINT_CLO(arg, "--histogram-granularity", clo_histo_gran,
+                       0, 1 << 20) {
+      if (clo_histo_gran > 0) {
+         if (VG_(log2)(clo_histo_gran) < 0)
+            VG_(fmsg_bad_option)(arg, "must be a power of 2\n");
+         clo_histo_gran_shift = VG_(log2)(clo_histo_gran);
+      }
+   }
+
+   else if VG_BINT_CLO(arg, "--sample-bytes", clo_sample_bytes, 0, 1 << 30) {}
+
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
 
@@ -1090,6 +1269,13 @@ static void dh_print_usage(void)
 {
    VG_(printf)(
 "    --dhat-out-file=<file>  output file name [dhat.out.%%p]\n"
+"    --histogram-granularity=<n>  access counts of blocks larger than 1024\n"
+"                            bytes are per <n> bytes, a power of 2; 0 means\n"
+"                            no access counts for them [64]\n"
+"    --sample-bytes=<n>      track only a sample of the blocks smaller than\n"
+"                            <n> bytes, about one per <n> bytes allocated,\n"
+"                            and scale up their counts; 0 tracks all\n"
+"                            blocks [0]\n"
    );
 }
 
@@ -1260,6 +1446,8 @@ static void write_APInfo(APInfo* api, Bool is_first)
       api->reads_bytes, api->writes_bytes);
 
    if (api->histo && api->xsize_tag == Exactly) {
+      if (api->histo_shift > 0)
+         FP("  ,\"accg\":%u\n", 1U << api->histo_shift);
       FP("  ,\"acc\":[");
 
       // Simple run-length encoding: when N entries in a row have the same
@@ -1267,8 +1455,9 @@ static void write_APInfo(APInfo* api, Bool is_first)
       // print "M". This reduces file size significantly.
       UShort repval = 0;
       Int reps = 0;
-      for (UWord i = 0; i < api->xsize; i++) {
-         UShort h = api->histo[i];
+      for (UWord i = 0; i < n_histo(api->xsize, api->histo_shift); i++) {
+         // Folded counts can exceed the 0xFFFF at which counts latch.
+         UShort h = api->histo[i] < 0xFFFF ? api->histo[i] : 0xFFFF;
          if (repval == h) {
             // Continue current run.
             reps++;
@@ -1352,7 +1541,8 @@ static void dh_fini(Int exit_status)
                 stats__n_fBc_cached + stats__n_fBc_uncached,
                 stats__n_fBc_cached,
                 stats__n_fBc_uncached);
-      VG_(dmsg)("          notfound: %'lu\n", stats__n_fBc_notfound);
+      VG_(dmsg)("          notfound: %'lu (%'lu cached)\n",
+                stats__n_fBc_notfound, stats__n_fBc_negcached);
       VG_(dmsg)("\n");
    }
 
@@ -1399,6 +1589,10 @@ static void dh_fini(Int exit_status)
    // Times.
    FP(",\"mi\":%llu,\"ei\":%llu\n", g_max_instrs, g_curr_instrs);
 
+   // The sampling interval, if the counts are estimates.
+   if (clo_sample_bytes > 0)
+      FP(",\"sb\":%u\n", clo_sample_bytes);
+
    // APs.
    write_APInfos();
 
@@ -1442,6 +1636,9 @@ static void dh_fini(Int exit_status)
              g_curr_bytes, g_curr_blocks);
    VG_(umsg)("Reads:     %'llu bytes\n", g_reads_bytes);
    VG_(umsg)("Writes:    %'llu bytes\n", g_writes_bytes);
+   if (clo_sample_bytes > 0)
+      VG_(umsg)("(estimated from blocks sampled every ~%'u bytes)\n",
+                clo_sample_bytes);
 
    // Print a how-to-view-the-profile hint.
    VG_(umsg)("\n");
@@ -1460,6 +1657,12 @@ static void dh_fini(Int exit_status)
 
 static void dh_post_clo_init(void)
 {
+   if (clo_sample_bytes > 0) {
+      untracked_pa = VG_(newPA)(sizeof(Untracked), 1000, VG_(malloc),
+                                "dh.untracked.1", VG_(free));
+      untracked_blocks = VG_(HT_construct)("dh.untracked.2");
+      sample_left = sample_gap();
+   }
 }
 
 static void dh_pre_clo_init(void)
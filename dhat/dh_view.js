@@ -332,12 +332,17 @@ function TreeNode(aKind, aFrames) {
   //   don't, or all kids have accesses but in different sizes)
   // - length>0 means "accesses" (i.e. all kids have accesses and all the same
   //   size)
+  // When set, this._accGran is the number of bytes covered by each element of
+  // this._accesses: 1, or more for blocks larger than 1024 bytes.
 
   // If a node would only have a single child, we instead effectively inline it
   // in the parent. Therefore a node can have multiple frames.
   this._frames = aFrames;
 
-  // this._kids is left undefined. It will be added if necessary.
+  // this._kids is left undefined. It will be added if necessary, by _setKids(),
+  // along with this._kidsByFrame, which maps the first frame of each kid with
+  // frames to that kid, so kids can be found in constant time while building
+  // the tree. (Nodes for big profiles can have tens of thousands of kids.)
 
   // this._sig is added later, by sigTree().
 }
@@ -345,7 +350,7 @@ function TreeNode(aKind, aFrames) {
 TreeNode.prototype = {
   _add(aTotalBytes, aTotalBlocks, aTotalLifetimesInstrs, aMaxBytes,
        aMaxBlocks, aAtTGmaxBytes, aAtTGmaxBlocks, aAtTEndBytes,
-       aAtTEndBlocks, aReadsBytes, aWritesBytes, aAccesses) {
+       aAtTEndBlocks, aReadsBytes, aWritesBytes, aAccesses, aAccGran) {
 
     // We ignore this._kind, this._frames, and this._kids.
 
@@ -378,8 +383,10 @@ TreeNode.prototype = {
       if (!this._accesses && aAccesses) {
         // unset accesses += accesses --> has accesses (must clone the array)
         this._accesses = aAccesses.slice();
+        this._accGran = aAccGran;
       } else if (this._accesses && aAccesses &&
-                 this._accesses.length === aAccesses.length) {
+                 this._accesses.length === aAccesses.length &&
+                 this._accGran === aAccGran) {
         // accesses += accesses (with matching lengths) --> accesses
         for (let i = 0; i < this._accesses.length; i++) {
           this._accesses[i] += aAccesses[i];
@@ -395,7 +402,7 @@ TreeNode.prototype = {
 
   _addAP(aAP) {
     this._add(aAP.tb, aAP.tbk, aAP.tli, aAP.mb, aAP.mbk, aAP.gb, aAP.gbk,
-              aAP.fb, aAP.fbk, aAP.rb, aAP.wb, aAP.acc);
+              aAP.fb, aAP.fbk, aAP.rb, aAP.wb, aAP.acc, aAP.accg || 1);
   },
 
   // This is called in two cases.
@@ -406,7 +413,22 @@ TreeNode.prototype = {
     this._add(aT._totalBytes, aT._totalBlocks, aT._totalLifetimesInstrs,
               aT._maxBytes, aT._maxBlocks, aT._atTGmaxBytes, aT._atTGmaxBlocks,
               aT._atTEndBytes, aT._atTEndBlocks,
-              aT._readsBytes, aT._writesBytes, aT._accesses);
+              aT._readsBytes, aT._writesBytes, aT._accesses, aT._accGran);
+  },
+
+  _setKids(aKids) {
+    this._kids = [];
+    this._kidsByFrame = new Map();
+    for (let kid of aKids) {
+      this._pushKid(kid);
+    }
+  },
+
+  _pushKid(aKid) {
+    this._kids.push(aKid);
+    if (aKid._frames.length > 0) {
+      this._kidsByFrame.set(aKid._frames[0], aKid);
+    }
   },
 
   // Split the node after the aTi'th internal frame. The inheriting kid will
@@ -417,6 +439,7 @@ TreeNode.prototype = {
     let kid1 = new TreeNode(this._kind, inheritedFrames);
     if (this._kids) {
       kid1._kids = this._kids;
+      kid1._kidsByFrame = this._kidsByFrame;
     }
     kid1._addNode(this);
 
@@ -433,7 +456,7 @@ TreeNode.prototype = {
       delete this._maxBytes;
       delete this._maxBlocks;
     }
-    this._kids = [kid1, kid2];
+    this._setKids([kid1, kid2]);
     this._addAP(aAP);
   },
 
@@ -590,13 +613,7 @@ function buildTree() {
         t._addAP(ap);
 
         // Search for the frame among the kids.
-        let kid;
-        for (let k of t._kids) {
-          if (k._frames[0] === kidFrame) {
-            kid = k;
-            break;
-          }
-        }
+        let kid = t._kidsByFrame.get(kidFrame);
         if (kid) {
           // Found it. Move to it.
           t = kid;
@@ -608,7 +625,7 @@ function buildTree() {
           //      ab:30-[c:10-Xs, d:10-Ys, ef:10-[]]
           kid = new TreeNode(kLeaf, ap.fs.slice(j));
           kid._addAP(ap);
-          t._kids.push(kid);
+          t._pushKid(kid);
           done = true;
           break;
         }
@@ -675,7 +692,7 @@ function buildTree() {
           let newKid = new TreeNode(kLeaf, []);
           newKid._addAP(ap);
 
-          t._kids.push(newKid);
+          t._pushKid(newKid);
           t._addAP(ap);
         }
       }
@@ -821,6 +838,10 @@ function appendInvocationAndTimes(aP) {
   v = "Invocation {\n";
   v += `  Command: ${gData.cmd}\n`;
   v += `  PID:     ${gData.pid}\n`;
+  if (gData.sb) {
+    v += `  Sampled: blocks smaller than ${gData.sb} bytes; ` +
+         `counts are estimates\n`;
+  }
   v += "}\n\n";
 
   appendElementWithText(aP, "span", v, "invocation");
@@ -841,6 +862,18 @@ const kNoKidsArrow      = "─ ";     // cannot change
 const kHidingKidsArrow  = "▶ ";     // expandible
 const kShowingKidsArrow = "▼ ";     // collapsible
 
+// Big trees are not appended to the page in full straight away, because
+// millions of DOM nodes can hang the browser. At most kMaxEagerNodes nodes are
+// appended at a time; the kids of nodes reached after that are only appended
+// when the node is first expanded. Likewise, at most kMaxKidsPerBatch kids of
+// a node are appended at a time, followed by a line that appends the next
+// batch when clicked.
+const kMaxEagerNodes   = 10000;
+const kMaxKidsPerBatch = 1000;
+
+// The number of nodes that can still be appended before deferring kids.
+let gNodesLeft;
+
 // HTML doesn't have a tree element, so we fake one with text. One nice
 // consequence is that you can copy and paste the output. The non-ASCII chars
 // used (for arrows and tree lines) usually reproduce well when pasted into
@@ -1002,12 +1035,17 @@ function appendTreeInner(aT, aP, aBolds, aCmp, aPc, aSig, aNodeIdNums,
          : (pc < 32) ? "lt32"               // 16% to  31.999%
          :             "lt100";             // 32% to 100%
 
-  // Append the primary element.
+  // Append the primary element. Its kids are deferred if we have already
+  // appended enough nodes.
+  gNodesLeft--;
+  let deferKids = kids && gNodesLeft <= 0;
   let arrow;
   if (kids) {
-    p = appendElement(aP, "span", lt + " internal expanded");
+    p = appendElement(aP, "span",
+                      lt + (deferKids ? " internal collapsed"
+                                      : " internal expanded"));
     p.onclick = toggleClass;
-    arrow = kShowingKidsArrow;
+    arrow = deferKids ? kHidingKidsArrow : kShowingKidsArrow;
   } else {
     p = appendElement(aP, "span", lt + " leaf");
     arrow = kNoKidsArrow;
@@ -1090,15 +1128,18 @@ function appendTreeInner(aT, aP, aBolds, aCmp, aPc, aSig, aNodeIdNums,
   fr(v2, aBolds.writesAvgPerByte);
   nl(aBolds.writesTitle);
 
-  // "Accesses". We show 32 per line (but not on aggregate nodes).
+  // "Accesses". We show 32 per line (but not on aggregate nodes). Counts of
+  // large blocks cover aT._accGran bytes each, and are indexed by offset.
   if (aT._accesses && aT._accesses.length > 0) {
-    let v = "  Accesses: {";
+    let v = (aT._accGran > 1)
+          ? `  Accesses (per ${aT._accGran} bytes): {`
+          : "  Accesses: {";
     let prevN;
     for (let [i, n] of aT._accesses.entries()) {
       if ((i % 32) === 0) {
         fr(v);
         nl();
-        v1 = i.toString().padStart(3, ' ');
+        v1 = (i * aT._accGran).toString().padStart(3, ' ');
         v = `    [${v1}]  `;
         v += `${accesses(n)} `;
       } else {
@@ -1152,7 +1193,8 @@ function appendTreeInner(aT, aP, aBolds, aCmp, aPc, aSig, aNodeIdNums,
   if (kids) {
     assert(aT._kind !== kLeaf, "leaf node has children");
 
-    p = appendElement(aP, "span", "kids");
+    let hasKidsNode = p;
+    p = appendElement(aP, "span", deferKids ? "kids hidden" : "kids");
 
     // tlFirstFor{Most,Last} are shorter than tlRestFor{Most,Last} to allow
     // space for the arrow.
@@ -1165,17 +1207,49 @@ function appendTreeInner(aT, aP, aBolds, aCmp, aPc, aSig, aNodeIdNums,
     let tlFirstForLast = aTlRest + "└─";
     let tlRestForLast  = aTlRest + "    ";
 
-    for (let [i, kid] of kids.entries()) {
-      let n = aT._frames.length;
-      aOldFrames.push(...aT._frames); // append aT._frames to aOldFrames
-      aNodeIdNums.push(i + 1);
-      let isLast = i === kids.length - 1;
-      appendTreeInner(kid, p, aBolds, aCmp, aPc, aSig, aNodeIdNums,
-                      kids.length - 1, aOldFrames,
-                      !isLast ? tlFirstForMost : tlFirstForLast,
-                      !isLast ? tlRestForMost : tlRestForLast);
-      aNodeIdNums.pop(i);
-      aOldFrames.splice(-n);         // remove aT._frames from aOldFrames
+    // Append a batch of kids, starting with the aStart'th. aIdNums and
+    // aFrames are this node's aNodeIdNums and aOldFrames, copied if this is
+    // done later.
+    let kidsSpan = p;
+    let appendKids = (aStart, aIdNums, aFrames) => {
+      let end = Math.min(kids.length, aStart + kMaxKidsPerBatch);
+      for (let i = aStart; i < end; i++) {
+        let kid = kids[i];
+        let n = aT._frames.length;
+        aFrames.push(...aT._frames);   // append aT._frames to aFrames
+        aIdNums.push(i + 1);
+        let isLast = i === kids.length - 1;
+        appendTreeInner(kid, kidsSpan, aBolds, aCmp, aPc, aSig, aIdNums,
+                        kids.length - 1, aFrames,
+                        !isLast ? tlFirstForMost : tlFirstForLast,
+                        !isLast ? tlRestForMost : tlRestForLast);
+        aIdNums.pop(i);
+        aFrames.splice(-n);            // remove aT._frames from aFrames
+      }
+
+      if (end < kids.length) {
+        let more = appendElement(kidsSpan, "span", "internal more");
+        appendElementWithText(more, "span", tlFirstForLast, "treeline");
+        appendElementWithText(more, "span", kHidingKidsArrow, "arrow");
+        appendText(more, `[${kids.length - end} more children]\n`);
+        let idNums = aIdNums.slice(), frames = aFrames.slice();
+        more.onclick = () => {
+          kidsSpan.removeChild(more);
+          gNodesLeft = kMaxEagerNodes;
+          appendKids(end, idNums, frames);
+        };
+      }
+    };
+
+    if (!deferKids) {
+      appendKids(0, aNodeIdNums, aOldFrames);
+    } else {
+      // Called by toggleClass() when the node is first expanded.
+      let idNums = aNodeIdNums.slice(), frames = aOldFrames.slice();
+      hasKidsNode.appendKids = () => {
+        gNodesLeft = kMaxEagerNodes;
+        appendKids(0, idNums, frames);
+      };
     }
   }
 }
@@ -1217,6 +1291,7 @@ function sigTree(aT, aSig) {
 function appendTree(aP, aBolds, aCmp, aPc, aSig) {
   sigTree(gRoot, aSig);
 
+  gNodesLeft = kMaxEagerNodes;
   appendTreeInner(gRoot, aP, aBolds, aCmp, aPc, aSig, [1], 0, [], "", "  ");
 }
 
@@ -1258,6 +1333,12 @@ function toggleClass(aEvent) {
   hasKidsNode.classList.toggle("expanded");
   hasKidsNode.classList.toggle("collapsed");
 
+  // Append the kids, if that was deferred.
+  if (hasKidsNode.appendKids) {
+    hasKidsNode.appendKids();
+    delete hasKidsNode.appendKids;
+  }
+
   // Element order: 0: treeline span, 1: arrow span, ...
   let arrowSpan = hasKidsNode.childNodes[1];
   assertClassListContains(arrowSpan, ["arrow"]);
@@ -1433,6 +1514,8 @@ function onLoad() {
                                   "at 65534; larger counts are treated as " +
                                   "infinity");
   appendElementWithText(ul, "li", "'〃' (in accesses): same as previous entry");
+  appendElementWithText(ul, "li", "'[N more children]': click to show them " +
+                                  "(large trees are shown in parts)");
 
   // The timings div.
   gTimingsDiv = appendElement(document.body, "div", "timings noselect");
@@ -263,6 +263,38 @@ static __inline__ void bm0_set_range(UWord* bm0,
       |= (((UWord)1 << size) - 1) << uword_lsb(a);
 }
 
+/**
+ * Set the bits corresponding to all of the addresses in range
+ * [ a1 << ADDR_IGNORED_BITS .. a2 << ADDR_IGNORED_BITS ] in bitmap bm0.
+ * Unlike bm0_set_range(), the range may span several UWords, which are
+ * filled a whole word at a time.
+ */
+static __inline__ void bm0_set_between(UWord* bm0,
+                                       const UWord a1, const UWord a2)
+{
+   const UWord k1 = uword_msb(a1);
+   const UWord k2 = uword_msb(a2);
+   const UWord first_mask = ~(UWord)0 << uword_lsb(a1);
+   const UWord last_mask = ~(UWord)0 >> (BITS_PER_UWORD - 1 - uword_lsb(a2));
+   UWord k;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a1 <= a2);
+   tl_assert(address_msb(make_address(0, a2)) == 0);
+#endif
+   if (k1 == k2)
+   {
+      bm0[k1] |= first_mask & last_mask;
+      return;
+   }
+   bm0[k1] |= first_mask;
+   for (k = k1 + 1; k < k2; k++)
+   {
+      bm0[k] = ~(UWord)0;
+   }
+   bm0[k2] |= last_mask;
+}
+
 /** Clear the bit corresponding to address a in bitmap bm0. */
 static __inline__ void bm0_clear(UWord* bm0, const UWord a)
 {
@@ -323,6 +355,37 @@ static __inline__ UWord bm0_is_any_set(const UWord* bm0,
    return (bm0[uword_msb(a)] & ((((UWord)1 << size) - 1) << uword_lsb(a)));
 }
 
+/**
+ * Return true if a bit corresponding to any of the addresses in range
+ * [ a1 << ADDR_IGNORED_BITS .. a2 << ADDR_IGNORED_BITS ] is set in bm0.
+ * Unlike bm0_is_any_set(), the range may span several UWords, which are
+ * tested a whole word at a time.
+ */
+static __inline__ UWord bm0_is_any_set_between(const UWord* bm0,
+                                               const UWord a1, const UWord a2)
+{
+   const UWord k1 = uword_msb(a1);
+   const UWord k2 = uword_msb(a2);
+   const UWord first_mask = ~(UWord)0 << uword_lsb(a1);
+   const UWord last_mask = ~(UWord)0 >> (BITS_PER_UWORD - 1 - uword_lsb(a2));
+   UWord k;
+
+#ifdef ENABLE_DRD_CONSISTENCY_CHECKS
+   tl_assert(a1 <= a2);
+   tl_assert(address_msb(make_address(0, a2)) == 0);
+#endif
+   if (k1 == k2)
+      return bm0[k1] & first_mask & last_mask;
+   if (bm0[k1] & first_mask)
+      return True;
+   for (k = k1 + 1; k < k2; k++)
+   {
+      if (bm0[k])
+         return True;
+   }
+   return bm0[k2] & last_mask;
+}
+
 
 
 /*********************************************************************/
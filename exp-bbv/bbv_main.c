@@ -41,6 +41,7 @@
 #include "pub_tool_libcbase.h"   /* VG_(strlen) */
 #include "pub_tool_libcprint.h"  /* VG_(printf) */
 #include "pub_tool_libcassert.h" /* VG_(exit) */
+#include "pub_tool_libcfile.h"    /* VG_(open) */
 #include "pub_tool_mallocfree.h" /* VG_(malloc) */
 #include "pub_tool_machine.h"    /* VG_(fnptr_to_fnentry) */
 #include "pub_tool_debuginfo.h"  /* VG_(get_fnname) */
@@ -66,6 +67,24 @@ static HChar *bb_out_file=NULL;
 static Bool instr_count_only=False;
 static Bool generate_pc_file=False;
 
+   /* output formats, see the <bbv-manual.fileformat> section of the manual */
+#define BB_OUT_TEXT      0
+#define BB_OUT_BINARY    1
+#define BB_OUT_PROJECTED 2
+static Int bb_out_format=BB_OUT_TEXT;
+
+   /* number of dimensions of the projected vectors; 15 is what */
+   /*   SimPoint projects to by default                         */
+#define DEFAULT_PROJECTION_DIMS 15
+#define MAX_PROJECTION_DIMS     1000
+static Int projection_dims=DEFAULT_PROJECTION_DIMS;
+
+   /* binary format */
+#define BB_BIN_MAGIC     "bbvbin1\n"
+#define BB_BIN_MAGIC_LEN 8
+#define BB_BIN_END       0   /* followed by a string: the final comments */
+#define BB_BIN_INTERVAL  1   /* followed by block/frequency pairs, then 0 */
+
    /* Global values */
 static OSet* instr_info_table;  /* table that holds the basic block info */
 static Int block_num=1;         /* global next block number */
@@ -82,7 +101,15 @@ struct thread_info {
    ULong global_rep_count;
    ULong unique_rep_count;
    ULong fldcw_count;       /* fldcw count */
-   VgFile *bbtrace_fp;      /* file pointer */
+   VgFile *bbtrace_fp;      /* file pointer (text and projected formats) */
+   struct bin_out *bbtrace_bin; /* output buffer (binary format) */
+};
+
+   /* Buffered output of one thread's binary BBV file */
+struct bin_out {
+   Int   fd;
+   Int   used;
+   UChar buf[65536];
 };
 
 struct BB_info {
@@ -123,7 +150,61 @@ static void dumpPcFile(void)
    VG_(fclose)(fp);
 }
 
-static VgFile *open_tracefile(Int thread_num)
+static void bin_flush(struct bin_out *out)
+{
+   Int done=0;
+
+   while (done < out->used) {
+      Int n=VG_(write)(out->fd, out->buf + done, out->used - done);
+      if (n <= 0) {
+         VG_(umsg)("Error: cannot write bb file\n");
+         VG_(exit)(1);
+      }
+      done+=n;
+   }
+   out->used=0;
+}
+
+static void bin_bytes(struct bin_out *out, const void *p, Int len)
+{
+   const UChar *s=p;
+
+   while (len > 0) {
+      Int n=sizeof(out->buf) - out->used;
+      if (n == 0) {
+         bin_flush(out);
+         n=sizeof(out->buf);
+      }
+      if (n > len) n=len;
+      VG_(memcpy)(out->buf + out->used, s, n);
+      out->used+=n;
+      s+=n;
+      len-=n;
+   }
+}
+
+   /* unsigned LEB128, at most 10 bytes */
+static void bin_varint(struct bin_out *out, ULong u)
+{
+   if (out->used + 10 > sizeof(out->buf)) {
+      bin_flush(out);
+   }
+   while (u >= 0x80) {
+      out->buf[out->used++]=(UChar)(u | 0x80);
+      u >>= 7;
+   }
+   out->buf[out->used++]=(UChar)u;
+}
+
+static void bin_close(struct bin_out *out)
+{
+   bin_flush(out);
+   VG_(close)(out->fd);
+   VG_(free)(out);
+}
+
+   /* Open the output file of a thread, in the selected format */
+static void open_tracefile(Int thread_num)
 {
    VgFile *fp;
    // Allocate a buffer large enough for the general case "%s.%d" below
@@ -139,6 +220,24 @@ static VgFile *open_tracefile(Int thread_num)
       VG_(sprintf)(temp_string,"%s.%d",bb_out_file,thread_num);
    }
 
+   if (bb_out_format == BB_OUT_BINARY) {
+      SysRes sres = VG_(open)(temp_string,
+                              VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
+                              VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IWGRP);
+      struct bin_out *out;
+
+      if (sr_isError(sres)) {
+         VG_(umsg)("Error: cannot create bb file %s\n",temp_string);
+         VG_(exit)(1);
+      }
+      out=VG_(malloc)("bbv.bin_out", sizeof(struct bin_out));
+      out->fd=sr_Res(sres);
+      out->used=0;
+      bin_bytes(out, BB_BIN_MAGIC, BB_BIN_MAGIC_LEN);
+      bbv_thread[thread_num].bbtrace_bin=out;
+      return;
+   }
+
    fp = VG_(fopen)(temp_string, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_WRONLY,
                    VKI_S_IRUSR|VKI_S_IWUSR|VKI_S_IRGRP|VKI_S_IWGRP);
 
@@ -147,37 +246,124 @@ static VgFile *open_tracefile(Int thread_num)
       VG_(exit)(1);
    }
 
-   return fp;
+   bbv_thread[thread_num].bbtrace_fp=fp;
 }
 
-static void handle_overflow(void)
+static Bool tracefile_is_open(Int thread_num)
+{
+   return bbv_thread[thread_num].bbtrace_fp != NULL
+          || bbv_thread[thread_num].bbtrace_bin != NULL;
+}
+
+   /* Write one interval as text: a T followed by block:frequency pairs */
+static void write_interval_text(void)
 {
    struct BB_info *bb_elem;
+   VgFile *fp=bbv_thread[current_thread].bbtrace_fp;
+
+   VG_(fprintf)(fp, "T");
+
+   VG_(OSetGen_ResetIter)(instr_info_table);
+   while ( (bb_elem = VG_(OSetGen_Next)(instr_info_table)) ) {
+      if ( bb_elem->inst_counter[current_thread] != 0 ) {
+         VG_(fprintf)(fp, ":%d:%d   ",
+                      bb_elem->block_num,
+                      bb_elem->inst_counter[current_thread]);
+         bb_elem->inst_counter[current_thread] = 0;
+      }
+   }
 
+   VG_(fprintf)(fp, "\n");
+}
+
+   /* Write one interval in binary.  Block numbers are stored as     */
+   /*   zig-zag coded deltas from the previous pair: they are unique, */
+   /*   so a delta is never zero, and zero ends the interval.         */
+static void write_interval_binary(void)
+{
+   struct BB_info *bb_elem;
+   struct bin_out *out=bbv_thread[current_thread].bbtrace_bin;
+   Long prev_block=0;
+
+   bin_varint(out, BB_BIN_INTERVAL);
+
+   VG_(OSetGen_ResetIter)(instr_info_table);
+   while ( (bb_elem = VG_(OSetGen_Next)(instr_info_table)) ) {
+      if ( bb_elem->inst_counter[current_thread] != 0 ) {
+         Long delta=bb_elem->block_num - prev_block;
+         bin_varint(out, ((ULong)delta << 1) ^ (ULong)(delta >> 63));
+         bin_varint(out, (UInt)bb_elem->inst_counter[current_thread]);
+         prev_block=bb_elem->block_num;
+         bb_elem->inst_counter[current_thread] = 0;
+      }
+   }
+
+   bin_varint(out, 0);
+}
+
+   /* Element (block, dim) of the random projection matrix, uniformly */
+   /*   distributed in [-1,1].  It is a hash of its coordinates, so    */
+   /*   the matrix needs no storage and is the same on every run.      */
+static Double projection_coeff(Int block, Int dim)
+{
+   ULong h=((ULong)block << 32 | (UInt)dim) + 0x9e3779b97f4a7c15ULL;
+
+   h=(h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   h=(h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+   h=h ^ (h >> 31);
+   return (Double)(h >> 11) / (Double)(1ULL << 52) - 1.0;
+}
+
+   /* Write one interval as a projected vector: the frequencies are   */
+   /*   normalised to sum to one and multiplied by the random matrix, */
+   /*   as SimPoint does before clustering.                           */
+static void write_interval_projected(void)
+{
+   struct BB_info *bb_elem;
+   VgFile *fp=bbv_thread[current_thread].bbtrace_fp;
+   Double vec[projection_dims];
+   Double total=0.0;
+   Int d;
+
+   for (d=0;d<projection_dims;d++) vec[d]=0.0;
+
+   VG_(OSetGen_ResetIter)(instr_info_table);
+   while ( (bb_elem = VG_(OSetGen_Next)(instr_info_table)) ) {
+      Int count=bb_elem->inst_counter[current_thread];
+      if ( count != 0 ) {
+         for (d=0;d<projection_dims;d++) {
+            vec[d]+=count * projection_coeff(bb_elem->block_num, d);
+         }
+         total+=count;
+         bb_elem->inst_counter[current_thread] = 0;
+      }
+   }
+
+   for (d=0;d<projection_dims;d++) {
+      VG_(fprintf)(fp, d == 0 ? "%.6f" : " %.6f",
+                   total > 0.0 ? vec[d] / total : 0.0);
+   }
+   VG_(fprintf)(fp, "\n");
+}
+
+static void handle_overflow(void)
+{
    if (bbv_thread[current_thread].dyn_instr > interval_size) {
 
       if (!instr_count_only) {
 
             /* If our output file hasn't been opened, open it */
-         if (bbv_thread[current_thread].bbtrace_fp == NULL) {
-            bbv_thread[current_thread].bbtrace_fp=open_tracefile(current_thread);
+         if (!tracefile_is_open(current_thread)) {
+            open_tracefile(current_thread);
          }
 
            /* put an entry to the bb.out file */
-
-         VG_(fprintf)(bbv_thread[current_thread].bbtrace_fp, "T");
-
-         VG_(OSetGen_ResetIter)(instr_info_table);
-         while ( (bb_elem = VG_(OSetGen_Next)(instr_info_table)) ) {
-            if ( bb_elem->inst_counter[current_thread] != 0 ) {
-               VG_(fprintf)(bbv_thread[current_thread].bbtrace_fp, ":%d:%d   ",
-                            bb_elem->block_num,
-                            bb_elem->inst_counter[current_thread]);
-               bb_elem->inst_counter[current_thread] = 0;
-            }
+         switch (bb_out_format) {
+            case BB_OUT_TEXT:      write_interval_text();      break;
+            case BB_OUT_BINARY:    write_interval_binary();    break;
+            case BB_OUT_PROJECTED: write_interval_projected(); break;
+            default:               tl_assert(0);
          }
-
-         VG_(fprintf)(bbv_thread[current_thread].bbtrace_fp, "\n");
       }
 
       bbv_thread[current_thread].dyn_instr -= interval_size;
@@ -477,6 +663,7 @@ static struct thread_info *allocate_new_thread(struct thread_info *old,
       temp[i].rep_count=0;
       temp[i].fldcw_count=0;
       temp[i].bbtrace_fp=NULL;
+      temp[i].bbtrace_bin=NULL;
    }
       /* expand the inst_counter on all allocated basic blocks */
    VG_(OSetGen_ResetIter)(instr_info_table);
@@ -529,6 +716,14 @@ static Bool bbv_process_cmd_line_option(const HChar* arg)
       generate_pc_file = True;
    }
    else if VG_BOOL_CLO (arg, "--instr-count-only", instr_count_only) {}
+   else if VG_XACT_CLO (arg, "--bb-out-format=text",
+                        bb_out_format, BB_OUT_TEXT) {}
+   else if VG_XACT_CLO (arg, "--bb-out-format=binary",
+                        bb_out_format, BB_OUT_BINARY) {}
+   else if VG_XACT_CLO (arg, "--bb-out-format=projected",
+                        bb_out_format, BB_OUT_PROJECTED) {}
+   else if VG_BINT_CLO (arg, "--projection-dims",  projection_dims,
+                        1, MAX_PROJECTION_DIMS) {}
    else {
       return False;
    }
@@ -543,6 +738,8 @@ static void bbv_print_usage(void)
 "   --pc-out-file=<file>       filename for BB addresses and function names\n"
 "   --interval-size=<num>      interval size\n"
 "   --instr-count-only=yes|no  only print total instruction count\n"
+"   --bb-out-format=text|binary|projected  format of the BBV file [text]\n"
+"   --projection-dims=<num>    dimensions of projected vectors [15]\n"
    );
 }
 
@@ -582,12 +779,22 @@ static void bbv_fini(Int exitcode)
          VG_(umsg)("%s\n", buf);
 
             /* open the output file if it hasn't already */
-         if (bbv_thread[i].bbtrace_fp == NULL) {
-            bbv_thread[i].bbtrace_fp=open_tracefile(i);
+         if (!tracefile_is_open(i)) {
+            open_tracefile(i);
          }
             /* Also print to results file */
-         VG_(fprintf)(bbv_thread[i].bbtrace_fp, "%s", buf);
-         VG_(fclose)(bbv_thread[i].bbtrace_fp);
+         if (bb_out_format == BB_OUT_BINARY) {
+            struct bin_out *out=bbv_thread[i].bbtrace_bin;
+            Int len=VG_(strlen)(buf);
+            bin_varint(out, BB_BIN_END);
+            bin_varint(out, len);
+            bin_bytes(out, buf, len);
+            bin_close(out);
+         }
+         else {
+            VG_(fprintf)(bbv_thread[i].bbtrace_fp, "%s", buf);
+            VG_(fclose)(bbv_thread[i].bbtrace_fp);
+         }
       }
    }
 }
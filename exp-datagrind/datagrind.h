@@ -67,8 +67,16 @@ typedef enum
    VG_USERREQ__UNTRACK_RANGE,
    VG_USERREQ__START_EVENT,
    VG_USERREQ__END_EVENT,
-
-   _VG_USERREQ__DATAGRIND_RECORD_OVERLAP_ERROR = VG_USERREQ_TOOL_BASE('D', 'G') + 256
+   VG_USERREQ__DATAGRIND_START_INSTRUMENTATION,
+   VG_USERREQ__DATAGRIND_STOP_INSTRUMENTATION,
+   VG_USERREQ__DATAGRIND_DUMP_RING,
+   VG_USERREQ__DATAGRIND_HEAP_SNAPSHOT,
+
+   _VG_USERREQ__DATAGRIND_RECORD_OVERLAP_ERROR = VG_USERREQ_TOOL_BASE('D', 'G') + 256,
+   /* From the replacements in dg_replace_strmem.c */
+   _VG_USERREQ__DATAGRIND_BULK_ACCESS,
+   /* From the wrappers in dg_intercepts.c */
+   _VG_USERREQ__DATAGRIND_LOCK
 } Vg_DataGrindClientRequest;
 
 /* Specify that an address range contains a structure of a specific type, with
@@ -112,4 +120,30 @@ typedef enum
     _qzz_res;                                                             \
    }))
 
+/* Start recording accesses, if it was stopped or disabled with
+ * --datagrind-instr-atstart=no.
+ */
+#define DATAGRIND_START_INSTRUMENTATION                                   \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(                                       \
+      VG_USERREQ__DATAGRIND_START_INSTRUMENTATION, 0, 0, 0, 0, 0)
+
+/* Stop recording accesses. Until restarted, the program runs without any
+ * tracing instrumentation.
+ */
+#define DATAGRIND_STOP_INSTRUMENTATION                                    \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(                                       \
+      VG_USERREQ__DATAGRIND_STOP_INSTRUMENTATION, 0, 0, 0, 0, 0)
+
+/* With --datagrind-ring-size, write what is in the ring to a new file.
+ * Does nothing otherwise.
+ */
+#define DATAGRIND_DUMP_RING                                               \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(                                       \
+      VG_USERREQ__DATAGRIND_DUMP_RING, 0, 0, 0, 0, 0)
+
+/* Write the heap blocks that are live now, in address order. */
+#define DATAGRIND_HEAP_SNAPSHOT                                           \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(                                       \
+      VG_USERREQ__DATAGRIND_HEAP_SNAPSHOT, 0, 0, 0, 0, 0)
+
 #endif /* !__DATAGRIND_H */
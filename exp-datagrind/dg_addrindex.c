@@ -0,0 +1,420 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: indexes a trace by address.        dg_addrindex.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_addrindex writes the address index of a trace (see dg_trace.h),
+ * from which dg_stat --who tells which contexts read or wrote an address
+ * and in which chunks, without decoding the trace again.
+ *
+ * The runs are decoded with dgt_decode_parallel. Each thread lists the
+ * page, chunk and context of every data access, and since a thread has a
+ * whole chunk at a time, the list of the chunk it is on can be sorted and
+ * made unique whenever it fills up, so that it grows with the number of
+ * distinct entries rather than with the accesses. The lists of all the
+ * threads are then sorted by page and written out. Fetches of instructions
+ * and the bulk accesses, which have no context, are left out.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+static const char *argv0 = "dg_addrindex";
+static const char *in_name = NULL;
+static const dgt_file *file;
+static unsigned int page_shift = 12;
+
+typedef struct
+{
+   uint64_t page;
+   uint64_t chunk;
+   uint64_t context;
+} entry;
+
+typedef struct
+{
+   entry *entries;
+   size_t n, size;
+   size_t chunk_start;       /* First entry of the chunk being decoded */
+   uint64_t chunk;
+} entries;
+
+static entries all;
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: writes the index by address of a Datagrind trace, for dg_stat --who\n"
+"usage: %s [options] trace\n"
+"    -o <file>          where to write it [<trace>.addrindex]\n"
+"    --page-shift=<n>   index pages of 2^n bytes, from 6 to 30 [12]\n"
+"    --threads=<n>      threads to decode with [one per processor]\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static void out_of_memory(void)
+{
+   fprintf(stderr, "%s: out of memory\n", argv0);
+   exit(1);
+}
+
+static void *grow(void *array, size_t n, size_t *size, size_t elem_size)
+{
+   if (n + 1 > *size)
+   {
+      size_t new_size = *size > 0 ? *size * 2 : 256;
+
+      while (new_size < n + 1)
+         new_size *= 2;
+      array = realloc(array, new_size * elem_size);
+      if (array == NULL)
+         out_of_memory();
+      *size = new_size;
+   }
+   return array;
+}
+
+static void bad_trace(int err)
+{
+   fprintf(stderr, "%s: %s: %s\n", argv0, in_name, dgt_strerror(err));
+   exit(1);
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+   const entry *ea = a, *eb = b;
+
+   if (ea->page != eb->page)
+      return ea->page < eb->page ? -1 : 1;
+   if (ea->chunk != eb->chunk)
+      return ea->chunk < eb->chunk ? -1 : 1;
+   if (ea->context != eb->context)
+      return ea->context < eb->context ? -1 : 1;
+   return 0;
+}
+
+/* Sorts the entries from start and drops the repeats among them */
+static void compact(entries *es, size_t start)
+{
+   size_t i, j;
+
+   qsort(es->entries + start, es->n - start, sizeof(entry), cmp_entry);
+   for (i = j = start; i < es->n; i++)
+      if (j == start || cmp_entry(&es->entries[j - 1], &es->entries[i]) != 0)
+         es->entries[j++] = es->entries[i];
+   es->n = j;
+}
+
+static void add_entry(entries *es, uint64_t page, uint64_t context)
+{
+   if (es->n == es->size)
+   {
+      compact(es, es->chunk_start);
+      /* Only grow if that did not leave enough room */
+      if (es->n >= es->size / 2)
+         es->entries = grow(es->entries, es->size, &es->size, sizeof(entry));
+   }
+   es->entries[es->n].page = page;
+   es->entries[es->n].chunk = es->chunk;
+   es->entries[es->n].context = context;
+   es->n++;
+}
+
+/* The number in the index of the chunk whose record is at offset */
+static uint64_t chunk_number(uint64_t offset)
+{
+   size_t l = 0, r = dgt_file_n_chunks(file);
+
+   while (r - l > 1)
+   {
+      size_t mid = l + (r - l) / 2;
+
+      if (dgt_file_chunk(file, mid)->offset <= offset)
+         l = mid;
+      else
+         r = mid;
+   }
+   return l;
+}
+
+static void *worker_new(void *arg)
+{
+   (void) arg;
+   return calloc(1, sizeof(entries));
+}
+
+static int worker_item(void *worker, const dgt_decoder *decoder, int kind,
+                       const dgt_record *record, const dgt_run *run)
+{
+   entries *es = worker;
+   uint32_t i;
+
+   (void) decoder;
+   if (kind == DGT_ITEM_RECORD && record->type == DG_R_CHUNK && dgt_file_has_index(file))
+   {
+      compact(es, es->chunk_start);
+      es->chunk_start = es->n;
+      es->chunk = chunk_number(record->offset);
+   }
+   if (kind != DGT_ITEM_RUN)
+      return 0;
+   for (i = 0; i < run->n_accesses; i++)
+   {
+      const dgt_access *a = &run->accesses[i];
+      uint64_t page, last;
+
+      if (a->dir == DG_ACC_EXEC)
+         continue;
+      page = a->addr >> page_shift;
+      last = (a->addr + (a->size > 0 ? a->size - 1 : 0)) >> page_shift;
+      for (; page <= last; page++)
+         add_entry(es, page, run->context_index);
+   }
+   return 0;
+}
+
+static void worker_merge(void *arg, void *worker)
+{
+   entries *es = worker;
+
+   (void) arg;
+   compact(es, es->chunk_start);
+   if (all.size < all.n + es->n)
+   {
+      all.size = all.n + es->n;
+      all.entries = realloc(all.entries, all.size * sizeof(entry));
+      if (all.entries == NULL && all.size > 0)
+         out_of_memory();
+   }
+   if (es->n > 0)
+      memcpy(all.entries + all.n, es->entries, es->n * sizeof(entry));
+   all.n += es->n;
+   free(es->entries);
+   free(es);
+}
+
+/* The offset of the record of each context, in the order they are numbered */
+static uint64_t *find_contexts(uint64_t *n_contexts)
+{
+   uint64_t *offsets = NULL;
+   size_t n = 0, size = 0;
+   dgt_cursor cursor;
+   dgt_record record;
+   int ret;
+
+   dgt_cursor_init(&cursor, file);
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+      if (record.type == DG_R_CONTEXT)
+      {
+         offsets = grow(offsets, n, &size, sizeof(uint64_t));
+         offsets[n++] = record.offset;
+      }
+   if (ret < 0)
+      bad_trace(ret);
+   *n_contexts = n;
+   return offsets;
+}
+
+static uint8_t *put_le64(uint8_t *p, uint64_t value)
+{
+   int i;
+
+   for (i = 0; i < 8; i++)
+      p[i] = (uint8_t) (value >> (8 * i));
+   return p + 8;
+}
+
+static uint8_t *put_uvarint(uint8_t *p, uint64_t value)
+{
+   while (value >= 0x80)
+   {
+      *p++ = (uint8_t) (value | 0x80);
+      value >>= 7;
+   }
+   *p++ = (uint8_t) value;
+   return p;
+}
+
+typedef struct
+{
+   uint8_t *data;
+   size_t n, size;
+} bytes;
+
+static void add_uvarint(bytes *b, uint64_t value)
+{
+   while (b->n + 10 > b->size)
+      b->data = grow(b->data, b->size, &b->size, 1);
+   b->n = put_uvarint(b->data + b->n, value) - b->data;
+}
+
+/* Encodes the sorted entries into the pages and their postings */
+static void encode(bytes *pages, bytes *postings, uint64_t *n_pages)
+{
+   size_t i = 0, j;
+
+   *n_pages = 0;
+   while (i < all.n)
+   {
+      uint64_t page = all.entries[i].page, chunk = 0;
+
+      while (pages->n + 16 > pages->size)
+         pages->data = grow(pages->data, pages->size, &pages->size, 1);
+      put_le64(put_le64(pages->data + pages->n, page), postings->n);
+      pages->n += 16;
+      (*n_pages)++;
+      for (; i < all.n && all.entries[i].page == page; i = j)
+      {
+         uint64_t context = 0;
+
+         for (j = i; j < all.n && all.entries[j].page == page
+                     && all.entries[j].chunk == all.entries[i].chunk; j++)
+            ;
+         add_uvarint(postings, all.entries[i].chunk - chunk);
+         add_uvarint(postings, j - i);
+         chunk = all.entries[i].chunk;
+         for (; i < j; i++)
+         {
+            add_uvarint(postings, all.entries[i].context - context);
+            context = all.entries[i].context;
+         }
+      }
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const char *out_name = NULL;
+   unsigned int n_threads = 0;
+   uint64_t *contexts, n_contexts, n_pages;
+   uint8_t header[DGT_ADDR_INDEX_HEADER_SIZE], *p;
+   bytes pages = { NULL, 0, 0 }, postings = { NULL, 0, 0 };
+   dgt_file *in;
+   dgt_defs *defs;
+   dgt_parallel_ops ops;
+   char *default_name = NULL;
+   FILE *out;
+   uint64_t i;
+   int ret;
+
+   if (argv[0])
+      argv0 = argv[0];
+   for (i = 1; i < (uint64_t) argc; i++)
+   {
+      if (strcmp(argv[i], "-o") == 0 && i + 1 < (uint64_t) argc)
+         out_name = argv[++i];
+      else if (strncmp(argv[i], "--page-shift=", 13) == 0)
+      {
+         page_shift = strtoul(argv[i] + 13, NULL, 10);
+         if (page_shift < 6 || page_shift > 30)
+            usage();
+      }
+      else if (strncmp(argv[i], "--threads=", 10) == 0)
+         n_threads = strtoul(argv[i] + 10, NULL, 10);
+      else if (argv[i][0] == '-' || in_name != NULL)
+         usage();
+      else
+         in_name = argv[i];
+   }
+   if (in_name == NULL)
+      usage();
+   if (out_name == NULL)
+   {
+      default_name = malloc(strlen(in_name) + sizeof(".addrindex"));
+      if (default_name == NULL)
+         out_of_memory();
+      sprintf(default_name, "%s.addrindex", in_name);
+      out_name = default_name;
+   }
+
+   ret = dgt_open(in_name, &in);
+   if (ret != DGT_OK)
+      bad_trace(ret);
+   file = in;
+   contexts = find_contexts(&n_contexts);
+   ret = dgt_defs_new(file, n_threads, &defs);
+   if (ret != DGT_OK)
+      bad_trace(ret);
+   if (dgt_defs_n_contexts(defs) != n_contexts)
+      bad_trace(DGT_ERR_FORMAT);
+   ops.arg = NULL;
+   ops.worker_new = worker_new;
+   ops.item = worker_item;
+   ops.merge = worker_merge;
+   ret = dgt_decode_parallel(file, defs, n_threads, &ops);
+   if (ret != DGT_OK)
+      bad_trace(ret);
+   qsort(all.entries, all.n, sizeof(entry), cmp_entry);
+   encode(&pages, &postings, &n_pages);
+
+   p = header;
+   memcpy(p, DGT_ADDR_INDEX_MAGIC, 8);
+   p = put_le64(p + 8, dgt_file_stream_size(file));
+   p = put_le64(p, dgt_file_n_chunks(file));
+   p = put_le64(p, n_contexts);
+   p = put_le64(p, n_pages);
+   p = put_le64(p, page_shift);
+   p = put_le64(p, DGT_ADDR_INDEX_HEADER_SIZE);
+   p = put_le64(p, DGT_ADDR_INDEX_HEADER_SIZE + n_contexts * 8);
+   put_le64(p, DGT_ADDR_INDEX_HEADER_SIZE + n_contexts * 8 + pages.n + postings.n);
+   for (i = 0; i < n_contexts; i++)
+      put_le64((uint8_t *) &contexts[i], contexts[i]);
+
+   out = fopen(out_name, "wb");
+   if (out == NULL)
+   {
+      fprintf(stderr, "%s: cannot create %s: %s\n", argv0, out_name, strerror(errno));
+      return 1;
+   }
+   if (fwrite(header, 1, sizeof(header), out) != sizeof(header)
+       || fwrite(contexts, 8, n_contexts, out) != n_contexts
+       || fwrite(pages.data, 1, pages.n, out) != pages.n
+       || fwrite(postings.data, 1, postings.n, out) != postings.n
+       || fclose(out) != 0)
+   {
+      fprintf(stderr, "%s: cannot write %s: %s\n", argv0, out_name, strerror(errno));
+      return 1;
+   }
+
+   free(contexts);
+   free(all.entries);
+   free(pages.data);
+   free(postings.data);
+   free(default_name);
+   dgt_defs_free(defs);
+   dgt_close(in);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,421 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: co-access graph of objects.         dg_affinity.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-affinity=yes, each access is named by the object it
+ * falls in: an offset in a range registered with DATAGRIND_TRACK_RANGE
+ * (taken modulo --datagrind-affinity-stride, as for the field heat), or
+ * else the allocation stack of the heap block holding it. Accesses to
+ * anything else are left out. When the object changes, the pair of it and
+ * each other object seen in the last --datagrind-affinity-window accesses
+ * gains one, so that objects used together end up joined by heavy edges,
+ * which is what a layout tool wants to put in the same cache line or page.
+ *
+ * There can be far too many pairs to count them all, so only
+ * --datagrind-affinity-pairs of them are, by the space-saving algorithm of
+ * Metwally et al: a pair that is not counted takes the place of the
+ * lightest one, and starts from its count, which is kept as the error.
+ * Each count is then at most its error over the true count, and every
+ * pair heavier than the total over the number of counters is among those
+ * kept.
+ */
+
+/* Offsets at or past this are not told apart */
+#define DG_AFFINITY_OFFSET_BITS 24
+#define DG_AFFINITY_MAX_WINDOW  1024
+
+/* A node is the stack index shifted left by one, or a field with the low
+ * bit set.
+ */
+#define SITE_NODE(stack_index) ((ULong) (stack_index) << 1)
+#define FIELD_NODE(range, offset) \
+   (((((ULong) (range)) << DG_AFFINITY_OFFSET_BITS | (offset)) << 1) | 1)
+
+typedef struct
+{
+   Addr start;
+   Addr end;          /* One past the last byte */
+   Bool active;
+   SizeT fold;        /* Offsets are taken modulo this */
+} DgAffinityRange;
+
+typedef struct
+{
+   ULong node;
+   ULong last;        /* Number of the last access to it */
+} DgAffinityRun;
+
+typedef struct
+{
+   VgHashNode header; /* Key is a hash of the nodes */
+   ULong a, b;        /* a < b */
+   ULong count;
+   ULong error;       /* Count the pair took over */
+   UInt heap_pos;
+} DgAffinityPair;
+
+Bool DG_(clo_affinity) = False;
+static Long clo_affinity_window = 16;
+static Long clo_affinity_pairs = 65536;
+static Long clo_affinity_stride = 0;
+
+static XArray *ranges = NULL;       /* DgAffinityRange, as registered */
+static Word n_active_ranges = 0;
+
+/* The runs of accesses to one node, newest at window_head */
+static DgAffinityRun *window = NULL;
+static UInt window_head = 0;
+static UInt window_used = 0;
+static ULong n_accesses = 0;
+static ULong *seen = NULL;          /* Scratch for the distinct nodes */
+
+static VgHashTable *pair_table = NULL;
+static DgAffinityPair *pairs = NULL;
+static UInt *heap = NULL;           /* Indices in pairs, lightest first */
+static UInt n_pairs = 0;
+
+Bool DG_(affinity_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-affinity", DG_(clo_affinity))) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-affinity-window", clo_affinity_window,
+                        1, DG_AFFINITY_MAX_WINDOW)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-affinity-pairs", clo_affinity_pairs,
+                        16, 1 << 24)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-affinity-stride", clo_affinity_stride,
+                        0, 1 << DG_AFFINITY_OFFSET_BITS)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(affinity_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-affinity=yes|no      count objects accessed together [no]\n"
+"    --datagrind-affinity-window=<n>  accesses that count as together [16]\n"
+"    --datagrind-affinity-pairs=<n>   pairs of objects to keep counts for [65536]\n"
+"    --datagrind-affinity-stride=<n>  take offsets in tracked ranges modulo n [0]\n"
+   );
+}
+
+void DG_(affinity_init)(void)
+{
+   if (!DG_(clo_affinity))
+      return;
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.affinity.ranges", VG_(free),
+                       sizeof(DgAffinityRange));
+   window = VG_(malloc)("datagrind.affinity.window",
+                        clo_affinity_window * sizeof(DgAffinityRun));
+   seen = VG_(malloc)("datagrind.affinity.seen", clo_affinity_window * sizeof(ULong));
+   pair_table = VG_(HT_construct)("datagrind.affinity.pairs");
+   pairs = VG_(malloc)("datagrind.affinity.pairs", clo_affinity_pairs * sizeof(DgAffinityPair));
+   heap = VG_(malloc)("datagrind.affinity.heap", clo_affinity_pairs * sizeof(UInt));
+}
+
+void DG_(affinity_track)(Addr addr, SizeT len)
+{
+   DgAffinityRange range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   range.fold = clo_affinity_stride > 0 && clo_affinity_stride < len
+                ? clo_affinity_stride : len;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(affinity_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgAffinityRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+static Word pair_cmp(const void *n1, const void *n2)
+{
+   const DgAffinityPair *p1 = n1;
+   const DgAffinityPair *p2 = n2;
+   return p1->a == p2->a && p1->b == p2->b ? 0 : 1;
+}
+
+static UWord pair_hash(ULong a, ULong b)
+{
+   ULong h = a * 0x9E3779B97F4A7C15ULL ^ b;
+   return (UWord) (h ^ (h >> 29));
+}
+
+static void heap_swap(UInt i, UInt j)
+{
+   UInt t = heap[i];
+   heap[i] = heap[j];
+   heap[j] = t;
+   pairs[heap[i]].heap_pos = i;
+   pairs[heap[j]].heap_pos = j;
+}
+
+static void heap_up(UInt i)
+{
+   while (i > 0 && pairs[heap[(i - 1) / 2]].count > pairs[heap[i]].count)
+   {
+      heap_swap(i, (i - 1) / 2);
+      i = (i - 1) / 2;
+   }
+}
+
+static void heap_down(UInt i)
+{
+   for (;;)
+   {
+      UInt l = 2 * i + 1, r = l + 1, m = i;
+      if (l < n_pairs && pairs[heap[l]].count < pairs[heap[m]].count)
+         m = l;
+      if (r < n_pairs && pairs[heap[r]].count < pairs[heap[m]].count)
+         m = r;
+      if (m == i)
+         return;
+      heap_swap(i, m);
+      i = m;
+   }
+}
+
+static void bump(ULong u, ULong v)
+{
+   DgAffinityPair key, *pair;
+
+   key.a = u < v ? u : v;
+   key.b = u < v ? v : u;
+   key.header.key = pair_hash(key.a, key.b);
+   pair = VG_(HT_gen_lookup)(pair_table, &key, pair_cmp);
+   if (pair != NULL)
+   {
+      pair->count++;
+      heap_down(pair->heap_pos);
+      return;
+   }
+
+   if (n_pairs < clo_affinity_pairs)
+   {
+      pair = &pairs[n_pairs];
+      pair->count = 1;
+      pair->error = 0;
+      heap[n_pairs] = n_pairs;
+      pair->heap_pos = n_pairs;
+      n_pairs++;
+      heap_up(pair->heap_pos);
+   }
+   else
+   {
+      pair = &pairs[heap[0]];
+      VG_(HT_gen_remove)(pair_table, pair, pair_cmp);
+      pair->error = pair->count;
+      pair->count++;
+      heap_down(0);
+   }
+   pair->header.key = key.header.key;
+   pair->a = key.a;
+   pair->b = key.b;
+   VG_(HT_add_node)(pair_table, pair);
+}
+
+/* The pairs are freed with their array */
+static void free_nothing(void *p)
+{
+}
+
+static Bool find_node(Addr addr, ULong *node)
+{
+   UWord stack_index;
+
+   if (n_active_ranges > 0)
+   {
+      Word n = VG_(sizeXA)(ranges), i;
+
+      for (i = 0; i < n; i++)
+      {
+         const DgAffinityRange *range = VG_(indexXA)(ranges, i);
+
+         if (range->active && addr - range->start < range->end - range->start)
+         {
+            SizeT offset = (addr - range->start) % range->fold;
+            if (offset >= (1 << DG_AFFINITY_OFFSET_BITS))
+               return False;
+            *node = FIELD_NODE(i, offset);
+            return True;
+         }
+      }
+   }
+   if (!DG_(allocstats_site)(addr, &stack_index))
+      return False;
+   *node = SITE_NODE(stack_index);
+   return True;
+}
+
+void DG_(affinity_access)(Addr addr)
+{
+   ULong node;
+   UInt n_seen = 0, k, j;
+
+   if (!find_node(addr, &node))
+      return;
+   n_accesses++;
+   if (window_used > 0 && window[window_head].node == node)
+   {
+      window[window_head].last = n_accesses;
+      return;
+   }
+
+   /* Each other node counts once, however often it was seen */
+   for (k = 0; k < window_used; k++)
+   {
+      const DgAffinityRun *run = &window[(window_head + clo_affinity_window - k)
+                                         % clo_affinity_window];
+      if (n_accesses - run->last > clo_affinity_window)
+         break;
+      if (run->node == node)
+         continue;
+      for (j = 0; j < n_seen && seen[j] != run->node; j++) {}
+      if (j < n_seen)
+         continue;
+      seen[n_seen++] = run->node;
+      bump(node, run->node);
+   }
+
+   window_head = (window_head + 1) % clo_affinity_window;
+   window[window_head].node = node;
+   window[window_head].last = n_accesses;
+   if (window_used < clo_affinity_window)
+      window_used++;
+}
+
+static Int cmp_pair_ptr(const void *a, const void *b)
+{
+   const DgAffinityPair *pa = *(DgAffinityPair * const *) a;
+   const DgAffinityPair *pb = *(DgAffinityPair * const *) b;
+   if (pa->count != pb->count)
+      return pa->count > pb->count ? -1 : 1;
+   if (pa->a != pb->a)
+      return pa->a < pb->a ? -1 : 1;
+   if (pa->b != pb->b)
+      return pa->b < pb->b ? -1 : 1;
+   return 0;
+}
+
+static UChar *encode_node(UChar *p, ULong node)
+{
+   if (node & 1)
+   {
+      node >>= 1;
+      p = put_byte(p, DG_AFFINITY_FIELD);
+      p = encode_uvarint64(p, node >> DG_AFFINITY_OFFSET_BITS);
+      p = encode_uvarint(p, node & ((1 << DG_AFFINITY_OFFSET_BITS) - 1));
+   }
+   else
+   {
+      p = put_byte(p, DG_AFFINITY_SITE);
+      p = encode_uvarint64(p, node >> 1);
+   }
+   return p;
+}
+
+void DG_(affinity_finish)(void)
+{
+   DgAffinityPair **sorted;
+   UChar *payload, *p;
+   UInt i;
+
+   if (ranges == NULL)
+      return;
+   sorted = VG_(malloc)("datagrind.affinity.sorted", (n_pairs + 1) * sizeof(DgAffinityPair *));
+   for (i = 0; i < n_pairs; i++)
+      sorted[i] = &pairs[i];
+   VG_(ssort)(sorted, n_pairs, sizeof(DgAffinityPair *), cmp_pair_ptr);
+
+   p = payload = VG_(malloc)("datagrind.affinity.payload",
+                             (4 + 8 * (SizeT) n_pairs) * DG_MAX_UVARINT_BYTES);
+   p = encode_uvarint(p, clo_affinity_window);
+   p = encode_uvarint(p, clo_affinity_stride);
+   p = encode_uvarint64(p, n_accesses);
+   p = encode_uvarint(p, n_pairs);
+   for (i = 0; i < n_pairs; i++)
+   {
+      p = encode_node(p, sorted[i]->a);
+      p = encode_node(p, sorted[i]->b);
+      p = encode_uvarint64(p, sorted[i]->count);
+      p = encode_uvarint64(p, sorted[i]->error);
+   }
+   out_byte(DG_R_AFFINITY);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+   VG_(free)(sorted);
+
+   VG_(HT_destruct)(pair_table, free_nothing);
+   pair_table = NULL;
+   VG_(free)(pairs);
+   VG_(free)(heap);
+   VG_(free)(window);
+   VG_(free)(seen);
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,304 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: statistics per allocation site. dg_allocstats.c   ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_wordfm.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-alloc-stats=yes, each recorded access is attributed to
+ * the live heap block that contains it, and the bytes read and written,
+ * the lifetime and the fraction of bytes touched are summed per allocation
+ * stack. The totals are written at exit, so the trace does not have to be
+ * joined against the malloc and free records afterwards.
+ *
+ * As in DHAT, live blocks are kept in a WordFM whose comparison treats
+ * overlapping blocks as equal, so that a lookup with a one-byte block
+ * finds the block containing an address. Runs tend to hit the same blocks
+ * over and over, so a two-entry cache is checked first.
+ */
+
+/* Blocks up to this size get a bitmap of the bytes touched */
+#define DG_ALLOCSTATS_TOUCH_LIMIT (1 << 20)
+
+typedef struct
+{
+   Addr payload;
+   SizeT szB;          /* Never 0 in the tree */
+   UWord stack_index;
+   ULong allocated_at; /* Instruction count */
+   ULong read_bytes;
+   ULong write_bytes;
+   UChar *touched;     /* Bit per byte, or NULL if too large */
+} DgStatsBlock;
+
+typedef struct
+{
+   VgHashNode header;   /* Key is the stack index */
+   ULong n_blocks;
+   ULong bytes;
+   ULong read_bytes;
+   ULong write_bytes;
+   ULong lifetime;      /* Total instructions between allocation and free */
+   ULong touch_bytes;   /* Bytes of blocks that have a bitmap... */
+   ULong touched;       /* ...and how many of them were accessed */
+} DgStatsSite;
+
+Bool DG_(clo_alloc_stats) = False;
+
+static WordFM *live_blocks = NULL;   /* DgStatsBlock* -> nothing */
+static VgHashTable *sites = NULL;    /* DgStatsSite */
+static DgStatsBlock *cache0 = NULL, *cache1 = NULL;
+
+Bool DG_(allocstats_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-alloc-stats", DG_(clo_alloc_stats))) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(allocstats_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-alloc-stats=yes|no   count accesses per allocation site [no]\n"
+   );
+}
+
+static Word block_cmp(UWord k1, UWord k2)
+{
+   const DgStatsBlock *b1 = (const DgStatsBlock *) k1;
+   const DgStatsBlock *b2 = (const DgStatsBlock *) k2;
+   if (b1->payload + b1->szB <= b2->payload) return -1;
+   if (b2->payload + b2->szB <= b1->payload) return 1;
+   return 0;
+}
+
+void DG_(allocstats_init)(void)
+{
+   /* The affinity graph names heap blocks by their sites too */
+   if (!DG_(clo_alloc_stats) && !DG_(clo_affinity))
+      return;
+   live_blocks = VG_(newFM)(VG_(malloc), "datagrind.allocstats.live", VG_(free),
+                            block_cmp);
+   sites = VG_(HT_construct)("datagrind.allocstats.sites");
+}
+
+static DgStatsBlock *find_block(Addr a)
+{
+   DgStatsBlock fake;
+   UWord key, val;
+
+   if (LIKELY(cache0 != NULL && a - cache0->payload < cache0->szB))
+      return cache0;
+   if (LIKELY(cache1 != NULL && a - cache1->payload < cache1->szB))
+   {
+      DgStatsBlock *tmp = cache0;
+      cache0 = cache1;
+      cache1 = tmp;
+      return cache0;
+   }
+   fake.payload = a;
+   fake.szB = 1;
+   if (!VG_(lookupFM)(live_blocks, &key, &val, (UWord) &fake))
+      return NULL;
+   cache1 = cache0;
+   cache0 = (DgStatsBlock *) key;
+   return cache0;
+}
+
+Bool DG_(allocstats_site)(Addr a, UWord *stack_index)
+{
+   DgStatsBlock *block;
+
+   if (live_blocks == NULL || (block = find_block(a)) == NULL)
+      return False;
+   *stack_index = block->stack_index;
+   return True;
+}
+
+void DG_(allocstats_new_block)(Addr p, SizeT szB, UWord stack_index, ULong now)
+{
+   DgStatsBlock *block, fake;
+   UWord key, val;
+
+   if (live_blocks == NULL || szB == 0)
+      return;
+   /* A custom allocator may hand out blocks inside its own, and only the
+    * first of overlapping blocks is kept.
+    */
+   fake.payload = p;
+   fake.szB = szB;
+   if (VG_(lookupFM)(live_blocks, &key, &val, (UWord) &fake))
+      return;
+   block = VG_(calloc)("datagrind.allocstats.block", 1, sizeof(DgStatsBlock));
+   block->payload = p;
+   block->szB = szB;
+   block->stack_index = stack_index;
+   block->allocated_at = now;
+   if (szB <= DG_ALLOCSTATS_TOUCH_LIMIT)
+      block->touched = VG_(calloc)("datagrind.allocstats.touched", (szB + 7) / 8, 1);
+   VG_(addToFM)(live_blocks, (UWord) block, 0);
+}
+
+static UWord count_bits(const UChar *bits, SizeT n)
+{
+   UWord count = 0;
+   SizeT i;
+
+   for (i = 0; i < n; i++)
+      if (bits[i >> 3] & (1 << (i & 7)))
+         count++;
+   return count;
+}
+
+/* Adds the totals for a block to its site, and frees it */
+static void retire_block(DgStatsBlock *block, ULong now)
+{
+   DgStatsSite *site = VG_(HT_lookup)(sites, block->stack_index);
+
+   if (site == NULL)
+   {
+      site = VG_(calloc)("datagrind.allocstats.site", 1, sizeof(DgStatsSite));
+      site->header.key = block->stack_index;
+      VG_(HT_add_node)(sites, site);
+   }
+   site->n_blocks++;
+   site->bytes += block->szB;
+   site->read_bytes += block->read_bytes;
+   site->write_bytes += block->write_bytes;
+   site->lifetime += now - block->allocated_at;
+   if (block->touched != NULL)
+   {
+      site->touch_bytes += block->szB;
+      site->touched += count_bits(block->touched, block->szB);
+      VG_(free)(block->touched);
+   }
+   VG_(free)(block);
+}
+
+void DG_(allocstats_free_block)(Addr p, ULong now)
+{
+   DgStatsBlock fake;
+   UWord key, val;
+
+   if (live_blocks == NULL)
+      return;
+   fake.payload = p;
+   fake.szB = 1;
+   if (!VG_(lookupFM)(live_blocks, &key, &val, (UWord) &fake)
+       || ((DgStatsBlock *) key)->payload != p)
+      return;
+   VG_(delFromFM)(live_blocks, NULL, NULL, (UWord) &fake);
+   cache0 = cache1 = NULL;
+   retire_block((DgStatsBlock *) key, now);
+}
+
+void DG_(allocstats_access)(Addr addr, UChar size, UChar dir)
+{
+   DgStatsBlock *block = find_block(addr);
+   SizeT offset, end, i;
+
+   if (block == NULL)
+      return;
+   /* Only the part inside the block counts */
+   offset = addr - block->payload;
+   end = offset + size > block->szB ? block->szB : offset + size;
+   if (DG_ACC_IS_WRITE(dir))
+      block->write_bytes += end - offset;
+   else
+      block->read_bytes += end - offset;
+   if (block->touched != NULL)
+      for (i = offset; i < end; i++)
+         block->touched[i >> 3] |= 1 << (i & 7);
+}
+
+static Int cmp_site_ptr(const void *a, const void *b)
+{
+   const DgStatsSite *sa = *(DgStatsSite * const *) a;
+   const DgStatsSite *sb = *(DgStatsSite * const *) b;
+   if (sa->header.key != sb->header.key)
+      return sa->header.key < sb->header.key ? -1 : 1;
+   return 0;
+}
+
+void DG_(allocstats_finish)(ULong now)
+{
+   UWord key, val;
+   DgStatsSite **nodes;
+   UInt n_nodes, i;
+
+   if (live_blocks == NULL)
+      return;
+
+   /* Blocks still live at exit count as living until now */
+   VG_(initIterFM)(live_blocks);
+   while (VG_(nextIterFM)(live_blocks, &key, &val))
+      retire_block((DgStatsBlock *) key, now);
+   VG_(doneIterFM)(live_blocks);
+   VG_(deleteFM)(live_blocks, NULL, NULL);
+   live_blocks = NULL;
+   cache0 = cache1 = NULL;
+
+   nodes = (DgStatsSite **) VG_(HT_to_array)(sites, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgStatsSite *), cmp_site_ptr);
+   for (i = 0; i < n_nodes && DG_(clo_alloc_stats); i++)
+   {
+      const DgStatsSite *site = nodes[i];
+      UChar payload[7 * 10 + DG_MAX_UVARINT_BYTES];
+      UChar *p = payload;
+
+      p = encode_uvarint(p, site->header.key);
+      p = encode_uvarint64(p, site->n_blocks);
+      p = encode_uvarint64(p, site->bytes);
+      p = encode_uvarint64(p, site->read_bytes);
+      p = encode_uvarint64(p, site->write_bytes);
+      p = encode_uvarint64(p, site->lifetime);
+      p = encode_uvarint64(p, site->touch_bytes);
+      p = encode_uvarint64(p, site->touched);
+      out_byte(DG_R_ALLOC_STATS);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+   }
+   VG_(free)(nodes);
+   VG_(HT_destruct)(sites, VG_(free));
+   sites = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
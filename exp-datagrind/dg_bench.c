@@ -0,0 +1,282 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: measuring how fast traces are read.    dg_bench.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_bench measures how fast libdgtrace reads a trace, so that changes to
+ * the format or the reader can be judged by what they cost analyses as
+ * well as by what they cost Datagrind. perf/dg_bench runs it on traces of
+ * the perf programs written in each encoding.
+ *
+ * It times opening the trace (which decompresses an LZO trace), gathering
+ * the definitions, and decoding every chunk with dgt_decode_parallel at
+ * 1, 2, 4 and so on up to --threads threads, each the best of --reps.
+ * Throughput is given in items (runs, repeats and other records) and
+ * accesses per second, and in GB per second of the record stream. Last,
+ * a decoder is moved to --seeks chunks picked at random, and the time
+ * from dgt_decoder_seek_chunk to the first run of the chunk is the seek
+ * latency.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dg_trace.h"
+
+static const char *argv0 = "dg_bench";
+
+typedef struct
+{
+   uint64_t items;
+   uint64_t accesses;
+} counts;
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: measures how fast a Datagrind trace is read\n"
+"usage: %s [options] trace\n"
+"    --threads=<n>     most threads to decode with [one per processor]\n"
+"    --reps=<n>        times to repeat each measurement, keeping the best [3]\n"
+"    --seeks=<n>       chunks to seek to [100]\n"
+"    --csv             print comma-separated values, without a header\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static double now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *worker_new(void *arg)
+{
+   return calloc(1, sizeof(counts));
+}
+
+static int worker_item(void *worker, const dgt_decoder *decoder, int kind,
+                       const dgt_record *record, const dgt_run *run)
+{
+   counts *c = worker;
+
+   c->items++;
+   if (kind == DGT_ITEM_RUN)
+      c->accesses += run->n_accesses;
+   return 0;
+}
+
+static void worker_merge(void *arg, void *worker)
+{
+   counts *total = arg;
+   counts *c = worker;
+
+   total->items += c->items;
+   total->accesses += c->accesses;
+   free(c);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double da = *(const double *) a;
+   double db = *(const double *) b;
+
+   return da < db ? -1 : da > db;
+}
+
+static void fail(const char *trace_name, int err)
+{
+   fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(err));
+   exit(1);
+}
+
+int main(int argc, char **argv)
+{
+   const char *trace_name = NULL;
+   unsigned int max_threads = 0, n_threads;
+   unsigned int n_reps = 3, n_seeks = 100, i, r;
+   int csv = 0, ret;
+   double t, best, open_secs, defs_secs, *seeks;
+   uint64_t bytes, state = 1;
+   size_t n_chunks;
+   counts total;
+   dgt_file *file;
+   dgt_defs *defs;
+   dgt_decoder *decoder;
+   dgt_parallel_ops ops;
+   dgt_record record;
+   dgt_run run;
+
+   if (argv[0])
+      argv0 = argv[0];
+   for (i = 1; i < (unsigned int) argc; i++)
+   {
+      if (strncmp(argv[i], "--threads=", 10) == 0)
+         max_threads = strtoul(argv[i] + 10, NULL, 10);
+      else if (strncmp(argv[i], "--reps=", 7) == 0)
+      {
+         n_reps = strtoul(argv[i] + 7, NULL, 10);
+         if (n_reps == 0)
+            usage();
+      }
+      else if (strncmp(argv[i], "--seeks=", 8) == 0)
+         n_seeks = strtoul(argv[i] + 8, NULL, 10);
+      else if (strcmp(argv[i], "--csv") == 0)
+         csv = 1;
+      else if (argv[i][0] == '-' || trace_name != NULL)
+         usage();
+      else
+         trace_name = argv[i];
+   }
+   if (trace_name == NULL)
+      usage();
+   if (max_threads == 0)
+   {
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      max_threads = n > 0 ? n : 1;
+   }
+
+   /* Opening and gathering the definitions are done once per rep, and
+    * the last of each is kept for the decodes.
+    */
+   open_secs = defs_secs = 0.0;
+   file = NULL;
+   defs = NULL;
+   for (r = 0; r < n_reps; r++)
+   {
+      if (defs != NULL)
+         dgt_defs_free(defs);
+      if (file != NULL)
+         dgt_close(file);
+      t = now();
+      ret = dgt_open(trace_name, &file);
+      if (ret != DGT_OK)
+         fail(trace_name, ret);
+      t = now() - t;
+      if (r == 0 || t < open_secs)
+         open_secs = t;
+      t = now();
+      ret = dgt_defs_new(file, max_threads, &defs);
+      if (ret != DGT_OK)
+         fail(trace_name, ret);
+      t = now() - t;
+      if (r == 0 || t < defs_secs)
+         defs_secs = t;
+   }
+   bytes = dgt_file_stream_size(file);
+   n_chunks = dgt_file_n_chunks(file);
+
+   if (!csv)
+   {
+      printf("Trace:         %s\n", trace_name);
+      printf("Stream bytes:  %llu in %llu chunks, %s\n", (unsigned long long) bytes,
+             (unsigned long long) n_chunks,
+             dgt_file_header(file)->compression == DG_COMPRESS_LZO
+             ? "LZO compressed" : "uncompressed");
+      printf("Open:          %.4f s, %.2f GB/s\n", open_secs, bytes / open_secs / 1e9);
+      printf("Definitions:   %.4f s on %u threads\n", defs_secs, max_threads);
+      printf("\n%7s %10s %12s %12s %8s\n", "Threads", "Decode s", "Items/s", "Accesses/s", "GB/s");
+   }
+
+   ops.arg = &total;
+   ops.worker_new = worker_new;
+   ops.item = worker_item;
+   ops.merge = worker_merge;
+   for (n_threads = 1;; n_threads = n_threads * 2 < max_threads ? n_threads * 2 : max_threads)
+   {
+      best = 0.0;
+      for (r = 0; r < n_reps; r++)
+      {
+         memset(&total, 0, sizeof(total));
+         t = now();
+         ret = dgt_decode_parallel(file, defs, n_threads, &ops);
+         if (ret != DGT_OK)
+            fail(trace_name, ret);
+         t = now() - t;
+         if (r == 0 || t < best)
+            best = t;
+      }
+      if (csv)
+         printf("decode,%u,%.6f,%llu,%llu,%llu\n", n_threads, best,
+                (unsigned long long) total.items, (unsigned long long) total.accesses,
+                (unsigned long long) bytes);
+      else
+         printf("%7u %10.4f %12.0f %12.0f %8.3f\n", n_threads, best,
+                total.items / best, total.accesses / best, bytes / best / 1e9);
+      if (n_threads >= max_threads)
+         break;
+   }
+
+   if (n_chunks > 0 && n_seeks > 0)
+   {
+      ret = dgt_decoder_new_shared(file, defs, &decoder);
+      if (ret != DGT_OK)
+         fail(trace_name, ret);
+      seeks = malloc(n_seeks * sizeof(double));
+      if (seeks == NULL)
+         fail(trace_name, DGT_ERR_NOMEM);
+      for (i = 0; i < n_seeks; i++)
+      {
+         size_t chunk;
+
+         /* A fixed sequence, so that runs seek to the same chunks */
+         state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+         chunk = (state >> 33) % n_chunks;
+         t = now();
+         ret = dgt_decoder_seek_chunk(decoder, chunk);
+         if (ret != DGT_OK)
+            fail(trace_name, ret);
+         do
+            ret = dgt_decoder_next(decoder, &record, &run);
+         while (ret == DGT_ITEM_RECORD);
+         if (ret < 0)
+            fail(trace_name, ret);
+         seeks[i] = now() - t;
+      }
+      qsort(seeks, n_seeks, sizeof(double), cmp_double);
+      if (csv)
+         printf("seek,%u,%.9f,%.9f\n", n_seeks, seeks[n_seeks / 2], seeks[n_seeks - 1]);
+      else
+         printf("\nSeek:          %u to a run, median %.1f us, max %.1f us\n",
+                n_seeks, seeks[n_seeks / 2] * 1e6, seeks[n_seeks - 1] * 1e6);
+      free(seeks);
+      dgt_decoder_free(decoder);
+   }
+
+   dgt_defs_free(defs);
+   dgt_close(file);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
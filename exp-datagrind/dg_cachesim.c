@@ -0,0 +1,459 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: cache simulation of the accesses. dg_cachesim.c  ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_threadstate.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* We sneakily include the cache configuration and simulator from
+ * cachegrind, as callgrind does, so that the results match a cachegrind
+ * run with the same --D1 and --LL.
+ */
+#include "cg_arch.c"
+/* Only needed for instruction fetches, which are not simulated */
+static Bool cachesim_is_IrNoX(Addr a, UChar size) __attribute__((unused));
+/* Recorded accesses are simulated as one thread */
+static void cachesim_switch_thread(ThreadId tid) __attribute__((unused));
+static void cachesim_initprefetch(Int kind, Int degree) __attribute__((unused));
+#include "cg_sim.c"
+
+/* With --datagrind-cache-sim=yes, the recorded data accesses are fed in
+ * order to cachegrind's D1 and LL simulation, and the references and
+ * misses are counted for each access of each context. They are written
+ * out at exit, after a record describing the caches. Instruction fetches
+ * are not simulated, so LL only sees data.
+ *
+ * With --datagrind-prefetch, a prefetcher fills LL ahead of the accesses,
+ * as the streamers of real L2 caches do. The next-line prefetcher follows
+ * each LL miss, and each first use of a prefetched line, with the next
+ * lines in the same page. The stride prefetcher keeps the last address and
+ * stride of each access of each context, and once the stride has come
+ * twice in a row fetches the lines that many strides ahead. A line is
+ * kept in a table from its prefetch until a D1 miss hits it in LL, which
+ * is a miss the prefetch covered, or until it is evicted unused, which
+ * makes the prefetch useless; both are counted against the access that
+ * issued the prefetch.
+ */
+
+#define DG_PREFETCH_NONE      0
+#define DG_PREFETCH_NEXT_LINE 1
+#define DG_PREFETCH_STRIDE    2
+#define DG_PREFETCH_BOTH      3
+
+/* The next-line prefetcher does not cross pages of this size */
+#define DG_PREFETCH_PAGE_SHIFT 12
+
+typedef struct
+{
+   ULong refs;
+   ULong d1_misses;
+   ULong ll_misses;
+   ULong prefetches;   /* Lines this access had prefetched into LL */
+   ULong covered;      /* D1 misses that hit a prefetched line */
+   ULong useless;      /* Prefetched lines evicted or left unused */
+   Addr last;          /* For the stride prefetcher */
+   Word stride;
+   UInt confirmed;
+   UWord last_block;   /* Last block the stride prefetcher asked for */
+} DgCacheCounts;
+
+/* A prefetched line that has not been used yet */
+typedef struct DgPrefetched
+{
+   struct DgPrefetched *next;
+   UWord key;          /* LL block */
+   UWord context_index;
+   Word access;
+} DgPrefetched;
+
+typedef struct DgCacheContext
+{
+   struct DgCacheContext *next;
+   UWord key;          /* Context index */
+   Word n_accesses;
+   DgCacheCounts counts[];
+} DgCacheContext;
+
+Bool DG_(clo_cache_sim) = False;
+
+static cache_t clo_I1_cache = UNDEFINED_CACHE;
+static cache_t clo_D1_cache = UNDEFINED_CACHE;
+static cache_t clo_LL_cache = UNDEFINED_CACHE;
+static cache_t D1c, LLc;
+static Int min_line_size;
+
+static Int clo_prefetch = DG_PREFETCH_NONE;
+static Long clo_prefetch_degree = 2;
+
+static VgHashTable *contexts = NULL;   /* DgCacheContext */
+static DgCacheContext *last_context = NULL;
+static VgHashTable *prefetched = NULL; /* DgPrefetched */
+static UInt max_prefetched;            /* Before the evicted lines are swept */
+
+Bool DG_(cachesim_process_cmd_line_option)(const HChar *arg)
+{
+   const HChar *tmp_str;
+
+   if (VG_(str_clo_cache_opt)(arg, &clo_I1_cache, &clo_D1_cache, &clo_LL_cache)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-cache-sim", DG_(clo_cache_sim))) {}
+   else if (VG_STR_CLO(arg, "--datagrind-prefetch", tmp_str))
+   {
+      if (VG_(strcmp)(tmp_str, "none") == 0)
+         clo_prefetch = DG_PREFETCH_NONE;
+      else if (VG_(strcmp)(tmp_str, "next-line") == 0)
+         clo_prefetch = DG_PREFETCH_NEXT_LINE;
+      else if (VG_(strcmp)(tmp_str, "stride") == 0)
+         clo_prefetch = DG_PREFETCH_STRIDE;
+      else if (VG_(strcmp)(tmp_str, "both") == 0)
+         clo_prefetch = DG_PREFETCH_BOTH;
+      else
+         VG_(fmsg_bad_option)(arg, "Unknown prefetcher '%s'\n", tmp_str);
+   }
+   else if (VG_BINT_CLO(arg, "--datagrind-prefetch-degree", clo_prefetch_degree, 1, 16)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(cachesim_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-cache-sim=yes|no     count D1 and LL misses of each access [no]\n"
+"    --datagrind-prefetch=none|next-line|stride|both\n"
+"                                     prefetch into LL in the cache simulation [none]\n"
+"    --datagrind-prefetch-degree=<n>  lines each prefetch runs ahead [2]\n"
+   );
+   VG_(print_cache_clo_opts)();
+}
+
+void DG_(cachesim_init)(void)
+{
+   cache_t I1c;
+
+   if (!DG_(clo_cache_sim))
+      return;
+   VG_(post_clo_init_configure_caches)(&I1c, &D1c, &LLc,
+                                       &clo_I1_cache, &clo_D1_cache, &clo_LL_cache);
+   cachesim_initcaches(I1c, D1c, /*MLc*/NULL, LLc, /*per_thread*/False);
+   /* Larger accesses are split so that no piece straddles more than two
+    * lines, which is all the simulator handles.
+    */
+   min_line_size = D1c.line_size < LLc.line_size ? D1c.line_size : LLc.line_size;
+   contexts = VG_(HT_construct)("datagrind.cachesim.contexts");
+   if (clo_prefetch != DG_PREFETCH_NONE)
+   {
+      prefetched = VG_(HT_construct)("datagrind.cachesim.prefetched");
+      max_prefetched = 2 * (LLc.size / LLc.line_size);
+   }
+}
+
+static DgCacheContext *lookup_context(UWord context_index, Word n_accesses)
+{
+   DgCacheContext *ctx = last_context;
+
+   if (ctx == NULL || ctx->key != context_index)
+   {
+      ctx = VG_(HT_lookup)(contexts, context_index);
+      if (ctx == NULL)
+      {
+         ctx = VG_(calloc)("datagrind.cachesim.context", 1,
+                           sizeof(DgCacheContext) + n_accesses * sizeof(DgCacheCounts));
+         ctx->key = context_index;
+         ctx->n_accesses = n_accesses;
+         VG_(HT_add_node)(contexts, ctx);
+      }
+      last_context = ctx;
+   }
+   return ctx;
+}
+
+/* Whether LL holds the block, without touching its LRU order */
+static Bool ll_holds(UWord block)
+{
+   const UWord *set = &LL.tags[(block & LL.sets_min_1) * LL.assoc];
+   Int i;
+
+   for (i = 0; i < LL.assoc; i++)
+      if (set[i] == block)
+         return True;
+   return False;
+}
+
+static DgCacheCounts *prefetch_counts(const DgPrefetched *pf)
+{
+   DgCacheContext *ctx = VG_(HT_lookup)(contexts, pf->context_index);
+   return &ctx->counts[pf->access];
+}
+
+/* Drops the prefetched lines that LL no longer holds, as useless */
+static void sweep_prefetched(void)
+{
+   DgPrefetched *pf;
+   UInt n_nodes;
+
+   VG_(HT_ResetIter)(prefetched);
+   while ((pf = VG_(HT_Next)(prefetched)) != NULL)
+      if (!ll_holds(pf->key))
+      {
+         prefetch_counts(pf)->useless++;
+         VG_(HT_remove_at_Iter)(prefetched);
+         VG_(free)(pf);
+      }
+   /* Leave room, so that a table full of live lines is not swept again
+    * at once.
+    */
+   n_nodes = VG_(HT_count_nodes)(prefetched);
+   if (2 * n_nodes > max_prefetched)
+      max_prefetched = 2 * n_nodes;
+}
+
+static void prefetch_block(UWord block, UWord context_index, Word access,
+                           DgCacheCounts *counts)
+{
+   DgPrefetched *pf;
+
+   if (!cachesim_setref_is_miss(&LL, block & LL.sets_min_1, block))
+      return;
+   counts->prefetches++;
+   pf = VG_(HT_lookup)(prefetched, block);
+   if (pf != NULL)
+   {
+      /* Evicted unused and fetched again */
+      prefetch_counts(pf)->useless++;
+   }
+   else
+   {
+      pf = VG_(malloc)("datagrind.cachesim.prefetch", sizeof(DgPrefetched));
+      pf->key = block;
+      VG_(HT_add_node)(prefetched, pf);
+      if (VG_(HT_count_nodes)(prefetched) > max_prefetched)
+         sweep_prefetched();
+   }
+   pf->context_index = context_index;
+   pf->access = access;
+}
+
+static void prefetch_next_lines(UWord block, UWord context_index, Word access,
+                                DgCacheCounts *counts)
+{
+   UWord page = block >> (DG_PREFETCH_PAGE_SHIFT - LL.line_size_bits);
+   Int i;
+
+   for (i = 1; i <= clo_prefetch_degree; i++)
+   {
+      if ((block + i) >> (DG_PREFETCH_PAGE_SHIFT - LL.line_size_bits) != page)
+         break;
+      prefetch_block(block + i, context_index, access, counts);
+   }
+}
+
+/* Accounts for a demand access to the block, which missed D1 (m1) and
+ * LL (mL), and issues the next-line prefetches it triggers.
+ */
+static void prefetch_demand(UWord block, Bool m1, Bool mL, UWord context_index,
+                            Word access, DgCacheCounts *counts)
+{
+   DgPrefetched *pf = VG_(HT_lookup)(prefetched, block);
+   Bool trigger = mL;
+
+   if (pf != NULL && m1)
+   {
+      if (mL)
+         prefetch_counts(pf)->useless++;
+      else
+      {
+         counts->covered++;
+         trigger = True;
+      }
+      VG_(HT_remove)(prefetched, block);
+      VG_(free)(pf);
+   }
+   if (trigger && (clo_prefetch & DG_PREFETCH_NEXT_LINE))
+      prefetch_next_lines(block, context_index, access, counts);
+}
+
+static void prefetch_stride(Addr addr, UWord context_index, Word access,
+                            DgCacheCounts *counts)
+{
+   Word delta = (Word) (addr - counts->last);
+   Int i;
+
+   if (counts->refs > 1 && delta != 0 && delta == counts->stride)
+   {
+      if (counts->confirmed < 2)
+         counts->confirmed++;
+   }
+   else
+      counts->confirmed = 0;
+   counts->stride = delta;
+   counts->last = addr;
+   if (counts->confirmed < 2)
+      return;
+   for (i = 1; i <= clo_prefetch_degree; i++)
+   {
+      UWord block = (addr + i * delta) >> LL.line_size_bits;
+      if (block == counts->last_block)
+         continue;
+      prefetch_block(block, context_index, access, counts);
+      counts->last_block = block;
+   }
+}
+
+void DG_(cachesim_ref)(UWord context_index, Word n_accesses, Word access,
+                       Addr addr, UChar size)
+{
+   DgCacheContext *ctx = lookup_context(context_index, n_accesses);
+   DgCacheCounts *counts;
+   ULong m1 = 0, mM = 0, mL = 0;
+   SimCC x;
+   UInt offset = 0;
+
+   tl_assert(access < ctx->n_accesses);
+   counts = &ctx->counts[access];
+
+   do
+   {
+      UChar piece = size - offset > min_line_size ? min_line_size : size - offset;
+      ULong p1 = m1, pL = mL;
+
+      cachesim_D1_doref(/*pc*/0, addr + offset, piece, /*is_write*/False,
+                        &m1, &mM, &mL, &x);
+      if (prefetched != NULL)
+         prefetch_demand((addr + offset) >> LL.line_size_bits, m1 > p1, mL > pL,
+                         context_index, access, counts);
+      offset += piece;
+   } while (offset < size);
+
+   counts->refs++;
+   if (clo_prefetch & DG_PREFETCH_STRIDE)
+      prefetch_stride(addr, context_index, access, counts);
+   if (m1 > 0)
+      counts->d1_misses++;
+   if (mL > 0)
+      counts->ll_misses++;
+}
+
+static Int cmp_context_ptr(const void *a, const void *b)
+{
+   const DgCacheContext *ca = *(DgCacheContext * const *) a;
+   const DgCacheContext *cb = *(DgCacheContext * const *) b;
+   if (ca->key != cb->key)
+      return ca->key < cb->key ? -1 : 1;
+   return 0;
+}
+
+static void out_cache_config(void)
+{
+   UChar payload[8 * DG_MAX_UVARINT_BYTES];
+   UChar *p = payload;
+
+   p = encode_uvarint(p, D1c.size);
+   p = encode_uvarint(p, D1c.assoc);
+   p = encode_uvarint(p, D1c.line_size);
+   p = encode_uvarint(p, LLc.size);
+   p = encode_uvarint(p, LLc.assoc);
+   p = encode_uvarint(p, LLc.line_size);
+   if (clo_prefetch != DG_PREFETCH_NONE)
+   {
+      p = encode_uvarint(p, clo_prefetch);
+      p = encode_uvarint(p, clo_prefetch_degree);
+   }
+   out_byte(DG_R_CACHE_CONFIG);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+}
+
+void DG_(cachesim_finish)(void)
+{
+   DgCacheContext **nodes;
+   UInt n_nodes, i;
+
+   if (contexts == NULL)
+      return;
+
+   if (prefetched != NULL)
+   {
+      DgPrefetched *pf;
+
+      /* Whatever is left was never used */
+      VG_(HT_ResetIter)(prefetched);
+      while ((pf = VG_(HT_Next)(prefetched)) != NULL)
+         prefetch_counts(pf)->useless++;
+      VG_(HT_destruct)(prefetched, VG_(free));
+      prefetched = NULL;
+   }
+   out_cache_config();
+   nodes = (DgCacheContext **) VG_(HT_to_array)(contexts, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgCacheContext *), cmp_context_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgCacheContext *ctx = nodes[i];
+      UChar *payload, *p;
+      Word j;
+
+      payload = VG_(malloc)("datagrind.cachesim.payload",
+                            2 * DG_MAX_UVARINT_BYTES + ctx->n_accesses * 6 * 10);
+      p = encode_uvarint(payload, ctx->key);
+      p = encode_uvarint(p, ctx->n_accesses);
+      for (j = 0; j < ctx->n_accesses; j++)
+      {
+         p = encode_uvarint64(p, ctx->counts[j].refs);
+         p = encode_uvarint64(p, ctx->counts[j].d1_misses);
+         p = encode_uvarint64(p, ctx->counts[j].ll_misses);
+         if (clo_prefetch != DG_PREFETCH_NONE)
+         {
+            p = encode_uvarint64(p, ctx->counts[j].prefetches);
+            p = encode_uvarint64(p, ctx->counts[j].covered);
+            p = encode_uvarint64(p, ctx->counts[j].useless);
+         }
+      }
+      out_byte(DG_R_CACHE_MISSES);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+      VG_(free)(payload);
+   }
+   VG_(free)(nodes);
+
+   VG_(HT_destruct)(contexts, VG_(free));
+   contexts = NULL;
+   last_context = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,639 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: converts traces for other tools.      dg_convert.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_convert writes a trace out in forms that other tools load directly.
+ *
+ * The events become a trace in the Chrome JSON format, which Perfetto and
+ * chrome://tracing open, with one slice per start and end event pair on
+ * the process and thread that made them. Time is measured in instructions,
+ * so the microseconds the viewers show are really instructions.
+ *
+ * The accesses become one file per column, each a plain array of
+ * fixed-size integers in the byte order of the host, described by a JSON
+ * file naming the columns, their types and the number of rows. Columns of
+ * that kind map directly onto numpy and Arrow arrays without parsing.
+ * The rows are gathered into batches, and each column of a batch is
+ * written out in one go.
+ *
+ * The affinity graph becomes a CSV list of weighted edges, one per pair of
+ * objects, which graph partitioners and layout tools take as it is.
+ *
+ * For memory simulators, the data accesses become requests in the trace
+ * formats of Ramulator (the CPU trace of non-memory instructions between
+ * requests and the address of each) and DRAMsim3 (address, command and
+ * time), with the instruction count standing in for the time. With --llc
+ * they first go through a set-associative LRU, write-allocate, write-back
+ * cache, so that only its misses and write-backs are written, as seen by
+ * the memory. The instructions become ChampSim's binary input_instr
+ * records, left unfiltered as ChampSim has caches of its own, with the
+ * last instruction of each run as a conditional branch, taken if the next
+ * run does not follow it. Threads are interleaved as in the trace; use
+ * dg_filter --tid for one.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+#define BATCH_ROWS 65536
+
+static const char *argv0 = "dg_convert";
+
+typedef struct
+{
+   const char *name;
+   const char *type;
+   size_t size;              /* Of one value */
+   FILE *f;
+   unsigned char *batch;
+} column;
+
+enum { COL_ADDR, COL_SIZE, COL_DIR, COL_CONTEXT, COL_INSTRS, COL_TID, N_COLUMNS };
+
+static column columns[N_COLUMNS] =
+{
+   { "addr",    "uint64", 8, NULL, NULL },
+   { "size",    "uint32", 4, NULL, NULL },
+   { "dir",     "uint8",  1, NULL, NULL },
+   { "context", "uint64", 8, NULL, NULL },
+   { "instrs",  "uint64", 8, NULL, NULL },
+   { "tid",     "uint32", 4, NULL, NULL },
+};
+
+static size_t batch_rows = 0;
+static unsigned long long total_rows = 0;
+
+/* ChampSim's trace record. The register numbers are its x86 ones. */
+#define CHAMPSIM_REG_FLAGS 25
+#define CHAMPSIM_REG_IP    26
+
+typedef struct
+{
+   uint64_t ip;
+   uint8_t is_branch;
+   uint8_t branch_taken;
+   uint8_t destination_registers[2];
+   uint8_t source_registers[4];
+   uint64_t destination_memory[2];
+   uint64_t source_memory[4];
+} champsim_instr;
+
+/* The last-level cache of --llc */
+typedef struct
+{
+   uint64_t n_sets;
+   uint32_t assoc;
+   uint32_t line_shift;
+   uint64_t *tags;           /* Line + 1 by set, most recent first, or 0 */
+   uint8_t *dirty;
+} llc;
+
+static FILE *ramulator = NULL, *dramsim3 = NULL, *champsim = NULL;
+static uint64_t last_request_instrs = 0;
+static champsim_instr pending;       /* End of the last run, not yet written */
+static int have_pending = 0;
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: converts a Datagrind trace for other tools\n"
+"usage: %s [options] trace\n"
+"    --affinity=<file>   write the affinity graph as CSV edges\n"
+"    --champsim=<file>   write the instructions as a ChampSim trace\n"
+"    --chrome=<file>     write the events as a Chrome JSON trace\n"
+"    --columns=<prefix>  write the accesses as columns <prefix>.<column>,\n"
+"                        described by <prefix>.json\n"
+"    --dramsim3=<file>   write the accesses as a DRAMsim3 trace\n"
+"    --ramulator=<file>  write the accesses as a Ramulator CPU trace\n"
+"    --llc=<size>,<assoc>,<line>\n"
+"                        only write the misses and write-backs of this\n"
+"                        cache to the Ramulator and DRAMsim3 traces\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static void fail(const char *what, const char *filename)
+{
+   fprintf(stderr, "%s: %s %s: %s\n", argv0, what, filename, strerror(errno));
+   exit(1);
+}
+
+static const char *column_name(const char *prefix, const char *suffix)
+{
+   static char *name = NULL;
+
+   free(name);
+   name = malloc(strlen(prefix) + strlen(suffix) + 2);
+   if (name == NULL)
+   {
+      fprintf(stderr, "%s: out of memory\n", argv0);
+      exit(1);
+   }
+   sprintf(name, "%s.%s", prefix, suffix);
+   return name;
+}
+
+static void open_columns(const char *prefix)
+{
+   int i;
+
+   for (i = 0; i < N_COLUMNS; i++)
+   {
+      const char *name = column_name(prefix, columns[i].name);
+
+      columns[i].f = fopen(name, "wb");
+      if (columns[i].f == NULL)
+         fail("cannot create", name);
+      columns[i].batch = malloc(BATCH_ROWS * columns[i].size);
+      if (columns[i].batch == NULL)
+      {
+         fprintf(stderr, "%s: out of memory\n", argv0);
+         exit(1);
+      }
+   }
+}
+
+static void flush_columns(void)
+{
+   int i;
+
+   for (i = 0; i < N_COLUMNS; i++)
+      if (fwrite(columns[i].batch, columns[i].size, batch_rows, columns[i].f) != batch_rows)
+         fail("cannot write column", columns[i].name);
+   total_rows += batch_rows;
+   batch_rows = 0;
+}
+
+static void add_row(uint64_t addr, uint32_t size, uint8_t dir, uint64_t context,
+                    uint64_t instrs, uint32_t tid)
+{
+   memcpy(columns[COL_ADDR].batch + batch_rows * 8, &addr, 8);
+   memcpy(columns[COL_SIZE].batch + batch_rows * 4, &size, 4);
+   columns[COL_DIR].batch[batch_rows] = dir;
+   memcpy(columns[COL_CONTEXT].batch + batch_rows * 8, &context, 8);
+   memcpy(columns[COL_INSTRS].batch + batch_rows * 8, &instrs, 8);
+   memcpy(columns[COL_TID].batch + batch_rows * 4, &tid, 4);
+   if (++batch_rows == BATCH_ROWS)
+      flush_columns();
+}
+
+static void close_columns(const char *prefix)
+{
+   static const uint16_t one = 1;
+   const char *name;
+   FILE *f;
+   int i;
+
+   flush_columns();
+   for (i = 0; i < N_COLUMNS; i++)
+      if (fclose(columns[i].f) != 0)
+         fail("cannot write column", columns[i].name);
+
+   name = column_name(prefix, "json");
+   f = fopen(name, "w");
+   if (f == NULL)
+      fail("cannot create", name);
+   fprintf(f, "{\n  \"rows\": %llu,\n  \"byte_order\": \"%s\",\n  \"columns\": [\n",
+           total_rows, *(const uint8_t *) &one ? "little" : "big");
+   for (i = 0; i < N_COLUMNS; i++)
+      fprintf(f, "    { \"name\": \"%s\", \"type\": \"%s\", \"file\": \"%s\" }%s\n",
+              columns[i].name, columns[i].type, column_name(prefix, columns[i].name),
+              i + 1 < N_COLUMNS ? "," : "");
+   fprintf(f, "  ]\n}\n");
+   if (fclose(f) != 0)
+      fail("cannot write", name);
+}
+
+/* Writes s as a JSON string */
+static void json_string(FILE *f, const char *s, size_t len)
+{
+   size_t i;
+
+   putc('"', f);
+   for (i = 0; i < len; i++)
+   {
+      unsigned char c = s[i];
+
+      if (c == '"' || c == '\\')
+         fprintf(f, "\\%c", c);
+      else if (c < 0x20)
+         fprintf(f, "\\u%04x", c);
+      else
+         putc(c, f);
+   }
+   putc('"', f);
+}
+
+static void chrome_counts(FILE *f, const char *name, const dgt_event_count *counts,
+                          uint32_t n)
+{
+   uint32_t i;
+
+   fprintf(f, ",\"%s\":{", name);
+   for (i = 0; i < n; i++)
+      fprintf(f, "%s\"%llu\":%llu", i > 0 ? "," : "", (unsigned long long) counts[i].key,
+              (unsigned long long) counts[i].accesses);
+   putc('}', f);
+}
+
+/* The summary of an event, if it has one, becomes the args of its end */
+static void chrome_event(FILE *f, int *first, const dgt_record *record, uint32_t pid,
+                         uint32_t tid)
+{
+   dgt_event event;
+
+   if (dgt_parse_event(record, &event) != DGT_OK)
+      return;
+   fprintf(f, "%s{\"name\":", *first ? "" : ",\n");
+   json_string(f, event.label, event.label_len);
+   fprintf(f, ",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%u,\"tid\":%u",
+           record->type == DG_R_START_EVENT ? 'B' : 'E',
+           (unsigned long long) event.instrs, pid != 0 ? pid : 1, tid);
+   if (event.has_summary)
+   {
+      fprintf(f, ",\"args\":{\"reads\":%llu,\"writes\":%llu,\"read_bytes\":%llu,"
+              "\"write_bytes\":%llu,\"lines\":%llu",
+              (unsigned long long) event.reads, (unsigned long long) event.writes,
+              (unsigned long long) event.read_bytes, (unsigned long long) event.write_bytes,
+              (unsigned long long) event.lines);
+      chrome_counts(f, "top_contexts", event.contexts, event.n_contexts);
+      chrome_counts(f, "top_ranges", event.ranges, event.n_ranges);
+      putc('}', f);
+   }
+   putc('}', f);
+   *first = 0;
+}
+
+/* Writes an object of a DG_R_AFFINITY as kind,id,offset */
+static const uint8_t *affinity_node(FILE *f, const uint8_t *p, const uint8_t *end)
+{
+   uint64_t id, offset = 0;
+   uint8_t kind;
+
+   if (p == NULL || p >= end)
+      return NULL;
+   kind = *p++;
+   if ((p = dgt_get_uvarint(p, end, &id)) == NULL
+       || (kind == DG_AFFINITY_FIELD && (p = dgt_get_uvarint(p, end, &offset)) == NULL))
+      return NULL;
+   if (kind == DG_AFFINITY_FIELD)
+      fprintf(f, "range,%llu,%llu,", (unsigned long long) id, (unsigned long long) offset);
+   else
+      fprintf(f, "site,%llu,,", (unsigned long long) id);
+   return p;
+}
+
+static void affinity_edges(FILE *f, const dgt_record *record)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   uint64_t window, stride, n_accesses, n_pairs, count, error, i;
+
+   if ((p = dgt_get_uvarint(p, end, &window)) == NULL
+       || (p = dgt_get_uvarint(p, end, &stride)) == NULL
+       || (p = dgt_get_uvarint(p, end, &n_accesses)) == NULL
+       || (p = dgt_get_uvarint(p, end, &n_pairs)) == NULL)
+      return;
+   for (i = 0; i < n_pairs; i++)
+   {
+      if ((p = affinity_node(f, p, end)) == NULL
+          || (p = affinity_node(f, p, end)) == NULL
+          || (p = dgt_get_uvarint(p, end, &count)) == NULL
+          || (p = dgt_get_uvarint(p, end, &error)) == NULL)
+         return;
+      fprintf(f, "%llu,%llu\n", (unsigned long long) count, (unsigned long long) error);
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Memory simulators                                    ---*/
+/*------------------------------------------------------------*/
+
+static int parse_llc(const char *s, llc *c)
+{
+   unsigned long long size, assoc, line;
+
+   if (sscanf(s, "%llu,%llu,%llu", &size, &assoc, &line) != 3
+       || line == 0 || (line & (line - 1)) != 0 || assoc == 0 || assoc > 1024
+       || size == 0 || size % (assoc * line) != 0)
+      return 0;
+   c->n_sets = size / (assoc * line);
+   c->assoc = assoc;
+   for (c->line_shift = 0; (1ULL << c->line_shift) < line; c->line_shift++)
+      ;
+   c->tags = calloc(c->n_sets * assoc, sizeof(uint64_t));
+   c->dirty = calloc(c->n_sets * assoc, 1);
+   if (c->tags == NULL || c->dirty == NULL)
+   {
+      fprintf(stderr, "%s: out of memory\n", argv0);
+      exit(1);
+   }
+   return 1;
+}
+
+static void request(uint64_t addr, int is_write, uint64_t writeback, uint64_t instrs)
+{
+   if (ramulator != NULL)
+   {
+      uint64_t bubbles = instrs > last_request_instrs ? instrs - last_request_instrs : 0;
+
+      if (writeback != 0)
+         fprintf(ramulator, "%llu %llu %llu\n", (unsigned long long) bubbles,
+                 (unsigned long long) addr, (unsigned long long) writeback);
+      else
+         fprintf(ramulator, "%llu %llu\n", (unsigned long long) bubbles,
+                 (unsigned long long) addr);
+      last_request_instrs = instrs + 1;
+   }
+   if (dramsim3 != NULL)
+   {
+      fprintf(dramsim3, "%#llx %s %llu\n", (unsigned long long) addr,
+              is_write ? "WRITE" : "READ", (unsigned long long) instrs);
+      if (writeback != 0)
+         fprintf(dramsim3, "%#llx WRITE %llu\n", (unsigned long long) writeback,
+                 (unsigned long long) instrs);
+   }
+}
+
+/* A miss reads the line, and writes back the line it evicts if dirty */
+static void llc_access(llc *c, uint64_t line, int is_write, uint64_t instrs)
+{
+   uint64_t *tags = &c->tags[(line % c->n_sets) * c->assoc];
+   uint8_t *dirty = &c->dirty[(line % c->n_sets) * c->assoc];
+   uint64_t victim, writeback = 0;
+   uint8_t was_dirty;
+   uint32_t i;
+
+   for (i = 0; i < c->assoc && tags[i] != line + 1; i++)
+      ;
+   if (i == c->assoc)
+   {
+      i = c->assoc - 1;
+      victim = tags[i];
+      if (victim != 0 && dirty[i])
+         writeback = (victim - 1) << c->line_shift;
+      request(line << c->line_shift, 0, writeback, instrs);
+      tags[i] = line + 1;
+      dirty[i] = 0;
+   }
+   victim = tags[i];
+   was_dirty = dirty[i] | is_write;
+   memmove(&tags[1], &tags[0], i * sizeof(uint64_t));
+   memmove(&dirty[1], &dirty[0], i);
+   tags[0] = victim;
+   dirty[0] = was_dirty;
+}
+
+/* The position in the run of the instruction making an access */
+static uint32_t instr_of(const dgt_run *run, const dgt_access *a)
+{
+   return a->dir == DG_ACC_EXEC ? a->index : run->bbdef->accesses[a->index].iseq;
+}
+
+static void memory_run(llc *c, const dgt_run *run, uint64_t instrs)
+{
+   uint32_t j;
+
+   for (j = 0; j < run->n_accesses; j++)
+   {
+      const dgt_access *a = &run->accesses[j];
+      int is_write = a->dir != DG_ACC_READ;
+
+      if (a->dir == DG_ACC_EXEC || a->size == 0)
+         continue;
+      if (c->tags == NULL)
+         request(a->addr, is_write, 0, instrs + instr_of(run, a));
+      else
+      {
+         uint64_t line;
+
+         for (line = a->addr >> c->line_shift;
+              line <= (a->addr + a->size - 1) >> c->line_shift; line++)
+            llc_access(c, line, is_write, instrs + instr_of(run, a));
+      }
+   }
+}
+
+static void champsim_write(const champsim_instr *instr)
+{
+   if (fwrite(instr, sizeof(*instr), 1, champsim) != 1)
+      fail("cannot write", "the ChampSim trace");
+}
+
+static void champsim_run(const dgt_run *run)
+{
+   const dgt_bbdef *bbd = run->bbdef;
+   uint32_t i, j = 0;
+
+   if (bbd == NULL || run->n_instrs == 0)
+      return;
+   if (have_pending)
+   {
+      pending.branch_taken = bbd->instrs[0].addr != pending.ip + pending.is_branch;
+      pending.is_branch = 1;
+      champsim_write(&pending);
+      have_pending = 0;
+   }
+   for (i = 0; i < run->n_instrs && i < bbd->n_instrs; i++)
+   {
+      champsim_instr instr;
+      int n_src = 0, n_dst = 0;
+
+      memset(&instr, 0, sizeof(instr));
+      instr.ip = bbd->instrs[i].addr;
+      for (; j < run->n_accesses && instr_of(run, &run->accesses[j]) == i; j++)
+      {
+         const dgt_access *a = &run->accesses[j];
+
+         if (a->dir == DG_ACC_EXEC)
+            continue;
+         if (a->dir != DG_ACC_WRITE && n_src < 4)
+            instr.source_memory[n_src++] = a->addr;
+         if (a->dir != DG_ACC_READ && n_dst < 2)
+            instr.destination_memory[n_dst++] = a->addr;
+      }
+      if (i + 1 == run->n_instrs)
+      {
+         /* Written with the next run, once it is known whether it is
+          * taken; is_branch holds the size meanwhile.
+          */
+         instr.destination_registers[0] = CHAMPSIM_REG_IP;
+         instr.source_registers[0] = CHAMPSIM_REG_IP;
+         instr.source_registers[1] = CHAMPSIM_REG_FLAGS;
+         instr.is_branch = bbd->instrs[i].size;
+         pending = instr;
+         have_pending = 1;
+      }
+      else
+         champsim_write(&instr);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   const char *chrome_name = NULL, *columns_prefix = NULL, *trace_name = NULL;
+   const char *affinity_name = NULL, *ramulator_name = NULL, *dramsim3_name = NULL;
+   const char *champsim_name = NULL;
+   llc cache = { 0, 0, 0, NULL, NULL };
+   FILE *chrome = NULL, *affinity = NULL;
+   int first_event = 1;
+   dgt_file *file;
+   dgt_decoder *decoder;
+   dgt_record record;
+   dgt_run run;
+   int i, ret;
+
+   if (argv[0])
+      argv0 = argv[0];
+   for (i = 1; i < argc; i++)
+   {
+      if (strncmp(argv[i], "--chrome=", 9) == 0)
+         chrome_name = argv[i] + 9;
+      else if (strncmp(argv[i], "--affinity=", 11) == 0)
+         affinity_name = argv[i] + 11;
+      else if (strncmp(argv[i], "--ramulator=", 12) == 0)
+         ramulator_name = argv[i] + 12;
+      else if (strncmp(argv[i], "--dramsim3=", 11) == 0)
+         dramsim3_name = argv[i] + 11;
+      else if (strncmp(argv[i], "--champsim=", 11) == 0)
+         champsim_name = argv[i] + 11;
+      else if (strncmp(argv[i], "--llc=", 6) == 0)
+      {
+         if (!parse_llc(argv[i] + 6, &cache))
+            usage();
+      }
+      else if (strncmp(argv[i], "--columns=", 10) == 0)
+         columns_prefix = argv[i] + 10;
+      else if (argv[i][0] == '-' || trace_name != NULL)
+         usage();
+      else
+         trace_name = argv[i];
+   }
+   if (trace_name == NULL
+       || (chrome_name == NULL && columns_prefix == NULL && affinity_name == NULL
+           && ramulator_name == NULL && dramsim3_name == NULL && champsim_name == NULL))
+      usage();
+
+   ret = dgt_open(trace_name, &file);
+   if (ret == DGT_OK)
+      ret = dgt_decoder_new(file, &decoder);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+      return 1;
+   }
+   if (chrome_name != NULL)
+   {
+      chrome = fopen(chrome_name, "w");
+      if (chrome == NULL)
+         fail("cannot create", chrome_name);
+      fprintf(chrome, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+   }
+   if (columns_prefix != NULL)
+      open_columns(columns_prefix);
+   if (affinity_name != NULL)
+   {
+      affinity = fopen(affinity_name, "w");
+      if (affinity == NULL)
+         fail("cannot create", affinity_name);
+      fprintf(affinity, "kind_a,id_a,offset_a,kind_b,id_b,offset_b,weight,error\n");
+   }
+   if (ramulator_name != NULL && (ramulator = fopen(ramulator_name, "w")) == NULL)
+      fail("cannot create", ramulator_name);
+   if (dramsim3_name != NULL && (dramsim3 = fopen(dramsim3_name, "w")) == NULL)
+      fail("cannot create", dramsim3_name);
+   if (champsim_name != NULL && (champsim = fopen(champsim_name, "wb")) == NULL)
+      fail("cannot create", champsim_name);
+
+   while ((ret = dgt_decoder_next(decoder, &record, &run)) > 0)
+   {
+      if (ret == DGT_ITEM_RUN)
+      {
+         uint64_t instrs = dgt_decoder_instrs(decoder) - run.n_instrs;
+         uint32_t j;
+
+         if (columns_prefix != NULL)
+            for (j = 0; j < run.n_accesses; j++)
+            {
+               const dgt_access *a = &run.accesses[j];
+               add_row(a->addr, a->size, a->dir, run.context_index, instrs, run.tid);
+            }
+         if (ramulator != NULL || dramsim3 != NULL)
+            memory_run(&cache, &run, instrs);
+         if (champsim != NULL)
+            champsim_run(&run);
+      }
+      else if (ret == DGT_ITEM_RECORD && chrome != NULL
+               && (record.type == DG_R_START_EVENT || record.type == DG_R_END_EVENT))
+         chrome_event(chrome, &first_event, &record, dgt_decoder_pid(decoder),
+                      dgt_decoder_tid(decoder));
+      else if (ret == DGT_ITEM_RECORD && affinity != NULL && record.type == DG_R_AFFINITY)
+         affinity_edges(affinity, &record);
+   }
+   if (ret < 0)
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+
+   if (chrome != NULL)
+   {
+      fprintf(chrome, "\n]}\n");
+      if (fclose(chrome) != 0)
+         fail("cannot write", chrome_name);
+   }
+   if (affinity != NULL && fclose(affinity) != 0)
+      fail("cannot write", affinity_name);
+   if (ramulator != NULL && fclose(ramulator) != 0)
+      fail("cannot write", ramulator_name);
+   if (dramsim3 != NULL && fclose(dramsim3) != 0)
+      fail("cannot write", dramsim3_name);
+   if (champsim != NULL)
+   {
+      if (have_pending)
+      {
+         pending.branch_taken = 1;
+         pending.is_branch = 1;
+         champsim_write(&pending);
+      }
+      if (fclose(champsim) != 0)
+         fail("cannot write", champsim_name);
+   }
+   free(cache.tags);
+   free(cache.dirty);
+   if (columns_prefix != NULL)
+      close_columns(columns_prefix);
+   dgt_decoder_free(decoder);
+   dgt_close(file);
+   return ret < 0 ? 1 : 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
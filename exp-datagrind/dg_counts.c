@@ -0,0 +1,393 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: per-instruction access counts.        dg_counts.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-mode=count, blocks are not given runs at all: no
+ * helper is called, and no address is kept. Instead each superblock is
+ * cut into segments at its exits, and each segment bumps a counter of its
+ * own with inline IR, as cachegrind's instruction counts would, but once
+ * per segment rather than once per instruction. Every instruction and
+ * every unguarded access in a segment runs as often as the segment does,
+ * so a segment's count is only added to theirs when its translation is
+ * discarded, or at exit. A guarded access bumps its own counter by its
+ * guard. The counts are written at exit as one DG_R_ACCESS_COUNTS, keyed
+ * by instruction address, so code that is unloaded and replaced by other
+ * code at the same address has the counts of both.
+ */
+
+typedef struct DgCountSlot
+{
+   struct DgCountSlot *next;
+   UChar dir;
+   UInt size;
+   ULong count;
+   HWord guarded;      /* Bumped inline, by the guard */
+} DgCountSlot;
+
+typedef struct
+{
+   VgHashNode header;  /* Keyed by the instruction address */
+   ULong execs;
+   DgCountSlot *slots; /* The accesses of the instruction, in IR order */
+} DgCountInstr;
+
+/* The statements of a translation between two exits */
+typedef struct
+{
+   HWord count;        /* Bumped inline */
+   UInt n_credits;
+   ULong **credits;    /* The counts it adds to, after the segment */
+} DgCountSeg;
+
+typedef struct
+{
+   VgHashNode header;  /* Keyed by the address of the translation */
+   XArray *segs;       /* DgCountSeg * */
+} DgCountSB;
+
+static VgHashTable *instrs = NULL;
+static VgHashTable *sbs = NULL;
+static XArray *credits = NULL;      /* ULong *, of the open segment */
+
+void DG_(counts_init)(void)
+{
+   instrs = VG_(HT_construct)("datagrind.counts.instrs");
+   sbs = VG_(HT_construct)("datagrind.counts.sbs");
+   credits = VG_(newXA)(VG_(malloc), "datagrind.counts.credits", VG_(free),
+                        sizeof(ULong *));
+}
+
+static DgCountInstr *instr_lookup(Addr addr)
+{
+   DgCountInstr *instr = VG_(HT_lookup)(instrs, addr);
+
+   if (instr == NULL)
+   {
+      instr = VG_(calloc)("datagrind.counts.instr", 1, sizeof(DgCountInstr));
+      instr->header.key = addr;
+      VG_(HT_add_node)(instrs, instr);
+   }
+   return instr;
+}
+
+/* Adds 1, or the guard, to a counter */
+static void add_bump(IRSB *sbOut, HWord *counter, IRExpr *guard)
+{
+   IRExpr *addr = mkIRExpr_HWord((HWord) counter);
+   IRTemp count = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp next = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRExpr *inc = mkIRExpr_HWord(1);
+
+   if (guard != NULL)
+   {
+      IRTemp wide = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+      addStmtToIRSB(sbOut, IRStmt_WrTmp(wide, IRExpr_Unop(DG_IROP_1UTO, guard)));
+      inc = IRExpr_RdTmp(wide);
+   }
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(count, IRExpr_Load(DG_IREND, DG_IRTY_WORD, addr)));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(next, IRExpr_Binop(DG_IROP_ADD, IRExpr_RdTmp(count),
+                                                        inc)));
+   addStmtToIRSB(sbOut, IRStmt_Store(DG_IREND, addr, IRExpr_RdTmp(next)));
+}
+
+/* Closes the open segment, if anything runs as often as it */
+static void end_segment(IRSB *sbOut, DgCountSB *sb)
+{
+   Word n = VG_(sizeXA)(credits);
+   DgCountSeg *seg;
+
+   if (n == 0)
+      return;
+   seg = VG_(malloc)("datagrind.counts.seg", sizeof(DgCountSeg) + n * sizeof(ULong *));
+   seg->count = 0;
+   seg->n_credits = n;
+   seg->credits = (ULong **) (seg + 1);
+   VG_(memcpy)(seg->credits, VG_(indexXA)(credits, 0), n * sizeof(ULong *));
+   VG_(addToXA)(sb->segs, &seg);
+   VG_(dropTailXA)(credits, n);
+   add_bump(sbOut, &seg->count, NULL);
+}
+
+/* Counts the next access of the instruction, whose slots are followed
+ * from *next.
+ */
+static void count_access(IRSB *sbOut, DgCountSlot ***next, UChar dir, Int size,
+                         IRExpr *guard)
+{
+   DgCountSlot *slot = **next;
+
+   if (slot == NULL)
+   {
+      slot = VG_(calloc)("datagrind.counts.slot", 1, sizeof(DgCountSlot));
+      slot->dir = dir;
+      slot->size = size;
+      **next = slot;
+   }
+   *next = &slot->next;
+   if (guard != NULL && guard->tag == Iex_Const && guard->Iex.Const.con->Ico.U1)
+      guard = NULL;
+   if (guard == NULL)
+   {
+      ULong *credit = &slot->count;
+      VG_(addToXA)(credits, &credit);
+   }
+   else
+      add_bump(sbOut, &slot->guarded, guard);
+}
+
+static void fold(DgCountSB *sb)
+{
+   Word n = VG_(sizeXA)(sb->segs);
+   Word i;
+   UInt j;
+
+   for (i = 0; i < n; i++)
+   {
+      DgCountSeg *seg = *(DgCountSeg **) VG_(indexXA)(sb->segs, i);
+
+      for (j = 0; j < seg->n_credits; j++)
+         *seg->credits[j] += seg->count;
+      VG_(free)(seg);
+   }
+   VG_(deleteXA)(sb->segs);
+   VG_(free)(sb);
+}
+
+void DG_(counts_discard)(Addr nraddr)
+{
+   DgCountSB *sb;
+
+   if (sbs != NULL && (sb = VG_(HT_remove)(sbs, nraddr)) != NULL)
+      fold(sb);
+}
+
+IRSB *DG_(counts_instrument)(IRSB *sbIn, Addr nraddr)
+{
+   IRSB *sbOut = deepCopyIRSBExceptStmts(sbIn);
+   DgCountSlot **next = NULL;
+   DgCountSB *sb;
+   Int i;
+
+   DG_(counts_discard)(nraddr);
+   sb = VG_(malloc)("datagrind.counts.sb", sizeof(DgCountSB));
+   sb->header.key = nraddr;
+   sb->segs = VG_(newXA)(VG_(malloc), "datagrind.counts.segs", VG_(free),
+                         sizeof(DgCountSeg *));
+   VG_(HT_add_node)(sbs, sb);
+
+   for (i = 0; i < sbIn->stmts_used; i++)
+   {
+      IRStmt *st = sbIn->stmts[i];
+
+      if (!st || st->tag == Ist_NoOp)
+         continue;
+      /* Nothing before the first IMark is counted */
+      if (next == NULL && st->tag != Ist_IMark)
+      {
+         addStmtToIRSB(sbOut, st);
+         continue;
+      }
+      switch (st->tag)
+      {
+      case Ist_IMark:
+         {
+            DgCountInstr *instr = instr_lookup(st->Ist.IMark.addr);
+            ULong *credit = &instr->execs;
+
+            VG_(addToXA)(credits, &credit);
+            next = &instr->slots;
+         }
+         break;
+      case Ist_Exit:
+         end_segment(sbOut, sb);
+         break;
+      case Ist_WrTmp:
+         if (st->Ist.WrTmp.data->tag == Iex_Load)
+            count_access(sbOut, &next, DG_ACC_READ,
+                         sizeofIRType(st->Ist.WrTmp.data->Iex.Load.ty), NULL);
+         break;
+      case Ist_Store:
+         count_access(sbOut, &next, DG_ACC_WRITE,
+                      sizeofIRType(typeOfIRExpr(sbOut->tyenv, st->Ist.Store.data)), NULL);
+         break;
+      case Ist_Dirty:
+         {
+            IRDirty *d = st->Ist.Dirty.details;
+
+            if (d->mFx == Ifx_Read || d->mFx == Ifx_Modify)
+               count_access(sbOut, &next, DG_ACC_READ, d->mSize, d->guard);
+            if (d->mFx == Ifx_Write || d->mFx == Ifx_Modify)
+               count_access(sbOut, &next, DG_ACC_WRITE, d->mSize, d->guard);
+         }
+         break;
+      case Ist_CAS:
+         {
+            IRCAS *cas = st->Ist.CAS.details;
+            Int size = sizeofIRType(typeOfIRExpr(sbOut->tyenv, cas->dataLo));
+
+            count_access(sbOut, &next, DG_ACC_ATOMIC, cas->dataHi != NULL ? 2 * size : size,
+                         NULL);
+         }
+         break;
+      case Ist_LLSC:
+         if (st->Ist.LLSC.storedata == NULL)
+            count_access(sbOut, &next, DG_ACC_READ,
+                         sizeofIRType(typeOfIRTemp(sbOut->tyenv, st->Ist.LLSC.result)), NULL);
+         else
+            count_access(sbOut, &next, DG_ACC_ATOMIC,
+                         sizeofIRType(typeOfIRExpr(sbOut->tyenv, st->Ist.LLSC.storedata)),
+                         NULL);
+         break;
+      case Ist_StoreG:
+         {
+            IRStoreG *sg = st->Ist.StoreG.details;
+
+            count_access(sbOut, &next, DG_ACC_WRITE,
+                         sizeofIRType(typeOfIRExpr(sbOut->tyenv, sg->data)), sg->guard);
+         }
+         break;
+      case Ist_LoadG:
+         {
+            IRLoadG *lg = st->Ist.LoadG.details;
+            IRType type = Ity_INVALID, typeWide = Ity_INVALID;
+
+            typeOfIRLoadGOp(lg->cvt, &typeWide, &type);
+            count_access(sbOut, &next, DG_ACC_READ, sizeofIRType(type), lg->guard);
+         }
+         break;
+      default:
+         break;
+      }
+      addStmtToIRSB(sbOut, st);
+   }
+   end_segment(sbOut, sb);
+   return sbOut;
+}
+
+static Int cmp_instr(const void *a, const void *b)
+{
+   const DgCountInstr *ia = *(DgCountInstr *const *) a;
+   const DgCountInstr *ib = *(DgCountInstr *const *) b;
+
+   if (ia->header.key != ib->header.key)
+      return ia->header.key < ib->header.key ? -1 : 1;
+   return 0;
+}
+
+/* Writes the counts of the instructions that ran, in address order */
+void DG_(counts_finish)(void)
+{
+   DgCountInstr **nodes;
+   DgCountSB *sb;
+   UChar *payload, *p;
+   Addr prev = 0;
+   UInt n_nodes, n_slots = 0, n_ran = 0, i;
+
+   if (instrs == NULL)
+      return;
+   VG_(HT_ResetIter)(sbs);
+   while ((sb = VG_(HT_Next)(sbs)) != NULL)
+   {
+      VG_(HT_remove_at_Iter)(sbs);
+      fold(sb);
+   }
+
+   nodes = (DgCountInstr **) VG_(HT_to_array)(instrs, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgCountInstr *), cmp_instr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgCountSlot *slot;
+
+      for (slot = nodes[i]->slots; slot != NULL; slot = slot->next)
+         n_slots++;
+   }
+   p = payload = VG_(malloc)("datagrind.counts.payload",
+                             DG_MAX_UVARINT_BYTES + n_nodes * (DG_MAX_UVARINT_BYTES + 2 * 10)
+                             + n_slots * (1 + DG_MAX_UVARINT_BYTES + 10));
+   for (i = 0; i < n_nodes; i++)
+      n_ran += nodes[i]->execs > 0;
+   p = encode_uvarint(p, n_ran);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgCountInstr *instr = nodes[i];
+      const DgCountSlot *slot;
+      UInt n = 0;
+
+      if (instr->execs == 0)
+         continue;
+      for (slot = instr->slots; slot != NULL; slot = slot->next)
+         n++;
+      p = encode_uvarint(p, instr->header.key - prev);
+      p = encode_uvarint64(p, instr->execs);
+      p = encode_uvarint(p, n);
+      for (slot = instr->slots; slot != NULL; slot = slot->next)
+      {
+         p = put_byte(p, slot->dir);
+         p = encode_uvarint(p, slot->size);
+         p = encode_uvarint64(p, slot->count + slot->guarded);
+      }
+      prev = instr->header.key;
+   }
+   out_byte(DG_R_ACCESS_COUNTS);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+
+   for (i = 0; i < n_nodes; i++)
+   {
+      DgCountSlot *slot = nodes[i]->slots;
+
+      while (slot != NULL)
+      {
+         DgCountSlot *next = slot->next;
+         VG_(free)(slot);
+         slot = next;
+      }
+   }
+   VG_(free)(nodes);
+   VG_(HT_destruct)(instrs, VG_(free));
+   VG_(HT_destruct)(sbs, VG_(free));
+   instrs = sbs = NULL;
+   VG_(deleteXA)(credits);
+   credits = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
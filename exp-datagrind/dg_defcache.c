@@ -0,0 +1,451 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: definitions cache.                  dg_defcache.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "config.h"
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_vki.h"
+#include "pub_tool_clientstate.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-defs-cache=<dir>, the block definitions and contexts
+ * of a program are kept from one run to the next in <dir>/<id>.dgdefs,
+ * where <id> is the GNU build-id of the executable. The cache is a trace
+ * of its own, holding a header and nothing but those records, numbered as
+ * they come. A run starts its numbering after the cache's, and its trace
+ * starts with a DG_R_FORK_DEFS naming the cache, as a forked child's
+ * names its parent's trace, so that readers take the definitions from it.
+ * A definition whose record is byte for byte one in the cache is given
+ * the cache's number and not written again.
+ *
+ * At exit, the definitions the run did write are appended to a copy of
+ * the cache, which then replaces it. The copy starts with all of the old
+ * cache, so traces that name it stay valid, and runs that finish at the
+ * same time each leave a cache that some of the traces can use.
+ *
+ * The writer and reader keep the last addresses of runs per block
+ * definition, so a cached definition is used by at most one block of a
+ * run. Translations that are thrown away and made again write new ones.
+ */
+
+/* The cache is not grown past this */
+#define DG_DEFCACHE_MAX_SIZE (256 * 1024 * 1024)
+
+typedef struct _DgCachedDef
+{
+   struct _DgCachedDef *next;
+   UWord key;                   /* Hash of the record */
+   const UChar *record;         /* In cache */
+   SizeT len;                   /* Including the type and length */
+   UWord index;
+} DgCachedDef;
+
+const HChar *DG_(clo_defs_cache) = NULL;
+
+static HChar *cache_name = NULL;
+static UChar *cache = NULL;          /* The file as it was read */
+static SizeT cache_size = 0;
+static VgHashTable *cached = NULL;   /* DgCachedDef */
+static UWord n_cached_bbdefs = 0;
+static UWord n_cached_contexts = 0;
+static UChar *bbdefs_used = NULL;    /* Bit per cached block definition */
+static XArray *new_defs = NULL;      /* UChar: records written by the run */
+
+static ULong stats_hits = 0;
+
+Bool DG_(defcache_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_STR_CLO(arg, "--datagrind-defs-cache", DG_(clo_defs_cache))) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(defcache_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-defs-cache=<dir>     keep the block definitions and contexts\n"
+"                                     of the executable in <dir>, by build-id,\n"
+"                                     and take them from there in later runs\n"
+   );
+}
+
+static UWord hash_record(const UChar *record, SizeT len)
+{
+   ULong h = 14695981039346656037ULL;
+   SizeT i;
+
+   for (i = 0; i < len; i++)
+      h = (h ^ record[i]) * 1099511628211ULL;
+   return (UWord) (h ^ (h >> 32));
+}
+
+static Word cached_cmp(const void *a, const void *b)
+{
+   const DgCachedDef *da = a;
+   const DgCachedDef *db = b;
+
+   if (da->len != db->len)
+      return 1;
+   return VG_(memcmp)(da->record, db->record, da->len);
+}
+
+static Bool read_all(Int fd, void *buf, SizeT count)
+{
+   UChar *p = buf;
+
+   while (count > 0)
+   {
+      Int n = VG_(read)(fd, p, count);
+      if (n <= 0)
+         return False;
+      p += n;
+      count -= n;
+   }
+   return True;
+}
+
+static Bool pread_all(Int fd, void *buf, SizeT count, ULong offset)
+{
+   return VG_(lseek)(fd, offset, VKI_SEEK_SET) == (Off64T) offset
+          && read_all(fd, buf, count);
+}
+
+/* Reads the GNU build-id note of the executable, returning its length or
+ * 0. Only the program headers are looked at, for the PT_NOTE segments.
+ */
+static SizeT read_build_id(UChar *id, SizeT size)
+{
+   const HChar *exe = VG_(args_the_exename);
+   UChar ehdr[64], phdr[56], note[12], name[4];
+   UInt phentsize, phnum, i;
+   ULong phoff;
+   SizeT len = 0;
+   SysRes sres;
+   Int fd;
+
+   if (exe == NULL)
+      return 0;
+   sres = VG_(open)(exe, VKI_O_RDONLY, 0);
+   if (sr_isError(sres))
+      return 0;
+   fd = sr_Res(sres);
+   if (!pread_all(fd, ehdr, sizeof(ehdr), 0)
+       || VG_(memcmp)(ehdr, "\177ELF", 4) != 0
+       || ehdr[4] != (VG_WORDSIZE == 8 ? 2 : 1))
+   {
+      VG_(close)(fd);
+      return 0;
+   }
+#if VG_WORDSIZE == 8
+   VG_(memcpy)(&phoff, ehdr + 0x20, 8);
+   phentsize = *(UShort *) (ehdr + 0x36);
+   phnum = *(UShort *) (ehdr + 0x38);
+#else
+   {
+      UInt off32;
+      VG_(memcpy)(&off32, ehdr + 0x1C, 4);
+      phoff = off32;
+   }
+   phentsize = *(UShort *) (ehdr + 0x2A);
+   phnum = *(UShort *) (ehdr + 0x2C);
+#endif
+   for (i = 0; len == 0 && i < phnum && phentsize <= sizeof(phdr); i++)
+   {
+      ULong offset, filesz, pos;
+
+      if (!pread_all(fd, phdr, phentsize, phoff + (ULong) i * phentsize)
+          || *(UInt *) phdr != 4 /* PT_NOTE */)
+         continue;
+#if VG_WORDSIZE == 8
+      VG_(memcpy)(&offset, phdr + 8, 8);
+      VG_(memcpy)(&filesz, phdr + 32, 8);
+#else
+      offset = *(UInt *) (phdr + 4);
+      filesz = *(UInt *) (phdr + 16);
+#endif
+      /* Each note is its name and descriptor sizes and its type, then the
+       * name and the descriptor, each padded to 4 bytes.
+       */
+      for (pos = 0; pos + sizeof(note) <= filesz; )
+      {
+         UInt namesz, descsz, type;
+
+         if (!pread_all(fd, note, sizeof(note), offset + pos))
+            break;
+         namesz = ((UInt *) note)[0];
+         descsz = ((UInt *) note)[1];
+         type = ((UInt *) note)[2];
+         if (type == 3 /* NT_GNU_BUILD_ID */ && namesz == 4 && descsz <= size
+             && pread_all(fd, name, 4, offset + pos + sizeof(note))
+             && VG_(memcmp)(name, "GNU", 4) == 0
+             && pread_all(fd, id, descsz, offset + pos + sizeof(note) + 4))
+         {
+            len = descsz;
+            break;
+         }
+         pos += sizeof(note) + ((namesz + 3) & ~3U) + ((descsz + 3) & ~3U);
+      }
+   }
+   VG_(close)(fd);
+   return len;
+}
+
+/* The header of the cache: that of a trace, uncompressed and without
+ * flags.
+ */
+static SizeT cache_header(UChar *buf)
+{
+   static const Char magic[] = "DATAGRIND1";
+   static const Char tool_version[] = VERSION;
+   UChar *p = buf;
+
+   p = put_byte(p, DG_R_HEADER);
+   p = put_byte(p, sizeof(magic) + 5 + sizeof(tool_version));
+   p = put_bytes(p, magic, sizeof(magic));
+   p = put_byte(p, 12); /* version */
+#if VG_BIGENDIAN
+   p = put_byte(p, 1);
+#else
+   p = put_byte(p, 0);
+#endif
+   p = put_byte(p, VG_WORDSIZE);
+   p = put_byte(p, DG_COMPRESS_NONE);
+   p = put_byte(p, 0); /* flags */
+   p = put_bytes(p, tool_version, sizeof(tool_version));
+   return p - buf;
+}
+
+/* Reads the cache, if there is one that this run can use */
+static void load_cache(void)
+{
+   UChar header[64];
+   SizeT header_size = cache_header(header);
+   struct vg_stat st;
+   SysRes sres;
+   SizeT pos;
+   Int fd;
+
+   sres = VG_(open)(cache_name, VKI_O_RDONLY, 0);
+   if (sr_isError(sres))
+      return;
+   fd = sr_Res(sres);
+   if (VG_(fstat)(fd, &st) != 0 || st.size < header_size || st.size > DG_DEFCACHE_MAX_SIZE)
+   {
+      VG_(close)(fd);
+      return;
+   }
+   cache_size = st.size;
+   cache = VG_(malloc)("datagrind.defcache.file", cache_size);
+   if (!read_all(fd, cache, cache_size)
+       || VG_(memcmp)(cache, header, header_size) != 0)
+   {
+      VG_(umsg)("Warning: ignoring datagrind definitions cache `%s'\n", cache_name);
+      VG_(free)(cache);
+      cache = NULL;
+      cache_size = 0;
+      VG_(close)(fd);
+      return;
+   }
+   VG_(close)(fd);
+
+   for (pos = header_size; pos + 2 <= cache_size; )
+   {
+      UChar type = cache[pos];
+      ULong len = cache[pos + 1];
+      SizeT head = 2;
+      DgCachedDef *def;
+
+      if (type >= 128)
+      {
+         pos += 2;
+         continue;
+      }
+      if (len == 255)
+      {
+         if (pos + 10 > cache_size)
+            break;
+         VG_(memcpy)(&len, cache + pos + 2, sizeof(len));
+         head = 10;
+      }
+      if (len > cache_size - pos - head)
+         break;
+      if (type == DG_R_BBDEF || type == DG_R_CONTEXT)
+      {
+         def = VG_(malloc)("datagrind.defcache.def", sizeof(DgCachedDef));
+         def->record = cache + pos;
+         def->len = head + len;
+         def->key = hash_record(def->record, def->len);
+         def->index = type == DG_R_BBDEF ? n_cached_bbdefs++ : n_cached_contexts++;
+         VG_(HT_add_node)(cached, def);
+      }
+      pos += head + len;
+   }
+   /* A cut short cache is used as far as it is whole */
+   cache_size = pos;
+   bbdefs_used = VG_(calloc)("datagrind.defcache.used", n_cached_bbdefs / 8 + 1, 1);
+}
+
+void DG_(defcache_start)(UWord *n_bbdefs, UWord *n_contexts)
+{
+   UChar id[64];
+   SizeT id_len, len, i;
+   UChar *payload, *p;
+   HChar *dir;
+
+   if (DG_(clo_defs_cache) == NULL)
+      return;
+   if (DG_(clo_xtree))
+      VG_(fmsg_bad_option)("--datagrind-defs-cache",
+                           "Can not be used with --datagrind-xtree\n");
+   id_len = read_build_id(id, sizeof(id));
+   if (id_len == 0)
+   {
+      VG_(umsg)("Warning: the executable has no build-id, so the datagrind "
+                "definitions cache is not used\n");
+      DG_(clo_defs_cache) = NULL;
+      return;
+   }
+   dir = VG_(expand_file_name)("--datagrind-defs-cache", DG_(clo_defs_cache));
+   cache_name = VG_(malloc)("datagrind.defcache.name", VG_(strlen)(dir) + 2 * id_len + 16);
+   p = (UChar *) cache_name + VG_(sprintf)(cache_name, "%s/", dir);
+   for (i = 0; i < id_len; i++)
+      p += VG_(sprintf)((HChar *) p, "%02x", id[i]);
+   VG_(strcpy)((HChar *) p, ".dgdefs");
+   VG_(free)(dir);
+
+   cached = VG_(HT_construct)("datagrind.defcache");
+   new_defs = VG_(newXA)(VG_(malloc), "datagrind.defcache.new", VG_(free), sizeof(UChar));
+   load_cache();
+   if (cache == NULL)
+      return;
+
+   len = VG_(strlen)(cache_name);
+   p = payload = VG_(malloc)("datagrind.defcache.fork_defs", 4 * 10 + len + 1);
+   p = encode_uvarint(p, 0);
+   p = encode_uvarint64(p, cache_size);
+   p = encode_uvarint64(p, n_cached_bbdefs);
+   p = encode_uvarint64(p, n_cached_contexts);
+   p = put_bytes(p, cache_name, len + 1);
+   out_byte(DG_R_FORK_DEFS);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+   *n_bbdefs = n_cached_bbdefs;
+   *n_contexts = n_cached_contexts;
+}
+
+Bool DG_(defcache_record)(const UChar *record, const UChar *end, UWord *index)
+{
+   DgCachedDef key, *def;
+
+   key.len = end - record;
+   key.record = record;
+   key.key = hash_record(record, key.len);
+   def = VG_(HT_gen_lookup)(cached, &key, cached_cmp);
+   if (def != NULL
+       && (record[0] != DG_R_BBDEF || !(bbdefs_used[def->index >> 3] & (1 << (def->index & 7)))))
+   {
+      if (record[0] == DG_R_BBDEF)
+         bbdefs_used[def->index >> 3] |= 1 << (def->index & 7);
+      *index = def->index;
+      stats_hits++;
+      return True;
+   }
+   VG_(addBytesToXA)(new_defs, record, key.len);
+   return False;
+}
+
+void DG_(defcache_finish)(void)
+{
+   UChar header[64];
+   SizeT header_size, n_new;
+   HChar *tmp_name;
+   SysRes sres;
+   Int fd;
+
+   if (DG_(clo_defs_cache) == NULL)
+      return;
+   n_new = VG_(sizeXA)(new_defs);
+   if (n_new > 0 && cache_size + n_new <= DG_DEFCACHE_MAX_SIZE)
+   {
+      tmp_name = VG_(malloc)("datagrind.defcache.tmp", VG_(strlen)(cache_name) + 16);
+      VG_(sprintf)(tmp_name, "%s.%d", cache_name, VG_(getpid)());
+      sres = VG_(open)(tmp_name, VKI_O_CREAT | VKI_O_TRUNC | VKI_O_WRONLY,
+                       VKI_S_IRUSR | VKI_S_IWUSR | VKI_S_IRGRP | VKI_S_IROTH);
+      if (sr_isError(sres))
+         VG_(umsg)("Warning: can not write datagrind definitions cache `%s'\n", tmp_name);
+      else
+      {
+         Bool ok;
+
+         fd = sr_Res(sres);
+         if (cache != NULL)
+            ok = VG_(write)(fd, cache, cache_size) == (Int) cache_size;
+         else
+         {
+            header_size = cache_header(header);
+            ok = VG_(write)(fd, header, header_size) == (Int) header_size;
+         }
+         ok = ok && VG_(write)(fd, VG_(indexXA)(new_defs, 0), n_new) == (Int) n_new;
+         VG_(close)(fd);
+         if (!ok || VG_(rename)(tmp_name, cache_name) != 0)
+         {
+            VG_(umsg)("Warning: can not write datagrind definitions cache `%s'\n",
+                      cache_name);
+            VG_(unlink)(tmp_name);
+         }
+      }
+      VG_(free)(tmp_name);
+   }
+
+   if (VG_(clo_stats))
+      VG_(dmsg)("datagrind: definitions cache: %'lu blocks and %'lu contexts, "
+                "%'llu used, %'lu bytes new\n",
+                n_cached_bbdefs, n_cached_contexts, stats_hits, n_new);
+   VG_(HT_destruct)(cached, VG_(free));
+   VG_(deleteXA)(new_defs);
+   VG_(free)(cache);
+   VG_(free)(bbdefs_used);
+   VG_(free)(cache_name);
+   cache = NULL;
+   bbdefs_used = NULL;
+   DG_(clo_defs_cache) = NULL;
+}
@@ -0,0 +1,1101 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: compares two traces.                    dg_diff.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_diff compares two traces of the same program, as before and after a
+ * change of data layout, and prints what changed for each call stack and
+ * each tracked range, much as cg_diff does for cachegrind.
+ *
+ * Addresses differ between builds, so contexts are matched by their
+ * symbolised stacks: each instruction address is looked up in the symbol
+ * table of the object it falls in, found from the DG_R_TEXT_AVMA records,
+ * and a stack becomes the names of its functions. Contexts with the same
+ * names, which differ only in their block or in the lines of a function,
+ * are counted together. Tracked ranges are matched by type and label.
+ *
+ * Each trace is decoded with dgt_decode_parallel, as in dg_stat, with
+ * every thread counting into its own table by key, so memory is bounded
+ * by the number of distinct stacks and labels. Distinct lines are
+ * estimated with small HyperLogLog sketches, and simulated misses are
+ * taken from the DG_R_CACHE_MISSES records of traces that have them.
+ */
+
+#include <elf.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+#define LINE_SHIFT 6
+#define HLL_BITS   7
+#define HLL_SIZE   (1 << HLL_BITS)
+#define MAX_FRAMES 8          /* Printed for each stack */
+
+static const char *argv0 = "dg_diff";
+
+enum { M_ACCESSES, M_BYTES, M_LINES, M_D1, M_LL, N_METRICS };
+
+static const char *const metric_names[N_METRICS] =
+{
+   "accesses", "bytes", "lines", "d1", "ll"
+};
+
+typedef struct
+{
+   uint64_t accesses;
+   uint64_t bytes;
+   uint8_t hll[HLL_SIZE];
+} counts;
+
+/* A stack or a label, with what each trace had of it */
+typedef struct
+{
+   char *name;               /* Frames separated by " < ", or type and label */
+   int is_range;
+   int seen[2];
+   counts c[2];
+   uint64_t d1_misses[2], ll_misses[2];
+} key;
+
+typedef struct
+{
+   uint64_t addr;
+   uint64_t size;
+   const char *name;
+} symbol;
+
+/* An object with text, from a DG_R_TEXT_AVMA record */
+typedef struct
+{
+   const char *filename;
+   const char *basename;
+   uint64_t bias;            /* Added to the addresses in the file */
+   uint64_t start, end;      /* Of its executable segments, in the trace */
+   symbol *symbols;          /* Sorted by address */
+   size_t n_symbols;
+   char *strtab;
+} object;
+
+typedef struct
+{
+   uint64_t addr;
+   uint64_t len;
+   const char *type;
+   const char *label;
+   uint64_t key;
+} range;
+
+typedef struct
+{
+   const char *name;
+   dgt_file *file;
+   dgt_defs *defs;
+   int side;
+   object *objects;
+   size_t n_objects;
+   range *ranges;            /* Sorted by address */
+   size_t n_ranges;
+   uint64_t n_contexts;
+   uint64_t *context_keys;
+   uint64_t *d1_misses;      /* By context, from DG_R_CACHE_MISSES */
+   uint64_t *ll_misses;
+   uint64_t n_misses;        /* Contexts with an entry */
+   size_t misses_size;
+   int cache_sim;
+} trace;
+
+typedef struct
+{
+   const trace *tr;
+   uint64_t n_keys;
+   counts *c;
+} worker;
+
+static key *keys = NULL;
+static size_t n_keys = 0, keys_size = 0;
+static uint64_t *key_table = NULL;   /* Open addressing, index + 1 */
+static size_t key_table_size = 0;
+
+static void out_of_memory(void)
+{
+   fprintf(stderr, "%s: out of memory\n", argv0);
+   exit(1);
+}
+
+static void *xcalloc(size_t n, size_t size)
+{
+   void *p = calloc(n > 0 ? n : 1, size);
+
+   if (p == NULL)
+      out_of_memory();
+   return p;
+}
+
+static void *grow(void *array, size_t n, size_t *size, size_t elem_size)
+{
+   if (n + 1 > *size)
+   {
+      size_t new_size = *size > 0 ? *size * 2 : 256;
+
+      while (new_size < n + 1)
+         new_size *= 2;
+      array = realloc(array, new_size * elem_size);
+      if (array == NULL)
+         out_of_memory();
+      *size = new_size;
+   }
+   return array;
+}
+
+static char *xstrdup(const char *s)
+{
+   char *copy = strdup(s);
+
+   if (copy == NULL)
+      out_of_memory();
+   return copy;
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: compares the contexts and tracked ranges of two Datagrind traces\n"
+"usage: %s [options] old-trace new-trace\n"
+"    --threads=<n>     threads to decode with [one per processor]\n"
+"    --top=<n>         stacks and ranges to list [20]\n"
+"    --sort=accesses|bytes|lines|d1|ll\n"
+"                      list by the largest change in this [accesses]\n",
+           argv0, argv0);
+   exit(2);
+}
+
+/*------------------------------------------------------------*/
+/*--- Counting                                             ---*/
+/*------------------------------------------------------------*/
+
+static uint64_t hash64(uint64_t x)
+{
+   x += 0x9E3779B97F4A7C15ULL;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+   return x ^ (x >> 31);
+}
+
+static void hll_add(uint8_t *hll, uint64_t value)
+{
+   uint64_t h = hash64(value);
+   uint64_t rest = (h << HLL_BITS) | (1ULL << (HLL_BITS - 1));
+   uint8_t rank = __builtin_clzll(rest) + 1;
+   uint8_t *reg = &hll[h >> (64 - HLL_BITS)];
+
+   if (rank > *reg)
+      *reg = rank;
+}
+
+static double hll_estimate(const uint8_t *hll)
+{
+   double sum = 0.0, m = HLL_SIZE, estimate;
+   int zeros = 0, i;
+
+   for (i = 0; i < HLL_SIZE; i++)
+   {
+      sum += ldexp(1.0, -hll[i]);
+      if (hll[i] == 0)
+         zeros++;
+   }
+   estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+   if (estimate <= 2.5 * m && zeros > 0)
+      estimate = m * log(m / zeros);
+   return estimate;
+}
+
+static void counts_add(counts *to, const counts *from)
+{
+   int i;
+
+   to->accesses += from->accesses;
+   to->bytes += from->bytes;
+   for (i = 0; i < HLL_SIZE; i++)
+      if (from->hll[i] > to->hll[i])
+         to->hll[i] = from->hll[i];
+}
+
+/*------------------------------------------------------------*/
+/*--- Keys                                                 ---*/
+/*------------------------------------------------------------*/
+
+static uint64_t hash_string(const char *s, int is_range)
+{
+   uint64_t h = 0xCBF29CE484222325ULL ^ is_range;
+
+   for (; *s != '\0'; s++)
+      h = (h ^ (unsigned char) *s) * 0x100000001B3ULL;
+   return h;
+}
+
+static void key_table_resize(size_t size)
+{
+   size_t i;
+
+   free(key_table);
+   key_table = xcalloc(size, sizeof(uint64_t));
+   key_table_size = size;
+   for (i = 0; i < n_keys; i++)
+   {
+      size_t j = hash_string(keys[i].name, keys[i].is_range) & (size - 1);
+
+      while (key_table[j] != 0)
+         j = (j + 1) & (size - 1);
+      key_table[j] = i + 1;
+   }
+}
+
+/* Returns the index of the key with the name, adding it if it is new */
+static uint64_t intern(const char *name, int is_range)
+{
+   size_t j;
+
+   if (2 * (n_keys + 1) > key_table_size)
+      key_table_resize(key_table_size > 0 ? 2 * key_table_size : 1024);
+   j = hash_string(name, is_range) & (key_table_size - 1);
+   for (; key_table[j] != 0; j = (j + 1) & (key_table_size - 1))
+   {
+      const key *k = &keys[key_table[j] - 1];
+      if (k->is_range == is_range && strcmp(k->name, name) == 0)
+         return key_table[j] - 1;
+   }
+   keys = grow(keys, n_keys, &keys_size, sizeof(key));
+   memset(&keys[n_keys], 0, sizeof(key));
+   keys[n_keys].name = xstrdup(name);
+   keys[n_keys].is_range = is_range;
+   key_table[j] = n_keys + 1;
+   return n_keys++;
+}
+
+/*------------------------------------------------------------*/
+/*--- Symbols                                              ---*/
+/*------------------------------------------------------------*/
+
+/* The parts of ELF headers that are used, for either class */
+typedef struct
+{
+   uint64_t type, flags, offset, addr, size, link;
+   uint32_t name;
+} elf_section;
+
+static int cmp_symbol(const void *a, const void *b)
+{
+   const symbol *sa = a;
+   const symbol *sb = b;
+
+   if (sa->addr != sb->addr)
+      return sa->addr < sb->addr ? -1 : 1;
+   return 0;
+}
+
+static int get_section(const uint8_t *image, size_t image_size, int is64,
+                       uint64_t shoff, uint32_t shentsize, uint32_t i, elf_section *s)
+{
+   uint64_t off = shoff + (uint64_t) i * shentsize;
+
+   if (off + shentsize > image_size)
+      return 0;
+   if (is64)
+   {
+      const Elf64_Shdr *sh = (const Elf64_Shdr *) (image + off);
+      s->name = sh->sh_name;
+      s->type = sh->sh_type;
+      s->flags = sh->sh_flags;
+      s->addr = sh->sh_addr;
+      s->offset = sh->sh_offset;
+      s->size = sh->sh_size;
+      s->link = sh->sh_link;
+   }
+   else
+   {
+      const Elf32_Shdr *sh = (const Elf32_Shdr *) (image + off);
+      s->name = sh->sh_name;
+      s->type = sh->sh_type;
+      s->flags = sh->sh_flags;
+      s->addr = sh->sh_addr;
+      s->offset = sh->sh_offset;
+      s->size = sh->sh_size;
+      s->link = sh->sh_link;
+   }
+   return s->type == SHT_NOBITS || s->offset + s->size <= image_size;
+}
+
+/* Reads the function symbols of the object, from .symtab if it has one
+ * and otherwise .dynsym, and where its text and executable segments are.
+ * An object that cannot be read is left without symbols, and its
+ * addresses are printed as they are.
+ */
+static void load_object(object *obj, uint64_t text_avma)
+{
+   FILE *f = fopen(obj->filename, "rb");
+   uint8_t *image = NULL;
+   long image_size;
+   int is64;
+   uint64_t shoff, phoff, text_svma = 0;
+   uint32_t shentsize, shnum, shstrndx, phentsize, phnum, i;
+   elf_section shstr, symtab, strtab, s;
+   int have_symtab = 0, have_text = 0;
+   size_t symbols_size = 0;
+
+   memset(&symtab, 0, sizeof(symtab));
+   memset(&strtab, 0, sizeof(strtab));
+
+   if (f == NULL)
+      return;
+   if (fseek(f, 0, SEEK_END) != 0 || (image_size = ftell(f)) < (long) sizeof(Elf64_Ehdr)
+       || fseek(f, 0, SEEK_SET) != 0)
+      goto out;
+   image = malloc(image_size);
+   if (image == NULL || fread(image, 1, image_size, f) != (size_t) image_size)
+      goto out;
+   if (memcmp(image, ELFMAG, SELFMAG) != 0)
+      goto out;
+   is64 = image[EI_CLASS] == ELFCLASS64;
+   if (is64)
+   {
+      const Elf64_Ehdr *eh = (const Elf64_Ehdr *) image;
+      shoff = eh->e_shoff;
+      shentsize = eh->e_shentsize;
+      shnum = eh->e_shnum;
+      shstrndx = eh->e_shstrndx;
+      phoff = eh->e_phoff;
+      phentsize = eh->e_phentsize;
+      phnum = eh->e_phnum;
+   }
+   else
+   {
+      const Elf32_Ehdr *eh = (const Elf32_Ehdr *) image;
+      shoff = eh->e_shoff;
+      shentsize = eh->e_shentsize;
+      shnum = eh->e_shnum;
+      shstrndx = eh->e_shstrndx;
+      phoff = eh->e_phoff;
+      phentsize = eh->e_phentsize;
+      phnum = eh->e_phnum;
+   }
+   if (shentsize < (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr))
+       || !get_section(image, image_size, is64, shoff, shentsize, shstrndx, &shstr))
+      goto out;
+
+   /* The bias comes from where the text is compared with where it was linked */
+   for (i = 0; i < shnum; i++)
+   {
+      const char *name;
+
+      if (!get_section(image, image_size, is64, shoff, shentsize, i, &s)
+          || s.name >= shstr.size)
+         continue;
+      name = (const char *) image + shstr.offset + s.name;
+      if (strcmp(name, ".text") == 0)
+      {
+         text_svma = s.addr;
+         have_text = 1;
+      }
+      if (s.type == SHT_SYMTAB || (s.type == SHT_DYNSYM && !have_symtab))
+      {
+         if (get_section(image, image_size, is64, shoff, shentsize, s.link, &strtab))
+         {
+            symtab = s;
+            have_symtab = s.type == SHT_SYMTAB;
+         }
+      }
+   }
+   if (!have_text)
+      goto out;
+   obj->bias = text_avma - text_svma;
+
+   obj->start = ~(uint64_t) 0;
+   obj->end = 0;
+   for (i = 0; i < phnum; i++)
+   {
+      uint64_t off = phoff + (uint64_t) i * phentsize, vaddr, memsz;
+      uint32_t type, flags;
+
+      if (off + (is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) > (uint64_t) image_size)
+         break;
+      if (is64)
+      {
+         const Elf64_Phdr *ph = (const Elf64_Phdr *) (image + off);
+         type = ph->p_type;
+         flags = ph->p_flags;
+         vaddr = ph->p_vaddr;
+         memsz = ph->p_memsz;
+      }
+      else
+      {
+         const Elf32_Phdr *ph = (const Elf32_Phdr *) (image + off);
+         type = ph->p_type;
+         flags = ph->p_flags;
+         vaddr = ph->p_vaddr;
+         memsz = ph->p_memsz;
+      }
+      if (type != PT_LOAD || !(flags & PF_X))
+         continue;
+      if (vaddr + obj->bias < obj->start)
+         obj->start = vaddr + obj->bias;
+      if (vaddr + memsz + obj->bias > obj->end)
+         obj->end = vaddr + memsz + obj->bias;
+   }
+
+   if (strtab.size == 0 || symtab.size == 0 || symtab.type == SHT_NOBITS)
+      goto out;
+   obj->strtab = malloc(strtab.size + 1);
+   if (obj->strtab == NULL)
+      out_of_memory();
+   memcpy(obj->strtab, image + strtab.offset, strtab.size);
+   obj->strtab[strtab.size] = '\0';
+   for (i = 0; i < symtab.size / (is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym)); i++)
+   {
+      uint64_t value, size;
+      uint32_t name;
+      unsigned char info;
+      uint16_t shndx;
+
+      if (is64)
+      {
+         const Elf64_Sym *sym = (const Elf64_Sym *) (image + symtab.offset) + i;
+         value = sym->st_value;
+         size = sym->st_size;
+         name = sym->st_name;
+         info = sym->st_info;
+         shndx = sym->st_shndx;
+      }
+      else
+      {
+         const Elf32_Sym *sym = (const Elf32_Sym *) (image + symtab.offset) + i;
+         value = sym->st_value;
+         size = sym->st_size;
+         name = sym->st_name;
+         info = sym->st_info;
+         shndx = sym->st_shndx;
+      }
+      if ((ELF64_ST_TYPE(info) != STT_FUNC && ELF64_ST_TYPE(info) != STT_GNU_IFUNC)
+          || shndx == SHN_UNDEF || name >= strtab.size || value == 0)
+         continue;
+      obj->symbols = grow(obj->symbols, obj->n_symbols, &symbols_size, sizeof(symbol));
+      obj->symbols[obj->n_symbols].addr = value;
+      obj->symbols[obj->n_symbols].size = size;
+      obj->symbols[obj->n_symbols].name = obj->strtab + name;
+      obj->n_symbols++;
+   }
+   qsort(obj->symbols, obj->n_symbols, sizeof(symbol), cmp_symbol);
+
+out:
+   free(image);
+   fclose(f);
+}
+
+static const symbol *find_symbol(const object *obj, uint64_t svma)
+{
+   size_t lo = 0, hi = obj->n_symbols;
+
+   while (lo < hi)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+      if (obj->symbols[mid].addr <= svma)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   /* Symbols without a size, such as _init, only name their first byte,
+    * so that the PLT after them is not taken for a part of them.
+    */
+   if (lo > 0 && (svma == obj->symbols[lo - 1].addr
+                  || svma - obj->symbols[lo - 1].addr < obj->symbols[lo - 1].size))
+      return &obj->symbols[lo - 1];
+   return NULL;
+}
+
+/* Appends the name of the frame at ip to buf */
+static void frame_name(const trace *tr, uint64_t ip, char *buf, size_t size)
+{
+   size_t i;
+
+   for (i = 0; i < tr->n_objects; i++)
+   {
+      const object *obj = &tr->objects[i];
+
+      if (ip >= obj->start && ip < obj->end)
+      {
+         const symbol *sym = find_symbol(obj, ip - obj->bias);
+
+         if (sym != NULL)
+            snprintf(buf, size, "%s:%s", obj->basename, sym->name);
+         else
+            snprintf(buf, size, "%s+%#llx", obj->basename,
+                     (unsigned long long) (ip - obj->bias));
+         return;
+      }
+   }
+   snprintf(buf, size, "%#llx", (unsigned long long) ip);
+}
+
+/* Gives every context the key of its symbolised stack. Callers are given
+ * by return addresses, which are looked up a byte early, so that a call at
+ * the end of a function is not taken for the next.
+ */
+static void key_contexts(trace *tr)
+{
+   dgt_decoder *decoder;
+   char *name = NULL, frame[512];
+   size_t name_size = 0;
+   uint64_t i;
+   int ret;
+
+   ret = dgt_decoder_new_shared(tr->file, tr->defs, &decoder);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, tr->name, dgt_strerror(ret));
+      exit(1);
+   }
+   tr->context_keys = xcalloc(tr->n_contexts, sizeof(uint64_t));
+   for (i = 0; i < tr->n_contexts; i++)
+   {
+      const dgt_context *context = dgt_decoder_context(decoder, i);
+      size_t len = 0;
+      uint32_t j;
+
+      for (j = 0; j < context->n_stack; j++)
+      {
+         uint64_t ip = dgt_context_ip(tr->file, context, j);
+         size_t flen;
+
+         frame_name(tr, j > 0 && ip > 0 ? ip - 1 : ip, frame, sizeof(frame));
+         flen = strlen(frame);
+         name = grow(name, len + flen + 4, &name_size, 1);
+         if (j > 0)
+         {
+            memcpy(name + len, " < ", 3);
+            len += 3;
+         }
+         memcpy(name + len, frame, flen);
+         len += flen;
+      }
+      name = grow(name, len, &name_size, 1);
+      name[len] = '\0';
+      tr->context_keys[i] = intern(name, 0);
+   }
+   free(name);
+   dgt_decoder_free(decoder);
+}
+
+/*------------------------------------------------------------*/
+/*--- Reading a trace                                      ---*/
+/*------------------------------------------------------------*/
+
+static int cmp_range(const void *a, const void *b)
+{
+   const range *ra = a;
+   const range *rb = b;
+
+   if (ra->addr != rb->addr)
+      return ra->addr < rb->addr ? -1 : 1;
+   return 0;
+}
+
+static const range *find_range(const trace *tr, uint64_t addr)
+{
+   size_t lo = 0, hi = tr->n_ranges;
+
+   /* Finds the last range starting at or before addr */
+   while (lo < hi)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+      if (tr->ranges[mid].addr <= addr)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   if (lo > 0 && addr - tr->ranges[lo - 1].addr < tr->ranges[lo - 1].len)
+      return &tr->ranges[lo - 1];
+   return NULL;
+}
+
+static void add_misses(trace *tr, const uint8_t *p, const uint8_t *end, int prefetch)
+{
+   uint64_t context, n, refs, d1 = 0, ll = 0, value, i;
+   int k;
+
+   if ((p = dgt_get_uvarint(p, end, &context)) == NULL
+       || (p = dgt_get_uvarint(p, end, &n)) == NULL)
+      return;
+   for (i = 0; i < n; i++)
+   {
+      if ((p = dgt_get_uvarint(p, end, &refs)) == NULL
+          || (p = dgt_get_uvarint(p, end, &value)) == NULL)
+         return;
+      d1 += value;
+      if ((p = dgt_get_uvarint(p, end, &value)) == NULL)
+         return;
+      ll += value;
+      for (k = 0; prefetch && k < 3; k++)
+         if ((p = dgt_get_uvarint(p, end, &value)) == NULL)
+            return;
+   }
+   if (context >= tr->n_misses)
+   {
+      size_t size = tr->misses_size;
+
+      tr->d1_misses = grow(tr->d1_misses, context, &size, sizeof(uint64_t));
+      tr->ll_misses = grow(tr->ll_misses, context, &tr->misses_size, sizeof(uint64_t));
+      memset(tr->d1_misses + tr->n_misses, 0, (context + 1 - tr->n_misses) * sizeof(uint64_t));
+      memset(tr->ll_misses + tr->n_misses, 0, (context + 1 - tr->n_misses) * sizeof(uint64_t));
+      tr->n_misses = context + 1;
+   }
+   tr->d1_misses[context] += d1;
+   tr->ll_misses[context] += ll;
+}
+
+/* Gathers the objects, the tracked ranges and the cache misses */
+static void walk(trace *tr)
+{
+   size_t ws = dgt_file_header(tr->file)->word_size;
+   size_t objects_size = 0, ranges_size = 0;
+   int prefetch = 0;
+   dgt_cursor cursor;
+   dgt_record record;
+   int ret;
+
+   dgt_cursor_init(&cursor, tr->file);
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+
+      switch (record.type)
+      {
+      case DG_R_TEXT_AVMA:
+         if (record.length > ws && end[-1] == '\0')
+         {
+            object *obj;
+            const char *slash;
+
+            tr->objects = grow(tr->objects, tr->n_objects, &objects_size, sizeof(object));
+            obj = &tr->objects[tr->n_objects++];
+            memset(obj, 0, sizeof(*obj));
+            obj->filename = (const char *) p + ws;
+            slash = strrchr(obj->filename, '/');
+            obj->basename = slash != NULL ? slash + 1 : obj->filename;
+            load_object(obj, dgt_get_word(tr->file, p));
+         }
+         break;
+      case DG_R_TRACK_RANGE:
+         if (record.length > 2 * ws && end[-1] == '\0')
+         {
+            range *r;
+            const char *label = memchr(p + 2 * ws, '\0', end - (p + 2 * ws));
+            char *name;
+
+            tr->ranges = grow(tr->ranges, tr->n_ranges, &ranges_size, sizeof(range));
+            r = &tr->ranges[tr->n_ranges++];
+            r->addr = dgt_get_word(tr->file, p);
+            r->len = dgt_get_word(tr->file, p + ws);
+            r->type = (const char *) p + 2 * ws;
+            r->label = label + 1 < (const char *) end ? label + 1 : "";
+            name = xcalloc(strlen(r->type) + strlen(r->label) + 2, 1);
+            sprintf(name, "%s %s", r->type, r->label);
+            r->key = intern(name, 1);
+            free(name);
+         }
+         break;
+      case DG_R_CACHE_CONFIG:
+         {
+            uint64_t value;
+            int k;
+
+            /* Six sizes, then the prefetcher if there is one */
+            for (k = 0; k < 6 && p != NULL; k++)
+               p = dgt_get_uvarint(p, end, &value);
+            prefetch = p != NULL && p < end;
+            tr->cache_sim = 1;
+         }
+         break;
+      case DG_R_CACHE_MISSES:
+         add_misses(tr, p, end, prefetch);
+         break;
+      default:
+         break;
+      }
+   }
+   if (ret < 0)
+      fprintf(stderr, "%s: warning: %s: %s; only the records before offset %llu are read\n",
+              argv0, tr->name, dgt_strerror(ret), (unsigned long long) cursor.pos);
+   /* Ranges tracked again at the same address count for the last */
+   qsort(tr->ranges, tr->n_ranges, sizeof(range), cmp_range);
+}
+
+static void *worker_new(void *arg)
+{
+   const trace *tr = arg;
+   worker *w = xcalloc(1, sizeof(worker));
+
+   w->tr = tr;
+   w->n_keys = n_keys;
+   w->c = xcalloc(n_keys, sizeof(counts));
+   return w;
+}
+
+static int worker_item(void *wp, const dgt_decoder *decoder, int kind,
+                       const dgt_record *record, const dgt_run *run)
+{
+   worker *w = wp;
+   const trace *tr = w->tr;
+   counts *c;
+   uint32_t i;
+
+   (void) decoder;
+   (void) record;
+   if (kind != DGT_ITEM_RUN)
+      return 0;
+   c = &w->c[tr->context_keys[run->context_index]];
+   for (i = 0; i < run->n_accesses; i++)
+   {
+      const dgt_access *a = &run->accesses[i];
+      const range *r;
+
+      if (a->dir == DG_ACC_EXEC)
+         continue;
+      c->accesses++;
+      c->bytes += a->size;
+      hll_add(c->hll, a->addr >> LINE_SHIFT);
+      r = find_range(tr, a->addr);
+      if (r != NULL)
+      {
+         counts *rc = &w->c[r->key];
+         rc->accesses++;
+         rc->bytes += a->size;
+         hll_add(rc->hll, a->addr >> LINE_SHIFT);
+      }
+   }
+   return 0;
+}
+
+static void worker_merge(void *arg, void *wp)
+{
+   const trace *tr = arg;
+   worker *w = wp;
+   uint64_t i;
+
+   for (i = 0; i < w->n_keys; i++)
+      if (w->c[i].accesses > 0)
+      {
+         counts_add(&keys[i].c[tr->side], &w->c[i]);
+         keys[i].seen[tr->side] = 1;
+      }
+   free(w->c);
+   free(w);
+}
+
+static void read_trace(trace *tr, unsigned int n_threads)
+{
+   uint64_t i;
+   int ret;
+
+   ret = dgt_open(tr->name, &tr->file);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, tr->name, dgt_strerror(ret));
+      exit(1);
+   }
+   walk(tr);
+   ret = dgt_defs_new(tr->file, n_threads, &tr->defs);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, tr->name, dgt_strerror(ret));
+      exit(1);
+   }
+   tr->n_contexts = dgt_defs_n_contexts(tr->defs);
+   key_contexts(tr);
+   for (i = 0; i < tr->n_misses && i < tr->n_contexts; i++)
+   {
+      key *k = &keys[tr->context_keys[i]];
+      k->d1_misses[tr->side] += tr->d1_misses[i];
+      k->ll_misses[tr->side] += tr->ll_misses[i];
+   }
+   /* Ranges are matched even if they had no accesses */
+   for (i = 0; i < tr->n_ranges; i++)
+      keys[tr->ranges[i].key].seen[tr->side] = 1;
+}
+
+static void decode_trace(trace *tr, unsigned int n_threads)
+{
+   dgt_parallel_ops ops;
+   int ret;
+
+   ops.arg = tr;
+   ops.worker_new = worker_new;
+   ops.item = worker_item;
+   ops.merge = worker_merge;
+   ret = dgt_decode_parallel(tr->file, tr->defs, n_threads, &ops);
+   if (ret != DGT_OK)
+      fprintf(stderr, "%s: %s: %s; the counts are incomplete\n",
+              argv0, tr->name, dgt_strerror(ret));
+}
+
+static void free_trace(trace *tr)
+{
+   size_t i;
+
+   for (i = 0; i < tr->n_objects; i++)
+   {
+      free(tr->objects[i].symbols);
+      free(tr->objects[i].strtab);
+   }
+   free(tr->objects);
+   free(tr->ranges);
+   free(tr->context_keys);
+   free(tr->d1_misses);
+   free(tr->ll_misses);
+   dgt_defs_free(tr->defs);
+   dgt_close(tr->file);
+}
+
+/*------------------------------------------------------------*/
+/*--- Printing                                             ---*/
+/*------------------------------------------------------------*/
+
+static double metric(const key *k, int side, int m)
+{
+   switch (m)
+   {
+   case M_ACCESSES: return k->c[side].accesses;
+   case M_BYTES:    return k->c[side].bytes;
+   case M_LINES:    return k->c[side].accesses > 0 ? hll_estimate(k->c[side].hll) : 0.0;
+   case M_D1:       return k->d1_misses[side];
+   default:         return k->ll_misses[side];
+   }
+}
+
+static int sort_metric;
+
+static int cmp_change(const void *a, const void *b)
+{
+   const key *ka = &keys[*(const size_t *) a];
+   const key *kb = &keys[*(const size_t *) b];
+   double da = fabs(metric(ka, 1, sort_metric) - metric(ka, 0, sort_metric));
+   double db = fabs(metric(kb, 1, sort_metric) - metric(kb, 0, sort_metric));
+
+   if (da != db)
+      return da > db ? -1 : 1;
+   return *(const size_t *) a < *(const size_t *) b ? -1 : 1;
+}
+
+static void print_change(double old, double new)
+{
+   printf(" %+14.0f", new - old);
+   if (old > 0)
+      printf(" %+7.1f%%", 100.0 * (new - old) / old);
+   else
+      printf(" %8s", new > 0 ? "new" : "");
+}
+
+static void print_totals(int cache_sim)
+{
+   double totals[2][N_METRICS];
+   counts lines[2];
+   size_t i;
+   int side, m;
+
+   memset(totals, 0, sizeof(totals));
+   memset(lines, 0, sizeof(lines));
+   for (i = 0; i < n_keys; i++)
+   {
+      if (keys[i].is_range)
+         continue;
+      for (side = 0; side < 2; side++)
+      {
+         counts_add(&lines[side], &keys[i].c[side]);
+         for (m = 0; m < N_METRICS; m++)
+            if (m != M_LINES)
+               totals[side][m] += metric(&keys[i], side, m);
+      }
+   }
+   for (side = 0; side < 2; side++)
+      totals[side][M_LINES] = lines[side].accesses > 0 ? hll_estimate(lines[side].hll) : 0.0;
+
+   printf("\n%-12s %16s %16s %15s %8s\n", "Total", "Old", "New", "Change", "Change%");
+   for (m = 0; m < N_METRICS; m++)
+   {
+      if ((m == M_D1 || m == M_LL) && !cache_sim)
+         continue;
+      printf("%-12s %16.0f %16.0f", metric_names[m], totals[0][m], totals[1][m]);
+      print_change(totals[0][m], totals[1][m]);
+      printf("\n");
+   }
+}
+
+/* Prints the frames of a stack, innermost first */
+static void print_stack(const char *name)
+{
+   const char *p = name;
+   int i;
+
+   for (i = 0; i < MAX_FRAMES && p != NULL; i++)
+   {
+      const char *next = strstr(p, " < ");
+
+      printf("%s%.*s", i > 0 ? " < " : " ", next != NULL ? (int) (next - p) : (int) strlen(p), p);
+      p = next != NULL ? next + 3 : NULL;
+   }
+   if (p != NULL)
+      printf(" < ...");
+}
+
+static void print_keys(int is_range, size_t n_top, int cache_sim)
+{
+   size_t *order = xcalloc(n_keys, sizeof(size_t));
+   size_t n = 0, i;
+   int m;
+
+   for (i = 0; i < n_keys; i++)
+      if (keys[i].is_range == is_range && (keys[i].seen[0] || keys[i].seen[1]))
+         order[n++] = i;
+   if (n == 0)
+   {
+      free(order);
+      return;
+   }
+   qsort(order, n, sizeof(size_t), cmp_change);
+   if (n_top > n)
+      n_top = n;
+   if (metric(&keys[order[0]], 0, sort_metric) == metric(&keys[order[0]], 1, sort_metric))
+   {
+      printf("\n%s: no change in %s\n", is_range ? "Tracked ranges" : "Stacks",
+             metric_names[sort_metric]);
+      free(order);
+      return;
+   }
+
+   printf("\n%s by change in %s\n", is_range ? "Tracked ranges" : "Stacks",
+          metric_names[sort_metric]);
+   printf("%14s %14s", "Old", "New");
+   for (m = 0; m < N_METRICS; m++)
+      if ((m != M_D1 && m != M_LL) || (cache_sim && !is_range))
+         printf(" %14s %8s", metric_names[m], "");
+   printf("  %s\n", is_range ? "Type and label" : "Stack");
+   for (i = 0; i < n_top; i++)
+   {
+      const key *k = &keys[order[i]];
+
+      if (metric(k, 0, sort_metric) == metric(k, 1, sort_metric))
+         break;
+      printf("%14.0f %14.0f", metric(k, 0, sort_metric), metric(k, 1, sort_metric));
+      for (m = 0; m < N_METRICS; m++)
+         if ((m != M_D1 && m != M_LL) || (cache_sim && !is_range))
+            print_change(metric(k, 0, m), metric(k, 1, m));
+      if (!k->seen[0] || !k->seen[1])
+         printf("  [%s only]", k->seen[0] ? "old" : "new");
+      if (is_range)
+         printf("  %s", k->name);
+      else
+         print_stack(k->name);
+      printf("\n");
+   }
+   free(order);
+}
+
+int main(int argc, char **argv)
+{
+   trace traces[2];
+   const char *names[2] = { NULL, NULL };
+   unsigned int n_threads = 0;
+   size_t n_top = 20, i;
+   int n_names = 0, side, cache_sim;
+
+   if (argv[0])
+      argv0 = argv[0];
+   sort_metric = M_ACCESSES;
+   for (i = 1; i < (size_t) argc; i++)
+   {
+      if (strncmp(argv[i], "--threads=", 10) == 0)
+         n_threads = strtoul(argv[i] + 10, NULL, 10);
+      else if (strncmp(argv[i], "--top=", 6) == 0)
+         n_top = strtoull(argv[i] + 6, NULL, 10);
+      else if (strncmp(argv[i], "--sort=", 7) == 0)
+      {
+         for (sort_metric = 0; sort_metric < N_METRICS; sort_metric++)
+            if (strcmp(argv[i] + 7, metric_names[sort_metric]) == 0)
+               break;
+         if (sort_metric == N_METRICS)
+            usage();
+      }
+      else if (argv[i][0] == '-' || n_names == 2)
+         usage();
+      else
+         names[n_names++] = argv[i];
+   }
+   if (n_names != 2)
+      usage();
+
+   /* Every key must be known before either trace is decoded, so that the
+    * tables of the workers cover them all.
+    */
+   for (side = 0; side < 2; side++)
+   {
+      memset(&traces[side], 0, sizeof(trace));
+      traces[side].name = names[side];
+      traces[side].side = side;
+      read_trace(&traces[side], n_threads);
+   }
+   for (side = 0; side < 2; side++)
+      decode_trace(&traces[side], n_threads);
+   cache_sim = traces[0].cache_sim && traces[1].cache_sim;
+   if ((sort_metric == M_D1 || sort_metric == M_LL) && !cache_sim)
+   {
+      fprintf(stderr, "%s: --sort=%s needs both traces to have --datagrind-cache-sim=yes\n",
+              argv0, metric_names[sort_metric]);
+      return 2;
+   }
+
+   printf("Old:           %s\n", names[0]);
+   printf("New:           %s\n", names[1]);
+   print_totals(cache_sim);
+   print_keys(0, n_top, cache_sim);
+   /* Misses are only known by context */
+   if (sort_metric != M_D1 && sort_metric != M_LL)
+      print_keys(1, n_top, cache_sim);
+
+   for (side = 0; side < 2; side++)
+      free_trace(&traces[side]);
+   for (i = 0; i < n_keys; i++)
+      free(keys[i].name);
+   free(keys);
+   free(key_table);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
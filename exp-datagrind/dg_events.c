@@ -0,0 +1,392 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: summaries of event regions.          dg_events.c  ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_threadstate.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-event-stats=yes, each thread keeps a stack of the
+ * events it has started and not yet ended, and every access it makes is
+ * added to all of them: the reads and writes, the distinct cache lines,
+ * and the accesses per context and per tracked range. An end event
+ * closes the innermost open event with the same label, and the totals
+ * with the contexts and ranges that had the most accesses are written
+ * after the label of its DG_R_END_EVENT.
+ *
+ * Lines, contexts and ranges are counted exactly, in an open-addressing
+ * hash table with linear probing per event, so memory grows with what
+ * the open events touch.
+ */
+
+#define DG_EVENTS_LINE_SHIFT 6
+#define DG_EVENTS_INITIAL    (1 << 6)
+
+typedef struct
+{
+   UWord key;           /* Plus one, so that 0 marks an empty slot */
+   ULong count;
+} DgEventCount;
+
+typedef struct
+{
+   DgEventCount *slots;
+   SizeT size;          /* Power of 2 */
+   SizeT used;
+} DgEventTable;
+
+typedef struct
+{
+   HChar label[64];
+   SizeT label_len;
+   ULong reads, writes;
+   ULong read_bytes, write_bytes;
+   DgEventTable lines;
+   DgEventTable contexts;
+   DgEventTable ranges;
+} DgEvent;
+
+typedef struct
+{
+   Addr start;
+   Addr end;            /* One past the last byte */
+   Bool active;
+} DgEventsRange;
+
+Bool DG_(clo_event_stats) = False;
+static Long clo_event_top = 5;
+
+/* DgEvent, innermost last, per thread */
+static XArray **stacks = NULL;
+
+static XArray *ranges = NULL;   /* DgEventsRange, as registered */
+static Word n_active_ranges = 0;
+
+Bool DG_(events_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-event-stats", DG_(clo_event_stats))) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-event-top", clo_event_top, 0, DG_EVENT_TOP_MAX)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(events_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-event-stats=yes|no   summarise the accesses of each event\n"
+"                                     in its end record [no]\n"
+"    --datagrind-event-top=<n>        contexts and ranges to list in each\n"
+"                                     summary [5]\n"
+   );
+}
+
+void DG_(events_init)(void)
+{
+   if (!DG_(clo_event_stats))
+      return;
+   stacks = VG_(calloc)("datagrind.events.stacks", VG_N_THREADS, sizeof(XArray *));
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.events.ranges", VG_(free),
+                       sizeof(DgEventsRange));
+}
+
+void DG_(events_track)(Addr addr, SizeT len)
+{
+   DgEventsRange range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(events_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgEventsRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+/* Returns the number of the first active range containing addr, plus
+ * one, or 0 if there is none.
+ */
+static UWord find_range(Addr addr)
+{
+   Word n, i;
+
+   if (n_active_ranges == 0)
+      return 0;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      const DgEventsRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && addr - range->start < range->end - range->start)
+         return i + 1;
+   }
+   return 0;
+}
+
+static inline SizeT count_hash(const DgEventTable *t, UWord key)
+{
+   UWord h = key * 0x9E3779B1U;
+   return (h ^ (h >> 15)) & (t->size - 1);
+}
+
+static DgEventCount *count_slot(const DgEventTable *t, UWord key)
+{
+   SizeT i = count_hash(t, key);
+
+   for (;;)
+   {
+      DgEventCount *c = &t->slots[i];
+      if (c->key == 0 || c->key == key)
+         return c;
+      i = (i + 1) & (t->size - 1);
+   }
+}
+
+static void count_resize(DgEventTable *t, SizeT size)
+{
+   DgEventCount *old = t->slots;
+   SizeT old_size = t->size;
+   SizeT i;
+
+   t->slots = VG_(calloc)("datagrind.events.table", size, sizeof(DgEventCount));
+   t->size = size;
+   for (i = 0; i < old_size; i++)
+      if (old[i].key != 0)
+         *count_slot(t, old[i].key) = old[i];
+   if (old != NULL)
+      VG_(free)(old);
+}
+
+/* Adds one to the count of key, which must not be 0. */
+static void count_add(DgEventTable *t, UWord key)
+{
+   DgEventCount *c;
+
+   if (t->size == 0)
+      count_resize(t, DG_EVENTS_INITIAL);
+   c = count_slot(t, key);
+   if (c->key == 0)
+   {
+      c->key = key;
+      if (++t->used > t->size / 2)
+      {
+         count_resize(t, t->size * 2);
+         c = count_slot(t, key);
+      }
+   }
+   c->count++;
+}
+
+static void count_free(DgEventTable *t)
+{
+   if (t->slots != NULL)
+      VG_(free)(t->slots);
+}
+
+void DG_(events_access)(ThreadId tid, UWord context_index, Addr addr, UChar size, UChar dir)
+{
+   XArray *stack = stacks[tid];
+   Word n, i;
+   UWord range;
+   Addr line, last_line;
+
+   if (stack == NULL || (n = VG_(sizeXA)(stack)) == 0)
+      return;
+   range = find_range(addr);
+   line = addr >> DG_EVENTS_LINE_SHIFT;
+   last_line = (addr + size - 1) >> DG_EVENTS_LINE_SHIFT;
+   for (i = 0; i < n; i++)
+   {
+      DgEvent *e = VG_(indexXA)(stack, i);
+      Addr l;
+
+      if (DG_ACC_IS_WRITE(dir))
+      {
+         e->writes++;
+         e->write_bytes += size;
+      }
+      else
+      {
+         e->reads++;
+         e->read_bytes += size;
+      }
+      for (l = line; l <= last_line; l++)
+         count_add(&e->lines, l + 1);
+      count_add(&e->contexts, context_index + 1);
+      if (range != 0)
+         count_add(&e->ranges, range);
+   }
+}
+
+void DG_(events_start)(ThreadId tid, const HChar *label, SizeT len)
+{
+   DgEvent e;
+
+   if (!DG_(clo_event_stats))
+      return;
+   if (stacks[tid] == NULL)
+      stacks[tid] = VG_(newXA)(VG_(malloc), "datagrind.events.stack", VG_(free),
+                               sizeof(DgEvent));
+   VG_(memset)(&e, 0, sizeof(e));
+   tl_assert(len <= sizeof(e.label));
+   VG_(memcpy)(e.label, label, len);
+   e.label_len = len;
+   VG_(addToXA)(stacks[tid], &e);
+}
+
+static Int cmp_count(const void *a, const void *b)
+{
+   const DgEventCount *ca = a;
+   const DgEventCount *cb = b;
+
+   if (ca->count != cb->count)
+      return ca->count > cb->count ? -1 : 1;
+   if (ca->key != cb->key)
+      return ca->key < cb->key ? -1 : 1;
+   return 0;
+}
+
+/* Writes the number of entries and up to clo_event_top of them with the
+ * largest counts, and frees the table.
+ */
+static UChar *out_top(UChar *p, DgEventTable *t)
+{
+   SizeT n = 0, i;
+
+   for (i = 0; i < t->size; i++)
+      if (t->slots[i].key != 0)
+         t->slots[n++] = t->slots[i];
+   VG_(ssort)(t->slots, n, sizeof(DgEventCount), cmp_count);
+   if (n > (SizeT) clo_event_top)
+      n = clo_event_top;
+   p = encode_uvarint(p, n);
+   for (i = 0; i < n; i++)
+   {
+      p = encode_uvarint(p, t->slots[i].key - 1);
+      p = encode_uvarint64(p, t->slots[i].count);
+   }
+   count_free(t);
+   return p;
+}
+
+UChar *DG_(events_end)(ThreadId tid, const HChar *label, SizeT len, SizeT *size)
+{
+   XArray *stack = stacks != NULL ? stacks[tid] : NULL;
+   DgEvent *e = NULL;
+   UChar *summary, *p;
+   Word i;
+
+   if (stack == NULL)
+      return NULL;
+   for (i = VG_(sizeXA)(stack) - 1; i >= 0; i--)
+   {
+      e = VG_(indexXA)(stack, i);
+      if (e->label_len == len && VG_(memcmp)(e->label, label, len) == 0)
+         break;
+   }
+   if (i < 0)
+      return NULL;
+
+   p = summary = VG_(malloc)("datagrind.events.summary",
+                             5 * 10 + 2 * (DG_MAX_UVARINT_BYTES
+                                           + clo_event_top * (DG_MAX_UVARINT_BYTES + 10)));
+   p = encode_uvarint64(p, e->reads);
+   p = encode_uvarint64(p, e->writes);
+   p = encode_uvarint64(p, e->read_bytes);
+   p = encode_uvarint64(p, e->write_bytes);
+   p = encode_uvarint64(p, e->lines.used);
+   p = out_top(p, &e->contexts);
+   p = out_top(p, &e->ranges);
+   count_free(&e->lines);
+   VG_(removeIndexXA)(stack, i);
+   *size = p - summary;
+   return summary;
+}
+
+void DG_(events_finish)(void)
+{
+   ThreadId tid;
+   Word i;
+
+   if (stacks == NULL)
+      return;
+   for (tid = 0; tid < VG_N_THREADS; tid++)
+      if (stacks[tid] != NULL)
+      {
+         /* Events still open at exit have no end record to go in */
+         for (i = 0; i < VG_(sizeXA)(stacks[tid]); i++)
+         {
+            DgEvent *e = VG_(indexXA)(stacks[tid], i);
+
+            count_free(&e->lines);
+            count_free(&e->contexts);
+            count_free(&e->ranges);
+         }
+         VG_(deleteXA)(stacks[tid]);
+         stacks[tid] = NULL;
+      }
+   VG_(free)(stacks);
+   stacks = NULL;
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,212 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: access counts by offset in ranges. dg_fieldheat.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-field-heat=yes, every byte read or written inside a
+ * range registered with DATAGRIND_TRACK_RANGE is counted by its offset in
+ * the range. With --datagrind-field-heat-stride, offsets are taken modulo
+ * the stride, so that an array of structs gives one count per byte of the
+ * struct. The counts are written at exit, and are mapped to fields with
+ * the DWARF layout of the range's type by the reader, since the core's
+ * type information is not available to tools.
+ */
+
+/* Offsets at or past this are not counted */
+#define DG_FIELD_HEAT_MAX (1 << 16)
+
+typedef struct
+{
+   Addr start;
+   Addr end;          /* One past the last byte */
+   Bool active;
+   SizeT fold;        /* Offsets are taken modulo this */
+   UInt *counts;      /* Read and write count per offset, interleaved */
+} DgHeatRange;
+
+Bool DG_(clo_field_heat) = False;
+static Long clo_field_heat_stride = 0;
+
+static XArray *ranges = NULL;     /* DgHeatRange, as registered */
+static Word n_active_ranges = 0;
+
+Bool DG_(fieldheat_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-field-heat", DG_(clo_field_heat))) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-field-heat-stride", clo_field_heat_stride,
+                        0, DG_FIELD_HEAT_MAX)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(fieldheat_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-field-heat=yes|no    count accesses per offset in tracked\n"
+"                                     ranges [no]\n"
+"    --datagrind-field-heat-stride=<n>  take those offsets modulo n [0]\n"
+   );
+}
+
+void DG_(fieldheat_init)(void)
+{
+   if (!DG_(clo_field_heat))
+      return;
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.fieldheat.ranges", VG_(free),
+                       sizeof(DgHeatRange));
+}
+
+void DG_(fieldheat_track)(Addr addr, SizeT len)
+{
+   DgHeatRange range;
+   SizeT n;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   range.fold = clo_field_heat_stride > 0 && clo_field_heat_stride < len
+                ? clo_field_heat_stride : len;
+   n = range.fold < DG_FIELD_HEAT_MAX ? range.fold : DG_FIELD_HEAT_MAX;
+   range.counts = n > 0 ? VG_(calloc)("datagrind.fieldheat.counts", 2 * n, sizeof(UInt))
+                        : NULL;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(fieldheat_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgHeatRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+void DG_(fieldheat_access)(Addr addr, UChar size, UChar dir)
+{
+   Word n, i;
+
+   if (n_active_ranges == 0)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgHeatRange *range = VG_(indexXA)(ranges, i);
+      Addr a;
+
+      if (!range->active || addr >= range->end || addr + size <= range->start)
+         continue;
+      for (a = addr < range->start ? range->start : addr;
+           a < addr + size && a < range->end; a++)
+      {
+         SizeT offset = (a - range->start) % range->fold;
+         if (offset < DG_FIELD_HEAT_MAX)
+         {
+            UInt *count = &range->counts[2 * offset + DG_ACC_IS_WRITE(dir)];
+            if (*count != 0xFFFFFFFFU)
+               (*count)++;
+         }
+      }
+   }
+}
+
+void DG_(fieldheat_finish)(void)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgHeatRange *range = VG_(indexXA)(ranges, i);
+      SizeT n_counts = range->fold < DG_FIELD_HEAT_MAX ? range->fold : DG_FIELD_HEAT_MAX;
+      SizeT n_entries = 0, prev = 0, j;
+      UChar *payload, *p;
+
+      for (j = 0; j < n_counts; j++)
+         if (range->counts[2 * j] != 0 || range->counts[2 * j + 1] != 0)
+            n_entries++;
+      if (n_entries > 0)
+      {
+         p = payload = VG_(malloc)("datagrind.fieldheat.payload",
+                                   (3 + 3 * n_entries) * DG_MAX_UVARINT_BYTES);
+         p = encode_uvarint(p, i);
+         p = encode_uvarint(p, range->fold);
+         p = encode_uvarint(p, n_entries);
+         for (j = 0; j < n_counts; j++)
+            if (range->counts[2 * j] != 0 || range->counts[2 * j + 1] != 0)
+            {
+               p = encode_uvarint(p, j - prev);
+               p = encode_uvarint(p, range->counts[2 * j]);
+               p = encode_uvarint(p, range->counts[2 * j + 1]);
+               prev = j;
+            }
+         out_byte(DG_R_FIELD_HEAT);
+         out_length(p - payload);
+         out_bytes(payload, p - payload);
+         VG_(free)(payload);
+      }
+      if (range->counts != NULL)
+         VG_(free)(range->counts);
+   }
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,531 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: filtering accesses by tracked range.  dg_filter.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_debuginfo.h"
+#include "pub_tool_execontext.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_machine.h"
+#include "pub_tool_options.h"
+#include "pub_tool_seqmatch.h"
+#include "pub_tool_stacktrace.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+
+/* Missing from the header, as noted in dg_main.c */
+extern StackTrace VG_(get_ExeContext_StackTrace) ( ExeContext* e );
+
+/* With --datagrind-filter=tracked, an access is only recorded if it
+ * overlaps a range registered with DATAGRIND_TRACK_RANGE. The ranges are
+ * merged into a sorted array of disjoint intervals, which a clean helper
+ * binary searches for every access.
+ *
+ * Since most accesses in a big program miss, the helper can be guarded by
+ * a map with a byte per cache line, hashed on the address, which inline IR
+ * checks first. A clear byte means that no tracked range is near the line,
+ * so the access is dropped without a call.
+ *
+ * With --datagrind-alloc-fn or --datagrind-alloc-site, the heap blocks
+ * allocated from a matching stack are tracked too. They come and go far
+ * more often than ranges, so they are kept in an array of their own that
+ * is kept sorted by insertion, and the map bytes count the ranges and
+ * blocks near each line (saturating), so that a free can clear them.
+ *
+ * Separately, --datagrind-ignore-ranges gives ranges whose accesses are
+ * never recorded. There are expected to be few, so each is checked by
+ * inline IR.
+ */
+
+#define DG_FILTER_LINE_SHIFT 6
+#define DG_FILTER_MAP_SIZE   (1 << 16)
+
+typedef struct
+{
+   Addr start;
+   Addr end;     /* One past the last byte */
+} DgInterval;
+
+Int DG_(clo_filter) = DG_FILTER_ALL;
+static Bool clo_filter_map = True;
+
+/* Ranges as registered, possibly overlapping */
+static XArray *tracked = NULL;
+/* From --datagrind-ignore-ranges */
+static XArray *ignored = NULL;
+/* Disjoint, in increasing order */
+static DgInterval *intervals = NULL;
+static Word n_intervals = 0;
+static UChar *filter_map = NULL;
+/* Marked heap blocks, disjoint, in increasing order */
+static DgInterval *blocks = NULL;
+static Word n_blocks = 0;
+static Word max_blocks = 0;
+
+static const HChar *clo_alloc_fn = NULL;
+static const HChar *clo_alloc_site = NULL;
+
+/* Whether an allocation stack matches, keyed by its ExeContext */
+typedef struct
+{
+   VgHashNode header;
+   Bool matches;
+} DgAllocMatch;
+
+static VgHashTable *alloc_matches = NULL;
+
+/* Parses a list of ranges of the form 0xPP-0xQQ[,0xRR-0xSS...], where the
+ * end of each is inclusive, as for memcheck's --ignore-ranges.
+ */
+static Bool parse_ignore_ranges(const HChar *str)
+{
+   const HChar **ppc = &str;
+
+   if (ignored == NULL)
+      ignored = VG_(newXA)(VG_(malloc), "datagrind.filter.ignored", VG_(free),
+                           sizeof(DgInterval));
+   for (;;)
+   {
+      DgInterval range;
+      Addr last;
+
+      if (!VG_(parse_Addr)(ppc, &range.start) || **ppc != '-')
+         return False;
+      (*ppc)++;
+      if (!VG_(parse_Addr)(ppc, &last) || last < range.start)
+         return False;
+      range.end = last + 1;
+      VG_(addToXA)(ignored, &range);
+      if (**ppc == '\0')
+         return True;
+      if (**ppc != ',')
+         return False;
+      (*ppc)++;
+   }
+}
+
+Bool DG_(filter_process_cmd_line_option)(const HChar *arg)
+{
+   const HChar *tmp_str;
+
+   if (VG_STR_CLO(arg, "--datagrind-ignore-ranges", tmp_str))
+   {
+      if (!parse_ignore_ranges(tmp_str))
+         VG_(fmsg_bad_option)(arg, "expected 0xPP-0xQQ[,0xRR-0xSS...]\n");
+   }
+   else if VG_XACT_CLO(arg, "--datagrind-filter=all", DG_(clo_filter),
+                  DG_FILTER_ALL) {}
+   else if VG_XACT_CLO(arg, "--datagrind-filter=tracked", DG_(clo_filter),
+                       DG_FILTER_TRACKED) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-filter-map", clo_filter_map)) {}
+   else if (VG_STR_CLO(arg, "--datagrind-alloc-fn", clo_alloc_fn))
+      DG_(clo_filter) = DG_FILTER_TRACKED;
+   else if (VG_STR_CLO(arg, "--datagrind-alloc-site", clo_alloc_site))
+      DG_(clo_filter) = DG_FILTER_TRACKED;
+   else
+      return False;
+   return True;
+}
+
+void DG_(filter_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-filter=all|tracked   record all accesses, or only those\n"
+"                                     to tracked ranges [all]\n"
+"    --datagrind-filter-map=no|yes    check a cache-line map before the\n"
+"                                     tracked ranges [yes]\n"
+"    --datagrind-alloc-fn=<pattern>   also track heap blocks allocated with\n"
+"                                     a matching function on the stack\n"
+"    --datagrind-alloc-site=<pattern> also track heap blocks allocated with\n"
+"                                     a matching file:line on the stack\n"
+"                                     (both imply --datagrind-filter=tracked)\n"
+"    --datagrind-ignore-ranges=0xPP-0xQQ[,0xRR-0xSS]\n"
+"                                     do not record accesses starting in\n"
+"                                     these ranges\n"
+   );
+}
+
+void DG_(filter_init)(void)
+{
+   if (DG_(clo_filter) != DG_FILTER_TRACKED)
+      return;
+   tracked = VG_(newXA)(VG_(malloc), "datagrind.filter.tracked", VG_(free),
+                        sizeof(DgInterval));
+   if (clo_filter_map)
+      filter_map = VG_(calloc)("datagrind.filter.map", DG_FILTER_MAP_SIZE, 1);
+   if (DG_(filter_by_alloc)())
+      alloc_matches = VG_(HT_construct)("datagrind.filter.alloc_matches");
+}
+
+static Int cmp_interval(const void *a, const void *b)
+{
+   const DgInterval *ia = a;
+   const DgInterval *ib = b;
+   if (ia->start != ib->start)
+      return ia->start < ib->start ? -1 : 1;
+   return 0;
+}
+
+/* Accesses of up to this size may start on the line before a range, so
+ * its lines are marked from one line early.
+ */
+#define DG_FILTER_MAP_MAX_ACCESS (1 << DG_FILTER_LINE_SHIFT)
+
+/* Adds delta (1 or -1) to the count of each line near [start, end). A
+ * count that reaches 255 stays there, as it may have lost track.
+ */
+static void mark_map(Addr start, Addr end, Int delta)
+{
+   Addr line = (start < DG_FILTER_MAP_MAX_ACCESS ? 0 : start - DG_FILTER_MAP_MAX_ACCESS + 1)
+               >> DG_FILTER_LINE_SHIFT;
+   Addr last = (end - 1) >> DG_FILTER_LINE_SHIFT;
+
+   if (last - line >= DG_FILTER_MAP_SIZE)
+   {
+      VG_(memset)(filter_map, 255, DG_FILTER_MAP_SIZE);
+      return;
+   }
+   for (; line <= last; line++)
+   {
+      UChar *count = &filter_map[line & (DG_FILTER_MAP_SIZE - 1)];
+
+      if (*count != 255)
+         *count += delta;
+   }
+}
+
+/* Ranges change rarely compared to how often they are checked, so the
+ * intervals and map are simply rebuilt from scratch.
+ */
+static void rebuild_intervals(void)
+{
+   Word n = VG_(sizeXA)(tracked);
+   Word i;
+
+   if (intervals != NULL)
+      VG_(free)(intervals);
+   intervals = NULL;
+   n_intervals = 0;
+   if (filter_map != NULL)
+      VG_(memset)(filter_map, 0, DG_FILTER_MAP_SIZE);
+   if (n == 0)
+   {
+      if (filter_map != NULL)
+         for (i = 0; i < n_blocks; i++)
+            mark_map(blocks[i].start, blocks[i].end, 1);
+      return;
+   }
+
+   intervals = VG_(malloc)("datagrind.filter.intervals", n * sizeof(DgInterval));
+   for (i = 0; i < n; i++)
+      intervals[i] = *(DgInterval *) VG_(indexXA)(tracked, i);
+   VG_(ssort)(intervals, n, sizeof(DgInterval), cmp_interval);
+   for (i = 0; i < n; i++)
+   {
+      if (n_intervals > 0 && intervals[i].start <= intervals[n_intervals - 1].end)
+      {
+         if (intervals[i].end > intervals[n_intervals - 1].end)
+            intervals[n_intervals - 1].end = intervals[i].end;
+      }
+      else
+         intervals[n_intervals++] = intervals[i];
+   }
+   if (filter_map != NULL)
+   {
+      for (i = 0; i < n_intervals; i++)
+         mark_map(intervals[i].start, intervals[i].end, 1);
+      for (i = 0; i < n_blocks; i++)
+         mark_map(blocks[i].start, blocks[i].end, 1);
+   }
+}
+
+void DG_(filter_track)(Addr addr, SizeT len)
+{
+   DgInterval range;
+
+   if (tracked == NULL || len == 0 || addr + len < addr)
+      return;
+   range.start = addr;
+   range.end = addr + len;
+   VG_(addToXA)(tracked, &range);
+   rebuild_intervals();
+}
+
+void DG_(filter_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (tracked == NULL)
+      return;
+   n = VG_(sizeXA)(tracked);
+   for (i = 0; i < n; i++)
+   {
+      const DgInterval *range = VG_(indexXA)(tracked, i);
+      if (range->start == addr && range->end == addr + len)
+      {
+         VG_(removeIndexXA)(tracked, i);
+         rebuild_intervals();
+         return;
+      }
+   }
+}
+
+/* Returns the index of the first of n disjoint sorted intervals that ends
+ * after a, or n.
+ */
+static Word find_interval(const DgInterval *v, Word n, Addr a)
+{
+   Word lo = 0, hi = n;
+
+   while (lo < hi)
+   {
+      Word mid = (lo + hi) / 2;
+      if (v[mid].end <= a)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+/* Returns 1 if [a, a + size) overlaps a tracked range or block. */
+static VG_REGPARM(2) UWord filter_check(Addr a, UWord size)
+{
+   Word i = find_interval(intervals, n_intervals, a);
+
+   if (i < n_intervals && intervals[i].start < a + size)
+      return 1;
+   i = find_interval(blocks, n_blocks, a);
+   return i < n_blocks && blocks[i].start < a + size;
+}
+
+Bool DG_(filter_by_alloc)(void)
+{
+   return clo_alloc_fn != NULL || clo_alloc_site != NULL;
+}
+
+static Bool frame_matches(DiEpoch ep, Addr ip)
+{
+   const HChar *name;
+   const HChar *file, *dir;
+   UInt line;
+
+   if (clo_alloc_fn != NULL && VG_(get_fnname)(ep, ip, &name)
+       && VG_(string_match)(clo_alloc_fn, name))
+      return True;
+   if (clo_alloc_site != NULL && VG_(get_filename_linenum)(ep, ip, &file, &dir, &line))
+   {
+      HChar site[256];
+
+      VG_(snprintf)(site, sizeof(site), "%s:%u", file, line);
+      if (VG_(string_match)(clo_alloc_site, site))
+         return True;
+   }
+   return False;
+}
+
+Bool DG_(filter_alloc_matches)(ExeContext *where)
+{
+   UWord key = VG_(get_ECU_from_ExeContext)(where);
+   DgAllocMatch *node = VG_(HT_lookup)(alloc_matches, key);
+
+   if (node == NULL)
+   {
+      DiEpoch ep = VG_(get_ExeContext_epoch)(where);
+      Int n_ips = VG_(get_ExeContext_n_ips)(where);
+      StackTrace stack = VG_(get_ExeContext_StackTrace)(where);
+      Int i;
+
+      node = VG_(malloc)("datagrind.filter.alloc_match", sizeof(DgAllocMatch));
+      node->header.key = key;
+      node->matches = False;
+      /* Return addresses are backed up into the call */
+      for (i = 0; i < n_ips && !node->matches; i++)
+         node->matches = frame_matches(ep, stack[i] - (i > 0));
+      VG_(HT_add_node)(alloc_matches, node);
+   }
+   return node->matches;
+}
+
+void DG_(filter_add_block)(Addr addr, SizeT szB)
+{
+   Word i;
+
+   if (szB == 0 || addr + szB < addr)
+      return;
+   i = find_interval(blocks, n_blocks, addr);
+   if (n_blocks == max_blocks)
+   {
+      max_blocks = max_blocks == 0 ? 1024 : 2 * max_blocks;
+      blocks = VG_(realloc)("datagrind.filter.blocks", blocks,
+                            max_blocks * sizeof(DgInterval));
+   }
+   VG_(memmove)(blocks + i + 1, blocks + i, (n_blocks - i) * sizeof(DgInterval));
+   blocks[i].start = addr;
+   blocks[i].end = addr + szB;
+   n_blocks++;
+   if (filter_map != NULL)
+      mark_map(addr, addr + szB, 1);
+}
+
+void DG_(filter_remove_block)(Addr addr)
+{
+   Word i = find_interval(blocks, n_blocks, addr);
+
+   if (i == n_blocks || blocks[i].start != addr)
+      return;
+   if (filter_map != NULL)
+      mark_map(blocks[i].start, blocks[i].end, -1);
+   VG_(memmove)(blocks + i, blocks + i + 1, (n_blocks - i - 1) * sizeof(DgInterval));
+   n_blocks--;
+}
+
+/* Assigns e to a new temporary, since IR must be flat */
+static IRExpr *assign(IRSB *sbOut, IRType ty, IRExpr *e)
+{
+   IRTemp t = newIRTemp(sbOut->tyenv, ty);
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(t, e));
+   return IRExpr_RdTmp(t);
+}
+
+IRExpr *DG_(and_guards)(IRSB *sbOut, IRExpr *a, IRExpr *b)
+{
+   IRTemp a32, b32, and, both;
+
+   if (a == NULL)
+      return b;
+   if (b == NULL)
+      return a;
+
+   /* There is no Iop_And1, so go via 32 bits */
+   a32 = newIRTemp(sbOut->tyenv, Ity_I32);
+   b32 = newIRTemp(sbOut->tyenv, Ity_I32);
+   and = newIRTemp(sbOut->tyenv, Ity_I32);
+   both = newIRTemp(sbOut->tyenv, Ity_I1);
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(a32, IRExpr_Unop(Iop_1Uto32, a)));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(b32, IRExpr_Unop(Iop_1Uto32, b)));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(and, IRExpr_Binop(Iop_And32, IRExpr_RdTmp(a32),
+                                                       IRExpr_RdTmp(b32))));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(both, IRExpr_Binop(Iop_CmpNE32, IRExpr_RdTmp(and),
+                                                        IRExpr_Const(IRConst_U32(0)))));
+   return IRExpr_RdTmp(both);
+}
+
+
+IRExpr *DG_(filter_guard)(IRSB *sbOut, IRExpr *addr, SizeT size)
+{
+   IRExpr **argv = mkIRExprVec_2(addr, mkIRExpr_HWord(size));
+   IRExpr *res;
+
+   if (filter_map != NULL && size <= DG_FILTER_MAP_MAX_ACCESS)
+   {
+      IRExpr *entry, *hit;
+      IRTemp ret = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+      IRDirty *di;
+
+      /* entry = filter_map + ((addr >> LINE_SHIFT) & (MAP_SIZE - 1)) */
+      entry = assign(sbOut, DG_IRTY_WORD,
+                     IRExpr_Binop(DG_IROP_SHR, addr,
+                                  IRExpr_Const(IRConst_U8(DG_FILTER_LINE_SHIFT))));
+      entry = assign(sbOut, DG_IRTY_WORD,
+                     IRExpr_Binop(DG_IROP_AND, entry,
+                                  mkIRExpr_HWord(DG_FILTER_MAP_SIZE - 1)));
+      entry = assign(sbOut, DG_IRTY_WORD,
+                     IRExpr_Binop(DG_IROP_ADD, entry, mkIRExpr_HWord((HWord) filter_map)));
+      hit = assign(sbOut, Ity_I8, IRExpr_Load(DG_IREND, Ity_I8, entry));
+      hit = assign(sbOut, Ity_I1, IRExpr_Binop(Iop_CmpNE8, hit,
+                                               IRExpr_Const(IRConst_U8(0))));
+
+      /* The result is junk when the call is skipped, hence the ITE */
+      di = unsafeIRDirty_1_N(ret, 2, "filter_check",
+                             VG_(fnptr_to_fnentry)(&filter_check), argv);
+      di->guard = hit;
+      addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+      res = assign(sbOut, DG_IRTY_WORD,
+                   IRExpr_ITE(hit, IRExpr_RdTmp(ret), mkIRExpr_HWord(0)));
+   }
+   else
+   {
+      res = assign(sbOut, DG_IRTY_WORD,
+                   mkIRExprCCall(DG_IRTY_WORD, 2, "filter_check",
+                                 VG_(fnptr_to_fnentry)(&filter_check), argv));
+   }
+   return assign(sbOut, Ity_I1, IRExpr_Binop(DG_IROP_CMPNE, res, mkIRExpr_HWord(0)));
+}
+
+Bool DG_(have_ignored)(void)
+{
+   return ignored != NULL && VG_(sizeXA)(ignored) > 0;
+}
+
+Bool DG_(is_ignored)(Addr a)
+{
+   Word n = ignored == NULL ? 0 : VG_(sizeXA)(ignored);
+   Word i;
+
+   for (i = 0; i < n; i++)
+   {
+      const DgInterval *range = VG_(indexXA)(ignored, i);
+      if (a - range->start < range->end - range->start)
+         return True;
+   }
+   return False;
+}
+
+IRExpr *DG_(ignore_guard)(IRSB *sbOut, IRExpr *addr)
+{
+   Word n = ignored == NULL ? 0 : VG_(sizeXA)(ignored);
+   IRExpr *guard = NULL;
+   Word i;
+
+   for (i = 0; i < n; i++)
+   {
+      const DgInterval *range = VG_(indexXA)(ignored, i);
+      IRExpr *offset;
+
+      /* Outside if addr - start >= end - start, unsigned */
+      offset = assign(sbOut, DG_IRTY_WORD,
+                      IRExpr_Binop(DG_IROP_SUB, addr, mkIRExpr_HWord(range->start)));
+      guard = DG_(and_guards)(sbOut, guard,
+                              assign(sbOut, Ity_I1,
+                                     IRExpr_Binop(DG_IROP_CMPLEU,
+                                                  mkIRExpr_HWord(range->end - range->start),
+                                                  offset)));
+   }
+   return guard;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,1113 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: extracts part of a trace.       dg_filter_trace.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_filter writes the part of a trace that is about one thread, one
+ * event, some tracked ranges, an address window or a stretch of
+ * instructions, as a trace of its own.
+ *
+ * The index is used to pass over the chunks that cannot hold anything
+ * wanted: those outside the instruction window or the events, which are
+ * found from the labels of the index, and those in which the thread never
+ * runs. Their runs are not decoded, and only the records that the rest of
+ * the trace depends on, such as the mappings, the objects, the tracked
+ * ranges and the heap, are copied from them.
+ *
+ * The runs that are kept are written again as filtered runs, with the
+ * accesses that pass and deltas of their own, so any form of run in the
+ * input becomes one the output can stand on. Block definitions and
+ * contexts are written just before their first use, numbered as in the
+ * output, so only those that are used are kept. An output chunk starts
+ * with each chunk of the input and wherever runs of other threads or
+ * times were left out, so that the instruction counts start right again.
+ * Runs left without accesses by the addresses are dropped, as the tool
+ * drops them when it filters, and the counts are off by their
+ * instructions until the next chunk. Summaries of the analysis modes,
+ * which cover the whole run, are left out, as are those of the events.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+#define NONE (~(uint64_t) 0)
+
+static const char *argv0 = "dg_filter";
+
+/* From lo up to (excluding) hi */
+typedef struct
+{
+   uint64_t lo, hi;
+} window;
+
+typedef struct
+{
+   window *w;
+   size_t n;
+   size_t size;
+} windows;
+
+/* A table from the numbers in the input to those of the output */
+typedef struct
+{
+   uint64_t *map;
+   size_t n;
+   size_t size;
+} remap;
+
+/* The deltas of a block of the output */
+typedef struct
+{
+   uint32_t n_accesses;
+   uint64_t chunk;           /* Output chunk in which prev was last used */
+   uint64_t *prev;
+} out_block;
+
+typedef struct
+{
+   uint64_t offset;
+   uint64_t instrs;
+   uint64_t n_labels;
+   size_t labels;
+} out_chunk;
+
+/* What is wanted */
+static int have_tid = 0;
+static uint64_t want_tid = 0;
+static window instrs_window = { 0, NONE };
+static const char *event_label = NULL;
+static windows events;       /* Instructions in which the event is on */
+static windows addrs;
+static const char **range_labels = NULL;
+static size_t n_range_labels = 0;
+static int keep_static;      /* Static accesses stay in the definitions */
+
+static const char *in_name;
+static dgt_file *file;
+static dgt_decoder *decoder;
+static size_t in_word_size;
+static uint64_t in_usecs = 0;   /* Of the last chunk record of the input */
+static remap bbdefs, contexts;
+
+static FILE *out;
+static const char *out_name;
+static uint64_t out_pos = 0;
+static int out_big_endian;
+static uint64_t out_n_bbdefs = 0, out_n_contexts = 0;
+static out_block *out_blocks = NULL;
+static size_t out_blocks_size = 0;
+static out_chunk *out_chunks = NULL;
+static size_t out_n_chunks = 0, out_chunks_size = 0;
+static char *labels = NULL;
+static size_t labels_len = 0, labels_size = 0;
+static int chunk_open = 0;     /* Cleared to start another */
+static uint64_t out_tid;
+
+/* The last run written, which a DG_R_BBREPEAT may repeat */
+static uint8_t *last_run = NULL;
+static size_t last_run_len = 0, last_run_size = 0;
+static uint64_t last_run_end = NONE;
+static unsigned int pending_repeats = 0;
+
+static uint64_t n_runs = 0, n_runs_kept = 0, n_chunks_skipped = 0;
+static uint64_t n_dropped = 0, n_event_summaries = 0;
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: writes the part of a Datagrind trace that is wanted as a new trace\n"
+"usage: %s [options] -o <file> trace\n"
+"    --tid=<n>              only the runs of thread n\n"
+"    --event=<label>        only while an event with the label is on\n"
+"    --range=<label>        only accesses to ranges tracked with the label\n"
+"    --addr=<lo>-<hi>       only accesses to these addresses (also <lo>+<size>)\n"
+"    --instrs=<from>-[<to>] only the runs in this window of instructions\n"
+"    --threads=<n>          threads to read the definitions with [one per processor]\n"
+"--range and --addr may be given more than once, and add to each other.\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static void out_of_memory(void)
+{
+   fprintf(stderr, "%s: out of memory\n", argv0);
+   exit(1);
+}
+
+static void *grow(void *array, size_t n, size_t *size, size_t elem_size)
+{
+   if (n + 1 > *size)
+   {
+      size_t new_size = *size > 0 ? *size * 2 : 256;
+
+      while (new_size < n + 1)
+         new_size *= 2;
+      array = realloc(array, new_size * elem_size);
+      if (array == NULL)
+         out_of_memory();
+      *size = new_size;
+   }
+   return array;
+}
+
+static void bad_trace(int err)
+{
+   fprintf(stderr, "%s: %s: %s\n", argv0, in_name, dgt_strerror(err));
+   exit(1);
+}
+
+static void add_window(windows *ws, uint64_t lo, uint64_t hi)
+{
+   ws->w = grow(ws->w, ws->n, &ws->size, sizeof(window));
+   ws->w[ws->n].lo = lo;
+   ws->w[ws->n].hi = hi;
+   ws->n++;
+}
+
+static int overlaps(const windows *ws, uint64_t lo, uint64_t hi)
+{
+   size_t i;
+
+   for (i = 0; i < ws->n; i++)
+      if (lo < ws->w[i].hi && hi > ws->w[i].lo)
+         return 1;
+   return 0;
+}
+
+/* Whether a run or record at instrs is in the instructions wanted */
+static int time_passes(uint64_t instrs)
+{
+   if (instrs < instrs_window.lo || instrs >= instrs_window.hi)
+      return 0;
+   return event_label == NULL || overlaps(&events, instrs, instrs + 1);
+}
+
+static int addr_passes(uint64_t addr, uint64_t size)
+{
+   return addrs.n == 0 || overlaps(&addrs, addr, addr + (size > 0 ? size : 1));
+}
+
+/* The slot of an input number, which is NONE until it is given one */
+static uint64_t *remap_slot(remap *r, uint64_t index)
+{
+   while (r->n <= index)
+   {
+      r->map = grow(r->map, r->n, &r->size, sizeof(uint64_t));
+      r->map[r->n++] = NONE;
+   }
+   return &r->map[index];
+}
+
+/*------------------------------------------------------------*/
+/*--- Writing                                              ---*/
+/*------------------------------------------------------------*/
+
+static void out_raw(const void *data, size_t len)
+{
+   if (fwrite(data, 1, len, out) != len)
+   {
+      fprintf(stderr, "%s: cannot write %s: %s\n", argv0, out_name, strerror(errno));
+      exit(1);
+   }
+   out_pos += len;
+}
+
+static void flush_repeats(void)
+{
+   if (pending_repeats > 0)
+   {
+      uint8_t repeat[2] = { DG_R_BBREPEAT, (uint8_t) pending_repeats };
+
+      pending_repeats = 0;
+      out_raw(repeat, sizeof(repeat));
+      last_run_end = out_pos;
+   }
+}
+
+/* Repeats waiting to be written go before anything else */
+static void out_bytes(const void *data, size_t len)
+{
+   flush_repeats();
+   out_raw(data, len);
+}
+
+static uint8_t *put_value(uint8_t *p, uint64_t value, size_t size)
+{
+   size_t i;
+
+   for (i = 0; i < size; i++)
+      p[out_big_endian ? size - 1 - i : i] = (uint8_t) (value >> (8 * i));
+   return p + size;
+}
+
+static uint8_t *put_uvarint(uint8_t *p, uint64_t value)
+{
+   while (value >= 0x80)
+   {
+      *p++ = (uint8_t) (value | 0x80);
+      value >>= 7;
+   }
+   *p++ = (uint8_t) value;
+   return p;
+}
+
+static uint8_t *put_svarint(uint8_t *p, int64_t value)
+{
+   return put_uvarint(p, ((uint64_t) value << 1) ^ (uint64_t) (value >> 63));
+}
+
+static void out_record(uint8_t type, const uint8_t *payload, uint64_t len)
+{
+   uint8_t head[10];
+   uint8_t *p = head;
+
+   *p++ = type;
+   if (len < 255)
+      *p++ = (uint8_t) len;
+   else
+   {
+      *p++ = 255;
+      p = put_value(p, len, 8);
+   }
+   out_bytes(head, p - head);
+   out_bytes(payload, len);
+}
+
+static void copy_raw(const dgt_record *record, uint64_t end)
+{
+   out_bytes(dgt_file_stream(file) + record->offset, end - record->offset);
+}
+
+static void add_label(const dgt_event *event)
+{
+   if (out_n_chunks == 0)
+      return;
+   labels = grow(labels, labels_len + event->label_len, &labels_size, 1);
+   memcpy(labels + labels_len, event->label, event->label_len);
+   labels[labels_len + event->label_len] = '\0';
+   labels_len += event->label_len + 1;
+   out_chunks[out_n_chunks - 1].n_labels++;
+}
+
+static void open_chunk(uint64_t instrs, uint64_t tid)
+{
+   uint8_t payload[6 * 10];
+   uint8_t *p = payload;
+   out_chunk *c;
+
+   flush_repeats();
+   out_chunks = grow(out_chunks, out_n_chunks, &out_chunks_size, sizeof(out_chunk));
+   c = &out_chunks[out_n_chunks++];
+   c->offset = out_pos;
+   c->instrs = instrs;
+   c->n_labels = 0;
+   c->labels = labels_len;
+
+   p = put_uvarint(p, out_n_chunks - 1);
+   p = put_uvarint(p, instrs);
+   p = put_uvarint(p, tid);
+   p = put_uvarint(p, out_n_bbdefs);
+   p = put_uvarint(p, out_n_contexts);
+   p = put_uvarint(p, in_usecs);
+   out_record(DG_R_CHUNK, payload, p - payload);
+   chunk_open = 1;
+   out_tid = tid;
+}
+
+static void out_thread(uint64_t tid)
+{
+   uint8_t payload[10];
+
+   out_record(DG_R_THREAD, payload, put_uvarint(payload, tid) - payload);
+   out_tid = tid;
+}
+
+/* Writes the block definition if it has not been, and returns its number
+ * in the output. Without static accesses, those of the input become
+ * dynamic, so that they can be filtered by address.
+ */
+static uint64_t need_bbdef(uint64_t index)
+{
+   uint64_t *slot = remap_slot(&bbdefs, index);
+   const dgt_bbdef *def;
+   uint8_t *payload, *p;
+   out_block *b;
+   uint32_t i;
+
+   if (*slot != NONE)
+      return *slot;
+   def = dgt_decoder_bbdef(decoder, index);
+   payload = malloc(10 + in_word_size + def->n_instrs * (in_word_size + 1)
+                    + def->n_accesses * (21 + in_word_size));
+   if (payload == NULL)
+      out_of_memory();
+   p = put_uvarint(payload, def->n_instrs);
+   p = put_value(p, def->n_accesses, in_word_size);
+   for (i = 0; i < def->n_instrs; i++)
+   {
+      p = put_value(p, def->instrs[i].addr, in_word_size);
+      *p++ = def->instrs[i].size;
+   }
+   for (i = 0; i < def->n_accesses; i++)
+   {
+      const dgt_access_def *a = &def->accesses[i];
+
+      *p++ = a->dir | (keep_static && a->is_static ? DG_ACC_STATIC : 0);
+      p = put_uvarint(p, a->size);
+      p = put_uvarint(p, a->iseq);
+   }
+   for (i = 0; keep_static && i < def->n_accesses; i++)
+      if (def->accesses[i].is_static)
+         p = put_value(p, def->accesses[i].static_addr, in_word_size);
+   out_record(DG_R_BBDEF, payload, p - payload);
+   free(payload);
+
+   out_blocks = grow(out_blocks, out_n_bbdefs, &out_blocks_size, sizeof(out_block));
+   b = &out_blocks[out_n_bbdefs];
+   b->n_accesses = def->n_accesses;
+   b->chunk = NONE;
+   b->prev = calloc(def->n_accesses > 0 ? def->n_accesses : 1, sizeof(uint64_t));
+   if (b->prev == NULL)
+      out_of_memory();
+   *slot = out_n_bbdefs++;
+   return *slot;
+}
+
+static uint64_t need_context(uint64_t index)
+{
+   uint64_t *slot = remap_slot(&contexts, index);
+   const dgt_context *context;
+   uint64_t bbdef;
+   uint8_t *payload, *p;
+
+   if (*slot != NONE)
+      return *slot;
+   context = dgt_decoder_context(decoder, index);
+   bbdef = need_bbdef(context->bbdef_index);
+   payload = malloc(in_word_size + 10 + context->n_stack * in_word_size);
+   if (payload == NULL)
+      out_of_memory();
+   p = put_value(payload, bbdef, in_word_size);
+   p = put_uvarint(p, context->n_stack);
+   memcpy(p, context->stack, context->n_stack * in_word_size);
+   p += context->n_stack * in_word_size;
+   out_record(DG_R_CONTEXT, payload, p - payload);
+   free(payload);
+   *slot = out_n_contexts++;
+   return *slot;
+}
+
+/* Writes the accesses of the run that pass, as a filtered run (or a line
+ * run, if some were merged by line), or as a repeat of the last if it
+ * comes out the same.
+ */
+static void write_run(const dgt_run *run, uint64_t instrs)
+{
+   uint8_t *payload, *p;
+   uint64_t context, bbdef;
+   out_block *b;
+   uint32_t i, next = 0;
+   int lines = 0, kept = 0;
+
+   for (i = 0; i < run->n_accesses; i++)
+   {
+      const dgt_access *a = &run->accesses[i];
+
+      if (a->dir == DG_ACC_EXEC || (keep_static && run->bbdef->accesses[a->index].is_static))
+         continue;
+      if (addr_passes(a->addr, a->size))
+      {
+         kept++;
+         lines |= a->line_mask != 0;
+      }
+   }
+   /* A run without the wanted accesses is only kept for its instructions */
+   if (kept == 0 && addrs.n > 0)
+      return;
+
+   if (!chunk_open)
+      open_chunk(instrs, run->tid);
+   else if (run->tid != out_tid)
+      out_thread(run->tid);
+   context = need_context(run->context_index);
+   bbdef = *remap_slot(&bbdefs, run->bbdef_index);
+   b = &out_blocks[bbdef];
+   if (b->chunk != out_n_chunks)
+   {
+      memset(b->prev, 0, b->n_accesses * sizeof(uint64_t));
+      b->chunk = out_n_chunks;
+   }
+
+   payload = malloc(20 + kept * 32);
+   if (payload == NULL)
+      out_of_memory();
+   p = put_uvarint(payload, context);
+   p = put_uvarint(p, run->n_instrs);
+   for (i = 0; i < run->n_accesses; i++)
+   {
+      const dgt_access *a = &run->accesses[i];
+      uint64_t addr = a->addr, delta;
+
+      if (a->dir == DG_ACC_EXEC || (keep_static && run->bbdef->accesses[a->index].is_static)
+          || !addr_passes(a->addr, a->size))
+         continue;
+      /* A merged entry records the start of its line */
+      if (a->line_mask != 0)
+         addr -= __builtin_ctzll(a->line_mask);
+      delta = addr - b->prev[a->index];
+      b->prev[a->index] = addr;
+      p = put_uvarint(p, a->index - next);
+      if (in_word_size == 4)
+         p = put_svarint(p, (int32_t) (uint32_t) delta);
+      else
+         p = put_svarint(p, (int64_t) delta);
+      if (lines)
+      {
+         if (a->line_mask != 0)
+         {
+            p = put_uvarint(p, 2);
+            p = put_uvarint(p, a->line_mask);
+         }
+         else
+            p = put_uvarint(p, 0);
+      }
+      next = a->index + 1;
+   }
+
+   if (out_pos == last_run_end && pending_repeats < 255
+       && (size_t) (p - payload) == last_run_len && memcmp(payload, last_run, last_run_len) == 0)
+      pending_repeats++;
+   else
+   {
+      out_record(lines ? DG_R_BBRUN_LINES : DG_R_BBRUN_FILTERED, payload, p - payload);
+      last_run = grow(last_run, p - payload, &last_run_size, 1);
+      memcpy(last_run, payload, p - payload);
+      last_run_len = p - payload;
+      last_run_end = out_pos;
+   }
+   free(payload);
+   n_runs_kept++;
+}
+
+static void write_index(void)
+{
+   uint8_t *payload, *p;
+   uint8_t footer[DG_FOOTER_SIZE];
+   uint64_t index_offset;
+   size_t i;
+
+   flush_repeats();
+   index_offset = out_pos;
+   payload = malloc(10 + out_n_chunks * 3 * 10 + labels_len);
+   if (payload == NULL)
+      out_of_memory();
+   p = put_uvarint(payload, out_n_chunks);
+   for (i = 0; i < out_n_chunks; i++)
+   {
+      const out_chunk *c = &out_chunks[i];
+      const char *label = labels + c->labels;
+      uint64_t j;
+
+      p = put_uvarint(p, c->offset);
+      p = put_uvarint(p, c->instrs);
+      p = put_uvarint(p, c->n_labels);
+      for (j = 0; j < c->n_labels; j++)
+      {
+         size_t len = strlen(label) + 1;
+
+         memcpy(p, label, len);
+         p += len;
+         label += len;
+      }
+   }
+   out_record(DG_R_INDEX, payload, p - payload);
+   free(payload);
+
+   footer[0] = DG_R_FOOTER;
+   footer[1] = DG_FOOTER_SIZE - 2;
+   put_value(footer + 2, index_offset, 8);
+   memcpy(footer + 10, "DGINDEX", 8);
+   out_bytes(footer, sizeof(footer));
+}
+
+/*------------------------------------------------------------*/
+/*--- Reading                                              ---*/
+/*------------------------------------------------------------*/
+
+static int is_summary(uint8_t type)
+{
+   switch (type)
+   {
+   case DG_R_HEATMAP:
+   case DG_R_REUSE:
+   case DG_R_CACHE_CONFIG:
+   case DG_R_CACHE_MISSES:
+   case DG_R_ALLOC_STATS:
+   case DG_R_FIELD_HEAT:
+   case DG_R_SHARING:
+   case DG_R_PAGES:
+   case DG_R_TLB_CONFIG:
+   case DG_R_TLB_MISSES:
+   case DG_R_ACCESS_PATTERNS:
+   case DG_R_ATOMICS:
+   case DG_R_WORKING_SET:
+   case DG_R_RASTER:
+   case DG_R_VALUE_STATS:
+   case DG_R_SOURCE_STATS:
+   case DG_R_SIMPOINTS:
+   case DG_R_FIRST_TOUCH:
+   case DG_R_ACCESS_COUNTS:
+   case DG_R_AFFINITY:
+   case DG_R_CONTEXT_COUNTS:
+      return 1;
+   default:
+      return 0;
+   }
+}
+
+static int label_is(const dgt_event *event, const char *label)
+{
+   return strlen(label) == event->label_len && memcmp(event->label, label, event->label_len) == 0;
+}
+
+/* Handles a record other than a run. In a chunk that is decoded, the
+ * accesses and events that pass are kept; in one that is passed over,
+ * only the records that later ones depend on.
+ */
+static void handle_record(const dgt_record *record, uint64_t end, int decoded)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *pend = p + record->length;
+   size_t ws = in_word_size;
+   uint64_t value;
+   dgt_event event;
+   dgt_bulk bulk;
+   dgt_lock lock;
+
+   switch (record->type)
+   {
+   case DG_R_HEADER:
+   case DG_R_INDEX:
+   case DG_R_FOOTER:
+   case DG_R_BBDEF:
+   case DG_R_CONTEXT:
+   case DG_R_FORK_DEFS:
+   case DG_R_THREAD:
+   case DG_R_BBRUN:
+   case DG_R_BBRUN_FILTERED:
+   case DG_R_BBRUN_STRIDED:
+   case DG_R_BBRUN_LINES:
+   case DG_R_BBREPEAT:
+      break;
+   case DG_R_CHUNK:
+      {
+         uint64_t fields[6];
+         int i;
+
+         /* Older traces do not have the time */
+         fields[5] = 0;
+         for (i = 0; i < 6 && p != NULL && p < pend; i++)
+            p = dgt_get_uvarint(p, pend, &fields[i]);
+         in_usecs = fields[5];
+         chunk_open = 0;
+      }
+      break;
+   case DG_R_START_EVENT:
+   case DG_R_END_EVENT:
+      if (dgt_parse_event(record, &event) != DGT_OK)
+         bad_trace(DGT_ERR_FORMAT);
+      if (!decoded || !time_passes(event.instrs))
+         break;
+      if (record->type == DG_R_START_EVENT)
+      {
+         add_label(&event);
+         copy_raw(record, end);
+      }
+      else if (event.has_summary)
+      {
+         /* The summary numbers contexts as in the input */
+         p = dgt_get_uvarint(p, pend, &value);
+         n_event_summaries++;
+         out_record(record->type, record->payload,
+                    (const uint8_t *) memchr(p, '\0', pend - p) + 1 - record->payload);
+      }
+      else
+         copy_raw(record, end);
+      break;
+   case DG_R_SYSCALL_ACCESS:
+      if (!decoded || (have_tid && dgt_decoder_tid(decoder) != want_tid)
+          || !time_passes(dgt_decoder_instrs(decoder)))
+         break;
+      if (record->length < 1 || (p = dgt_get_uvarint(p + 1, pend, &value)) == NULL
+          || (size_t) (pend - p) < ws || dgt_get_uvarint(p + ws, pend, &value) == NULL)
+         bad_trace(DGT_ERR_FORMAT);
+      if (addr_passes(dgt_get_word(file, p), value))
+         copy_raw(record, end);
+      break;
+   case DG_R_BULK_ACCESS:
+      if (!decoded || (have_tid && dgt_decoder_tid(decoder) != want_tid)
+          || !time_passes(dgt_decoder_instrs(decoder)))
+         break;
+      if (dgt_parse_bulk(file, record, &bulk) != DGT_OK)
+         bad_trace(DGT_ERR_FORMAT);
+      if (addr_passes(bulk.dst, bulk.size)
+          || (bulk.op == DG_BULK_COPY && addr_passes(bulk.src, bulk.size)))
+         copy_raw(record, end);
+      break;
+   case DG_R_LOCK:
+      if (!decoded || (have_tid && dgt_decoder_tid(decoder) != want_tid)
+          || !time_passes(dgt_decoder_instrs(decoder)))
+         break;
+      if (dgt_parse_lock(file, record, &lock) != DGT_OK)
+         bad_trace(DGT_ERR_FORMAT);
+      if (addr_passes(lock.addr, 1))
+         copy_raw(record, end);
+      break;
+   default:
+      /* Mappings, objects, ranges, the heap and the process */
+      if (is_summary(record->type))
+         n_dropped += decoded;
+      else
+         copy_raw(record, end);
+      break;
+   }
+}
+
+/* Decodes the records from the decoder's position to the end of its
+ * stretch, keeping the runs that pass.
+ */
+static void decode(void)
+{
+   dgt_record record;
+   dgt_run run;
+   int ret;
+
+   while ((ret = dgt_decoder_next(decoder, &record, &run)) > 0)
+   {
+      if (ret == DGT_ITEM_RECORD)
+         handle_record(&record, record.payload + record.length - dgt_file_stream(file), 1);
+      else
+      {
+         uint64_t instrs = dgt_decoder_instrs(decoder) - run.n_instrs;
+
+         n_runs++;
+         if (time_passes(instrs) && (!have_tid || run.tid == want_tid))
+            write_run(&run, instrs);
+         else
+            chunk_open = 0;
+      }
+   }
+   if (ret < 0)
+      bad_trace(ret);
+}
+
+/* Copies what is needed from the records from start to end, which are
+ * not decoded.
+ */
+static void pass_over(uint64_t start, uint64_t end)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   int ret = 0;
+
+   dgt_cursor_init(&cursor, file);
+   dgt_cursor_seek(&cursor, start);
+   while (cursor.pos < end && (ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      if (record.type == DG_R_INDEX || record.type == DG_R_FOOTER)
+         break;
+      handle_record(&record, cursor.pos, 0);
+      if (record.type == DG_R_BBRUN || record.type == DG_R_BBRUN_FILTERED
+          || record.type == DG_R_BBRUN_STRIDED || record.type == DG_R_BBRUN_LINES)
+         n_runs++;
+      else if (record.type == DG_R_BBREPEAT)
+         n_runs += record.payload[0];
+   }
+   if (ret < 0)
+      bad_trace(ret);
+}
+
+static uint64_t chunk_end(size_t i)
+{
+   if (i + 1 < dgt_file_n_chunks(file))
+      return dgt_file_chunk(file, i + 1)->offset;
+   return dgt_file_stream_size(file);
+}
+
+/* Finds the instructions in which the event is on, from the records after
+ * start. Without an index that is the whole trace; with one, each chunk
+ * in which the event starts is read up to the chunk after its end.
+ */
+static uint64_t find_events_from(uint64_t start)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   dgt_event event;
+   uint64_t on = NONE;
+   int ret;
+
+   dgt_cursor_init(&cursor, file);
+   dgt_cursor_seek(&cursor, start);
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      if (record.type == DG_R_INDEX || record.type == DG_R_FOOTER
+          || (record.type == DG_R_CHUNK && on == NONE && record.offset > start
+              && dgt_file_has_index(file)))
+         break;
+      if (record.type != DG_R_START_EVENT && record.type != DG_R_END_EVENT)
+         continue;
+      if (dgt_parse_event(&record, &event) != DGT_OK)
+         bad_trace(DGT_ERR_FORMAT);
+      if (!label_is(&event, event_label))
+         continue;
+      if (record.type == DG_R_START_EVENT && on == NONE)
+         on = event.instrs;
+      else if (record.type == DG_R_END_EVENT && on != NONE)
+      {
+         add_window(&events, on, event.instrs + 1);
+         on = NONE;
+      }
+   }
+   if (ret < 0)
+      bad_trace(ret);
+   if (on != NONE)
+      add_window(&events, on, NONE);
+   return ret == 1 ? record.offset : cursor.pos;
+}
+
+static void find_events(void)
+{
+   dgt_cursor cursor;
+   uint64_t done = 0;
+   size_t i;
+
+   if (!dgt_file_has_index(file))
+   {
+      dgt_cursor_init(&cursor, file);
+      find_events_from(cursor.pos);
+      return;
+   }
+   for (i = 0; i < dgt_file_n_chunks(file); i++)
+   {
+      const dgt_chunk *c = dgt_file_chunk(file, i);
+      const char *label = c->labels;
+      uint32_t j;
+
+      if (c->offset < done)
+         continue;
+      for (j = 0; j < c->n_labels; j++, label += strlen(label) + 1)
+         if (strcmp(label, event_label) == 0)
+         {
+            done = find_events_from(c->offset);
+            break;
+         }
+   }
+}
+
+/* Adds the ranges tracked with the labels to the addresses wanted */
+static void find_ranges(void)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   size_t ws = in_word_size, i;
+   int ret;
+
+   dgt_cursor_init(&cursor, file);
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      const char *label;
+      uint64_t addr;
+
+      if (record.type != DG_R_TRACK_RANGE || record.length <= 2 * ws || end[-1] != '\0')
+         continue;
+      label = memchr(p + 2 * ws, '\0', end - (p + 2 * ws));
+      label = label + 1 < (const char *) end ? label + 1 : "";
+      for (i = 0; i < n_range_labels; i++)
+         if (strcmp(label, range_labels[i]) == 0)
+         {
+            addr = dgt_get_word(file, p);
+            add_window(&addrs, addr, addr + dgt_get_word(file, p + ws));
+            break;
+         }
+   }
+   if (ret < 0)
+      bad_trace(ret);
+}
+
+/* Whether the thread runs in the chunk: it is the thread of the chunk
+ * record, or of a thread record in it.
+ */
+static int chunk_has_tid(size_t i)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   uint64_t end = chunk_end(i), value;
+   int ret;
+
+   dgt_cursor_init(&cursor, file);
+   dgt_cursor_seek(&cursor, dgt_file_chunk(file, i)->offset);
+   while (cursor.pos < end && (ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *pend = p + record.length;
+
+      if (record.type == DG_R_CHUNK)
+      {
+         /* The chunk number, the instructions, then the thread */
+         if ((p = dgt_get_uvarint(p, pend, &value)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &value)) == NULL
+             || dgt_get_uvarint(p, pend, &value) == NULL)
+            bad_trace(DGT_ERR_FORMAT);
+         if (value == want_tid)
+            return 1;
+      }
+      else if (record.type == DG_R_THREAD)
+      {
+         if (dgt_get_uvarint(p, pend, &value) == NULL)
+            bad_trace(DGT_ERR_FORMAT);
+         if (value == want_tid)
+            return 1;
+      }
+      else if (record.type == DG_R_INDEX || record.type == DG_R_FOOTER)
+         break;
+   }
+   return 0;
+}
+
+static int chunk_wanted(size_t i)
+{
+   size_t n = dgt_file_n_chunks(file);
+   uint64_t lo = dgt_file_chunk(file, i)->instrs;
+   uint64_t hi = i + 1 < n ? dgt_file_chunk(file, i + 1)->instrs : NONE;
+
+   if (hi < instrs_window.lo || lo >= instrs_window.hi)
+      return 0;
+   if (event_label != NULL && !overlaps(&events, lo, hi == NONE ? NONE : hi + 1))
+      return 0;
+   return !have_tid || chunk_has_tid(i);
+}
+
+static int parse_window(const char *s, window *w)
+{
+   char *end;
+
+   w->lo = strtoull(s, &end, 0);
+   if (end == s)
+      return 0;
+   if (*end == '-' && end[1] == '\0')
+      w->hi = NONE;
+   else if (*end == '-' || *end == '+')
+   {
+      const char *rest = end + 1;
+      int is_size = *end == '+';
+      uint64_t value = strtoull(rest, &end, 0);
+
+      if (end == rest || *end != '\0')
+         return 0;
+      w->hi = is_size ? w->lo + value : value;
+   }
+   else
+      return 0;
+   return w->hi > w->lo;
+}
+
+int main(int argc, char **argv)
+{
+   const dgt_header *h;
+   dgt_defs *defs = NULL;
+   unsigned int n_threads = 0;
+   uint64_t flags;
+   uint8_t header[2 + 11 + 4 + 10 + 32];
+   uint8_t *p;
+   size_t version_len, i;
+   int have_filter = 0, ret;
+
+   if (argv[0])
+      argv0 = argv[0];
+   range_labels = calloc(argc > 1 ? argc : 1, sizeof(const char *));
+   if (range_labels == NULL)
+      out_of_memory();
+   for (i = 1; i < (size_t) argc; i++)
+   {
+      window w;
+
+      if (strcmp(argv[i], "-o") == 0 && i + 1 < (size_t) argc)
+         out_name = argv[++i];
+      else if (strncmp(argv[i], "--tid=", 6) == 0)
+      {
+         want_tid = strtoull(argv[i] + 6, NULL, 10);
+         have_tid = 1;
+      }
+      else if (strncmp(argv[i], "--event=", 8) == 0)
+         event_label = argv[i] + 8;
+      else if (strncmp(argv[i], "--range=", 8) == 0)
+         range_labels[n_range_labels++] = argv[i] + 8;
+      else if (strncmp(argv[i], "--addr=", 7) == 0)
+      {
+         if (!parse_window(argv[i] + 7, &w))
+            usage();
+         add_window(&addrs, w.lo, w.hi);
+      }
+      else if (strncmp(argv[i], "--instrs=", 9) == 0)
+      {
+         if (!parse_window(argv[i] + 9, &instrs_window))
+            usage();
+      }
+      else if (strncmp(argv[i], "--threads=", 10) == 0)
+         n_threads = strtoul(argv[i] + 10, NULL, 10);
+      else if (argv[i][0] == '-' || in_name != NULL)
+         usage();
+      else
+         in_name = argv[i];
+      have_filter |= strncmp(argv[i], "--", 2) == 0 && strncmp(argv[i], "--threads=", 10) != 0;
+   }
+   if (out_name == NULL || in_name == NULL || !have_filter)
+      usage();
+
+   ret = dgt_open(in_name, &file);
+   if (ret != DGT_OK)
+      bad_trace(ret);
+   h = dgt_file_header(file);
+   in_word_size = h->word_size;
+   out_big_endian = h->big_endian;
+   if (n_range_labels > 0)
+   {
+      find_ranges();
+      if (addrs.n == 0)
+         fprintf(stderr, "%s: warning: no range is tracked with the label\n", argv0);
+   }
+   if (event_label != NULL)
+   {
+      find_events();
+      if (events.n == 0)
+         fprintf(stderr, "%s: warning: no event has the label %s\n", argv0, event_label);
+   }
+   keep_static = addrs.n == 0 && n_range_labels == 0;
+
+   out = fopen(out_name, "wb");
+   if (out == NULL)
+   {
+      fprintf(stderr, "%s: cannot create %s: %s\n", argv0, out_name, strerror(errno));
+      return 1;
+   }
+   /* Fetches are left out with the addresses, and runs are never strided */
+   flags = (h->flags & ~(uint64_t) (DG_HEADER_STRIDED | DG_HEADER_EVENTS))
+           | DG_HEADER_CHUNKED | DG_HEADER_PARTIAL;
+   if (!keep_static)
+      flags &= ~(uint64_t) DG_HEADER_INSTRS;
+   header[0] = DG_R_HEADER;
+   memcpy(header + 2, "DATAGRIND1", 11);
+   header[13] = DGT_FILE_VERSION;
+   header[14] = out_big_endian;
+   header[15] = in_word_size;
+   header[16] = DG_COMPRESS_NONE;
+   p = put_uvarint(header + 17, flags);
+   version_len = strlen(h->tool_version) + 1;
+   memcpy(p, h->tool_version, version_len);
+   p += version_len;
+   header[1] = p - header - 2;
+   out_bytes(header, p - header);
+
+   if (dgt_file_has_index(file))
+   {
+      dgt_cursor cursor;
+      size_t n = dgt_file_n_chunks(file);
+
+      ret = dgt_defs_new(file, n_threads, &defs);
+      if (ret == DGT_OK)
+         ret = dgt_decoder_new_shared(file, defs, &decoder);
+      if (ret != DGT_OK)
+         bad_trace(ret);
+      dgt_cursor_init(&cursor, file);
+      pass_over(cursor.pos, n > 0 ? dgt_file_chunk(file, 0)->offset : dgt_file_stream_size(file));
+      for (i = 0; i < n; i++)
+      {
+         if (chunk_wanted(i))
+         {
+            ret = dgt_decoder_seek_chunk(decoder, i);
+            if (ret != DGT_OK)
+               bad_trace(ret);
+            decode();
+         }
+         else
+         {
+            n_chunks_skipped++;
+            pass_over(dgt_file_chunk(file, i)->offset, chunk_end(i));
+         }
+      }
+   }
+   else
+   {
+      ret = dgt_decoder_new(file, &decoder);
+      if (ret != DGT_OK)
+         bad_trace(ret);
+      decode();
+   }
+   write_index();
+   if (fclose(out) != 0)
+   {
+      fprintf(stderr, "%s: cannot write %s: %s\n", argv0, out_name, strerror(errno));
+      return 1;
+   }
+
+   fprintf(stderr, "%s: kept %llu of %llu runs; %llu of %llu chunks were not decoded\n",
+           argv0, (unsigned long long) n_runs_kept, (unsigned long long) n_runs,
+           (unsigned long long) n_chunks_skipped,
+           (unsigned long long) (dgt_file_has_index(file) ? dgt_file_n_chunks(file) : 1));
+   if (n_dropped > 0)
+      fprintf(stderr, "%s: left out %llu analysis summary records\n",
+              argv0, (unsigned long long) n_dropped);
+   if (n_event_summaries > 0)
+      fprintf(stderr, "%s: left out the summaries of %llu events\n",
+              argv0, (unsigned long long) n_event_summaries);
+
+   for (i = 0; i < out_n_bbdefs; i++)
+      free(out_blocks[i].prev);
+   free(out_blocks);
+   free(out_chunks);
+   free(labels);
+   free(last_run);
+   free(bbdefs.map);
+   free(contexts.map);
+   free(events.w);
+   free(addrs.w);
+   free(range_labels);
+   dgt_decoder_free(decoder);
+   dgt_defs_free(defs);
+   dgt_close(file);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,221 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: counting accesses per cache line.   dg_heatmap.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-mode=heatmap, runs are not written out. Instead each
+ * access bumps a counter keyed by the context, the cache line and the
+ * direction, and the counters are written as a DG_R_HEATMAP at each event
+ * and at exit, then cleared. The size of the output thus depends on the
+ * working set rather than on how long the program runs.
+ *
+ * The counters live in an open-addressing hash table with linear probing,
+ * which is doubled when it gets half full. With --datagrind-max-memory,
+ * a table that would grow past the cap is written out as a DG_R_HEATMAP
+ * and cleared instead, as at an event: readers already add up the records,
+ * so the trace ends up holding sorted partial counts that are merged when
+ * read, and the memory used no longer depends on the working set.
+ */
+
+#define DG_HEATMAP_LINE_SHIFT 6
+#define DG_HEATMAP_INITIAL    (1 << 16)
+
+typedef struct
+{
+   UWord context_index;
+   Addr line;
+   UInt count;     /* 0 if the slot is empty; saturates */
+   UChar dir;
+} DgHeatEntry;
+
+static DgHeatEntry *table = NULL;
+static SizeT table_size = 0;    /* Power of 2 */
+static SizeT table_used = 0;
+static SizeT max_size = 0;      /* Largest table allowed, or 0 for no limit */
+static ULong stats_spills = 0;
+
+static inline SizeT heat_hash(UWord context_index, Addr line, UChar dir)
+{
+   UWord h = context_index * 0x9E3779B1U ^ line * 0x85EBCA6BU ^ dir;
+   return (h ^ (h >> 15)) & (table_size - 1);
+}
+
+static DgHeatEntry *heat_slot(UWord context_index, Addr line, UChar dir)
+{
+   SizeT i = heat_hash(context_index, line, dir);
+
+   for (;;)
+   {
+      DgHeatEntry *e = &table[i];
+      if (e->count == 0
+          || (e->line == line && e->context_index == context_index && e->dir == dir))
+         return e;
+      i = (i + 1) & (table_size - 1);
+   }
+}
+
+static void heat_resize(SizeT size)
+{
+   DgHeatEntry *old = table;
+   SizeT old_size = table_size;
+   SizeT i;
+
+   table = VG_(calloc)("datagrind.heatmap", size, sizeof(DgHeatEntry));
+   table_size = size;
+   for (i = 0; i < old_size; i++)
+      if (old[i].count != 0)
+         *heat_slot(old[i].context_index, old[i].line, old[i].dir) = old[i];
+   if (old != NULL)
+      VG_(free)(old);
+}
+
+void DG_(heatmap_init)(SizeT max_memory)
+{
+   if (max_memory > 0)
+   {
+      max_size = DG_HEATMAP_INITIAL;
+      while (2 * max_size * sizeof(DgHeatEntry) <= max_memory)
+         max_size *= 2;
+   }
+   heat_resize(DG_HEATMAP_INITIAL);
+}
+
+void DG_(heatmap_add)(UWord context_index, Addr addr, UChar dir)
+{
+   Addr line = addr >> DG_HEATMAP_LINE_SHIFT;
+   DgHeatEntry *e = heat_slot(context_index, line, dir);
+
+   if (e->count == 0)
+   {
+      e->context_index = context_index;
+      e->line = line;
+      e->dir = dir;
+      if (++table_used > table_size / 2)
+      {
+         e->count = 1;
+         if (max_size == 0 || table_size < max_size)
+            heat_resize(table_size * 2);
+         else
+         {
+            DG_(heatmap_flush)();
+            stats_spills++;
+         }
+         return;
+      }
+   }
+   if (e->count != 0xFFFFFFFFU)
+      e->count++;
+}
+
+static Int cmp_heat_entry(const void *a, const void *b)
+{
+   const DgHeatEntry *ea = a;
+   const DgHeatEntry *eb = b;
+
+   if (ea->context_index != eb->context_index)
+      return ea->context_index < eb->context_index ? -1 : 1;
+   if (ea->line != eb->line)
+      return ea->line < eb->line ? -1 : 1;
+   return (Int) ea->dir - (Int) eb->dir;
+}
+
+void DG_(heatmap_print_stats)(DgPrintf print)
+{
+   if (table == NULL)
+      return;
+   print("datagrind: heat map of %'lu entries, %'llu spills\n",
+         table_size, stats_spills);
+}
+
+static UChar *encode_heat_entry(UChar *p, const DgHeatEntry *e,
+                                UWord *prev_context, Addr *prev_line)
+{
+   p = encode_uvarint(p, e->context_index - *prev_context);
+   if (e->context_index != *prev_context)
+      *prev_line = 0;
+   p = encode_uvarint(p, e->line - *prev_line);
+   *p++ = e->dir;
+   p = encode_uvarint(p, e->count);
+   *prev_context = e->context_index;
+   *prev_line = e->line;
+   return p;
+}
+
+void DG_(heatmap_flush)(void)
+{
+   DgHeatEntry *entries;
+   UChar entry[3 * DG_MAX_UVARINT_BYTES + 1];
+   SizeT n = 0, i;
+   ULong len;
+   UWord prev_context = 0;
+   Addr prev_line = 0;
+
+   if (table == NULL || table_used == 0)
+      return;
+
+   /* Gather the entries at the front of the table, and sort them so that
+    * each can be delta-encoded against the one before.
+    */
+   entries = table;
+   for (i = 0; i < table_size; i++)
+      if (table[i].count != 0)
+         entries[n++] = table[i];
+   tl_assert(n == table_used);
+   VG_(ssort)(entries, n, sizeof(DgHeatEntry), cmp_heat_entry);
+
+   /* The length is worked out first, so that the entries can go straight
+    * to the output rather than through a payload bigger than the table.
+    */
+   len = 1 + uvarint_size(n);
+   for (i = 0; i < n; i++)
+      len += encode_heat_entry(entry, &entries[i], &prev_context, &prev_line) - entry;
+   out_byte(DG_R_HEATMAP);
+   out_length(len);
+   out_byte(DG_HEATMAP_LINE_SHIFT);
+   out_bytes(entry, encode_uvarint(entry, n) - entry);
+   prev_context = 0;
+   prev_line = 0;
+   for (i = 0; i < n; i++)
+      out_bytes(entry, encode_heat_entry(entry, &entries[i], &prev_context, &prev_line) - entry);
+
+   VG_(memset)(table, 0, table_size * sizeof(DgHeatEntry));
+   table_used = 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,689 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: declarations shared between modules.             ---*/
+/*---                                                 dg_include.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __DG_INCLUDE_H
+#define __DG_INCLUDE_H
+
+#define DG_(str)    VGAPPEND(vgDatagrind_,str)
+
+/* This is a private header file for use only within the
+   exp-datagrind/ directory. */
+
+#if VG_WORDSIZE == 8
+# define DG_IRTY_WORD  Ity_I64
+# define DG_IROP_ADD   Iop_Add64
+# define DG_IROP_SUB   Iop_Sub64
+# define DG_IROP_AND   Iop_And64
+# define DG_IROP_SHR   Iop_Shr64
+# define DG_IROP_CMPNE Iop_CmpNE64
+# define DG_IROP_CMPEQ Iop_CmpEQ64
+# define DG_IROP_CMPLEU Iop_CmpLE64U
+# define DG_IROP_1UTO  Iop_1Uto64
+#else
+# define DG_IRTY_WORD  Ity_I32
+# define DG_IROP_ADD   Iop_Add32
+# define DG_IROP_SUB   Iop_Sub32
+# define DG_IROP_AND   Iop_And32
+# define DG_IROP_SHR   Iop_Shr32
+# define DG_IROP_CMPNE Iop_CmpNE32
+# define DG_IROP_CMPEQ Iop_CmpEQ32
+# define DG_IROP_CMPLEU Iop_CmpLE32U
+# define DG_IROP_1UTO  Iop_1Uto32
+#endif
+
+#if defined(VG_BIGENDIAN)
+# define DG_IREND Iend_BE
+#elif defined(VG_LITTLEENDIAN)
+# define DG_IREND Iend_LE
+#else
+# error "Unknown endianness"
+#endif
+
+/*------------------------------------------------------------*/
+/*--- Output (dg_out.c)                                    ---*/
+/*------------------------------------------------------------*/
+
+/* The buffer currently being filled. It is exposed so that the encoders
+ * below can be inlined into their callers.
+ */
+extern UChar *DG_(out_buf);
+extern SizeT DG_(out_buf_size);
+extern SizeT DG_(out_buf_used);
+/* Bytes of the record stream handed to the writer so far */
+extern ULong DG_(out_flushed);
+
+/* One of the DG_COMPRESS_* values */
+extern Int DG_(clo_compress);
+
+extern Bool DG_(out_process_cmd_line_option)(const HChar *arg);
+extern void DG_(out_print_usage)(void);
+
+/* Opens the output given by --datagrind-out-file: a file name to expand,
+ * or tcp:host:port or fd:n to stream to. Exits with a message on failure.
+ */
+extern void DG_(out_open)(const HChar *name);
+/* Writes out the header, which is never compressed, and starts the writer
+ * for the rest of the trace.
+ */
+extern void DG_(out_end_header)(void);
+/* Hands the buffered data to the writer. */
+extern void DG_(out_flush)(void);
+/* Ends the trace with the index and closes the output, or dumps the ring
+ * with --datagrind-ring-size.
+ */
+extern void DG_(out_finish)(void);
+/* Called before each chunk record, to start a new file there when
+ * rotating. instrs is the instruction count of the chunk.
+ */
+extern void DG_(out_chunk_start)(ULong instrs);
+/* Writes data that is too large to be worth buffering. */
+extern void DG_(out_write_unbuffered)(const void *buf, SizeT count);
+/* Whether the files written hold only part of the run, because of the
+ * ring or rotation.
+ */
+extern Bool DG_(out_partial)(void);
+
+/* printf-like, so that statistics can go to the log or to gdb */
+typedef UInt (*DgPrintf)(const HChar *format, ...);
+/* Prints the counts of flushes, writes and records by type */
+extern void DG_(out_print_stats)(DgPrintf print);
+
+/* Bytes of trace kept by the flight recorder, or 0 to write it all */
+extern Long DG_(clo_ring_size);
+/* Writes the header, the definitions and the chunks in the ring to
+ * <out-file>.<n>, for the nth dump.
+ */
+extern void DG_(out_ring_dump)(void);
+
+/* Whether a forked child writes a file of its own */
+extern Bool DG_(clo_fork_files);
+/* In a forked child, with the buffer flushed before the fork, leaves the
+ * parent's file and opens the child's, ready for its header. Returns the
+ * name of the parent's file, which the caller frees.
+ */
+extern HChar *DG_(out_fork_child)(void);
+
+/* Position in the record stream, counting from the start of the file. It
+ * is the file offset unless the trace is compressed.
+ */
+static inline ULong DG_(out_offset)(void)
+{
+   return DG_(out_flushed) + DG_(out_buf_used);
+}
+
+static inline void out_bytes(const void *buf, SizeT count)
+{
+   if (count > DG_(out_buf_size) - DG_(out_buf_used))
+   {
+      DG_(out_flush)();
+      if (count > DG_(out_buf_size))
+      {
+         DG_(out_write_unbuffered)(buf, count);
+         return;
+      }
+   }
+   VG_(memcpy)(DG_(out_buf) + DG_(out_buf_used), buf, count);
+   DG_(out_buf_used) += count;
+}
+
+static inline void out_byte(UChar byte)
+{
+   if (DG_(out_buf_used) >= DG_(out_buf_size))
+      DG_(out_flush)();
+   DG_(out_buf)[DG_(out_buf_used)++] = byte;
+}
+
+static inline void out_word(UWord word)
+{
+   out_bytes(&word, sizeof(word));
+}
+
+static inline void out_length(ULong len)
+{
+   if (len < 255)
+      out_byte((UChar) len);
+   else
+   {
+      out_byte(255);
+      out_bytes(&len, sizeof(len));
+   }
+}
+
+/* Record fields can also be written straight into the buffer, once room
+ * for the whole record has been made with out_begin_record. Each put_
+ * function writes at p and returns the end.
+ */
+
+/* Largest record type and length */
+#define DG_MAX_RECORD_HEAD (2 + sizeof(ULong))
+
+static inline UChar *put_byte(UChar *p, UChar byte)
+{
+   *p = byte;
+   return p + 1;
+}
+
+static inline UChar *put_word(UChar *p, UWord word)
+{
+   VG_(memcpy)(p, &word, sizeof(word));
+   return p + sizeof(word);
+}
+
+static inline UChar *put_bytes(UChar *p, const void *buf, SizeT count)
+{
+   VG_(memcpy)(p, buf, count);
+   return p + count;
+}
+
+static inline UChar *put_length(UChar *p, ULong len)
+{
+   if (len < 255)
+      return put_byte(p, (UChar) len);
+   *p++ = 255;
+   return put_bytes(p, &len, sizeof(len));
+}
+
+/* Flushes the buffer to make room for count bytes, enlarging it if it
+ * is too small.
+ */
+extern UChar *DG_(out_reserve)(SizeT count);
+
+/* Makes room for a record with a payload of len bytes and writes its type
+ * and length, returning where the payload goes. The payload is written
+ * with the put_ functions, and the end passed to out_end_record.
+ */
+static inline UChar *out_begin_record(UChar type, ULong len)
+{
+   UChar *p;
+
+   if (len + DG_MAX_RECORD_HEAD <= DG_(out_buf_size) - DG_(out_buf_used))
+      p = DG_(out_buf) + DG_(out_buf_used);
+   else
+      p = DG_(out_reserve)(len + DG_MAX_RECORD_HEAD);
+   *p++ = type;
+   return put_length(p, len);
+}
+
+static inline void out_end_record(UChar *end)
+{
+   DG_(out_buf_used) = end - DG_(out_buf);
+}
+
+#define DG_MAX_UVARINT_BYTES ((VG_WORDSIZE * 8 + 6) / 7)
+
+/* Encodes v as an unsigned LEB128 varint at p, returning the end. */
+static inline UChar *encode_uvarint(UChar *p, HWord v)
+{
+   while (v >= 0x80)
+   {
+      *p++ = (UChar) (v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (UChar) v;
+   return p;
+}
+
+/* The number of bytes encode_uvarint writes for v */
+static inline SizeT uvarint_size(HWord v)
+{
+   SizeT n = 1;
+
+   while (v >= 0x80)
+   {
+      n++;
+      v >>= 7;
+   }
+   return n;
+}
+
+/* As encode_uvarint, but for 64-bit values even on 32-bit targets. */
+static inline UChar *encode_uvarint64(UChar *p, ULong v)
+{
+   while (v >= 0x80)
+   {
+      *p++ = (UChar) (v | 0x80);
+      v >>= 7;
+   }
+   *p++ = (UChar) v;
+   return p;
+}
+
+/*------------------------------------------------------------*/
+/*--- Chunk index (dg_index.c)                             ---*/
+/*------------------------------------------------------------*/
+
+/* Stream offset after which the next run starts a new chunk */
+extern ULong DG_(index_next_chunk);
+/* Number of the current chunk, within which address deltas are valid */
+extern UWord DG_(index_chunk);
+/* Wall clock time of the DG_R_PROCESS, in microseconds since the epoch */
+extern ULong DG_(index_start_usecs);
+
+extern ULong DG_(index_now_usecs)(void);
+
+extern Bool DG_(index_process_cmd_line_option)(const HChar *arg);
+extern void DG_(index_print_usage)(void);
+/* Whether DG_R_CHUNK records are written */
+extern Bool DG_(index_chunked)(void);
+
+/* Writes a DG_R_CHUNK, given the decoder state that it records. Does
+ * nothing if chunks are disabled.
+ */
+extern void DG_(index_start_chunk)(ULong instrs, ThreadId tid,
+                                   UWord n_bbdefs, UWord n_contexts);
+/* Notes a DG_R_START_EVENT in the current chunk. */
+extern void DG_(index_add_label)(const HChar *label, SizeT len);
+/* Writes the DG_R_INDEX and fills in the footer for DG_(out_finish),
+ * returning its size, or 0 if there is no index.
+ */
+extern SizeT DG_(index_finish)(UChar *footer);
+/* Returns the offset of the first chunk starting after offset, or ~0. */
+extern ULong DG_(index_chunk_after)(ULong offset);
+/* Forgets the chunks starting before offset, which are no longer kept. */
+extern void DG_(index_drop_before)(ULong offset);
+/* Returns the whole DG_R_INDEX record for the stream moved by delta
+ * bytes, setting *size, and fills in the footer for an index at
+ * index_offset. Returns NULL if there is no index. The caller frees it.
+ */
+extern UChar *DG_(index_moved)(Long delta, ULong index_offset, UChar *footer,
+                               SizeT *size);
+
+static inline Bool DG_(index_chunk_due)(void)
+{
+   return DG_(out_offset)() >= DG_(index_next_chunk);
+}
+
+/*------------------------------------------------------------*/
+/*--- Heat maps (dg_heatmap.c)                             ---*/
+/*------------------------------------------------------------*/
+
+/* max_memory caps the table, or is 0 for no limit. */
+extern void DG_(heatmap_init)(SizeT max_memory);
+/* Counts an access by the run of a context. */
+extern void DG_(heatmap_add)(UWord context_index, Addr addr, UChar dir);
+/* Writes out the counts as a DG_R_HEATMAP, if there are any, and clears them. */
+extern void DG_(heatmap_flush)(void);
+extern void DG_(heatmap_print_stats)(DgPrintf print);
+
+/*------------------------------------------------------------*/
+/*--- Reuse distances (dg_reuse.c)                         ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(reuse_process_cmd_line_option)(const HChar *arg);
+extern void DG_(reuse_print_usage)(void);
+/* max_memory caps the table of lines and the tree, or is 0 for no limit. */
+extern void DG_(reuse_init)(SizeT max_memory);
+/* Measures the reuse distance of an access by the run of a context. */
+extern void DG_(reuse_add)(UWord context_index, Addr addr);
+/* Add or remove a range that gets a histogram of its own. */
+extern void DG_(reuse_track)(Addr addr, SizeT len);
+extern void DG_(reuse_untrack)(Addr addr, SizeT len);
+/* Writes out the counts since the last flush as DG_R_REUSE records, and
+ * clears them.
+ */
+extern void DG_(reuse_flush)(void);
+/* Flushes the histograms for the last time. */
+extern void DG_(reuse_finish)(void);
+extern void DG_(reuse_print_stats)(DgPrintf print);
+
+/*------------------------------------------------------------*/
+/*--- Time by address rasters (dg_raster.c)                ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(raster_process_cmd_line_option)(const HChar *arg);
+extern void DG_(raster_print_usage)(void);
+extern void DG_(raster_init)(void);
+/* Add or remove a range that gets rows of its own. */
+extern void DG_(raster_track)(Addr addr, SizeT len);
+extern void DG_(raster_untrack)(Addr addr, SizeT len);
+/* now is the number of instructions executed so far. */
+extern void DG_(raster_add)(Addr addr, UChar dir, ULong now);
+/* Writes out the last bucket. */
+extern void DG_(raster_finish)(ULong now);
+
+/*------------------------------------------------------------*/
+/*--- Per-instruction counts (dg_counts.c)                 ---*/
+/*------------------------------------------------------------*/
+
+extern void DG_(counts_init)(void);
+/* Counts the instructions and accesses of a superblock with inline IR,
+ * in place of its runs.
+ */
+extern IRSB *DG_(counts_instrument)(IRSB *sbIn, Addr nraddr);
+/* Adds in the counts of a translation that is being discarded. */
+extern void DG_(counts_discard)(Addr nraddr);
+/* Writes out the counts as a DG_R_ACCESS_COUNTS. */
+extern void DG_(counts_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Cache simulation (dg_cachesim.c)                     ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_cache_sim);
+
+extern Bool DG_(cachesim_process_cmd_line_option)(const HChar *arg);
+extern void DG_(cachesim_print_usage)(void);
+extern void DG_(cachesim_init)(void);
+/* Simulates an access, numbered within the block definition, by the run
+ * of a context whose block has n_accesses accesses.
+ */
+extern void DG_(cachesim_ref)(UWord context_index, Word n_accesses, Word access,
+                              Addr addr, UChar size);
+/* Writes out the counts as DG_R_CACHE_CONFIG and DG_R_CACHE_MISSES records. */
+extern void DG_(cachesim_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Allocation statistics (dg_allocstats.c)              ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_alloc_stats);
+
+extern Bool DG_(allocstats_process_cmd_line_option)(const HChar *arg);
+extern void DG_(allocstats_print_usage)(void);
+extern void DG_(allocstats_init)(void);
+/* Heap blocks coming and going, with the instruction count as the time */
+extern void DG_(allocstats_new_block)(Addr p, SizeT szB, UWord stack_index, ULong now);
+extern void DG_(allocstats_free_block)(Addr p, ULong now);
+extern void DG_(allocstats_access)(Addr addr, UChar size, UChar dir);
+/* The allocation stack of the live block holding a, if any */
+extern Bool DG_(allocstats_site)(Addr a, UWord *stack_index);
+/* Writes out the totals per allocation stack as DG_R_ALLOC_STATS records. */
+extern void DG_(allocstats_finish)(ULong now);
+
+/*------------------------------------------------------------*/
+/*--- Definitions cache (dg_defcache.c)                    ---*/
+/*------------------------------------------------------------*/
+
+extern const HChar *DG_(clo_defs_cache);
+
+extern Bool DG_(defcache_process_cmd_line_option)(const HChar *arg);
+extern void DG_(defcache_print_usage)(void);
+/* Reads the cache and writes the DG_R_FORK_DEFS naming it, returning the
+ * numbers of the definitions it has, from which the run goes on.
+ */
+extern void DG_(defcache_start)(UWord *n_bbdefs, UWord *n_contexts);
+/* Given a DG_R_BBDEF or DG_R_CONTEXT about to be written, from its type
+ * to end, returns True with the number of the same one in the cache, if
+ * it can be used instead, and otherwise keeps a copy to add to the cache.
+ */
+extern Bool DG_(defcache_record)(const UChar *record, const UChar *end, UWord *index);
+/* Adds the definitions the run wrote to the cache */
+extern void DG_(defcache_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Affinity graph (dg_affinity.c)                       ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_affinity);
+
+extern Bool DG_(affinity_process_cmd_line_option)(const HChar *arg);
+extern void DG_(affinity_print_usage)(void);
+extern void DG_(affinity_init)(void);
+extern void DG_(affinity_track)(Addr addr, SizeT len);
+extern void DG_(affinity_untrack)(Addr addr, SizeT len);
+extern void DG_(affinity_access)(Addr addr);
+/* Writes out the heaviest pairs as a DG_R_AFFINITY record. */
+extern void DG_(affinity_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Field heat (dg_fieldheat.c)                          ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_field_heat);
+
+extern Bool DG_(fieldheat_process_cmd_line_option)(const HChar *arg);
+extern void DG_(fieldheat_print_usage)(void);
+extern void DG_(fieldheat_init)(void);
+extern void DG_(fieldheat_track)(Addr addr, SizeT len);
+extern void DG_(fieldheat_untrack)(Addr addr, SizeT len);
+extern void DG_(fieldheat_access)(Addr addr, UChar size, UChar dir);
+/* Writes out the counts per range as DG_R_FIELD_HEAT records. */
+extern void DG_(fieldheat_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Sharing between threads (dg_sharing.c)               ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_sharing);
+extern Bool DG_(clo_atomics);
+
+extern Bool DG_(sharing_process_cmd_line_option)(const HChar *arg);
+extern void DG_(sharing_print_usage)(void);
+extern void DG_(sharing_init)(void);
+/* now is the number of instructions executed so far. */
+extern void DG_(sharing_access)(ThreadId tid, UWord context_index, Addr addr, UChar size,
+                                UChar dir, ULong now);
+/* Counts a DG_ACC_ATOMIC access for --datagrind-atomics. */
+extern void DG_(atomics_access)(ThreadId tid, UWord context_index, Addr addr, ULong now);
+/* Writes out the lines that moved between threads as DG_R_SHARING records,
+ * and the contended atomic lines as DG_R_ATOMICS records.
+ */
+extern void DG_(sharing_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Page summary (dg_pages.c)                            ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_pages);
+extern Bool DG_(clo_first_touch);
+
+extern Bool DG_(pages_process_cmd_line_option)(const HChar *arg);
+extern void DG_(pages_print_usage)(void);
+extern void DG_(pages_init)(void);
+extern void DG_(pages_track)(Addr addr, SizeT len);
+extern void DG_(pages_untrack)(Addr addr, SizeT len);
+/* now is the number of instructions executed so far. */
+extern void DG_(pages_access)(ThreadId tid, UWord context, Addr addr, UChar dir, ULong now);
+/* Forget or move the first writes of the pages of a mapping. */
+extern void DG_(pages_unmap)(Addr addr, SizeT len);
+extern void DG_(pages_remap)(Addr from, Addr to, SizeT len);
+/* Writes out the counts as a DG_R_PAGES record per page size, and the
+ * first writes as a DG_R_FIRST_TOUCH record.
+ */
+extern void DG_(pages_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- TLB simulation (dg_tlbsim.c)                         ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_tlb_sim);
+
+extern Bool DG_(tlbsim_process_cmd_line_option)(const HChar *arg);
+extern void DG_(tlbsim_print_usage)(void);
+extern void DG_(tlbsim_init)(void);
+extern void DG_(tlbsim_track)(Addr addr, SizeT len);
+extern void DG_(tlbsim_untrack)(Addr addr, SizeT len);
+/* Simulates access number access of the n_accesses in the context. */
+extern void DG_(tlbsim_ref)(UWord context_index, Word n_accesses, Word access,
+                            Addr addr, UChar size);
+/* Writes out the TLB configuration and the counts per context and range. */
+extern void DG_(tlbsim_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Access patterns (dg_patterns.c)                      ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_access_patterns);
+
+extern Bool DG_(patterns_process_cmd_line_option)(const HChar *arg);
+extern void DG_(patterns_print_usage)(void);
+extern void DG_(patterns_init)(void);
+extern void DG_(patterns_track)(Addr addr, SizeT len);
+extern void DG_(patterns_untrack)(Addr addr, SizeT len);
+/* Classes access number access of the n_accesses in the context. */
+extern void DG_(patterns_ref)(UWord context_index, Word n_accesses, Word access,
+                              Addr addr, UChar size);
+/* Writes out the classes and counts per context and range. */
+extern void DG_(patterns_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Value locality (dg_values.c)                         ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_value_stats);
+
+extern Bool DG_(values_process_cmd_line_option)(const HChar *arg);
+extern void DG_(values_print_usage)(void);
+extern void DG_(values_init)(void);
+/* Classes a store of size bytes, at most 8, by the context. */
+extern void DG_(values_store)(UWord context_index, ULong value, UChar size);
+/* Writes out the counts per context. */
+extern void DG_(values_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Source lines (dg_sources.c)                          ---*/
+/*------------------------------------------------------------*/
+
+typedef struct DgSourceLine DgSourceLine;
+
+extern Bool DG_(clo_source_stats);
+
+extern Bool DG_(sources_process_cmd_line_option)(const HChar *arg);
+extern void DG_(sources_print_usage)(void);
+extern void DG_(sources_init)(void);
+/* The node for the file, line and function of an instruction, which
+ * stays valid to the end of the run.
+ */
+extern DgSourceLine *DG_(sources_lookup)(Addr ip);
+extern void DG_(sources_access)(DgSourceLine *line, Bool write, UInt size);
+extern void DG_(sources_print_stats)(DgPrintf print);
+/* Writes out the counts per line and per function. */
+extern void DG_(sources_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Working set sizes (dg_wss.c)                         ---*/
+/*------------------------------------------------------------*/
+
+extern Long DG_(clo_wss_interval);
+
+extern Bool DG_(wss_process_cmd_line_option)(const HChar *arg);
+extern void DG_(wss_print_usage)(void);
+extern void DG_(wss_init)(void);
+extern void DG_(wss_track)(Addr addr, SizeT len);
+extern void DG_(wss_untrack)(Addr addr, SizeT len);
+/* now is the number of instructions executed so far. */
+extern void DG_(wss_access)(ThreadId tid, Addr addr, UChar size, UChar dir, ULong now);
+/* Counts the instructions of a run, after its accesses. */
+extern void DG_(wss_run)(ThreadId tid, ULong n_instrs, ULong now);
+/* Writes out the last window. */
+extern void DG_(wss_finish)(ULong now);
+
+/*------------------------------------------------------------*/
+/*--- Event summaries (dg_events.c)                        ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_event_stats);
+
+extern Bool DG_(events_process_cmd_line_option)(const HChar *arg);
+extern void DG_(events_print_usage)(void);
+extern void DG_(events_init)(void);
+extern void DG_(events_track)(Addr addr, SizeT len);
+extern void DG_(events_untrack)(Addr addr, SizeT len);
+extern void DG_(events_access)(ThreadId tid, UWord context_index, Addr addr, UChar size,
+                               UChar dir);
+extern void DG_(events_start)(ThreadId tid, const HChar *label, SizeT len);
+/* Closes the innermost open event of the thread with the label, returning
+ * its summary for the DG_R_END_EVENT and setting *size, or NULL if there
+ * is none. The caller frees it.
+ */
+extern UChar *DG_(events_end)(ThreadId tid, const HChar *label, SizeT len, SizeT *size);
+extern void DG_(events_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Callgrind-format costs (dg_xtree.c)                  ---*/
+/*------------------------------------------------------------*/
+
+extern Bool DG_(clo_xtree);
+
+extern Bool DG_(xtree_process_cmd_line_option)(const HChar *arg);
+extern void DG_(xtree_print_usage)(void);
+extern void DG_(xtree_init)(void);
+/* Gives the stack of a new context, which must be the next index. */
+extern void DG_(xtree_context)(UWord context_index, ExeContext *ec);
+/* Adds the accesses of a run to its context. */
+extern void DG_(xtree_add)(UWord context_index, ULong reads, ULong writes,
+                           ULong read_bytes, ULong write_bytes);
+/* Writes the tree so far to the file of --datagrind-xtree. */
+extern void DG_(xtree_checkpoint)(void);
+/* Writes the tree to the file of --datagrind-xtree. */
+extern void DG_(xtree_finish)(void);
+
+/*------------------------------------------------------------*/
+/*--- Filtering (dg_filter.c)                              ---*/
+/*------------------------------------------------------------*/
+
+#define DG_FILTER_ALL     0
+#define DG_FILTER_TRACKED 1
+
+/* One of the DG_FILTER_* values */
+extern Int DG_(clo_filter);
+
+extern Bool DG_(filter_process_cmd_line_option)(const HChar *arg);
+extern void DG_(filter_print_usage)(void);
+extern void DG_(filter_init)(void);
+
+/* Add or remove a range from those that pass the filter. */
+extern void DG_(filter_track)(Addr addr, SizeT len);
+extern void DG_(filter_untrack)(Addr addr, SizeT len);
+
+/* Whether heap blocks pass the filter by their allocation stacks */
+extern Bool DG_(filter_by_alloc)(void);
+/* Whether an allocation stack matches --datagrind-alloc-fn or
+ * --datagrind-alloc-site. The answer is cached for each stack.
+ */
+extern Bool DG_(filter_alloc_matches)(ExeContext *where);
+/* Add or remove a heap block that passes the filter. */
+extern void DG_(filter_add_block)(Addr addr, SizeT szB);
+extern void DG_(filter_remove_block)(Addr addr);
+
+/* Adds IR to sbOut that checks whether an access passes the filter, and
+ * returns an Ity_I1 atom that is true if it does. addr must be an atom.
+ */
+extern IRExpr *DG_(filter_guard)(IRSB *sbOut, IRExpr *addr, SizeT size);
+
+/* Whether any ranges were given by --datagrind-ignore-ranges. */
+extern Bool DG_(have_ignored)(void);
+/* Whether a is in a range given by --datagrind-ignore-ranges. */
+extern Bool DG_(is_ignored)(Addr a);
+/* Adds IR to sbOut that checks whether addr is outside the ignored ranges,
+ * returning an Ity_I1 atom or NULL if there are none. addr must be an atom.
+ */
+extern IRExpr *DG_(ignore_guard)(IRSB *sbOut, IRExpr *addr);
+
+/* Returns an Ity_I1 atom for the conjunction of two Ity_I1 atoms, either
+ * of which may be NULL for true.
+ */
+extern IRExpr *DG_(and_guards)(IRSB *sbOut, IRExpr *a, IRExpr *b);
+
+#endif /* ndef __DG_INCLUDE_H */
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,281 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: chunk index for seeking in the trace. dg_index.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_vki.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* The record stream is cut into chunks of roughly --datagrind-chunk-size
+ * bytes. Each starts with a DG_R_CHUNK giving all the decoder state that
+ * is not a definition, and address deltas restart from zero in every
+ * chunk, so a reader that has the definitions can decode a chunk without
+ * anything before it. A DG_R_INDEX at the end of the trace lists where
+ * each chunk starts, and a fixed-size footer after it points to the index.
+ *
+ * Chunks only start before a run, as the runs are what makes a trace big.
+ * Each also gives the wall clock time at which it started, so that the
+ * traces of several processes can be interleaved.
+ */
+
+#define DG_DEFAULT_CHUNK_SIZE (4 * 1024 * 1024)
+#define DG_FOOTER_MAGIC "DGINDEX"
+
+typedef struct
+{
+   ULong offset;    /* Of the DG_R_CHUNK in the record stream */
+   ULong instrs;    /* Executed before the first run of the chunk */
+   Word n_labels;
+   Word labels;     /* Offset of the first label in chunk_labels */
+} DgChunk;
+
+ULong DG_(index_next_chunk) = ~0ULL;
+UWord DG_(index_chunk) = 0;
+ULong DG_(index_start_usecs) = 0;
+
+static Long clo_chunk_size = DG_DEFAULT_CHUNK_SIZE;
+
+static XArray *chunks = NULL;          /* DgChunk */
+static XArray *chunk_labels = NULL;    /* HChar, null-terminated labels */
+
+Bool DG_(index_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BINT_CLO(arg, "--datagrind-chunk-size", clo_chunk_size,
+                   0, 1LL << 40)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(index_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-chunk-size=<n>       start a seekable chunk every n bytes\n"
+"                                     of trace, or never if 0 [4M]\n"
+   );
+}
+
+ULong DG_(index_now_usecs)(void)
+{
+   struct vki_timeval tv;
+
+   if (VG_(gettimeofday)(&tv, NULL) != 0)
+      return DG_(index_start_usecs);
+   return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+Bool DG_(index_chunked)(void)
+{
+   return clo_chunk_size != 0;
+}
+
+void DG_(index_start_chunk)(ULong instrs, ThreadId tid,
+                            UWord n_bbdefs, UWord n_contexts)
+{
+   UChar payload[6 * 10];
+   ULong now;
+   UChar *p = payload;
+   DgChunk chunk;
+
+   if (clo_chunk_size == 0)
+      return;
+   if (chunks == NULL)
+   {
+      chunks = VG_(newXA)(VG_(malloc), "datagrind.index.chunks", VG_(free),
+                          sizeof(DgChunk));
+      chunk_labels = VG_(newXA)(VG_(malloc), "datagrind.index.labels",
+                                VG_(free), sizeof(HChar));
+   }
+   else
+      DG_(index_chunk)++;
+
+   DG_(out_chunk_start)(instrs);
+   chunk.offset = DG_(out_offset)();
+   chunk.instrs = instrs;
+   chunk.n_labels = 0;
+   chunk.labels = VG_(sizeXA)(chunk_labels);
+   VG_(addToXA)(chunks, &chunk);
+   DG_(index_next_chunk) = chunk.offset + clo_chunk_size;
+
+   p = encode_uvarint64(p, DG_(index_chunk));
+   p = encode_uvarint64(p, instrs);
+   p = encode_uvarint64(p, tid);
+   p = encode_uvarint64(p, n_bbdefs);
+   p = encode_uvarint64(p, n_contexts);
+   /* The clock may have been set back since */
+   now = DG_(index_now_usecs)();
+   p = encode_uvarint64(p, now > DG_(index_start_usecs) ? now - DG_(index_start_usecs) : 0);
+   out_byte(DG_R_CHUNK);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+}
+
+void DG_(index_add_label)(const HChar *label, SizeT len)
+{
+   DgChunk *chunk;
+
+   if (chunks == NULL)
+      return;
+   chunk = VG_(indexXA)(chunks, VG_(sizeXA)(chunks) - 1);
+   VG_(addBytesToXA)(chunk_labels, label, len);
+   VG_(addBytesToXA)(chunk_labels, "", 1);
+   chunk->n_labels++;
+}
+
+ULong DG_(index_chunk_after)(ULong offset)
+{
+   Word n, i;
+
+   if (chunks == NULL)
+      return ~0ULL;
+   n = VG_(sizeXA)(chunks);
+   for (i = 0; i < n; i++)
+   {
+      const DgChunk *chunk = VG_(indexXA)(chunks, i);
+      if (chunk->offset > offset)
+         return chunk->offset;
+   }
+   return ~0ULL;
+}
+
+void DG_(index_drop_before)(ULong offset)
+{
+   Word n = 0;
+
+   if (chunks == NULL)
+      return;
+   while (n < VG_(sizeXA)(chunks)
+          && ((DgChunk *) VG_(indexXA)(chunks, n))->offset < offset)
+      n++;
+   VG_(dropHeadXA)(chunks, n);
+}
+
+/* Returns the payload of a DG_R_INDEX of the chunks, with delta added to
+ * each offset.
+ */
+static XArray *index_payload(Long delta)
+{
+   XArray *payload;
+   UChar tmp[3 * 10];
+   Word n_chunks, i;
+
+   n_chunks = VG_(sizeXA)(chunks);
+   payload = VG_(newXA)(VG_(malloc), "datagrind.index.payload", VG_(free),
+                        sizeof(UChar));
+   VG_(addBytesToXA)(payload, tmp, encode_uvarint64(tmp, n_chunks) - tmp);
+   for (i = 0; i < n_chunks; i++)
+   {
+      const DgChunk *chunk = VG_(indexXA)(chunks, i);
+      Word label = chunk->labels;
+      UChar *p = tmp;
+      Word j;
+
+      p = encode_uvarint64(p, chunk->offset + delta);
+      p = encode_uvarint64(p, chunk->instrs);
+      p = encode_uvarint64(p, chunk->n_labels);
+      VG_(addBytesToXA)(payload, tmp, p - tmp);
+      for (j = 0; j < chunk->n_labels; j++)
+      {
+         const HChar *str = VG_(indexXA)(chunk_labels, label);
+         SizeT len = VG_(strlen)(str) + 1;
+         VG_(addBytesToXA)(payload, str, len);
+         label += len;
+      }
+   }
+   return payload;
+}
+
+static void fill_footer(UChar *footer, ULong index_offset)
+{
+   footer[0] = DG_R_FOOTER;
+   footer[1] = DG_FOOTER_SIZE - 2;
+   VG_(memcpy)(footer + 2, &index_offset, sizeof(index_offset));
+   VG_(memcpy)(footer + 10, DG_FOOTER_MAGIC, sizeof(DG_FOOTER_MAGIC));
+}
+
+UChar *DG_(index_moved)(Long delta, ULong index_offset, UChar *footer, SizeT *size)
+{
+   XArray *payload;
+   UChar *record, *p;
+   ULong len;
+
+   if (chunks == NULL)
+      return NULL;
+   payload = index_payload(delta);
+   len = VG_(sizeXA)(payload);
+   p = record = VG_(malloc)("datagrind.index.record", 10 + len);
+   *p++ = DG_R_INDEX;
+   if (len < 255)
+      *p++ = len;
+   else
+   {
+      *p++ = 255;
+      VG_(memcpy)(p, &len, sizeof(len));
+      p += sizeof(len);
+   }
+   VG_(memcpy)(p, VG_(indexXA)(payload, 0), len);
+   *size = (p - record) + len;
+   VG_(deleteXA)(payload);
+   fill_footer(footer, index_offset);
+   return record;
+}
+
+SizeT DG_(index_finish)(UChar *footer)
+{
+   XArray *payload;
+   ULong index_offset = DG_(out_offset)();
+
+   if (chunks == NULL)
+      return 0;
+
+   payload = index_payload(0);
+   out_byte(DG_R_INDEX);
+   out_length(VG_(sizeXA)(payload));
+   out_bytes(VG_(indexXA)(payload, 0), VG_(sizeXA)(payload));
+   VG_(deleteXA)(payload);
+   fill_footer(footer, index_offset);
+
+   VG_(deleteXA)(chunks);
+   VG_(deleteXA)(chunk_labels);
+   chunks = chunk_labels = NULL;
+   return DG_FOOTER_SIZE;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,245 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: wrappers for the pthread locks.                   ---*/
+/*---                                              dg_intercepts.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_redir.h"
+#include "pub_tool_clreq.h"
+#include "config.h"
+
+#include "datagrind.h"
+#include "dg_record.h"
+
+#include <errno.h>
+#include <pthread.h>
+
+/* These wrap the mutexes, rwlocks and spinlocks of libpthread, in the
+ * way of helgrind/hg_intercepts.c. Each tells the tool when a lock has
+ * been taken, once the original returns, and when it is about to be
+ * given up, so that with --datagrind-locks=yes the accesses made while
+ * it is held fall between its DG_R_LOCK records. A wait on a condition
+ * variable gives up its mutex and takes it again.
+ *
+ * Since glibc 2.34 the functions are in libc itself, so on Linux they
+ * are wrapped in both; only one of the two is ever loaded.
+ */
+
+#define DG_LOCK(op, lock)                                               \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(_VG_USERREQ__DATAGRIND_LOCK,        \
+                                   op, lock, 0, 0, 0)
+
+#if defined(VGO_linux) && !defined(MUSL_LIBC)
+#define LOCK_FUNC(ret_ty, f, args, ...)                                 \
+   ret_ty I_WRAP_SONAME_FNNAME_ZZ(VG_Z_LIBPTHREAD_SONAME,f) args;      \
+   ret_ty I_WRAP_SONAME_FNNAME_ZZ(VG_Z_LIBPTHREAD_SONAME,f) args       \
+   __VA_ARGS__                                                          \
+   ret_ty I_WRAP_SONAME_FNNAME_ZZ(VG_Z_LIBC_SONAME,f) args;            \
+   ret_ty I_WRAP_SONAME_FNNAME_ZZ(VG_Z_LIBC_SONAME,f) args             \
+   __VA_ARGS__
+#else
+#define LOCK_FUNC(ret_ty, f, args, ...)                                 \
+   ret_ty I_WRAP_SONAME_FNNAME_ZZ(VG_Z_LIBPTHREAD_SONAME,f) args;      \
+   ret_ty I_WRAP_SONAME_FNNAME_ZZ(VG_Z_LIBPTHREAD_SONAME,f) args       \
+   __VA_ARGS__
+#endif
+
+/* The workers fetch the original, so they must be called from a wrapper
+ * before anything else that is wrapped.
+ */
+__attribute__((noinline))
+static int lock_WRK(int op, volatile void *lock)
+{
+   OrigFn fn;
+   int ret;
+
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_W(ret, fn, lock);
+   if (ret == 0)
+      DG_LOCK(op, lock);
+   return ret;
+}
+
+__attribute__((noinline))
+static int timedlock_WRK(int op, volatile void *lock, const struct timespec *abstime)
+{
+   OrigFn fn;
+   int ret;
+
+   VALGRIND_GET_ORIG_FN(fn);
+   CALL_FN_W_WW(ret, fn, lock, abstime);
+   if (ret == 0)
+      DG_LOCK(op, lock);
+   return ret;
+}
+
+__attribute__((noinline))
+static int unlock_WRK(int kind, volatile void *lock)
+{
+   OrigFn fn;
+   int ret;
+
+   VALGRIND_GET_ORIG_FN(fn);
+   DG_LOCK(kind | DG_LOCK_RELEASE, lock);
+   CALL_FN_W_W(ret, fn, lock);
+   return ret;
+}
+
+/* abstime is NULL for pthread_cond_wait. The mutex is held again when
+ * the wait times out, as when it is signalled.
+ */
+__attribute__((noinline))
+static int cond_wait_WRK(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                         const struct timespec *abstime)
+{
+   OrigFn fn;
+   int ret;
+
+   VALGRIND_GET_ORIG_FN(fn);
+   DG_LOCK(DG_LOCK_MUTEX | DG_LOCK_RELEASE, mutex);
+   if (abstime == NULL)
+      CALL_FN_W_WW(ret, fn, cond, mutex);
+   else
+      CALL_FN_W_WWW(ret, fn, cond, mutex, abstime);
+   if (ret == 0 || ret == ETIMEDOUT)
+      DG_LOCK(DG_LOCK_MUTEX | DG_LOCK_ACQUIRE, mutex);
+   return ret;
+}
+
+/*------------------------------------------------------------*/
+/*--- Mutexes                                              ---*/
+/*------------------------------------------------------------*/
+
+LOCK_FUNC(int, pthreadZumutexZulock, // pthread_mutex_lock
+          (pthread_mutex_t *mutex),
+{
+   return lock_WRK(DG_LOCK_MUTEX | DG_LOCK_ACQUIRE, mutex);
+})
+
+LOCK_FUNC(int, pthreadZumutexZutrylock, // pthread_mutex_trylock
+          (pthread_mutex_t *mutex),
+{
+   return lock_WRK(DG_LOCK_MUTEX | DG_LOCK_ACQUIRE, mutex);
+})
+
+LOCK_FUNC(int, pthreadZumutexZutimedlock, // pthread_mutex_timedlock
+          (pthread_mutex_t *mutex, const struct timespec *abstime),
+{
+   return timedlock_WRK(DG_LOCK_MUTEX | DG_LOCK_ACQUIRE, mutex, abstime);
+})
+
+LOCK_FUNC(int, pthreadZumutexZuunlock, // pthread_mutex_unlock
+          (pthread_mutex_t *mutex),
+{
+   return unlock_WRK(DG_LOCK_MUTEX, mutex);
+})
+
+LOCK_FUNC(int, pthreadZucondZuwait, // pthread_cond_wait
+          (pthread_cond_t *cond, pthread_mutex_t *mutex),
+{
+   return cond_wait_WRK(cond, mutex, NULL);
+})
+
+LOCK_FUNC(int, pthreadZucondZutimedwait, // pthread_cond_timedwait
+          (pthread_cond_t *cond, pthread_mutex_t *mutex,
+           const struct timespec *abstime),
+{
+   return cond_wait_WRK(cond, mutex, abstime);
+})
+
+/*------------------------------------------------------------*/
+/*--- Reader-writer locks                                  ---*/
+/*------------------------------------------------------------*/
+
+LOCK_FUNC(int, pthreadZurwlockZurdlock, // pthread_rwlock_rdlock
+          (pthread_rwlock_t *rwlock),
+{
+   return lock_WRK(DG_LOCK_RWLOCK | DG_LOCK_ACQUIRE_SHARED, rwlock);
+})
+
+LOCK_FUNC(int, pthreadZurwlockZutryrdlock, // pthread_rwlock_tryrdlock
+          (pthread_rwlock_t *rwlock),
+{
+   return lock_WRK(DG_LOCK_RWLOCK | DG_LOCK_ACQUIRE_SHARED, rwlock);
+})
+
+LOCK_FUNC(int, pthreadZurwlockZutimedrdlock, // pthread_rwlock_timedrdlock
+          (pthread_rwlock_t *rwlock, const struct timespec *abstime),
+{
+   return timedlock_WRK(DG_LOCK_RWLOCK | DG_LOCK_ACQUIRE_SHARED, rwlock, abstime);
+})
+
+LOCK_FUNC(int, pthreadZurwlockZuwrlock, // pthread_rwlock_wrlock
+          (pthread_rwlock_t *rwlock),
+{
+   return lock_WRK(DG_LOCK_RWLOCK | DG_LOCK_ACQUIRE, rwlock);
+})
+
+LOCK_FUNC(int, pthreadZurwlockZutrywrlock, // pthread_rwlock_trywrlock
+          (pthread_rwlock_t *rwlock),
+{
+   return lock_WRK(DG_LOCK_RWLOCK | DG_LOCK_ACQUIRE, rwlock);
+})
+
+LOCK_FUNC(int, pthreadZurwlockZutimedwrlock, // pthread_rwlock_timedwrlock
+          (pthread_rwlock_t *rwlock, const struct timespec *abstime),
+{
+   return timedlock_WRK(DG_LOCK_RWLOCK | DG_LOCK_ACQUIRE, rwlock, abstime);
+})
+
+LOCK_FUNC(int, pthreadZurwlockZuunlock, // pthread_rwlock_unlock
+          (pthread_rwlock_t *rwlock),
+{
+   return unlock_WRK(DG_LOCK_RWLOCK, rwlock);
+})
+
+/*------------------------------------------------------------*/
+/*--- Spinlocks                                            ---*/
+/*------------------------------------------------------------*/
+
+LOCK_FUNC(int, pthreadZuspinZulock, // pthread_spin_lock
+          (pthread_spinlock_t *lock),
+{
+   return lock_WRK(DG_LOCK_SPIN | DG_LOCK_ACQUIRE, lock);
+})
+
+LOCK_FUNC(int, pthreadZuspinZutrylock, // pthread_spin_trylock
+          (pthread_spinlock_t *lock),
+{
+   return lock_WRK(DG_LOCK_SPIN | DG_LOCK_ACQUIRE, lock);
+})
+
+LOCK_FUNC(int, pthreadZuspinZuunlock, // pthread_spin_unlock
+          (pthread_spinlock_t *lock),
+{
+   return unlock_WRK(DG_LOCK_SPIN, lock);
+})
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
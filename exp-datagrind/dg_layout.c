@@ -0,0 +1,782 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: proposes structure layouts.           dg_layout.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_layout reads the DG_R_FIELD_HEAT and DG_R_AFFINITY records of a trace
+ * and proposes, for each type of tracked range, an order of its fields
+ * and a split into hot and cold parts.
+ *
+ * Ranges are grouped by their type and by the fold of their counts, so
+ * that with --datagrind-field-heat-stride and --datagrind-affinity-stride
+ * set to the size of the structure, every element of an array adds to the
+ * same group. The fields come from a file given with --fields, in the
+ * form "offset size name type", or failing that are guessed from the
+ * heat: a field is a run of accessed bytes that does not cross an 8-byte
+ * boundary, so that the fields of a word are kept together, and each run
+ * of bytes that were never accessed is a cold one.
+ *
+ * The hottest fields that make up --hot percent of the accesses are hot,
+ * and the rest are split out. The hot fields are placed greedily: the
+ * hottest first, then each time the one with the most affinity to those
+ * already in the line it would go in. The cost of a layout is the number
+ * of lines each co-access of two fields touches, weighted by the
+ * affinity, with the structure taken to start on a line; the cost of the
+ * old and new layouts gives the lines saved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+#define MAX_HOT   1024        /* Hot fields placed by affinity, the rest by heat */
+#define COLD_BASE (1ULL << 40)  /* Lines of the cold part, apart from the hot */
+
+static const char *argv0 = "dg_layout";
+
+typedef struct
+{
+   uint64_t offset;
+   uint64_t size;
+   uint64_t heat;            /* Accesses, as the largest count of its bytes */
+   uint64_t byte_heat;       /* Counts of its bytes added up */
+   char *name;
+   int hot;
+   uint64_t new_offset;
+} field;
+
+typedef struct
+{
+   uint64_t a, b;            /* Byte offsets, then fields, with a < b */
+   uint64_t weight;
+} edge;
+
+/* Tracked ranges of one type, and what was counted of them */
+typedef struct
+{
+   const char *type;
+   uint64_t fold;
+   uint64_t n_ranges;
+   uint64_t *heat;           /* Reads and writes by offset */
+   uint64_t total;
+   edge *edges;
+   size_t n_edges, edges_size;
+   field *fields;
+   size_t n_fields, fields_size;
+   int *field_of;            /* By offset, or -1 */
+} group;
+
+typedef struct
+{
+   const char *type;
+   uint64_t len;
+   group *g;                 /* Once anything is counted for it */
+} range;
+
+typedef struct
+{
+   char *type;
+   uint64_t offset, size;
+   char *name;
+} named_field;
+
+static range *ranges = NULL;
+static size_t n_ranges = 0, ranges_size = 0;
+static group **groups = NULL;
+static size_t n_groups = 0, groups_size = 0;
+static named_field *named = NULL;
+static size_t n_named = 0, named_size = 0;
+static uint64_t line_size = 64;
+
+static void out_of_memory(void)
+{
+   fprintf(stderr, "%s: out of memory\n", argv0);
+   exit(1);
+}
+
+static void *xcalloc(size_t n, size_t size)
+{
+   void *p = calloc(n > 0 ? n : 1, size);
+
+   if (p == NULL)
+      out_of_memory();
+   return p;
+}
+
+static void *grow(void *array, size_t n, size_t *size, size_t elem_size)
+{
+   if (n + 1 > *size)
+   {
+      size_t new_size = *size > 0 ? *size * 2 : 256;
+
+      while (new_size < n + 1)
+         new_size *= 2;
+      array = realloc(array, new_size * elem_size);
+      if (array == NULL)
+         out_of_memory();
+      *size = new_size;
+   }
+   return array;
+}
+
+static char *xstrdup(const char *s)
+{
+   char *copy = strdup(s);
+
+   if (copy == NULL)
+      out_of_memory();
+   return copy;
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: proposes field orders for the tracked types of a Datagrind trace\n"
+"usage: %s [options] trace\n"
+"    --fields=<file>     the fields of the types, as lines of\n"
+"                        \"offset size name type\" [guessed from the heat]\n"
+"    --hot=<percent>     share of the accesses the hot fields make up [99]\n"
+"    --line-size=<n>     bytes in a cache line [64]\n",
+           argv0, argv0);
+   exit(2);
+}
+
+/*------------------------------------------------------------*/
+/*--- Reading                                              ---*/
+/*------------------------------------------------------------*/
+
+static void read_fields(const char *filename)
+{
+   FILE *f = fopen(filename, "r");
+   char line[1024];
+
+   if (f == NULL)
+   {
+      perror(filename);
+      exit(1);
+   }
+   while (fgets(line, sizeof(line), f) != NULL)
+   {
+      unsigned long long offset, size;
+      char name[256];
+      int n = 0;
+      size_t len;
+
+      if (line[0] == '#' || sscanf(line, "%lli %lli %255s %n", &offset, &size, name, &n) < 3
+          || n == 0 || size == 0)
+         continue;
+      len = strlen(line + n);
+      while (len > 0 && (line[n + len - 1] == '\n' || line[n + len - 1] == ' '))
+         line[n + --len] = '\0';
+      named = grow(named, n_named, &named_size, sizeof(named_field));
+      named[n_named].type = xstrdup(line + n);
+      named[n_named].offset = offset;
+      named[n_named].size = size;
+      named[n_named].name = xstrdup(name);
+      n_named++;
+   }
+   fclose(f);
+}
+
+static group *group_of(uint64_t number, uint64_t fold)
+{
+   range *r;
+   size_t i;
+
+   if (number >= n_ranges || fold == 0 || fold > (1 << 24))
+      return NULL;
+   r = &ranges[number];
+   if (r->g != NULL)
+      return r->g->fold == fold ? r->g : NULL;
+   for (i = 0; i < n_groups; i++)
+      if (groups[i]->fold == fold && strcmp(groups[i]->type, r->type) == 0)
+         break;
+   if (i == n_groups)
+   {
+      groups = grow(groups, n_groups, &groups_size, sizeof(group *));
+      groups[n_groups] = xcalloc(1, sizeof(group));
+      groups[n_groups]->type = r->type;
+      groups[n_groups]->fold = fold;
+      groups[n_groups]->heat = xcalloc(fold, sizeof(uint64_t));
+      n_groups++;
+   }
+   r->g = groups[i];
+   r->g->n_ranges++;
+   return r->g;
+}
+
+static void add_heat(const dgt_record *record)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   uint64_t number, fold, n_offsets, offset = 0, delta, reads, writes, i;
+   group *g;
+
+   if ((p = dgt_get_uvarint(p, end, &number)) == NULL
+       || (p = dgt_get_uvarint(p, end, &fold)) == NULL
+       || (p = dgt_get_uvarint(p, end, &n_offsets)) == NULL
+       || (g = group_of(number, fold)) == NULL)
+      return;
+   for (i = 0; i < n_offsets; i++)
+   {
+      if ((p = dgt_get_uvarint(p, end, &delta)) == NULL
+          || (p = dgt_get_uvarint(p, end, &reads)) == NULL
+          || (p = dgt_get_uvarint(p, end, &writes)) == NULL)
+         return;
+      offset += delta;
+      if (offset < fold)
+      {
+         g->heat[offset] += reads + writes;
+         g->total += reads + writes;
+      }
+   }
+}
+
+/* Reads a node of a DG_R_AFFINITY, giving its group if it is a field */
+static const uint8_t *get_node(const uint8_t *p, const uint8_t *end, uint64_t stride,
+                               group **g, uint64_t *offset)
+{
+   uint64_t id;
+   uint8_t kind;
+
+   *g = NULL;
+   if (p == NULL || p >= end)
+      return NULL;
+   kind = *p++;
+   if ((p = dgt_get_uvarint(p, end, &id)) == NULL)
+      return NULL;
+   if (kind == DG_AFFINITY_FIELD)
+   {
+      if ((p = dgt_get_uvarint(p, end, offset)) == NULL)
+         return NULL;
+      if (id < n_ranges)
+         *g = group_of(id, stride > 0 && stride < ranges[id].len ? stride : ranges[id].len);
+   }
+   return p;
+}
+
+/* Keeps the edges between fields of the same type */
+static void add_affinity(const dgt_record *record)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   uint64_t window, stride, n_accesses, n_pairs, count, error, a, b, i;
+   group *ga, *gb;
+
+   if ((p = dgt_get_uvarint(p, end, &window)) == NULL
+       || (p = dgt_get_uvarint(p, end, &stride)) == NULL
+       || (p = dgt_get_uvarint(p, end, &n_accesses)) == NULL
+       || (p = dgt_get_uvarint(p, end, &n_pairs)) == NULL)
+      return;
+   for (i = 0; i < n_pairs; i++)
+   {
+      if ((p = get_node(p, end, stride, &ga, &a)) == NULL
+          || (p = get_node(p, end, stride, &gb, &b)) == NULL
+          || (p = dgt_get_uvarint(p, end, &count)) == NULL
+          || (p = dgt_get_uvarint(p, end, &error)) == NULL)
+         return;
+      if (ga != NULL && ga == gb && a != b)
+      {
+         ga->edges = grow(ga->edges, ga->n_edges, &ga->edges_size, sizeof(edge));
+         ga->edges[ga->n_edges].a = a < b ? a : b;
+         ga->edges[ga->n_edges].b = a < b ? b : a;
+         ga->edges[ga->n_edges].weight = count;
+         ga->n_edges++;
+      }
+   }
+}
+
+static void read_trace(const dgt_file *file)
+{
+   size_t ws = dgt_file_header(file)->word_size;
+   dgt_cursor cursor;
+   dgt_record record;
+   int ret;
+
+   dgt_cursor_init(&cursor, file);
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+
+      switch (record.type)
+      {
+      case DG_R_TRACK_RANGE:
+         ranges = grow(ranges, n_ranges, &ranges_size, sizeof(range));
+         if (record.length > 2 * ws && p[record.length - 1] == '\0')
+         {
+            ranges[n_ranges].type = (const char *) p + 2 * ws;
+            ranges[n_ranges].len = dgt_get_word(file, p + ws);
+         }
+         else
+         {
+            ranges[n_ranges].type = "";
+            ranges[n_ranges].len = 0;
+         }
+         ranges[n_ranges].g = NULL;
+         n_ranges++;
+         break;
+      case DG_R_FIELD_HEAT:
+         add_heat(&record);
+         break;
+      case DG_R_AFFINITY:
+         add_affinity(&record);
+         break;
+      default:
+         break;
+      }
+   }
+   if (ret < 0)
+      fprintf(stderr, "%s: warning: %s; only the records before offset %llu are read\n",
+              argv0, dgt_strerror(ret), (unsigned long long) cursor.pos);
+}
+
+/*------------------------------------------------------------*/
+/*--- Fields                                               ---*/
+/*------------------------------------------------------------*/
+
+static void add_field(group *g, uint64_t offset, uint64_t size, const char *name)
+{
+   field *f;
+   uint64_t i;
+   char buf[32];
+
+   if (name == NULL)
+   {
+      snprintf(buf, sizeof(buf), "+%#llx", (unsigned long long) offset);
+      name = buf;
+   }
+   g->fields = grow(g->fields, g->n_fields, &g->fields_size, sizeof(field));
+   f = &g->fields[g->n_fields];
+   f->offset = offset;
+   f->size = size;
+   f->heat = 0;
+   f->byte_heat = 0;
+   f->name = xstrdup(name);
+   f->hot = 0;
+   for (i = offset; i < offset + size; i++)
+   {
+      if (g->heat[i] > f->heat)
+         f->heat = g->heat[i];
+      f->byte_heat += g->heat[i];
+      g->field_of[i] = g->n_fields;
+   }
+   g->n_fields++;
+}
+
+static void find_fields(group *g)
+{
+   uint64_t i, start;
+   size_t j;
+
+   g->field_of = xcalloc(g->fold, sizeof(int));
+   for (i = 0; i < g->fold; i++)
+      g->field_of[i] = -1;
+   for (j = 0; j < n_named; j++)
+      if (strcmp(named[j].type, g->type) == 0 && named[j].offset < g->fold)
+      {
+         uint64_t size = named[j].size;
+
+         if (size > g->fold - named[j].offset)
+            size = g->fold - named[j].offset;
+         add_field(g, named[j].offset, size, named[j].name);
+      }
+
+   /* What the named fields leave is guessed */
+   for (i = 0; i < g->fold; i = start)
+   {
+      start = i;
+      if (g->field_of[i] >= 0)
+      {
+         start++;
+         continue;
+      }
+      while (start < g->fold && g->field_of[start] < 0
+             && (g->heat[start] == 0) == (g->heat[i] == 0)
+             && (start == i || start % 8 != 0 || g->heat[i] == 0))
+         start++;
+      add_field(g, i, start - i, NULL);
+   }
+}
+
+/* Turns the byte offsets of the edges into fields, and adds up repeats */
+static int cmp_edge(const void *a, const void *b)
+{
+   const edge *ea = a, *eb = b;
+
+   if (ea->a != eb->a)
+      return ea->a < eb->a ? -1 : 1;
+   if (ea->b != eb->b)
+      return ea->b < eb->b ? -1 : 1;
+   return 0;
+}
+
+static void field_edges(group *g)
+{
+   size_t i, n = 0;
+
+   for (i = 0; i < g->n_edges; i++)
+   {
+      edge e = g->edges[i];
+      int fa, fb;
+
+      if (e.a >= g->fold || e.b >= g->fold)
+         continue;
+      fa = g->field_of[e.a];
+      fb = g->field_of[e.b];
+      if (fa < 0 || fb < 0 || fa == fb)
+         continue;
+      g->edges[n].a = fa < fb ? fa : fb;
+      g->edges[n].b = fa < fb ? fb : fa;
+      g->edges[n].weight = e.weight;
+      n++;
+   }
+   qsort(g->edges, n, sizeof(edge), cmp_edge);
+   g->n_edges = 0;
+   for (i = 0; i < n; i++)
+   {
+      if (g->n_edges > 0 && cmp_edge(&g->edges[g->n_edges - 1], &g->edges[i]) == 0)
+         g->edges[g->n_edges - 1].weight += g->edges[i].weight;
+      else
+         g->edges[g->n_edges++] = g->edges[i];
+   }
+}
+
+/*------------------------------------------------------------*/
+/*--- Placing                                              ---*/
+/*------------------------------------------------------------*/
+
+static uint64_t align_of(uint64_t size)
+{
+   uint64_t align = 8;
+
+   while (size % align != 0)
+      align /= 2;
+   return align;
+}
+
+/* An offset at or after offset for a field, which does not straddle a
+ * line if it fits in one.
+ */
+static uint64_t place_at(uint64_t offset, uint64_t size)
+{
+   uint64_t align = align_of(size);
+
+   offset = (offset + align - 1) / align * align;
+   if (size <= line_size && offset % line_size + size > line_size)
+      offset = (offset + line_size - 1) / line_size * line_size;
+   return offset;
+}
+
+static uint64_t first_line(const field *f, int new_layout)
+{
+   if (!new_layout)
+      return f->offset / line_size;
+   return (f->hot ? 0 : COLD_BASE) + f->new_offset / line_size;
+}
+
+static uint64_t last_line(const field *f, int new_layout)
+{
+   if (!new_layout)
+      return (f->offset + f->size - 1) / line_size;
+   return (f->hot ? 0 : COLD_BASE) + (f->new_offset + f->size - 1) / line_size;
+}
+
+/* Lines a co-access of two fields touches */
+static uint64_t pair_lines(const field *a, const field *b, int new_layout)
+{
+   uint64_t a0 = first_line(a, new_layout), a1 = last_line(a, new_layout);
+   uint64_t b0 = first_line(b, new_layout), b1 = last_line(b, new_layout);
+
+   if (a1 < b0 || b1 < a0)
+      return (a1 - a0 + 1) + (b1 - b0 + 1);
+   return (a1 > b1 ? a1 : b1) - (a0 < b0 ? a0 : b0) + 1;
+}
+
+/* Distinct lines under the hot fields, which are all in the first
+ * COLD_BASE lines
+ */
+static uint64_t hot_lines(const group *g, int new_layout)
+{
+   uint64_t n_lines = 0, count = 0, l;
+   uint8_t *touched;
+   size_t i;
+
+   for (i = 0; i < g->n_fields; i++)
+      if (g->fields[i].hot && last_line(&g->fields[i], new_layout) + 1 > n_lines)
+         n_lines = last_line(&g->fields[i], new_layout) + 1;
+   touched = xcalloc(n_lines, 1);
+   for (i = 0; i < g->n_fields; i++)
+      if (g->fields[i].hot)
+         for (l = first_line(&g->fields[i], new_layout);
+              l <= last_line(&g->fields[i], new_layout); l++)
+         {
+            count += !touched[l];
+            touched[l] = 1;
+         }
+   free(touched);
+   return count;
+}
+
+static const uint64_t *sort_heat;
+
+static int cmp_heat(const void *a, const void *b)
+{
+   size_t ia = *(const size_t *) a, ib = *(const size_t *) b;
+
+   if (sort_heat[ia] != sort_heat[ib])
+      return sort_heat[ia] > sort_heat[ib] ? -1 : 1;
+   return ia < ib ? -1 : ia > ib;
+}
+
+static size_t *place(group *g, double hot_share, size_t *n_hot)
+{
+   size_t *order = xcalloc(g->n_fields, sizeof(size_t));
+   uint64_t *heats = xcalloc(g->n_fields, sizeof(uint64_t));
+   uint64_t *affinity = NULL, sum = 0, offset = 0;
+   size_t i, j, k, n = 0;
+   int *placed;
+
+   for (i = 0; i < g->n_fields; i++)
+   {
+      order[i] = i;
+      heats[i] = g->fields[i].heat;
+   }
+   sort_heat = heats;
+   qsort(order, g->n_fields, sizeof(size_t), cmp_heat);
+   for (i = 0; i < g->n_fields && heats[order[i]] > 0
+               && (n == 0 || sum < hot_share * g->total); i++, n++)
+   {
+      g->fields[order[i]].hot = 1;
+      sum += g->fields[order[i]].byte_heat;
+   }
+   *n_hot = n;
+   free(heats);
+
+   /* Fields beyond MAX_HOT keep the order of their heat */
+   if (n <= MAX_HOT)
+   {
+      affinity = xcalloc(n * n, sizeof(uint64_t));
+      placed = xcalloc(g->n_fields, sizeof(int));
+      for (i = 0; i < g->n_fields; i++)
+         placed[i] = -1;
+      for (i = 0; i < n; i++)
+         placed[order[i]] = i;      /* Rank among the hot for now */
+      for (i = 0; i < g->n_edges; i++)
+      {
+         int ra = placed[g->edges[i].a], rb = placed[g->edges[i].b];
+
+         if (ra >= 0 && rb >= 0)
+         {
+            affinity[ra * n + rb] += g->edges[i].weight;
+            affinity[rb * n + ra] += g->edges[i].weight;
+         }
+      }
+      /* order[0..k-1] are placed, and chosen from the rest by affinity to
+       * the fields in the line each would go in
+       */
+      for (k = 0; k < n; k++)
+      {
+         size_t best = k;
+         uint64_t best_score = 0;
+
+         for (i = k; i < n && k > 0; i++)
+         {
+            const field *f = &g->fields[order[i]];
+            uint64_t at = place_at(offset, f->size), score = 0;
+
+            for (j = 0; j < k; j++)
+            {
+               const field *p = &g->fields[order[j]];
+               if (p->new_offset / line_size <= (at + f->size - 1) / line_size
+                   && (p->new_offset + p->size - 1) / line_size >= at / line_size)
+                  score += affinity[placed[order[i]] * n + placed[order[j]]];
+            }
+            if (score > best_score)
+            {
+               best = i;
+               best_score = score;
+            }
+         }
+         j = order[best];
+         memmove(&order[k + 1], &order[k], (best - k) * sizeof(size_t));
+         order[k] = j;
+         g->fields[j].new_offset = place_at(offset, g->fields[j].size);
+         offset = g->fields[j].new_offset + g->fields[j].size;
+      }
+      free(placed);
+      free(affinity);
+   }
+   else
+      for (k = 0; k < n; k++)
+      {
+         field *f = &g->fields[order[k]];
+         f->new_offset = place_at(offset, f->size);
+         offset = f->new_offset + f->size;
+      }
+
+   /* The cold part keeps the old order */
+   offset = 0;
+   for (i = 0; i < g->n_fields; i++)
+      if (!g->fields[i].hot)
+      {
+         g->fields[i].new_offset = place_at(offset, g->fields[i].size);
+         offset = g->fields[i].new_offset + g->fields[i].size;
+      }
+   return order;
+}
+
+/*------------------------------------------------------------*/
+/*--- Printing                                             ---*/
+/*------------------------------------------------------------*/
+
+static void print_field(const field *f, int new_offset)
+{
+   if (new_offset)
+      printf("  %8llu", (unsigned long long) f->new_offset);
+   else
+      printf("  %8s", "");
+   printf(" %8llu %6llu %14llu  %s\n", (unsigned long long) f->offset,
+          (unsigned long long) f->size, (unsigned long long) f->heat, f->name);
+}
+
+static void print_group(group *g, double hot_share)
+{
+   uint64_t old_cost = 0, new_cost = 0, weight = 0, hot_bytes = 0, hot_heat = 0;
+   size_t *order, n_hot, i;
+
+   find_fields(g);
+   field_edges(g);
+   order = place(g, hot_share, &n_hot);
+   for (i = 0; i < g->n_edges; i++)
+   {
+      const field *a = &g->fields[g->edges[i].a], *b = &g->fields[g->edges[i].b];
+
+      weight += g->edges[i].weight;
+      old_cost += g->edges[i].weight * pair_lines(a, b, 0);
+      new_cost += g->edges[i].weight * pair_lines(a, b, 1);
+   }
+   for (i = 0; i < g->n_fields; i++)
+      if (g->fields[i].hot)
+      {
+         hot_bytes += g->fields[i].size;
+         hot_heat += g->fields[i].byte_heat;
+      }
+
+   printf("\n%s, %llu bytes (%llu range%s, %llu byte accesses)\n",
+          g->type[0] ? g->type : "(no type)", (unsigned long long) g->fold,
+          (unsigned long long) g->n_ranges, g->n_ranges == 1 ? "" : "s",
+          (unsigned long long) g->total);
+   printf("  hot: %llu of %llu fields, %llu bytes, %.2f%% of the accesses\n",
+          (unsigned long long) n_hot, (unsigned long long) g->n_fields,
+          (unsigned long long) hot_bytes, g->total > 0 ? 100.0 * hot_heat / g->total : 0.0);
+   printf("  lines under the hot fields: %llu -> %llu\n",
+          (unsigned long long) hot_lines(g, 0), (unsigned long long) hot_lines(g, 1));
+   if (weight > 0)
+      printf("  lines per co-access: %.2f -> %.2f, %lld lines saved over %llu co-accesses\n",
+             (double) old_cost / weight, (double) new_cost / weight,
+             (long long) (old_cost - new_cost), (unsigned long long) weight);
+   else
+      printf("  no co-accesses (run with --datagrind-affinity=yes)\n");
+   printf("  %8s %8s %6s %14s  %s\n", "New", "Old", "Size", "Accesses", "Field");
+   for (i = 0; i < n_hot; i++)
+      print_field(&g->fields[order[i]], 1);
+   if (n_hot < g->n_fields)
+   {
+      printf("  split out:\n");
+      for (i = 0; i < g->n_fields; i++)
+         if (!g->fields[i].hot)
+            print_field(&g->fields[i], 1);
+   }
+   free(order);
+}
+
+static int cmp_group(const void *a, const void *b)
+{
+   const group *ga = *(group * const *) a, *gb = *(group * const *) b;
+
+   if (ga->total != gb->total)
+      return ga->total > gb->total ? -1 : 1;
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   const char *trace_name = NULL;
+   double hot = 99.0;
+   dgt_file *file;
+   size_t i;
+   int ret;
+
+   if (argv[0])
+      argv0 = argv[0];
+   for (i = 1; i < (size_t) argc; i++)
+   {
+      if (strncmp(argv[i], "--fields=", 9) == 0)
+         read_fields(argv[i] + 9);
+      else if (strncmp(argv[i], "--hot=", 6) == 0)
+      {
+         hot = strtod(argv[i] + 6, NULL);
+         if (!(hot > 0.0 && hot <= 100.0))
+            usage();
+      }
+      else if (strncmp(argv[i], "--line-size=", 12) == 0)
+      {
+         line_size = strtoull(argv[i] + 12, NULL, 10);
+         if (line_size == 0)
+            usage();
+      }
+      else if (argv[i][0] == '-' || trace_name != NULL)
+         usage();
+      else
+         trace_name = argv[i];
+   }
+   if (trace_name == NULL)
+      usage();
+
+   ret = dgt_open(trace_name, &file);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+      return 1;
+   }
+   read_trace(file);
+   qsort(groups, n_groups, sizeof(group *), cmp_group);
+   for (i = 0; i < n_groups; i++)
+      if (groups[i]->total > 0)
+         print_group(groups[i], hot / 100.0);
+   if (n_groups == 0 || groups[0]->total == 0)
+      fprintf(stderr, "%s: %s: no field heat (run with --datagrind-field-heat=yes)\n",
+              argv0, trace_name);
+   dgt_close(file);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -28,9 +28,11 @@
    The GNU General Public License is contained in the file COPYING.
 */
 
+#include "config.h"
 #include "pub_tool_basics.h"
 #include "pub_tool_tooliface.h"
 #include "pub_tool_vki.h"
+#include "pub_tool_aspacemgr.h"
 #include "pub_tool_hashtable.h"
 #include "pub_tool_xarray.h"
 #include "pub_tool_mallocfree.h"
@@ -38,18 +40,23 @@
 #include "pub_tool_libcprint.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcfile.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_clientstate.h"
 #include "pub_tool_debuginfo.h"
 #include "pub_tool_stacktrace.h"
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_options.h"
 #include "pub_tool_machine.h"
 #include "pub_tool_threadstate.h"
+#include "pub_tool_transtab.h"
+#include "pub_tool_seqmatch.h"
+#include "pub_tool_poolalloc.h"
+#include "pub_tool_gdbserver.h"
+#include "pub_tool_guest.h"
 
 #include "datagrind.h"
 #include "dg_record.h"
-
-#define STACK_DEPTH 8 /* TODO: replace with --num-callers option instead */
-#define OUT_BUF_SIZE 4096
+#include "dg_include.h"
 
 /* Defined in the core, but missing from the header (which has the
  * non-existent function apply_ExeContext instead). */
@@ -72,6 +79,7 @@ typedef struct
 typedef struct
 {
    VgHashNode header;
+   Bool ignored;       /* Matches --datagrind-ignore-objects */
 } DgDebugInfo;
 
 typedef struct
@@ -79,10 +87,31 @@ typedef struct
    VgHashNode header;
    SizeT szB;
    SizeT actual_szB;
-   UInt n_ips;
-   StackTrace ips;
+   ExeContext *where;  /* Allocation stack, or NULL if not taken */
+   Addr pool;          /* For a pool chunk, the anchor of its pool */
+   UInt pool_gen;      /* For a pool chunk, the generation of its pool */
+   Bool marked;        /* Passes --datagrind-alloc-fn or --datagrind-alloc-site */
 } DgMallocBlock;
 
+/* A pool of VALGRIND_CREATE_MEMPOOL, keyed by its anchor. Each creation
+ * gets a new generation, and its chunks are live only while the pool of
+ * their anchor has the generation they were allocated in, so that a
+ * destroy need not visit them.
+ */
+typedef struct
+{
+   VgHashNode header;
+   UInt gen;
+   UWord n_chunks;
+} DgMempool;
+
+/* An allocation stack written as a DG_R_ALLOC_STACK, keyed by ExeContext */
+typedef struct
+{
+   VgHashNode header;
+   UWord index;
+} DgAllocStack;
+
 typedef struct
 {
    HWord addr;
@@ -91,34 +120,216 @@ typedef struct
 
 typedef struct
 {
-   UChar dir;
-   UChar size;
-   UChar iseq;
+   UChar dir;       /* Includes DG_ACC_STATIC if addr is constant */
+   UInt size;
+   UInt iseq;
+   HWord addr;      /* Only if DG_ACC_STATIC */
 } DgBBDefAccess;
 
+/* Slot of the context table, which maps a block and an ExeContext, or a
+ * block and a shadow stack frame ID, to a context index.
+ */
 typedef struct
 {
-   VgHashNode header;
+   ULong bbdef;        /* Block index plus one, or 0 if the slot is empty */
+   UWord id;           /* ExeContext pointer or frame ID */
    UWord context_index;
+   Bool frame;
 } DgBBDefContext;
 
+/* Node in the table interning shadow stack frames, so that a frame ID
+ * identifies the whole chain of return addresses leading to it.
+ */
+typedef struct
+{
+   VgHashNode header;  /* Key is a hash of parent and ret_addr */
+   UWord parent;
+   Addr ret_addr;
+   UWord frame_id;
+} DgFrameNode;
+
+typedef struct
+{
+   Addr sp;            /* SP on entry to the function */
+   UWord frame_id;
+   Bool toggled;       /* Entered a --datagrind-toggle-collect function */
+} DgShadowFrame;
+
+/* The state of a shadow stack when a signal handler was entered, restored
+ * when it returns.
+ */
+typedef struct
+{
+   Int depth;
+   Addr sp;            /* SP of the interrupted code */
+   Addr root_sp;
+   UWord root_id;
+   Bool root_toggled;
+   Int n_toggled;
+   /* The alternate stack the handler runs on, or a size of 0 */
+   Addr alt_min;
+   SizeT alt_size;
+} DgSignalFrame;
+
+/* Per-thread shadow of the call stack, maintained from the jump kinds of
+ * block exits in the same way as callgrind's call stack.
+ *
+ * A signal handler gets a root of its own above the frames of the code it
+ * interrupted, which it cannot pop. Otherwise the handler's SP, which on
+ * the alternate stack can be anywhere, would unwind frames that are still
+ * live, and the call the interrupted block made would be pushed at the
+ * handler's SP, to be popped again as soon as the handler returned.
+ */
+typedef struct
+{
+   DgShadowFrame *frames;
+   Int depth;
+   Int capacity;
+   Int base;           /* Frames of the code interrupted by signals */
+   DgSignalFrame *signals;
+   Int n_signals;
+   Int signals_capacity;
+   /* The frame below frames[0]. If tracking started part-way through the
+    * run, it is the function activation that was current then, which ends
+    * when SP rises above root_sp (or 0 if this is the initial stack).
+    */
+   Addr root_sp;
+   UWord root_id;
+   Bool root_toggled;
+   Int n_toggled;      /* Number of toggled frames, including the root */
+} DgShadowStack;
+
+/* The stride of a position of a block; see stride_update */
+typedef struct
+{
+   HWord delta;        /* From the run before last to the last run */
+   UChar hits;         /* Runs in a row since, with the same delta */
+   UChar shift;        /* Times the stride has broken in the chunk */
+} DgStride;
+
 typedef struct
 {
-   ULong index;
-   /* Maps ExeContext pointers to context indices. */
-   VgHashTable *context_indices;
+   ULong index;        /* Only once written */
+   /* The DG_R_BBDEF is only written before the first recorded run, so
+    * that blocks which never run cost nothing in the trace.
+    */
+   Bool written;
+   /* The context last found for the block, which is usually the next */
+   UWord last_id;
+   UWord last_context_index;
+   Bool last_frame;
+   Bool has_last;
    Addr start_ip;
+   /* Only until written. Blocks stay translated for a long time, so the
+    * arrays are not kept any longer than needed.
+    */
    XArray *instrs;
    XArray *accesses;
+   /* Once written, and only when counting: the accesses, for passing the
+    * addresses of runs to the analyses.
+    */
+   DgBBDefAccess *access_list;
+   /* Once written, with --datagrind-source-stats: the source line of each
+    * access.
+    */
+   DgSourceLine **source_lines;
+   Word n_accesses;    /* Once written */
+   /* Address last recorded at each access position, against which the
+    * next run of this block is delta-encoded.
+    */
+   HWord *last_addrs;
+   /* Once written, when runs may be strided: the stride of each position
+    * among the dynamic accesses, of which there are n_dynamic.
+    */
+   DgStride *strides;
+   Word n_dynamic;
+   /* Once written, with --datagrind-context-counts: the instruction of
+    * each static access, in order, since a reader adds those that a run
+    * reached to its accesses.
+    */
+   UInt *static_iseqs;
+   Word n_static;
+   /* The chunk in which last_addrs and strides were last used */
+   UWord chunk;
+   /* Only valid during instrumentation: temporaries holding cur_bbr, the
+    * address of its trace buffer position, and the position for the next
+    * access.
+    */
+   IRTemp run;
+   IRTemp buf_pos_addr;
+   IRTemp buf_pos;
+   /* Only valid during instrumentation when recording selectively: Ity_I1
+    * temporary that is true if the current run is being recorded.
+    */
+   IRTemp recording;
+   /* Only valid during instrumentation with --datagrind-ignore-stack: the
+    * highest address of the stack of the current run's thread.
+    */
+   IRTemp stack_max;
+   /* Starts a function matching --datagrind-toggle-collect */
+   Bool toggle;
+   /* With --datagrind-simpoints: the address of a rep-prefixed string
+    * instruction ending the block, or 0. Its iterations are unrolled by
+    * VEX, so it is the rep_first'th to the rep_last'th instructions.
+    */
+   Addr rep_ip;
+   UInt rep_first;
+   UInt rep_last;
 } DgBBDef;
 
+/* Values of DgBBRun.exit_kind. Any other value is a call, and gives the
+ * return address.
+ */
+#define DG_EXIT_BORING 0
+#define DG_EXIT_RET    1
+
+/* Buffer into which instrumented code writes access addresses for the
+ * current run, using inline IR rather than a helper call. The capacity is
+ * grown at translation time to hold the largest block definition, so no
+ * run-time overflow check is needed: each run is flushed by the
+ * trace_bb_start of the following one, which then rewinds pos to base.
+ *
+ * When filtering, only some accesses are written, so each address is
+ * preceded by its index in the block definition.
+ */
+typedef struct
+{
+   HWord *pos;    /* Next free slot, updated by the instrumented code */
+   HWord *base;
+   SizeT capacity;
+   UChar *encoded; /* Room to encode a full buffer as a DG_R_BBRUN payload */
+} DgTraceBuf;
+
+/* Each thread has its own run and buffer. Instrumented code finds the
+ * current one through cur_bbr, which trace_bb_start switches when the
+ * running thread changes.
+ *
+ * The runs are then encoded into the one output buffer in the order the
+ * threads ran them, which needs no locking since the core only runs one
+ * thread at a time. That order is what the reader numbers definitions
+ * and counts instructions by, so output buffers per thread would need the
+ * chunks reordered by their sequence numbers and instruction counts (which
+ * DG_R_CHUNK already has) and definitions kept out of them. A switch only
+ * costs a DG_R_THREAD record; the output is not flushed.
+ */
 typedef struct
 {
+   DgBBDef *bbdef;
    ULong context_index;
    HWord n_instrs;
-   XArray* accesses; /* HWord */
+   HWord exit_kind;     /* Set by instrumented code before leaving */
+   HWord recording;     /* Read by instrumented code if selective */
+   Addr stack_max;      /* Read by instrumented code with --datagrind-ignore-stack */
+   ThreadId tid;
+   DgTraceBuf buf;
 } DgBBRun;
 
+/* Largest DG_R_BBRUN payload for a run of n buffer slots */
+#define DG_BBRUN_MAX_PAYLOAD(n) (DG_MAX_UVARINT_BYTES * (2 * (n) + 4))
+
+/* Buffer slots written by each recorded access */
+#define DG_TRACE_SLOTS (indexed_slots ? 2 : 1)
+
 /* A SB corresponds exactly to a call to dg_instrument. It may contain
  * multiple DgBBDef entries if the IRSB was partitioned to meet size limits.
  */
@@ -128,24 +339,337 @@ typedef struct
    XArray* bbdefs;    /* Each element is a DgBBDef* */
 } DgSB;
 
-static Int out_fd = -1;
-static UChar out_buf[OUT_BUF_SIZE];
-static UInt out_buf_used = 0;
-static DgBBRun out_bbr;
+static DgBBRun *bbrs = NULL;      /* Indexed by ThreadId */
+static DgBBRun *cur_bbr = NULL;   /* Last run started, if not yet flushed */
+static ThreadId out_tid = 1;      /* Thread of the last run in the trace */
+static SizeT trace_buf_capacity = 256;
 static UWord global_bbdef_index = 0;
 static UWord global_context_index = 0;
+/* The contexts of all blocks, in an open-addressing table with linear
+ * probing, since it is looked up before nearly every run. The entries of
+ * discarded blocks are only dropped when the table is rebuilt, as block
+ * indices are never reused.
+ */
+static DgBBDefContext *context_table = NULL;
+static SizeT context_table_size = 0;   /* Power of 2 */
+static SizeT context_table_used = 0;   /* Including discarded blocks */
+static UChar *live_bbdefs = NULL;      /* Bit per block index, if not discarded */
+static SizeT live_bbdefs_size = 0;     /* Bytes */
 static VgHashTable *dgsbs = NULL;
+/* With --datagrind-context-counts, the runs and accesses written for each
+ * context index since the last DG_R_CONTEXT_COUNTS
+ */
+typedef struct
+{
+   ULong runs;
+   ULong accesses;
+} DgContextCount;
+
+static DgContextCount *context_counts = NULL;
+static SizeT context_counts_size = 0;
+
+/* With --datagrind-hot-threshold, the runs of each superblock, keyed by
+ * nraddr. The counts outlive the translations.
+ */
+typedef struct
+{
+   VgHashNode header;
+   UWord count;
+} DgHotness;
+
+static VgHashTable *hot_table = NULL;
 
+/* The core puts each new DebugInfo at the head of its list, and a lookup
+ * only moves one a step closer to the head, so the ones loaded since the
+ * last check are found among the first few. A mapping that loads debug
+ * information says so with its handle, and only a debug information load
+ * that the tool is not told about (through mprotect) needs a full scan.
+ */
 static VgHashTable *debuginfo_table = NULL;
-static Bool debuginfo_dirty = True;
+static Bool debuginfo_dirty = True;     /* The whole list must be checked */
+static UInt debuginfo_pending = 0;      /* Known to be new in the list */
 
 static VgHashTable *block_table = NULL;
+static PoolAlloc *block_pool = NULL;              /* DgMallocBlock */
+/* Pool chunks are kept apart from the blocks, as the first chunk of an
+ * arena usually has the address of the block it was carved from. Those of
+ * destroyed pools are dropped when next looked up, or by a sweep once they
+ * are half of the table.
+ */
+static VgHashTable *mempool_table = NULL;         /* DgMempool */
+static VgHashTable *chunk_table = NULL;           /* DgMallocBlock */
+static UInt global_pool_gen = 0;
+static UWord n_stale_chunks = 0;
+static VgHashTable *alloc_stack_table = NULL;     /* DgAllocStack */
+static UWord global_alloc_stack_index = 0;
+
+static DgShadowStack *shadow_stacks = NULL; /* Indexed by ThreadId */
+static VgHashTable *frame_table = NULL;
+static UWord global_frame_id = 0;
+
+/* The system call each thread is in, or -1. The tool's hooks run before
+ * the pre-wrapper and after the post-wrapper, so they bracket all of the
+ * memory the kernel is told about.
+ */
+static Int *syscall_nums = NULL;   /* Indexed by ThreadId */
 
 static const HChar *clo_datagrind_out_file = "datagrind.out.%p";
+static Bool clo_datagrind_shadow_stack = True;
+static Long clo_datagrind_context_depth = -1;  /* -1 for --num-callers */
+static Bool clo_datagrind_instr_atstart = True;
+static Long clo_datagrind_sample_rate = 1;
+static Long clo_datagrind_burst_on = 0;
+static Long clo_datagrind_burst_off = 0;
+static XArray *clo_datagrind_toggle_collect = NULL;   /* Patterns */
+static XArray *clo_datagrind_ignore_objects = NULL;   /* Patterns */
+static Bool clo_datagrind_ignore_stack = False;
+static Bool clo_datagrind_syscalls = True;
+static Bool clo_datagrind_bulk_copies = True;
+static Bool clo_datagrind_locks = False;
+static Bool clo_datagrind_context_counts = False;
+static Long clo_datagrind_max_memory = 0;
+static Bool clo_datagrind_strides = True;
+static Bool clo_datagrind_lines = False;
+static Bool clo_datagrind_trace_instr = False;
+static Long clo_datagrind_hot_threshold = 0;
+static Bool clo_datagrind_trace_hot = True;
+static const HChar *clo_datagrind_trace_ips = NULL;
+static Long clo_datagrind_checkpoint_instrs = 0;
+static Long clo_datagrind_checkpoint_secs = 0;
+static const HChar *clo_datagrind_simpoints = NULL;
+static const HChar *clo_datagrind_simpoint_weights = NULL;
+static Long clo_datagrind_simpoint_interval = 100000000;   /* As exp-bbv */
+static Long clo_datagrind_simpoint_thread = 1;
+static Long clo_datagrind_shard_index = 0;
+static Long clo_datagrind_shard_count = 0;   /* 0 when not sharded */
+static Long clo_datagrind_shard_instrs = 0;
+
+/* The deepest --datagrind-context-depth, as for --num-callers */
+#define DG_MAX_CONTEXT_DEPTH 500
+
+#define DG_MODE_TRACE   0
+#define DG_MODE_HEATMAP 1
+#define DG_MODE_REUSE   2
+#define DG_MODE_RASTER  3
+#define DG_MODE_COUNT   4
+static Int clo_datagrind_mode = DG_MODE_TRACE;
+
+#define DG_ALLOC_STACKS_NONE    0
+#define DG_ALLOC_STACKS_SAMPLED 1
+#define DG_ALLOC_STACKS_ALL     2
+static Int clo_datagrind_alloc_stacks = DG_ALLOC_STACKS_ALL;
+static Long clo_datagrind_alloc_stacks_every = 100;
+static Long clo_datagrind_alloc_stacks_min_size = 4096;
+static Bool clo_datagrind_heap_snapshots = False;
+
+/* Whether some runs are left out, by sampling or by toggling collection,
+ * so that instrumented code must check whether the run is recorded.
+ */
+static Bool selective = False;
+
+/* Sampling state: whether runs are sampled, and if so the counters used
+ * to choose them.
+ */
+static Bool sampling = False;
+static Long sample_count = 0;
+static ULong sample_instrs = 0;   /* Instructions executed so far */
+static ULong burst_end = 0;       /* Value of sample_instrs ending the burst */
+static Bool burst_on = True;
+
+/* A simulation point: an interval of --datagrind-simpoint-interval
+ * instructions of the SimPoint thread, the cluster it stands for and the
+ * cluster's weight in millionths.
+ */
+typedef struct
+{
+   ULong interval;
+   ULong cluster;
+   ULong weight;
+} DgSimPoint;
+
+/* SimPoint state: the points, sorted by interval, and the instructions of
+ * the SimPoint thread counted as exp-bbv counts them, with each sequence
+ * of iterations of a rep-prefixed string instruction as one. Runs are
+ * recorded while the count is in the interval of simpoints[simpoint_next],
+ * which changes when it reaches simpoint_change.
+ */
+static DgSimPoint *simpoints = NULL;
+static Word n_simpoints = 0;
+static Word simpoint_next = 0;
+static Bool simpoint_on = False;
+static ULong simpoint_instrs = 0;
+static ULong simpoint_change = 0;
+static Addr simpoint_rep_ip = 0;   /* Rep instruction last run, or 0 */
+
+/* Shard state: runs are recorded while sample_instrs is in the window of
+ * --datagrind-shard, which is entered or left when it reaches
+ * shard_change. The last shard has no end.
+ */
+static Bool shard_on = False;
+static ULong shard_change = 0;
+
+/* Checkpoint state: the value of sample_instrs at which to look again,
+ * and when the next checkpoint is due, by instructions and by the clock.
+ * The clock is only read every DG_CHECKPOINT_POLL instructions.
+ */
+#define DG_CHECKPOINT_POLL 10000000
+static ULong checkpoint_poll_at = ~0ULL;
+static ULong checkpoint_next_instrs = 0;
+static ULong checkpoint_next_usecs = 0;
+
+/* Whether blocks are being instrumented at all */
+static Bool instrument_state = True;
+
+/* Whether each address in the trace buffer is preceded by its index in the
+ * block definition, which is needed when not every access writes one.
+ */
+static Bool indexed_slots = False;
+
+/* Whether runs are passed to trace_bb_count */
+static Bool counting = False;
+
+/* Whether contexts are also looked up by shadow stack frame, which is not
+ * worth it when they only depend on the block.
+ */
+static Bool frame_contexts = False;
+
+/* Whether the replacements in the preload are left uninstrumented and
+ * report their ranges as DG_R_BULK_ACCESS. Only the trace can hold them,
+ * so the analyses, and filtering by tracked range, see the accesses of
+ * the replacements instead.
+ */
+static Bool bulk = False;
+
+/* Whether positions of full runs that keep a constant stride are left
+ * out, as DG_R_BBRUN_STRIDED.
+ */
+static Bool strided = False;
+
+/* With --datagrind-trace-ips, the instructions whose accesses are
+ * recorded: addresses, sorted, and file:line patterns.
+ */
+static XArray *trace_ips = NULL;     /* Addr */
+static XArray *trace_sites = NULL;   /* Patterns */
+
+/* Whether the accesses of the instruction being instrumented are recorded */
+static Bool instr_traced = True;
+
+/* Counters for --stats=yes and the stats monitor command */
+static ULong stats_runs = 0;          /* Written */
+static ULong stats_addrs = 0;         /* In written runs, so not static ones */
+static ULong stats_bb_starts = 0;     /* Calls of trace_bb_start */
+static ULong stats_frame_hits = 0;    /* Contexts found from the shadow stack */
+static ULong stats_unwinds = 0;       /* Stacks recorded for contexts */
+static ULong stats_unwind_hits = 0;   /* Of those, already with a context */
+static ULong stats_alloc_lookups = 0; /* Allocation stacks looked up */
+static ULong stats_hot_switches = 0;  /* Blocks that crossed the hot threshold */
+static ULong stats_checkpoints = 0;
 
 static Bool dg_process_cmd_line_option(const HChar *arg)
 {
+   const HChar *tmp_str;
+
    if (VG_STR_CLO(arg, "--datagrind-out-file", clo_datagrind_out_file)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-shadow-stack", clo_datagrind_shadow_stack)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-context-depth", clo_datagrind_context_depth,
+                        0, DG_MAX_CONTEXT_DEPTH)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-instr-atstart", clo_datagrind_instr_atstart)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-ignore-stack", clo_datagrind_ignore_stack)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-syscalls", clo_datagrind_syscalls)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-bulk-copies", clo_datagrind_bulk_copies)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-locks", clo_datagrind_locks)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-context-counts", clo_datagrind_context_counts)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-strides", clo_datagrind_strides)) {}
+   else if VG_XACT_CLO(arg, "--datagrind-granularity=access", clo_datagrind_lines, False) {}
+   else if VG_XACT_CLO(arg, "--datagrind-granularity=line", clo_datagrind_lines, True) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-trace-instr", clo_datagrind_trace_instr)) {}
+   else if VG_XACT_CLO(arg, "--datagrind-mode=trace", clo_datagrind_mode, DG_MODE_TRACE) {}
+   else if VG_XACT_CLO(arg, "--datagrind-mode=heatmap", clo_datagrind_mode, DG_MODE_HEATMAP) {}
+   else if VG_XACT_CLO(arg, "--datagrind-mode=reuse", clo_datagrind_mode, DG_MODE_REUSE) {}
+   else if VG_XACT_CLO(arg, "--datagrind-mode=raster", clo_datagrind_mode, DG_MODE_RASTER) {}
+   else if VG_XACT_CLO(arg, "--datagrind-mode=count", clo_datagrind_mode, DG_MODE_COUNT) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-max-memory", clo_datagrind_max_memory,
+                        0, 1LL << 62)) {}
+   else if VG_XACT_CLO(arg, "--datagrind-alloc-stacks=none", clo_datagrind_alloc_stacks,
+                       DG_ALLOC_STACKS_NONE) {}
+   else if VG_XACT_CLO(arg, "--datagrind-alloc-stacks=sampled", clo_datagrind_alloc_stacks,
+                       DG_ALLOC_STACKS_SAMPLED) {}
+   else if VG_XACT_CLO(arg, "--datagrind-alloc-stacks=all", clo_datagrind_alloc_stacks,
+                       DG_ALLOC_STACKS_ALL) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-alloc-stacks-every", clo_datagrind_alloc_stacks_every,
+                        0, 1000000000)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-alloc-stacks-min-size", clo_datagrind_alloc_stacks_min_size,
+                        0, 1LL << 62)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-heap-snapshots", clo_datagrind_heap_snapshots)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-sample-rate", clo_datagrind_sample_rate,
+                        1, 1000000000)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-burst-on", clo_datagrind_burst_on,
+                        0, 1LL << 62)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-burst-off", clo_datagrind_burst_off,
+                        0, 1LL << 62)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-hot-threshold", clo_datagrind_hot_threshold,
+                        0, 1LL << 62)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-trace-hot", clo_datagrind_trace_hot)) {}
+   else if (VG_STR_CLO(arg, "--datagrind-trace-ips", clo_datagrind_trace_ips)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-checkpoint-instrs", clo_datagrind_checkpoint_instrs,
+                        0, 1LL << 62)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-checkpoint-secs", clo_datagrind_checkpoint_secs,
+                        0, 1000000000)) {}
+   else if (VG_STR_CLO(arg, "--datagrind-simpoints", clo_datagrind_simpoints)) {}
+   else if (VG_STR_CLO(arg, "--datagrind-simpoint-weights", clo_datagrind_simpoint_weights)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-simpoint-interval", clo_datagrind_simpoint_interval,
+                        1, 1LL << 62)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-simpoint-thread", clo_datagrind_simpoint_thread,
+                        1, VG_N_THREADS - 1)) {}
+   else if (VG_STR_CLO(arg, "--datagrind-shard", tmp_str))
+   {
+      HChar *end;
+
+      clo_datagrind_shard_index = VG_(strtoll10)(tmp_str, &end);
+      if (*end != '/' || end == tmp_str)
+         VG_(fmsg_bad_option)(arg, "expected <i>/<n>\n");
+      tmp_str = end + 1;
+      clo_datagrind_shard_count = VG_(strtoll10)(tmp_str, &end);
+      if (*end != '\0' || end == tmp_str || clo_datagrind_shard_count < 1
+          || clo_datagrind_shard_index < 0
+          || clo_datagrind_shard_index >= clo_datagrind_shard_count)
+         VG_(fmsg_bad_option)(arg, "expected <i>/<n> with 0 <= i < n\n");
+   }
+   else if (VG_BINT_CLO(arg, "--datagrind-shard-instrs", clo_datagrind_shard_instrs,
+                        1, 1LL << 62)) {}
+   else if (VG_STR_CLO(arg, "--datagrind-toggle-collect", tmp_str))
+   {
+      if (clo_datagrind_toggle_collect == NULL)
+         clo_datagrind_toggle_collect = VG_(newXA)(VG_(malloc), "datagrind.toggle_collect",
+                                                   VG_(free), sizeof(HChar *));
+      VG_(addToXA)(clo_datagrind_toggle_collect, &tmp_str);
+   }
+   else if (VG_STR_CLO(arg, "--datagrind-ignore-objects", tmp_str))
+   {
+      if (clo_datagrind_ignore_objects == NULL)
+         clo_datagrind_ignore_objects = VG_(newXA)(VG_(malloc), "datagrind.ignore_objects",
+                                                   VG_(free), sizeof(HChar *));
+      VG_(addToXA)(clo_datagrind_ignore_objects, &tmp_str);
+   }
+   else if (DG_(out_process_cmd_line_option)(arg)) {}
+   else if (DG_(index_process_cmd_line_option)(arg)) {}
+   else if (DG_(filter_process_cmd_line_option)(arg)) {}
+   else if (DG_(reuse_process_cmd_line_option)(arg)) {}
+   else if (DG_(raster_process_cmd_line_option)(arg)) {}
+   else if (DG_(cachesim_process_cmd_line_option)(arg)) {}
+   else if (DG_(allocstats_process_cmd_line_option)(arg)) {}
+   else if (DG_(fieldheat_process_cmd_line_option)(arg)) {}
+   else if (DG_(affinity_process_cmd_line_option)(arg)) {}
+   else if (DG_(sharing_process_cmd_line_option)(arg)) {}
+   else if (DG_(pages_process_cmd_line_option)(arg)) {}
+   else if (DG_(tlbsim_process_cmd_line_option)(arg)) {}
+   else if (DG_(patterns_process_cmd_line_option)(arg)) {}
+   else if (DG_(values_process_cmd_line_option)(arg)) {}
+   else if (DG_(sources_process_cmd_line_option)(arg)) {}
+   else if (DG_(wss_process_cmd_line_option)(arg)) {}
+   else if (DG_(events_process_cmd_line_option)(arg)) {}
+   else if (DG_(xtree_process_cmd_line_option)(arg)) {}
+   else if (DG_(defcache_process_cmd_line_option)(arg)) {}
    else if (VG_(replacement_malloc_process_cmd_line_option)(arg)) {}
    else
        return False;
@@ -155,8 +679,97 @@ static Bool dg_process_cmd_line_option(const HChar *arg)
 static void dg_print_usage(void)
 {
    VG_(printf)(
-"    --datagrind-out-file=<file>      output file name [datagrind.out]\n"
+"    --datagrind-out-file=<file>      output file name, or tcp:<ip>:<port> or\n"
+"                                     fd:<n> to stream it [datagrind.out]\n"
+"    --datagrind-mode=trace|heatmap|reuse|raster|count\n"
+"                                     record every access, count accesses per\n"
+"                                     context and cache line, histogram their\n"
+"                                     reuse distances, count them by time\n"
+"                                     and address, or only count them per\n"
+"                                     instruction [trace]\n"
+"    --datagrind-max-memory=<n>       keep the heat map or reuse table under\n"
+"                                     n bytes, spilling or sampling (0 for\n"
+"                                     no limit) [0]\n"
+"    --datagrind-checkpoint-instrs=<n>  write the heat map, reuse distances\n"
+"                                     and xtree so far every n instructions...\n"
+"    --datagrind-checkpoint-secs=<n>  ...or every n seconds (0 for never)\n"
+"                                     [0 0]\n"
+"    --datagrind-shadow-stack=no|yes  track calls to avoid unwinding the\n"
+"                                     stack for every block [yes]\n"
+"    --datagrind-context-depth=<n>    callers that tell contexts apart, or 0\n"
+"                                     for the block alone [--num-callers]\n"
+"    --datagrind-instr-atstart=no|yes record from the start of the program,\n"
+"                                     rather than from a client request [yes]\n"
+"    --datagrind-sample-rate=<n>      record one in every n block runs [1]\n"
+"    --datagrind-burst-on=<n>         record in bursts of n instructions...\n"
+"    --datagrind-burst-off=<n>        ...separated by gaps of n [0 0]\n"
+"    --datagrind-simpoints=<file>     only record the intervals chosen by\n"
+"                                     SimPoint from exp-bbv's vectors\n"
+"    --datagrind-simpoint-weights=<file>  the weights SimPoint gave them\n"
+"    --datagrind-simpoint-interval=<n>  instructions in an interval, as\n"
+"                                     exp-bbv's --interval-size [100000000]\n"
+"    --datagrind-simpoint-thread=<n>  thread whose instructions are counted,\n"
+"                                     as in exp-bbv's vectors for it [1]\n"
+"    --datagrind-shard=<i>/<n>        record only shard i of n, then exit...\n"
+"    --datagrind-shard-instrs=<k>     ...where each shard is k instructions,\n"
+"                                     and the last runs to the end\n"
+"    --datagrind-hot-threshold=<n>    only instrument blocks once they have\n"
+"                                     run n times (0 for all blocks) [0]\n"
+"    --datagrind-trace-hot=yes|no     with no, instrument blocks only until\n"
+"                                     they have run n times instead [yes]\n"
+"    --datagrind-trace-ips=<file>     only record the accesses of the\n"
+"                                     instructions listed in <file>, as\n"
+"                                     addresses or file:line patterns\n"
+"    --datagrind-toggle-collect=<fn>  only record while a function matching\n"
+"                                     <fn> is on the stack (may be repeated)\n"
+"    --datagrind-ignore-stack=no|yes  do not record accesses to the stack [no]\n"
+"    --datagrind-ignore-objects=<obj> do not record code in shared objects\n"
+"                                     matching <obj> (may be repeated)\n"
+"    --datagrind-syscalls=no|yes      record the memory that system calls\n"
+"                                     read and write [yes]\n"
+"    --datagrind-bulk-copies=no|yes   record each memcpy, memmove and memset\n"
+"                                     as one range rather than its accesses\n"
+"                                     [yes]\n"
+"    --datagrind-locks=no|yes         record each pthread mutex, rwlock and\n"
+"                                     spinlock taken and given up [no]\n"
+"    --datagrind-context-counts=no|yes  write the runs and accesses of each\n"
+"                                     context with every chunk [no]\n"
+"    --datagrind-strides=no|yes       leave out the addresses of accesses\n"
+"                                     that keep a constant stride [yes]\n"
+"    --datagrind-granularity=access|line\n"
+"                                     record every access, or merge those in\n"
+"                                     a run that touch the same cache line\n"
+"                                     [access]\n"
+"    --datagrind-trace-instr=no|yes   have readers give the instruction\n"
+"                                     fetches of each run too [no]\n"
+"    --datagrind-alloc-stacks=none|sampled|all\n"
+"                                     which heap blocks get the stack that\n"
+"                                     allocated them [all]\n"
+"    --datagrind-alloc-stacks-every=<n>     with sampled, every nth block...\n"
+"    --datagrind-alloc-stacks-min-size=<n>  ...and any of n bytes or more\n"
+"                                     [100 4096]\n"
+"    --datagrind-heap-snapshots=no|yes  write the live heap blocks after\n"
+"                                     every end event [no]\n"
    );
+   DG_(out_print_usage)();
+   DG_(index_print_usage)();
+   DG_(filter_print_usage)();
+   DG_(reuse_print_usage)();
+   DG_(raster_print_usage)();
+   DG_(cachesim_print_usage)();
+   DG_(allocstats_print_usage)();
+   DG_(fieldheat_print_usage)();
+   DG_(affinity_print_usage)();
+   DG_(sharing_print_usage)();
+   DG_(pages_print_usage)();
+   DG_(tlbsim_print_usage)();
+   DG_(patterns_print_usage)();
+   DG_(values_print_usage)();
+   DG_(sources_print_usage)();
+   DG_(wss_print_usage)();
+   DG_(events_print_usage)();
+   DG_(xtree_print_usage)();
+   DG_(defcache_print_usage)();
 }
 
 static void dg_print_debug_usage(void)
@@ -166,182 +779,1830 @@ static void dg_print_debug_usage(void)
    );
 }
 
-static void out_flush(void)
+/* The command line is cut short after this many bytes */
+#define DG_MAX_PROCESS_ARGS 1024
+
+/* Writes the DG_R_PROCESS, which tells apart the traces of processes that
+ * fork and exec each other, and gives the time that chunks count from.
+ */
+static void out_process(void)
+{
+   const HChar *exe = VG_(args_the_exename) != NULL ? VG_(args_the_exename) : "";
+   SizeT exe_len = VG_(strlen)(exe);
+   SizeT args_len = 0;
+   UChar *payload, *p;
+   Word i, n_args = VG_(sizeXA)(VG_(args_for_client));
+
+   for (i = 0; i < n_args; i++)
+   {
+      const HChar *arg = *(HChar **) VG_(indexXA)(VG_(args_for_client), i);
+      SizeT len = VG_(strlen)(arg) + 1;
+      if (args_len + len > DG_MAX_PROCESS_ARGS)
+         break;
+      args_len += len;
+   }
+   n_args = i;
+
+   DG_(index_start_usecs) = DG_(index_now_usecs)();
+   p = payload = VG_(malloc)("datagrind.process",
+                             3 * 10 + exe_len + 1 + args_len);
+   p = encode_uvarint(p, VG_(getpid)());
+   p = encode_uvarint(p, VG_(getppid)());
+   p = encode_uvarint64(p, DG_(index_start_usecs));
+   VG_(memcpy)(p, exe, exe_len + 1);
+   p += exe_len + 1;
+   for (i = 0; i < n_args; i++)
+   {
+      const HChar *arg = *(HChar **) VG_(indexXA)(VG_(args_for_client), i);
+      SizeT len = VG_(strlen)(arg) + 1;
+      VG_(memcpy)(p, arg, len);
+      p += len;
+   }
+   out_byte(DG_R_PROCESS);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+}
+
+/* Writes the DG_R_SIMPOINTS, which gives the simulation points recorded
+ * and their weights, so that the summaries of their events can be scaled
+ * up to the whole program.
+ */
+static void out_simpoints(void)
+{
+   UChar *payload, *p;
+   Word i;
+
+   p = payload = VG_(malloc)("datagrind.simpoints.out", (3 + 3 * n_simpoints) * 10);
+   p = encode_uvarint64(p, clo_datagrind_simpoint_interval);
+   p = encode_uvarint(p, clo_datagrind_simpoint_thread);
+   p = encode_uvarint(p, n_simpoints);
+   for (i = 0; i < n_simpoints; i++)
+   {
+      p = encode_uvarint64(p, simpoints[i].interval);
+      p = encode_uvarint64(p, simpoints[i].cluster);
+      p = encode_uvarint64(p, simpoints[i].weight);
+   }
+   out_byte(DG_R_SIMPOINTS);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+}
+
+/* Writes the DG_R_SHARD, which places the trace in the run that the
+ * shards were cut from, so that dg_merge can put them back together.
+ */
+static void out_shard(void)
+{
+   UChar payload[4 * 10];
+   UChar *p = payload;
+
+   p = encode_uvarint(p, clo_datagrind_shard_index);
+   p = encode_uvarint(p, clo_datagrind_shard_count);
+   p = encode_uvarint64(p, clo_datagrind_shard_instrs);
+   p = encode_uvarint64(p, clo_datagrind_shard_index * clo_datagrind_shard_instrs);
+   out_byte(DG_R_SHARD);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+}
+
+/* Writes the DG_R_HEADER, which ends the part of the file that is never
+ * compressed.
+ */
+static void out_header(void)
 {
-   VG_(write)(out_fd, out_buf, out_buf_used);
-   out_buf_used = 0;
+   static const Char magic[] = "DATAGRIND1";
+   static const Char tool_version[] = VERSION;
+   UChar flags[10];
+   UChar *p;
+   UInt f = 0;
+
+   if (DG_(index_chunked)())
+      f |= DG_HEADER_CHUNKED;
+   if (selective || clo_datagrind_hot_threshold > 0 || trace_ips != NULL)
+      f |= DG_HEADER_SAMPLED;
+   if (clo_datagrind_mode != DG_MODE_TRACE)
+      f |= DG_HEADER_SUMMARY;
+   if (DG_(out_partial)() || clo_datagrind_shard_count > 0)
+      f |= DG_HEADER_PARTIAL;
+   if (strided)
+      f |= DG_HEADER_STRIDED;
+   if (clo_datagrind_lines && clo_datagrind_mode == DG_MODE_TRACE)
+      f |= DG_HEADER_LINES;
+   if (clo_datagrind_trace_instr && clo_datagrind_mode == DG_MODE_TRACE)
+      f |= DG_HEADER_INSTRS;
+   if (DG_(clo_event_stats))
+      f |= DG_HEADER_EVENTS;
+   p = encode_uvarint(flags, f);
+
+   out_byte(DG_R_HEADER);
+   out_byte(sizeof(magic) + 4 + (p - flags) + sizeof(tool_version));
+   out_bytes(magic, sizeof(magic));
+   out_byte(12); /* version */
+#if VG_BIGENDIAN
+   out_byte(1);
+#elif VG_LITTLEENDIAN
+   out_byte(0);
+#else
+   tl_assert(0);
+#endif
+   out_byte(VG_WORDSIZE);
+   out_byte(DG_(clo_compress));
+   out_bytes(flags, p - flags);
+   out_bytes(tool_version, sizeof(tool_version));
+   DG_(out_end_header)();
 }
 
-static void out_bytes(const void *buf, UInt count)
+static void prepare_out_file(void)
 {
-   if (count > OUT_BUF_SIZE - out_buf_used)
-      out_flush();
-   VG_(memcpy)(out_buf + out_buf_used, buf, count);
-   out_buf_used += count;
+   DG_(out_open)(clo_datagrind_out_file);
+   out_header();
+   out_process();
+   if (simpoints != NULL)
+      out_simpoints();
+   if (clo_datagrind_shard_count > 0)
+      out_shard();
+   DG_(defcache_start)(&global_bbdef_index, &global_context_index);
+   DG_(index_start_chunk)(0, out_tid, global_bbdef_index, global_context_index);
 }
 
-static void out_byte(UChar byte)
+static Int cmp_addr(const void *a, const void *b)
 {
-   if (out_buf_used >= OUT_BUF_SIZE)
-      out_flush();
-   out_buf[out_buf_used++] = byte;
+   Addr aa = *(const Addr *) a;
+   Addr ab = *(const Addr *) b;
+   if (aa != ab)
+      return aa < ab ? -1 : 1;
+   return 0;
 }
 
-static inline void out_word(UWord word)
+/* Reads the whole of the file given to an option, as a string */
+static HChar *load_option_file(const HChar *option, const HChar *name)
 {
-   out_bytes(&word, sizeof(word));
+   SysRes fd;
+   HChar *buf;
+   SizeT size = 0, cap = 4096;
+   Int n;
+
+   fd = VG_(open)(name, VKI_O_RDONLY, 0);
+   if (sr_isError(fd))
+      VG_(fmsg_bad_option)(option, "cannot open '%s'\n", name);
+   buf = VG_(malloc)("datagrind.option_file", cap);
+   while ((n = VG_(read)(sr_Res(fd), buf + size, cap - size - 1)) > 0)
+   {
+      size += n;
+      if (size == cap - 1)
+      {
+         cap *= 2;
+         buf = VG_(realloc)("datagrind.option_file", buf, cap);
+      }
+   }
+   VG_(close)(sr_Res(fd));
+   buf[size] = '\0';
+   return buf;
 }
 
-static void out_length(ULong len)
+/* Cuts the next line from *pos, with any comment after a '#' and the
+ * surrounding space taken off, and moves *pos past it. Returns NULL at the
+ * end of the string.
+ */
+static HChar *next_option_line(HChar **pos)
 {
-   if (len < 255)
-      out_byte((UChar) len);
+   HChar *line = *pos, *end;
+
+   if (*line == '\0')
+      return NULL;
+   *pos = VG_(strchr)(line, '\n');
+   if (*pos != NULL)
+      *(*pos)++ = '\0';
    else
+      *pos = line + VG_(strlen)(line);
+   end = VG_(strchr)(line, '#');
+   if (end != NULL)
+      *end = '\0';
+   while (VG_(isspace)(*line))
+      line++;
+   end = line + VG_(strlen)(line);
+   while (end > line && VG_(isspace)(end[-1]))
+      *--end = '\0';
+   return line;
+}
+
+/* Reads the file of --datagrind-trace-ips. Each line holds a hex address
+ * or a file:line pattern, and anything after a '#' is a comment.
+ */
+static void load_trace_ips(void)
+{
+   HChar *buf, *line, *next;
+
+   buf = next = load_option_file("--datagrind-trace-ips", clo_datagrind_trace_ips);
+   trace_ips = VG_(newXA)(VG_(malloc), "datagrind.trace_ips", VG_(free), sizeof(Addr));
+   VG_(setCmpFnXA)(trace_ips, cmp_addr);
+   while ((line = next_option_line(&next)) != NULL)
    {
-      out_byte(255);
-      out_bytes(&len, sizeof(len));
+      HChar *end;
+
+      if (*line == '\0')
+         continue;
+
+      if (line[0] == '0' && (line[1] == 'x' || line[1] == 'X'))
+      {
+         Addr addr = VG_(strtoull16)(line, &end);
+         if (*end != '\0')
+            VG_(fmsg_bad_option)("--datagrind-trace-ips", "bad address '%s'\n", line);
+         VG_(addToXA)(trace_ips, &addr);
+      }
+      else if (VG_(strchr)(line, ':') != NULL)
+      {
+         const HChar *site = VG_(strdup)("datagrind.trace_site", line);
+         if (trace_sites == NULL)
+            trace_sites = VG_(newXA)(VG_(malloc), "datagrind.trace_sites",
+                                     VG_(free), sizeof(HChar *));
+         VG_(addToXA)(trace_sites, &site);
+      }
+      else
+         VG_(fmsg_bad_option)("--datagrind-trace-ips",
+                              "'%s' is neither an address nor file:line\n", line);
    }
+   VG_(sortXA)(trace_ips);
+   VG_(free)(buf);
 }
 
-static void prepare_out_file(void)
+static Int cmp_simpoint(const void *a, const void *b)
+{
+   const DgSimPoint *pa = a;
+   const DgSimPoint *pb = b;
+   if (pa->interval != pb->interval)
+      return pa->interval < pb->interval ? -1 : 1;
+   return 0;
+}
+
+/* Reads the files SimPoint writes with -saveSimpoints and -saveWeights.
+ * Each line of the first holds an interval and its cluster, and each of the
+ * second the weight of a cluster and the cluster.
+ */
+static void load_simpoints(void)
 {
-   SysRes sres;
-   HChar *filename = VG_(expand_file_name)("--datagrind-out-file", clo_datagrind_out_file);
-   sres = VG_(open)(filename, VKI_O_CREAT | VKI_O_TRUNC | VKI_O_WRONLY,
-                    VKI_S_IRUSR | VKI_S_IWUSR);
-   if (sr_isError(sres))
+   HChar *buf, *line, *next;
+   Word cap = 16, i;
+
+   buf = next = load_option_file("--datagrind-simpoints", clo_datagrind_simpoints);
+   simpoints = VG_(malloc)("datagrind.simpoints", cap * sizeof(DgSimPoint));
+   while ((line = next_option_line(&next)) != NULL)
    {
-      VG_(message)(Vg_UserMsg,
-                   "Error: can not open datagrind output file `%s'\n",
-                   filename);
-      VG_(exit)(1);
+      DgSimPoint *sp;
+      HChar *mid, *end;
+
+      if (*line == '\0')
+         continue;
+      if (n_simpoints == cap)
+      {
+         cap *= 2;
+         simpoints = VG_(realloc)("datagrind.simpoints", simpoints, cap * sizeof(DgSimPoint));
+      }
+      sp = &simpoints[n_simpoints++];
+      sp->interval = VG_(strtoull10)(line, &mid);
+      sp->cluster = VG_(strtoull10)(mid, &end);
+      sp->weight = 0;
+      if (mid == line || end == mid || *end != '\0')
+         VG_(fmsg_bad_option)("--datagrind-simpoints",
+                              "'%s' is not an interval and a cluster\n", line);
    }
-   else
+   VG_(free)(buf);
+   if (n_simpoints == 0)
+      VG_(fmsg_bad_option)("--datagrind-simpoints", "no intervals in '%s'\n",
+                           clo_datagrind_simpoints);
+   VG_(ssort)(simpoints, n_simpoints, sizeof(DgSimPoint), cmp_simpoint);
+   for (i = 1; i < n_simpoints; i++)
+      if (simpoints[i].interval == simpoints[i - 1].interval)
+         VG_(fmsg_bad_option)("--datagrind-simpoints", "interval %llu is given twice\n",
+                              simpoints[i].interval);
+
+   if (clo_datagrind_simpoint_weights == NULL)
+      return;
+   buf = next = load_option_file("--datagrind-simpoint-weights", clo_datagrind_simpoint_weights);
+   while ((line = next_option_line(&next)) != NULL)
    {
-      static const Char magic[] = "DATAGRIND1";
+      double weight;
+      ULong cluster;
+      HChar *mid, *end;
 
-      out_fd = (Int) sr_Res(sres);
-      out_byte(DG_R_HEADER);
-      out_byte(sizeof(magic) + 3);
-      out_bytes(magic, sizeof(magic));
-      out_byte(1); /* version */
-#if VG_BIGENDIAN
-      out_byte(1);
-#elif VG_LITTLEENDIAN
-      out_byte(0);
-#else
-      tl_assert(0);
-#endif
-      out_byte(VG_WORDSIZE);
+      if (*line == '\0')
+         continue;
+      weight = VG_(strtod)(line, &mid);
+      cluster = VG_(strtoull10)(mid, &end);
+      if (mid == line || end == mid || *end != '\0' || weight < 0.0 || weight > 1.0)
+         VG_(fmsg_bad_option)("--datagrind-simpoint-weights",
+                              "'%s' is not a weight and a cluster\n", line);
+      for (i = 0; i < n_simpoints; i++)
+         if (simpoints[i].cluster == cluster)
+            simpoints[i].weight = (ULong) (weight * 1000000.0 + 0.5);
    }
+   VG_(free)(buf);
 }
 
+static void fork_parent(ThreadId tid);
+static void fork_child(ThreadId tid);
+
 static void dg_post_clo_init(void)
 {
+   ThreadId tid;
+
+   if (clo_datagrind_shadow_stack
+       && VG_(clo_vex_control).guest_chase_thresh != 0)
+   {
+      /* Chasing into a callee leaves the call with no block exit, so the
+       * shadow stack would never see it.
+       */
+      VG_(message)(Vg_UserMsg,
+                   "--datagrind-shadow-stack=yes needs --vex-guest-chase-thresh=0\n"
+                   "=> resetting it back to 0\n");
+      VG_(clo_vex_control).guest_chase_thresh = 0;
+   }
+
+   if ((clo_datagrind_burst_on == 0) != (clo_datagrind_burst_off == 0))
+      VG_(fmsg_bad_option)("--datagrind-burst-on/--datagrind-burst-off",
+                           "both must be given, or neither\n");
+   if (clo_datagrind_toggle_collect != NULL && !clo_datagrind_shadow_stack)
+      VG_(fmsg_bad_option)("--datagrind-toggle-collect",
+                           "needs --datagrind-shadow-stack=yes\n");
+   if (clo_datagrind_trace_ips != NULL)
+      load_trace_ips();
+   if (clo_datagrind_simpoint_weights != NULL && clo_datagrind_simpoints == NULL)
+      VG_(fmsg_bad_option)("--datagrind-simpoint-weights",
+                           "needs --datagrind-simpoints\n");
+   if (clo_datagrind_simpoints != NULL && clo_datagrind_hot_threshold > 0)
+      VG_(fmsg_bad_option)("--datagrind-simpoints",
+                           "cannot count instructions with --datagrind-hot-threshold\n");
+   if (clo_datagrind_simpoints != NULL)
+   {
+      load_simpoints();
+      simpoint_change = simpoints[0].interval * clo_datagrind_simpoint_interval;
+   }
+   if ((clo_datagrind_shard_count > 0) != (clo_datagrind_shard_instrs > 0))
+      VG_(fmsg_bad_option)("--datagrind-shard/--datagrind-shard-instrs",
+                           "both must be given, or neither\n");
+   if (clo_datagrind_shard_count > 0
+       && (clo_datagrind_hot_threshold > 0 || !clo_datagrind_instr_atstart))
+      VG_(fmsg_bad_option)("--datagrind-shard",
+                           "cannot count instructions with --datagrind-hot-threshold"
+                           " or --datagrind-instr-atstart=no\n");
+   if (clo_datagrind_shard_count > 0)
+      shard_change = clo_datagrind_shard_index * clo_datagrind_shard_instrs;
+   sampling = clo_datagrind_sample_rate > 1 || clo_datagrind_burst_off > 0;
+   selective = sampling || clo_datagrind_toggle_collect != NULL || simpoints != NULL
+               || clo_datagrind_shard_count > 0;
+   instrument_state = clo_datagrind_instr_atstart;
+   burst_end = clo_datagrind_burst_on;
+   if (clo_datagrind_checkpoint_instrs > 0 || clo_datagrind_checkpoint_secs > 0)
+   {
+      checkpoint_next_instrs = clo_datagrind_checkpoint_instrs;
+      checkpoint_next_usecs = DG_(index_now_usecs)()
+                              + clo_datagrind_checkpoint_secs * 1000000ULL;
+      checkpoint_poll_at = 0;
+   }
+   frame_contexts = clo_datagrind_shadow_stack
+                    && (clo_datagrind_context_depth < 0 || clo_datagrind_context_depth > 1);
+   counting = (clo_datagrind_mode != DG_MODE_TRACE && clo_datagrind_mode != DG_MODE_COUNT)
+              || DG_(clo_cache_sim) || DG_(clo_alloc_stats)
+              || DG_(clo_field_heat) || DG_(clo_affinity) || DG_(clo_sharing) || DG_(clo_atomics)
+              || DG_(clo_pages) || DG_(clo_first_touch) || DG_(clo_tlb_sim) || DG_(clo_access_patterns)
+              || DG_(clo_wss_interval) > 0 || DG_(clo_event_stats) || DG_(clo_xtree)
+              || DG_(clo_source_stats);
+   /* The inline counters see none of the runs */
+   if (clo_datagrind_mode == DG_MODE_COUNT
+       && (counting || selective || clo_datagrind_hot_threshold > 0 || trace_ips != NULL
+           || DG_(clo_filter) != DG_FILTER_ALL))
+      VG_(fmsg_bad_option)("--datagrind-mode=count",
+                           "cannot be used with the analysis, sampling, hot or filter options\n");
+   indexed_slots = DG_(clo_filter) == DG_FILTER_TRACKED || counting
+                   || clo_datagrind_ignore_stack || DG_(have_ignored)()
+                   || clo_datagrind_lines;
+   strided = clo_datagrind_strides && clo_datagrind_mode == DG_MODE_TRACE && !indexed_slots;
+   bulk = clo_datagrind_bulk_copies && !counting && DG_(clo_filter) != DG_FILTER_TRACKED;
+   DG_(filter_init)();
+   if (clo_datagrind_mode == DG_MODE_HEATMAP)
+      DG_(heatmap_init)(clo_datagrind_max_memory);
+   else if (clo_datagrind_mode == DG_MODE_REUSE)
+      DG_(reuse_init)(clo_datagrind_max_memory);
+   else if (clo_datagrind_mode == DG_MODE_RASTER)
+      DG_(raster_init)();
+   else if (clo_datagrind_mode == DG_MODE_COUNT)
+      DG_(counts_init)();
+   DG_(cachesim_init)();
+   DG_(allocstats_init)();
+   DG_(fieldheat_init)();
+   DG_(affinity_init)();
+   DG_(sharing_init)();
+   DG_(pages_init)();
+   DG_(tlbsim_init)();
+   DG_(patterns_init)();
+   DG_(values_init)();
+   DG_(sources_init)();
+   DG_(wss_init)();
+   DG_(events_init)();
+   DG_(xtree_init)();
+
    debuginfo_table = VG_(HT_construct)("datagrind.debuginfo_table");
    block_table = VG_(HT_construct)("datagrind.block_table");
+   block_pool = VG_(newPA)(sizeof(DgMallocBlock), 1000, VG_(malloc),
+                           "datagrind.block_pool", VG_(free));
+   mempool_table = VG_(HT_construct)("datagrind.mempool_table");
+   chunk_table = VG_(HT_construct)("datagrind.chunk_table");
+   alloc_stack_table = VG_(HT_construct)("datagrind.alloc_stack_table");
    dgsbs = VG_(HT_construct)("datagrind.dgsbs");
-   out_bbr.n_instrs = 0;
-   out_bbr.accesses = VG_(newXA)(VG_(malloc), "datagrind.out_bb.accesses",
-                                 VG_(free), sizeof(HWord));
+   if (clo_datagrind_hot_threshold > 0)
+      hot_table = VG_(HT_construct)("datagrind.hot_table");
+   frame_table = VG_(HT_construct)("datagrind.frame_table");
+   shadow_stacks = VG_(calloc)("datagrind.shadow_stacks", VG_N_THREADS,
+                               sizeof(DgShadowStack));
+   bbrs = VG_(calloc)("datagrind.bbrs", VG_N_THREADS, sizeof(DgBBRun));
+   syscall_nums = VG_(malloc)("datagrind.syscall_nums", VG_N_THREADS * sizeof(Int));
+   for (tid = 0; tid < VG_N_THREADS; tid++)
+      syscall_nums[tid] = -1;
 
    prepare_out_file();
+   if (DG_(clo_fork_files))
+      VG_(atfork)(fork_parent, NULL, fork_child);
 }
 
-static void trace_bb_flush(DgBBRun *bbr)
+/* Makes buf hold trace_buf_capacity slots, keeping its contents. */
+static void trace_buf_resize(DgTraceBuf *buf)
+{
+   SizeT used = buf->pos - buf->base;
+
+   buf->capacity = trace_buf_capacity;
+   buf->base = VG_(realloc)("datagrind.trace_buf", buf->base,
+                            buf->capacity * sizeof(HWord));
+   buf->pos = buf->base + used;
+   buf->encoded = VG_(realloc)("datagrind.trace_buf.encoded", buf->encoded,
+                               DG_BBRUN_MAX_PAYLOAD(buf->capacity));
+}
+
+/* Ensures that the trace buffers can hold at least n_accesses addresses.
+ * This is only called at translation time, so it never runs while an
+ * instrumented block is part-way through writing to a buffer.
+ */
+static void trace_buf_reserve(SizeT n_accesses)
+{
+   SizeT n_slots = n_accesses * DG_TRACE_SLOTS;
+   ThreadId tid;
+
+   if (n_slots > trace_buf_capacity)
+   {
+      while (trace_buf_capacity < n_slots)
+         trace_buf_capacity *= 2;
+      for (tid = 1; tid < VG_N_THREADS; tid++)
+         if (bbrs[tid].buf.base != NULL)
+            trace_buf_resize(&bbrs[tid].buf);
+   }
+}
+
+/* Returns the run of thread tid, setting it up on first use. */
+static DgBBRun *thread_bbr(ThreadId tid)
+{
+   DgBBRun *bbr = &bbrs[tid];
+
+   if (bbr->buf.base == NULL)
+   {
+      bbr->tid = tid;
+      bbr->exit_kind = DG_EXIT_BORING;
+      bbr->recording = True;
+      trace_buf_resize(&bbr->buf);
+   }
+   return bbr;
+}
+
+/* Writes a DG_R_THREAD if the run about to be written is from a different
+ * thread to the last one.
+ */
+static void out_thread_switch(ThreadId tid)
+{
+   UChar payload[DG_MAX_UVARINT_BYTES];
+   UChar *p, *q;
+
+   if (tid == out_tid)
+      return;
+   p = encode_uvarint(payload, tid);
+   q = out_begin_record(DG_R_THREAD, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+   out_tid = tid;
+}
+
+/* Counts a run of bbr towards its context, with the accesses a reader
+ * decodes for it: the n_dynamic recorded and the static ones of the
+ * instructions it reached.
+ */
+static void context_count(const DgBBRun *bbr, ULong n_dynamic)
+{
+   const DgBBDef *bbd = bbr->bbdef;
+   UWord context_index = bbr->context_index;
+   Word n_static = bbd->n_static;
+
+   while (n_static > 0 && bbd->static_iseqs[n_static - 1] >= bbr->n_instrs)
+      n_static--;
+   if (context_index >= context_counts_size)
+   {
+      SizeT old_size = context_counts_size;
+
+      context_counts_size = old_size > 0 ? 2 * old_size : 1024;
+      while (context_counts_size <= context_index)
+         context_counts_size *= 2;
+      context_counts = VG_(realloc)("datagrind.context_counts", context_counts,
+                                    context_counts_size * sizeof(DgContextCount));
+      VG_(memset)(context_counts + old_size, 0,
+                  (context_counts_size - old_size) * sizeof(DgContextCount));
+   }
+   context_counts[context_index].runs++;
+   context_counts[context_index].accesses += n_dynamic + n_static;
+}
+
+/* Writes the DG_R_CONTEXT_COUNTS of the runs written since the last one,
+ * so that a reader can rank the contexts without decoding the runs.
+ * Written before each chunk record, for the chunk before it, and at exit.
+ */
+static void out_context_counts(void)
+{
+   UChar *payload, *p, *q;
+   UWord i, n = 0, next = 0;
+
+   if (!clo_datagrind_context_counts)
+      return;
+   for (i = 0; i < context_counts_size; i++)
+      if (context_counts[i].runs > 0)
+         n++;
+   if (n == 0)
+      return;
+
+   p = payload = VG_(malloc)("datagrind.context_counts.out", (1 + 3 * n) * 10);
+   p = encode_uvarint(p, n);
+   for (i = 0; i < context_counts_size; i++)
+      if (context_counts[i].runs > 0)
+      {
+         p = encode_uvarint(p, i - next);
+         p = encode_uvarint64(p, context_counts[i].runs);
+         p = encode_uvarint64(p, context_counts[i].accesses);
+         next = i + 1;
+      }
+   VG_(memset)(context_counts, 0, context_counts_size * sizeof(DgContextCount));
+   q = out_begin_record(DG_R_CONTEXT_COUNTS, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+   VG_(free)(payload);
+}
+
+/* Starts a chunk at the next run */
+static void start_chunk(void)
+{
+   out_context_counts();
+   DG_(index_start_chunk)(sample_instrs, out_tid,
+                          global_bbdef_index, global_context_index);
+}
+
+/* Does what is needed before writing a run of bbr: starting a chunk if
+ * one is due, restarting the deltas of its block in a new chunk, and
+ * switching thread.
+ */
+static void out_run_start(DgBBRun *bbr)
+{
+   DgBBDef *bbd = bbr->bbdef;
+
+   if (DG_(index_chunk_due)())
+      start_chunk();
+   if (bbd->chunk != DG_(index_chunk))
+   {
+      if (bbd->last_addrs != NULL)
+         VG_(memset)(bbd->last_addrs, 0, bbd->n_accesses * sizeof(HWord));
+      if (bbd->strides != NULL)
+         VG_(memset)(bbd->strides, 0, bbd->n_dynamic * sizeof(DgStride));
+      bbd->chunk = DG_(index_chunk);
+   }
+   out_thread_switch(bbr->tid);
+}
+
+/* Each address in a DG_R_BBRUN is stored as the zigzag varint of its
+ * difference from the address at the same position in the previous run of
+ * the block, which is usually a small stride.
+ */
+static inline UChar *encode_addr_delta(UChar *p, HWord *last, HWord addr)
+{
+   Word delta = (Word) (addr - *last);
+   *last = addr;
+   return encode_uvarint(p, ((HWord) delta << 1) ^ (HWord) (delta >> (VG_WORDSIZE * 8 - 1)));
+}
+
+/* Tracks the stride of a position, given its delta in a run. A position is
+ * strided once the same delta has come DG_STRIDE_MIN_HITS times in a row,
+ * and stays so until the delta changes. Each such break doubles the run
+ * of hits needed next time, up to a limit, so that irregular accesses that
+ * happen to repeat soon stop being tried. The reader keeps the same state
+ * from the deltas it decodes, so none of it is written.
+ */
+static inline Bool stride_held(const DgStride *s)
+{
+   return s->hits >= (DG_STRIDE_MIN_HITS << s->shift);
+}
+
+static inline void stride_update(DgStride *s, HWord delta)
+{
+   if (delta == s->delta)
+   {
+      if (s->hits < 255)
+         s->hits++;
+   }
+   else
+   {
+      if (stride_held(s) && s->shift < DG_STRIDE_MAX_SHIFT)
+         s->shift++;
+      s->delta = delta;
+      s->hits = 0;
+   }
+}
+
+/* Encodes the addresses of a run that has no indices, as a DG_R_BBRUN, or
+ * as a DG_R_BBRUN_STRIDED if any of its positions is strided. That lists
+ * the strided positions whose delta broke, and leaves out the addresses of
+ * the others.
+ */
+static UChar *encode_strided(DgBBDef *bbd, const DgTraceBuf *buf, UChar *p, UChar *type)
 {
-   if (bbr->n_instrs > 0)
+   Word n_slots = buf->pos - buf->base;
+   HWord *last = bbd->last_addrs;
+   DgStride *strides = bbd->strides;
+   Word i, next = 0, n_held = 0, n_breaks = 0;
+
+   for (i = 0; i < n_slots; i++)
+      if (stride_held(&strides[i]))
+      {
+         n_held++;
+         if (buf->base[i] - last[i] != strides[i].delta)
+            n_breaks++;
+      }
+   if (n_held > 0)
+   {
+      *type = DG_R_BBRUN_STRIDED;
+      p = encode_uvarint(p, (n_breaks << 1) | (n_slots != bbd->n_dynamic));
+      if (n_slots != bbd->n_dynamic)
+         p = encode_uvarint(p, n_slots);
+      for (i = 0; i < n_slots && n_breaks > 0; i++)
+         if (stride_held(&strides[i]) && buf->base[i] - last[i] != strides[i].delta)
+         {
+            p = encode_uvarint(p, i - next);
+            next = i + 1;
+            n_breaks--;
+         }
+   }
+   for (i = 0; i < n_slots; i++)
    {
-      UInt i;
-      Word n_accesses = VG_(sizeXA)(bbr->accesses);
-      ULong length = 1 + (1 + n_accesses) * sizeof(HWord);
+      HWord delta = buf->base[i] - last[i];
+
+      if (stride_held(&strides[i]) && delta == strides[i].delta)
+         last[i] = buf->base[i];
+      else
+         p = encode_addr_delta(p, &last[i], buf->base[i]);
+      stride_update(&strides[i], delta);
+   }
+   return p;
+}
+
+/* A loop body whose addresses advance by a constant stride encodes to the
+ * same payload on every iteration, since the addresses are deltas. If an
+ * identical run immediately follows, a DG_R_BBREPEAT counting the repeats
+ * is written instead, and is then updated in place while it is the last
+ * thing in the buffer.
+ */
+static UChar last_run_type;
+static SizeT last_run_pos;        /* Of last run's payload in DG_(out_buf) */
+static SizeT last_run_len;
+static SizeT last_run_end = 0;    /* DG_(out_buf_used) after it, and repeats */
+static ULong last_run_flushed = ~0ULL; /* DG_(out_flushed) when valid */
+static Bool last_run_repeated = False;
+
+/* Whether out_run would write the run as a repeat */
+static Bool out_run_repeats(UChar type, const UChar *payload, SizeT len)
+{
+   return DG_(out_flushed) == last_run_flushed
+          && DG_(out_buf_used) == last_run_end
+          && type == last_run_type
+          && len == last_run_len
+          && VG_(memcmp)(DG_(out_buf) + last_run_pos, payload, len) == 0;
+}
+
+static void out_run(UChar type, const UChar *payload, SizeT len)
+{
+   if (out_run_repeats(type, payload, len))
+   {
+      UChar *count = DG_(out_buf) + last_run_end - 1;
+
+      if (last_run_repeated && *count < 255)
+         (*count)++;
+      else
+      {
+         out_byte(DG_R_BBREPEAT);
+         out_byte(1);
+         last_run_repeated = True;
+      }
+      last_run_end = DG_(out_buf_used);
+      if (DG_(out_flushed) != last_run_flushed)
+         last_run_flushed = ~0ULL;
+      return;
+   }
+
+   out_end_record(put_bytes(out_begin_record(type, len), payload, len));
+   if (len <= DG_(out_buf_used))
+   {
+      last_run_type = type;
+      last_run_pos = DG_(out_buf_used) - len;
+      last_run_len = len;
+      last_run_end = DG_(out_buf_used);
+      last_run_flushed = DG_(out_flushed);
+      last_run_repeated = False;
+   }
+   else
+      last_run_flushed = ~0ULL;
+}
+
+/* With --datagrind-fork-files=yes, a child forked without exec writes a
+ * file of its own. It has the definitions of the parent and goes on
+ * numbering from them, so rather than writing them again its file starts
+ * with a DG_R_FORK_DEFS naming the parent's file and the part of it that
+ * holds them, and a new chunk so that the addresses start afresh. Only
+ * the definitions made after the fork are in the child's file.
+ */
+static void fork_parent(ThreadId tid)
+{
+   DG_(out_flush)();
+}
+
+static void fork_child(ThreadId tid)
+{
+   ULong parent_end = DG_(out_offset)();
+   HChar *parent = DG_(out_fork_child)();
+   SizeT len = VG_(strlen)(parent);
+   UChar *payload, *p;
+
+   out_header();
+   out_process();
+   if (simpoints != NULL)
+      out_simpoints();
+
+   p = payload = VG_(malloc)("datagrind.fork_defs", 4 * 10 + len + 1);
+   p = encode_uvarint(p, VG_(getppid)());
+   p = encode_uvarint64(p, parent_end);
+   p = encode_uvarint64(p, global_bbdef_index);
+   p = encode_uvarint64(p, global_context_index);
+   VG_(memcpy)(p, parent, len + 1);
+   p += len + 1;
+   out_byte(DG_R_FORK_DEFS);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+   VG_(free)(parent);
+
+   /* The parent's chunks are not this file's, nor its counts */
+   DG_(index_drop_before)(~0ULL);
+   if (context_counts != NULL)
+      VG_(memset)(context_counts, 0, context_counts_size * sizeof(DgContextCount));
+   last_run_flushed = ~0ULL;
+   out_tid = tid;
+   DG_(index_start_chunk)(sample_instrs, out_tid,
+                          global_bbdef_index, global_context_index);
+}
+
+/* Cache line size assumed by --datagrind-granularity=line and by the
+ * splitting of wide accesses for the analyses
+ */
+#define DG_LINE_SIZE     64
+
+/* Passes one access of a run to each analysis that wants it */
+static void trace_bb_count_access(const DgBBRun *bbr, Word n_accesses, Word i,
+                                  UChar dir, HWord addr, UChar size)
+{
+   if (DG_(clo_cache_sim))
+      DG_(cachesim_ref)(bbr->context_index, n_accesses, i, addr, size);
+   if (DG_(clo_tlb_sim))
+      DG_(tlbsim_ref)(bbr->context_index, n_accesses, i, addr, size);
+   if (DG_(clo_access_patterns))
+      DG_(patterns_ref)(bbr->context_index, n_accesses, i, addr, size);
+   if (DG_(clo_alloc_stats))
+      DG_(allocstats_access)(addr, size, dir);
+   if (DG_(clo_field_heat))
+      DG_(fieldheat_access)(addr, size, dir);
+   if (DG_(clo_affinity))
+      DG_(affinity_access)(addr);
+   if (DG_(clo_sharing))
+      DG_(sharing_access)(bbr->tid, bbr->context_index, addr, size, dir, sample_instrs);
+   if (DG_(clo_pages) || DG_(clo_first_touch))
+      DG_(pages_access)(bbr->tid, bbr->context_index, addr, dir, sample_instrs);
+   if (DG_(clo_wss_interval) > 0)
+      DG_(wss_access)(bbr->tid, addr, size, dir, sample_instrs);
+   if (DG_(clo_event_stats))
+      DG_(events_access)(bbr->tid, bbr->context_index, addr, size, dir);
+   if (clo_datagrind_mode == DG_MODE_HEATMAP)
+      DG_(heatmap_add)(bbr->context_index, addr, dir);
+   else if (clo_datagrind_mode == DG_MODE_REUSE)
+      DG_(reuse_add)(bbr->context_index, addr);
+   else if (clo_datagrind_mode == DG_MODE_RASTER)
+      DG_(raster_add)(addr, dir, sample_instrs);
+   if (DG_(clo_atomics) && dir == DG_ACC_ATOMIC)
+      DG_(atomics_access)(bbr->tid, bbr->context_index, addr, sample_instrs);
+}
+
+/* Passes the accesses of a run, including static ones, in program order
+ * to the cache and TLB simulations, access pattern classes, allocation
+ * statistics, field heat, affinity graph, sharing detection, page summary and working set
+ * sizes, and to the heat map, reuse distance measurement or raster.
+ */
+static void trace_bb_count(DgBBRun *bbr)
+{
+   DgTraceBuf *buf = &bbr->buf;
+   DgBBDef *bbd = bbr->bbdef;
+   Word n_slots = buf->pos - buf->base;
+   Word n_accesses = bbd->n_accesses;
+   Word i, slot = 0;
+   ULong reads = 0, writes = 0, read_bytes = 0, write_bytes = 0;
+
+   for (i = 0; i < n_accesses; i++)
+   {
+      const DgBBDefAccess *access = &bbd->access_list[i];
+      HWord addr;
+      UInt size;
+
+      if (access->dir & DG_ACC_STATIC)
+      {
+         if (access->iseq >= bbr->n_instrs)
+            continue;
+         addr = access->addr;
+      }
+      else if (slot < n_slots && buf->base[slot] == i)
+      {
+         addr = buf->base[slot + 1];
+         slot += 2;
+      }
+      else
+         continue;
+
+      /* Accesses wider than a line, such as the state area of an FXSAVE
+       * or XSAVE, are passed on a line at a time, so that each line is
+       * charged for its own bytes.
+       */
+      size = access->size;
+      do
+      {
+         UChar piece = size <= DG_LINE_SIZE ? size
+                       : DG_LINE_SIZE - (addr & (DG_LINE_SIZE - 1));
+
+         trace_bb_count_access(bbr, n_accesses, i, access->dir & ~DG_ACC_STATIC,
+                               addr, piece);
+         addr += piece;
+         size -= piece;
+      } while (size > 0);
+
+      if (DG_ACC_IS_WRITE(access->dir & ~DG_ACC_STATIC))
+      {
+         writes++;
+         write_bytes += access->size;
+      }
+      else
+      {
+         reads++;
+         read_bytes += access->size;
+      }
+      if (bbd->source_lines != NULL)
+         DG_(sources_access)(bbd->source_lines[i],
+                             DG_ACC_IS_WRITE(access->dir & ~DG_ACC_STATIC), access->size);
+   }
+   if (DG_(clo_xtree))
+      DG_(xtree_add)(bbr->context_index, reads, writes, read_bytes, write_bytes);
+   if (DG_(clo_wss_interval) > 0)
+      DG_(wss_run)(bbr->tid, bbr->n_instrs, sample_instrs);
+}
+
+/* With --datagrind-granularity=line, the accesses of a run that fall in
+ * the same cache line in the same direction are merged into the first of
+ * them, which then gives the line and the bytes of it that were touched.
+ * Only the last few lines of the run are searched, so that each access
+ * costs a bounded amount, which catches the usual run of neighbouring
+ * accesses from vector code or a structure copy. Loops often encode to
+ * repeats access by access but not line by line (as the masks move along
+ * the lines), so the run is only written this way when it is smaller.
+ */
+#define DG_LINE_SEARCH   4
+
+typedef struct
+{
+   HWord index;        /* Of the first access, in the definition */
+   HWord addr;         /* Of the line, or of the access if there is one */
+   ULong mask;         /* Bytes of the line touched */
+   UChar dir;
+   Bool merged;
+} DgLine;
+
+static DgLine *lines = NULL;
+static HWord *lines_last = NULL;    /* last_addrs of each access before */
+static UChar *lines_encoded = NULL;
+static SizeT lines_size = 0;        /* Accesses the arrays hold */
+static Word n_lines;
+
+static inline ULong line_mask(HWord offset, UChar size)
+{
+   return (size == DG_LINE_SIZE ? ~0ULL : (1ULL << size) - 1) << offset;
+}
+
+/* Encodes the DG_R_BBRUN_LINES payload of a run with indexed slots into
+ * lines_encoded, leaving last_addrs as it was. Returns its length, or 0
+ * if no accesses were merged.
+ */
+static SizeT encode_lines(DgBBRun *bbr)
+{
+   const DgTraceBuf *buf = &bbr->buf;
+   DgBBDef *bbd = bbr->bbdef;
+   HWord *last = bbd->last_addrs;
+   Word n_slots = buf->pos - buf->base;
+   Word i, j;
+   Bool any_merged = False;
+   HWord next = 0;
+   UChar *p;
+
+   if (lines_size < (SizeT) n_slots / 2)
+   {
+      lines_size = trace_buf_capacity / 2;
+      lines = VG_(realloc)("datagrind.lines", lines, lines_size * sizeof(DgLine));
+      lines_last = VG_(realloc)("datagrind.lines.last", lines_last,
+                                lines_size * sizeof(HWord));
+      lines_encoded = VG_(realloc)("datagrind.lines.encoded", lines_encoded,
+                                   DG_BBRUN_MAX_PAYLOAD(trace_buf_capacity));
+   }
+   n_lines = 0;
+   for (i = 0; i < n_slots; i += 2)
+   {
+      const DgBBDefAccess *access = &bbd->access_list[buf->base[i]];
+      HWord addr = buf->base[i + 1];
+      HWord line = addr & ~(HWord) (DG_LINE_SIZE - 1);
+      HWord offset = addr - line;
+      Bool crosses = offset + access->size > DG_LINE_SIZE;
+      DgLine *l = NULL;
+
+      lines_last[i / 2] = last[buf->base[i]];
+      /* Accesses that cross into the next line are kept whole */
+      if (!crosses)
+         for (j = n_lines - 1; j >= 0 && j >= n_lines - DG_LINE_SEARCH; j--)
+            if ((lines[j].addr & ~(HWord) (DG_LINE_SIZE - 1)) == line
+                && lines[j].dir == access->dir && lines[j].mask != 0)
+            {
+               l = &lines[j];
+               break;
+            }
+      if (l != NULL)
+      {
+         l->addr = line;
+         l->mask |= line_mask(offset, access->size);
+         l->merged = True;
+         any_merged = True;
+      }
+      else
+      {
+         l = &lines[n_lines++];
+         l->index = buf->base[i];
+         l->addr = addr;
+         l->mask = crosses ? 0 : line_mask(offset, access->size);
+         l->dir = access->dir;
+         l->merged = False;
+      }
+   }
+   if (!any_merged)
+      return 0;
+
+   p = encode_uvarint(lines_encoded, bbr->context_index);
+   p = encode_uvarint(p, bbr->n_instrs);
+   for (i = 0; i < n_lines; i++)
+   {
+      const DgLine *l = &lines[i];
+      HWord prev = last[l->index];
+
+      p = encode_uvarint(p, l->index - next);
+      p = encode_addr_delta(p, &prev, l->addr);
+      if (!l->merged)
+         *p++ = 0;
+      else
+      {
+         UInt lo = __builtin_ctzll(l->mask);
+         UInt len = 64 - lo - __builtin_clzll(l->mask);    /* Up to the last byte */
+
+         if ((l->mask >> lo) == (len == 64 ? ~0ULL : (1ULL << len) - 1))
+            p = encode_uvarint(p, (((lo << 6) | (len - 1)) << 1) | 1);
+         else
+         {
+            *p++ = 2;
+            p = encode_uvarint64(p, l->mask);
+         }
+      }
+      next = l->index + 1;
+   }
+   return p - lines_encoded;
+}
+
+/* Puts last_addrs as encode_lines leaves it, with the accesses that were
+ * merged away keeping their earlier addresses.
+ */
+static void apply_lines(DgBBRun *bbr)
+{
+   const DgTraceBuf *buf = &bbr->buf;
+   HWord *last = bbr->bbdef->last_addrs;
+   Word n_slots = buf->pos - buf->base;
+   Word i;
+
+   for (i = 0; i < n_slots; i += 2)
+      last[buf->base[i]] = lines_last[i / 2];
+   for (i = 0; i < n_lines; i++)
+      last[lines[i].index] = lines[i].addr;
+}
+
+/* Writes what the aggregates have gathered since the last checkpoint: the
+ * heat map and reuse distance counts, which are cleared, and the xtree,
+ * which is written whole to its own file. A DG_R_CHECKPOINT follows, with
+ * the instructions and time so far, and the buffer is flushed, so that a
+ * run that dies later still leaves everything up to it, and readers can
+ * follow a run as it goes.
+ */
+static void out_checkpoint(ULong now_usecs)
+{
+   UChar payload[2 * DG_MAX_UVARINT_BYTES];
+   UChar *p = payload;
+
+   DG_(heatmap_flush)();
+   DG_(reuse_flush)();
+   DG_(xtree_checkpoint)();
+   p = encode_uvarint64(p, sample_instrs);
+   p = encode_uvarint64(p, now_usecs > DG_(index_start_usecs)
+                           ? now_usecs - DG_(index_start_usecs) : 0);
+   out_byte(DG_R_CHECKPOINT);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   DG_(out_flush)();
+   stats_checkpoints++;
+}
+
+/* Called at the end of a run once sample_instrs reaches checkpoint_poll_at,
+ * to write a checkpoint if one is due and to decide when to look again.
+ */
+static void checkpoint_poll(void)
+{
+   ULong now_usecs = 0;
+   Bool due = False;
+
+   if (clo_datagrind_checkpoint_instrs > 0 && sample_instrs >= checkpoint_next_instrs)
+   {
+      due = True;
+      /* A run may be longer than the interval */
+      while (checkpoint_next_instrs <= sample_instrs)
+         checkpoint_next_instrs += clo_datagrind_checkpoint_instrs;
+   }
+   if (clo_datagrind_checkpoint_secs > 0 || due)
+      now_usecs = DG_(index_now_usecs)();
+   if (clo_datagrind_checkpoint_secs > 0 && now_usecs >= checkpoint_next_usecs)
+   {
+      due = True;
+      checkpoint_next_usecs = now_usecs + clo_datagrind_checkpoint_secs * 1000000ULL;
+   }
+   if (due)
+      out_checkpoint(now_usecs);
+
+   checkpoint_poll_at = clo_datagrind_checkpoint_secs > 0
+                        ? sample_instrs + DG_CHECKPOINT_POLL : ~0ULL;
+   if (clo_datagrind_checkpoint_instrs > 0 && checkpoint_next_instrs < checkpoint_poll_at)
+      checkpoint_poll_at = checkpoint_next_instrs;
+}
+
+/* Counts the instructions of a run of the SimPoint thread as exp-bbv
+ * does, where a rep-prefixed string instruction counts once however many
+ * times it iterates. Each iteration jumps back to it, so the iterations
+ * are the runs of blocks that start with it, after one that ends with it.
+ */
+static void simpoint_count(const DgBBRun *bbr)
+{
+   const DgBBDef *bbd = bbr->bbdef;
+   HWord n = bbr->n_instrs;
+
+   if (n == 0)
+      return;
+   if (bbd->rep_ip != 0 && n >= bbd->rep_first)
+   {
+      /* The iterations in the run count as one, or as none if the
+       * previous run ended in them too
+       */
+      n = bbd->rep_first - 1;
+      if (n > 0 || bbd->rep_ip != simpoint_rep_ip)
+         n++;
+      simpoint_rep_ip = bbd->rep_ip;
+   }
+   else
+      simpoint_rep_ip = 0;
+   simpoint_instrs += n;
+}
+
+/* When accesses may be left out at run time (by filtering, or by the
+ * stack or ignored range checks), a DG_R_BBRUN_FILTERED instead gives each
+ * address after the gap in access indices since the previous one, and runs
+ * with no accesses left are dropped altogether, unless the instruction
+ * fetches the runs imply are wanted.
+ */
+static void trace_bb_flush(DgBBRun *bbr)
+{
+   DgTraceBuf *buf = &bbr->buf;
+
+   if (bbr->n_instrs > 0 && bbr->recording)
+   {
+      Word n_slots = buf->pos - buf->base;
+      HWord *last = bbr->bbdef->last_addrs;
+      UChar *p = buf->encoded;
+      Word i;
+
+      if (counting)
+         trace_bb_count(bbr);
+      if (clo_datagrind_mode == DG_MODE_TRACE && indexed_slots)
+      {
+         if (n_slots > 0 || clo_datagrind_trace_instr)
+         {
+            HWord next = 0;
+            SizeT lines_len;
+            Word n_decoded = n_slots / 2;
+
+            out_run_start(bbr);
+            lines_len = clo_datagrind_lines ? encode_lines(bbr) : 0;
+            p = encode_uvarint(p, bbr->context_index);
+            p = encode_uvarint(p, bbr->n_instrs);
+            for (i = 0; i < n_slots; i += 2)
+            {
+               HWord index = buf->base[i];
+               p = encode_uvarint(p, index - next);
+               p = encode_addr_delta(p, &last[index], buf->base[i + 1]);
+               next = index + 1;
+            }
+            if (lines_len > 0 && lines_len < p - buf->encoded
+                && !out_run_repeats(DG_R_BBRUN_FILTERED, buf->encoded, p - buf->encoded))
+            {
+               apply_lines(bbr);
+               out_run(DG_R_BBRUN_LINES, lines_encoded, lines_len);
+               n_decoded = n_lines;
+            }
+            else
+               out_run(DG_R_BBRUN_FILTERED, buf->encoded, p - buf->encoded);
+            stats_runs++;
+            stats_addrs += n_slots / 2;
+            if (clo_datagrind_context_counts)
+               context_count(bbr, n_decoded);
+         }
+      }
+      else if (clo_datagrind_mode == DG_MODE_TRACE)
+      {
+         UChar type = DG_R_BBRUN;
+
+         out_run_start(bbr);
+         p = encode_uvarint(p, bbr->context_index);
+         p = encode_uvarint(p, bbr->n_instrs);
+         if (strided && n_slots > 0)
+            p = encode_strided(bbr->bbdef, buf, p, &type);
+         else
+            for (i = 0; i < n_slots; i++)
+               p = encode_addr_delta(p, &last[i], buf->base[i]);
+
+         out_run(type, buf->encoded, p - buf->encoded);
+         stats_runs++;
+         stats_addrs += n_slots;
+         if (clo_datagrind_context_counts)
+            context_count(bbr, n_slots);
+      }
+   }
+
+   /* Reset for next */
+   if (simpoints != NULL && bbr->tid == clo_datagrind_simpoint_thread)
+      simpoint_count(bbr);
+   sample_instrs += bbr->n_instrs;
+   bbr->n_instrs = 0;
+   buf->pos = buf->base;
+   if (sample_instrs >= checkpoint_poll_at)
+      checkpoint_poll();
+}
+
+/* Decides whether the next run is recorded. Runs are kept or dropped
+ * whole, so that every DG_R_BBRUN is complete. The burst boundaries are
+ * only checked at the start of a run, so bursts overshoot by up to a run.
+ */
+static Bool sample_next_run(void)
+{
+   if (clo_datagrind_burst_off > 0 && sample_instrs >= burst_end)
+   {
+      burst_on = !burst_on;
+      burst_end = sample_instrs + (burst_on ? clo_datagrind_burst_on
+                                            : clo_datagrind_burst_off);
+   }
+   if (!burst_on)
+      return False;
+   if (++sample_count < clo_datagrind_sample_rate)
+      return False;
+   sample_count = 0;
+   return True;
+}
+
+static void out_event(ThreadId tid, Bool start, const HChar *label);
+
+/* Writes the event labelled "simpoint <interval>" that brackets the runs
+ * of the current simulation point.
+ */
+static void out_simpoint_event(Bool start)
+{
+   HChar label[32];
+
+   VG_(sprintf)(label, "simpoint %llu", simpoints[simpoint_next].interval);
+   out_event(clo_datagrind_simpoint_thread, start, label);
+}
+
+/* Called once the SimPoint thread's count reaches simpoint_change, to end
+ * the simulation point being recorded, or start the next one if the count
+ * is in its interval. As with bursts, the boundaries are only checked at
+ * the start of a run.
+ */
+static void simpoint_advance(void)
+{
+   ULong interval = simpoint_instrs / clo_datagrind_simpoint_interval;
+
+   if (simpoint_on)
+   {
+      out_simpoint_event(False);
+      simpoint_on = False;
+      simpoint_next++;
+   }
+   while (simpoint_next < n_simpoints && simpoints[simpoint_next].interval < interval)
+      simpoint_next++;
+   if (simpoint_next == n_simpoints)
+      simpoint_change = ~0ULL;
+   else if (simpoints[simpoint_next].interval == interval)
+   {
+      /* The runs left out before it are not in a reader's count, which
+       * a chunk brings back in line with the events
+       */
+      start_chunk();
+      out_simpoint_event(True);
+      simpoint_on = True;
+      simpoint_change = (interval + 1) * clo_datagrind_simpoint_interval;
+   }
+   else
+      simpoint_change = simpoints[simpoint_next].interval * clo_datagrind_simpoint_interval;
+}
+
+static void dg_fini(Int exitcode);
+
+/* Called once sample_instrs reaches shard_change, to start recording the
+ * shard, or to end the trace and the program once it is over. Like
+ * intervals, shards start and end between runs.
+ */
+static void shard_advance(void)
+{
+   if (!shard_on)
+   {
+      /* The chunk gives the instructions fast-forwarded over */
+      start_chunk();
+      shard_on = True;
+      if (clo_datagrind_shard_index == clo_datagrind_shard_count - 1)
+         shard_change = ~0ULL;
+      else
+         shard_change = (clo_datagrind_shard_index + 1) * clo_datagrind_shard_instrs;
+   }
+   else
+   {
+      VG_(umsg)("Shard %lld/%lld ends after %llu instructions; exiting\n",
+                clo_datagrind_shard_index, clo_datagrind_shard_count, sample_instrs);
+      dg_fini(0);
+      VG_(exit)(0);
+   }
+}
+
+static Word cmp_frame_node(const void *a, const void *b)
+{
+   const DgFrameNode *fa = a;
+   const DgFrameNode *fb = b;
+   return fa->parent != fb->parent || fa->ret_addr != fb->ret_addr;
+}
+
+/* Returns the ID for the frame reached by calling from the frame parent,
+ * with return address ret_addr.
+ */
+static UWord shadow_frame_id(UWord parent, Addr ret_addr)
+{
+   DgFrameNode key, *node;
+
+   key.header.key = parent * 0x9e3779b1UL ^ ret_addr;
+   key.parent = parent;
+   key.ret_addr = ret_addr;
+   node = VG_(HT_gen_lookup)(frame_table, &key, cmp_frame_node);
+   if (node == NULL)
+   {
+      node = VG_(malloc)("datagrind.shadow_frame_id", sizeof(DgFrameNode));
+      *node = key;
+      node->frame_id = ++global_frame_id;
+      VG_(HT_add_node)(frame_table, node);
+   }
+   return node->frame_id;
+}
+
+/* Empties the stack, with the current activation as a new root. The root
+ * gets a fresh ID, so frame IDs from before are never confused with the
+ * frames that follow.
+ */
+static void shadow_stack_reroot(DgShadowStack *ss, Addr sp)
+{
+   ss->depth = ss->base;
+   ss->root_sp = sp;
+   ss->root_id = ++global_frame_id;
+   ss->root_toggled = False;
+   ss->n_toggled = ss->n_signals > 0 ? ss->signals[ss->n_signals - 1].n_toggled : 0;
+}
+
+/* Starts a signal handler on top of the current frames. Its root has no
+ * SP, since it only ends when the handler returns.
+ */
+static void shadow_stack_enter_signal(DgShadowStack *ss, Addr sp,
+                                      Addr alt_min, SizeT alt_size)
+{
+   DgSignalFrame *sf;
+
+   if (ss->n_signals == ss->signals_capacity)
+   {
+      ss->signals_capacity = ss->signals_capacity ? 2 * ss->signals_capacity : 4;
+      ss->signals = VG_(realloc)("datagrind.shadow_stack.signals", ss->signals,
+                                 ss->signals_capacity * sizeof(DgSignalFrame));
+   }
+   sf = &ss->signals[ss->n_signals++];
+   sf->depth = ss->depth;
+   sf->sp = sp;
+   sf->root_sp = ss->root_sp;
+   sf->root_id = ss->root_id;
+   sf->root_toggled = ss->root_toggled;
+   sf->n_toggled = ss->n_toggled;
+   sf->alt_min = alt_min;
+   sf->alt_size = alt_size;
+   ss->base = ss->depth;
+   shadow_stack_reroot(ss, 0);
+}
+
+/* Returns to the code interrupted by the innermost signal handler */
+static void shadow_stack_leave_signal(DgShadowStack *ss)
+{
+   const DgSignalFrame *sf = &ss->signals[--ss->n_signals];
+
+   ss->depth = sf->depth;
+   ss->root_sp = sf->root_sp;
+   ss->root_id = sf->root_id;
+   ss->root_toggled = sf->root_toggled;
+   ss->n_toggled = sf->n_toggled;
+   ss->base = ss->n_signals > 0 ? ss->signals[ss->n_signals - 1].depth : 0;
+}
+
+/* Pops frames that have been returned from, judging by the stack pointer,
+ * or at least min_pops frames whose SP matches (for a return on
+ * architectures where the return address is not on the stack). Returning
+ * out of the root means that the caller is unknown, so the stack is
+ * rerooted.
+ */
+static void shadow_stack_unwind(DgShadowStack *ss, Addr sp, Int min_pops)
+{
+   /* Rising above the interrupted code means the handler was left with
+    * longjmp rather than by returning. A handler on the alternate stack
+    * can be anywhere relative to it, so it must be off that stack as well,
+    * as after a siglongjmp out of a SIGSEGV handler on stack overflow.
+    */
+   while (ss->n_signals > 0)
+   {
+      const DgSignalFrame *sf = &ss->signals[ss->n_signals - 1];
+
+      if (sf->sp < sp && (sp < sf->alt_min || sp - sf->alt_min >= sf->alt_size))
+         shadow_stack_leave_signal(ss);
+      else
+         break;
+   }
+   while (ss->depth > ss->base)
+   {
+      const DgShadowFrame *top = &ss->frames[ss->depth - 1];
+      if (top->sp < sp || (top->sp == sp && min_pops > 0))
+      {
+         if (top->toggled)
+            ss->n_toggled--;
+         min_pops--;
+         ss->depth--;
+      }
+      else
+         return;
+   }
+   if (min_pops > 0 || (ss->root_sp != 0 && ss->root_sp < sp))
+      shadow_stack_reroot(ss, sp);
+}
+
+static void shadow_stack_push(DgShadowStack *ss, Addr sp, Addr ret_addr)
+{
+   UWord parent = ss->depth > 0 ? ss->frames[ss->depth - 1].frame_id : ss->root_id;
+
+   if (ss->depth == ss->capacity)
+   {
+      ss->capacity = ss->capacity ? 2 * ss->capacity : 64;
+      ss->frames = VG_(realloc)("datagrind.shadow_stack", ss->frames,
+                                ss->capacity * sizeof(DgShadowFrame));
+   }
+   ss->frames[ss->depth].sp = sp;
+   ss->frames[ss->depth].frame_id = shadow_frame_id(parent, ret_addr);
+   ss->frames[ss->depth].toggled = False;
+   ss->depth++;
+}
+
+/* Updates the shadow stack of the thread that ran the previous block, based
+ * on how it left the block. sp is the thread's stack pointer now.
+ */
+static void shadow_stack_exit(ThreadId tid, HWord exit_kind, Addr sp)
+{
+   DgShadowStack *ss = &shadow_stacks[tid];
+
+   if (exit_kind == DG_EXIT_RET)
+      shadow_stack_unwind(ss, sp, 1);
+   else if (exit_kind != DG_EXIT_BORING)
+   {
+      shadow_stack_unwind(ss, sp, 0);
+      shadow_stack_push(ss, sp, exit_kind);
+   }
+}
+
+/* Synchronises the shadow stack with the real stack pointer, to account
+ * for longjmp and exceptions, and returns the ID of the current frame.
+ */
+static UWord shadow_stack_sync(ThreadId tid, Addr sp)
+{
+   DgShadowStack *ss = &shadow_stacks[tid];
+
+   shadow_stack_unwind(ss, sp, 0);
+   return ss->depth > 0 ? ss->frames[ss->depth - 1].frame_id : ss->root_id;
+}
+
+/* Marks the current frame as having entered a toggle-collect function, so
+ * that collection stays on until it returns. A tail call into one reuses
+ * the frame of the caller.
+ */
+static void shadow_stack_toggle(DgShadowStack *ss)
+{
+   Bool *toggled = ss->depth > 0 ? &ss->frames[ss->depth - 1].toggled : &ss->root_toggled;
+
+   if (!*toggled)
+   {
+      *toggled = True;
+      ss->n_toggled++;
+   }
+}
+
+/* Whether str matches any of an XArray of patterns, which may be NULL */
+static Bool match_any(XArray *patterns, const HChar *str)
+{
+   Word i, n;
+
+   if (patterns == NULL)
+      return False;
+   n = VG_(sizeXA)(patterns);
+   for (i = 0; i < n; i++)
+   {
+      const HChar *pattern = *(const HChar **) VG_(indexXA)(patterns, i);
+      if (VG_(string_match)(pattern, str))
+         return True;
+   }
+   return False;
+}
+
+/* Whether addr is the entry point of a function matching one of the
+ * --datagrind-toggle-collect patterns.
+ */
+static Bool is_toggle_entry(Addr addr)
+{
+   const HChar *fnname;
+
+   if (clo_datagrind_toggle_collect == NULL
+       || !VG_(get_fnname_if_entry)(VG_(current_DiEpoch)(), addr, &fnname))
+      return False;
+   return match_any(clo_datagrind_toggle_collect, fnname);
+}
+
+/* Whether addr is code in an object matching --datagrind-ignore-objects,
+ * or in the preload when its replacements report bulk accesses.
+ */
+static Bool is_ignored_code(Addr addr)
+{
+   const DebugInfo *di;
+   const DgDebugInfo *node;
+
+   if (clo_datagrind_ignore_objects == NULL && !bulk)
+      return False;
+   di = VG_(find_DebugInfo)(VG_(current_DiEpoch)(), addr);
+   if (di == NULL)
+      return False;
+   node = VG_(HT_lookup)(debuginfo_table, (UWord) di);
+   return node != NULL && node->ignored;
+}
+
+/* Whether addr is listed by --datagrind-trace-ips */
+static Bool is_traced_ip(Addr addr)
+{
+   const HChar *file, *dir;
+   UInt line;
+   Word first, last;
+
+   if (VG_(lookupXA)(trace_ips, &addr, &first, &last))
+      return True;
+   if (trace_sites != NULL
+       && VG_(get_filename_linenum)(VG_(current_DiEpoch)(), addr, &file, &dir, &line))
+   {
+      HChar site[256];
+
+      VG_(snprintf)(site, sizeof(site), "%s:%u", file, line);
+      return match_any(trace_sites, site);
+   }
+   return False;
+}
+
+/* Whether any instruction of a block is listed by --datagrind-trace-ips */
+static Bool has_traced_ip(const IRSB *sb)
+{
+   Int i;
+
+   for (i = 0; i < sb->stmts_used; i++)
+   {
+      const IRStmt *st = sb->stmts[i];
+      if (st->tag == Ist_IMark && is_traced_ip(st->Ist.IMark.addr))
+         return True;
+   }
+   return False;
+}
+
+static inline Bool bbdef_live(ULong index)
+{
+   return (live_bbdefs[index >> 3] >> (index & 7)) & 1;
+}
+
+static inline SizeT context_hash(ULong bbdef, UWord id, Bool frame)
+{
+   ULong h = bbdef * 0x9E3779B97F4A7C15ULL ^ (ULong) id * 0xC2B2AE3D27D4EB4FULL ^ frame;
+   return (h ^ (h >> 29)) & (context_table_size - 1);
+}
+
+static DgBBDefContext *context_slot(ULong bbdef, UWord id, Bool frame)
+{
+   SizeT i = context_hash(bbdef, id, frame);
+
+   for (;;)
+   {
+      DgBBDefContext *e = &context_table[i];
+      if (e->bbdef == 0 || (e->bbdef == bbdef && e->id == id && e->frame == frame))
+         return e;
+      i = (i + 1) & (context_table_size - 1);
+   }
+}
+
+/* Rebuilds the table without the contexts of discarded blocks, at a size
+ * leaving it at most a quarter full.
+ */
+static void context_rehash(void)
+{
+   DgBBDefContext *old = context_table;
+   SizeT old_size = context_table_size;
+   SizeT live = 0, size = 1024, i;
+
+   for (i = 0; i < old_size; i++)
+      if (old[i].bbdef != 0 && bbdef_live(old[i].bbdef - 1))
+         live++;
+   while (size < 4 * (live + 1))
+      size *= 2;
+
+   context_table = VG_(calloc)("datagrind.context_table", size, sizeof(DgBBDefContext));
+   context_table_size = size;
+   context_table_used = live;
+   for (i = 0; i < old_size; i++)
+      if (old[i].bbdef != 0 && bbdef_live(old[i].bbdef - 1))
+         *context_slot(old[i].bbdef, old[i].id, old[i].frame) = old[i];
+   if (old != NULL)
+      VG_(free)(old);
+}
+
+static Bool find_context(DgBBDef *bbd, UWord id, Bool frame, UWord *context_index)
+{
+   const DgBBDefContext *e;
+
+   /* Nothing refers to a block before it is written */
+   if (!bbd->written)
+      return False;
+   if (bbd->has_last && bbd->last_id == id && bbd->last_frame == frame)
+   {
+      *context_index = bbd->last_context_index;
+      return True;
+   }
+   e = context_slot(bbd->index + 1, id, frame);
+   if (e->bbdef == 0)
+      return False;
+   bbd->last_id = id;
+   bbd->last_frame = frame;
+   bbd->last_context_index = e->context_index;
+   bbd->has_last = True;
+   *context_index = e->context_index;
+   return True;
+}
+
+static void add_context(DgBBDef *bbd, UWord id, Bool frame, UWord context_index)
+{
+   DgBBDefContext *e;
+
+   if (context_table_used + 1 > context_table_size / 2)
+      context_rehash();
+   e = context_slot(bbd->index + 1, id, frame);
+   tl_assert(e->bbdef == 0);
+   e->bbdef = bbd->index + 1;
+   e->id = id;
+   e->frame = frame;
+   e->context_index = context_index;
+   context_table_used++;
+   bbd->last_id = id;
+   bbd->last_frame = frame;
+   bbd->last_context_index = context_index;
+   bbd->has_last = True;
+}
+
+static void dg_bbdef_write(DgBBDef *bbd);
+
+/* Finds or allocates the context index for the current stack, by
+ * unwinding it. With --datagrind-context-depth, only that many frames are
+ * unwound, so deeper stacks that agree on them share a context; with 0 or
+ * 1 the block alone is the context and nothing is unwound. The guest
+ * state has the registers for unwinding from the start of the block, as
+ * dg_bbdef_add_instr arranges.
+ */
+static UWord bbdef_lookup_context(ThreadId tid, DgBBDef *bbd)
+{
+   static Addr ips[DG_MAX_CONTEXT_DEPTH];
+   ExeContext *ec = NULL;
+   UWord context_index;
+
+   if (clo_datagrind_context_depth >= 0 && clo_datagrind_context_depth <= 1)
+   {
+      if (find_context(bbd, 0, False, &context_index))
+         return context_index;
+      ips[0] = bbd->start_ip;
+      ec = VG_(make_ExeContext_from_StackTrace)(ips, 1);
+   }
+   else
+   {
+      if (clo_datagrind_context_depth < 0
+          || clo_datagrind_context_depth >= VG_(clo_backtrace_size))
+         ec = VG_(record_ExeContext)(tid, 0);
+      else
+      {
+         UInt n = VG_(get_StackTrace)(tid, ips, clo_datagrind_context_depth,
+                                      NULL, NULL, 0);
+         ec = VG_(make_ExeContext_from_StackTrace)(ips, n);
+      }
+      stats_unwinds++;
+   }
+   if (!find_context(bbd, (UWord) ec, False, &context_index))
+   {
+      Int n_ips = VG_(get_ExeContext_n_ips)(ec);
+      StackTrace stack = VG_(get_ExeContext_StackTrace)(ec);
+      UChar *p, *record;
+      Int i;
 
-      out_byte(DG_R_BBRUN);
-      out_length(length);
-      out_word(bbr->context_index);
-      out_byte(bbr->n_instrs);
-      for (i = 0; i < n_accesses; i++)
-         out_word(*(HWord *) VG_(indexXA)(bbr->accesses, i));
+      /* Every recorded run has a context, so this is its first */
+      if (!bbd->written)
+         dg_bbdef_write(bbd);
+      p = out_begin_record(DG_R_CONTEXT, uvarint_size(n_ips) + (1 + n_ips) * sizeof(HWord));
+      record = DG_(out_buf) + DG_(out_buf_used);
+      p = put_word(p, bbd->index);
+      p = encode_uvarint(p, n_ips);
+      for (i = 0; i < n_ips; i++)
+         p = put_word(p, stack[i]);
+      if (DG_(clo_defs_cache) == NULL || !DG_(defcache_record)(record, p, &context_index))
+      {
+         out_end_record(p);
+         context_index = global_context_index++;
+      }
 
-      /* Reset for next */
-      bbr->n_instrs = 0;
-      VG_(dropTailXA)(bbr->accesses, n_accesses);
+      add_context(bbd, clo_datagrind_context_depth >= 0 && clo_datagrind_context_depth <= 1
+                       ? 0 : (UWord) ec, False, context_index);
+      DG_(xtree_context)(context_index, ec);
+      return context_index;
    }
-   tl_assert(VG_(sizeXA)(bbr->accesses) == 0);
+   stats_unwind_hits++;
+   return context_index;
 }
 
-static VG_REGPARM(1) void trace_bb_start(DgBBDef *bbd)
+static VG_REGPARM(2) void trace_bb_start(DgBBDef *bbd, Addr sp)
 {
-   DgBBRun *bbr = &out_bbr;
+   DgBBRun *bbr = cur_bbr;
    ThreadId tid = VG_(get_running_tid)();
-   Addr ip = VG_(get_IP)(tid);
-   ExeContext *ec;
-   DgBBDefContext *ctx;
-
-   /* Flush out the old one before clobbering it */
-   trace_bb_flush(bbr);
+   Bool found = False;
+   UWord frame_id = 0, context_index = 0;
 
-   ec = VG_(record_ExeContext)(tid, bbd->start_ip - ip);
-   ctx = VG_(HT_lookup)(bbd->context_indices, (UWord) ec);
-   if (ctx == NULL)
+   stats_bb_starts++;
+   if (bbr != NULL)
    {
-      Int n_ips = VG_(get_ExeContext_n_ips)(ec);
-      StackTrace stack = VG_(get_ExeContext_StackTrace)(ec);
-      Int i;
-
-      if (n_ips > 255)
-         n_ips = 255;
-      out_byte(DG_R_CONTEXT);
-      out_length(1 + (1 + n_ips) * sizeof(HWord));
-      out_word(bbd->index);
-      out_byte((UChar) n_ips);
-      for (i = 0; i < n_ips; i++)
-         out_word(stack[i]);
+      /* The previous run is complete, since threads only switch between
+       * blocks.
+       */
+      /* Returning straight to the return address means that the callee
+       * was not instrumented, so it is as if there had been no call.
+       */
+      if (clo_datagrind_shadow_stack
+          && (bbr->tid != tid || bbr->exit_kind != bbd->start_ip))
+         shadow_stack_exit(bbr->tid, bbr->exit_kind,
+                           bbr->tid == tid ? sp : VG_(get_SP)(bbr->tid));
+      trace_bb_flush(bbr);
+   }
+   if (bbr == NULL || bbr->tid != tid)
+   {
+      cur_bbr = bbr = thread_bbr(tid);
+      /* A thread ID may be reused with a different stack */
+      if (clo_datagrind_ignore_stack)
+         bbr->stack_max = VG_(thread_get_stack_max)(tid);
+   }
 
-      ctx = VG_(calloc)("datagrind.trace_bb_start", 1, sizeof(DgBBDefContext));
-      ctx->header.key = (UWord) ec;
-      ctx->context_index = global_context_index++;
-      VG_(HT_add_node)(bbd->context_indices, ctx);
+   if (clo_datagrind_shadow_stack)
+   {
+      frame_id = shadow_stack_sync(tid, sp);
+      if (bbd->toggle)
+         shadow_stack_toggle(&shadow_stacks[tid]);
+      if (frame_contexts)
+      {
+         found = find_context(bbd, frame_id, True, &context_index);
+         if (found)
+            stats_frame_hits++;
+      }
    }
-   bbr->context_index = ctx->context_index;
-}
 
-static VG_REGPARM(1) void trace_access(Addr addr)
-{
-   VG_(addToXA)(out_bbr.accesses, &addr);
-}
+   bbr->bbdef = bbd;
+   bbr->exit_kind = DG_EXIT_BORING;
+   if (selective)
+   {
+      if (simpoints != NULL && tid == clo_datagrind_simpoint_thread
+          && simpoint_instrs >= simpoint_change)
+         simpoint_advance();
+      if (clo_datagrind_shard_count > 0 && sample_instrs >= shard_change)
+         shard_advance();
+      bbr->recording = (clo_datagrind_toggle_collect == NULL
+                        || shadow_stacks[tid].n_toggled > 0)
+                       && (simpoints == NULL || simpoint_on)
+                       && (clo_datagrind_shard_count == 0 || shard_on)
+                       && (!sampling || sample_next_run());
+      /* No context is needed, which saves unwinding the stack */
+      if (!bbr->recording)
+         return;
+   }
 
-static VG_REGPARM(1) void trace_update_instrs(HWord n_instrs)
-{
-   out_bbr.n_instrs = n_instrs;
+   if (!found)
+   {
+      context_index = bbdef_lookup_context(tid, bbd);
+      /* Only a real unwind establishes a context for this frame */
+      if (frame_contexts)
+         add_context(bbd, frame_id, True, context_index);
+   }
+   bbr->context_index = context_index;
 }
 
 static void clean_debuginfo(void)
 {
-   if (debuginfo_dirty)
+   if (debuginfo_dirty || debuginfo_pending > 0)
    {
       const DebugInfo *di = VG_(next_DebugInfo)(NULL);
 
-      for (; di != NULL; di = VG_(next_DebugInfo)(di))
+      for (; di != NULL && (debuginfo_dirty || debuginfo_pending > 0);
+           di = VG_(next_DebugInfo)(di))
       {
          const HChar *filename = VG_(DebugInfo_get_filename)(di);
          Addr text_avma = VG_(DebugInfo_get_text_avma)(di);
          SizeT filename_len = VG_(strlen)(filename);
 
-         if (!VG_(HT_lookup)(debuginfo_table, (UWord) di))
+         /* An object is put in the list when its first mapping is seen,
+          * and has no text until all of them have been.
+          */
+         if (VG_(DebugInfo_get_text_size)(di) > 0
+             && !VG_(HT_lookup)(debuginfo_table, (UWord) di))
          {
             DgDebugInfo *node = VG_(calloc)("debuginfo_table.node", 1, sizeof(DgDebugInfo));
             node->header.key = (UWord) di;
+            node->ignored = match_any(clo_datagrind_ignore_objects, filename)
+                            || (bulk && VG_(string_match)("*/vgpreload_exp-datagrind-*.so",
+                                                          filename));
             VG_(HT_add_node)(debuginfo_table, node);
+            if (node->ignored && VG_(clo_verbosity) > 1)
+               VG_(message)(Vg_DebugMsg, "Ignoring code in %s\n", filename);
 
             out_byte(DG_R_TEXT_AVMA);
             out_length(filename_len + sizeof(Addr) + 1);
             out_word(text_avma);
             out_bytes(filename, filename_len);
             out_byte('\0');
+            if (debuginfo_pending > 0)
+               debuginfo_pending--;
          }
       }
       debuginfo_dirty = False;
+      debuginfo_pending = 0;
    }
 }
 
@@ -350,125 +2611,628 @@ static DgBBDef* dg_bbdef_new(void)
    DgBBDef *bbd = VG_(malloc)("datagrind.bbdef", sizeof(DgBBDef));
    bbd->instrs = VG_(newXA)(VG_(malloc), "datagrind.bbdef.instrs", VG_(free), sizeof(DgBBDefInstr));
    bbd->accesses = VG_(newXA)(VG_(malloc), "datagrind.bbdef.accesses", VG_(free), sizeof(DgBBDefAccess));
-   bbd->context_indices = VG_(HT_construct)("datagrind.bbdef.context_indices");
+   bbd->has_last = False;
+   bbd->written = False;
+   bbd->access_list = NULL;
+   bbd->source_lines = NULL;
+   bbd->n_accesses = 0;
+   bbd->last_addrs = NULL;
+   bbd->strides = NULL;
+   bbd->n_dynamic = 0;
+   bbd->static_iseqs = NULL;
+   bbd->n_static = 0;
+   bbd->chunk = 0;
+   bbd->run = IRTemp_INVALID;
+   bbd->buf_pos_addr = IRTemp_INVALID;
+   bbd->buf_pos = IRTemp_INVALID;
+   bbd->recording = IRTemp_INVALID;
+   bbd->stack_max = IRTemp_INVALID;
+   bbd->toggle = False;
+   bbd->rep_ip = 0;
+   bbd->rep_first = 0;
+   bbd->rep_last = 0;
    return bbd;
 }
 
+/* Completes a def at the end of its instrumentation. It is written by
+ * dg_bbdef_write when it first runs.
+ */
 static void dg_bbdef_flush(DgBBDef *bbd)
 {
    Word n_instrs = VG_(sizeXA)(bbd->instrs);
-   Word n_accesses = VG_(sizeXA)(bbd->accesses);
-   ULong len = 1 + sizeof(HWord) + (1 + sizeof(HWord)) * n_instrs + 3 * n_accesses;
-   Word i;
 
    if (n_instrs == 0)
       return;
-   tl_assert(n_instrs <= 255);
+   trace_buf_reserve(VG_(sizeXA)(bbd->accesses));
+}
+
+static void dg_bbdef_write(DgBBDef *bbd)
+{
+   Word n_instrs = VG_(sizeXA)(bbd->instrs);
+   Word n_accesses = VG_(sizeXA)(bbd->accesses);
+   Word n_static = 0;
+   ULong len;
+   UChar *p, *record;
+   UWord cached_index;
+   Word i;
+
+   len = uvarint_size(n_instrs) + sizeof(HWord) + (1 + sizeof(HWord)) * n_instrs
+         + n_accesses;
+   for (i = 0; i < n_accesses; i++)
+   {
+      const DgBBDefAccess *access = VG_(indexXA)(bbd->accesses, i);
+      len += uvarint_size(access->size) + uvarint_size(access->iseq);
+      if (access->dir & DG_ACC_STATIC)
+         n_static++;
+   }
+   len += sizeof(HWord) * n_static;
 
-   out_byte(DG_R_BBDEF);
-   out_length(len);
-   out_byte(n_instrs);
-   out_word(n_accesses);
+   p = out_begin_record(DG_R_BBDEF, len);
+   record = DG_(out_buf) + DG_(out_buf_used);
+   p = encode_uvarint(p, n_instrs);
+   p = put_word(p, n_accesses);
    for (i = 0; i < n_instrs; i++)
    {
       DgBBDefInstr *instr = (DgBBDefInstr *) VG_(indexXA)(bbd->instrs, i);
-      out_word(instr->addr);
-      out_byte(instr->size);
+      p = put_word(p, instr->addr);
+      p = put_byte(p, instr->size);
+   }
+   for (i = 0; i < n_accesses; i++)
+   {
+      DgBBDefAccess *access = (DgBBDefAccess *) VG_(indexXA)(bbd->accesses, i);
+      p = put_byte(p, access->dir);
+      p = encode_uvarint(p, access->size);
+      p = encode_uvarint(p, access->iseq);
    }
    for (i = 0; i < n_accesses; i++)
    {
       DgBBDefAccess *access = (DgBBDefAccess *) VG_(indexXA)(bbd->accesses, i);
-      out_byte(access->dir);
-      out_byte(access->size);
-      out_byte(access->iseq);
+      if (access->dir & DG_ACC_STATIC)
+         p = put_word(p, access->addr);
+   }
+   if (DG_(clo_defs_cache) != NULL && DG_(defcache_record)(record, p, &cached_index))
+      bbd->index = cached_index;
+   else
+   {
+      out_end_record(p);
+      bbd->index = global_bbdef_index++;
    }
-   bbd->index = global_bbdef_index++;
+   bbd->written = True;
+   if ((bbd->index >> 3) >= live_bbdefs_size)
+   {
+      SizeT old_size = live_bbdefs_size;
 
-   /* Empty the arrays - we no longer need them */
-   VG_(dropTailXA)(bbd->instrs, n_instrs);
-   VG_(dropTailXA)(bbd->accesses, n_accesses);
+      live_bbdefs_size = old_size == 0 ? 1024 : 2 * old_size;
+      live_bbdefs = VG_(realloc)("datagrind.live_bbdefs", live_bbdefs, live_bbdefs_size);
+      VG_(memset)(live_bbdefs + old_size, 0, live_bbdefs_size - old_size);
+   }
+   live_bbdefs[bbd->index >> 3] |= 1 << (bbd->index & 7);
+   if (n_accesses > 0)
+   {
+      bbd->last_addrs = VG_(calloc)("datagrind.bbdef.last_addrs",
+                                    n_accesses, sizeof(HWord));
+      bbd->n_dynamic = n_accesses - n_static;
+      if (strided && bbd->n_dynamic > 0)
+         bbd->strides = VG_(calloc)("datagrind.bbdef.strides",
+                                    bbd->n_dynamic, sizeof(DgStride));
+      /* Only the access directions and static addresses are needed from
+       * here on, and only when counting accesses.
+       */
+      if (counting || clo_datagrind_lines)
+      {
+         bbd->access_list = VG_(malloc)("datagrind.bbdef.access_list",
+                                        n_accesses * sizeof(DgBBDefAccess));
+         VG_(memcpy)(bbd->access_list, VG_(indexXA)(bbd->accesses, 0),
+                     n_accesses * sizeof(DgBBDefAccess));
+      }
+      if (clo_datagrind_context_counts && n_static > 0)
+      {
+         bbd->static_iseqs = VG_(malloc)("datagrind.bbdef.static_iseqs",
+                                         n_static * sizeof(UInt));
+         for (i = 0; i < n_accesses; i++)
+         {
+            const DgBBDefAccess *access = VG_(indexXA)(bbd->accesses, i);
+            if (access->dir & DG_ACC_STATIC)
+               bbd->static_iseqs[bbd->n_static++] = access->iseq;
+         }
+      }
+      if (DG_(clo_source_stats))
+      {
+         bbd->source_lines = VG_(malloc)("datagrind.bbdef.source_lines",
+                                         n_accesses * sizeof(DgSourceLine *));
+         for (i = 0; i < n_accesses; i++)
+         {
+            const DgBBDefAccess *access = VG_(indexXA)(bbd->accesses, i);
+            const DgBBDefInstr *instr = VG_(indexXA)(bbd->instrs, access->iseq);
+            bbd->source_lines[i] = DG_(sources_lookup)(instr->addr);
+         }
+      }
+   }
+   bbd->n_accesses = n_accesses;
+   VG_(deleteXA)(bbd->instrs);
+   VG_(deleteXA)(bbd->accesses);
+   bbd->instrs = bbd->accesses = NULL;
 }
 
 static void dg_bbdef_delete(DgBBDef *bbd)
 {
-   VG_(deleteXA)(bbd->instrs);
-   VG_(deleteXA)(bbd->accesses);
-   VG_(HT_destruct)(bbd->context_indices, VG_(free));
+   if (bbd->instrs != NULL)
+   {
+      VG_(deleteXA)(bbd->instrs);
+      VG_(deleteXA)(bbd->accesses);
+   }
+   /* Leaves its contexts to be dropped by the next context_rehash */
+   if (bbd->written)
+      live_bbdefs[bbd->index >> 3] &= ~(1 << (bbd->index & 7));
+   if (bbd->access_list != NULL)
+      VG_(free)(bbd->access_list);
+   if (bbd->source_lines != NULL)
+      VG_(free)(bbd->source_lines);
+   if (bbd->static_iseqs != NULL)
+      VG_(free)(bbd->static_iseqs);
+   if (bbd->last_addrs != NULL)
+      VG_(free)(bbd->last_addrs);
+   if (bbd->strides != NULL)
+      VG_(free)(bbd->strides);
    VG_(free)(bbd);
 }
 
-/* Returns a new def if the old one had to be flushed */
-static DgBBDef* dg_bbdef_add_instr(IRSB *sbOut, DgBBDef *bbd, HWord addr, SizeT size)
+/* Returns an atom for the address of a field of the current run. */
+static IRExpr *dg_run_field(IRSB *sbOut, DgBBDef *bbd, SizeT offset)
 {
-   DgBBDefInstr instr;
+   IRTemp addr = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(addr, IRExpr_Binop(DG_IROP_ADD, IRExpr_RdTmp(bbd->run),
+                                                        mkIRExpr_HWord(offset))));
+   return IRExpr_RdTmp(addr);
+}
+
+/* Adds IR to update the instruction count and exit kind. Must be done
+ * before an exit from a block. Both are constants, so this is plain stores
+ * rather than a helper call, leaving trace_bb_start as the only helper per
+ * run.
+ */
+static void dg_bbdef_update_instrs(IRSB* sbOut, DgBBDef* bbd, IRJumpKind jk)
+{
+   SizeT n_instrs = VG_(sizeXA)(bbd->instrs);
+   HWord exit_kind = DG_EXIT_BORING;
+
+   tl_assert(n_instrs > 0);
+
+   if (jk == Ijk_Ret)
+      exit_kind = DG_EXIT_RET;
+   else if (jk == Ijk_Call)
+   {
+      const DgBBDefInstr *last = VG_(indexXA)(bbd->instrs, n_instrs - 1);
+      exit_kind = last->addr + last->size;
+      tl_assert(exit_kind != DG_EXIT_BORING && exit_kind != DG_EXIT_RET);
+   }
+
+   addStmtToIRSB(sbOut, IRStmt_Store(DG_IREND,
+                                     dg_run_field(sbOut, bbd, offsetof(DgBBRun, n_instrs)),
+                                     mkIRExpr_HWord(n_instrs)));
+   addStmtToIRSB(sbOut, IRStmt_Store(DG_IREND,
+                                     dg_run_field(sbOut, bbd, offsetof(DgBBRun, exit_kind)),
+                                     mkIRExpr_HWord(exit_kind)));
+}
 
-   if (VG_(sizeXA)(bbd->instrs) == 255)
+/* Whether the instruction is a rep-prefixed movs, cmps, scas, lods, stos,
+ * ins or outs, which exp-bbv counts once however many times it iterates.
+ * The prefixes are looked for as exp-bbv looks for them.
+ */
+static Bool is_rep_string(Addr addr, SizeT size)
+{
+#if defined(VGA_x86) || defined(VGA_amd64)
+   const UChar *p = (const UChar *) addr;
+   Bool rep = False;
+   SizeT i;
+
+   for (i = 0; i < size; i++)
    {
-      dg_bbdef_flush(bbd);
-      bbd = dg_bbdef_new();
+      if (p[i] == 0xf2 || p[i] == 0xf3)
+         rep = True;
+      else if (p[i] != 0x66 && p[i] != 0x67 && p[i] != 0x48)
+         break;
    }
+   return rep && i < size
+          && ((p[i] >= 0xa4 && p[i] <= 0xaf) || (p[i] >= 0x6c && p[i] <= 0x6f));
+#else
+   return False;
+#endif
+}
+
+/* Adds an instruction to the def. There is no limit on the number, since
+ * counts are varints in the trace, so an IRSB is only split into several
+ * defs by needs_flush.
+ */
+static void dg_bbdef_add_instr(IRSB *sbOut, const VexGuestLayout *layout,
+                               DgBBDef *bbd, HWord addr, SizeT size)
+{
+   DgBBDefInstr instr;
 
    if (VG_(sizeXA)(bbd->instrs) == 0)
    {
       /* Start of internal BB, so inject code to grab stack trace */
       IRDirty* di;
       IRExpr** argv;
+      IRTemp sp;
+      Int i;
 
       bbd->start_ip = addr;
-      argv = mkIRExprVec_1(mkIRExpr_HWord((HWord) bbd));
-      /* TODO: does this need to marked as reading guest state and memory, for
-       * stack unwinding?
+      bbd->toggle = is_toggle_entry(addr);
+      /* The stack pointer is passed for the shadow stack. Unwinding reads
+       * the guest state, so the helper is declared to read the registers
+       * it starts from, which keeps them up to date there, and the
+       * program counter, which VEX only writes at exits, is set to the
+       * block's. Without unwinding none of this is needed.
        */
-      di = unsafeIRDirty_0_N(1, "trace_bb_start",
+      sp = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+      addStmtToIRSB(sbOut, IRStmt_WrTmp(sp, IRExpr_Get(layout->offset_SP, DG_IRTY_WORD)));
+      argv = mkIRExprVec_2(mkIRExpr_HWord((HWord) bbd), IRExpr_RdTmp(sp));
+      di = unsafeIRDirty_0_N(2, "trace_bb_start",
                              VG_(fnptr_to_fnentry)(&trace_bb_start), argv);
+      if (clo_datagrind_context_depth < 0 || clo_datagrind_context_depth > 1)
+      {
+         addStmtToIRSB(sbOut, IRStmt_Put(layout->offset_IP, mkIRExpr_HWord(addr)));
+         di->nFxState = 3;
+         di->fxState[0].fx = Ifx_Read;
+         di->fxState[0].offset = layout->offset_SP;
+         di->fxState[0].size = layout->sizeof_SP;
+         di->fxState[1].fx = Ifx_Read;
+         di->fxState[1].offset = layout->offset_FP;
+         di->fxState[1].size = layout->sizeof_FP;
+         di->fxState[2].fx = Ifx_Read;
+         di->fxState[2].offset = layout->offset_IP;
+         di->fxState[2].size = layout->sizeof_IP;
+         for (i = 0; i < di->nFxState; i++)
+         {
+            di->fxState[i].nRepeats = 0;
+            di->fxState[i].repeatLen = 0;
+         }
+      }
       addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+
+      /* trace_bb_start switches the run and rewinds the buffer, so pick up
+       * both after it
+       */
+      bbd->run = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+      addStmtToIRSB(sbOut, IRStmt_WrTmp(bbd->run,
+                                        IRExpr_Load(DG_IREND, DG_IRTY_WORD,
+                                                    mkIRExpr_HWord((HWord) &cur_bbr))));
+      bbd->buf_pos_addr = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+      addStmtToIRSB(sbOut, IRStmt_WrTmp(bbd->buf_pos_addr,
+                                        dg_run_field(sbOut, bbd, offsetof(DgBBRun, buf.pos))));
+      bbd->buf_pos = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+      addStmtToIRSB(sbOut, IRStmt_WrTmp(bbd->buf_pos,
+                                        IRExpr_Load(DG_IREND, DG_IRTY_WORD,
+                                                    IRExpr_RdTmp(bbd->buf_pos_addr))));
+      if (selective)
+      {
+         IRTemp flag = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+         addStmtToIRSB(sbOut, IRStmt_WrTmp(flag,
+                                           IRExpr_Load(DG_IREND, DG_IRTY_WORD,
+                                                       dg_run_field(sbOut, bbd, offsetof(DgBBRun, recording)))));
+         bbd->recording = newIRTemp(sbOut->tyenv, Ity_I1);
+         addStmtToIRSB(sbOut, IRStmt_WrTmp(bbd->recording,
+                                           IRExpr_Binop(DG_IROP_CMPNE, IRExpr_RdTmp(flag),
+                                                        mkIRExpr_HWord(0))));
+      }
+      if (clo_datagrind_ignore_stack)
+      {
+         bbd->stack_max = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+         addStmtToIRSB(sbOut, IRStmt_WrTmp(bbd->stack_max,
+                                           IRExpr_Load(DG_IREND, DG_IRTY_WORD,
+                                                       dg_run_field(sbOut, bbd, offsetof(DgBBRun, stack_max)))));
+      }
    }
 
    tl_assert(size <= 255);
    instr.addr = addr;
    instr.size = (UChar) size;
    VG_(addToXA)(bbd->instrs, &instr);
-   return bbd;
+   if (simpoints != NULL)
+   {
+      if (!is_rep_string(addr, size))
+         bbd->rep_ip = 0;
+      else if (bbd->rep_ip != addr)
+      {
+         bbd->rep_ip = addr;
+         bbd->rep_first = VG_(sizeXA)(bbd->instrs);
+      }
+      bbd->rep_last = VG_(sizeXA)(bbd->instrs);
+   }
+}
+
+/* With --datagrind-ignore-stack, the temporaries of the IRSB being
+ * instrumented that hold SP plus or minus a constant. Accesses through them
+ * are known to be to the stack, and are dropped without any IR.
+ */
+static Bool *sp_tmps = NULL;
+static Int sp_offset;
+
+static Bool dg_is_sp_atom(IRExpr *e)
+{
+   return e->tag == Iex_RdTmp && sp_tmps[e->Iex.RdTmp.tmp];
+}
+
+/* Whether e, the right hand side of a WrTmp, is SP plus or minus a constant */
+static Bool dg_is_sp_expr(IRExpr *e)
+{
+   switch (e->tag)
+   {
+   case Iex_Get:
+      return e->Iex.Get.offset == sp_offset && e->Iex.Get.ty == DG_IRTY_WORD;
+   case Iex_RdTmp:
+      return dg_is_sp_atom(e);
+   case Iex_Binop:
+      if (e->Iex.Binop.op == DG_IROP_ADD)
+         return (dg_is_sp_atom(e->Iex.Binop.arg1) && e->Iex.Binop.arg2->tag == Iex_Const)
+            || (dg_is_sp_atom(e->Iex.Binop.arg2) && e->Iex.Binop.arg1->tag == Iex_Const);
+      if (e->Iex.Binop.op == DG_IROP_SUB)
+         return dg_is_sp_atom(e->Iex.Binop.arg1) && e->Iex.Binop.arg2->tag == Iex_Const;
+      return False;
+   default:
+      return False;
+   }
+}
+
+/* Returns an Ity_I1 atom that is true if addr is not on the stack of the
+ * current thread, meaning not in [SP - redzone, stack_max).
+ */
+static IRExpr *dg_stack_guard(IRSB *sbOut, DgBBDef *bbd, IRExpr *addr)
+{
+   IRTemp sp = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp lo = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp offset = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp len = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp outside = newIRTemp(sbOut->tyenv, Ity_I1);
+
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(sp, IRExpr_Get(sp_offset, DG_IRTY_WORD)));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(lo, IRExpr_Binop(DG_IROP_SUB, IRExpr_RdTmp(sp),
+                                                      mkIRExpr_HWord(VG_STACK_REDZONE_SZB))));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(offset, IRExpr_Binop(DG_IROP_SUB, addr,
+                                                          IRExpr_RdTmp(lo))));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(len, IRExpr_Binop(DG_IROP_SUB, IRExpr_RdTmp(bbd->stack_max),
+                                                       IRExpr_RdTmp(lo))));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(outside, IRExpr_Binop(DG_IROP_CMPLEU, IRExpr_RdTmp(len),
+                                                           IRExpr_RdTmp(offset))));
+   return IRExpr_RdTmp(outside);
+}
+
+/* Adds to the guard of a statement, which may be NULL, the conditions
+ * under which an access to the address in addr_tmp is recorded.
+ */
+static IRExpr *dg_access_guard(IRSB *sbOut, DgBBDef *bbd, IRTemp addr_tmp, SizeT size,
+                               IRExpr *guard)
+{
+   if (clo_datagrind_ignore_stack)
+      guard = DG_(and_guards)(sbOut, guard,
+                              dg_stack_guard(sbOut, bbd, IRExpr_RdTmp(addr_tmp)));
+   guard = DG_(and_guards)(sbOut, guard, DG_(ignore_guard)(sbOut, IRExpr_RdTmp(addr_tmp)));
+   if (DG_(clo_filter) == DG_FILTER_TRACKED)
+   {
+      guard = DG_(and_guards)(sbOut, guard,
+                              DG_(filter_guard)(sbOut, IRExpr_RdTmp(addr_tmp), size));
+   }
+   if (bbd->recording != IRTemp_INVALID)
+      guard = DG_(and_guards)(sbOut, guard, IRExpr_RdTmp(bbd->recording));
+   return guard;
 }
 
+/* Emits inline IR to append an address to the trace buffer:
+ *
+ *   *buf_pos = addr;
+ *   buf_pos += sizeof(HWord);
+ *   cur_bbr->buf.pos = buf_pos;
+ *
+ * If there is a guard, the stores are StoreGs and the increment is an ITE
+ * on the guard, so that skipped accesses leave no entry. When recording
+ * selectively, the guard also includes whether the run is recorded, and when
+ * filtering, whether the access passes the filter. Filtered accesses are
+ * preceded by their index.
+ *
+ * An unguarded access to a constant address, such as a global after VEX has
+ * folded a RIP-relative address, is the same in every run. It is given in
+ * the DG_R_BBDEF instead, and needs no IR at all. This is not done when
+ * filtering, since whether it passes can change between runs.
+ *
+ * With --datagrind-ignore-stack, an access through an SP-derived
+ * temporary is dropped altogether, and for any other the guard also
+ * checks that it is not to the stack. Likewise for --datagrind-ignore-ranges,
+ * except that only constant addresses can be dropped up front. With
+ * --datagrind-trace-ips, the accesses of unlisted instructions are dropped.
+ *
+ * These are ordinary loads, stores and adds, so the backend already emits
+ * them inline with no caller-saved registers spilled. There is no overflow
+ * check per access either: trace_buf_reserve sizes the buffer for the
+ * largest block at translation time, and it is drained by the next
+ * trace_bb_start, the block's only helper call. A
+ * dedicated VEX append primitive would have nothing left to remove.
+ */
 static void dg_bbdef_add_access(IRSB *sbOut, DgBBDef *bbd, UChar dir, IRExpr *addr, SizeT size,
                                 IRExpr *guard)
 {
    SizeT n_instrs = VG_(sizeXA)(bbd->instrs);
    DgBBDefAccess access;
-   IRDirty* di;
-   IRExpr** argv;
+   IRTemp addr_tmp, next_pos;
+   IRExpr *next;
+   IRExpr *slots[2];
+   Int n_slots = 0, i;
 
    tl_assert(n_instrs > 0);
-   tl_assert(size <= 255);
+   tl_assert(size > 0 && size <= 0xFFFFFFFF);
+   tl_assert(bbd->buf_pos != IRTemp_INVALID);
    access.dir = dir;
    access.size = size;
    access.iseq = n_instrs - 1;
+   access.addr = 0;
+   if (!instr_traced)
+      return;
+   if (clo_datagrind_ignore_stack && dg_is_sp_atom(addr))
+      return;
+   if (addr->tag == Iex_Const && guard == NULL
+       && DG_(clo_filter) != DG_FILTER_TRACKED)
+   {
+      access.dir |= DG_ACC_STATIC;
+      access.addr = VG_WORDSIZE == 8 ? (HWord) addr->Iex.Const.con->Ico.U64
+                                     : (HWord) addr->Iex.Const.con->Ico.U32;
+      if (!DG_(is_ignored)(access.addr))
+         VG_(addToXA)(bbd->accesses, &access);
+      return;
+   }
    VG_(addToXA)(bbd->accesses, &access);
 
-   argv = mkIRExprVec_1(addr);
-   di = unsafeIRDirty_0_N(1, "trace_access",
-                          VG_(fnptr_to_fnentry)(&trace_access), argv);
+   /* The address may be an arbitrary expression, but IR for stores and ITE
+    * requires atoms.
+    */
+   addr_tmp = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(addr_tmp, addr));
+   guard = dg_access_guard(sbOut, bbd, addr_tmp, size, guard);
+   if (indexed_slots)
+      slots[n_slots++] = mkIRExpr_HWord(VG_(sizeXA)(bbd->accesses) - 1);
+   slots[n_slots++] = IRExpr_RdTmp(addr_tmp);
+
+   for (i = 0; i < n_slots; i++)
+   {
+      IRExpr *slot_addr = IRExpr_RdTmp(bbd->buf_pos);
+      if (i > 0)
+      {
+         IRTemp tmp = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+         addStmtToIRSB(sbOut, IRStmt_WrTmp(tmp, IRExpr_Binop(DG_IROP_ADD, slot_addr,
+                                                             mkIRExpr_HWord(i * sizeof(HWord)))));
+         slot_addr = IRExpr_RdTmp(tmp);
+      }
+      if (guard)
+         addStmtToIRSB(sbOut, IRStmt_StoreG(DG_IREND, slot_addr, slots[i], guard));
+      else
+         addStmtToIRSB(sbOut, IRStmt_Store(DG_IREND, slot_addr, slots[i]));
+   }
+
+   next_pos = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   next = IRExpr_Binop(DG_IROP_ADD, IRExpr_RdTmp(bbd->buf_pos),
+                       mkIRExpr_HWord(n_slots * sizeof(HWord)));
    if (guard)
-       di->guard = guard;
-   addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+   {
+      addStmtToIRSB(sbOut, IRStmt_WrTmp(next_pos, next));
+      next = IRExpr_ITE(guard, IRExpr_RdTmp(next_pos), IRExpr_RdTmp(bbd->buf_pos));
+      next_pos = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   }
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(next_pos, next));
+   addStmtToIRSB(sbOut, IRStmt_Store(DG_IREND, IRExpr_RdTmp(bbd->buf_pos_addr),
+                                     IRExpr_RdTmp(next_pos)));
+   bbd->buf_pos = next_pos;
+}
+
+static VG_REGPARM(3) void trace_store_value(HWord size, HWord lo, HWord hi)
+{
+   ULong value = VG_WORDSIZE == 8 ? lo : ((ULong) hi << 32) | lo;
+
+   DG_(values_store)(cur_bbr->context_index, value, size);
+}
+
+/* Binds a piece of stored data, converted by op, to a temporary */
+static IRExpr *dg_value_piece(IRSB *sbOut, IRExpr *data, IROp op)
+{
+   IRType dst, arg1, arg2, arg3, arg4;
+   IRTemp tmp;
+
+   typeOfPrimop(op, &dst, &arg1, &arg2, &arg3, &arg4);
+   tmp = newIRTemp(sbOut->tyenv, dst);
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(tmp, IRExpr_Unop(op, data)));
+   return IRExpr_RdTmp(tmp);
 }
 
-/* Adds IR to update the instruction count. Must be done before an exit
- * from a block.
+/* With --datagrind-value-stats, passes the data of a store to the value
+ * statistics under the same conditions as its address is recorded, with a
+ * call for each 8-byte piece of a wider store. Decimal and 128-bit float
+ * stores are not counted.
  */
-static void dg_bbdef_update_instrs(IRSB* sbOut, DgBBDef* bbd)
+static void dg_bbdef_add_value(IRSB *sbOut, DgBBDef *bbd, IRExpr *addr, IRExpr *data,
+                               IRExpr *guard)
 {
-   IRDirty* di;
-   IRExpr** argv;
-   SizeT n_instrs = VG_(sizeXA)(bbd->instrs);
+   IRType ty = typeOfIRExpr(sbOut->tyenv, data);
+   IRExpr *pieces[4];
+   Int n_pieces = 1, i;
+   UInt piece_size;
+   IRTemp addr_tmp;
 
-   tl_assert(n_instrs > 0);
+   if (!instr_traced)
+      return;
+   if (clo_datagrind_ignore_stack && dg_is_sp_atom(addr))
+      return;
+   switch (ty)
+   {
+   case Ity_I8:
+   case Ity_I16:
+   case Ity_I32:
+   case Ity_I64:
+      pieces[0] = data;
+      break;
+   case Ity_F32:
+      pieces[0] = dg_value_piece(sbOut, data, Iop_ReinterpF32asI32);
+      break;
+   case Ity_F64:
+      pieces[0] = dg_value_piece(sbOut, data, Iop_ReinterpF64asI64);
+      break;
+   case Ity_I128:
+      pieces[0] = dg_value_piece(sbOut, data, Iop_128to64);
+      pieces[1] = dg_value_piece(sbOut, data, Iop_128HIto64);
+      n_pieces = 2;
+      break;
+   case Ity_V128:
+      pieces[0] = dg_value_piece(sbOut, data, Iop_V128to64);
+      pieces[1] = dg_value_piece(sbOut, data, Iop_V128HIto64);
+      n_pieces = 2;
+      break;
+   case Ity_V256:
+      pieces[0] = dg_value_piece(sbOut, data, Iop_V256to64_0);
+      pieces[1] = dg_value_piece(sbOut, data, Iop_V256to64_1);
+      pieces[2] = dg_value_piece(sbOut, data, Iop_V256to64_2);
+      pieces[3] = dg_value_piece(sbOut, data, Iop_V256to64_3);
+      n_pieces = 4;
+      break;
+   default:
+      return;
+   }
+   piece_size = sizeofIRType(ty) / n_pieces;
+
+   addr_tmp = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(addr_tmp, addr));
+   guard = dg_access_guard(sbOut, bbd, addr_tmp, sizeofIRType(ty), guard);
 
-   argv = mkIRExprVec_1(mkIRExpr_HWord(n_instrs));
-   di = unsafeIRDirty_0_N(1, "trace_update_instrs",
-                          VG_(fnptr_to_fnentry)(&trace_update_instrs), argv);
-   addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+   for (i = 0; i < n_pieces; i++)
+   {
+      IRExpr *piece = pieces[i];
+      IRExpr *lo, *hi = mkIRExpr_HWord(0);
+      IRDirty *di;
+
+#if VG_WORDSIZE == 8
+      switch (piece_size)
+      {
+      case 1: lo = dg_value_piece(sbOut, piece, Iop_8Uto64); break;
+      case 2: lo = dg_value_piece(sbOut, piece, Iop_16Uto64); break;
+      case 4: lo = dg_value_piece(sbOut, piece, Iop_32Uto64); break;
+      default: lo = piece; break;
+      }
+#else
+      switch (piece_size)
+      {
+      case 1: lo = dg_value_piece(sbOut, piece, Iop_8Uto32); break;
+      case 2: lo = dg_value_piece(sbOut, piece, Iop_16Uto32); break;
+      case 4: lo = piece; break;
+      default:
+         lo = dg_value_piece(sbOut, piece, Iop_64to32);
+         hi = dg_value_piece(sbOut, piece, Iop_64HIto32);
+         break;
+      }
+#endif
+      di = unsafeIRDirty_0_N(3, "trace_store_value",
+                             VG_(fnptr_to_fnentry)(&trace_store_value),
+                             mkIRExprVec_3(mkIRExpr_HWord(piece_size), lo, hi));
+      if (guard != NULL)
+         di->guard = guard;
+      addStmtToIRSB(sbOut, IRStmt_Dirty(di));
+   }
 }
 
 static DgSB* dg_sb_new(UWord key)
@@ -482,6 +3246,52 @@ static DgSB* dg_sb_new(UWord key)
    return dgsb;
 }
 
+static DgHotness *hot_lookup(Addr nraddr)
+{
+   DgHotness *node = VG_(HT_lookup)(hot_table, nraddr);
+
+   if (node == NULL)
+   {
+      node = VG_(malloc)("datagrind.hotness", sizeof(DgHotness));
+      node->header.key = nraddr;
+      node->count = 0;
+      VG_(HT_add_node)(hot_table, node);
+   }
+   return node;
+}
+
+/* Counts the runs of a superblock that is on the first side of
+ * --datagrind-hot-threshold. The run that reaches the threshold leaves
+ * before any guest code, through an icache invalidation of the block's
+ * first extent, so that the core discards the translation (which it can
+ * not be asked to do from a helper) and translates it again from the
+ * start.
+ */
+static void add_hot_counter(IRSB *sbOut, DgHotness *node, const VexGuestExtents *vge,
+                            Addr nraddr, Int offset_IP)
+{
+   IRExpr *addr = mkIRExpr_HWord((HWord) &node->count);
+   IRTemp count = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp next = newIRTemp(sbOut->tyenv, DG_IRTY_WORD);
+   IRTemp hit = newIRTemp(sbOut->tyenv, Ity_I1);
+
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(count, IRExpr_Load(DG_IREND, DG_IRTY_WORD, addr)));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(next, IRExpr_Binop(DG_IROP_ADD, IRExpr_RdTmp(count),
+                                                        mkIRExpr_HWord(1))));
+   addStmtToIRSB(sbOut, IRStmt_Store(DG_IREND, addr, IRExpr_RdTmp(next)));
+   addStmtToIRSB(sbOut, IRStmt_WrTmp(hit, IRExpr_Binop(DG_IROP_CMPEQ, IRExpr_RdTmp(next),
+                                                       mkIRExpr_HWord(clo_datagrind_hot_threshold))));
+   /* Only read by the exit, so they can be set on every run */
+   addStmtToIRSB(sbOut, IRStmt_Put(offsetof(VexGuestArchState, guest_CMSTART),
+                                   mkIRExpr_HWord(vge->base[0])));
+   addStmtToIRSB(sbOut, IRStmt_Put(offsetof(VexGuestArchState, guest_CMLEN),
+                                   mkIRExpr_HWord(vge->len[0])));
+   addStmtToIRSB(sbOut, IRStmt_Exit(IRExpr_RdTmp(hit), Ijk_InvalICache,
+                                    VG_WORDSIZE == 8 ? IRConst_U64(nraddr)
+                                                     : IRConst_U32(nraddr),
+                                    offset_IP));
+}
+
 static IRSB* dg_instrument(VgCallbackClosure* closure,
                            IRSB* sbIn,
                            const VexGuestLayout* layout,
@@ -494,6 +3304,7 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
    DgBBDef *bbd;
    DgSB *dgsb;
    Bool needs_flush = False;
+   DgHotness *hot = NULL;
 
    if (gWordTy != hWordTy)
    {
@@ -501,15 +3312,56 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
       VG_(tool_panic)("host/guest word size mismatch");
    }
 
+   if (!instrument_state)
+      return sbIn;
+
    clean_debuginfo();
+   /* Runs are not recorded, and the shadow stack catches up using SP */
+   if (is_ignored_code(closure->nraddr))
+      return sbIn;
+   /* Likewise for blocks with none of --datagrind-trace-ips */
+   if (trace_ips != NULL && !has_traced_ip(sbIn))
+      return sbIn;
+   if (clo_datagrind_mode == DG_MODE_COUNT)
+      return DG_(counts_instrument)(sbIn, closure->nraddr);
+
+   if (hot_table != NULL)
+   {
+      hot = hot_lookup(closure->nraddr);
+      if (hot->count >= clo_datagrind_hot_threshold)
+      {
+         stats_hot_switches++;
+         /* No more counting is needed on this side */
+         if (!clo_datagrind_trace_hot)
+            return sbIn;
+         hot = NULL;
+      }
+      else if (clo_datagrind_trace_hot)
+      {
+         sbOut = deepCopyIRSBExceptStmts(sbIn);
+         for (i = 0; i < sbIn->stmts_used && sbIn->stmts[i]->tag != Ist_IMark; i++)
+            addStmtToIRSB(sbOut, sbIn->stmts[i]);
+         add_hot_counter(sbOut, hot, vge, closure->nraddr, layout->offset_IP);
+         for (; i < sbIn->stmts_used; i++)
+            addStmtToIRSB(sbOut, sbIn->stmts[i]);
+         return sbOut;
+      }
+   }
 
    sbOut = deepCopyIRSBExceptStmts(sbIn);
+   if (clo_datagrind_ignore_stack)
+   {
+      sp_offset = layout->offset_SP;
+      sp_tmps = VG_(calloc)("datagrind.sp_tmps", sbIn->tyenv->types_used, sizeof(Bool));
+   }
 
    /* Copy preamble */
    for (i = 0; i < sbIn->stmts_used && sbIn->stmts[i]->tag != Ist_IMark; i++)
    {
       addStmtToIRSB(sbOut, sbIn->stmts[i]);
    }
+   if (hot != NULL)
+      add_hot_counter(sbOut, hot, vge, closure->nraddr, layout->offset_IP);
 
    dgsb = dg_sb_new(closure->nraddr);
    bbd = dg_bbdef_new();
@@ -530,34 +3382,28 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
             addStmtToIRSB(sbOut, st);
             break;
          case Ist_Exit:
-            dg_bbdef_update_instrs(sbOut, bbd);
+            dg_bbdef_update_instrs(sbOut, bbd, st->Ist.Exit.jk);
             /* TODO: needed when crossing function boundaries */
             /* needs_flush = True; */
             addStmtToIRSB(sbOut, st);
             break;
          case Ist_IMark:
+            if (needs_flush)
             {
-               DgBBDef *bbd_new;
-               if (needs_flush)
-               {
-                  dg_bbdef_flush(bbd);
-                  bbd = dg_bbdef_new();
-                  VG_(addToXA)(dgsb->bbdefs, &bbd);
-                  needs_flush = False;
-               }
-               addStmtToIRSB(sbOut, st);
-               bbd_new = dg_bbdef_add_instr(sbOut, bbd, st->Ist.IMark.addr, st->Ist.IMark.len);
-               if (bbd_new != bbd)
-               {
-                  /* It was flushed by add_instr */
-                  VG_(addToXA)(dgsb->bbdefs, &bbd_new);
-                  bbd = bbd_new;
-               }
+               dg_bbdef_flush(bbd);
+               bbd = dg_bbdef_new();
+               VG_(addToXA)(dgsb->bbdefs, &bbd);
+               needs_flush = False;
             }
+            addStmtToIRSB(sbOut, st);
+            dg_bbdef_add_instr(sbOut, layout, bbd, st->Ist.IMark.addr, st->Ist.IMark.len);
+            instr_traced = trace_ips == NULL || is_traced_ip(st->Ist.IMark.addr);
             break;
          case Ist_WrTmp:
             {
                IRExpr* data = st->Ist.WrTmp.data;
+               if (sp_tmps != NULL)
+                  sp_tmps[st->Ist.WrTmp.tmp] = dg_is_sp_expr(data);
                if (data->tag == Iex_Load)
                {
                   dg_bbdef_add_access(sbOut, bbd, DG_ACC_READ,
@@ -575,6 +3421,8 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
                                    st->Ist.Store.addr,
                                    sizeofIRType(typeOfIRExpr(sbOut->tyenv, data)),
                                    NULL);
+               if (DG_(clo_value_stats))
+                  dg_bbdef_add_value(sbOut, bbd, st->Ist.Store.addr, data, NULL);
             }
             addStmtToIRSB(sbOut, st);
             break;
@@ -604,8 +3452,29 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
                dataSize = sizeofIRType(typeOfIRExpr(sbOut->tyenv, cas->dataLo));
                if (cas->dataHi != NULL)
                   dataSize *= 2;
-               dg_bbdef_add_access(sbOut, bbd, DG_ACC_READ, cas->addr, dataSize, NULL);
-               dg_bbdef_add_access(sbOut, bbd, DG_ACC_WRITE, cas->addr, dataSize, NULL);
+               dg_bbdef_add_access(sbOut, bbd, DG_ACC_ATOMIC, cas->addr, dataSize, NULL);
+            }
+            addStmtToIRSB(sbOut, st);
+            break;
+         case Ist_LLSC:
+            {
+               /* The load-linked is an ordinary read, and the
+                * store-conditional is atomic, like a CAS: both are
+                * logged whether or not the store succeeds.
+                */
+               IRType dataTy;
+               if (st->Ist.LLSC.storedata == NULL)
+               {
+                  dataTy = typeOfIRTemp(sbOut->tyenv, st->Ist.LLSC.result);
+                  dg_bbdef_add_access(sbOut, bbd, DG_ACC_READ, st->Ist.LLSC.addr,
+                                      sizeofIRType(dataTy), NULL);
+               }
+               else
+               {
+                  dataTy = typeOfIRExpr(sbOut->tyenv, st->Ist.LLSC.storedata);
+                  dg_bbdef_add_access(sbOut, bbd, DG_ACC_ATOMIC, st->Ist.LLSC.addr,
+                                      sizeofIRType(dataTy), NULL);
+               }
             }
             addStmtToIRSB(sbOut, st);
             break;
@@ -616,6 +3485,8 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
                 dg_bbdef_add_access(sbOut, bbd, DG_ACC_WRITE, sg->addr,
                                     sizeofIRType(typeOfIRExpr(sbOut->tyenv, data)),
                                     sg->guard);
+                if (DG_(clo_value_stats))
+                   dg_bbdef_add_value(sbOut, bbd, sg->addr, data, sg->guard);
             }
             addStmtToIRSB(sbOut, st);
             break;
@@ -637,53 +3508,202 @@ static IRSB* dg_instrument(VgCallbackClosure* closure,
       }
    }
 
-   dg_bbdef_update_instrs(sbOut, bbd);
-   dg_bbdef_flush(bbd);
-   return sbOut;
+   dg_bbdef_update_instrs(sbOut, bbd, sbOut->jumpkind);
+   dg_bbdef_flush(bbd);
+   if (sp_tmps != NULL)
+   {
+      VG_(free)(sp_tmps);
+      sp_tmps = NULL;
+   }
+   return sbOut;
+}
+
+static void dg_discard_superblock_info(Addr orig_addr, VexGuestExtents vge)
+{
+   DgSB *sb = VG_(HT_remove)(dgsbs, (UWord) orig_addr);
+
+   DG_(counts_discard)(orig_addr);
+
+   if (sb != NULL)
+   {
+      Word size = VG_(sizeXA)(sb->bbdefs);
+      Word i;
+      for (i = 0; i < size; i++)
+      {
+         DgBBDef** item = (DgBBDef**) VG_(indexXA)(sb->bbdefs, i);
+         /* The pending run still needs the block to encode its addresses */
+         if (cur_bbr != NULL && cur_bbr->bbdef == *item)
+         {
+            trace_bb_flush(cur_bbr);
+            cur_bbr->bbdef = NULL;
+         }
+         dg_bbdef_delete(*item);
+      }
+      VG_(deleteXA)(sb->bbdefs);
+      VG_(free)(sb);
+   }
+}
+
+/* Returns the index of the allocation stack, writing it out the first time.
+ * ExeContexts are interned by the core, so each distinct stack is only
+ * written once.
+ */
+static UWord out_alloc_stack(ExeContext *ec)
+{
+   DgAllocStack *node;
+
+   if (ec == NULL)
+      return ~(UWord) 0;
+   stats_alloc_lookups++;
+   node = VG_(HT_lookup)(alloc_stack_table, (UWord) ec);
+   if (node == NULL)
+   {
+      Int n_ips = VG_(get_ExeContext_n_ips)(ec);
+      StackTrace stack = VG_(get_ExeContext_StackTrace)(ec);
+      UChar *p;
+      Int i;
+
+      p = out_begin_record(DG_R_ALLOC_STACK, uvarint_size(n_ips) + n_ips * sizeof(HWord));
+      p = encode_uvarint(p, n_ips);
+      for (i = 0; i < n_ips; i++)
+         p = put_word(p, stack[i]);
+      out_end_record(p);
+
+      node = VG_(malloc)("datagrind.alloc_stack", sizeof(DgAllocStack));
+      node->header.key = (UWord) ec;
+      node->index = global_alloc_stack_index++;
+      VG_(HT_add_node)(alloc_stack_table, node);
+   }
+   return node->index;
+}
+
+static void out_add_block(DgMallocBlock* block)
+{
+   UWord stack_index = out_alloc_stack(block->where);
+   UChar *p = out_begin_record(DG_R_MALLOC_BLOCK, 3 * sizeof(Addr));
+
+   p = put_word(p, block->header.key); /* addr */
+   p = put_word(p, block->szB);
+   p = put_word(p, stack_index);
+   out_end_record(p);
+   DG_(allocstats_new_block)(block->header.key, block->szB, stack_index, sample_instrs);
+}
+
+static Int cmp_block_addr(const void *a, const void *b)
+{
+   const DgMallocBlock *ba = *(DgMallocBlock *const *) a;
+   const DgMallocBlock *bb = *(DgMallocBlock *const *) b;
+
+   if (ba->header.key != bb->header.key)
+      return ba->header.key < bb->header.key ? -1 : 1;
+   return 0;
 }
 
-static void dg_discard_superblock_info(Addr orig_addr, VexGuestExtents vge)
+/* Writes the live heap blocks as a DG_R_HEAP_SNAPSHOT, in address order,
+ * so that a reader can start from it rather than from the first block.
+ * Each block is given by the gap after the previous one.
+ */
+static void out_heap_snapshot(void)
 {
-   DgSB *sb = VG_(HT_remove)(dgsbs, (UWord) orig_addr);
+   UInt n, i;
+   VgHashNode **blocks = VG_(HT_to_array)(block_table, &n);
+   UChar *payload, *p;
+   Addr prev_end = 0;
 
-   if (sb != NULL)
+   VG_(ssort)(blocks, n, sizeof(VgHashNode *), cmp_block_addr);
+   p = payload = VG_(malloc)("datagrind.heap_snapshot",
+                             10 + DG_MAX_UVARINT_BYTES * (1 + 3 * (SizeT) n));
+   p = encode_uvarint64(p, sample_instrs + (cur_bbr != NULL ? cur_bbr->n_instrs : 0));
+   p = encode_uvarint(p, n);
+   for (i = 0; i < n; i++)
    {
-      Word size = VG_(sizeXA)(sb->bbdefs);
-      Word i;
-      for (i = 0; i < size; i++)
-      {
-         DgBBDef** item = (DgBBDef**) VG_(indexXA)(sb->bbdefs, i);
-         dg_bbdef_delete(*item);
-      }
-      VG_(deleteXA)(sb->bbdefs);
-      VG_(free)(sb);
+      const DgMallocBlock *block = (const DgMallocBlock *) blocks[i];
+
+      p = encode_uvarint(p, block->header.key - prev_end);
+      p = encode_uvarint(p, block->szB);
+      /* Shifted so that a block without a stack is 0 */
+      p = encode_uvarint(p, out_alloc_stack(block->where) + 1);
+      prev_end = block->header.key + block->szB;
    }
+   out_byte(DG_R_HEAP_SNAPSHOT);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+   VG_(free)(blocks);
 }
 
-static void out_add_block(DgMallocBlock* block)
+static void out_remove_block(DgMallocBlock* block)
 {
-   UInt i;
-   out_byte(DG_R_MALLOC_BLOCK);
-   out_byte((block->n_ips + 3) * sizeof(Addr));
-   out_word(block->header.key); /* addr */
-   out_word(block->szB);
-   out_word(block->n_ips);
+   UChar *p = out_begin_record(DG_R_FREE_BLOCK, sizeof(Addr));
 
-   for (i = 0; i < block->n_ips; i++)
-      out_word(block->ips[i]);
+   out_end_record(put_word(p, block->header.key)); /* addr */
+   DG_(allocstats_free_block)(block->header.key, sample_instrs);
 }
 
-static void out_remove_block(DgMallocBlock* block)
+/* Writes a DG_R_REALLOC_BLOCK for a block that was at old_addr. The
+ * stack is only given if a new one was taken; otherwise the block keeps
+ * the one it was allocated with.
+ */
+static void out_realloc_block(Addr old_addr, DgMallocBlock* block, ExeContext *where)
+{
+   UWord stack_index = out_alloc_stack(where);
+   UChar *p = out_begin_record(DG_R_REALLOC_BLOCK, 4 * sizeof(Addr));
+
+   p = put_word(p, old_addr);
+   p = put_word(p, block->header.key); /* new addr */
+   p = put_word(p, block->szB);
+   p = put_word(p, stack_index);
+   out_end_record(p);
+   DG_(allocstats_free_block)(old_addr, sample_instrs);
+   DG_(allocstats_new_block)(block->header.key, block->szB,
+                             out_alloc_stack(block->where), sample_instrs);
+}
+
+/* Takes the allocation stack of a block, if --datagrind-alloc-stacks
+ * wants one. Unwinding is the main cost of an allocation, so leaving it
+ * out speeds up heap-heavy programs.
+ */
+static ExeContext *alloc_stack(ThreadId tid, SizeT szB)
+{
+   static ULong n_allocs = 0;
+
+   switch (clo_datagrind_alloc_stacks)
+   {
+   case DG_ALLOC_STACKS_NONE:
+      return NULL;
+   case DG_ALLOC_STACKS_SAMPLED:
+      n_allocs++;
+      if (szB >= clo_datagrind_alloc_stacks_min_size
+          || (clo_datagrind_alloc_stacks_every > 0
+              && n_allocs % clo_datagrind_alloc_stacks_every == 0))
+         break;
+      return NULL;
+   default:
+      break;
+   }
+   return VG_(record_ExeContext)(tid, 0);
+}
+
+/* Gives a block to the filter if it was allocated from a matching stack.
+ * The stack is taken for the match even if the block is not to have it.
+ */
+static void mark_block(ThreadId tid, DgMallocBlock *block)
 {
-   out_byte(DG_R_FREE_BLOCK);
-   out_byte(sizeof(Addr));
-   out_word(block->header.key); /* addr */
+   ExeContext *where = block->where;
+
+   block->marked = False;
+   if (!DG_(filter_by_alloc)())
+      return;
+   if (where == NULL)
+      where = VG_(record_ExeContext)(tid, 0);
+   block->marked = DG_(filter_alloc_matches)(where);
+   if (block->marked)
+      DG_(filter_add_block)(block->header.key, block->szB);
 }
 
 static void add_block(ThreadId tid, void* p, SizeT szB, Bool custom)
 {
-   StackTrace ips = VG_(calloc)("datagrind.add_block.stacktrace", STACK_DEPTH, sizeof(Addr));
-   DgMallocBlock* block = VG_(calloc)("datagrind.add_block.block", 1, sizeof(DgMallocBlock));
+   DgMallocBlock* block = VG_(allocEltPA)(block_pool);
 
    block->header.key = (UWord) p;
    block->szB = szB;
@@ -692,8 +3712,8 @@ static void add_block(ThreadId tid, void* p, SizeT szB, Bool custom)
    else
       block->actual_szB = szB;
 
-   block->n_ips = VG_(get_StackTrace)(tid, ips, STACK_DEPTH, NULL, NULL, 0);
-   block->ips = ips;
+   block->where = alloc_stack(tid, szB);
+   mark_block(tid, block);
 
    VG_(HT_add_node)(block_table, block);
 
@@ -707,13 +3727,161 @@ static Bool remove_block(void* p)
    if (block == NULL)
       return False;
 
+   if (block->marked)
+      DG_(filter_remove_block)(block->header.key);
    out_remove_block(block);
 
-   VG_(free)(block->ips);
-   VG_(free)(block);
+   VG_(freeEltPA)(block_pool, block);
    return True;
 }
 
+/* Writes a DG_R_MEMPOOL. A chunk is given for an alloc or a free */
+static void out_mempool(UChar op, Addr pool, const DgMallocBlock *chunk)
+{
+   UWord stack_index = 0;
+   SizeT n_words = 1;
+   UChar *p;
+
+   if (op == DG_POOL_ALLOC)
+   {
+      stack_index = out_alloc_stack(chunk->where);
+      n_words = 4;
+   }
+   else if (op == DG_POOL_FREE)
+      n_words = 2;
+   p = out_begin_record(DG_R_MEMPOOL, 1 + n_words * sizeof(Addr));
+   p = put_byte(p, op);
+   p = put_word(p, pool);
+   if (n_words > 1)
+      p = put_word(p, chunk->header.key); /* addr */
+   if (n_words > 2)
+   {
+      p = put_word(p, chunk->szB);
+      p = put_word(p, stack_index);
+   }
+   out_end_record(p);
+}
+
+static Bool chunk_is_live(const DgMallocBlock *chunk)
+{
+   const DgMempool *pool = VG_(HT_lookup)(mempool_table, chunk->pool);
+
+   return pool != NULL && pool->gen == chunk->pool_gen;
+}
+
+/* Looks up the chunk at addr, dropping it if its pool is gone */
+static DgMallocBlock *lookup_chunk(Addr addr)
+{
+   DgMallocBlock *chunk = VG_(HT_lookup)(chunk_table, addr);
+
+   if (chunk != NULL && !chunk_is_live(chunk))
+   {
+      VG_(HT_remove)(chunk_table, addr);
+      VG_(freeEltPA)(block_pool, chunk);
+      n_stale_chunks--;
+      chunk = NULL;
+   }
+   return chunk;
+}
+
+/* Removes the stale chunks from the chunk table, in place */
+static void sweep_chunks(void)
+{
+   DgMallocBlock *chunk;
+
+   VG_(HT_ResetIter)(chunk_table);
+   while ((chunk = VG_(HT_Next)(chunk_table)) != NULL)
+      if (!chunk_is_live(chunk))
+      {
+         VG_(HT_remove_at_Iter)(chunk_table);
+         VG_(freeEltPA)(block_pool, chunk);
+      }
+   n_stale_chunks = 0;
+}
+
+/* Takes the chunks of a pool out of use, in constant time */
+static void retire_chunks(DgMempool *pool)
+{
+   n_stale_chunks += pool->n_chunks;
+   pool->n_chunks = 0;
+   if (n_stale_chunks >= 1024 && n_stale_chunks > VG_(HT_count_nodes)(chunk_table) / 2)
+      sweep_chunks();
+}
+
+/* A pool that already exists starts again empty */
+static void create_mempool(Addr anchor)
+{
+   DgMempool *pool = VG_(HT_lookup)(mempool_table, anchor);
+
+   if (pool == NULL)
+   {
+      pool = VG_(malloc)("datagrind.mempool", sizeof(DgMempool));
+      pool->header.key = anchor;
+      pool->n_chunks = 0;
+      VG_(HT_add_node)(mempool_table, pool);
+   }
+   pool->gen = ++global_pool_gen;
+   retire_chunks(pool);
+   out_mempool(DG_POOL_CREATE, anchor, NULL);
+}
+
+static void destroy_mempool(Addr anchor)
+{
+   DgMempool *pool = VG_(HT_remove)(mempool_table, anchor);
+
+   if (pool == NULL)
+      return;
+   retire_chunks(pool);
+   VG_(free)(pool);
+   out_mempool(DG_POOL_DESTROY, anchor, NULL);
+}
+
+/* Frees a live chunk, with a DG_POOL_FREE */
+static void remove_chunk(DgMallocBlock *chunk)
+{
+   DgMempool *pool = VG_(HT_lookup)(mempool_table, chunk->pool);
+
+   VG_(HT_remove)(chunk_table, chunk->header.key);
+   pool->n_chunks--;
+   out_mempool(DG_POOL_FREE, chunk->pool, chunk);
+   VG_(freeEltPA)(block_pool, chunk);
+}
+
+static void mempool_alloc(ThreadId tid, Addr anchor, Addr addr, SizeT szB)
+{
+   DgMempool *pool = VG_(HT_lookup)(mempool_table, anchor);
+   DgMallocBlock *chunk;
+
+   if (pool == NULL)
+      return;
+   /* A chunk still allocated at addr is freed first, so that each address
+    * has one chunk and is counted once in its pool.
+    */
+   chunk = lookup_chunk(addr);
+   if (chunk != NULL)
+      remove_chunk(chunk);
+   chunk = VG_(allocEltPA)(block_pool);
+   chunk->header.key = addr;
+   chunk->szB = szB;
+   chunk->actual_szB = szB;
+   chunk->where = alloc_stack(tid, szB);
+   chunk->pool = anchor;
+   chunk->pool_gen = pool->gen;
+   chunk->marked = False;
+   VG_(HT_add_node)(chunk_table, chunk);
+   pool->n_chunks++;
+   out_mempool(DG_POOL_ALLOC, anchor, chunk);
+}
+
+static void mempool_free(Addr anchor, Addr addr)
+{
+   DgMallocBlock *chunk = lookup_chunk(addr);
+
+   if (chunk == NULL || chunk->pool != anchor)
+      return;
+   remove_chunk(chunk);
+}
+
 static void* dg_malloc(ThreadId tid, SizeT szB)
 {
    void* p = VG_(cli_malloc)(VG_(clo_alignment), szB);
@@ -763,31 +3931,43 @@ static void* dg_realloc(ThreadId tid, void* p, SizeT szB)
 
    if (szB <= block->actual_szB)
    {
-      /* No need to resize. */
-      out_remove_block(block);
+      /* No need to resize, or to unwind: the block keeps its stack */
       block->szB = szB;
-      block->n_ips = VG_(get_StackTrace)(tid, block->ips, STACK_DEPTH, NULL, NULL, 0);
-      out_add_block(block);
+      if (block->marked)
+      {
+         DG_(filter_remove_block)(block->header.key);
+         DG_(filter_add_block)(block->header.key, szB);
+      }
+      out_realloc_block((Addr) p, block, NULL);
       return p;
    }
    else
    {
       /* New size is bigger */
       void* new_p = VG_(cli_malloc)(VG_(clo_alignment), szB);
+      ExeContext *where;
+
       if (new_p == NULL)
          return NULL;
       VG_(memcpy)(new_p, p, block->szB);
 
-      out_remove_block(block);
       VG_(HT_remove)(block_table, (UWord) p);
+      if (block->marked)
+      {
+         DG_(filter_remove_block)((Addr) p);
+         DG_(filter_add_block)((Addr) new_p, szB);
+      }
 
       block->header.key = (UWord) new_p;
       block->szB = szB;
       block->actual_szB = VG_(cli_malloc_usable_size)(new_p);
-      block->n_ips = VG_(get_StackTrace)(tid, block->ips, STACK_DEPTH, NULL, NULL, 0);
+      where = alloc_stack(tid, szB);
+      if (where != NULL)
+         block->where = where;
 
       VG_(HT_add_node)(block_table, block);
-      out_add_block(block);
+      out_realloc_block((Addr) p, block, where);
+      VG_(cli_free)(p);
       return new_p;
    }
 }
@@ -801,6 +3981,284 @@ static SizeT dg_malloc_usable_size(ThreadId tid, void* p)
       return block->actual_szB;
 }
 
+/* Switches instrumentation on or off, by discarding all translations so
+ * that blocks are retranslated with or without tracing IR.
+ */
+static void set_instrument_state(const HChar *reason, Bool state)
+{
+   ThreadId tid;
+
+   if (instrument_state == state)
+      return;
+   instrument_state = state;
+
+   /* This also flushes the pending run, through dg_discard_superblock_info */
+   VG_(discard_translations_safely)((Addr) 0x1000, ~(SizeT) 0xfff, "datagrind");
+   cur_bbr = NULL;
+
+   /* Calls and returns were not seen while off */
+   if (state)
+   {
+      Addr stack_min, stack_max;
+
+      for (tid = 1; tid < VG_N_THREADS; tid++)
+      {
+         shadow_stacks[tid].n_signals = 0;
+         shadow_stacks[tid].base = 0;
+         shadow_stack_reroot(&shadow_stacks[tid], 0);
+      }
+      VG_(thread_stack_reset_iter)(&tid);
+      while (VG_(thread_stack_next)(&tid, &stack_min, &stack_max))
+         shadow_stack_reroot(&shadow_stacks[tid], VG_(get_SP)(tid));
+   }
+
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg, "%s: instrumentation switched %s\n",
+                   reason, state ? "ON" : "OFF");
+}
+
+/* Returns the peak resident size of the process, tool and client
+ * together, in kB, or 0 if it is not known.
+ */
+static ULong peak_rss_kb(void)
+{
+   HChar buf[4096];
+   const HChar *line;
+   SysRes fd;
+   Int n;
+
+   fd = VG_(open)("/proc/self/status", VKI_O_RDONLY, 0);
+   if (sr_isError(fd))
+      return 0;
+   n = VG_(read)(sr_Res(fd), buf, sizeof(buf) - 1);
+   VG_(close)(sr_Res(fd));
+   if (n <= 0)
+      return 0;
+   buf[n] = '\0';
+   line = VG_(strstr)(buf, "VmHWM:");
+   if (line == NULL)
+      return 0;
+   line += 6;
+   while (*line == ' ' || *line == '\t')
+      line++;
+   return VG_(strtoull10)(line, NULL);
+}
+
+static UInt dmsg_print(const HChar *format, ...)
+{
+   UInt ret;
+   va_list vargs;
+
+   va_start(vargs, format);
+   ret = VG_(vmessage)(Vg_DebugMsg, format, vargs);
+   va_end(vargs);
+   return ret;
+}
+
+static void dg_print_stats(DgPrintf print)
+{
+   ULong bytes = DG_(out_offset)();
+
+   print("datagrind: %'llu runs, %'llu addresses written\n",
+         stats_runs, stats_addrs);
+   print("datagrind: %'llu bytes of records, %llu.%02llu per address\n",
+         bytes, stats_addrs > 0 ? bytes / stats_addrs : 0ULL,
+         stats_addrs > 0 ? bytes * 100 / stats_addrs % 100 : 0ULL);
+   print("datagrind: %'llu calls of trace_bb_start, %'llu contexts from the shadow stack\n",
+         stats_bb_starts, stats_frame_hits);
+   print("datagrind: %'llu stacks recorded for contexts, %'llu already known, %'lu contexts\n",
+         stats_unwinds, stats_unwind_hits, global_context_index);
+   print("datagrind: %'llu allocation stacks looked up, %'lu written\n",
+         stats_alloc_lookups, global_alloc_stack_index);
+   if (hot_table != NULL)
+      print("datagrind: %'llu translations past the hot threshold, of %'u blocks\n",
+            stats_hot_switches, VG_(HT_count_nodes)(hot_table));
+   if (stats_checkpoints > 0)
+      print("datagrind: %'llu checkpoints written\n", stats_checkpoints);
+   DG_(heatmap_print_stats)(print);
+   DG_(reuse_print_stats)(print);
+   DG_(sources_print_stats)(print);
+   DG_(out_print_stats)(print);
+   print("datagrind: peak resident memory %'llu kB\n", peak_rss_kb());
+}
+
+/* Writes a DG_R_START_EVENT or DG_R_END_EVENT of a thread, with the label
+ * cut short after 64 bytes, and the summary of the event's accesses after
+ * it with --datagrind-event-stats=yes.
+ */
+static void out_event(ThreadId tid, Bool start, const HChar *label)
+{
+   SizeT label_len = VG_(strlen)(label);
+   SizeT summary_len = 0;
+   UChar *summary = NULL;
+   UChar instrs[10];
+   UChar *p;
+
+   if (label_len > 64) label_len = 64;
+   /* The run that made the request belongs to the events open before it */
+   if (DG_(clo_event_stats) && cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   /* Otherwise it is not flushed yet, but counts */
+   p = encode_uvarint64(instrs, sample_instrs + (cur_bbr != NULL ? cur_bbr->n_instrs : 0));
+   DG_(heatmap_flush)();
+   if (start)
+      DG_(events_start)(tid, label, label_len);
+   else if (DG_(clo_event_stats))
+      summary = DG_(events_end)(tid, label, label_len, &summary_len);
+   out_byte(start ? DG_R_START_EVENT : DG_R_END_EVENT);
+   out_length((p - instrs) + label_len + 1 + summary_len);
+   out_bytes(instrs, p - instrs);
+   out_bytes(label, label_len);
+   out_byte('\0');
+   if (summary != NULL)
+   {
+      out_bytes(summary, summary_len);
+      VG_(free)(summary);
+   }
+   if (start)
+      DG_(index_add_label)(label, label_len);
+   else if (clo_datagrind_heap_snapshots)
+      out_heap_snapshot();
+}
+
+static void print_monitor_help(void)
+{
+   VG_(gdb_printf)(
+"\n"
+"datagrind monitor commands:\n"
+"  dump_ring\n"
+"      writes the trace kept with --datagrind-ring-size to a new file\n"
+"  stats\n"
+"      prints the counters shown at exit with --stats=yes\n"
+"  flush\n"
+"      writes out the pending run and the buffered records\n"
+"  instrumentation [on|off]\n"
+"      switches recording on or off, or shows whether it is on\n"
+"  mark <label>\n"
+"      writes a start and an end event with the label\n"
+"  heap_snapshot\n"
+"      writes the live heap blocks\n"
+"\n");
+}
+
+/* Returns True if the request is recognised */
+static Bool handle_gdb_monitor_command(ThreadId tid, HChar *req)
+{
+   HChar *wcmd;
+   HChar s[VG_(strlen)(req) + 1]; /* copy for strtok_r */
+   HChar *ssaveptr;
+
+   VG_(strcpy)(s, req);
+   wcmd = VG_(strtok_r)(s, " ", &ssaveptr);
+   switch (VG_(keyword_id)("help dump_ring stats flush instrumentation mark heap_snapshot",
+                           wcmd, kwd_report_duplicated_matches))
+   {
+   case -2: /* multiple matches */
+      return True;
+   case -1: /* not found */
+      return False;
+   case 0: /* help */
+      print_monitor_help();
+      return True;
+   case 1: /* dump_ring */
+      if (DG_(clo_ring_size) == 0)
+         VG_(gdb_printf)("datagrind is not running with --datagrind-ring-size\n");
+      else
+         DG_(out_ring_dump)();
+      return True;
+   case 2: /* stats */
+      dg_print_stats(VG_(gdb_printf));
+      return True;
+   case 3: /* flush */
+      if (cur_bbr != NULL)
+         trace_bb_flush(cur_bbr);
+      DG_(out_flush)();
+      return True;
+   case 4: /* instrumentation */
+      {
+         HChar *arg = VG_(strtok_r)(NULL, " ", &ssaveptr);
+
+         if (arg == NULL)
+            VG_(gdb_printf)("instrumentation is %s\n", instrument_state ? "on" : "off");
+         else if (VG_(strcmp)(arg, "on") == 0)
+            set_instrument_state("Monitor Command", True);
+         else if (VG_(strcmp)(arg, "off") == 0)
+            set_instrument_state("Monitor Command", False);
+         else
+            VG_(gdb_printf)("expected on or off, not %s\n", arg);
+      }
+      return True;
+   case 5: /* mark */
+      {
+         HChar *label = VG_(strtok_r)(NULL, "", &ssaveptr);
+
+         while (label != NULL && *label == ' ')
+            label++;
+         if (label == NULL || *label == '\0')
+            VG_(gdb_printf)("mark needs a label\n");
+         else
+         {
+            out_event(tid, True, label);
+            out_event(tid, False, label);
+         }
+      }
+      return True;
+   case 6: /* heap_snapshot */
+      out_heap_snapshot();
+      return True;
+   default:
+      tl_assert(0);
+      return False;
+   }
+}
+
+/* Writes a DG_R_BULK_ACCESS for a copy or fill made by the preload, which
+ * runs uninstrumented, as for a system call.
+ */
+static void out_bulk_access(ThreadId tid, UChar op, Addr dst, Addr src, SizeT size)
+{
+   UChar payload[1 + 2 * sizeof(Addr) + DG_MAX_UVARINT_BYTES];
+   UChar *p, *q;
+
+   if (!bulk || !instrument_state || size == 0)
+      return;
+   if (clo_datagrind_toggle_collect != NULL && shadow_stacks[tid].n_toggled == 0)
+      return;
+
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   out_thread_switch(tid);
+   p = put_byte(payload, op);
+   p = put_word(p, dst);
+   if (op == DG_BULK_COPY)
+      p = put_word(p, src);
+   p = encode_uvarint(p, size);
+   q = out_begin_record(DG_R_BULK_ACCESS, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+}
+
+/* Writes a DG_R_LOCK for a lock taken or given up through the wrappers in
+ * the preload.
+ */
+static void out_lock(ThreadId tid, UChar op, Addr lock)
+{
+   UChar payload[1 + sizeof(Addr)];
+   UChar *p, *q;
+
+   if (!clo_datagrind_locks || clo_datagrind_mode != DG_MODE_TRACE || !instrument_state)
+      return;
+   if (clo_datagrind_toggle_collect != NULL && shadow_stacks[tid].n_toggled == 0)
+      return;
+
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   out_thread_switch(tid);
+   p = put_byte(payload, op);
+   p = put_word(p, lock);
+   q = out_begin_record(DG_R_LOCK, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+}
+
 static Bool dg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
 {
    switch (args[0])
@@ -818,6 +4276,21 @@ static Bool dg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
          remove_block(p);
       }
       break;
+   case VG_USERREQ__CREATE_MEMPOOL:
+      create_mempool(args[1]);
+      break;
+   case VG_USERREQ__DESTROY_MEMPOOL:
+      destroy_mempool(args[1]);
+      break;
+   case VG_USERREQ__MEMPOOL_ALLOC:
+      mempool_alloc(tid, args[1], args[2], args[3]);
+      break;
+   case VG_USERREQ__MEMPOOL_FREE:
+      mempool_free(args[1], args[2]);
+      break;
+   case VG_USERREQ__MEMPOOL_EXISTS:
+      *ret = VG_(HT_lookup)(mempool_table, args[1]) != NULL;
+      return True;
    case VG_USERREQ__TRACK_RANGE:
       {
          UWord addr = args[1];
@@ -827,10 +4300,18 @@ static Bool dg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
          SizeT type_len = VG_(strlen)(type);
          SizeT label_len = VG_(strlen)(label);
 
-         if (type_len > 64) type_len = 64;
-         if (label_len > 64) label_len = 64;
+         DG_(filter_track)(addr, len);
+         DG_(reuse_track)(addr, len);
+         DG_(raster_track)(addr, len);
+         DG_(fieldheat_track)(addr, len);
+         DG_(affinity_track)(addr, len);
+         DG_(pages_track)(addr, len);
+         DG_(tlbsim_track)(addr, len);
+         DG_(patterns_track)(addr, len);
+         DG_(wss_track)(addr, len);
+         DG_(events_track)(addr, len);
          out_byte(DG_R_TRACK_RANGE);
-         out_byte(2 * sizeof(addr) + type_len + label_len + 2);
+         out_length(2 * sizeof(addr) + type_len + label_len + 2);
          out_word(addr);
          out_word(len);
          out_bytes(type, type_len);
@@ -843,6 +4324,16 @@ static Bool dg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
       {
           UWord addr = args[1];
           UWord len = args[2];
+          DG_(filter_untrack)(addr, len);
+          DG_(reuse_untrack)(addr, len);
+          DG_(raster_untrack)(addr, len);
+          DG_(fieldheat_untrack)(addr, len);
+          DG_(affinity_untrack)(addr, len);
+          DG_(pages_untrack)(addr, len);
+          DG_(tlbsim_untrack)(addr, len);
+          DG_(patterns_untrack)(addr, len);
+          DG_(wss_untrack)(addr, len);
+          DG_(events_untrack)(addr, len);
           out_byte(DG_R_UNTRACK_RANGE);
           out_byte(2 * sizeof(addr));
           out_word(addr);
@@ -851,16 +4342,29 @@ static Bool dg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
       break;
    case VG_USERREQ__START_EVENT:
    case VG_USERREQ__END_EVENT:
-      {
-          const HChar *label = (const HChar *) args[1];
-          SizeT label_len = VG_(strlen)(label);
-          if (label_len > 64) label_len = 64;
-          out_byte(args[0] == VG_USERREQ__START_EVENT ? DG_R_START_EVENT : DG_R_END_EVENT);
-          out_byte(label_len + 1);
-          out_bytes(label, label_len);
-          out_byte('\0');
-      }
+      out_event(tid, args[0] == VG_USERREQ__START_EVENT, (const HChar *) args[1]);
+      break;
+   case VG_USERREQ__DATAGRIND_START_INSTRUMENTATION:
+      set_instrument_state("Client Request", True);
+      break;
+   case VG_USERREQ__DATAGRIND_STOP_INSTRUMENTATION:
+      set_instrument_state("Client Request", False);
+      break;
+   case VG_USERREQ__DATAGRIND_DUMP_RING:
+      DG_(out_ring_dump)();
+      break;
+   case VG_USERREQ__DATAGRIND_HEAP_SNAPSHOT:
+      out_heap_snapshot();
+      break;
+   case _VG_USERREQ__DATAGRIND_BULK_ACCESS:
+      out_bulk_access(tid, args[1], args[2], args[3], args[4]);
       break;
+   case _VG_USERREQ__DATAGRIND_LOCK:
+      out_lock(tid, args[1], args[2]);
+      break;
+   case VG_USERREQ__GDB_MONITOR_COMMAND:
+      *ret = handle_gdb_monitor_command(tid, (HChar *) args[1]);
+      return *ret;
    default:
       *ret = 0;
       return False;
@@ -869,26 +4373,247 @@ static Bool dg_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
    return True;
 }
 
+/* Signals are only delivered between blocks, so the run of the thread is
+ * complete, but its exit would otherwise be applied by the handler's first
+ * trace_bb_start, at the handler's SP.
+ */
+static void dg_pre_deliver_signal(ThreadId tid, Int sigNo, Bool alt_stack)
+{
+   Addr sp = VG_(get_SP)(tid);
+
+   if (!clo_datagrind_shadow_stack || !instrument_state)
+      return;
+   if (cur_bbr != NULL && cur_bbr->tid == tid)
+   {
+      shadow_stack_exit(tid, cur_bbr->exit_kind, sp);
+      cur_bbr->exit_kind = DG_EXIT_BORING;
+   }
+   shadow_stack_enter_signal(&shadow_stacks[tid], sp,
+                             alt_stack ? VG_(thread_get_altstack_min)(tid) : 0,
+                             alt_stack ? VG_(thread_get_altstack_size)(tid) : 0);
+}
+
+static void dg_post_deliver_signal(ThreadId tid, Int sigNo)
+{
+   DgShadowStack *ss = &shadow_stacks[tid];
+
+   if (!clo_datagrind_shadow_stack || ss->n_signals == 0)
+      return;
+   /* The return from the handler is not a return in the interrupted code */
+   if (cur_bbr != NULL && cur_bbr->tid == tid)
+      cur_bbr->exit_kind = DG_EXIT_BORING;
+   shadow_stack_leave_signal(ss);
+}
+
+static void dg_pre_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs)
+{
+   syscall_nums[tid] = syscallno;
+}
+
+static void dg_post_syscall(ThreadId tid, UInt syscallno, UWord *args, UInt nArgs,
+                            SysRes res)
+{
+   syscall_nums[tid] = -1;
+}
+
+/* Writes a DG_R_SYSCALL_ACCESS for a range the kernel reads or writes on
+ * behalf of a system call. The range is written whole, so a large buffer
+ * costs no more than a small one.
+ */
+static void out_syscall_access(CorePart part, ThreadId tid, Addr a, SizeT size, UChar dir)
+{
+   UChar payload[1 + 2 * DG_MAX_UVARINT_BYTES + sizeof(Addr)];
+   UChar *p, *q;
+
+   if (!clo_datagrind_syscalls || clo_datagrind_mode != DG_MODE_TRACE
+       || !instrument_state || size == 0
+       || (part != Vg_CoreSysCall && part != Vg_CoreSysCallArgInMem)
+       || syscall_nums[tid] < 0)
+      return;
+   if (clo_datagrind_toggle_collect != NULL && shadow_stacks[tid].n_toggled == 0)
+      return;
+
+   /* The run that made the call comes first */
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   out_thread_switch(tid);
+   p = put_byte(payload, dir);
+   p = encode_uvarint(p, syscall_nums[tid]);
+   p = put_word(p, a);
+   p = encode_uvarint(p, size);
+   q = out_begin_record(DG_R_SYSCALL_ACCESS, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+}
+
+static void dg_pre_mem_read(CorePart part, ThreadId tid, const HChar *s,
+                            Addr a, SizeT size)
+{
+   out_syscall_access(part, tid, a, size, DG_ACC_READ);
+}
+
+/* The kernel fails the call if the string is not readable, so it is only
+ * measured as far as the client can read it.
+ */
+static void dg_pre_mem_read_asciiz(CorePart part, ThreadId tid, const HChar *s,
+                                   Addr a)
+{
+   Addr end = a;
+
+   while (VG_(am_is_valid_for_client)(end, 1, VKI_PROT_READ))
+   {
+      Addr page_end = VG_PGROUNDDN(end) + VKI_PAGE_SIZE;
+
+      while (end < page_end && *(const HChar *) end != '\0')
+         end++;
+      if (end < page_end)
+      {
+         end++; /* The terminator */
+         break;
+      }
+   }
+   out_syscall_access(part, tid, a, end - a, DG_ACC_READ);
+}
+
+static void dg_post_mem_write(CorePart part, ThreadId tid, Addr a, SizeT size)
+{
+   out_syscall_access(part, tid, a, size, DG_ACC_WRITE);
+}
+
+static UChar map_prot(Bool rr, Bool ww, Bool xx)
+{
+   return (rr ? DG_PROT_READ : 0) | (ww ? DG_PROT_WRITE : 0) | (xx ? DG_PROT_EXEC : 0);
+}
+
+/* Writes a DG_R_MAP for a new mapping, with the file backing it if there
+ * is one. The core records the segment before telling the tool, so its
+ * name is already known.
+ */
 static void dg_track_new_mem_mmap_or_startup(Addr a, SizeT len, Bool rr, Bool ww, Bool xx, ULong di_handle)
 {
+   NSegment const *seg = VG_(am_find_nsegment)(a);
+   const HChar *filename = seg != NULL ? VG_(am_get_filename)(seg) : NULL;
+   ULong offset = 0;
+   UChar payload[1 + sizeof(Addr) + DG_MAX_UVARINT_BYTES + 10];
+   UChar *p, *q;
+   SizeT name_len;
+
+   if (di_handle != 0)
+      debuginfo_pending++;
+
+   if (filename == NULL)
+      filename = "";
+   else
+      offset = seg->offset + (a - seg->start);
+   name_len = VG_(strlen)(filename) + 1;
+
+   /* The run before the call comes first */
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   p = put_byte(payload, map_prot(rr, ww, xx));
+   p = put_word(p, a);
+   p = encode_uvarint(p, len);
+   p = encode_uvarint64(p, offset);
+   q = out_begin_record(DG_R_MAP, (p - payload) + name_len);
+   q = put_bytes(q, payload, p - payload);
+   out_end_record(put_bytes(q, filename, name_len));
+}
+
+static void dg_track_die_mem_munmap(Addr a, SizeT len)
+{
+   UChar payload[sizeof(Addr) + DG_MAX_UVARINT_BYTES];
+   UChar *p, *q;
+
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   DG_(pages_unmap)(a, len);
+   p = put_word(payload, a);
+   p = encode_uvarint(p, len);
+   q = out_begin_record(DG_R_UNMAP, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+}
+
+/* The core follows this with a new mapping if the region grew, and an
+ * unmapping of the old range if it moved.
+ */
+static void dg_track_copy_mem_remap(Addr from, Addr to, SizeT len)
+{
+   UChar payload[2 * sizeof(Addr) + DG_MAX_UVARINT_BYTES];
+   UChar *p, *q;
+
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   DG_(pages_remap)(from, to, len);
+   p = put_word(payload, from);
+   p = put_word(p, to);
+   p = encode_uvarint(p, len);
+   q = out_begin_record(DG_R_REMAP, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
+}
+
+static void dg_track_change_mem_mprotect(Addr a, SizeT len, Bool rr, Bool ww, Bool xx)
+{
+   UChar payload[1 + sizeof(Addr) + DG_MAX_UVARINT_BYTES];
+   UChar *p, *q;
+
+   /* This can load debug information, with no handle to say so */
    if (xx)
       debuginfo_dirty = True;
+
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   p = put_byte(payload, map_prot(rr, ww, xx));
+   p = put_word(p, a);
+   p = encode_uvarint(p, len);
+   q = out_begin_record(DG_R_PROTECT, p - payload);
+   out_end_record(put_bytes(q, payload, p - payload));
 }
 
 static void dg_fini(Int exitcode)
 {
-   trace_bb_flush(&out_bbr);
-   VG_(deleteXA)(out_bbr.accesses);
+   ThreadId tid;
 
-   if (out_fd != -1)
-   {
-      out_flush();
-      VG_(close)(out_fd);
-   }
+   if (cur_bbr != NULL)
+      trace_bb_flush(cur_bbr);
+   if (simpoint_on)
+      out_simpoint_event(False);
+   out_context_counts();
+   for (tid = 1; tid < VG_N_THREADS; tid++)
+      if (bbrs[tid].buf.base != NULL)
+      {
+         VG_(free)(bbrs[tid].buf.base);
+         VG_(free)(bbrs[tid].buf.encoded);
+      }
+
+   DG_(heatmap_flush)();
+   DG_(reuse_finish)();
+   DG_(raster_finish)(sample_instrs);
+   DG_(counts_finish)();
+   DG_(cachesim_finish)();
+   DG_(affinity_finish)();
+   DG_(allocstats_finish)(sample_instrs);
+   DG_(fieldheat_finish)();
+   DG_(sharing_finish)();
+   DG_(pages_finish)();
+   DG_(tlbsim_finish)();
+   DG_(patterns_finish)();
+   DG_(values_finish)();
+   DG_(sources_finish)();
+   DG_(wss_finish)(sample_instrs);
+   DG_(events_finish)();
+   DG_(xtree_finish)();
+   DG_(defcache_finish)();
+   /* Also reached from a fatal signal, so a ring is not lost */
+   DG_(out_finish)();
+   if (VG_(clo_stats))
+      dg_print_stats(dmsg_print);
 
    /* TODO: need to free the node entries */
    if (debuginfo_table != NULL)
       VG_(HT_destruct)(debuginfo_table, VG_(free));
+   if (frame_table != NULL)
+      VG_(HT_destruct)(frame_table, VG_(free));
+   if (alloc_stack_table != NULL)
+      VG_(HT_destruct)(alloc_stack_table, VG_(free));
 }
 
 static void dg_pre_clo_init(void)
@@ -900,6 +4625,9 @@ static void dg_pre_clo_init(void)
       "Copyright (C) 2010, and GNU GPL'd, by Bruce Merry.");
    VG_(details_bug_reports_to)  ("bmerry@users.sourceforge.net");
 
+   /* Needed by the shadow stack; overridable if it is disabled. */
+   VG_(clo_vex_control).guest_chase_thresh = 0;
+
    VG_(basic_tool_funcs)        (dg_post_clo_init,
                                  dg_instrument,
                                  dg_fini);
@@ -922,9 +4650,18 @@ static void dg_pre_clo_init(void)
       0                  /* red zone */
       );
    VG_(needs_superblock_discards)(dg_discard_superblock_info);
+   VG_(needs_syscall_wrapper)(dg_pre_syscall, dg_post_syscall);
 
+   VG_(track_pre_deliver_signal)(dg_pre_deliver_signal);
+   VG_(track_post_deliver_signal)(dg_post_deliver_signal);
    VG_(track_new_mem_startup)(dg_track_new_mem_mmap_or_startup);
    VG_(track_new_mem_mmap)(dg_track_new_mem_mmap_or_startup);
+   VG_(track_die_mem_munmap)(dg_track_die_mem_munmap);
+   VG_(track_copy_mem_remap)(dg_track_copy_mem_remap);
+   VG_(track_change_mem_mprotect)(dg_track_change_mem_mprotect);
+   VG_(track_pre_mem_read)(dg_pre_mem_read);
+   VG_(track_pre_mem_read_asciiz)(dg_pre_mem_read_asciiz);
+   VG_(track_post_mem_write)(dg_post_mem_write);
 }
 
 VG_DETERMINE_INTERFACE_VERSION(dg_pre_clo_init)
@@ -0,0 +1,806 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: merges the traces of several processes. dg_merge.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_merge interleaves the traces written by the processes of one
+ * --trace-children=yes run into a single trace, so that they can be
+ * looked at side by side.
+ *
+ * Chunks are the unit of interleaving: each chunk of an input is copied
+ * whole, and the chunks of all the inputs are put in the order of the wall
+ * clock times at which they started, which the DG_R_CHUNK records give
+ * relative to the DG_R_PROCESS. Every chunk written is followed by the
+ * DG_R_PROCESS of its input, so that a reader can tell whose it is.
+ *
+ * Block definitions, contexts and allocation stacks are numbered in the
+ * order they appear, so each input keeps a table from its numbers to those
+ * of the merged trace, and the records that use them are rewritten. The
+ * summaries that the analysis modes write at the end are per process, and
+ * are left out. The merged trace is not compressed.
+ *
+ * The shards of one run, written with --datagrind-shard, are stitched
+ * together instead: their chunks are put in the order of the shards, and
+ * keep the instruction counts from the start of the run that they have.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+static const char *argv0 = "dg_merge";
+
+/* A table from the numbers in an input to those in the output */
+typedef struct
+{
+   uint64_t *map;
+   size_t n;
+   size_t size;
+} remap;
+
+/* A chunk of an input */
+typedef struct
+{
+   uint64_t body;            /* Of the first record after the DG_R_CHUNK */
+   uint64_t end;
+   uint64_t instrs;
+   uint64_t tid;
+   uint64_t usecs;           /* Since the epoch */
+} stretch;
+
+typedef struct
+{
+   const char *name;
+   dgt_file *file;
+   stretch *chunks;
+   size_t n_chunks;
+   size_t next;              /* Chunk to write next */
+   uint64_t prefix_start;    /* Of the records before the first chunk */
+   uint64_t prefix_end;
+   int chunked;              /* Has DG_R_CHUNK records */
+   uint64_t process_start;   /* Of the DG_R_PROCESS, if any */
+   uint64_t process_end;
+   int sharded;              /* Has a DG_R_SHARD */
+   uint64_t shard, n_shards, shard_instrs;
+   remap bbdefs, contexts, stacks;
+} source;
+
+/* An entry of the index being built */
+typedef struct
+{
+   uint64_t offset;
+   uint64_t instrs;
+   uint64_t n_labels;
+   size_t labels;            /* Offset of the first label in labels */
+} out_chunk;
+
+static FILE *out;
+static const char *out_name;
+static uint64_t out_pos = 0;
+static int out_big_endian;
+static size_t out_word_size;
+static uint64_t out_n_bbdefs = 0, out_n_contexts = 0, out_n_stacks = 0;
+
+static out_chunk *out_chunks = NULL;
+static size_t out_n_chunks = 0, out_chunks_size = 0;
+static char *labels = NULL;
+static size_t labels_len = 0, labels_size = 0;
+
+static uint64_t n_dropped = 0;
+static uint64_t n_event_summaries = 0;
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: merges the Datagrind traces of the processes or shards of one run\n"
+"usage: %s -o <file> trace...\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static void out_of_memory(void)
+{
+   fprintf(stderr, "%s: out of memory\n", argv0);
+   exit(1);
+}
+
+static void *grow(void *array, size_t n, size_t *size, size_t elem_size)
+{
+   if (n + 1 > *size)
+   {
+      size_t new_size = *size > 0 ? *size * 2 : 256;
+
+      while (new_size < n + 1)
+         new_size *= 2;
+      array = realloc(array, new_size * elem_size);
+      if (array == NULL)
+         out_of_memory();
+      *size = new_size;
+   }
+   return array;
+}
+
+static void remap_add(remap *r, uint64_t value)
+{
+   r->map = grow(r->map, r->n, &r->size, sizeof(uint64_t));
+   r->map[r->n++] = value;
+}
+
+static void bad_trace(const source *src)
+{
+   fprintf(stderr, "%s: %s: %s\n", argv0, src->name, dgt_strerror(DGT_ERR_FORMAT));
+   exit(1);
+}
+
+static void out_bytes(const void *data, size_t len)
+{
+   if (fwrite(data, 1, len, out) != len)
+   {
+      fprintf(stderr, "%s: cannot write %s: %s\n", argv0, out_name, strerror(errno));
+      exit(1);
+   }
+   out_pos += len;
+}
+
+static uint8_t *put_value(uint8_t *p, uint64_t value, size_t size)
+{
+   size_t i;
+
+   for (i = 0; i < size; i++)
+      p[out_big_endian ? size - 1 - i : i] = (uint8_t) (value >> (8 * i));
+   return p + size;
+}
+
+static uint8_t *put_uvarint(uint8_t *p, uint64_t value)
+{
+   while (value >= 0x80)
+   {
+      *p++ = (uint8_t) (value | 0x80);
+      value >>= 7;
+   }
+   *p++ = (uint8_t) value;
+   return p;
+}
+
+static void out_record(uint8_t type, const uint8_t *payload, uint64_t len)
+{
+   uint8_t head[10];
+   uint8_t *p = head;
+
+   *p++ = type;
+   if (len < 255)
+      *p++ = (uint8_t) len;
+   else
+   {
+      *p++ = 255;
+      p = put_value(p, len, 8);
+   }
+   out_bytes(head, p - head);
+   out_bytes(payload, len);
+}
+
+/* Copies records as they are in the input */
+static void copy_raw(const source *src, uint64_t start, uint64_t end)
+{
+   out_bytes(dgt_file_stream(src->file) + start, end - start);
+}
+
+static void add_label(const dgt_record *record)
+{
+   const uint8_t *end = record->payload + record->length;
+   const uint8_t *label;
+   uint64_t instrs;
+   size_t len;
+
+   label = dgt_get_uvarint(record->payload, end, &instrs);
+   if (label == NULL || out_n_chunks == 0)
+      return;
+   len = strnlen((const char *) label, end - label);
+   labels = grow(labels, labels_len + len, &labels_size, 1);
+   memcpy(labels + labels_len, label, len);
+   labels[labels_len + len] = '\0';
+   labels_len += len + 1;
+   out_chunks[out_n_chunks - 1].n_labels++;
+}
+
+static int is_summary(uint8_t type)
+{
+   switch (type)
+   {
+   case DG_R_HEATMAP:
+   case DG_R_REUSE:
+   case DG_R_CACHE_CONFIG:
+   case DG_R_CACHE_MISSES:
+   case DG_R_ALLOC_STATS:
+   case DG_R_FIELD_HEAT:
+   case DG_R_SHARING:
+   case DG_R_PAGES:
+   case DG_R_TLB_CONFIG:
+   case DG_R_TLB_MISSES:
+   case DG_R_ACCESS_PATTERNS:
+   case DG_R_ATOMICS:
+   case DG_R_WORKING_SET:
+   case DG_R_RASTER:
+   case DG_R_VALUE_STATS:
+   case DG_R_SOURCE_STATS:
+   case DG_R_SIMPOINTS:
+   case DG_R_FIRST_TOUCH:
+   case DG_R_ACCESS_COUNTS:
+   case DG_R_AFFINITY:
+   case DG_R_CONTEXT_COUNTS:
+      return 1;
+   default:
+      return 0;
+   }
+}
+
+/* Copies the definitions that a DG_R_FORK_DEFS of file takes from the
+ * parent's trace, numbered for src as if they were its own, so that the
+ * merged trace does not need the parent's. The text mappings come too.
+ */
+static void copy_fork_defs(source *src, const dgt_file *file, const dgt_record *fork_record)
+{
+   size_t ws = out_word_size;
+   dgt_fork_defs fork;
+   dgt_file *parent = NULL;
+   dgt_cursor cursor;
+   dgt_record record;
+   uint8_t *buf = NULL;
+   size_t buf_size = 0;
+   uint64_t value;
+   int ret;
+
+   ret = dgt_parse_fork_defs(fork_record, &fork);
+   if (ret != DGT_OK)
+      bad_trace(src);
+   ret = dgt_open_parent(file, &fork, &parent);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: parent trace %s: %s\n", argv0, src->name, fork.parent,
+              ret == DGT_ERR_IO ? strerror(errno) : dgt_strerror(ret));
+      exit(1);
+   }
+   dgt_cursor_init(&cursor, parent);
+   while (cursor.pos < fork.end && (ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      switch (record.type)
+      {
+      case DG_R_TEXT_AVMA:
+         out_record(record.type, record.payload, record.length);
+         break;
+      case DG_R_BBDEF:
+         remap_add(&src->bbdefs, out_n_bbdefs++);
+         out_record(record.type, record.payload, record.length);
+         break;
+      case DG_R_ALLOC_STACK:
+         remap_add(&src->stacks, out_n_stacks++);
+         out_record(record.type, record.payload, record.length);
+         break;
+      case DG_R_CONTEXT:
+         if (record.length < ws)
+            bad_trace(src);
+         value = dgt_get_word(parent, record.payload);
+         if (value >= src->bbdefs.n)
+            bad_trace(src);
+         buf = grow(buf, record.length, &buf_size, 1);
+         memcpy(buf, record.payload, record.length);
+         put_value(buf, src->bbdefs.map[value], ws);
+         remap_add(&src->contexts, out_n_contexts++);
+         out_record(record.type, buf, record.length);
+         break;
+      case DG_R_FORK_DEFS:
+         copy_fork_defs(src, parent, &record);
+         break;
+      default:
+         break;
+      }
+   }
+   if (ret < 0 || src->bbdefs.n != fork.n_bbdefs || src->contexts.n != fork.n_contexts)
+      bad_trace(src);
+   free(buf);
+   dgt_close(parent);
+}
+
+/* Copies the records from start to end into the output, with the numbers
+ * of definitions changed to those of the output. In the records before the
+ * first chunk, the process and thread are left to the chunk record.
+ */
+static void copy_records(source *src, uint64_t start, uint64_t end, int prefix)
+{
+   size_t ws = out_word_size;
+   dgt_cursor cursor;
+   dgt_record record;
+   uint8_t *buf = NULL;
+   size_t buf_size = 0;
+   uint64_t value;
+   int ret = 0;
+
+   dgt_cursor_init(&cursor, src->file);
+   dgt_cursor_seek(&cursor, start);
+   while (cursor.pos < end && (ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *rest;
+
+      buf = grow(buf, record.length + 10, &buf_size, 1);
+      switch (record.type)
+      {
+      case DG_R_HEADER:
+      case DG_R_CHUNK:
+      case DG_R_INDEX:
+      case DG_R_FOOTER:
+      case DG_R_SHARD:
+         break;
+      case DG_R_PROCESS:
+      case DG_R_THREAD:
+         if (!prefix)
+            copy_raw(src, record.offset, cursor.pos);
+         break;
+      case DG_R_BBDEF:
+         remap_add(&src->bbdefs, out_n_bbdefs++);
+         copy_raw(src, record.offset, cursor.pos);
+         break;
+      case DG_R_FORK_DEFS:
+         copy_fork_defs(src, src->file, &record);
+         break;
+      case DG_R_ALLOC_STACK:
+         remap_add(&src->stacks, out_n_stacks++);
+         copy_raw(src, record.offset, cursor.pos);
+         break;
+      case DG_R_CONTEXT:
+         if (record.length < ws)
+            bad_trace(src);
+         value = dgt_get_word(src->file, p);
+         if (value >= src->bbdefs.n)
+            bad_trace(src);
+         memcpy(buf, p, record.length);
+         put_value(buf, src->bbdefs.map[value], ws);
+         remap_add(&src->contexts, out_n_contexts++);
+         out_record(record.type, buf, record.length);
+         break;
+      case DG_R_MALLOC_BLOCK:
+      case DG_R_REALLOC_BLOCK:
+         {
+            /* The stack index is the last word of both */
+            size_t at = (record.type == DG_R_MALLOC_BLOCK ? 2 : 3) * ws;
+
+            if (record.length < at + ws)
+               bad_trace(src);
+            value = dgt_get_word(src->file, p + at);
+            memcpy(buf, p, record.length);
+            /* Blocks without a stack keep the all-ones index */
+            if (value < src->stacks.n)
+               put_value(buf + at, src->stacks.map[value], ws);
+            out_record(record.type, buf, record.length);
+         }
+         break;
+      case DG_R_MEMPOOL:
+         if (record.length < 1 + ws)
+            bad_trace(src);
+         memcpy(buf, p, record.length);
+         if (p[0] == DG_POOL_ALLOC)
+         {
+            size_t at = 1 + 3 * ws;
+
+            if (record.length < at + ws)
+               bad_trace(src);
+            value = dgt_get_word(src->file, p + at);
+            if (value < src->stacks.n)
+               put_value(buf + at, src->stacks.map[value], ws);
+         }
+         out_record(record.type, buf, record.length);
+         break;
+      case DG_R_BBRUN:
+      case DG_R_BBRUN_FILTERED:
+      case DG_R_BBRUN_STRIDED:
+      case DG_R_BBRUN_LINES:
+         rest = dgt_get_uvarint(p, p + record.length, &value);
+         if (rest == NULL || value >= src->contexts.n)
+            bad_trace(src);
+         {
+            uint8_t *q = put_uvarint(buf, src->contexts.map[value]);
+
+            memcpy(q, rest, p + record.length - rest);
+            q += p + record.length - rest;
+            out_record(record.type, buf, q - buf);
+         }
+         break;
+      case DG_R_START_EVENT:
+         add_label(&record);
+         copy_raw(src, record.offset, cursor.pos);
+         break;
+      case DG_R_END_EVENT:
+         /* Summaries number contexts and ranges as in their own trace, so
+          * they are left out rather than renumbered
+          */
+         rest = dgt_get_uvarint(p, p + record.length, &value);
+         if (rest == NULL || (rest = memchr(rest, '\0', p + record.length - rest)) == NULL)
+            bad_trace(src);
+         if (rest + 1 < p + record.length)
+         {
+            n_event_summaries++;
+            out_record(record.type, p, rest + 1 - p);
+         }
+         else
+            copy_raw(src, record.offset, cursor.pos);
+         break;
+      default:
+         if (is_summary(record.type))
+            n_dropped++;
+         else
+            copy_raw(src, record.offset, cursor.pos);
+         break;
+      }
+   }
+   if (ret < 0)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, src->name, dgt_strerror(ret));
+      exit(1);
+   }
+   free(buf);
+}
+
+/* Finds the chunks and the process record of an input */
+static void scan_source(source *src)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   uint64_t start_usecs = 0, end;
+   size_t chunks_size = 0;
+   int ret;
+
+   dgt_cursor_init(&cursor, src->file);
+   src->prefix_start = cursor.pos;
+   src->prefix_end = dgt_file_stream_size(src->file);
+   end = src->prefix_end;
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *pend = p + record.length;
+
+      if (record.type == DG_R_INDEX || record.type == DG_R_FOOTER)
+      {
+         end = record.offset;
+         break;
+      }
+      else if (record.type == DG_R_PROCESS && !src->chunked && src->process_end == 0)
+      {
+         uint64_t pid, ppid;
+
+         if ((p = dgt_get_uvarint(p, pend, &pid)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &ppid)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &start_usecs)) == NULL)
+            bad_trace(src);
+         src->process_start = record.offset;
+         src->process_end = cursor.pos;
+      }
+      else if (record.type == DG_R_SHARD && !src->sharded)
+      {
+         if ((p = dgt_get_uvarint(p, pend, &src->shard)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &src->n_shards)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &src->shard_instrs)) == NULL)
+            bad_trace(src);
+         src->sharded = 1;
+      }
+      else if (record.type == DG_R_CHUNK)
+      {
+         stretch *s;
+         uint64_t chunk, n_bbdefs, n_contexts, usecs = 0;
+
+         src->chunks = grow(src->chunks, src->n_chunks, &chunks_size, sizeof(stretch));
+         s = &src->chunks[src->n_chunks];
+         if ((p = dgt_get_uvarint(p, pend, &chunk)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &s->instrs)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &s->tid)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &n_bbdefs)) == NULL
+             || (p = dgt_get_uvarint(p, pend, &n_contexts)) == NULL)
+            bad_trace(src);
+         /* Older traces do not have the time */
+         if (p < pend && dgt_get_uvarint(p, pend, &usecs) == NULL)
+            bad_trace(src);
+         s->body = cursor.pos;
+         s->usecs = start_usecs + usecs;
+         if (src->n_chunks > 0)
+            src->chunks[src->n_chunks - 1].end = record.offset;
+         else
+            src->prefix_end = record.offset;
+         src->n_chunks++;
+         src->chunked = 1;
+      }
+   }
+   if (ret < 0)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, src->name, dgt_strerror(ret));
+      exit(1);
+   }
+
+   if (!src->chunked)
+   {
+      /* The whole trace is one chunk */
+      src->chunks = malloc(sizeof(stretch));
+      if (src->chunks == NULL)
+         out_of_memory();
+      src->chunks[0].body = src->prefix_start;
+      src->chunks[0].instrs = 0;
+      src->chunks[0].tid = 1;
+      src->chunks[0].usecs = start_usecs;
+      src->n_chunks = 1;
+   }
+   src->chunks[src->n_chunks - 1].end = end;
+}
+
+static void write_chunk(source *src, uint64_t base_usecs)
+{
+   const stretch *s = &src->chunks[src->next];
+   uint8_t payload[6 * 10];
+   uint8_t *p = payload;
+   out_chunk *c;
+
+   out_chunks = grow(out_chunks, out_n_chunks, &out_chunks_size, sizeof(out_chunk));
+   c = &out_chunks[out_n_chunks++];
+   c->offset = out_pos;
+   c->instrs = s->instrs;
+   c->n_labels = 0;
+   c->labels = labels_len;
+
+   p = put_uvarint(p, out_n_chunks - 1);
+   p = put_uvarint(p, s->instrs);
+   p = put_uvarint(p, s->tid);
+   p = put_uvarint(p, out_n_bbdefs);
+   p = put_uvarint(p, out_n_contexts);
+   p = put_uvarint(p, s->usecs > base_usecs ? s->usecs - base_usecs : 0);
+   out_record(DG_R_CHUNK, payload, p - payload);
+   copy_raw(src, src->process_start, src->process_end);
+   if (src->next == 0 && src->chunked)
+      copy_records(src, src->prefix_start, src->prefix_end, 1);
+   copy_records(src, s->body, s->end, 0);
+   src->next++;
+}
+
+/* Checks that the inputs are all shards of one run, or none are. Returns
+ * whether they are shards, and whether every shard is there.
+ */
+static int check_shards(const source *sources, size_t n_sources, int *complete)
+{
+   size_t i, j;
+
+   for (i = 0; i < n_sources; i++)
+   {
+      const source *src = &sources[i];
+
+      if (src->sharded != sources[0].sharded)
+      {
+         fprintf(stderr, "%s: %s and %s are not both shards\n",
+                 argv0, sources[0].name, src->name);
+         exit(1);
+      }
+      if (!src->sharded)
+         continue;
+      if (src->n_shards != sources[0].n_shards
+          || src->shard_instrs != sources[0].shard_instrs)
+      {
+         fprintf(stderr, "%s: %s and %s are shards of different sizes or counts\n",
+                 argv0, sources[0].name, src->name);
+         exit(1);
+      }
+      for (j = 0; j < i; j++)
+         if (sources[j].shard == src->shard)
+         {
+            fprintf(stderr, "%s: %s and %s are both shard %llu\n",
+                    argv0, sources[j].name, src->name, (unsigned long long) src->shard);
+            exit(1);
+         }
+   }
+   *complete = sources[0].sharded && n_sources == sources[0].n_shards;
+   if (sources[0].sharded && !*complete)
+      fprintf(stderr, "%s: only %llu of the %llu shards are given\n",
+              argv0, (unsigned long long) n_sources,
+              (unsigned long long) sources[0].n_shards);
+   return sources[0].sharded;
+}
+
+static void write_index(void)
+{
+   uint8_t *payload, *p;
+   uint8_t footer[DG_FOOTER_SIZE];
+   uint64_t index_offset = out_pos;
+   size_t i;
+
+   payload = malloc(10 + out_n_chunks * 3 * 10 + labels_len);
+   if (payload == NULL)
+      out_of_memory();
+   p = put_uvarint(payload, out_n_chunks);
+   for (i = 0; i < out_n_chunks; i++)
+   {
+      const out_chunk *c = &out_chunks[i];
+      const char *label = labels + c->labels;
+      uint64_t j;
+
+      p = put_uvarint(p, c->offset);
+      p = put_uvarint(p, c->instrs);
+      p = put_uvarint(p, c->n_labels);
+      for (j = 0; j < c->n_labels; j++)
+      {
+         size_t len = strlen(label) + 1;
+
+         memcpy(p, label, len);
+         p += len;
+         label += len;
+      }
+   }
+   out_record(DG_R_INDEX, payload, p - payload);
+   free(payload);
+
+   footer[0] = DG_R_FOOTER;
+   footer[1] = DG_FOOTER_SIZE - 2;
+   put_value(footer + 2, index_offset, 8);
+   memcpy(footer + 10, "DGINDEX", 8);
+   out_bytes(footer, sizeof(footer));
+}
+
+int main(int argc, char **argv)
+{
+   source *sources;
+   size_t n_sources = 0, i;
+   uint64_t base_usecs = UINT64_MAX;
+   uint64_t flags = DG_HEADER_CHUNKED | DG_HEADER_MERGED;
+   uint8_t header[2 + 11 + 4 + 10 + 32];
+   uint8_t *p;
+   size_t version_len;
+   int sharded, complete;
+   int ret;
+
+   if (argv[0])
+      argv0 = argv[0];
+   sources = calloc(argc > 1 ? argc : 1, sizeof(source));
+   if (sources == NULL)
+      out_of_memory();
+   for (i = 1; i < (size_t) argc; i++)
+   {
+      if (strcmp(argv[i], "-o") == 0 && i + 1 < (size_t) argc)
+         out_name = argv[++i];
+      else if (argv[i][0] == '-')
+         usage();
+      else
+         sources[n_sources++].name = argv[i];
+   }
+   if (out_name == NULL || n_sources == 0)
+      usage();
+
+   for (i = 0; i < n_sources; i++)
+   {
+      source *src = &sources[i];
+      const dgt_header *h;
+
+      ret = dgt_open(src->name, &src->file);
+      if (ret != DGT_OK)
+      {
+         fprintf(stderr, "%s: %s: %s\n", argv0, src->name, dgt_strerror(ret));
+         return 1;
+      }
+      h = dgt_file_header(src->file);
+      /* Strides are only used by strided runs, so traces without can
+       * share the flag, and so on. Every run implies its fetches.
+       */
+      flags |= h->flags & (DG_HEADER_SAMPLED | DG_HEADER_SUMMARY | DG_HEADER_PARTIAL
+                           | DG_HEADER_STRIDED | DG_HEADER_LINES
+                           | DG_HEADER_INSTRS);
+      if (i == 0)
+      {
+         out_big_endian = h->big_endian;
+         out_word_size = h->word_size;
+      }
+      else if (h->big_endian != out_big_endian || h->word_size != out_word_size)
+      {
+         fprintf(stderr, "%s: %s: byte order or word size differs from %s\n",
+                 argv0, src->name, sources[0].name);
+         return 1;
+      }
+      scan_source(src);
+      if (src->chunks[0].usecs < base_usecs)
+         base_usecs = src->chunks[0].usecs;
+   }
+
+   /* Together, all the shards are the whole run */
+   sharded = check_shards(sources, n_sources, &complete);
+   if (complete)
+      flags &= ~DG_HEADER_PARTIAL;
+
+   out = fopen(out_name, "wb");
+   if (out == NULL)
+   {
+      fprintf(stderr, "%s: cannot create %s: %s\n", argv0, out_name, strerror(errno));
+      return 1;
+   }
+   header[0] = DG_R_HEADER;
+   memcpy(header + 2, "DATAGRIND1", 11);
+   header[13] = DGT_FILE_VERSION;
+   header[14] = out_big_endian;
+   header[15] = out_word_size;
+   header[16] = DG_COMPRESS_NONE;
+   p = put_uvarint(header + 17, flags);
+   /* The version of the first input stands for them all */
+   version_len = strlen(dgt_file_header(sources[0].file)->tool_version) + 1;
+   memcpy(p, dgt_file_header(sources[0].file)->tool_version, version_len);
+   p += version_len;
+   header[1] = p - header - 2;
+   out_bytes(header, p - header);
+
+   /* Always the earliest chunk not yet written, keeping each input in
+    * order, or the chunks of the earliest shard not yet written
+    */
+   for (;;)
+   {
+      source *first = NULL;
+
+      for (i = 0; i < n_sources; i++)
+      {
+         source *src = &sources[i];
+
+         if (src->next < src->n_chunks
+             && (first == NULL
+                 || (sharded ? src->shard < first->shard
+                             : src->chunks[src->next].usecs < first->chunks[first->next].usecs)))
+            first = src;
+      }
+      if (first == NULL)
+         break;
+      write_chunk(first, base_usecs);
+   }
+   write_index();
+   if (fclose(out) != 0)
+   {
+      fprintf(stderr, "%s: cannot write %s: %s\n", argv0, out_name, strerror(errno));
+      return 1;
+   }
+   if (n_dropped > 0)
+      fprintf(stderr, "%s: left out %llu analysis summary records\n",
+              argv0, (unsigned long long) n_dropped);
+   if (n_event_summaries > 0)
+      fprintf(stderr, "%s: left out the summaries of %llu events\n",
+              argv0, (unsigned long long) n_event_summaries);
+
+   for (i = 0; i < n_sources; i++)
+   {
+      free(sources[i].chunks);
+      free(sources[i].bbdefs.map);
+      free(sources[i].contexts.map);
+      free(sources[i].stacks.map);
+      dgt_close(sources[i].file);
+   }
+   free(sources);
+   free(out_chunks);
+   free(labels);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
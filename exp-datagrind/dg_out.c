@@ -0,0 +1,1222 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: buffered output of the trace.            dg_out.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_vki.h"
+#include "pub_tool_vkiscnums.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
+#include "pub_tool_options.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* The LZO compressor in the core, used for compressed debuginfo */
+#include "../coregrind/m_debuginfo/minilzo.h"
+
+/* From pub_core_libcfile.h, which tools can not include, for streaming
+ * the output as --log-socket and --log-fd do.
+ */
+extern Int VG_(safe_fd)(Int oldfd);
+extern Int VG_(connect_via_socket)(const HChar *str);
+extern Int VG_(write_socket)(Int sd, const void *msg, Int count);
+/* From pub_core_syscall.h, for fdatasync and fadvise, which have no
+ * wrappers
+ */
+extern SysRes VG_(do_syscall)(UWord sysno, RegWord, RegWord, RegWord,
+                              RegWord, RegWord, RegWord, RegWord, RegWord);
+
+/* The output can either be written directly to the file, or handed over
+ * a pipe to a forked writer process. In the latter case the guest only
+ * waits for the data to be copied into the pipe, never for the disk, and
+ * the pipe (enlarged to the buffer size where the kernel allows it) acts
+ * as the second half of a double buffer.
+ *
+ * With compression, everything after the header is a sequence of frames,
+ * each holding one independently compressed chunk of the record stream.
+ * Compression is done by the writer process if there is one, so that it
+ * overlaps with running the guest.
+ *
+ * Nothing is ever read back or overwritten, so the output may equally be a
+ * socket or an inherited pipe. Writes block until the reader takes the
+ * data, which slows the guest down to the reader's pace rather than
+ * losing any.
+ *
+ * With --datagrind-ring-size, nothing is written until a dump is asked
+ * for. The record stream goes into a ring instead, from which the oldest
+ * chunks are dropped to make room. The definitions in a dropped chunk
+ * (blocks, contexts, ranges and so on) are still needed to decode the
+ * later chunks, so they are copied out and kept, as are the heap blocks
+ * still live where the ring now starts. A dump is then the header, the
+ * kept definitions and blocks, the chunks in the ring, and an index of
+ * those.
+ *
+ * With --datagrind-rotate-size or --datagrind-rotate-instrs, the trace is
+ * split over numbered files, each starting at a chunk. The definitions are
+ * picked out of the stream as it is written, and each new file starts
+ * with the header, all the definitions so far and the live heap blocks in
+ * the same way, so that any file can be decoded on its own.
+ *
+ * With --datagrind-out-cache=drop, every DG_DROP_BATCH bytes written to a
+ * file are waited for with fdatasync and then dropped from the page cache
+ * with fadvise, so that a trace many times the size of memory neither
+ * pushes the guest's own files out of the cache nor leaves a long
+ * writeback to wait for at exit. The writer process does this for what
+ * it writes, so that the guest does not wait for the disk. O_DIRECT would
+ * also keep the trace out of the cache, but it needs every write to be
+ * aligned, and a record stream, frames and footer are not.
+ */
+
+#define DG_DEFAULT_BUFFER_SIZE (4 * 1024 * 1024)
+#define DG_DROP_BATCH (64 * 1024 * 1024)
+
+/* POSIX_FADV_DONTNEED, which differs on 64-bit s390 */
+#if defined(VGA_s390x)
+#define DG_FADV_DONTNEED 6
+#else
+#define DG_FADV_DONTNEED 4
+#endif
+
+UChar *DG_(out_buf) = NULL;
+SizeT DG_(out_buf_size) = 0;
+SizeT DG_(out_buf_used) = 0;
+ULong DG_(out_flushed) = 0;
+
+/* Counters for --stats=yes and the stats monitor command. Writing and
+ * compressing done by the writer process (--datagrind-async-writer) are
+ * not seen. Records are only tallied by type with --stats=yes, since that
+ * takes a pass over the headers.
+ */
+static ULong stats_flushes = 0;
+static ULong stats_writes = 0;
+static ULong stats_write_usecs = 0;
+static ULong stats_compress_usecs = 0;
+static ULong stats_drops = 0;
+static ULong stats_drop_usecs = 0;
+static ULong stats_type_records[256];
+static ULong stats_type_bytes[256];
+static UChar tally_head[2 + sizeof(ULong)];
+static SizeT tally_head_len = 0;
+static ULong tally_left = 0;         /* Payload bytes still to come */
+
+static Int out_file_fd = -1;    /* The output file itself */
+static Int out_fd = -1;         /* Where buffers are written: file or pipe */
+static Int writer_pid = -1;
+static Bool out_socket = False;  /* out_file_fd is a socket */
+static Bool out_framed = False;  /* Header is written; making frames */
+
+static UChar *lzo_out = NULL;
+static void *lzo_wrkmem = NULL;
+
+static Int clo_buffer_size = DG_DEFAULT_BUFFER_SIZE;
+static Bool clo_drop_cache = False;
+static Bool clo_async_writer = False;
+Int DG_(clo_compress) = DG_COMPRESS_NONE;
+Long DG_(clo_ring_size) = 0;
+Bool DG_(clo_fork_files) = False;
+
+static Long clo_rotate_size = 0;
+static Long clo_rotate_instrs = 0;
+
+/* Of the output file, with --datagrind-out-cache=drop */
+static ULong drop_from = 0;           /* File offset not yet dropped */
+static ULong drop_pending = 0;        /* Bytes written since the last drop */
+
+/* A heap block that was allocated before the kept records and not yet
+ * freed
+ */
+typedef struct DgKeptBlock
+{
+   struct DgKeptBlock *next;
+   UWord key;          /* Address */
+   UWord size;
+   UWord stack_index;
+} DgKeptBlock;
+
+/* A memory pool that was created before the kept records, with its live
+ * chunks (DgKeptBlock)
+ */
+typedef struct DgKeptPool
+{
+   struct DgKeptPool *next;
+   UWord key;          /* Anchor */
+   VgHashTable *chunks;
+} DgKeptPool;
+
+static const HChar *out_name = NULL;  /* Unexpanded, for numbered files */
+static HChar *out_filename = NULL;    /* Expanded, of a plain file */
+static XArray *kept_header = NULL;    /* UChar */
+static XArray *kept_defs = NULL;      /* UChar: definition records */
+static VgHashTable *kept_blocks = NULL;   /* DgKeptBlock */
+static VgHashTable *kept_pools = NULL;    /* DgKeptPool */
+
+static UChar *ring = NULL;            /* DG_(clo_ring_size) bytes */
+static ULong ring_start = 0;          /* Stream offset of the oldest byte kept */
+static ULong ring_end = 0;            /* Stream offset after the newest byte */
+static UInt ring_dumps = 0;
+
+static Bool rotating = False;
+static UInt piece = 1;                /* Number of the file being written */
+static Long piece_delta = 0;          /* File offset less stream offset */
+static ULong piece_start = 0;         /* Stream offset of its first chunk */
+static ULong piece_instrs = 0;        /* Instructions before its first chunk */
+static Bool piece_started = False;    /* First chunk of the file is written */
+
+/* The record being passed to the file, while rotating */
+static UChar scan_head[2 + sizeof(ULong)];
+static SizeT scan_head_len = 0;
+static ULong scan_left = 0;           /* Payload bytes still to come */
+static Bool scan_in_payload = False;
+static XArray *scan_record = NULL;    /* UChar, if it is kept */
+
+Bool DG_(out_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BINT_CLO(arg, "--datagrind-buffer-size", clo_buffer_size,
+                   4096, 1024 * 1024 * 1024)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-async-writer", clo_async_writer)) {}
+   else if VG_XACT_CLO(arg, "--datagrind-out-cache=keep", clo_drop_cache, False) {}
+   else if VG_XACT_CLO(arg, "--datagrind-out-cache=drop", clo_drop_cache, True) {}
+   else if VG_XACT_CLO(arg, "--datagrind-compress=none", DG_(clo_compress),
+                       DG_COMPRESS_NONE) {}
+   else if VG_XACT_CLO(arg, "--datagrind-compress=lzo", DG_(clo_compress),
+                       DG_COMPRESS_LZO) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-ring-size", DG_(clo_ring_size),
+                        0, 1LL << 40)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-rotate-size", clo_rotate_size,
+                        0, 1LL << 50)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-rotate-instrs", clo_rotate_instrs,
+                        0, 1LL << 62)) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-fork-files", DG_(clo_fork_files))) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(out_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-buffer-size=<n>      size of output buffer in bytes [4M]\n"
+"    --datagrind-async-writer=no|yes  write the trace from a separate\n"
+"                                     process [no]\n"
+"    --datagrind-out-cache=keep|drop  drop the trace from the page cache as\n"
+"                                     it reaches the disk [keep]\n"
+"    --datagrind-compress=none|lzo    compress the trace [none]\n"
+"    --datagrind-ring-size=<n>        keep only the last n bytes of trace in\n"
+"                                     memory, and write them when asked [0]\n"
+"    --datagrind-rotate-size=<n>      start a new output file once it has n\n"
+"                                     bytes, or never if 0 [0]\n"
+"    --datagrind-rotate-instrs=<n>    start a new output file every n\n"
+"                                     instructions, or never if 0 [0]\n"
+"    --datagrind-fork-files=no|yes    give each forked child a file of its\n"
+"                                     own, taking the definitions from\n"
+"                                     before the fork from the parent's [no]\n"
+   );
+}
+
+/* Waits for what has been written to the file fd to reach the disk, and
+ * drops it from the page cache from offset from, returning the offset
+ * dropped up to. Only clean pages can be dropped, hence the wait.
+ */
+static ULong drop_written(Int fd, ULong from)
+{
+   Off64T end = VG_(lseek)(fd, 0, VKI_SEEK_CUR);
+   ULong start = DG_(index_now_usecs)();
+
+   if (end < 0 || (ULong) end <= from)
+      return from;
+#if defined(VGO_linux)
+   VG_(do_syscall)(__NR_fdatasync, fd, 0, 0, 0, 0, 0, 0, 0);
+#  if VG_WORDSIZE == 8
+   VG_(do_syscall)(__NR_fadvise64, fd, from, end - from, DG_FADV_DONTNEED, 0, 0, 0, 0);
+#  endif
+#endif
+   stats_drops++;
+   stats_drop_usecs += DG_(index_now_usecs)() - start;
+   return end;
+}
+
+/* Writes the whole of buf, retrying after partial writes. */
+static void write_all(Int fd, const void *buf, SizeT count)
+{
+   const UChar *p = buf;
+   ULong start = DG_(index_now_usecs)();
+
+   if (clo_drop_cache && fd == out_file_fd)
+      drop_pending += count;
+
+   while (count > 0)
+   {
+      Int chunk = count > 0x40000000 ? 0x40000000 : (Int) count;
+      Int written;
+
+      /* Sent so that a reader going away is an error rather than SIGPIPE */
+      if (out_socket && fd == out_file_fd)
+      {
+         written = VG_(write_socket)(fd, p, chunk);
+         if (written < 0)
+         {
+            VG_(message)(Vg_UserMsg,
+                         "Error: sending datagrind output failed\n");
+            VG_(exit)(1);
+         }
+      }
+      else
+         written = VG_(write)(fd, p, chunk);
+      if (written < 0)
+      {
+         if (written == -VKI_EINTR)
+            continue;
+         VG_(message)(Vg_UserMsg,
+                      "Error: writing datagrind output failed (errno %d)\n",
+                      -written);
+         VG_(exit)(1);
+      }
+      p += written;
+      count -= written;
+      stats_writes++;
+   }
+   stats_write_usecs += DG_(index_now_usecs)() - start;
+   if (fd == out_file_fd && drop_pending >= DG_DROP_BATCH)
+   {
+      drop_from = drop_written(fd, drop_from);
+      drop_pending = 0;
+   }
+}
+
+/* Writes buf as compressed frames of at most one buffer each. A chunk
+ * that does not shrink is stored as is, which the reader recognises by the
+ * stored size being equal to the raw size.
+ */
+static void write_frames(Int fd, const UChar *buf, SizeT count)
+{
+   if (lzo_out == NULL)
+   {
+      lzo_out = VG_(malloc)("datagrind.lzo_out",
+                            clo_buffer_size + clo_buffer_size / 16 + 64 + 3);
+      lzo_wrkmem = VG_(malloc)("datagrind.lzo_wrkmem", LZO1X_1_MEM_COMPRESS);
+   }
+
+   while (count > 0)
+   {
+      SizeT raw = count > clo_buffer_size ? clo_buffer_size : count;
+      lzo_uint stored = 0;
+      UInt frame[2];
+      Int rc;
+
+      ULong start = DG_(index_now_usecs)();
+
+      rc = lzo1x_1_compress(buf, raw, lzo_out, &stored, lzo_wrkmem);
+      stats_compress_usecs += DG_(index_now_usecs)() - start;
+      if (rc != LZO_E_OK || stored >= raw)
+         stored = raw;
+      frame[0] = raw;
+      frame[1] = stored;
+      write_all(fd, frame, sizeof(frame));
+      write_all(fd, stored == raw ? buf : lzo_out, stored);
+      buf += raw;
+      count -= raw;
+   }
+}
+
+static void ring_append(const void *buf, SizeT count);
+static void scan_defs(const UChar *buf, SizeT count);
+
+/* Adds the records in data to the counts for each type. Records may be
+ * split between calls.
+ */
+static void tally_records(const UChar *buf, SizeT count)
+{
+   while (count > 0)
+   {
+      if (tally_left > 0)
+      {
+         SizeT n = count < tally_left ? count : tally_left;
+
+         buf += n;
+         count -= n;
+         tally_left -= n;
+         continue;
+      }
+      tally_head[tally_head_len++] = *buf++;
+      count--;
+      if (tally_head[0] >= 128)
+      {
+         if (tally_head_len == 2)
+         {
+            stats_type_records[tally_head[0]]++;
+            stats_type_bytes[tally_head[0]] += 2;
+            tally_head_len = 0;
+         }
+         continue;
+      }
+      if (tally_head_len < 2
+          || (tally_head[1] == 255 && tally_head_len < sizeof(tally_head)))
+         continue;
+      if (tally_head[1] == 255)
+         VG_(memcpy)(&tally_left, tally_head + 2, sizeof(tally_left));
+      else
+         tally_left = tally_head[1];
+      stats_type_records[tally_head[0]]++;
+      stats_type_bytes[tally_head[0]] += tally_head_len + tally_left;
+      tally_head_len = 0;
+   }
+}
+
+/* Writes data from the guest to wherever it goes next. */
+static void write_out(const void *buf, SizeT count)
+{
+   if (VG_(clo_stats))
+      tally_records(buf, count);
+   if (!out_framed && kept_header != NULL && count > 0)
+      VG_(addBytesToXA)(kept_header, buf, count);
+   if (ring != NULL)
+   {
+      if (out_framed)
+         ring_append(buf, count);
+      return;
+   }
+   if (rotating && out_framed)
+      scan_defs(buf, count);
+   if (writer_pid == -1 && out_framed && DG_(clo_compress) != DG_COMPRESS_NONE)
+      write_frames(out_file_fd, buf, count);
+   else
+      write_all(out_fd, buf, count);
+}
+
+/* Body of the writer process: copies everything from the pipe to the file
+ * until end of file. Reads are gathered into whole buffers so that
+ * compressed frames are not limited to the pipe size.
+ */
+static void writer_main(Int in_fd, Int file_fd)
+{
+   SizeT size = clo_buffer_size;
+   UChar *buf = VG_(malloc)("datagrind.writer_main", size);
+
+   for (;;)
+   {
+      SizeT filled = 0;
+      Bool eof = False;
+
+      while (filled < size && !eof)
+      {
+         Int n = VG_(read)(in_fd, buf + filled, size - filled);
+         if (n == -VKI_EINTR)
+            continue;
+         if (n <= 0)
+            eof = True;
+         else
+            filled += n;
+      }
+      if (DG_(clo_compress) != DG_COMPRESS_NONE)
+         write_frames(file_fd, buf, filled);
+      else
+         write_all(file_fd, buf, filled);
+      if (eof)
+         break;
+   }
+   if (clo_drop_cache)
+      drop_written(file_fd, drop_from);
+}
+
+static void start_writer(void)
+{
+   Int pid;
+   Int fd = VG_(start_writer)(out_file_fd, clo_buffer_size, writer_main, &pid);
+
+   if (fd < 0)
+   {
+      VG_(message)(Vg_UserMsg,
+                   "Warning: can not start datagrind writer; "
+                   "writing synchronously\n");
+      return;
+   }
+   writer_pid = pid;
+   out_fd = fd;
+}
+
+/* A forked guest carries on with synchronous writes to the inherited file,
+ * as it would without the writer. Keeping our end of the pipe open would
+ * stop the writer from ever seeing end of file.
+ */
+static void out_atfork_child(ThreadId tid)
+{
+   if (writer_pid != -1)
+   {
+      VG_(abandon_writer)(out_fd);
+      out_fd = out_file_fd;
+      writer_pid = -1;
+   }
+}
+
+/* Opens the nth of the numbered files for the ring dumps or rotation,
+ * returning the descriptor or -1. The name is returned in filename.
+ */
+static Int open_numbered(UInt n, HChar **filename)
+{
+   HChar *base = VG_(expand_file_name)("--datagrind-out-file", out_name);
+   SysRes sres;
+
+   *filename = VG_(malloc)("datagrind.out.filename", VG_(strlen)(base) + 16);
+   VG_(sprintf)(*filename, "%s.%u", base, n);
+   VG_(free)(base);
+   sres = VG_(open)(*filename, VKI_O_CREAT | VKI_O_TRUNC | VKI_O_WRONLY,
+                    VKI_S_IRUSR | VKI_S_IWUSR);
+   return sr_isError(sres) ? -1 : (Int) sr_Res(sres);
+}
+
+static void open_piece(void)
+{
+   HChar *filename;
+
+   out_file_fd = open_numbered(piece, &filename);
+   if (out_file_fd == -1)
+   {
+      VG_(message)(Vg_UserMsg,
+                   "Error: can not open datagrind output file `%s'\n",
+                   filename);
+      VG_(exit)(1);
+   }
+   VG_(free)(filename);
+}
+
+static void open_file(const HChar *name)
+{
+   HChar *filename = VG_(expand_file_name)("--datagrind-out-file", name);
+   SysRes sres;
+
+   sres = VG_(open)(filename, VKI_O_CREAT | VKI_O_TRUNC | VKI_O_WRONLY,
+                    VKI_S_IRUSR | VKI_S_IWUSR);
+   if (sr_isError(sres))
+   {
+      VG_(message)(Vg_UserMsg,
+                   "Error: can not open datagrind output file `%s'\n",
+                   filename);
+      VG_(exit)(1);
+   }
+   out_file_fd = (Int) sr_Res(sres);
+   VG_(free)(out_filename);
+   out_filename = filename;
+}
+
+void DG_(out_open)(const HChar *name)
+{
+   Bool streaming = VG_(strncmp)(name, "tcp:", 4) == 0
+                    || VG_(strncmp)(name, "fd:", 3) == 0;
+
+   out_name = name;
+   rotating = clo_rotate_size > 0 || clo_rotate_instrs > 0;
+   if (DG_(clo_ring_size) > 0 || rotating)
+   {
+      const HChar *option = rotating ? "--datagrind-rotate-size" : "--datagrind-ring-size";
+
+      if (DG_(clo_ring_size) > 0 && rotating)
+         VG_(fmsg_bad_option)(option, "Can not be used with --datagrind-ring-size\n");
+      if (streaming)
+         VG_(fmsg_bad_option)(option, "Needs --datagrind-out-file to be a file\n");
+      if (clo_async_writer)
+         VG_(fmsg_bad_option)(option, "Can not be used with --datagrind-async-writer\n");
+      kept_header = VG_(newXA)(VG_(malloc), "datagrind.kept.header", VG_(free),
+                               sizeof(UChar));
+      kept_defs = VG_(newXA)(VG_(malloc), "datagrind.kept.defs", VG_(free),
+                             sizeof(UChar));
+      kept_blocks = VG_(HT_construct)("datagrind.kept.blocks");
+      kept_pools = VG_(HT_construct)("datagrind.kept.pools");
+   }
+
+   if (clo_drop_cache && streaming)
+      VG_(fmsg_bad_option)("--datagrind-out-cache=drop",
+                           "Needs --datagrind-out-file to be a file\n");
+   if (DG_(clo_fork_files))
+   {
+      if (streaming)
+         VG_(fmsg_bad_option)("--datagrind-fork-files",
+                              "Needs --datagrind-out-file to be a file\n");
+      if (DG_(clo_ring_size) > 0 || rotating)
+         VG_(fmsg_bad_option)("--datagrind-fork-files",
+                              "Can not be used with --datagrind-ring-size or rotation\n");
+      if (!DG_(index_chunked)())
+         VG_(fmsg_bad_option)("--datagrind-fork-files",
+                              "Can not be used with --datagrind-chunk-size=0\n");
+   }
+
+   if (DG_(clo_ring_size) > 0)
+   {
+      if (DG_(clo_ring_size) < 2 * (Long) clo_buffer_size)
+         VG_(fmsg_bad_option)("--datagrind-ring-size",
+                              "Must be at least twice --datagrind-buffer-size\n");
+      ring = VG_(malloc)("datagrind.ring", DG_(clo_ring_size));
+   }
+   else if (rotating)
+   {
+      scan_record = VG_(newXA)(VG_(malloc), "datagrind.scan.record", VG_(free),
+                               sizeof(UChar));
+      open_piece();
+   }
+   else if (VG_(strncmp)(name, "tcp:", 4) == 0)
+   {
+      Int sd = VG_(connect_via_socket)(name + 4);
+      if (sd == -1)
+         VG_(fmsg_bad_option)("--datagrind-out-file",
+                              "Expected tcp:<ip>:<port>, with a numeric IPv4 address\n");
+      else if (sd < 0)
+      {
+         VG_(message)(Vg_UserMsg,
+                      "Error: can not connect datagrind output to `%s'\n",
+                      name + 4);
+         VG_(exit)(1);
+      }
+      out_file_fd = VG_(safe_fd)(sd);
+      out_socket = True;
+   }
+   else if (VG_(strncmp)(name, "fd:", 3) == 0)
+   {
+      HChar *end;
+      Long fd = VG_(strtoll10)(name + 3, &end);
+
+      if (end == name + 3 || *end != '\0' || fd < 0
+          || VG_(fcntl)(fd, VKI_F_GETFD, 0) < 0)
+         VG_(fmsg_bad_option)("--datagrind-out-file",
+                              "Expected fd:<n>, with an open file descriptor\n");
+      /* Out of the way of the guest, which might close it */
+      out_file_fd = VG_(safe_fd)(fd);
+   }
+   else
+      open_file(name);
+   out_fd = out_file_fd;
+
+   DG_(out_buf_size) = clo_buffer_size;
+   DG_(out_buf_used) = 0;
+   DG_(out_buf) = VG_(malloc)("datagrind.out_buf", DG_(out_buf_size));
+}
+
+void DG_(out_end_header)(void)
+{
+   DG_(out_flush)();
+   out_framed = True;
+   ring_start = ring_end = DG_(out_flushed);
+   if (clo_async_writer)
+      start_writer();
+   VG_(atfork)(NULL, NULL, out_atfork_child);
+}
+
+HChar *DG_(out_fork_child)(void)
+{
+   HChar *parent = out_filename;
+   HChar *name = VG_(expand_file_name)("--datagrind-out-file", out_name);
+
+   /* Without a %p the name would be the parent's */
+   if (VG_(strcmp)(name, parent) == 0)
+   {
+      HChar *numbered = VG_(malloc)("datagrind.out.filename", VG_(strlen)(name) + 16);
+
+      VG_(sprintf)(numbered, "%s.%d", name, VG_(getpid)());
+      VG_(free)(name);
+      name = numbered;
+   }
+   VG_(close)(out_file_fd);
+   out_filename = NULL;
+   open_file(name);
+   VG_(free)(name);
+   out_fd = out_file_fd;
+   out_framed = False;
+   drop_from = drop_pending = 0;
+   DG_(out_flushed) = 0;
+   DG_(out_buf_used) = 0;
+   return parent;
+}
+
+void DG_(out_write_unbuffered)(const void *buf, SizeT count)
+{
+   write_out(buf, count);
+   DG_(out_flushed) += count;
+}
+
+Bool DG_(out_partial)(void)
+{
+   return DG_(clo_ring_size) > 0 || clo_rotate_size > 0 || clo_rotate_instrs > 0;
+}
+
+void DG_(out_flush)(void)
+{
+   stats_flushes++;
+   write_out(DG_(out_buf), DG_(out_buf_used));
+   DG_(out_flushed) += DG_(out_buf_used);
+   DG_(out_buf_used) = 0;
+}
+
+void DG_(out_print_stats)(DgPrintf print)
+{
+   static const HChar *const names[] =
+   {
+      "HEADER", "READ", "WRITE", "TRACK_RANGE", "UNTRACK_RANGE",
+      "START_EVENT", "END_EVENT", "INSTR", "TEXT_AVMA", "MALLOC_BLOCK",
+      "FREE_BLOCK", "BBDEF", "BBRUN", "CONTEXT", "BBRUN_FILTERED", "THREAD",
+      "CHUNK", "INDEX", "FOOTER", "HEATMAP", "REUSE", "CACHE_CONFIG",
+      "CACHE_MISSES", "ALLOC_STACK", "ALLOC_STATS", "FIELD_HEAT", "SHARING",
+      "PAGES", "TLB_CONFIG", "TLB_MISSES", "SYSCALL_ACCESS", "MAP", "UNMAP",
+      "REMAP", "PROTECT", "PROCESS", "BBRUN_STRIDED",
+      "BBRUN_LINES", "HEAP_SNAPSHOT", "BULK_ACCESS",
+      "REALLOC_BLOCK", "MEMPOOL", "ACCESS_PATTERNS",
+      "ATOMICS", "WORKING_SET", "CHECKPOINT", "RASTER", "VALUE_STATS",
+      "SOURCE_STATS", "SIMPOINTS", "FIRST_TOUCH", "LOCK",
+      "ACCESS_COUNTS", "AFFINITY", "FORK_DEFS", "SHARD",
+      "CONTEXT_COUNTS"
+   };
+   STATIC_ASSERT(sizeof(names) / sizeof(names[0]) == DG_R_LAST + 1);
+   UInt i;
+
+   print("datagrind: %'llu flushes, %'llu writes taking %'llu ms, "
+         "%'llu ms compressing\n",
+         stats_flushes, stats_writes, stats_write_usecs / 1000,
+         stats_compress_usecs / 1000);
+   if (stats_drops > 0)
+      print("datagrind: %'llu page cache drops taking %'llu ms\n",
+            stats_drops, stats_drop_usecs / 1000);
+   if (!VG_(clo_stats))
+      return;
+   for (i = 0; i < 256; i++)
+      if (stats_type_records[i] > 0)
+      {
+         if (i < sizeof(names) / sizeof(names[0]))
+            print("datagrind: %16s %'14llu records %'16llu bytes\n",
+                  names[i], stats_type_records[i], stats_type_bytes[i]);
+         else if (i == DG_R_BBREPEAT)
+            print("datagrind: %16s %'14llu records %'16llu bytes\n",
+                  "BBREPEAT", stats_type_records[i], stats_type_bytes[i]);
+         else
+            print("datagrind: %16u %'14llu records %'16llu bytes\n",
+                  i, stats_type_records[i], stats_type_bytes[i]);
+      }
+}
+
+UChar *DG_(out_reserve)(SizeT count)
+{
+   DG_(out_flush)();
+   if (count > DG_(out_buf_size))
+   {
+      DG_(out_buf_size) = count;
+      DG_(out_buf) = VG_(realloc)("datagrind.out_buf", DG_(out_buf), count);
+   }
+   return DG_(out_buf);
+}
+
+/* Flushes and closes the output file, waiting for the writer to finish. The
+ * footer is then appended uncompressed, so that it ends the file.
+ */
+static void close_file(const void *footer, SizeT footer_size)
+{
+   if (out_fd == -1)
+      return;
+
+   DG_(out_flush)();
+   if (writer_pid != -1)
+   {
+      VG_(finish_writer)(out_fd, writer_pid);
+      writer_pid = -1;
+   }
+   /* The writer shared our file offset, which is now at its end. A
+    * compressed footer gets a frame of its own, stored as is so that it
+    * is also the last footer_size bytes of the file.
+    */
+   if (footer_size > 0)
+   {
+      if (DG_(clo_compress) != DG_COMPRESS_NONE)
+      {
+         UInt frame[2];
+         frame[0] = frame[1] = footer_size;
+         write_all(out_file_fd, frame, sizeof(frame));
+      }
+      write_all(out_file_fd, footer, footer_size);
+   }
+   /* What the writer wrote is dropped again, but it is clean by now */
+   if (clo_drop_cache)
+      drop_written(out_file_fd, drop_from);
+   drop_from = drop_pending = 0;
+   VG_(close)(out_file_fd);
+   out_fd = out_file_fd = -1;
+}
+
+/* Keeps a record that the records after it may need. The record includes
+ * its head_len bytes of type and length.
+ */
+static void keep_record(const UChar *record, SizeT head_len, ULong len)
+{
+   switch (record[0])
+   {
+   case DG_R_MALLOC_BLOCK:
+   case DG_R_FREE_BLOCK:
+   case DG_R_REALLOC_BLOCK:
+      {
+         UWord words[4];
+         UWord old_stack = ~(UWord) 0;
+         DgKeptBlock *block;
+
+         tl_assert(len <= sizeof(words));
+         VG_(memcpy)(words, record + head_len, len);
+         block = VG_(HT_remove)(kept_blocks, words[0]);
+         if (block != NULL)
+         {
+            old_stack = block->stack_index;
+            VG_(free)(block);
+         }
+         if (record[0] == DG_R_REALLOC_BLOCK)
+         {
+            /* Now like a malloc at the new address, with the old stack
+             * unless it has a new one
+             */
+            if (words[3] == ~(UWord) 0)
+               words[3] = old_stack;
+            words[0] = words[1];
+            words[1] = words[2];
+            words[2] = words[3];
+         }
+         if (record[0] != DG_R_FREE_BLOCK)
+         {
+            block = VG_(malloc)("datagrind.kept.block", sizeof(DgKeptBlock));
+            block->key = words[0];
+            block->size = words[1];
+            block->stack_index = words[2];
+            VG_(HT_add_node)(kept_blocks, block);
+         }
+      }
+      break;
+   case DG_R_MEMPOOL:
+      {
+         UWord words[4];
+         UChar op = record[head_len];
+         DgKeptPool *pool;
+         DgKeptBlock *chunk;
+
+         tl_assert(len >= 1 + sizeof(UWord) && len <= 1 + sizeof(words));
+         VG_(memcpy)(words, record + head_len + 1, len - 1);
+         pool = VG_(HT_lookup)(kept_pools, words[0]);
+         switch (op)
+         {
+         case DG_POOL_CREATE:
+         case DG_POOL_DESTROY:
+            if (pool != NULL)
+            {
+               VG_(HT_remove)(kept_pools, words[0]);
+               VG_(HT_destruct)(pool->chunks, VG_(free));
+               VG_(free)(pool);
+            }
+            if (op == DG_POOL_CREATE)
+            {
+               pool = VG_(malloc)("datagrind.kept.pool", sizeof(DgKeptPool));
+               pool->key = words[0];
+               pool->chunks = VG_(HT_construct)("datagrind.kept.chunks");
+               VG_(HT_add_node)(kept_pools, pool);
+            }
+            break;
+         case DG_POOL_ALLOC:
+            if (pool != NULL)
+            {
+               chunk = VG_(malloc)("datagrind.kept.chunk", sizeof(DgKeptBlock));
+               chunk->key = words[1];
+               chunk->size = words[2];
+               chunk->stack_index = words[3];
+               VG_(HT_add_node)(pool->chunks, chunk);
+            }
+            break;
+         case DG_POOL_FREE:
+            if (pool != NULL && (chunk = VG_(HT_remove)(pool->chunks, words[1])) != NULL)
+               VG_(free)(chunk);
+            break;
+         }
+      }
+      break;
+   default:
+      VG_(addBytesToXA)(kept_defs, record, head_len + len);
+      break;
+   }
+}
+
+/* Whether records of a type are needed to decode the records after them */
+static Bool is_kept(UChar type)
+{
+   switch (type)
+   {
+   case DG_R_TRACK_RANGE:
+   case DG_R_UNTRACK_RANGE:
+   case DG_R_INSTR:
+   case DG_R_TEXT_AVMA:
+   case DG_R_MALLOC_BLOCK:
+   case DG_R_FREE_BLOCK:
+   case DG_R_REALLOC_BLOCK:
+   case DG_R_MEMPOOL:
+   case DG_R_BBDEF:
+   case DG_R_CONTEXT:
+   case DG_R_ALLOC_STACK:
+   case DG_R_MAP:
+   case DG_R_UNMAP:
+   case DG_R_REMAP:
+   case DG_R_PROTECT:
+   case DG_R_PROCESS:
+   case DG_R_FORK_DEFS:
+   case DG_R_SHARD:
+      return True;
+   default:
+      return False;
+   }
+}
+
+/* Keeps the definitions in data on its way to the file. Records may be
+ * split between calls.
+ */
+static void scan_defs(const UChar *buf, SizeT count)
+{
+   while (count > 0)
+   {
+      if (!scan_in_payload)
+      {
+         scan_head[scan_head_len++] = *buf++;
+         count--;
+         if (scan_head[0] >= 128)
+         {
+            if (scan_head_len == 2)
+               scan_head_len = 0;
+            continue;
+         }
+         if (scan_head_len < 2
+             || (scan_head[1] == 255 && scan_head_len < sizeof(scan_head)))
+            continue;
+         if (scan_head[1] == 255)
+            VG_(memcpy)(&scan_left, scan_head + 2, sizeof(scan_left));
+         else
+            scan_left = scan_head[1];
+         VG_(dropTailXA)(scan_record, VG_(sizeXA)(scan_record));
+         if (is_kept(scan_head[0]))
+            VG_(addBytesToXA)(scan_record, scan_head, scan_head_len);
+         scan_in_payload = True;
+      }
+      else
+      {
+         SizeT n = count < scan_left ? count : scan_left;
+
+         if (VG_(sizeXA)(scan_record) > 0)
+            VG_(addBytesToXA)(scan_record, buf, n);
+         buf += n;
+         count -= n;
+         scan_left -= n;
+      }
+      if (scan_in_payload && scan_left == 0)
+      {
+         if (VG_(sizeXA)(scan_record) > 0)
+            keep_record(VG_(indexXA)(scan_record, 0), scan_head_len,
+                        VG_(sizeXA)(scan_record) - scan_head_len);
+         scan_head_len = 0;
+         scan_in_payload = False;
+      }
+   }
+}
+
+/* Writes the rest of a numbered file after the header, compressing it if
+ * asked.
+ */
+static void dump_write(Int fd, const void *buf, SizeT count)
+{
+   if (DG_(clo_compress) != DG_COMPRESS_NONE)
+      write_frames(fd, buf, count);
+   else
+      write_all(fd, buf, count);
+}
+
+/* Starts a numbered file with the header, the kept definitions and the live
+ * blocks, returning the stream length of those.
+ */
+static ULong write_prefix(Int fd)
+{
+   ULong size;
+   DgKeptBlock *block;
+   DgKeptPool *pool;
+
+   write_all(fd, VG_(indexXA)(kept_header, 0), VG_(sizeXA)(kept_header));
+   size = VG_(sizeXA)(kept_header);
+   if (VG_(sizeXA)(kept_defs) > 0)
+   {
+      dump_write(fd, VG_(indexXA)(kept_defs, 0), VG_(sizeXA)(kept_defs));
+      size += VG_(sizeXA)(kept_defs);
+   }
+   VG_(HT_ResetIter)(kept_blocks);
+   while ((block = VG_(HT_Next)(kept_blocks)) != NULL)
+   {
+      UChar record[2 + 3 * sizeof(UWord)];
+
+      record[0] = DG_R_MALLOC_BLOCK;
+      record[1] = 3 * sizeof(UWord);
+      VG_(memcpy)(record + 2, &block->key, sizeof(UWord));
+      VG_(memcpy)(record + 2 + sizeof(UWord), &block->size, sizeof(UWord));
+      VG_(memcpy)(record + 2 + 2 * sizeof(UWord), &block->stack_index, sizeof(UWord));
+      dump_write(fd, record, sizeof(record));
+      size += sizeof(record);
+   }
+   VG_(HT_ResetIter)(kept_pools);
+   while ((pool = VG_(HT_Next)(kept_pools)) != NULL)
+   {
+      UChar record[3 + 4 * sizeof(UWord)];
+
+      record[0] = DG_R_MEMPOOL;
+      record[1] = 1 + sizeof(UWord);
+      record[2] = DG_POOL_CREATE;
+      VG_(memcpy)(record + 3, &pool->key, sizeof(UWord));
+      dump_write(fd, record, 3 + sizeof(UWord));
+      size += 3 + sizeof(UWord);
+
+      record[1] = 1 + 4 * sizeof(UWord);
+      record[2] = DG_POOL_ALLOC;
+      VG_(HT_ResetIter)(pool->chunks);
+      while ((block = VG_(HT_Next)(pool->chunks)) != NULL)
+      {
+         VG_(memcpy)(record + 3 + sizeof(UWord), &block->key, sizeof(UWord));
+         VG_(memcpy)(record + 3 + 2 * sizeof(UWord), &block->size, sizeof(UWord));
+         VG_(memcpy)(record + 3 + 3 * sizeof(UWord), &block->stack_index, sizeof(UWord));
+         dump_write(fd, record, sizeof(record));
+         size += sizeof(record);
+      }
+   }
+   return size;
+}
+
+/* Writes the index of the current file's chunks, and closes it */
+static void close_piece(void)
+{
+   UChar footer[DG_FOOTER_SIZE];
+   UChar *index;
+   SizeT index_size;
+
+   DG_(out_flush)();
+   index = DG_(index_moved)(piece_delta, DG_(out_offset)() + piece_delta,
+                            footer, &index_size);
+   if (index != NULL)
+   {
+      dump_write(out_file_fd, index, index_size);
+      VG_(free)(index);
+   }
+   DG_(index_drop_before)(DG_(out_offset)());
+   close_file(footer, index != NULL ? DG_FOOTER_SIZE : 0);
+}
+
+void DG_(out_chunk_start)(ULong instrs)
+{
+   /* Everything before the chunk goes out now, so that a run that is
+    * killed outright still leaves its finished chunks in the file, and
+    * compressed frames end where chunks do.
+    */
+   if (DG_(out_buf_used) > 0)
+      DG_(out_flush)();
+
+   /* The size leaves out the definitions repeated at the start, which
+    * only grow.
+    */
+   if (!rotating)
+      return;
+   if (piece_started
+       && ((clo_rotate_size > 0 && DG_(out_offset)() - piece_start >= (ULong) clo_rotate_size)
+           || (clo_rotate_instrs > 0 && instrs - piece_instrs >= (ULong) clo_rotate_instrs)))
+   {
+      close_piece();
+      piece++;
+      open_piece();
+      out_fd = out_file_fd;
+      piece_delta = (Long) write_prefix(out_file_fd) - (Long) DG_(out_offset)();
+      piece_started = False;
+   }
+   if (!piece_started)
+   {
+      piece_start = DG_(out_offset)();
+      piece_instrs = instrs;
+      piece_started = True;
+   }
+}
+
+void DG_(out_finish)(void)
+{
+   if (ring != NULL)
+      DG_(out_ring_dump)();
+   else if (rotating)
+      close_piece();
+   else
+   {
+      UChar footer[DG_FOOTER_SIZE];
+      SizeT footer_size = DG_(index_finish)(footer);
+      close_file(footer, footer_size);
+   }
+
+   VG_(free)(DG_(out_buf));
+   DG_(out_buf) = NULL;
+   if (lzo_out != NULL)
+   {
+      VG_(free)(lzo_out);
+      VG_(free)(lzo_wrkmem);
+      lzo_out = lzo_wrkmem = NULL;
+   }
+}
+
+/* Copies n bytes from the ring, starting at stream offset offset */
+static void ring_read(ULong offset, void *buf, SizeT n)
+{
+   SizeT pos = offset % DG_(clo_ring_size);
+   SizeT first = n < DG_(clo_ring_size) - pos ? n : DG_(clo_ring_size) - pos;
+
+   VG_(memcpy)(buf, ring + pos, first);
+   VG_(memcpy)((UChar *) buf + first, ring, n - first);
+}
+
+/* Keeps what later chunks need from the records in [ring_start, end),
+ * which are about to be dropped.
+ */
+static void ring_keep(ULong end)
+{
+   ULong offset = ring_start;
+
+   while (offset < end)
+   {
+      UChar head[2];
+      ULong len;
+      SizeT head_len = 2;
+
+      ring_read(offset, head, 2);
+      if (head[0] >= 128)
+      {
+         offset += 2;
+         continue;
+      }
+      len = head[1];
+      if (len == 255)
+      {
+         ring_read(offset + 2, &len, sizeof(len));
+         head_len += sizeof(len);
+      }
+      if (is_kept(head[0]))
+      {
+         UChar *record = VG_(malloc)("datagrind.ring.record", head_len + len);
+         ring_read(offset, record, head_len + len);
+         keep_record(record, head_len, len);
+         VG_(free)(record);
+      }
+      offset += head_len + len;
+   }
+   tl_assert(offset == end);
+}
+
+static void ring_append(const void *buf, SizeT count)
+{
+   const UChar *p = buf;
+
+   while (count > 0)
+   {
+      SizeT pos = ring_end % DG_(clo_ring_size);
+      SizeT n = count < DG_(clo_ring_size) - pos ? count : DG_(clo_ring_size) - pos;
+
+      /* Drop whole chunks from the front until there is room */
+      while (ring_end + n - ring_start > (ULong) DG_(clo_ring_size))
+      {
+         ULong next = DG_(index_chunk_after)(ring_start);
+         if (next >= ring_end)
+         {
+            VG_(message)(Vg_UserMsg,
+                         "Error: a datagrind chunk does not fit in the ring; "
+                         "make --datagrind-chunk-size smaller than --datagrind-ring-size\n");
+            VG_(exit)(1);
+         }
+         ring_keep(next);
+         ring_start = next;
+         DG_(index_drop_before)(ring_start);
+      }
+      VG_(memcpy)(ring + pos, p, n);
+      ring_end += n;
+      p += n;
+      count -= n;
+   }
+}
+
+void DG_(out_ring_dump)(void)
+{
+   HChar *filename;
+   Int fd;
+   ULong offset, moved_start;
+   UChar footer[DG_FOOTER_SIZE];
+   UChar *index;
+   SizeT index_size;
+
+   if (ring == NULL)
+      return;
+   DG_(out_flush)();
+
+   fd = open_numbered(++ring_dumps, &filename);
+   if (fd == -1)
+   {
+      VG_(message)(Vg_UserMsg,
+                   "Warning: can not open datagrind ring dump `%s'\n", filename);
+      VG_(free)(filename);
+      return;
+   }
+
+   moved_start = write_prefix(fd);
+   for (offset = ring_start; offset < ring_end; )
+   {
+      SizeT pos = offset % DG_(clo_ring_size);
+      SizeT n = ring_end - offset < DG_(clo_ring_size) - pos
+                ? ring_end - offset : DG_(clo_ring_size) - pos;
+      dump_write(fd, ring + pos, n);
+      offset += n;
+   }
+
+   index = DG_(index_moved)((Long) (moved_start - ring_start),
+                            moved_start + (ring_end - ring_start), footer, &index_size);
+   if (index != NULL)
+   {
+      dump_write(fd, index, index_size);
+      VG_(free)(index);
+      if (DG_(clo_compress) != DG_COMPRESS_NONE)
+      {
+         UInt frame[2];
+         frame[0] = frame[1] = DG_FOOTER_SIZE;
+         write_all(fd, frame, sizeof(frame));
+      }
+      write_all(fd, footer, DG_FOOTER_SIZE);
+   }
+   if (clo_drop_cache)
+      drop_written(fd, 0);
+   VG_(close)(fd);
+   VG_(umsg)("Datagrind: wrote the last %llu bytes of trace to %s\n",
+             ring_end - ring_start, filename);
+   VG_(free)(filename);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,527 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: accesses per page and huge page.      dg_pages.c  ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-pages=yes, accesses are counted per 4 KiB page and per
+ * 2 MiB region, for each thread and each tracked range (or none), along
+ * with the number of intervals of --datagrind-pages-interval instructions
+ * in which there were any. A page that is touched in few intervals by one
+ * thread is a candidate for binding to that thread's node, and a region
+ * that is touched throughout by everyone for a huge page.
+ *
+ * The counters live in an open-addressing hash table with linear probing,
+ * as for the heat map, and are written as one DG_R_PAGES record per page
+ * size at exit.
+ *
+ * With --datagrind-first-touch=yes, each 4 KiB page also keeps the thread,
+ * context and instruction count of its first write, which is what places
+ * an anonymous page on a NUMA node under Linux's first-touch policy (a
+ * read before it only maps the shared zero page). Unmapping a page forgets
+ * it, and mremap moves it. At exit, a DG_R_FIRST_TOUCH record gives each
+ * page with the thread that made most of its accesses, from the counts of
+ * the page table (kept only for 4 KiB pages if --datagrind-pages=no), so
+ * that the pages placed by a thread that hardly uses them can be listed.
+ */
+
+#define DG_PAGES_SMALL_SHIFT 12
+#define DG_PAGES_HUGE_SHIFT  21
+#define DG_PAGES_INITIAL     (1 << 12)
+
+/* Range number of accesses outside any tracked range */
+#define DG_PAGES_NO_RANGE    (~(UWord) 0)
+
+typedef struct
+{
+   Addr page;           /* Address >> shift */
+   UWord range;         /* Tracked range number, or DG_PAGES_NO_RANGE */
+   ThreadId tid;        /* 0 if the slot is empty */
+   UChar shift;
+   ULong reads;
+   ULong writes;
+   ULong intervals;     /* Intervals with any accesses */
+   ULong last_interval; /* Last of those */
+} DgPageEntry;
+
+typedef struct
+{
+   Addr start;
+   Addr end;            /* One past the last byte */
+   Bool active;
+} DgPagesRange;
+
+/* The first write of a page, keyed by the page number */
+typedef struct DgFirstTouch
+{
+   struct DgFirstTouch *next;
+   UWord page;
+   ThreadId tid;
+   UWord context;
+   ULong instrs;
+} DgFirstTouch;
+
+Bool DG_(clo_pages) = False;
+Bool DG_(clo_first_touch) = False;
+static Long clo_pages_interval = 1000000;
+
+static DgPageEntry *table = NULL;
+static SizeT table_size = 0;    /* Power of 2 */
+static SizeT table_used = 0;
+
+static XArray *ranges = NULL;   /* DgPagesRange, as registered */
+static Word n_active_ranges = 0;
+
+static VgHashTable *first_touches = NULL;
+static DgFirstTouch *last_touch = NULL;   /* Of the last write, or NULL */
+
+Bool DG_(pages_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-pages", DG_(clo_pages))) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-first-touch", DG_(clo_first_touch))) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-pages-interval", clo_pages_interval,
+                        1, 1000000000000LL)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(pages_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-pages=yes|no         count accesses per page and 2 MiB\n"
+"                                     region, thread and range [no]\n"
+"    --datagrind-pages-interval=<n>   instructions in each interval counted\n"
+"                                     for those [1000000]\n"
+"    --datagrind-first-touch=yes|no   record the first write of each page,\n"
+"                                     and whether its thread uses it most [no]\n"
+   );
+}
+
+static inline SizeT page_hash(Addr page, UWord range, ThreadId tid, UChar shift)
+{
+   UWord h = page * 0x9E3779B1U ^ range * 0x85EBCA6BU ^ tid * 0xC2B2AE35U ^ shift;
+   return (h ^ (h >> 15)) & (table_size - 1);
+}
+
+static DgPageEntry *page_slot(Addr page, UWord range, ThreadId tid, UChar shift)
+{
+   SizeT i = page_hash(page, range, tid, shift);
+
+   for (;;)
+   {
+      DgPageEntry *e = &table[i];
+      if (e->tid == 0
+          || (e->page == page && e->range == range && e->tid == tid && e->shift == shift))
+         return e;
+      i = (i + 1) & (table_size - 1);
+   }
+}
+
+static void page_resize(SizeT size)
+{
+   DgPageEntry *old = table;
+   SizeT old_size = table_size;
+   SizeT i;
+
+   table = VG_(calloc)("datagrind.pages", size, sizeof(DgPageEntry));
+   table_size = size;
+   for (i = 0; i < old_size; i++)
+      if (old[i].tid != 0)
+         *page_slot(old[i].page, old[i].range, old[i].tid, old[i].shift) = old[i];
+   if (old != NULL)
+      VG_(free)(old);
+}
+
+void DG_(pages_init)(void)
+{
+   if (DG_(clo_first_touch))
+      first_touches = VG_(HT_construct)("datagrind.pages.first_touches");
+   if (!DG_(clo_pages) && !DG_(clo_first_touch))
+      return;
+   page_resize(DG_PAGES_INITIAL);
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.pages.ranges", VG_(free),
+                       sizeof(DgPagesRange));
+}
+
+void DG_(pages_track)(Addr addr, SizeT len)
+{
+   DgPagesRange range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(pages_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgPagesRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+/* Returns the first active range containing addr */
+static UWord find_range(Addr addr)
+{
+   Word n, i;
+
+   if (n_active_ranges == 0)
+      return DG_PAGES_NO_RANGE;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      const DgPagesRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && addr - range->start < range->end - range->start)
+         return i;
+   }
+   return DG_PAGES_NO_RANGE;
+}
+
+static void page_add(Addr page, UWord range, ThreadId tid, UChar shift,
+                     UChar dir, ULong interval)
+{
+   DgPageEntry *e = page_slot(page, range, tid, shift);
+
+   if (e->tid == 0)
+   {
+      e->page = page;
+      e->range = range;
+      e->tid = tid;
+      e->shift = shift;
+      e->intervals = 1;
+      e->last_interval = interval;
+      if (++table_used > table_size / 2)
+      {
+         page_resize(table_size * 2);
+         e = page_slot(page, range, tid, shift);
+      }
+   }
+   else if (e->last_interval != interval)
+   {
+      e->intervals++;
+      e->last_interval = interval;
+   }
+   if (DG_ACC_IS_WRITE(dir))
+      e->writes++;
+   else
+      e->reads++;
+}
+
+static void first_touch(ThreadId tid, UWord context, UWord page, ULong now)
+{
+   DgFirstTouch *ft;
+
+   if (last_touch != NULL && last_touch->page == page)
+      return;
+   ft = VG_(HT_lookup)(first_touches, page);
+   if (ft == NULL)
+   {
+      ft = VG_(malloc)("datagrind.pages.first_touch", sizeof(DgFirstTouch));
+      ft->page = page;
+      ft->tid = tid;
+      ft->context = context;
+      ft->instrs = now;
+      VG_(HT_add_node)(first_touches, ft);
+   }
+   last_touch = ft;
+}
+
+/* An access that straddles two pages only counts in the first. */
+void DG_(pages_access)(ThreadId tid, UWord context, Addr addr, UChar dir, ULong now)
+{
+   UWord range = DG_(clo_pages) ? find_range(addr) : DG_PAGES_NO_RANGE;
+   ULong interval = now / clo_pages_interval;
+
+   page_add(addr >> DG_PAGES_SMALL_SHIFT, range, tid, DG_PAGES_SMALL_SHIFT, dir, interval);
+   if (DG_(clo_pages))
+      page_add(addr >> DG_PAGES_HUGE_SHIFT, range, tid, DG_PAGES_HUGE_SHIFT, dir, interval);
+   if (first_touches != NULL && DG_ACC_IS_WRITE(dir))
+      first_touch(tid, context, addr >> DG_PAGES_SMALL_SHIFT, now);
+}
+
+/* Takes the first writes of the pages from..from+len out of the table, into
+ * an array that the caller frees, with their number in *n. The pages are
+ * looked up one by one unless there are more of them than entries.
+ */
+static DgFirstTouch **take_first_touches(Addr from, SizeT len, UInt *n)
+{
+   UWord lo = from >> DG_PAGES_SMALL_SHIFT;
+   UWord hi = (from + len + (1 << DG_PAGES_SMALL_SHIFT) - 1) >> DG_PAGES_SMALL_SHIFT;
+   UInt n_nodes = VG_(HT_count_nodes)(first_touches);
+   DgFirstTouch **taken;
+   UInt i;
+
+   *n = 0;
+   last_touch = NULL;
+   if (n_nodes == 0 || hi <= lo)
+      return NULL;
+   if (hi - lo <= n_nodes)
+   {
+      UWord page;
+
+      taken = VG_(malloc)("datagrind.pages.taken", (hi - lo) * sizeof(DgFirstTouch *));
+      for (page = lo; page < hi; page++)
+      {
+         DgFirstTouch *ft = VG_(HT_remove)(first_touches, page);
+         if (ft != NULL)
+            taken[(*n)++] = ft;
+      }
+      return taken;
+   }
+   taken = (DgFirstTouch **) VG_(HT_to_array)(first_touches, &n_nodes);
+   for (i = 0; i < n_nodes; i++)
+      if (taken[i]->page - lo < hi - lo)
+         taken[(*n)++] = VG_(HT_remove)(first_touches, taken[i]->page);
+   return taken;
+}
+
+void DG_(pages_unmap)(Addr addr, SizeT len)
+{
+   DgFirstTouch **taken;
+   UInt n, i;
+
+   if (first_touches == NULL)
+      return;
+   taken = take_first_touches(addr, len, &n);
+   for (i = 0; i < n; i++)
+      VG_(free)(taken[i]);
+   if (taken != NULL)
+      VG_(free)(taken);
+}
+
+/* The kernel moves whole pages, so the offset is page-aligned */
+void DG_(pages_remap)(Addr from, Addr to, SizeT len)
+{
+   DgFirstTouch **taken;
+   UInt n, i;
+
+   if (first_touches == NULL)
+      return;
+   taken = take_first_touches(from, len, &n);
+   for (i = 0; i < n; i++)
+   {
+      DgFirstTouch *old = VG_(HT_remove)(first_touches, taken[i]->page + ((to - from) >> DG_PAGES_SMALL_SHIFT));
+
+      if (old != NULL)
+         VG_(free)(old);
+      taken[i]->page += (to - from) >> DG_PAGES_SMALL_SHIFT;
+      VG_(HT_add_node)(first_touches, taken[i]);
+   }
+   if (taken != NULL)
+      VG_(free)(taken);
+}
+
+static Int cmp_page_entry(const void *a, const void *b)
+{
+   const DgPageEntry *ea = a;
+   const DgPageEntry *eb = b;
+
+   if (ea->shift != eb->shift)
+      return (Int) ea->shift - (Int) eb->shift;
+   if (ea->page != eb->page)
+      return ea->page < eb->page ? -1 : 1;
+   if (ea->tid != eb->tid)
+      return ea->tid < eb->tid ? -1 : 1;
+   if (ea->range != eb->range)
+      return ea->range < eb->range ? -1 : 1;
+   return 0;
+}
+
+/* Writes the n entries of one page size */
+static void out_pages(const DgPageEntry *entries, SizeT n)
+{
+   UChar *payload, *p;
+   Addr prev_page = 0;
+   SizeT i;
+
+   p = payload = VG_(malloc)("datagrind.pages.payload",
+                             1 + DG_MAX_UVARINT_BYTES + n * (3 * DG_MAX_UVARINT_BYTES + 3 * 10));
+   *p++ = entries[0].shift;
+   p = encode_uvarint(p, n);
+   for (i = 0; i < n; i++)
+   {
+      const DgPageEntry *e = &entries[i];
+
+      p = encode_uvarint(p, e->page - prev_page);
+      p = encode_uvarint(p, e->tid);
+      /* Shifted so that accesses outside any range are 0 */
+      p = encode_uvarint(p, e->range + 1);
+      p = encode_uvarint64(p, e->reads);
+      p = encode_uvarint64(p, e->writes);
+      p = encode_uvarint64(p, e->intervals);
+      prev_page = e->page;
+   }
+   out_byte(DG_R_PAGES);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+}
+
+static Int cmp_first_touch(const void *a, const void *b)
+{
+   const DgFirstTouch *fa = *(const DgFirstTouch *const *) a;
+   const DgFirstTouch *fb = *(const DgFirstTouch *const *) b;
+
+   if (fa->page != fb->page)
+      return fa->page < fb->page ? -1 : 1;
+   return 0;
+}
+
+/* Writes the first writes, each with the accesses to its page from the n
+ * entries of 4 KiB pages, in order of page and then thread.
+ */
+static void out_first_touches(const DgPageEntry *entries, SizeT n)
+{
+   DgFirstTouch **nodes;
+   UChar *payload, *p;
+   UWord prev_page = 0;
+   UInt n_nodes, i;
+   SizeT e = 0;
+
+   nodes = (DgFirstTouch **) VG_(HT_to_array)(first_touches, &n_nodes);
+   if (n_nodes == 0)
+   {
+      VG_(free)(nodes);
+      return;
+   }
+   VG_(ssort)(nodes, n_nodes, sizeof(DgFirstTouch *), cmp_first_touch);
+   p = payload = VG_(malloc)("datagrind.pages.first_touch_payload",
+                             DG_MAX_UVARINT_BYTES + n_nodes * (5 * DG_MAX_UVARINT_BYTES + 4 * 10));
+   p = encode_uvarint(p, n_nodes);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgFirstTouch *ft = nodes[i];
+      ThreadId owner = ft->tid;
+      ULong owner_accesses = 0, first_accesses = 0, accesses = 0;
+
+      while (e < n && entries[e].page < ft->page)
+         e++;
+      while (e < n && entries[e].page == ft->page)
+      {
+         ThreadId tid = entries[e].tid;
+         ULong count = 0;
+
+         /* The ranges of a thread are next to each other */
+         for (; e < n && entries[e].page == ft->page && entries[e].tid == tid; e++)
+            count += entries[e].reads + entries[e].writes;
+         accesses += count;
+         if (tid == ft->tid)
+            first_accesses = count;
+         /* A tie goes to the first writer */
+         if (count > owner_accesses || (count == owner_accesses && tid == ft->tid))
+         {
+            owner = tid;
+            owner_accesses = count;
+         }
+      }
+
+      p = encode_uvarint(p, ft->page - prev_page);
+      p = encode_uvarint(p, ft->tid);
+      p = encode_uvarint(p, ft->context);
+      p = encode_uvarint64(p, ft->instrs);
+      p = encode_uvarint(p, owner);
+      p = encode_uvarint64(p, owner_accesses);
+      p = encode_uvarint64(p, first_accesses);
+      p = encode_uvarint64(p, accesses);
+      prev_page = ft->page;
+   }
+   out_byte(DG_R_FIRST_TOUCH);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+   VG_(free)(nodes);
+}
+
+void DG_(pages_finish)(void)
+{
+   DgPageEntry *entries = table;
+   SizeT n = 0, i, split;
+
+   if (table == NULL)
+      return;
+
+   for (i = 0; i < table_size; i++)
+      if (table[i].tid != 0)
+         entries[n++] = table[i];
+   tl_assert(n == table_used);
+   VG_(ssort)(entries, n, sizeof(DgPageEntry), cmp_page_entry);
+   for (split = 0; split < n && entries[split].shift == DG_PAGES_SMALL_SHIFT; split++)
+      ;
+   if (DG_(clo_pages) && n > 0)
+   {
+      out_pages(entries, split);
+      out_pages(entries + split, n - split);
+   }
+   if (first_touches != NULL)
+   {
+      out_first_touches(entries, split);
+      VG_(HT_destruct)(first_touches, VG_(free));
+      first_touches = NULL;
+      last_touch = NULL;
+   }
+   VG_(free)(table);
+   table = NULL;
+   table_size = table_used = 0;
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,346 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: classification of access patterns.  dg_patterns.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-access-patterns=yes, each access of each context keeps
+ * its last address, and each later address is classed by its delta from
+ * it: the same address (a broadcast), one within the size of the access
+ * (sequential), the same delta as last time (strided), or anything else
+ * (irregular, as from pointer chasing or hashing). The stride is voted for
+ * as it goes, keeping the delta that has been seen against the others most
+ * often, so that a loop that is mostly strided reports its usual stride.
+ * At exit a record is written per context with the counts of each access
+ * and the class that most of them fell in, and one per tracked range with
+ * the counts of the accesses inside it, classed by their own access.
+ */
+
+/* Kinds of DG_R_ACCESS_PATTERNS */
+#define DG_PATTERN_CONTEXT 0
+#define DG_PATTERN_RANGE   1
+
+typedef struct
+{
+   ULong refs;
+   ULong counts[DG_N_PATTERNS];
+} DgPatternCounts;
+
+typedef struct
+{
+   Addr last;
+   Word last_delta;
+   Word stride;        /* Candidate of the vote */
+   ULong votes;
+   DgPatternCounts counts;
+} DgPatternAccess;
+
+typedef struct DgPatternContext
+{
+   struct DgPatternContext *next;
+   UWord key;          /* Context index */
+   Word n_accesses;
+   DgPatternAccess accesses[];
+} DgPatternContext;
+
+typedef struct
+{
+   Addr start;
+   Addr end;           /* One past the last byte */
+   Bool active;
+   DgPatternCounts counts;
+} DgPatternRange;
+
+Bool DG_(clo_access_patterns) = False;
+
+static VgHashTable *contexts = NULL;   /* DgPatternContext */
+static DgPatternContext *last_context = NULL;
+static XArray *ranges = NULL;          /* DgPatternRange, as registered */
+static Word n_active_ranges = 0;
+
+Bool DG_(patterns_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-access-patterns", DG_(clo_access_patterns))) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(patterns_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-access-patterns=yes|no  class each access as sequential,\n"
+"                                     strided, irregular or broadcast [no]\n"
+   );
+}
+
+void DG_(patterns_init)(void)
+{
+   if (!DG_(clo_access_patterns))
+      return;
+   contexts = VG_(HT_construct)("datagrind.patterns.contexts");
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.patterns.ranges", VG_(free),
+                       sizeof(DgPatternRange));
+}
+
+void DG_(patterns_track)(Addr addr, SizeT len)
+{
+   DgPatternRange range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   VG_(memset)(&range, 0, sizeof(range));
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(patterns_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgPatternRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+/* Classes the delta of an access from its last address, and votes for its
+ * stride. The first address of an access has no class.
+ */
+static Int classify(DgPatternAccess *acc, Addr addr, UChar size)
+{
+   Word delta = (Word) (addr - acc->last);
+   Int pattern;
+
+   if (delta == 0)
+      pattern = DG_PATTERN_BROADCAST;
+   else if (delta >= -(Word) size && delta <= (Word) size)
+      pattern = DG_PATTERN_SEQUENTIAL;
+   else if (delta == acc->last_delta)
+      pattern = DG_PATTERN_STRIDED;
+   else
+      pattern = DG_PATTERN_IRREGULAR;
+
+   if (delta == acc->stride)
+      acc->votes++;
+   else if (acc->votes == 0)
+   {
+      acc->stride = delta;
+      acc->votes = 1;
+   }
+   else
+      acc->votes--;
+   acc->last_delta = delta;
+   return pattern;
+}
+
+void DG_(patterns_ref)(UWord context_index, Word n_accesses, Word access,
+                       Addr addr, UChar size)
+{
+   DgPatternContext *ctx = last_context;
+   DgPatternAccess *acc;
+   Int pattern = -1;
+
+   if (ctx == NULL || ctx->key != context_index)
+   {
+      ctx = VG_(HT_lookup)(contexts, context_index);
+      if (ctx == NULL)
+      {
+         ctx = VG_(calloc)("datagrind.patterns.context", 1,
+                           sizeof(DgPatternContext) + n_accesses * sizeof(DgPatternAccess));
+         ctx->key = context_index;
+         ctx->n_accesses = n_accesses;
+         VG_(HT_add_node)(contexts, ctx);
+      }
+      last_context = ctx;
+   }
+   tl_assert(access < ctx->n_accesses);
+
+   acc = &ctx->accesses[access];
+   if (acc->counts.refs > 0)
+   {
+      pattern = classify(acc, addr, size);
+      acc->counts.counts[pattern]++;
+   }
+   acc->counts.refs++;
+   acc->last = addr;
+
+   if (n_active_ranges > 0)
+   {
+      Word n = VG_(sizeXA)(ranges), i;
+
+      /* Counted for the first range containing the access */
+      for (i = 0; i < n; i++)
+      {
+         DgPatternRange *range = VG_(indexXA)(ranges, i);
+         if (range->active && addr - range->start < range->end - range->start)
+         {
+            range->counts.refs++;
+            if (pattern >= 0)
+               range->counts.counts[pattern]++;
+            break;
+         }
+      }
+   }
+}
+
+static Int cmp_context_ptr(const void *a, const void *b)
+{
+   const DgPatternContext *ca = *(DgPatternContext * const *) a;
+   const DgPatternContext *cb = *(DgPatternContext * const *) b;
+   if (ca->key != cb->key)
+      return ca->key < cb->key ? -1 : 1;
+   return 0;
+}
+
+/* The class with the most deltas, or DG_PATTERN_NONE if there were none.
+ * Ties go to the more regular class.
+ */
+static UChar dominant(const DgPatternCounts *counts)
+{
+   UChar best = DG_PATTERN_NONE;
+   ULong best_count = 0;
+   Int i;
+
+   for (i = 0; i < DG_N_PATTERNS; i++)
+      if (counts->counts[i] > best_count)
+      {
+         best = i;
+         best_count = counts->counts[i];
+      }
+   return best;
+}
+
+static UChar *encode_counts(UChar *p, const DgPatternCounts *counts, Word stride)
+{
+   Int i;
+
+   *p++ = dominant(counts);
+   p = encode_uvarint64(p, counts->refs);
+   for (i = 0; i < DG_N_PATTERNS; i++)
+      p = encode_uvarint64(p, counts->counts[i]);
+   /* Zigzag, as the stride may be negative */
+   p = encode_uvarint(p, ((HWord) stride << 1) ^ (HWord) (stride >> (VG_WORDSIZE * 8 - 1)));
+   return p;
+}
+
+#define DG_PATTERN_ENTRY_BYTES (1 + (DG_N_PATTERNS + 2) * 10)
+
+void DG_(patterns_finish)(void)
+{
+   DgPatternContext **nodes;
+   UInt n_nodes, i;
+   Word n_ranges, r;
+
+   if (contexts == NULL)
+      return;
+
+   nodes = (DgPatternContext **) VG_(HT_to_array)(contexts, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgPatternContext *), cmp_context_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgPatternContext *ctx = nodes[i];
+      UChar *payload, *p;
+      Word j;
+
+      payload = VG_(malloc)("datagrind.patterns.payload",
+                            1 + 2 * DG_MAX_UVARINT_BYTES
+                            + ctx->n_accesses * DG_PATTERN_ENTRY_BYTES);
+      p = payload;
+      *p++ = DG_PATTERN_CONTEXT;
+      p = encode_uvarint(p, ctx->key);
+      p = encode_uvarint(p, ctx->n_accesses);
+      for (j = 0; j < ctx->n_accesses; j++)
+      {
+         const DgPatternAccess *acc = &ctx->accesses[j];
+         /* Only a stride that has held a majority is worth reporting */
+         Bool strided = acc->counts.counts[DG_PATTERN_STRIDED] > 0 && acc->votes > 0;
+         p = encode_counts(p, &acc->counts, strided ? acc->stride : 0);
+      }
+      out_byte(DG_R_ACCESS_PATTERNS);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+      VG_(free)(payload);
+   }
+   VG_(free)(nodes);
+
+   n_ranges = VG_(sizeXA)(ranges);
+   for (r = 0; r < n_ranges; r++)
+   {
+      const DgPatternRange *range = VG_(indexXA)(ranges, r);
+      UChar payload[1 + 2 * DG_MAX_UVARINT_BYTES + DG_PATTERN_ENTRY_BYTES];
+      UChar *p = payload;
+
+      if (range->counts.refs == 0)
+         continue;
+      *p++ = DG_PATTERN_RANGE;
+      p = encode_uvarint(p, r);
+      p = encode_uvarint(p, 1);
+      p = encode_counts(p, &range->counts, 0);
+      out_byte(DG_R_ACCESS_PATTERNS);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+   }
+
+   VG_(HT_destruct)(contexts, VG_(free));
+   contexts = NULL;
+   last_context = NULL;
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,394 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: time by address rasters.              dg_raster.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_aspacemgr.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-mode=raster, runs are not written out. Instead the
+ * accesses are counted in a grid of time by address, which is what dg_view
+ * draws when it is zoomed out, so that the overview needs only these
+ * records rather than the whole trace. Time is cut into buckets of
+ * --datagrind-raster-instrs instructions, and the address space into
+ * regions: the ranges registered with DATAGRIND_TRACK_RANGE, and for other
+ * accesses the client mappings, as they stand when first touched in the
+ * bucket. Each region is cut into at most --datagrind-raster-rows rows of
+ * a power of two bytes, no smaller than a cache line. A record holding the
+ * rows with any accesses is written at the end of each bucket with any.
+ *
+ * The mapping regions are kept sorted by address and are forgotten at the
+ * end of each bucket, so a mapping that grows or moves is picked up again
+ * in the next. Accesses outside any client mapping are not counted.
+ */
+
+#define DG_RASTER_MIN_SHIFT 6
+
+/* Kinds of region in a DG_R_RASTER */
+#define DG_RASTER_MAPPING 0
+#define DG_RASTER_RANGE   1
+
+typedef struct
+{
+   Addr start;
+   Addr end;           /* One past the last byte */
+   Bool active;        /* Only for ranges */
+   UChar shift;        /* log2 of the bytes per row */
+   UInt n_rows;
+   UInt *counts;       /* Reads and writes of each row; NULL if unused */
+} DgRasterRegion;
+
+static Long clo_raster_instrs = 1000000;
+static Long clo_raster_rows = 256;
+
+static XArray *ranges = NULL;          /* DgRasterRegion, as registered */
+static Word n_active_ranges = 0;
+static XArray *maps = NULL;            /* DgRasterRegion, sorted by start */
+static Word last_map = -1;             /* Index into maps of the last hit */
+static ULong bucket_start = 0;
+
+Bool DG_(raster_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BINT_CLO(arg, "--datagrind-raster-instrs", clo_raster_instrs,
+                   1, 1000000000000LL)) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-raster-rows", clo_raster_rows,
+                        1, 65536)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(raster_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-raster-instrs=<n>    with --datagrind-mode=raster, the\n"
+"                                     instructions per time bucket [1000000]\n"
+"    --datagrind-raster-rows=<n>      with --datagrind-mode=raster, the most\n"
+"                                     address rows per region [256]\n"
+   );
+}
+
+void DG_(raster_init)(void)
+{
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.raster.ranges", VG_(free),
+                       sizeof(DgRasterRegion));
+   maps = VG_(newXA)(VG_(malloc), "datagrind.raster.maps", VG_(free),
+                     sizeof(DgRasterRegion));
+}
+
+/* Picks the width of the rows of a region, and so their number */
+static void region_init(DgRasterRegion *region, Addr start, Addr end)
+{
+   UChar shift = DG_RASTER_MIN_SHIFT;
+
+   VG_(memset)(region, 0, sizeof(*region));
+   region->start = start;
+   region->end = end;
+   if (end > start)
+   {
+      while (shift < 63 && ((end - start - 1) >> shift) >= (ULong) clo_raster_rows)
+         shift++;
+      region->n_rows = ((end - start - 1) >> shift) + 1;
+   }
+   region->shift = shift;
+}
+
+void DG_(raster_track)(Addr addr, SizeT len)
+{
+   DgRasterRegion range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   region_init(&range, addr, addr + len);
+   range.active = len > 0;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(raster_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgRasterRegion *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         /* The counts so far are still written with the bucket */
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+/* Returns the mapping region containing addr, adding one for the client
+ * mapping if there is none yet, or NULL if addr is not in a client
+ * mapping. A new region is clipped to those around it, in case the
+ * mapping grew into them.
+ */
+static DgRasterRegion *map_region(Addr addr)
+{
+   Word lo = 0, hi = VG_(sizeXA)(maps);
+   NSegment const *seg;
+   DgRasterRegion region;
+   Addr start, end;
+
+   if (last_map >= 0)
+   {
+      DgRasterRegion *r = VG_(indexXA)(maps, last_map);
+      if (addr - r->start < r->end - r->start)
+         return r;
+   }
+
+   /* Finds the first region starting after addr */
+   while (lo < hi)
+   {
+      Word mid = lo + (hi - lo) / 2;
+      const DgRasterRegion *r = VG_(indexXA)(maps, mid);
+      if (r->start <= addr)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   if (lo > 0)
+   {
+      DgRasterRegion *r = VG_(indexXA)(maps, lo - 1);
+      if (addr < r->end)
+      {
+         last_map = lo - 1;
+         return r;
+      }
+   }
+
+   seg = VG_(am_find_nsegment)(addr);
+   if (seg == NULL
+       || (seg->kind != SkAnonC && seg->kind != SkFileC && seg->kind != SkShmC))
+      return NULL;
+   start = seg->start;
+   end = seg->end + 1;
+   if (lo > 0)
+   {
+      const DgRasterRegion *r = VG_(indexXA)(maps, lo - 1);
+      if (start < r->end)
+         start = r->end;
+   }
+   if (lo < VG_(sizeXA)(maps))
+   {
+      const DgRasterRegion *r = VG_(indexXA)(maps, lo);
+      if (end > r->start)
+         end = r->start;
+   }
+   region_init(&region, start, end);
+   VG_(insertIndexXA)(maps, lo, &region);
+   last_map = lo;
+   return VG_(indexXA)(maps, lo);
+}
+
+static SizeT region_bytes(const DgRasterRegion *region)
+{
+   return 2 + sizeof(Addr) + 3 * DG_MAX_UVARINT_BYTES
+          + (SizeT) region->n_rows * 3 * DG_MAX_UVARINT_BYTES;
+}
+
+static UChar *encode_region(UChar *p, UChar kind, UWord id, const DgRasterRegion *region)
+{
+   UInt n_used = 0, prev = 0, i;
+
+   for (i = 0; i < region->n_rows; i++)
+      if (region->counts[2 * i] != 0 || region->counts[2 * i + 1] != 0)
+         n_used++;
+   p = put_byte(p, kind);
+   p = encode_uvarint(p, id);
+   p = put_word(p, region->start);
+   p = encode_uvarint(p, region->end - region->start);
+   p = put_byte(p, region->shift);
+   p = encode_uvarint(p, n_used);
+   for (i = 0; i < region->n_rows; i++)
+   {
+      if (region->counts[2 * i] == 0 && region->counts[2 * i + 1] == 0)
+         continue;
+      p = encode_uvarint(p, i - prev);
+      p = encode_uvarint(p, region->counts[2 * i]);
+      p = encode_uvarint(p, region->counts[2 * i + 1]);
+      prev = i;
+   }
+   return p;
+}
+
+/* Writes out the bucket that started at bucket_start, if it had any
+ * accesses, and empties the regions.
+ */
+static void raster_flush(ULong now)
+{
+   Word n_ranges = VG_(sizeXA)(ranges), n_maps = VG_(sizeXA)(maps), r;
+   Word n_regions = 0;
+   SizeT size = 3 * 10;
+   UChar *payload, *p;
+
+   for (r = 0; r < n_ranges; r++)
+   {
+      const DgRasterRegion *range = VG_(indexXA)(ranges, r);
+      if (range->counts != NULL)
+      {
+         n_regions++;
+         size += region_bytes(range);
+      }
+   }
+   for (r = 0; r < n_maps; r++)
+   {
+      const DgRasterRegion *map = VG_(indexXA)(maps, r);
+      if (map->counts != NULL)
+      {
+         n_regions++;
+         size += region_bytes(map);
+      }
+   }
+
+   if (n_regions > 0)
+   {
+      payload = VG_(malloc)("datagrind.raster.payload", size);
+      p = payload;
+      p = encode_uvarint64(p, bucket_start);
+      /* The last bucket may be cut short */
+      p = encode_uvarint64(p, now - bucket_start < (ULong) clo_raster_instrs
+                              ? now - bucket_start : (ULong) clo_raster_instrs);
+      p = encode_uvarint(p, n_regions);
+      for (r = 0; r < n_ranges; r++)
+      {
+         const DgRasterRegion *range = VG_(indexXA)(ranges, r);
+         if (range->counts != NULL)
+            p = encode_region(p, DG_RASTER_RANGE, r, range);
+      }
+      for (r = 0; r < n_maps; r++)
+      {
+         const DgRasterRegion *map = VG_(indexXA)(maps, r);
+         if (map->counts != NULL)
+            p = encode_region(p, DG_RASTER_MAPPING, 0, map);
+      }
+      tl_assert(p - payload <= size);
+      out_byte(DG_R_RASTER);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+      VG_(free)(payload);
+   }
+
+   for (r = 0; r < n_ranges; r++)
+   {
+      DgRasterRegion *range = VG_(indexXA)(ranges, r);
+      if (range->counts != NULL)
+      {
+         VG_(free)(range->counts);
+         range->counts = NULL;
+      }
+   }
+   for (r = 0; r < n_maps; r++)
+   {
+      DgRasterRegion *map = VG_(indexXA)(maps, r);
+      if (map->counts != NULL)
+         VG_(free)(map->counts);
+   }
+   VG_(dropTailXA)(maps, n_maps);
+   last_map = -1;
+}
+
+static inline void region_add(DgRasterRegion *region, Addr addr, UChar dir)
+{
+   UInt *count;
+
+   if (UNLIKELY(region->counts == NULL))
+      region->counts = VG_(calloc)("datagrind.raster.counts", 2 * region->n_rows,
+                                   sizeof(UInt));
+   count = &region->counts[2 * ((addr - region->start) >> region->shift)
+                           + (DG_ACC_IS_WRITE(dir) ? 1 : 0)];
+   if (*count != 0xFFFFFFFFU)
+      (*count)++;
+}
+
+void DG_(raster_add)(Addr addr, UChar dir, ULong now)
+{
+   DgRasterRegion *map;
+
+   if (UNLIKELY(now - bucket_start >= (ULong) clo_raster_instrs))
+   {
+      raster_flush(now);
+      bucket_start = now - now % clo_raster_instrs;
+   }
+
+   if (n_active_ranges > 0)
+   {
+      Word n = VG_(sizeXA)(ranges), i;
+
+      /* Counted for the first range containing the access */
+      for (i = 0; i < n; i++)
+      {
+         DgRasterRegion *range = VG_(indexXA)(ranges, i);
+         if (range->active && addr - range->start < range->end - range->start)
+         {
+            region_add(range, addr, dir);
+            return;
+         }
+      }
+   }
+
+   map = map_region(addr);
+   if (map != NULL)
+      region_add(map, addr, dir);
+}
+
+void DG_(raster_finish)(ULong now)
+{
+   if (ranges == NULL)
+      return;
+   raster_flush(now);
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+   VG_(deleteXA)(maps);
+   maps = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
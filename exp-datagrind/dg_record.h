@@ -40,9 +40,139 @@
 #define DG_R_BBDEF           11
 #define DG_R_BBRUN           12
 #define DG_R_CONTEXT         13
+#define DG_R_BBRUN_FILTERED  14
+#define DG_R_THREAD          15
+#define DG_R_CHUNK           16
+#define DG_R_INDEX           17
+#define DG_R_FOOTER          18
+#define DG_R_HEATMAP         19
+#define DG_R_REUSE           20
+#define DG_R_CACHE_CONFIG    21
+#define DG_R_CACHE_MISSES    22
+#define DG_R_ALLOC_STACK     23
+#define DG_R_ALLOC_STATS     24
+#define DG_R_FIELD_HEAT      25
+#define DG_R_SHARING         26
+#define DG_R_PAGES           27
+#define DG_R_TLB_CONFIG      28
+#define DG_R_TLB_MISSES      29
+#define DG_R_SYSCALL_ACCESS  30
+#define DG_R_MAP             31
+#define DG_R_UNMAP           32
+#define DG_R_REMAP           33
+#define DG_R_PROTECT         34
+#define DG_R_PROCESS         35
+#define DG_R_BBRUN_STRIDED   36
+#define DG_R_BBRUN_LINES     37
+#define DG_R_HEAP_SNAPSHOT   38
+#define DG_R_BULK_ACCESS     39
+#define DG_R_REALLOC_BLOCK   40
+#define DG_R_MEMPOOL         41
+#define DG_R_ACCESS_PATTERNS 42
+#define DG_R_ATOMICS         43
+#define DG_R_WORKING_SET     44
+#define DG_R_CHECKPOINT      45
+#define DG_R_RASTER          46
+#define DG_R_VALUE_STATS     47
+#define DG_R_SOURCE_STATS    48
+#define DG_R_SIMPOINTS       49
+#define DG_R_FIRST_TOUCH     50
+#define DG_R_LOCK            51
+#define DG_R_ACCESS_COUNTS   52
+#define DG_R_AFFINITY        53
+#define DG_R_FORK_DEFS       54
+#define DG_R_SHARD           55
+#define DG_R_CONTEXT_COUNTS  56
+/* The last of the one-byte records, which the tables of names cover */
+#define DG_R_LAST            DG_R_CONTEXT_COUNTS
+
+/* Two-byte records */
+#define DG_R_BBREPEAT       128
+
+/* The footer is the last DG_FOOTER_SIZE bytes of the file */
+#define DG_FOOTER_SIZE       18
+
+#define DG_COMPRESS_NONE      0
+#define DG_COMPRESS_LZO       1
+
+/* Flags in the header, saying how the trace was written */
+#define DG_HEADER_CHUNKED  0x01   /* Has DG_R_CHUNK records */
+#define DG_HEADER_SAMPLED  0x02   /* Some runs are left out */
+#define DG_HEADER_SUMMARY  0x04   /* Summaries only, without runs */
+#define DG_HEADER_PARTIAL  0x08   /* A ring dump or one of the rotated files */
+#define DG_HEADER_MERGED   0x10   /* Written by dg_merge */
+#define DG_HEADER_STRIDED  0x20   /* Runs may be DG_R_BBRUN_STRIDED */
+#define DG_HEADER_LINES    0x40   /* Runs may be DG_R_BBRUN_LINES */
+#define DG_HEADER_INSTRS   0x80   /* Readers give the instruction fetches */
+#define DG_HEADER_EVENTS   0x100  /* DG_R_END_EVENT records have summaries */
+
+/* A position of a block is strided once its delta has repeated
+ * DG_STRIDE_MIN_HITS << shift times in a row, where shift counts (up to
+ * DG_STRIDE_MAX_SHIFT) the times its stride has broken in the chunk.
+ */
+#define DG_STRIDE_MIN_HITS    2
+#define DG_STRIDE_MAX_SHIFT   5
+
+/* Most contexts or ranges listed in the summary of a DG_R_END_EVENT */
+#define DG_EVENT_TOP_MAX     32
 
 #define DG_ACC_READ           0
 #define DG_ACC_WRITE          1
 #define DG_ACC_EXEC           2
+/* A compare-and-swap or store-conditional, which reads and writes the
+ * location whether or not it succeeds
+ */
+#define DG_ACC_ATOMIC         3
+#define DG_ACC_IS_WRITE(dir) ((dir) == DG_ACC_WRITE || (dir) == DG_ACC_ATOMIC)
+/* Flag in the dir of a DG_R_BBDEF access */
+#define DG_ACC_STATIC      0x80
+
+/* The op of a DG_R_BULK_ACCESS */
+#define DG_BULK_COPY          0
+#define DG_BULK_SET           1
+
+/* The op of a DG_R_LOCK: what was done, and to which kind of lock */
+#define DG_LOCK_ACQUIRE        0
+#define DG_LOCK_ACQUIRE_SHARED 1   /* A read lock of a rwlock */
+#define DG_LOCK_RELEASE        2
+#define DG_LOCK_MUTEX       0x00
+#define DG_LOCK_RWLOCK      0x10
+#define DG_LOCK_SPIN        0x20
+#define DG_LOCK_ACTION(op) ((op) & 0x0F)
+#define DG_LOCK_KIND(op)   ((op) & 0xF0)
+
+/* The kinds of node in a DG_R_AFFINITY */
+#define DG_AFFINITY_SITE       0   /* Heap blocks from one allocation stack */
+#define DG_AFFINITY_FIELD      1   /* An offset in a tracked range */
+
+/* The op of a DG_R_MEMPOOL */
+#define DG_POOL_CREATE        0
+#define DG_POOL_DESTROY       1
+#define DG_POOL_ALLOC         2
+#define DG_POOL_FREE          3
+
+/* The classes of a DG_R_ACCESS_PATTERNS, in the order of its counts */
+#define DG_PATTERN_SEQUENTIAL 0
+#define DG_PATTERN_STRIDED    1
+#define DG_PATTERN_BROADCAST  2
+#define DG_PATTERN_IRREGULAR  3
+#define DG_N_PATTERNS         4
+#define DG_PATTERN_NONE       0xFF
+
+/* The classes of a DG_R_VALUE_STATS, in the order of its counts */
+#define DG_VALUE_ZERO         0
+#define DG_VALUE_REPEATED     1
+#define DG_VALUE_NARROW       2
+#define DG_VALUE_OTHER        3
+#define DG_N_VALUES           4
+
+/* The kind of a DG_R_SOURCE_STATS */
+#define DG_SOURCE_LINE        0
+#define DG_SOURCE_FUNCTION    1
+
+/* Bits of the protection in DG_R_MAP and DG_R_PROTECT */
+#define DG_PROT_READ          1
+#define DG_PROT_WRITE         2
+#define DG_PROT_EXEC          4
 
 #endif /* __DG_RECORD_H */
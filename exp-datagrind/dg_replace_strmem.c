@@ -0,0 +1,264 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: replacements for the bulk memory functions.       ---*/
+/*---                                          dg_replace_strmem.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_redir.h"
+#include "pub_tool_clreq.h"
+
+#include "datagrind.h"
+#include "dg_record.h"
+
+/* These replace the copies and fills of libc, with the same behaviour
+ * tags and sonames as shared/vg_replace_strmem.c. Each tells the tool
+ * about the whole range it moves before doing the work. With
+ * --datagrind-bulk-copies=yes this object is left uninstrumented, so the
+ * trace gets one DG_R_BULK_ACCESS rather than an access per word, and
+ * with =no the tool ignores the request and the loops below are traced
+ * like any other code.
+ *
+ * Only the memory functions are replaced: the string functions stop at
+ * a terminator, so their ranges are not known until they are done, and
+ * they are left to libc.
+ */
+
+#define DG_BULK_ACCESS(op, dst, src, len)                               \
+   VALGRIND_DO_CLIENT_REQUEST_STMT(_VG_USERREQ__DATAGRIND_BULK_ACCESS, \
+                                   op, dst, src, len, 0)
+
+/* Call here to exit if we can't continue, as in vg_replace_strmem.c */
+__attribute__ ((__noreturn__))
+static inline void my_exit ( int x )
+{
+#  if defined(VGPV_arm_linux_android) || defined(VGPV_mips32_linux_android) \
+      || defined(VGPV_arm64_linux_android)
+   __asm__ __volatile__(".word 0xFFFFFFFF");
+   while (1) {}
+#  elif defined(VGPV_x86_linux_android)
+   __asm__ __volatile__("ud2");
+   while (1) {}
+#  else
+   extern __attribute__ ((__noreturn__)) void _exit(int status);
+   _exit(x);
+#  endif
+}
+
+/* Copies with memmove semantics, a word at a time where the alignment
+ * allows.
+ */
+static inline void dg_copy(void *dst, const void *src, SizeT len)
+{
+   const Addr WS = sizeof(UWord);
+   const Addr WM = WS - 1;
+   SizeT n = len;
+
+   if (len == 0 || dst == src)
+      return;
+   if ((Addr) dst < (Addr) src || (Addr) dst >= (Addr) src + len)
+   {
+      Addr d = (Addr) dst;
+      Addr s = (Addr) src;
+
+      if (((s ^ d) & WM) == 0)
+      {
+         while ((s & WM) != 0 && n >= 1)
+            { *(UChar *) d = *(UChar *) s; s += 1; d += 1; n -= 1; }
+         while (n >= WS)
+            { *(UWord *) d = *(UWord *) s; s += WS; d += WS; n -= WS; }
+      }
+      while (n >= 1)
+         { *(UChar *) d = *(UChar *) s; s += 1; d += 1; n -= 1; }
+   }
+   else
+   {
+      /* Backwards, since dst overlaps the end of src */
+      Addr d = (Addr) dst + n;
+      Addr s = (Addr) src + n;
+
+      if (((s ^ d) & WM) == 0)
+      {
+         while ((s & WM) != 0 && n >= 1)
+            { s -= 1; d -= 1; *(UChar *) d = *(UChar *) s; n -= 1; }
+         while (n >= WS)
+            { s -= WS; d -= WS; *(UWord *) d = *(UWord *) s; n -= WS; }
+      }
+      while (n >= 1)
+         { s -= 1; d -= 1; *(UChar *) d = *(UChar *) s; n -= 1; }
+   }
+}
+
+static inline void dg_set(void *dst, Int c, SizeT len)
+{
+   const Addr WS = sizeof(UWord);
+   const Addr WM = WS - 1;
+   Addr a = (Addr) dst;
+   UWord cw = (UChar) c;
+   SizeT n = len;
+
+   cw |= cw << 8;
+   cw |= cw << 16;
+   if (WS == 8)
+      cw |= (cw << 16) << 16;
+   while ((a & WM) != 0 && n >= 1)
+      { *(UChar *) a = (UChar) c; a += 1; n -= 1; }
+   while (n >= WS)
+      { *(UWord *) a = cw; a += WS; n -= WS; }
+   while (n >= 1)
+      { *(UChar *) a = (UChar) c; a += 1; n -= 1; }
+}
+
+/*---------------------- memcpy and memmove ----------------------*/
+
+#define MEMMOVE_OR_MEMCPY(becTag, soname, fnname)                       \
+   void* VG_REPLACE_FUNCTION_EZZ(becTag,soname,fnname)                  \
+            ( void *dst, const void *src, SizeT len );                  \
+   void* VG_REPLACE_FUNCTION_EZZ(becTag,soname,fnname)                  \
+            ( void *dst, const void *src, SizeT len )                   \
+   {                                                                    \
+      DG_BULK_ACCESS(DG_BULK_COPY, dst, src, len);                      \
+      dg_copy(dst, src, len);                                           \
+      return dst;                                                       \
+   }
+
+#define MEMMOVE(soname, fnname)  \
+   MEMMOVE_OR_MEMCPY(20181, soname, fnname)
+
+#define MEMCPY(soname, fnname) \
+   MEMMOVE_OR_MEMCPY(20180, soname, fnname)
+
+#if defined(VGO_linux)
+ MEMMOVE(VG_Z_LIBC_SONAME, memcpyZAGLIBCZu2Zd2Zd5) /* memcpy@GLIBC_2.2.5 */
+ MEMCPY(VG_Z_LIBC_SONAME,  memcpyZAZAGLIBCZu2Zd14) /* memcpy@@GLIBC_2.14 */
+ MEMCPY(VG_Z_LIBC_SONAME,  memcpy) /* fallback case */
+ MEMCPY(VG_Z_LIBC_SONAME,  __GI_memcpy)
+ MEMCPY(VG_Z_LIBC_SONAME,  __memcpy_sse2)
+ MEMCPY(VG_Z_LD_SO_1,      memcpy) /* ld.so.1 */
+ MEMCPY(VG_Z_LD64_SO_1,    memcpy) /* ld64.so.1 */
+
+ MEMMOVE(VG_Z_LIBC_SONAME, memmove)
+ MEMMOVE(VG_Z_LIBC_SONAME, __GI_memmove)
+ MEMMOVE(VG_Z_LD64_SO_1,   memmove)
+
+#elif defined(VGO_darwin)
+# if DARWIN_VERS <= DARWIN_10_6
+  MEMCPY(VG_Z_LIBC_SONAME, memcpy)
+  MEMMOVE(VG_Z_LIBC_SONAME, memmove)
+# endif
+ MEMCPY(VG_Z_LIBC_SONAME,  memcpyZDVARIANTZDsse3x) /* memcpy$VARIANT$sse3x */
+ MEMCPY(VG_Z_LIBC_SONAME,  memcpyZDVARIANTZDsse42) /* memcpy$VARIANT$sse42 */
+ MEMMOVE(VG_Z_LIBC_SONAME, memmoveZDVARIANTZDsse3x) /* memmove$VARIANT$sse3x */
+ MEMMOVE(VG_Z_LIBC_SONAME, memmoveZDVARIANTZDsse42) /* memmove$VARIANT$sse42 */
+
+#elif defined(VGO_solaris)
+ MEMCPY(VG_Z_LIBC_SONAME,  memcpy)
+ MEMCPY(VG_Z_LIBC_SONAME,  memcpyZPZa)
+ MEMCPY(VG_Z_LD_SO_1,      memcpy)
+ MEMMOVE(VG_Z_LIBC_SONAME, memmove)
+ MEMMOVE(VG_Z_LIBC_SONAME, memmoveZPZa)
+ MEMMOVE(VG_Z_LD_SO_1,     memmove)
+
+#endif
+
+/*---------------------- memset ----------------------*/
+
+#define MEMSET(soname, fnname)                                          \
+   void* VG_REPLACE_FUNCTION_EZZ(20210,soname,fnname)                   \
+            (void *s, Int c, SizeT n);                                  \
+   void* VG_REPLACE_FUNCTION_EZZ(20210,soname,fnname)                   \
+            (void *s, Int c, SizeT n)                                   \
+   {                                                                    \
+      DG_BULK_ACCESS(DG_BULK_SET, s, 0, n);                             \
+      dg_set(s, c, n);                                                  \
+      return s;                                                         \
+   }
+
+#if defined(VGO_linux)
+ MEMSET(VG_Z_LIBC_SONAME, memset)
+
+#elif defined(VGO_darwin)
+ MEMSET(VG_Z_LIBC_SONAME, memset)
+
+#elif defined(VGO_solaris)
+ MEMSET(VG_Z_LIBC_SONAME, memset)
+ MEMSET(VG_Z_LIBC_SONAME, memsetZPZa)
+
+#endif
+
+/*---------------------- mempcpy ----------------------*/
+
+#define GLIBC25_MEMPCPY(soname, fnname)                                 \
+   void* VG_REPLACE_FUNCTION_EZU(20290,soname,fnname)                   \
+            ( void *dst, const void *src, SizeT len );                  \
+   void* VG_REPLACE_FUNCTION_EZU(20290,soname,fnname)                   \
+            ( void *dst, const void *src, SizeT len )                   \
+   {                                                                    \
+      DG_BULK_ACCESS(DG_BULK_COPY, dst, src, len);                      \
+      dg_copy(dst, src, len);                                           \
+      return (HChar *) dst + len;                                       \
+   }
+
+#if defined(VGO_linux)
+ GLIBC25_MEMPCPY(VG_Z_LIBC_SONAME, mempcpy)
+ GLIBC25_MEMPCPY(VG_Z_LIBC_SONAME, __GI_mempcpy)
+ GLIBC25_MEMPCPY(VG_Z_LD_SO_1,     mempcpy) /* ld.so.1 */
+ GLIBC25_MEMPCPY(VG_Z_LD_LINUX_SO_3, mempcpy) /* ld-linux.so.3 */
+ GLIBC25_MEMPCPY(VG_Z_LD_LINUX_X86_64_SO_2, mempcpy) /* ld-linux-x86-64.so.2 */
+#endif
+
+/*---------------------- memcpy_chk and memmove_chk ----------------------*/
+
+/* Variants that check that the destination is big enough, which
+ * _FORTIFY_SOURCE turns memcpy and memmove into.
+ */
+#define MEMCPY_CHK(becTag, name, soname, fnname)                        \
+   void* VG_REPLACE_FUNCTION_EZU(becTag,soname,fnname)                  \
+            (void *dst, const void *src, SizeT len, SizeT dstlen);      \
+   void* VG_REPLACE_FUNCTION_EZU(becTag,soname,fnname)                  \
+            (void *dst, const void *src, SizeT len, SizeT dstlen)       \
+   {                                                                    \
+      if (dstlen < len)                                                 \
+      {                                                                 \
+         VALGRIND_PRINTF_BACKTRACE(                                     \
+            "*** " name ": buffer overflow detected ***: "              \
+            "program terminated\n");                                    \
+         my_exit(1);                                                    \
+      }                                                                 \
+      DG_BULK_ACCESS(DG_BULK_COPY, dst, src, len);                      \
+      dg_copy(dst, src, len);                                           \
+      return dst;                                                       \
+   }
+
+#if defined(VGO_linux)
+ MEMCPY_CHK(20240, "memmove_chk", VG_Z_LIBC_SONAME, __memmove_chk)
+ MEMCPY_CHK(20300, "memcpy_chk", VG_Z_LIBC_SONAME, __memcpy_chk)
+#endif
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,585 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: replays the accesses of a trace.      dg_replay.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_replay makes the loads and stores of a trace, or of a window of its
+ * instructions, natively on the machine it runs on, and times them, so
+ * that an access pattern can be tried on other hardware without the
+ * program that made it.
+ *
+ * The pages the accesses touch are packed together into an arena, in
+ * order of address, so that neighbouring pages stay neighbours and only
+ * the gaps between them are taken out; offsets within pages are kept.
+ * The accesses become a list of 8-byte operations on the arena, which
+ * can be written to a replay file with --write and replayed from it
+ * later, without the trace. The file is the operations as they are in
+ * memory, after a small header, so it is only read on machines with the
+ * byte order of the one that wrote it.
+ *
+ * Each replay thread goes through all the operations once to warm up,
+ * and then --passes times while timed, on an arena of its own or, with
+ * --shared=yes, on one they all use. Instruction fetches are left out,
+ * atomic accesses are made as atomic adds where they are aligned, and
+ * the replay keeps none of the timing or the computation between the
+ * accesses, so it gives what the memory system does with the pattern
+ * rather than the time of the program.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "dg_trace.h"
+
+#define NONE          (~(uint64_t) 0)
+#define PAGE_SHIFT    12
+#define PAGE_SIZE     (1 << PAGE_SHIFT)
+#define MAX_ARENA     (1ULL << 32)
+#define REPLAY_MAGIC  "DGREPLAY"
+#define REPLAY_VERSION 1
+
+static const char *argv0 = "dg_replay";
+
+/* An access of the replay */
+typedef struct
+{
+   uint32_t offset;          /* In the arena */
+   uint16_t size;
+   uint8_t dir;              /* DG_ACC_READ, DG_ACC_WRITE or DG_ACC_ATOMIC */
+   uint8_t pad;
+} op;
+
+/* An access of the trace, before the pages are packed */
+typedef struct
+{
+   uint64_t addr;
+   uint32_t size;
+   uint8_t dir;
+} raw_op;
+
+typedef struct
+{
+   char magic[8];
+   uint32_t version;
+   uint32_t op_size;
+   uint64_t arena_size;
+   uint64_t n_ops;
+} replay_header;
+
+typedef struct
+{
+   const op *ops;
+   uint64_t n_ops;
+   uint64_t arena_size;
+   unsigned int passes;
+   unsigned char *shared;    /* Or NULL for an arena of its own */
+   pthread_barrier_t *barrier;
+   uint64_t sum;             /* Of what was loaded, so it is not dropped */
+   double secs;
+} replay_thread;
+
+static void out_of_memory(void)
+{
+   fprintf(stderr, "%s: out of memory\n", argv0);
+   exit(1);
+}
+
+static void *grow(void *array, size_t n, size_t *size, size_t elem_size)
+{
+   if (n + 1 > *size)
+   {
+      size_t new_size = *size > 0 ? *size * 2 : 65536;
+
+      while (new_size < n + 1)
+         new_size *= 2;
+      array = realloc(array, new_size * elem_size);
+      if (array == NULL)
+         out_of_memory();
+      *size = new_size;
+   }
+   return array;
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: replays the accesses of a Datagrind trace and times them\n"
+"usage: %s [options] trace|replay-file\n"
+"    --instrs=<from>-[<to>] only the runs in this window of instructions\n"
+"    --tid=<n>              only the accesses of thread n\n"
+"    --max-accesses=<n>     stop after this many accesses [no limit]\n"
+"    --write=<file>         write the replay to a file rather than run it\n"
+"    --threads=<n>          threads to replay with [1]\n"
+"    --shared=yes|no        the threads share one arena [no]\n"
+"    --passes=<n>           timed passes after the warm-up one [3]\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static int parse_window(const char *s, uint64_t *lo, uint64_t *hi)
+{
+   char *end;
+
+   *lo = strtoull(s, &end, 0);
+   if (end == s)
+      return 0;
+   if (*end == '-' && end[1] == '\0')
+      *hi = NONE;
+   else if (*end == '-' || *end == '+')
+   {
+      const char *rest = end + 1;
+      int is_size = *end == '+';
+      uint64_t value = strtoull(rest, &end, 0);
+
+      if (end == rest || *end != '\0')
+         return 0;
+      *hi = is_size ? *lo + value : value;
+   }
+   else
+      return 0;
+   return *hi > *lo;
+}
+
+/*------------------------------------------------------------*/
+/*--- Building                                             ---*/
+/*------------------------------------------------------------*/
+
+static int cmp_page(const void *a, const void *b)
+{
+   uint64_t pa = *(const uint64_t *) a, pb = *(const uint64_t *) b;
+
+   return pa < pb ? -1 : pa > pb;
+}
+
+static uint64_t find_page(const uint64_t *pages, uint64_t n, uint64_t page)
+{
+   uint64_t lo = 0, hi = n;
+
+   while (hi - lo > 1)
+   {
+      uint64_t mid = lo + (hi - lo) / 2;
+      if (pages[mid] <= page)
+         lo = mid;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+/* Reads the accesses of the window, and packs their pages */
+static op *build(const char *trace_name, uint64_t lo, uint64_t hi, uint32_t tid, int have_tid,
+                 uint64_t max_accesses, uint64_t *n_ops, uint64_t *arena_size)
+{
+   raw_op *raw = NULL;
+   size_t n_raw = 0, raw_size = 0;
+   uint64_t *pages, n_pages = 0, i;
+   op *ops;
+   dgt_file *file;
+   dgt_decoder *decoder;
+   dgt_record record;
+   dgt_run run;
+   int ret;
+
+   ret = dgt_open(trace_name, &file);
+   if (ret == DGT_OK)
+      ret = dgt_decoder_new(file, &decoder);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+      exit(1);
+   }
+   while (n_raw < max_accesses && (ret = dgt_decoder_next(decoder, &record, &run)) > 0)
+   {
+      uint64_t instrs;
+      uint32_t j;
+
+      if (ret != DGT_ITEM_RUN || (have_tid && run.tid != tid))
+         continue;
+      instrs = dgt_decoder_instrs(decoder) - run.n_instrs;
+      if (instrs >= hi)
+         break;
+      if (instrs < lo)
+         continue;
+      for (j = 0; j < run.n_accesses && n_raw < max_accesses; j++)
+      {
+         const dgt_access *a = &run.accesses[j];
+         uint32_t size = a->size;
+         uint64_t addr = a->addr;
+
+         if (a->dir == DG_ACC_EXEC || size == 0)
+            continue;
+         /* Wide accesses are split to fit the operations */
+         while (size > 0 && n_raw < max_accesses)
+         {
+            uint32_t part = size > 0x8000 ? 0x8000 : size;
+
+            raw = grow(raw, n_raw, &raw_size, sizeof(raw_op));
+            raw[n_raw].addr = addr;
+            raw[n_raw].size = part;
+            raw[n_raw].dir = a->dir;
+            n_raw++;
+            addr += part;
+            size -= part;
+         }
+      }
+   }
+   if (ret < 0)
+      fprintf(stderr, "%s: %s: %s; only the accesses before it are replayed\n",
+              argv0, trace_name, dgt_strerror(ret));
+   dgt_decoder_free(decoder);
+   dgt_close(file);
+
+   /* Both ends of each access, so that one that crosses a page finds the
+    * next page packed after its own
+    */
+   pages = malloc((2 * n_raw + 1) * sizeof(uint64_t));
+   if (pages == NULL)
+      out_of_memory();
+   for (i = 0; i < n_raw; i++)
+   {
+      pages[2 * i] = raw[i].addr >> PAGE_SHIFT;
+      pages[2 * i + 1] = (raw[i].addr + raw[i].size - 1) >> PAGE_SHIFT;
+   }
+   qsort(pages, 2 * n_raw, sizeof(uint64_t), cmp_page);
+   for (i = 0; i < 2 * n_raw; i++)
+      if (n_pages == 0 || pages[i] != pages[n_pages - 1])
+         pages[n_pages++] = pages[i];
+   if (n_pages << PAGE_SHIFT > MAX_ARENA)
+   {
+      fprintf(stderr, "%s: the accesses touch more than %llu bytes of pages; use a smaller --instrs window\n",
+              argv0, (unsigned long long) MAX_ARENA);
+      exit(1);
+   }
+
+   ops = malloc(n_raw * sizeof(op) + 1);
+   if (ops == NULL)
+      out_of_memory();
+   for (i = 0; i < n_raw; i++)
+   {
+      uint64_t page = find_page(pages, n_pages, raw[i].addr >> PAGE_SHIFT);
+
+      ops[i].offset = (page << PAGE_SHIFT) | (raw[i].addr & (PAGE_SIZE - 1));
+      ops[i].size = raw[i].size;
+      ops[i].dir = raw[i].dir;
+      ops[i].pad = 0;
+   }
+   free(raw);
+   free(pages);
+   *n_ops = n_raw;
+   *arena_size = n_pages << PAGE_SHIFT;
+   return ops;
+}
+
+static void write_replay(const char *filename, const op *ops, uint64_t n_ops,
+                         uint64_t arena_size)
+{
+   FILE *f = fopen(filename, "wb");
+   replay_header h;
+
+   if (f == NULL)
+   {
+      perror(filename);
+      exit(1);
+   }
+   memset(&h, 0, sizeof(h));
+   memcpy(h.magic, REPLAY_MAGIC, sizeof(h.magic));
+   h.version = REPLAY_VERSION;
+   h.op_size = sizeof(op);
+   h.arena_size = arena_size;
+   h.n_ops = n_ops;
+   if (fwrite(&h, sizeof(h), 1, f) != 1
+       || fwrite(ops, sizeof(op), n_ops, f) != n_ops
+       || fclose(f) != 0)
+   {
+      perror(filename);
+      exit(1);
+   }
+}
+
+/* Returns NULL if the file is not a replay */
+static op *read_replay(const char *filename, uint64_t *n_ops, uint64_t *arena_size)
+{
+   FILE *f = fopen(filename, "rb");
+   replay_header h;
+   op *ops;
+
+   if (f == NULL)
+   {
+      perror(filename);
+      exit(1);
+   }
+   if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, REPLAY_MAGIC, sizeof(h.magic)) != 0)
+   {
+      fclose(f);
+      return NULL;
+   }
+   if (h.version != REPLAY_VERSION || h.op_size != sizeof(op) || h.arena_size > MAX_ARENA)
+   {
+      fprintf(stderr, "%s: %s: not a replay this version can read\n", argv0, filename);
+      exit(1);
+   }
+   ops = malloc(h.n_ops * sizeof(op) + 1);
+   if (ops == NULL)
+      out_of_memory();
+   if (fread(ops, sizeof(op), h.n_ops, f) != h.n_ops)
+   {
+      fprintf(stderr, "%s: %s: cut short\n", argv0, filename);
+      exit(1);
+   }
+   fclose(f);
+   *n_ops = h.n_ops;
+   *arena_size = h.arena_size;
+   return ops;
+}
+
+/*------------------------------------------------------------*/
+/*--- Replaying                                            ---*/
+/*------------------------------------------------------------*/
+
+static unsigned char *new_arena(uint64_t size)
+{
+   void *arena = mmap(NULL, size + PAGE_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+   if (arena == MAP_FAILED)
+      out_of_memory();
+   /* Faulted in by the thread that uses it, so it is local to it */
+   memset(arena, 1, size + PAGE_SIZE);
+   return arena;
+}
+
+static uint64_t replay_pass(unsigned char *arena, const op *ops, uint64_t n_ops)
+{
+   uint64_t sum = 0, i;
+
+   for (i = 0; i < n_ops; i++)
+   {
+      unsigned char *p = arena + ops[i].offset;
+      uint32_t size = ops[i].size;
+
+      if (ops[i].dir == DG_ACC_READ)
+      {
+         switch (size)
+         {
+         case 1: sum += *(volatile uint8_t *) p; break;
+         case 2: { uint16_t v; memcpy(&v, p, 2); sum += v; break; }
+         case 4: { uint32_t v; memcpy(&v, p, 4); sum += v; break; }
+         case 8: { uint64_t v; memcpy(&v, p, 8); sum += v; break; }
+         default:
+            {
+               uint32_t j;
+               for (j = 0; j < size; j++)
+                  sum += ((volatile unsigned char *) p)[j];
+            }
+         }
+      }
+      else if (ops[i].dir == DG_ACC_ATOMIC && size == 8 && (ops[i].offset & 7) == 0)
+         __atomic_fetch_add((uint64_t *) p, 1, __ATOMIC_SEQ_CST);
+      else if (ops[i].dir == DG_ACC_ATOMIC && size == 4 && (ops[i].offset & 3) == 0)
+         __atomic_fetch_add((uint32_t *) p, 1, __ATOMIC_SEQ_CST);
+      else
+      {
+         switch (size)
+         {
+         case 1: *(volatile uint8_t *) p = (uint8_t) i; break;
+         case 2: { uint16_t v = i; memcpy(p, &v, 2); break; }
+         case 4: { uint32_t v = i; memcpy(p, &v, 4); break; }
+         case 8: memcpy(p, &i, 8); break;
+         default: memset(p, (int) i, size);
+         }
+      }
+   }
+   return sum;
+}
+
+static double now_secs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *replay_main(void *arg)
+{
+   replay_thread *t = arg;
+   unsigned char *arena = t->shared != NULL ? t->shared : new_arena(t->arena_size);
+   unsigned int i;
+   double start;
+
+   t->sum = replay_pass(arena, t->ops, t->n_ops);
+   pthread_barrier_wait(t->barrier);
+   start = now_secs();
+   for (i = 0; i < t->passes; i++)
+      t->sum += replay_pass(arena, t->ops, t->n_ops);
+   t->secs = now_secs() - start;
+   if (t->shared == NULL)
+      munmap(arena, t->arena_size + PAGE_SIZE);
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   const char *input = NULL, *write_name = NULL;
+   uint64_t lo = 0, hi = NONE, max_accesses = NONE, n_ops, arena_size, bytes = 0;
+   uint64_t n_reads = 0, n_writes = 0, n_atomics = 0, sum = 0;
+   unsigned int n_threads = 1, passes = 3, tid = 0, j;
+   int have_tid = 0, shared = 0, i;
+   uint64_t k;
+   replay_thread *threads;
+   pthread_t *handles;
+   pthread_barrier_t barrier;
+   double secs = 0.0;
+   op *ops;
+
+   if (argv[0])
+      argv0 = argv[0];
+   for (i = 1; i < argc; i++)
+   {
+      if (strncmp(argv[i], "--instrs=", 9) == 0)
+      {
+         if (!parse_window(argv[i] + 9, &lo, &hi))
+            usage();
+      }
+      else if (strncmp(argv[i], "--tid=", 6) == 0)
+      {
+         tid = strtoul(argv[i] + 6, NULL, 10);
+         have_tid = 1;
+      }
+      else if (strncmp(argv[i], "--max-accesses=", 15) == 0)
+         max_accesses = strtoull(argv[i] + 15, NULL, 10);
+      else if (strncmp(argv[i], "--write=", 8) == 0)
+         write_name = argv[i] + 8;
+      else if (strncmp(argv[i], "--threads=", 10) == 0)
+      {
+         n_threads = strtoul(argv[i] + 10, NULL, 10);
+         if (n_threads == 0)
+            usage();
+      }
+      else if (strcmp(argv[i], "--shared=yes") == 0)
+         shared = 1;
+      else if (strcmp(argv[i], "--shared=no") == 0)
+         shared = 0;
+      else if (strncmp(argv[i], "--passes=", 9) == 0)
+      {
+         passes = strtoul(argv[i] + 9, NULL, 10);
+         if (passes == 0)
+            usage();
+      }
+      else if (argv[i][0] == '-' || input != NULL)
+         usage();
+      else
+         input = argv[i];
+   }
+   if (input == NULL)
+      usage();
+
+   ops = read_replay(input, &n_ops, &arena_size);
+   if (ops == NULL)
+      ops = build(input, lo, hi, tid, have_tid, max_accesses, &n_ops, &arena_size);
+   else if (lo != 0 || hi != NONE || have_tid || max_accesses != NONE)
+      fprintf(stderr, "%s: %s is a replay, so the window options are ignored\n",
+              argv0, input);
+   if (write_name != NULL)
+   {
+      write_replay(write_name, ops, n_ops, arena_size);
+      free(ops);
+      return 0;
+   }
+   if (n_ops == 0)
+   {
+      fprintf(stderr, "%s: %s: no accesses to replay\n", argv0, input);
+      return 1;
+   }
+
+   for (k = 0; k < n_ops; k++)
+   {
+      bytes += ops[k].size;
+      n_reads += ops[k].dir == DG_ACC_READ;
+      n_writes += ops[k].dir == DG_ACC_WRITE;
+      n_atomics += ops[k].dir == DG_ACC_ATOMIC;
+   }
+   printf("Replaying %llu accesses (%llu reads, %llu writes, %llu atomics, %llu bytes)"
+          " over a %llu-byte arena\n",
+          (unsigned long long) n_ops, (unsigned long long) n_reads,
+          (unsigned long long) n_writes, (unsigned long long) n_atomics,
+          (unsigned long long) bytes, (unsigned long long) arena_size);
+
+   threads = calloc(n_threads, sizeof(replay_thread));
+   handles = calloc(n_threads, sizeof(pthread_t));
+   if (threads == NULL || handles == NULL)
+      out_of_memory();
+   pthread_barrier_init(&barrier, NULL, n_threads);
+   for (j = 0; j < n_threads; j++)
+   {
+      threads[j].ops = ops;
+      threads[j].n_ops = n_ops;
+      threads[j].arena_size = arena_size;
+      threads[j].passes = passes;
+      threads[j].shared = NULL;
+      threads[j].barrier = &barrier;
+   }
+   if (shared)
+   {
+      unsigned char *arena = new_arena(arena_size);
+
+      for (j = 0; j < n_threads; j++)
+         threads[j].shared = arena;
+   }
+   for (j = 0; j < n_threads; j++)
+      if (pthread_create(&handles[j], NULL, replay_main, &threads[j]) != 0)
+      {
+         fprintf(stderr, "%s: cannot start a thread\n", argv0);
+         return 1;
+      }
+   for (j = 0; j < n_threads; j++)
+   {
+      pthread_join(handles[j], NULL);
+      if (threads[j].secs > secs)
+         secs = threads[j].secs;
+      sum += threads[j].sum;
+   }
+   pthread_barrier_destroy(&barrier);
+
+   printf("%u thread%s, %u pass%s: %.3f ns/access, %.3f GB/s (checksum %llx)\n",
+          n_threads, n_threads == 1 ? "" : "s", passes, passes == 1 ? "" : "es",
+          secs * 1e9 / ((double) n_ops * passes),
+          secs > 0.0 ? (double) bytes * passes * n_threads / secs * 1e-9 : 0.0,
+          (unsigned long long) sum);
+   free(threads);
+   free(handles);
+   free(ops);
+   return 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,472 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: online reuse distance histograms.     dg_reuse.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-mode=reuse, runs are not written out. Instead the LRU
+ * stack distance of each access is measured at cache line granularity:
+ * the number of distinct other lines touched since the previous access to
+ * the same line. Histograms of the distances are kept per context and per
+ * range registered with DATAGRIND_TRACK_RANGE, and written at exit. With
+ * checkpoints, the counts since the last one are written at each, and
+ * cleared, while the distances carry on from all the accesses so far.
+ *
+ * The time of the last access to each line is kept in a hash table, and a
+ * Fenwick tree over times holds a 1 at each time that is still the last
+ * access to its line, so the distance is a sum over the tree. Times are
+ * renumbered densely when the tree fills up.
+ *
+ * With --datagrind-reuse-rate=n, only lines whose hash falls in a fixed
+ * 1/n of the hash space are tracked, and their distances are scaled up by
+ * n, as in SHARDS (Waldspurger et al., FAST '15). The tree and table then
+ * only hold the sampled lines.
+ *
+ * With --datagrind-max-memory, a table of lines that would grow past the
+ * cap halves the sampling rate instead, dropping the lines that are no
+ * longer sampled, much as the fixed-size variant of SHARDS does. The
+ * histograms are written out first, since each record gives the rate its
+ * counts were taken at.
+ */
+
+#define DG_REUSE_LINE_SHIFT  6
+#define DG_REUSE_INITIAL     (1 << 16)
+/* Bucket 0 is cold misses, bucket 1 distance 0, and bucket b > 1
+ * distances in [2^(b-2), 2^(b-1)).
+ */
+#define DG_REUSE_BUCKETS     50
+#define DG_REUSE_SAMPLE_BITS 24
+
+#define DG_REUSE_CONTEXT 0
+#define DG_REUSE_RANGE   1
+
+typedef struct
+{
+   Addr line;
+   ULong time;     /* 0 if the slot is empty */
+} DgReuseLine;
+
+typedef struct DgReuseContext
+{
+   struct DgReuseContext *next;
+   UWord key;      /* Context index */
+   ULong counts[DG_REUSE_BUCKETS];
+} DgReuseContext;
+
+typedef struct
+{
+   Addr start;
+   Addr end;       /* One past the last byte */
+   Bool active;
+   ULong counts[DG_REUSE_BUCKETS];
+} DgReuseRange;
+
+static Long clo_reuse_rate = 1;
+static Long reuse_rate = 0;     /* clo_reuse_rate, doubled at each halving */
+static UInt sample_threshold;
+static SizeT max_memory = 0;
+static ULong stats_halvings = 0;
+
+static DgReuseLine *lines = NULL;
+static SizeT lines_size = 0;    /* Power of 2 */
+static SizeT lines_used = 0;
+
+static UInt *tree = NULL;       /* Fenwick tree, indexed from 1 */
+static ULong tree_size = 0;
+static ULong now = 1;           /* Time of the next access */
+
+static VgHashTable *contexts = NULL;  /* DgReuseContext */
+static XArray *ranges = NULL;         /* DgReuseRange, as registered */
+static Word n_active_ranges = 0;
+
+Bool DG_(reuse_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BINT_CLO(arg, "--datagrind-reuse-rate", clo_reuse_rate,
+                   1, 1 << DG_REUSE_SAMPLE_BITS)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(reuse_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-reuse-rate=<n>       with --datagrind-mode=reuse, measure 1\n"
+"                                     in n cache lines [1]\n"
+   );
+}
+
+static inline UWord line_hash(Addr line)
+{
+   UWord h = line * 0x9E3779B1U;
+   return h ^ (h >> 16);
+}
+
+/* Fixed-rate sampling on a spatial hash, so each line is either always or
+ * never measured.
+ */
+static inline Bool line_sampled(Addr line)
+{
+   return (line_hash(line * 0x85EBCA6BU) & ((1U << DG_REUSE_SAMPLE_BITS) - 1))
+          < sample_threshold;
+}
+
+static DgReuseLine *line_slot(Addr line)
+{
+   SizeT i = line_hash(line) & (lines_size - 1);
+
+   for (;;)
+   {
+      DgReuseLine *e = &lines[i];
+      if (e->time == 0 || e->line == line)
+         return e;
+      i = (i + 1) & (lines_size - 1);
+   }
+}
+
+/* Rehashes the lines into a table of the given size, leaving out any that
+ * are no longer sampled.
+ */
+static void lines_resize(SizeT size)
+{
+   DgReuseLine *old = lines;
+   SizeT old_size = lines_size;
+   SizeT i;
+
+   lines = VG_(calloc)("datagrind.reuse.lines", size, sizeof(DgReuseLine));
+   lines_size = size;
+   lines_used = 0;
+   for (i = 0; i < old_size; i++)
+      if (old[i].time != 0 && line_sampled(old[i].line))
+      {
+         *line_slot(old[i].line) = old[i];
+         lines_used++;
+      }
+   if (old != NULL)
+      VG_(free)(old);
+}
+
+static inline void tree_add(ULong t, Int v)
+{
+   for (; t <= tree_size; t += t & -t)
+      tree[t] += v;
+}
+
+/* Number of live times in [1, t] */
+static inline ULong tree_sum(ULong t)
+{
+   ULong sum = 0;
+   for (; t > 0; t -= t & -t)
+      sum += tree[t];
+   return sum;
+}
+
+static Int cmp_line_time(const void *a, const void *b)
+{
+   const DgReuseLine *la = a;
+   const DgReuseLine *lb = b;
+   if (la->time != lb->time)
+      return la->time < lb->time ? -1 : 1;
+   return 0;
+}
+
+/* Renumbers the live times as 1 to lines_used, keeping their order, and
+ * rebuilds the tree with room to grow.
+ */
+static void renumber(void)
+{
+   DgReuseLine *live;
+   SizeT n = 0, i;
+
+   live = VG_(malloc)("datagrind.reuse.live", (lines_used + 1) * sizeof(DgReuseLine));
+   for (i = 0; i < lines_size; i++)
+      if (lines[i].time != 0)
+         live[n++] = lines[i];
+   tl_assert(n == lines_used);
+   VG_(ssort)(live, n, sizeof(DgReuseLine), cmp_line_time);
+   for (i = 0; i < n; i++)
+   {
+      live[i].time = i + 1;
+      *line_slot(live[i].line) = live[i];
+   }
+   VG_(free)(live);
+
+   if (tree != NULL)
+      VG_(free)(tree);
+   tree_size = 2 * n + DG_REUSE_INITIAL;
+   tree = VG_(calloc)("datagrind.reuse.tree", tree_size + 1, sizeof(UInt));
+   /* Linear-time build: each node covers [t - (t & -t) + 1, t] */
+   for (i = 1; i <= tree_size; i++)
+   {
+      ULong lo = i - (i & -i) + 1;
+      tree[i] = lo > n ? 0 : (i > n ? n : i) - lo + 1;
+   }
+   now = n + 1;
+}
+
+/* Memory taken by a table of lines of the given size, with the tree that
+ * renumber builds for it once it is half full.
+ */
+static SizeT reuse_footprint(SizeT size)
+{
+   return size * sizeof(DgReuseLine) + (size + DG_REUSE_INITIAL + 1) * sizeof(UInt);
+}
+
+/* Halves the sampling rate, to make room in a full table of lines */
+static void reuse_halve(void)
+{
+   DG_(reuse_flush)();
+   reuse_rate *= 2;
+   sample_threshold /= 2;
+   lines_resize(lines_size);
+   renumber();
+   stats_halvings++;
+}
+
+void DG_(reuse_init)(SizeT cap)
+{
+   if (clo_reuse_rate == 1)
+      sample_threshold = 1U << DG_REUSE_SAMPLE_BITS;
+   else
+      sample_threshold = (1U << DG_REUSE_SAMPLE_BITS) / clo_reuse_rate;
+   reuse_rate = clo_reuse_rate;
+   max_memory = cap;
+   lines_resize(DG_REUSE_INITIAL);
+   renumber();
+   contexts = VG_(HT_construct)("datagrind.reuse.contexts");
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.reuse.ranges", VG_(free),
+                       sizeof(DgReuseRange));
+}
+
+static inline UInt distance_bucket(ULong distance, Bool cold)
+{
+   UInt b = 1;
+
+   if (cold)
+      return 0;
+   while (distance > 0 && b < DG_REUSE_BUCKETS - 1)
+   {
+      distance >>= 1;
+      b++;
+   }
+   return b;
+}
+
+void DG_(reuse_add)(UWord context_index, Addr addr)
+{
+   Addr line = addr >> DG_REUSE_LINE_SHIFT;
+   DgReuseLine *e;
+   DgReuseContext *ctx;
+   Bool cold;
+   ULong distance = 0;
+   UInt bucket;
+
+   if (!line_sampled(line))
+      return;
+
+   if (now > tree_size)
+      renumber();
+   e = line_slot(line);
+   cold = e->time == 0;
+   if (!cold)
+   {
+      distance = (tree_sum(now - 1) - tree_sum(e->time)) * reuse_rate;
+      tree_add(e->time, -1);
+   }
+   else
+   {
+      e->line = line;
+      lines_used++;
+   }
+   e->time = now;
+   tree_add(now, 1);
+   now++;
+
+   bucket = distance_bucket(distance, cold);
+   ctx = VG_(HT_lookup)(contexts, context_index);
+   if (ctx == NULL)
+   {
+      ctx = VG_(calloc)("datagrind.reuse.context", 1, sizeof(DgReuseContext));
+      ctx->key = context_index;
+      VG_(HT_add_node)(contexts, ctx);
+   }
+   ctx->counts[bucket]++;
+
+   if (n_active_ranges > 0)
+   {
+      Word n = VG_(sizeXA)(ranges);
+      Word i;
+      for (i = 0; i < n; i++)
+      {
+         DgReuseRange *range = VG_(indexXA)(ranges, i);
+         if (range->active && addr >= range->start && addr < range->end)
+            range->counts[bucket]++;
+      }
+   }
+
+   /* Only once the access is counted, since halving writes out the counts */
+   if (cold && lines_used > lines_size / 2)
+   {
+      if (max_memory == 0 || reuse_footprint(lines_size * 2) <= max_memory
+          || sample_threshold <= 1)
+         lines_resize(lines_size * 2);
+      else
+         reuse_halve();
+   }
+}
+
+void DG_(reuse_track)(Addr addr, SizeT len)
+{
+   DgReuseRange range;
+
+   if (ranges == NULL)
+      return;
+   VG_(memset)(&range, 0, sizeof(range));
+   range.start = addr;
+   range.end = addr + len;
+   range.active = True;
+   VG_(addToXA)(ranges, &range);
+   n_active_ranges++;
+}
+
+void DG_(reuse_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgReuseRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+static void out_histogram(UChar kind, UWord id, const ULong *counts)
+{
+   UChar payload[1 + 3 * DG_MAX_UVARINT_BYTES + DG_REUSE_BUCKETS * 10];
+   UChar *p = payload;
+   Int n = DG_REUSE_BUCKETS, i;
+
+   while (n > 0 && counts[n - 1] == 0)
+      n--;
+   if (n == 0)
+      return;
+   *p++ = kind;
+   p = encode_uvarint(p, id);
+   p = encode_uvarint(p, reuse_rate);
+   p = encode_uvarint(p, n);
+   for (i = 0; i < n; i++)
+      p = encode_uvarint64(p, counts[i]);
+   out_byte(DG_R_REUSE);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+}
+
+static Int cmp_context_ptr(const void *a, const void *b)
+{
+   const DgReuseContext *ca = *(DgReuseContext * const *) a;
+   const DgReuseContext *cb = *(DgReuseContext * const *) b;
+   if (ca->key != cb->key)
+      return ca->key < cb->key ? -1 : 1;
+   return 0;
+}
+
+void DG_(reuse_flush)(void)
+{
+   DgReuseContext **nodes;
+   UInt n_nodes, i;
+   Word n_ranges, j;
+
+   if (contexts == NULL)
+      return;
+
+   nodes = (DgReuseContext **) VG_(HT_to_array)(contexts, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgReuseContext *), cmp_context_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      out_histogram(DG_REUSE_CONTEXT, nodes[i]->key, nodes[i]->counts);
+      VG_(memset)(nodes[i]->counts, 0, sizeof(nodes[i]->counts));
+   }
+   VG_(free)(nodes);
+
+   n_ranges = VG_(sizeXA)(ranges);
+   for (j = 0; j < n_ranges; j++)
+   {
+      DgReuseRange *range = VG_(indexXA)(ranges, j);
+      out_histogram(DG_REUSE_RANGE, j, range->counts);
+      VG_(memset)(range->counts, 0, sizeof(range->counts));
+   }
+}
+
+void DG_(reuse_print_stats)(DgPrintf print)
+{
+   /* Still set after reuse_finish, which comes before the stats at exit */
+   if (reuse_rate == 0)
+      return;
+   print("datagrind: reuse table of %'lu lines, sampling 1 in %'lld, %'llu halvings\n",
+         lines_size, reuse_rate, stats_halvings);
+}
+
+void DG_(reuse_finish)(void)
+{
+   if (contexts == NULL)
+      return;
+
+   DG_(reuse_flush)();
+
+   VG_(HT_destruct)(contexts, VG_(free));
+   VG_(deleteXA)(ranges);
+   VG_(free)(lines);
+   VG_(free)(tree);
+   contexts = NULL;
+   ranges = NULL;
+   lines = NULL;
+   tree = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
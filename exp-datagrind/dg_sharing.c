@@ -0,0 +1,409 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: cache lines shared between threads. dg_sharing.c  ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-sharing=yes, each cache line keeps the thread that last
+ * wrote it, the bytes that thread has written, and the threads that have
+ * read it since. An access counts as a transfer of the line when it comes
+ * from another thread than the writer within the window after the last
+ * write, or is a write within the window after another thread read the
+ * line, much as the line would move between cores. A transfer is true
+ * sharing if it touches bytes the other side accessed, and false sharing
+ * if the bytes are disjoint. Lines with transfers are written at exit,
+ * with the contexts on both sides.
+ *
+ * The "time" is the number of instructions executed, since valgrind runs
+ * one thread at a time; the window should thus cover a few timeslices.
+ * Threads are kept in a 64-bit mask, so with more than 64 threads some
+ * share a bit.
+ *
+ * With --datagrind-atomics=yes, the atomic accesses (compare-and-swaps
+ * and store-conditionals) are counted for each line apart from the rest.
+ * An atomic is contended when the last atomic on the line came from
+ * another thread within the window, as the line then had to be taken from
+ * that thread's core. Lines with contended atomics are written at exit.
+
+ */
+
+#define DG_SHARING_LINE_SHIFT 6
+#define DG_SHARING_LINE_SIZE  (1 << DG_SHARING_LINE_SHIFT)
+#define DG_SHARING_INITIAL    (1 << 16)
+#define DG_SHARING_CONTEXTS   8      /* Contexts kept per shared line */
+
+typedef struct
+{
+   Addr line;
+   ULong last_write;     /* Instruction counts */
+   ULong last_read;
+   ULong written;        /* Bytes written by the writer since it took the line */
+   ULong read;           /* Bytes read by the readers */
+   ULong readers;        /* Threads that read it since the last write */
+   UWord writer_context;
+   UWord reader_context; /* Context of the last read */
+   ThreadId writer;      /* 0 if not written yet */
+   Bool used;            /* False if the slot is empty */
+} DgSharingLine;
+
+typedef struct
+{
+   VgHashNode header;    /* Key is the line */
+   ULong threads;
+   ULong false_transfers;
+   ULong true_transfers;
+   ULong false_bytes;    /* Bytes of the line in false sharing transfers */
+   ULong true_bytes;     /* Bytes accessed by both sides */
+   UInt n_contexts;
+   UWord contexts[DG_SHARING_CONTEXTS];
+} DgSharedLine;
+
+typedef struct
+{
+   VgHashNode header;    /* Key is the line */
+   ULong threads;
+   ULong atomics;
+   ULong contended;
+   ULong last;           /* Instruction count of the last atomic */
+   ThreadId last_tid;
+   UInt n_contexts;
+   UWord contexts[DG_SHARING_CONTEXTS];
+} DgAtomicLine;
+
+Bool DG_(clo_sharing) = False;
+Bool DG_(clo_atomics) = False;
+static Long clo_sharing_window = 10000000;
+
+static DgSharingLine *table = NULL;
+static SizeT table_size = 0;    /* Power of 2 */
+static SizeT table_used = 0;
+static VgHashTable *shared = NULL;   /* DgSharedLine */
+static VgHashTable *atomics = NULL;  /* DgAtomicLine */
+
+Bool DG_(sharing_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-sharing", DG_(clo_sharing))) {}
+   else if (VG_BOOL_CLO(arg, "--datagrind-atomics", DG_(clo_atomics))) {}
+   else if (VG_BINT_CLO(arg, "--datagrind-sharing-window", clo_sharing_window,
+                        1, 1000000000000LL)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(sharing_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-sharing=yes|no       find cache lines moving between\n"
+"                                     threads [no]\n"
+"    --datagrind-sharing-window=<n>   instructions after a write in which\n"
+"                                     another thread shares the line [10000000]\n"
+"    --datagrind-atomics=yes|no       find atomics contended between\n"
+"                                     threads [no]\n"
+   );
+}
+
+static inline SizeT sharing_hash(Addr line)
+{
+   UWord h = line * 0x9E3779B1U;
+   return (h ^ (h >> 15)) & (table_size - 1);
+}
+
+static DgSharingLine *sharing_slot(Addr line)
+{
+   SizeT i = sharing_hash(line);
+
+   for (;;)
+   {
+      DgSharingLine *e = &table[i];
+      if (!e->used || e->line == line)
+         return e;
+      i = (i + 1) & (table_size - 1);
+   }
+}
+
+static void sharing_resize(SizeT size)
+{
+   DgSharingLine *old = table;
+   SizeT old_size = table_size;
+   SizeT i;
+
+   table = VG_(calloc)("datagrind.sharing.lines", size, sizeof(DgSharingLine));
+   table_size = size;
+   for (i = 0; i < old_size; i++)
+      if (old[i].used)
+         *sharing_slot(old[i].line) = old[i];
+   if (old != NULL)
+      VG_(free)(old);
+}
+
+void DG_(sharing_init)(void)
+{
+   if (DG_(clo_atomics))
+      atomics = VG_(HT_construct)("datagrind.sharing.atomics");
+   if (!DG_(clo_sharing))
+      return;
+   sharing_resize(DG_SHARING_INITIAL);
+   shared = VG_(HT_construct)("datagrind.sharing.shared");
+}
+
+static inline ULong thread_bit(ThreadId tid)
+{
+   return 1ULL << ((tid - 1) & 63);
+}
+
+static void add_context(UWord *contexts, UInt *n_contexts, UWord context_index)
+{
+   UInt i;
+
+   for (i = 0; i < *n_contexts; i++)
+      if (contexts[i] == context_index)
+         return;
+   if (*n_contexts < DG_SHARING_CONTEXTS)
+      contexts[(*n_contexts)++] = context_index;
+}
+
+static void transfer(const DgSharingLine *e, ULong threads, ULong mask, ULong other,
+                     UWord context_index, UWord other_context)
+{
+   DgSharedLine *s = VG_(HT_lookup)(shared, e->line);
+
+   if (s == NULL)
+   {
+      s = VG_(calloc)("datagrind.sharing.shared", 1, sizeof(DgSharedLine));
+      s->header.key = e->line;
+      VG_(HT_add_node)(shared, s);
+   }
+   s->threads |= threads;
+   if (mask & other)
+   {
+      s->true_transfers++;
+      s->true_bytes |= mask & other;
+   }
+   else
+   {
+      s->false_transfers++;
+      s->false_bytes |= mask;
+   }
+   add_context(s->contexts, &s->n_contexts, context_index);
+   add_context(s->contexts, &s->n_contexts, other_context);
+}
+
+static void sharing_line_access(ThreadId tid, UWord context_index, Addr line,
+                                ULong mask, UChar dir, ULong now)
+{
+   DgSharingLine *e = sharing_slot(line);
+   ULong bit = thread_bit(tid);
+   Bool recent;
+
+   if (!e->used)
+   {
+      e->used = True;
+      e->line = line;
+      if (++table_used > table_size / 2)
+      {
+         sharing_resize(table_size * 2);
+         e = sharing_slot(line);
+      }
+   }
+
+   recent = e->writer != 0 && now - e->last_write <= clo_sharing_window;
+   if (DG_ACC_IS_WRITE(dir))
+   {
+      if (recent && e->writer != tid)
+         transfer(e, bit | thread_bit(e->writer), mask, e->written,
+                  context_index, e->writer_context);
+      else if ((e->readers & ~bit) && now - e->last_read <= clo_sharing_window)
+         transfer(e, e->readers | bit, mask, e->read,
+                  context_index, e->reader_context);
+      if (e->writer != tid || !recent)
+         e->written = 0;
+      e->written |= mask;
+      e->writer = tid;
+      e->writer_context = context_index;
+      e->last_write = now;
+      e->readers = 0;
+      e->read = 0;
+   }
+   else
+   {
+      /* Only the first read of each thread moves the line */
+      if (recent && e->writer != tid && !(e->readers & bit))
+         transfer(e, bit | thread_bit(e->writer), mask, e->written,
+                  context_index, e->writer_context);
+      e->readers |= bit;
+      e->read |= mask;
+      e->reader_context = context_index;
+      e->last_read = now;
+   }
+}
+
+void DG_(sharing_access)(ThreadId tid, UWord context_index, Addr addr, UChar size,
+                         UChar dir, ULong now)
+{
+   Addr end = addr + size;
+
+   /* An access may straddle two lines */
+   while (addr < end)
+   {
+      Addr line = addr >> DG_SHARING_LINE_SHIFT;
+      UInt offset = addr & (DG_SHARING_LINE_SIZE - 1);
+      UInt n = end - addr < DG_SHARING_LINE_SIZE - offset
+               ? end - addr : DG_SHARING_LINE_SIZE - offset;
+      ULong mask = n == 64 ? ~0ULL : ((1ULL << n) - 1) << offset;
+
+      sharing_line_access(tid, context_index, line, mask, dir, now);
+      addr += n;
+   }
+}
+
+void DG_(atomics_access)(ThreadId tid, UWord context_index, Addr addr, ULong now)
+{
+   Addr line = addr >> DG_SHARING_LINE_SHIFT;
+   DgAtomicLine *a = VG_(HT_lookup)(atomics, line);
+
+   if (a == NULL)
+   {
+      a = VG_(calloc)("datagrind.sharing.atomic", 1, sizeof(DgAtomicLine));
+      a->header.key = line;
+      VG_(HT_add_node)(atomics, a);
+   }
+   else if (a->last_tid != tid && now - a->last <= clo_sharing_window)
+      a->contended++;
+   a->atomics++;
+   a->threads |= thread_bit(tid);
+   a->last = now;
+   a->last_tid = tid;
+   add_context(a->contexts, &a->n_contexts, context_index);
+}
+
+static Int cmp_shared_ptr(const void *a, const void *b)
+{
+   const DgSharedLine *sa = *(DgSharedLine * const *) a;
+   const DgSharedLine *sb = *(DgSharedLine * const *) b;
+   if (sa->header.key != sb->header.key)
+      return sa->header.key < sb->header.key ? -1 : 1;
+   return 0;
+}
+
+static Int cmp_atomic_ptr(const void *a, const void *b)
+{
+   const DgAtomicLine *aa = *(DgAtomicLine * const *) a;
+   const DgAtomicLine *ab = *(DgAtomicLine * const *) b;
+   if (aa->header.key != ab->header.key)
+      return aa->header.key < ab->header.key ? -1 : 1;
+   return 0;
+}
+
+static void atomics_finish(void)
+{
+   DgAtomicLine **nodes;
+   UInt n_nodes, i;
+
+   nodes = (DgAtomicLine **) VG_(HT_to_array)(atomics, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgAtomicLine *), cmp_atomic_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgAtomicLine *a = nodes[i];
+      UChar payload[1 + 4 * 10 + (DG_SHARING_CONTEXTS + 1) * DG_MAX_UVARINT_BYTES];
+      UChar *p = payload;
+      UInt j;
+
+      if (a->contended == 0)
+         continue;
+      *p++ = DG_SHARING_LINE_SHIFT;
+      p = encode_uvarint(p, a->header.key);
+      p = encode_uvarint64(p, a->threads);
+      p = encode_uvarint64(p, a->atomics);
+      p = encode_uvarint64(p, a->contended);
+      p = encode_uvarint(p, a->n_contexts);
+      for (j = 0; j < a->n_contexts; j++)
+         p = encode_uvarint(p, a->contexts[j]);
+      out_byte(DG_R_ATOMICS);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+   }
+   VG_(free)(nodes);
+   VG_(HT_destruct)(atomics, VG_(free));
+   atomics = NULL;
+}
+
+void DG_(sharing_finish)(void)
+{
+   DgSharedLine **nodes;
+   UInt n_nodes, i;
+
+   if (atomics != NULL)
+      atomics_finish();
+   if (shared == NULL)
+      return;
+
+   nodes = (DgSharedLine **) VG_(HT_to_array)(shared, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgSharedLine *), cmp_shared_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgSharedLine *s = nodes[i];
+      UChar payload[1 + 7 * 10 + (DG_SHARING_CONTEXTS + 1) * DG_MAX_UVARINT_BYTES];
+      UChar *p = payload;
+      UInt j;
+
+      *p++ = DG_SHARING_LINE_SHIFT;
+      p = encode_uvarint(p, s->header.key);
+      p = encode_uvarint64(p, s->threads);
+      p = encode_uvarint64(p, s->false_transfers);
+      p = encode_uvarint64(p, s->true_transfers);
+      p = encode_uvarint64(p, s->false_bytes);
+      p = encode_uvarint64(p, s->true_bytes);
+      p = encode_uvarint(p, s->n_contexts);
+      for (j = 0; j < s->n_contexts; j++)
+         p = encode_uvarint(p, s->contexts[j]);
+      out_byte(DG_R_SHARING);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+   }
+   VG_(free)(nodes);
+   VG_(HT_destruct)(shared, VG_(free));
+   shared = NULL;
+   VG_(free)(table);
+   table = NULL;
+   table_size = table_used = 0;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
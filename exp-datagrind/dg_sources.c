@@ -0,0 +1,311 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: accesses per source line.            dg_sources.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_debuginfo.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-source-stats=yes, the accesses are counted by source
+ * line and function as the run goes, so that a trace can be read by line
+ * without looking up every context's stack afterwards. Each access of a
+ * block is looked up once, when its DG_R_BBDEF is written, to a node for
+ * its file, line and function, and each run adds to the nodes of its
+ * accesses. Blocks are written again as they are retranslated, so the
+ * lookups go through a direct-mapped cache by instruction address, as in
+ * callgrind's dump.c. At exit the nodes are summed by line and by function,
+ * and a record is written for each.
+ */
+
+/* As in callgrind, a prime */
+#define DG_SOURCE_CACHE_SIZE 1777
+
+typedef struct
+{
+   ULong reads, writes;
+   ULong read_bytes, write_bytes;
+} DgSourceCounts;
+
+typedef struct DgSourceName
+{
+   struct DgSourceName *next;
+   UWord key;          /* Hash of the name */
+   const HChar *name;
+} DgSourceName;
+
+struct DgSourceLine
+{
+   struct DgSourceLine *next;
+   UWord key;          /* Hash of the fields below */
+   const DgSourceName *file;   /* With its directory */
+   UInt line;          /* 0 if unknown */
+   const DgSourceName *fn;
+   DgSourceCounts counts;
+};
+
+Bool DG_(clo_source_stats) = False;
+
+static VgHashTable *names = NULL;      /* DgSourceName, of files and functions */
+static VgHashTable *lines = NULL;      /* DgSourceLine */
+
+static Addr cache_addr[DG_SOURCE_CACHE_SIZE];
+static DgSourceLine *cache_line[DG_SOURCE_CACHE_SIZE];
+
+static ULong stats_lookups = 0;
+static ULong stats_cache_hits = 0;
+
+Bool DG_(sources_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-source-stats", DG_(clo_source_stats))) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(sources_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-source-stats=yes|no  count the accesses of each source line\n"
+"                                     and function [no]\n"
+   );
+}
+
+void DG_(sources_init)(void)
+{
+   if (!DG_(clo_source_stats))
+      return;
+   names = VG_(HT_construct)("datagrind.sources.names");
+   lines = VG_(HT_construct)("datagrind.sources.lines");
+}
+
+static UWord hash_string(const HChar *s)
+{
+   UWord h = 0;
+
+   for (; *s != '\0'; s++)
+      h = h * 31 + (UChar) *s;
+   return h;
+}
+
+static Word cmp_name(const void *a, const void *b)
+{
+   return VG_(strcmp)(((const DgSourceName *) a)->name, ((const DgSourceName *) b)->name);
+}
+
+static const DgSourceName *intern_name(const HChar *name)
+{
+   DgSourceName key, *node;
+
+   key.key = hash_string(name);
+   key.name = name;
+   node = VG_(HT_gen_lookup)(names, &key, cmp_name);
+   if (node == NULL)
+   {
+      node = VG_(malloc)("datagrind.sources.name", sizeof(DgSourceName));
+      node->key = key.key;
+      node->name = VG_(strdup)("datagrind.sources.name", name);
+      VG_(HT_add_node)(names, node);
+   }
+   return node;
+}
+
+static Word cmp_line(const void *a, const void *b)
+{
+   const DgSourceLine *la = a, *lb = b;
+   return la->file != lb->file || la->line != lb->line || la->fn != lb->fn;
+}
+
+DgSourceLine *DG_(sources_lookup)(Addr ip)
+{
+   UWord slot = ip % DG_SOURCE_CACHE_SIZE;
+   DiEpoch ep = VG_(current_DiEpoch)();
+   const HChar *file, *dir, *fn;
+   DgSourceLine key, *node;
+
+   stats_lookups++;
+   if (cache_line[slot] != NULL && cache_addr[slot] == ip)
+   {
+      stats_cache_hits++;
+      return cache_line[slot];
+   }
+
+   VG_(memset)(&key, 0, sizeof(key));
+   if (VG_(get_filename_linenum)(ep, ip, &file, &dir, &key.line))
+   {
+      if (dir[0] != '\0')
+      {
+         HChar *path = VG_(malloc)("datagrind.sources.path",
+                                   VG_(strlen)(dir) + VG_(strlen)(file) + 2);
+         VG_(sprintf)(path, "%s/%s", dir, file);
+         key.file = intern_name(path);
+         VG_(free)(path);
+      }
+      else
+         key.file = intern_name(file);
+   }
+   else
+   {
+      key.file = intern_name("???");
+      key.line = 0;
+   }
+   /* Only once the file is interned, as the name may share its buffer */
+   key.fn = intern_name(VG_(get_fnname)(ep, ip, &fn) ? fn : "???");
+
+   key.key = (UWord) key.file ^ ((UWord) key.fn >> 3) ^ ((UWord) key.line * 2654435761U);
+   node = VG_(HT_gen_lookup)(lines, &key, cmp_line);
+   if (node == NULL)
+   {
+      node = VG_(malloc)("datagrind.sources.line", sizeof(DgSourceLine));
+      *node = key;
+      VG_(HT_add_node)(lines, node);
+   }
+   cache_addr[slot] = ip;
+   cache_line[slot] = node;
+   return node;
+}
+
+void DG_(sources_access)(DgSourceLine *line, Bool write, UInt size)
+{
+   if (write)
+   {
+      line->counts.writes++;
+      line->counts.write_bytes += size;
+   }
+   else
+   {
+      line->counts.reads++;
+      line->counts.read_bytes += size;
+   }
+}
+
+static Int cmp_by_line(const void *a, const void *b)
+{
+   const DgSourceLine *la = *(DgSourceLine * const *) a;
+   const DgSourceLine *lb = *(DgSourceLine * const *) b;
+   Int c = VG_(strcmp)(la->file->name, lb->file->name);
+
+   if (c != 0)
+      return c;
+   if (la->line != lb->line)
+      return la->line < lb->line ? -1 : 1;
+   return 0;
+}
+
+static Int cmp_by_fn(const void *a, const void *b)
+{
+   const DgSourceLine *la = *(DgSourceLine * const *) a;
+   const DgSourceLine *lb = *(DgSourceLine * const *) b;
+   return VG_(strcmp)(la->fn->name, lb->fn->name);
+}
+
+static void add_counts(DgSourceCounts *to, const DgSourceCounts *from)
+{
+   to->reads += from->reads;
+   to->writes += from->writes;
+   to->read_bytes += from->read_bytes;
+   to->write_bytes += from->write_bytes;
+}
+
+static void write_source(UChar kind, const HChar *name, UInt line,
+                         const DgSourceCounts *counts)
+{
+   SizeT name_len = VG_(strlen)(name) + 1;
+   UChar *payload, *p;
+
+   if (counts->reads == 0 && counts->writes == 0)
+      return;
+   payload = VG_(malloc)("datagrind.sources.payload",
+                         1 + name_len + DG_MAX_UVARINT_BYTES + 4 * 10);
+   p = put_byte(payload, kind);
+   p = put_bytes(p, name, name_len);
+   p = encode_uvarint(p, line);
+   p = encode_uvarint64(p, counts->reads);
+   p = encode_uvarint64(p, counts->writes);
+   p = encode_uvarint64(p, counts->read_bytes);
+   p = encode_uvarint64(p, counts->write_bytes);
+   out_byte(DG_R_SOURCE_STATS);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+}
+
+/* Sums the runs of nodes that compare equal, writing a record for each */
+static void write_sums(DgSourceLine **nodes, UInt n_nodes, UChar kind,
+                       Int (*cmp)(const void *, const void *))
+{
+   UInt i, j;
+
+   VG_(ssort)(nodes, n_nodes, sizeof(DgSourceLine *), cmp);
+   for (i = 0; i < n_nodes; i = j)
+   {
+      DgSourceCounts sum = nodes[i]->counts;
+
+      for (j = i + 1; j < n_nodes && cmp(&nodes[i], &nodes[j]) == 0; j++)
+         add_counts(&sum, &nodes[j]->counts);
+      if (kind == DG_SOURCE_LINE)
+         write_source(kind, nodes[i]->file->name, nodes[i]->line, &sum);
+      else
+         write_source(kind, nodes[i]->fn->name, 0, &sum);
+   }
+}
+
+void DG_(sources_print_stats)(DgPrintf print)
+{
+   if (lines == NULL)
+      return;
+   print("datagrind: %'llu source lookups, %'llu cache hits, %'d lines\n",
+         stats_lookups, stats_cache_hits, VG_(HT_count_nodes)(lines));
+}
+
+void DG_(sources_finish)(void)
+{
+   DgSourceLine **nodes;
+   UInt n_nodes;
+
+   if (lines == NULL)
+      return;
+
+   nodes = (DgSourceLine **) VG_(HT_to_array)(lines, &n_nodes);
+   write_sums(nodes, n_nodes, DG_SOURCE_LINE, cmp_by_line);
+   write_sums(nodes, n_nodes, DG_SOURCE_FUNCTION, cmp_by_fn);
+   VG_(free)(nodes);
+   /* The nodes are kept, since blocks still point at them */
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,1434 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: summary statistics of a trace.           dg_stat.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* dg_stat prints a summary of a trace: the bytes taken by each type of
+ * record, the mix of reads and writes, the contexts and tracked ranges
+ * with the most accesses, and the working set over time.
+ *
+ * A first walk over the records, which only looks at their headers and
+ * the first bytes of runs, counts the records and instructions and gathers
+ * the tracked ranges. The runs are then decoded with dgt_decode_parallel,
+ * each thread counting into its own tables, which are added up at the end.
+ * Memory is bounded by the number of contexts and ranges rather than the
+ * length of the trace.
+ *
+ * The working set of each interval is the number of distinct cache lines
+ * touched, estimated with a HyperLogLog sketch so that the count takes a
+ * fixed amount of memory and the sketches of threads can be merged.
+ *
+ * With --who, only the address index written by dg_addrindex is read, to
+ * list the contexts that accessed some addresses and when.
+ *
+ * A trace written with --datagrind-first-touch=yes also gets the contexts
+ * whose first writes placed the most pages that another thread then made
+ * most of the accesses to, which are the ones to move or parallelise for
+ * NUMA placement.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dg_trace.h"
+
+#define LINE_SHIFT 6
+#define HLL_BITS   10
+#define HLL_SIZE   (1 << HLL_BITS)
+
+static const char *argv0 = "dg_stat";
+
+static const char *const record_names[] =
+{
+   "HEADER", "READ", "WRITE", "TRACK_RANGE", "UNTRACK_RANGE",
+   "START_EVENT", "END_EVENT", "INSTR", "TEXT_AVMA", "MALLOC_BLOCK",
+   "FREE_BLOCK", "BBDEF", "BBRUN", "CONTEXT", "BBRUN_FILTERED", "THREAD",
+   "CHUNK", "INDEX", "FOOTER", "HEATMAP", "REUSE", "CACHE_CONFIG",
+   "CACHE_MISSES", "ALLOC_STACK", "ALLOC_STATS", "FIELD_HEAT", "SHARING",
+   "PAGES", "TLB_CONFIG", "TLB_MISSES", "SYSCALL_ACCESS", "MAP", "UNMAP",
+   "REMAP", "PROTECT", "PROCESS", "BBRUN_STRIDED",
+   "BBRUN_LINES", "HEAP_SNAPSHOT", "BULK_ACCESS",
+   "REALLOC_BLOCK", "MEMPOOL", "ACCESS_PATTERNS",
+   "ATOMICS", "WORKING_SET", "CHECKPOINT", "RASTER", "VALUE_STATS",
+   "SOURCE_STATS", "SIMPOINTS", "FIRST_TOUCH", "LOCK",
+   "ACCESS_COUNTS", "AFFINITY", "FORK_DEFS", "SHARD",
+   "CONTEXT_COUNTS"
+};
+
+typedef struct
+{
+   uint64_t addr;
+   uint64_t len;
+   const char *type;
+   const char *label;
+   uint64_t number;          /* Of the first track range record for it */
+   uint64_t times;           /* Number of such records */
+} range;
+
+typedef struct
+{
+   uint64_t accesses;
+   uint64_t writes;
+   uint8_t hll[HLL_SIZE];
+} interval;
+
+/* A DG_R_LOCK, with where and when it was met */
+typedef struct
+{
+   uint64_t addr;
+   uint64_t offset;
+   uint64_t instrs;
+   uint32_t tid;
+   uint8_t action, kind;
+} lock_event;
+
+typedef struct stats stats;
+
+typedef struct
+{
+   const stats *st;
+   uint64_t reads, writes;
+   uint64_t read_bytes, write_bytes;
+   uint64_t atomics, atomic_bytes;   /* Also counted as writes */
+   uint64_t fetches, fetch_bytes;
+   uint64_t copies, copy_bytes;      /* DG_R_BULK_ACCESS */
+   uint64_t sets, set_bytes;
+   uint64_t *context_accesses;
+   uint64_t *context_writes;
+   uint64_t *range_accesses;
+   uint64_t *range_writes;
+   interval *intervals;
+   lock_event *locks;
+   size_t n_locks, locks_size;
+} counts;
+
+struct stats
+{
+   const dgt_file *file;
+   uint64_t n_contexts;
+   size_t n_ranges;
+   const range *ranges;      /* Sorted by address */
+   uint64_t interval_instrs;
+   size_t n_intervals;
+   counts total;
+};
+
+static void *xcalloc(size_t n, size_t size)
+{
+   void *p = calloc(n > 0 ? n : 1, size);
+
+   if (p == NULL)
+   {
+      fprintf(stderr, "%s: out of memory\n", argv0);
+      exit(1);
+   }
+   return p;
+}
+
+static void usage(void)
+{
+   fprintf(stderr,
+"%s: prints a summary of a Datagrind trace\n"
+"usage: %s [options] trace\n"
+"    --threads=<n>     threads to decode with [one per processor]\n"
+"    --top=<n>         contexts and ranges to list [10]\n"
+"    --intervals=<n>   intervals to show the working set for [20]\n"
+"    --who=<lo>[-<hi>] only list the contexts accessing these addresses\n"
+"                      (also <lo>+<size>), from the address index\n"
+"    --addr-index=<f>  the address index to use [<trace>.addrindex]\n"
+"    --quick           only list the top contexts, from the counts of\n"
+"                      --datagrind-context-counts=yes, without decoding\n",
+           argv0, argv0);
+   exit(2);
+}
+
+static uint64_t hash64(uint64_t x)
+{
+   x += 0x9E3779B97F4A7C15ULL;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+   return x ^ (x >> 31);
+}
+
+static void hll_add(uint8_t *hll, uint64_t value)
+{
+   uint64_t h = hash64(value);
+   uint64_t rest = (h << HLL_BITS) | (1ULL << (HLL_BITS - 1));
+   uint8_t rank = __builtin_clzll(rest) + 1;
+   uint8_t *reg = &hll[h >> (64 - HLL_BITS)];
+
+   if (rank > *reg)
+      *reg = rank;
+}
+
+static double hll_estimate(const uint8_t *hll)
+{
+   double sum = 0.0, m = HLL_SIZE, estimate;
+   int zeros = 0, i;
+
+   for (i = 0; i < HLL_SIZE; i++)
+   {
+      sum += ldexp(1.0, -hll[i]);
+      if (hll[i] == 0)
+         zeros++;
+   }
+   estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+   if (estimate <= 2.5 * m && zeros > 0)
+      estimate = m * log(m / zeros);
+   return estimate;
+}
+
+static const range *find_range(const stats *st, uint64_t addr)
+{
+   size_t lo = 0, hi = st->n_ranges;
+
+   /* Finds the last range starting at or before addr */
+   while (lo < hi)
+   {
+      size_t mid = lo + (hi - lo) / 2;
+      if (st->ranges[mid].addr <= addr)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   if (lo > 0 && addr - st->ranges[lo - 1].addr < st->ranges[lo - 1].len)
+      return &st->ranges[lo - 1];
+   return NULL;
+}
+
+static void counts_init(counts *c, const stats *st)
+{
+   memset(c, 0, sizeof(*c));
+   c->st = st;
+   c->context_accesses = xcalloc(st->n_contexts, sizeof(uint64_t));
+   c->context_writes = xcalloc(st->n_contexts, sizeof(uint64_t));
+   c->range_accesses = xcalloc(st->n_ranges, sizeof(uint64_t));
+   c->range_writes = xcalloc(st->n_ranges, sizeof(uint64_t));
+   c->intervals = xcalloc(st->n_intervals, sizeof(interval));
+}
+
+static void counts_free(counts *c)
+{
+   free(c->context_accesses);
+   free(c->context_writes);
+   free(c->range_accesses);
+   free(c->range_writes);
+   free(c->intervals);
+   free(c->locks);
+}
+
+static void *worker_new(void *arg)
+{
+   counts *c = xcalloc(1, sizeof(counts));
+
+   counts_init(c, arg);
+   return c;
+}
+
+static void add_lock(counts *c, const lock_event *e)
+{
+   if (c->n_locks == c->locks_size)
+   {
+      c->locks_size = c->locks_size > 0 ? 2 * c->locks_size : 64;
+      c->locks = realloc(c->locks, c->locks_size * sizeof(lock_event));
+      if (c->locks == NULL)
+      {
+         fprintf(stderr, "%s: out of memory\n", argv0);
+         exit(1);
+      }
+   }
+   c->locks[c->n_locks++] = *e;
+}
+
+static int worker_item(void *worker, const dgt_decoder *decoder, int kind,
+                       const dgt_record *record, const dgt_run *run)
+{
+   counts *c = worker;
+   const stats *st = c->st;
+   uint64_t start;
+   size_t n;
+   interval *iv;
+   uint32_t i;
+
+   if (kind == DGT_ITEM_RECORD && record->type == DG_R_BULK_ACCESS)
+   {
+      dgt_bulk bulk;
+
+      if (dgt_parse_bulk(st->file, record, &bulk) == DGT_OK)
+      {
+         if (bulk.op == DG_BULK_COPY)
+         {
+            c->copies++;
+            c->copy_bytes += bulk.size;
+         }
+         else
+         {
+            c->sets++;
+            c->set_bytes += bulk.size;
+         }
+      }
+      return 0;
+   }
+   if (kind == DGT_ITEM_RECORD && record->type == DG_R_LOCK)
+   {
+      dgt_lock lock;
+      lock_event e;
+
+      if (dgt_parse_lock(st->file, record, &lock) == DGT_OK)
+      {
+         e.addr = lock.addr;
+         e.offset = record->offset;
+         e.instrs = dgt_decoder_instrs(decoder);
+         e.tid = dgt_decoder_tid(decoder);
+         e.action = lock.action;
+         e.kind = lock.kind;
+         add_lock(c, &e);
+      }
+      return 0;
+   }
+   if (kind != DGT_ITEM_RUN)
+      return 0;
+   start = dgt_decoder_instrs(decoder) - run->n_instrs;
+   n = start / st->interval_instrs;
+   iv = &c->intervals[n < st->n_intervals ? n : st->n_intervals - 1];
+   for (i = 0; i < run->n_accesses; i++)
+   {
+      const dgt_access *a = &run->accesses[i];
+      const range *r;
+      int write = DG_ACC_IS_WRITE(a->dir);
+
+      /* The rest only describes data */
+      if (a->dir == DG_ACC_EXEC)
+      {
+         c->fetches++;
+         c->fetch_bytes += a->size;
+         continue;
+      }
+      r = find_range(st, a->addr);
+      if (write)
+      {
+         c->writes++;
+         c->write_bytes += a->size;
+         c->context_writes[run->context_index]++;
+         if (a->dir == DG_ACC_ATOMIC)
+         {
+            c->atomics++;
+            c->atomic_bytes += a->size;
+         }
+      }
+      else
+      {
+         c->reads++;
+         c->read_bytes += a->size;
+      }
+      c->context_accesses[run->context_index]++;
+      if (r != NULL)
+      {
+         c->range_accesses[r - st->ranges]++;
+         c->range_writes[r - st->ranges] += write;
+      }
+      iv->accesses++;
+      iv->writes += write;
+      hll_add(iv->hll, a->addr >> LINE_SHIFT);
+   }
+   return 0;
+}
+
+static void worker_merge(void *arg, void *worker)
+{
+   stats *st = arg;
+   counts *c = worker;
+   uint64_t i;
+   size_t j;
+   int k;
+
+   st->total.reads += c->reads;
+   st->total.writes += c->writes;
+   st->total.read_bytes += c->read_bytes;
+   st->total.write_bytes += c->write_bytes;
+   st->total.atomics += c->atomics;
+   st->total.atomic_bytes += c->atomic_bytes;
+   st->total.fetches += c->fetches;
+   st->total.fetch_bytes += c->fetch_bytes;
+   st->total.copies += c->copies;
+   st->total.copy_bytes += c->copy_bytes;
+   st->total.sets += c->sets;
+   st->total.set_bytes += c->set_bytes;
+   for (j = 0; j < c->n_locks; j++)
+      add_lock(&st->total, &c->locks[j]);
+   for (i = 0; i < st->n_contexts; i++)
+   {
+      st->total.context_accesses[i] += c->context_accesses[i];
+      st->total.context_writes[i] += c->context_writes[i];
+   }
+   for (j = 0; j < st->n_ranges; j++)
+   {
+      st->total.range_accesses[j] += c->range_accesses[j];
+      st->total.range_writes[j] += c->range_writes[j];
+   }
+   for (j = 0; j < st->n_intervals; j++)
+   {
+      interval *to = &st->total.intervals[j];
+      const interval *from = &c->intervals[j];
+
+      to->accesses += from->accesses;
+      to->writes += from->writes;
+      for (k = 0; k < HLL_SIZE; k++)
+         if (from->hll[k] > to->hll[k])
+            to->hll[k] = from->hll[k];
+   }
+   counts_free(c);
+   free(c);
+}
+
+static int cmp_range(const void *a, const void *b)
+{
+   const range *ra = a;
+   const range *rb = b;
+
+   if (ra->addr != rb->addr)
+      return ra->addr < rb->addr ? -1 : 1;
+   return ra->number < rb->number ? -1 : ra->number > rb->number;
+}
+
+/* A range that is tracked again with the same name, as when a buffer is
+ * reused, is counted as one.
+ */
+static size_t merge_ranges(range *ranges, size_t n)
+{
+   size_t i, out = 0;
+
+   for (i = 0; i < n; i++)
+   {
+      range *prev = out > 0 ? &ranges[out - 1] : NULL;
+
+      if (prev != NULL && prev->addr == ranges[i].addr && prev->len == ranges[i].len
+          && strcmp(prev->type, ranges[i].type) == 0
+          && strcmp(prev->label, ranges[i].label) == 0)
+         prev->times++;
+      else
+         ranges[out++] = ranges[i];
+   }
+   return out;
+}
+
+/* Sorts indices by descending count */
+static const uint64_t *sort_counts;
+
+static int cmp_index(const void *a, const void *b)
+{
+   uint64_t ca = sort_counts[*(const uint64_t *) a];
+   uint64_t cb = sort_counts[*(const uint64_t *) b];
+
+   if (ca != cb)
+      return ca > cb ? -1 : 1;
+   return *(const uint64_t *) a < *(const uint64_t *) b ? -1 : 1;
+}
+
+static uint64_t *top(const uint64_t *c, uint64_t n, uint64_t *n_top)
+{
+   uint64_t *order = xcalloc(n, sizeof(uint64_t));
+   uint64_t i;
+
+   for (i = 0; i < n; i++)
+      order[i] = i;
+   sort_counts = c;
+   qsort(order, n, sizeof(uint64_t), cmp_index);
+   while (*n_top > 0 && (*n_top > n || c[order[*n_top - 1]] == 0))
+      (*n_top)--;
+   return order;
+}
+
+static double percent(uint64_t part, uint64_t whole)
+{
+   return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+/* Counts the records and instructions and gathers the tracked ranges */
+static void walk(const dgt_file *file, uint64_t *n_records, uint64_t *record_bytes,
+                 uint64_t *instrs, range **ranges, size_t *n_ranges)
+{
+   const uint8_t *stream = dgt_file_stream(file);
+   size_t ws = dgt_file_header(file)->word_size;
+   size_t ranges_size = 0;
+   uint64_t last_instrs = 0, n_tracked = 0;
+   dgt_cursor cursor;
+   dgt_record record;
+   int ret;
+
+   *instrs = 0;
+   *ranges = NULL;
+   *n_ranges = 0;
+   dgt_cursor_init(&cursor, file);
+   n_records[DG_R_HEADER]++;
+   record_bytes[DG_R_HEADER] += cursor.pos;
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      uint64_t value;
+
+      n_records[record.type]++;
+      record_bytes[record.type] += end - (stream + record.offset);
+      switch (record.type)
+      {
+      case DG_R_CHUNK:
+         if ((p = dgt_get_uvarint(p, end, &value)) != NULL
+             && dgt_get_uvarint(p, end, &value) != NULL)
+            *instrs = value;
+         break;
+      case DG_R_BBRUN:
+      case DG_R_BBRUN_FILTERED:
+      case DG_R_BBRUN_STRIDED:
+      case DG_R_BBRUN_LINES:
+         if ((p = dgt_get_uvarint(p, end, &value)) != NULL
+             && dgt_get_uvarint(p, end, &value) != NULL)
+         {
+            last_instrs = value;
+            *instrs += last_instrs;
+         }
+         break;
+      case DG_R_BBREPEAT:
+         *instrs += p[0] * last_instrs;
+         break;
+      case DG_R_TRACK_RANGE:
+         if (record.length > 2 * ws && end[-1] == '\0')
+         {
+            range *r;
+            const char *label = memchr(p + 2 * ws, '\0', end - (p + 2 * ws));
+
+            if (*n_ranges == ranges_size)
+            {
+               ranges_size = ranges_size > 0 ? 2 * ranges_size : 64;
+               *ranges = realloc(*ranges, ranges_size * sizeof(range));
+               if (*ranges == NULL)
+               {
+                  fprintf(stderr, "%s: out of memory\n", argv0);
+                  exit(1);
+               }
+            }
+            r = &(*ranges)[(*n_ranges)++];
+            r->addr = dgt_get_word(file, p);
+            r->len = dgt_get_word(file, p + ws);
+            r->type = (const char *) p + 2 * ws;
+            r->label = label + 1 < (const char *) end ? label + 1 : "";
+            r->number = n_tracked;
+            r->times = 1;
+         }
+         n_tracked++;
+         break;
+      default:
+         break;
+      }
+   }
+   if (ret < 0)
+      fprintf(stderr, "%s: warning: %s; only the records before offset %llu are counted\n",
+              argv0, dgt_strerror(ret), (unsigned long long) cursor.pos);
+}
+
+static void print_flags(uint64_t flags)
+{
+   static const char *const names[] =
+   {
+      "chunked", "sampled", "summary", "partial", "merged", "strided", "lines",
+      "instrs", "events"
+   };
+   const char *sep = "";
+   int i;
+
+   printf("Flags:        ");
+   for (i = 0; i < 64; i++)
+      if (flags & ((uint64_t) 1 << i))
+      {
+         if (i < (int) (sizeof(names) / sizeof(names[0])))
+            printf("%s %s", sep, names[i]);
+         else
+            printf("%s bit %d", sep, i);
+         sep = ",";
+      }
+   printf("%s\n", flags == 0 ? " none" : "");
+}
+
+static void print_records(const uint64_t *n_records, const uint64_t *record_bytes,
+                          uint64_t total_bytes)
+{
+   int i;
+
+   printf("\n%-16s %14s %16s %7s\n", "Record", "Count", "Bytes", "Bytes%");
+   for (i = 0; i < 256; i++)
+   {
+      char name[16];
+
+      if (n_records[i] == 0)
+         continue;
+      if (i < (int) (sizeof(record_names) / sizeof(record_names[0])))
+         snprintf(name, sizeof(name), "%s", record_names[i]);
+      else if (i == DG_R_BBREPEAT)
+         snprintf(name, sizeof(name), "BBREPEAT");
+      else
+         snprintf(name, sizeof(name), "type %d", i);
+      printf("%-16s %14llu %16llu %6.2f%%\n", name, (unsigned long long) n_records[i],
+             (unsigned long long) record_bytes[i], percent(record_bytes[i], total_bytes));
+   }
+}
+
+static void print_contexts(const stats *st, const dgt_decoder *decoder, uint64_t n_top)
+{
+   const dgt_file *file = st->file;
+   uint64_t *order = top(st->total.context_accesses, st->n_contexts, &n_top);
+   uint64_t total = st->total.reads + st->total.writes;
+   uint64_t i;
+   uint32_t j;
+
+   printf("\nTop contexts by accesses\n");
+   printf("%10s %14s %7s %7s  %s\n", "Context", "Accesses", "Acc%", "Write%", "Stack");
+   for (i = 0; i < n_top; i++)
+   {
+      uint64_t index = order[i];
+      const dgt_context *context = dgt_decoder_context(decoder, index);
+
+      printf("%10llu %14llu %6.2f%% %6.2f%% ", (unsigned long long) index,
+             (unsigned long long) st->total.context_accesses[index],
+             percent(st->total.context_accesses[index], total),
+             percent(st->total.context_writes[index], st->total.context_accesses[index]));
+      for (j = 0; j < context->n_stack && j < 5; j++)
+         printf("%s0x%llx", j > 0 ? " < " : " ",
+                (unsigned long long) dgt_context_ip(file, context, j));
+      if (context->n_stack > 5)
+         printf(" < ...");
+      printf("\n");
+   }
+   free(order);
+}
+
+static void print_ranges(const stats *st, uint64_t n_top)
+{
+   uint64_t *order;
+   uint64_t total = st->total.reads + st->total.writes;
+   uint64_t i;
+
+   if (st->n_ranges == 0)
+      return;
+   order = top(st->total.range_accesses, st->n_ranges, &n_top);
+   printf("\nTop tracked ranges by accesses\n");
+   printf("%8s %6s %18s %12s %14s %7s %7s  %s\n", "Range", "Times", "Address", "Length",
+          "Accesses", "Acc%", "Write%", "Type and label");
+   for (i = 0; i < n_top; i++)
+   {
+      const range *r = &st->ranges[order[i]];
+
+      printf("%8llu %6llu %#18llx %12llu %14llu %6.2f%% %6.2f%%  %s %s\n",
+             (unsigned long long) r->number, (unsigned long long) r->times,
+             (unsigned long long) r->addr,
+             (unsigned long long) r->len,
+             (unsigned long long) st->total.range_accesses[order[i]],
+             percent(st->total.range_accesses[order[i]], total),
+             percent(st->total.range_writes[order[i]], st->total.range_accesses[order[i]]),
+             r->type, r->label);
+   }
+   free(order);
+}
+
+/* Lists the contexts that first wrote pages mostly accessed by another
+ * thread, from the DG_R_FIRST_TOUCH records.
+ */
+static void print_first_touch(const stats *st, const dgt_decoder *decoder, uint64_t n_top)
+{
+   const dgt_file *file = st->file;
+   uint64_t *pages = xcalloc(st->n_contexts, sizeof(uint64_t));
+   uint64_t *mismatched = xcalloc(st->n_contexts, sizeof(uint64_t));
+   uint64_t *owner_accesses = xcalloc(st->n_contexts, sizeof(uint64_t));
+   uint64_t *accesses = xcalloc(st->n_contexts, sizeof(uint64_t));
+   uint64_t n_pages = 0, n_mismatched = 0, *order, i;
+   dgt_cursor cursor;
+   dgt_record record;
+   uint32_t j;
+
+   dgt_cursor_init(&cursor, file);
+   while (dgt_cursor_next(&cursor, &record) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      uint64_t n = 0;
+
+      if (record.type != DG_R_FIRST_TOUCH)
+         continue;
+      p = dgt_get_uvarint(p, end, &n);
+      for (i = 0; i < n && p != NULL; i++)
+      {
+         uint64_t f[8];
+
+         for (j = 0; j < 8 && p != NULL; j++)
+            p = dgt_get_uvarint(p, end, &f[j]);
+         /* page delta, first tid, context, instrs, owner, owner accesses,
+          * first writer's accesses, accesses
+          */
+         if (p == NULL || f[2] >= st->n_contexts)
+            break;
+         n_pages++;
+         pages[f[2]]++;
+         if (f[4] != f[1])
+         {
+            n_mismatched++;
+            mismatched[f[2]]++;
+            owner_accesses[f[2]] += f[5];
+            accesses[f[2]] += f[7];
+         }
+      }
+   }
+   if (n_pages > 0)
+   {
+      printf("\nFirst-touch pages: %llu first written, %llu (%.2f%%) mostly accessed by another thread\n",
+             (unsigned long long) n_pages, (unsigned long long) n_mismatched,
+             percent(n_mismatched, n_pages));
+      order = top(mismatched, st->n_contexts, &n_top);
+      if (n_top > 0)
+      {
+         printf("%10s %10s %10s %7s  %s\n", "Context", "Pages", "Elsewhere", "Owner%", "Stack");
+         for (i = 0; i < n_top; i++)
+         {
+            uint64_t index = order[i];
+            const dgt_context *context = dgt_decoder_context(decoder, index);
+
+            printf("%10llu %10llu %10llu %6.2f%% ", (unsigned long long) index,
+                   (unsigned long long) pages[index], (unsigned long long) mismatched[index],
+                   percent(owner_accesses[index], accesses[index]));
+            for (j = 0; j < context->n_stack && j < 5; j++)
+               printf("%s0x%llx", j > 0 ? " < " : " ",
+                      (unsigned long long) dgt_context_ip(file, context, j));
+            if (context->n_stack > 5)
+               printf(" < ...");
+            printf("\n");
+         }
+      }
+      free(order);
+   }
+   free(pages);
+   free(mismatched);
+   free(owner_accesses);
+   free(accesses);
+}
+
+static int cmp_lock_event(const void *a, const void *b)
+{
+   const lock_event *x = a, *y = b;
+
+   if (x->addr != y->addr)
+      return x->addr < y->addr ? -1 : 1;
+   return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+/* Lists the locks held for the most instructions, from the DG_R_LOCK
+ * records. A hold runs from when a thread first takes the lock to when
+ * it gives up its last hold on it, so a recursive mutex or a shared
+ * rwlock held by several threads is held as long as any thread holds
+ * it. A handoff is a hold taken by another thread than the last one.
+ * Holds still open at the end are left out.
+ */
+static void print_locks(stats *st, uint64_t instrs, uint64_t n_top)
+{
+   lock_event *e = st->total.locks;
+   size_t n = st->total.n_locks, n_locks = 0, i, j, k;
+   uint64_t *addrs, *held, *max, *acquires, *handoffs, *order;
+   uint8_t *kind;
+   struct { uint32_t tid, depth; } *holders;
+   size_t n_holders;
+
+   qsort(e, n, sizeof(lock_event), cmp_lock_event);
+   for (i = 0; i < n; i++)
+      n_locks += i == 0 || e[i].addr != e[i - 1].addr;
+   addrs = xcalloc(n_locks, sizeof(uint64_t));
+   held = xcalloc(n_locks, sizeof(uint64_t));
+   max = xcalloc(n_locks, sizeof(uint64_t));
+   acquires = xcalloc(n_locks, sizeof(uint64_t));
+   handoffs = xcalloc(n_locks, sizeof(uint64_t));
+   kind = xcalloc(n_locks, 1);
+   holders = xcalloc(n, sizeof(*holders));
+
+   k = 0;
+   for (i = 0; i < n; i = j)
+   {
+      uint64_t since = 0;
+      uint32_t last_tid = 0;
+      size_t depth = 0;
+
+      n_holders = 0;
+      addrs[k] = e[i].addr;
+      kind[k] = e[i].kind;
+      for (j = i; j < n && e[j].addr == e[i].addr; j++)
+      {
+         size_t h;
+
+         for (h = 0; h < n_holders && holders[h].tid != e[j].tid; h++)
+            ;
+         if (e[j].action != DG_LOCK_RELEASE)
+         {
+            if (h == n_holders)
+            {
+               holders[n_holders].tid = e[j].tid;
+               holders[n_holders++].depth = 0;
+            }
+            if (holders[h].depth++ == 0)
+            {
+               acquires[k]++;
+               handoffs[k] += acquires[k] > 1 && e[j].tid != last_tid;
+               last_tid = e[j].tid;
+               if (depth++ == 0)
+                  since = e[j].instrs;
+            }
+         }
+         else if (h < n_holders && --holders[h].depth == 0)
+         {
+            holders[h] = holders[--n_holders];
+            if (--depth == 0)
+            {
+               held[k] += e[j].instrs - since;
+               if (e[j].instrs - since > max[k])
+                  max[k] = e[j].instrs - since;
+            }
+         }
+      }
+      k++;
+   }
+
+   if (n_locks > 0)
+   {
+      uint64_t total_acquires = 0;
+
+      for (k = 0; k < n_locks; k++)
+         total_acquires += acquires[k];
+      printf("\nLocks: %llu, taken %llu times\n", (unsigned long long) n_locks,
+             (unsigned long long) total_acquires);
+      order = top(held, n_locks, &n_top);
+      if (n_top > 0)
+      {
+         printf("%18s %6s %10s %10s %14s %7s %12s\n", "Lock", "Kind", "Acquires",
+                "Handoffs", "Held", "Held%", "Max");
+         for (i = 0; i < n_top; i++)
+         {
+            k = order[i];
+            printf("%#18llx %6s %10llu %10llu %14llu %6.2f%% %12llu\n",
+                   (unsigned long long) addrs[k],
+                   kind[k] == DG_LOCK_MUTEX ? "mutex"
+                   : kind[k] == DG_LOCK_RWLOCK ? "rwlock" : "spin",
+                   (unsigned long long) acquires[k], (unsigned long long) handoffs[k],
+                   (unsigned long long) held[k], percent(held[k], instrs),
+                   (unsigned long long) max[k]);
+         }
+      }
+      free(order);
+   }
+   free(addrs);
+   free(held);
+   free(max);
+   free(acquires);
+   free(handoffs);
+   free(kind);
+   free(holders);
+}
+
+/* Lists the instructions with the most accesses, from the
+ * DG_R_ACCESS_COUNTS of --datagrind-mode=count.
+ */
+static void print_access_counts(const stats *st, uint64_t n_top)
+{
+   const dgt_file *file = st->file;
+   uint64_t *addrs = NULL, *execs = NULL, *reads = NULL, *writes = NULL, *accesses = NULL;
+   uint64_t n = 0, size = 0, total_execs = 0, total_reads = 0, total_writes = 0;
+   uint64_t *order, i;
+   dgt_cursor cursor;
+   dgt_record record;
+
+   dgt_cursor_init(&cursor, file);
+   while (dgt_cursor_next(&cursor, &record) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      uint64_t n_instrs = 0, addr = 0, j;
+
+      if (record.type != DG_R_ACCESS_COUNTS)
+         continue;
+      p = dgt_get_uvarint(p, end, &n_instrs);
+      for (j = 0; j < n_instrs && p != NULL; j++)
+      {
+         uint64_t delta, count, n_slots, slot_size, k;
+
+         if ((p = dgt_get_uvarint(p, end, &delta)) == NULL
+             || (p = dgt_get_uvarint(p, end, &count)) == NULL
+             || (p = dgt_get_uvarint(p, end, &n_slots)) == NULL)
+            break;
+         if (n == size)
+         {
+            size = size > 0 ? 2 * size : 1024;
+            addrs = realloc(addrs, size * sizeof(uint64_t));
+            execs = realloc(execs, size * sizeof(uint64_t));
+            reads = realloc(reads, size * sizeof(uint64_t));
+            writes = realloc(writes, size * sizeof(uint64_t));
+            accesses = realloc(accesses, size * sizeof(uint64_t));
+            if (!addrs || !execs || !reads || !writes || !accesses)
+            {
+               fprintf(stderr, "%s: out of memory\n", argv0);
+               exit(1);
+            }
+         }
+         addr += delta;
+         addrs[n] = addr;
+         execs[n] = count;
+         reads[n] = writes[n] = 0;
+         for (k = 0; k < n_slots && p != NULL; k++)
+         {
+            uint8_t dir;
+
+            if (p >= end)
+            {
+               p = NULL;
+               break;
+            }
+            dir = *p++;
+            if ((p = dgt_get_uvarint(p, end, &slot_size)) == NULL
+                || (p = dgt_get_uvarint(p, end, &count)) == NULL)
+               break;
+            if (DG_ACC_IS_WRITE(dir))
+               writes[n] += count;
+            else if (dir == DG_ACC_READ)
+               reads[n] += count;
+         }
+         if (p == NULL)
+            break;
+         accesses[n] = reads[n] + writes[n];
+         total_execs += execs[n];
+         total_reads += reads[n];
+         total_writes += writes[n];
+         n++;
+      }
+   }
+
+   printf("\nInstruction counts: %llu instructions executed %llu times, %llu reads, %llu writes\n",
+          (unsigned long long) n, (unsigned long long) total_execs,
+          (unsigned long long) total_reads, (unsigned long long) total_writes);
+   order = top(accesses, n, &n_top);
+   if (n_top > 0)
+   {
+      printf("%18s %14s %14s %14s %7s\n", "Instruction", "Executions", "Reads", "Writes",
+             "Acc%");
+      for (i = 0; i < n_top; i++)
+      {
+         uint64_t k = order[i];
+
+         printf("%#18llx %14llu %14llu %14llu %6.2f%%\n", (unsigned long long) addrs[k],
+                (unsigned long long) execs[k], (unsigned long long) reads[k],
+                (unsigned long long) writes[k],
+                percent(accesses[k], total_reads + total_writes));
+      }
+   }
+   free(order);
+   free(addrs);
+   free(execs);
+   free(reads);
+   free(writes);
+   free(accesses);
+}
+
+/* Reads a node of a DG_R_AFFINITY into a name */
+static const uint8_t *get_affinity_node(const uint8_t *p, const uint8_t *end, char *name,
+                                        size_t size)
+{
+   uint64_t id, offset;
+   uint8_t kind;
+
+   if (p == NULL || p >= end)
+      return NULL;
+   kind = *p++;
+   if ((p = dgt_get_uvarint(p, end, &id)) == NULL)
+      return NULL;
+   if (kind == DG_AFFINITY_FIELD)
+   {
+      if ((p = dgt_get_uvarint(p, end, &offset)) == NULL)
+         return NULL;
+      snprintf(name, size, "range %llu+%#llx", (unsigned long long) id,
+               (unsigned long long) offset);
+   }
+   else
+      snprintf(name, size, "site %llu", (unsigned long long) id);
+   return p;
+}
+
+/* Lists the heaviest edges of the DG_R_AFFINITY of --datagrind-affinity,
+ * which come sorted.
+ */
+static void print_affinity(const stats *st, uint64_t n_top)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+
+   dgt_cursor_init(&cursor, st->file);
+   while (dgt_cursor_next(&cursor, &record) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      uint64_t window, stride, n_accesses, n_pairs, i;
+
+      if (record.type != DG_R_AFFINITY)
+         continue;
+      if ((p = dgt_get_uvarint(p, end, &window)) == NULL
+          || (p = dgt_get_uvarint(p, end, &stride)) == NULL
+          || (p = dgt_get_uvarint(p, end, &n_accesses)) == NULL
+          || (p = dgt_get_uvarint(p, end, &n_pairs)) == NULL)
+         return;
+      printf("\nAffinity: %llu pairs over %llu accesses, window %llu\n",
+             (unsigned long long) n_pairs, (unsigned long long) n_accesses,
+             (unsigned long long) window);
+      if (n_pairs > 0 && n_top > 0)
+         printf("%-24s %-24s %14s %14s\n", "Object", "Object", "Weight", "Error");
+      for (i = 0; i < n_pairs && i < n_top; i++)
+      {
+         char a[64], b[64];
+         uint64_t count, error;
+
+         if ((p = get_affinity_node(p, end, a, sizeof(a))) == NULL
+             || (p = get_affinity_node(p, end, b, sizeof(b))) == NULL
+             || (p = dgt_get_uvarint(p, end, &count)) == NULL
+             || (p = dgt_get_uvarint(p, end, &error)) == NULL)
+            return;
+         printf("%-24s %-24s %14llu %14llu\n", a, b, (unsigned long long) count,
+                (unsigned long long) error);
+      }
+      return;
+   }
+}
+
+static void print_intervals(const stats *st)
+{
+   size_t i;
+
+   printf("\nWorking set per interval of %llu instructions (%d-byte lines, estimated)\n",
+          (unsigned long long) st->interval_instrs, 1 << LINE_SHIFT);
+   printf("%16s %14s %7s %12s %12s\n", "From instr", "Accesses", "Write%", "Lines", "KiB");
+   for (i = 0; i < st->n_intervals; i++)
+   {
+      const interval *iv = &st->total.intervals[i];
+      double lines = iv->accesses > 0 ? hll_estimate(iv->hll) : 0.0;
+
+      printf("%16llu %14llu %6.2f%% %12.0f %12.0f\n",
+             (unsigned long long) (i * st->interval_instrs),
+             (unsigned long long) iv->accesses, percent(iv->writes, iv->accesses),
+             lines, lines * (1 << LINE_SHIFT) / 1024.0);
+   }
+}
+
+typedef struct
+{
+   uint64_t context;
+   uint64_t first, last;     /* Chunks */
+   uint64_t n_chunks;
+} who_entry;
+
+static int cmp_who(const void *a, const void *b)
+{
+   const who_entry *wa = a, *wb = b;
+
+   if (wa->first != wb->first)
+      return wa->first < wb->first ? -1 : 1;
+   if (wa->context != wb->context)
+      return wa->context < wb->context ? -1 : 1;
+   return 0;
+}
+
+static int cmp_posting_context(const void *a, const void *b)
+{
+   const dgt_posting *pa = a, *pb = b;
+
+   if (pa->context != pb->context)
+      return pa->context < pb->context ? -1 : 1;
+   if (pa->chunk != pb->chunk)
+      return pa->chunk < pb->chunk ? -1 : 1;
+   return 0;
+}
+
+/* Parses <lo>, <lo>-<hi> or <lo>+<size>, in any base strtoull takes */
+static int parse_addrs(const char *s, uint64_t *lo, uint64_t *hi)
+{
+   char *end;
+
+   *lo = strtoull(s, &end, 0);
+   if (*end == '\0')
+      *hi = *lo + 1;
+   else if (*end == '-')
+      *hi = strtoull(end + 1, &end, 0);
+   else if (*end == '+')
+      *hi = *lo + strtoull(end + 1, &end, 0);
+   else
+      return 0;
+   return *end == '\0' && *hi > *lo;
+}
+
+/* Lists the contexts that accessed the pages of lo to hi, in the order of
+ * the chunk in which each first did, with the instructions from the start
+ * of that chunk to the end of the last one it did so in.
+ */
+static int print_who(const char *trace_name, const char *index_name, const dgt_file *file,
+                     uint64_t lo, uint64_t hi)
+{
+   dgt_addr_index *index;
+   dgt_posting *postings;
+   who_entry *who;
+   size_t n, n_who = 0, n_chunks = dgt_file_n_chunks(file), i;
+   int ret;
+
+   ret = dgt_addr_index_open(index_name, file, &index);
+   if (ret == DGT_ERR_INVALID)
+   {
+      fprintf(stderr, "%s: %s was not built for %s as it is now; run dg_addrindex again\n",
+              argv0, index_name, trace_name);
+      return 1;
+   }
+   if (ret == DGT_OK)
+      ret = dgt_addr_index_query(index, lo, hi, &postings, &n);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, index_name, dgt_strerror(ret));
+      dgt_addr_index_close(index);
+      return 1;
+   }
+
+   qsort(postings, n, sizeof(dgt_posting), cmp_posting_context);
+   who = xcalloc(n, sizeof(who_entry));
+   for (i = 0; i < n; i++)
+   {
+      if (n_who == 0 || who[n_who - 1].context != postings[i].context)
+      {
+         who[n_who].context = postings[i].context;
+         who[n_who].first = postings[i].chunk;
+         n_who++;
+      }
+      who[n_who - 1].last = postings[i].chunk;
+      who[n_who - 1].n_chunks++;
+   }
+   qsort(who, n_who, sizeof(who_entry), cmp_who);
+
+   printf("Accesses to 0x%llx-0x%llx, by %d-byte pages, from %s\n",
+          (unsigned long long) lo, (unsigned long long) hi,
+          1 << dgt_addr_index_page_shift(index), index_name);
+   printf("%10s %8s %16s %16s  %s\n", "Context", "Chunks", "From instr", "To instr", "Stack");
+   for (i = 0; i < n_who && ret == DGT_OK; i++)
+   {
+      dgt_context context;
+      uint32_t j;
+
+      ret = dgt_addr_index_context(index, who[i].context, &context);
+      if (ret != DGT_OK)
+         break;
+      printf("%10llu %8llu ", (unsigned long long) who[i].context,
+             (unsigned long long) who[i].n_chunks);
+      if (n_chunks > 0)
+         printf("%16llu ", (unsigned long long) dgt_file_chunk(file, who[i].first)->instrs);
+      else
+         printf("%16s ", "-");
+      if (who[i].last + 1 < n_chunks)
+         printf("%16llu ", (unsigned long long) dgt_file_chunk(file, who[i].last + 1)->instrs);
+      else
+         printf("%16s ", "end");
+      for (j = 0; j < context.n_stack && j < 5; j++)
+         printf("%s0x%llx", j > 0 ? " < " : " ",
+                (unsigned long long) dgt_context_ip(file, &context, j));
+      if (context.n_stack > 5)
+         printf(" < ...");
+      printf("\n");
+   }
+   if (ret != DGT_OK)
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+   else if (n_who == 0)
+      printf("No accesses\n");
+   free(who);
+   free(postings);
+   dgt_addr_index_close(index);
+   return ret != DGT_OK;
+}
+
+/* Lists the contexts with the most accesses from the DG_R_CONTEXT_COUNTS
+ * records, which is much quicker than decoding the runs. Returns 0 if the
+ * trace has none.
+ */
+static int print_context_counts(const dgt_file *file, const dgt_decoder *decoder,
+                                uint64_t n_contexts, uint64_t n_top)
+{
+   uint64_t *runs = xcalloc(n_contexts, sizeof(uint64_t));
+   uint64_t *accesses = xcalloc(n_contexts, sizeof(uint64_t));
+   uint64_t total_runs = 0, total = 0, *order, i;
+   int found = 0;
+   dgt_cursor cursor;
+   dgt_record record;
+   uint32_t j;
+
+   dgt_cursor_init(&cursor, file);
+   while (dgt_cursor_next(&cursor, &record) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      uint64_t n = 0, next = 0;
+
+      if (record.type != DG_R_CONTEXT_COUNTS)
+         continue;
+      found = 1;
+      p = dgt_get_uvarint(p, end, &n);
+      for (i = 0; i < n && p != NULL; i++)
+      {
+         uint64_t delta, r, a;
+
+         if ((p = dgt_get_uvarint(p, end, &delta)) == NULL
+             || (p = dgt_get_uvarint(p, end, &r)) == NULL
+             || (p = dgt_get_uvarint(p, end, &a)) == NULL)
+            break;
+         next += delta;
+         if (next < n_contexts)
+         {
+            runs[next] += r;
+            accesses[next] += a;
+            total_runs += r;
+            total += a;
+         }
+         next++;
+      }
+   }
+
+   if (found)
+   {
+      order = top(accesses, n_contexts, &n_top);
+      printf("Runs:          %llu\n", (unsigned long long) total_runs);
+      printf("Accesses:      %llu\n", (unsigned long long) total);
+      printf("\nTop contexts by accesses\n");
+      printf("%10s %14s %7s %14s  %s\n", "Context", "Accesses", "Acc%", "Runs", "Stack");
+      for (i = 0; i < n_top; i++)
+      {
+         uint64_t index = order[i];
+         const dgt_context *context = dgt_decoder_context(decoder, index);
+
+         printf("%10llu %14llu %6.2f%% %14llu ", (unsigned long long) index,
+                (unsigned long long) accesses[index], percent(accesses[index], total),
+                (unsigned long long) runs[index]);
+         for (j = 0; j < context->n_stack && j < 5; j++)
+            printf("%s0x%llx", j > 0 ? " < " : " ",
+                   (unsigned long long) dgt_context_ip(file, context, j));
+         if (context->n_stack > 5)
+            printf(" < ...");
+         printf("\n");
+      }
+      free(order);
+   }
+   free(runs);
+   free(accesses);
+   return found;
+}
+
+int main(int argc, char **argv)
+{
+   const char *trace_name = NULL, *index_name = NULL;
+   char *default_index = NULL;
+   unsigned int n_threads = 0;
+   uint64_t who_lo = 0, who_hi = 0;
+   uint64_t n_top = 10, n_intervals = 20, instrs;
+   int quick = 0;
+   uint64_t n_records[256], record_bytes[256];
+   uint64_t total;
+   range *ranges;
+   stats st;
+   dgt_file *file;
+   dgt_defs *defs;
+   dgt_decoder *decoder;
+   dgt_parallel_ops ops;
+   const dgt_header *header;
+   int i, ret;
+
+   if (argv[0])
+      argv0 = argv[0];
+   for (i = 1; i < argc; i++)
+   {
+      if (strncmp(argv[i], "--threads=", 10) == 0)
+         n_threads = strtoul(argv[i] + 10, NULL, 10);
+      else if (strncmp(argv[i], "--top=", 6) == 0)
+         n_top = strtoull(argv[i] + 6, NULL, 10);
+      else if (strncmp(argv[i], "--intervals=", 12) == 0)
+      {
+         n_intervals = strtoull(argv[i] + 12, NULL, 10);
+         if (n_intervals == 0)
+            usage();
+      }
+      else if (strncmp(argv[i], "--who=", 6) == 0)
+      {
+         if (!parse_addrs(argv[i] + 6, &who_lo, &who_hi))
+            usage();
+      }
+      else if (strncmp(argv[i], "--addr-index=", 13) == 0)
+         index_name = argv[i] + 13;
+      else if (strcmp(argv[i], "--quick") == 0)
+         quick = 1;
+      else if (argv[i][0] == '-' || trace_name != NULL)
+         usage();
+      else
+         trace_name = argv[i];
+   }
+   if (trace_name == NULL)
+      usage();
+
+   ret = dgt_open(trace_name, &file);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+      return 1;
+   }
+   if (who_hi > who_lo)
+   {
+      if (index_name == NULL)
+      {
+         default_index = xcalloc(strlen(trace_name) + sizeof(".addrindex"), 1);
+         sprintf(default_index, "%s.addrindex", trace_name);
+         index_name = default_index;
+      }
+      ret = print_who(trace_name, index_name, file, who_lo, who_hi);
+      free(default_index);
+      dgt_close(file);
+      return ret;
+   }
+   header = dgt_file_header(file);
+
+   if (quick)
+   {
+      ret = dgt_defs_new(file, n_threads, &defs);
+      if (ret == DGT_OK)
+         ret = dgt_decoder_new_shared(file, defs, &decoder);
+      if (ret != DGT_OK)
+      {
+         fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+         return 1;
+      }
+      printf("Trace:         %s\n", trace_name);
+      ret = print_context_counts(file, decoder, dgt_defs_n_contexts(defs), n_top);
+      if (!ret)
+         fprintf(stderr, "%s: %s: no context counts; trace with"
+                 " --datagrind-context-counts=yes\n", argv0, trace_name);
+      dgt_decoder_free(decoder);
+      dgt_defs_free(defs);
+      dgt_close(file);
+      return !ret;
+   }
+
+   memset(n_records, 0, sizeof(n_records));
+   memset(record_bytes, 0, sizeof(record_bytes));
+   memset(&st, 0, sizeof(st));
+   walk(file, n_records, record_bytes, &instrs, &ranges, &st.n_ranges);
+   qsort(ranges, st.n_ranges, sizeof(range), cmp_range);
+   st.n_ranges = merge_ranges(ranges, st.n_ranges);
+   st.file = file;
+   st.ranges = ranges;
+   st.n_intervals = n_intervals;
+   st.interval_instrs = instrs / n_intervals + (instrs % n_intervals != 0);
+   if (st.interval_instrs == 0)
+      st.interval_instrs = 1;
+
+   ret = dgt_defs_new(file, n_threads, &defs);
+   if (ret == DGT_OK)
+      ret = dgt_decoder_new_shared(file, defs, &decoder);
+   if (ret != DGT_OK)
+   {
+      fprintf(stderr, "%s: %s: %s\n", argv0, trace_name, dgt_strerror(ret));
+      return 1;
+   }
+   st.n_contexts = dgt_defs_n_contexts(defs);
+   counts_init(&st.total, &st);
+   ops.arg = &st;
+   ops.worker_new = worker_new;
+   ops.item = worker_item;
+   ops.merge = worker_merge;
+   ret = dgt_decode_parallel(file, defs, n_threads, &ops);
+   if (ret != DGT_OK)
+      fprintf(stderr, "%s: %s: %s; the counts are incomplete\n",
+              argv0, trace_name, dgt_strerror(ret));
+
+   printf("Trace:         %s\n", trace_name);
+   printf("Format:        version %d, %d-bit, %s-endian, %s\n", header->version,
+          header->word_size * 8, header->big_endian ? "big" : "little",
+          header->compression == DG_COMPRESS_LZO ? "LZO compressed" : "uncompressed");
+   printf("Written by:    Valgrind %s\n", header->tool_version);
+   print_flags(header->flags);
+   printf("Stream bytes:  %llu\n", (unsigned long long) dgt_file_stream_size(file));
+   printf("Chunks:        %llu%s\n", (unsigned long long) n_records[DG_R_CHUNK],
+          dgt_file_finished(file) ? "" : " (unfinished, index rebuilt)");
+   if (dgt_file_dropped(file) > 0)
+      printf("Cut short:     %llu bytes at the end, left out\n",
+             (unsigned long long) dgt_file_dropped(file));
+   printf("Instructions:  %llu\n", (unsigned long long) instrs);
+   printf("Definitions:   %llu blocks, %llu contexts\n",
+          (unsigned long long) dgt_defs_n_bbdefs(defs), (unsigned long long) st.n_contexts);
+   print_records(n_records, record_bytes, dgt_file_stream_size(file));
+
+   total = st.total.reads + st.total.writes;
+   printf("\n%-16s %14s %16s %7s\n", "Accesses", "Count", "Bytes", "Count%");
+   printf("%-16s %14llu %16llu %6.2f%%\n", "reads", (unsigned long long) st.total.reads,
+          (unsigned long long) st.total.read_bytes, percent(st.total.reads, total));
+   printf("%-16s %14llu %16llu %6.2f%%\n", "writes", (unsigned long long) st.total.writes,
+          (unsigned long long) st.total.write_bytes, percent(st.total.writes, total));
+   printf("%-16s %14llu %16llu\n", "total", (unsigned long long) total,
+          (unsigned long long) (st.total.read_bytes + st.total.write_bytes));
+   if (st.total.atomics > 0)
+      printf("%-16s %14llu %16llu\n", "atomic writes",
+             (unsigned long long) st.total.atomics,
+             (unsigned long long) st.total.atomic_bytes);
+   if (st.total.fetches > 0)
+      printf("%-16s %14llu %16llu\n", "fetches", (unsigned long long) st.total.fetches,
+             (unsigned long long) st.total.fetch_bytes);
+   if (st.total.copies > 0)
+      printf("%-16s %14llu %16llu\n", "bulk copies", (unsigned long long) st.total.copies,
+             (unsigned long long) st.total.copy_bytes);
+   if (st.total.sets > 0)
+      printf("%-16s %14llu %16llu\n", "bulk sets", (unsigned long long) st.total.sets,
+             (unsigned long long) st.total.set_bytes);
+
+   print_contexts(&st, decoder, n_top);
+   print_ranges(&st, n_top);
+   if (n_records[DG_R_FIRST_TOUCH] > 0)
+      print_first_touch(&st, decoder, n_top);
+   if (n_records[DG_R_LOCK] > 0)
+      print_locks(&st, instrs, n_top);
+   if (n_records[DG_R_ACCESS_COUNTS] > 0)
+      print_access_counts(&st, n_top);
+   if (n_records[DG_R_AFFINITY] > 0)
+      print_affinity(&st, n_top);
+   print_intervals(&st);
+
+   counts_free(&st.total);
+   free(ranges);
+   dgt_decoder_free(decoder);
+   dgt_defs_free(defs);
+   dgt_close(file);
+   return ret != DGT_OK;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,391 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: TLB simulation of the accesses.       dg_tlbsim.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-tlb-sim=yes, the recorded data accesses go through a
+ * model of a first and second level data TLB, each set-associative with
+ * LRU replacement, for a single page size. The references and misses are
+ * counted for each access of each context, as for the cache simulation,
+ * and for each tracked range. The TLBs are given like cachegrind's
+ * caches, but with a number of entries rather than a size, and the page
+ * size is given separately, since a TLB entry covers a page much as a
+ * cache line covers its bytes.
+ */
+
+/* Kinds of DG_R_TLB_MISSES */
+#define DG_TLB_CONTEXT 0
+#define DG_TLB_RANGE   1
+
+typedef struct
+{
+   Int entries;
+   Int assoc;
+   Int sets_min_1;
+   UWord *tags;        /* Entries of each set, most recently used first */
+} DgTLB;
+
+typedef struct
+{
+   ULong refs;
+   ULong l1_misses;
+   ULong l2_misses;
+} DgTLBCounts;
+
+typedef struct DgTLBContext
+{
+   struct DgTLBContext *next;
+   UWord key;          /* Context index */
+   Word n_accesses;
+   DgTLBCounts counts[];
+} DgTLBContext;
+
+typedef struct
+{
+   Addr start;
+   Addr end;           /* One past the last byte */
+   Bool active;
+   DgTLBCounts counts;
+} DgTLBRange;
+
+Bool DG_(clo_tlb_sim) = False;
+static Int clo_tlb1_entries = 64;
+static Int clo_tlb1_assoc = 4;
+static Int clo_tlb2_entries = 1536;
+static Int clo_tlb2_assoc = 12;
+static Long clo_tlb_page_size = 4096;
+
+static DgTLB tlb1, tlb2;
+static Int page_shift;
+
+static VgHashTable *contexts = NULL;   /* DgTLBContext */
+static DgTLBContext *last_context = NULL;
+static XArray *ranges = NULL;          /* DgTLBRange, as registered */
+static Word n_active_ranges = 0;
+
+/* Parses "<entries>,<assoc>" */
+static void parse_tlb_opt(Int *entries, Int *assoc, const HChar *opt, const HChar *optval)
+{
+   Long i1, i2;
+   HChar *endptr;
+
+   i1 = VG_(strtoll10)(optval, &endptr);     if (*endptr != ',')  goto bad;
+   i2 = VG_(strtoll10)(endptr + 1, &endptr); if (*endptr != '\0') goto bad;
+   if (i1 <= 0 || i2 <= 0 || i1 > 1 << 24 || i2 > i1 || i1 % i2 != 0
+       || VG_(log2)(i1 / i2) == -1)
+      goto bad;
+   *entries = i1;
+   *assoc = i2;
+   return;
+
+  bad:
+   VG_(fmsg_bad_option)(opt, "Bad argument '%s' (the number of sets must be a power of 2)\n",
+                        optval);
+}
+
+Bool DG_(tlbsim_process_cmd_line_option)(const HChar *arg)
+{
+   const HChar *tmp_str;
+
+   if (VG_BOOL_CLO(arg, "--datagrind-tlb-sim", DG_(clo_tlb_sim))) {}
+   else if (VG_STR_CLO(arg, "--datagrind-tlb1", tmp_str))
+      parse_tlb_opt(&clo_tlb1_entries, &clo_tlb1_assoc, arg, tmp_str);
+   else if (VG_STR_CLO(arg, "--datagrind-tlb2", tmp_str))
+      parse_tlb_opt(&clo_tlb2_entries, &clo_tlb2_assoc, arg, tmp_str);
+   else if (VG_BINT_CLO(arg, "--datagrind-tlb-page-size", clo_tlb_page_size,
+                        4096, 1LL << 30))
+   {
+      if (VG_(log2)(clo_tlb_page_size) == -1)
+         VG_(fmsg_bad_option)(arg, "The page size must be a power of 2\n");
+   }
+   else
+      return False;
+   return True;
+}
+
+void DG_(tlbsim_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-tlb-sim=yes|no       count first and second level data TLB\n"
+"                                     misses of each access [no]\n"
+"    --datagrind-tlb1=<entries>,<assoc>  first level TLB [64,4]\n"
+"    --datagrind-tlb2=<entries>,<assoc>  second level TLB [1536,12]\n"
+"    --datagrind-tlb-page-size=<n>    page size in bytes [4096]\n"
+   );
+}
+
+static void tlb_init(DgTLB *tlb, Int entries, Int assoc, const HChar *cc)
+{
+   tlb->entries = entries;
+   tlb->assoc = assoc;
+   tlb->sets_min_1 = entries / assoc - 1;
+   tlb->tags = VG_(malloc)(cc, entries * sizeof(UWord));
+   /* No page is ~0 after the shift, so this marks empty entries */
+   VG_(memset)(tlb->tags, 0xFF, entries * sizeof(UWord));
+}
+
+void DG_(tlbsim_init)(void)
+{
+   if (!DG_(clo_tlb_sim))
+      return;
+   tlb_init(&tlb1, clo_tlb1_entries, clo_tlb1_assoc, "datagrind.tlbsim.tlb1");
+   tlb_init(&tlb2, clo_tlb2_entries, clo_tlb2_assoc, "datagrind.tlbsim.tlb2");
+   page_shift = VG_(log2)(clo_tlb_page_size);
+   contexts = VG_(HT_construct)("datagrind.tlbsim.contexts");
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.tlbsim.ranges", VG_(free),
+                       sizeof(DgTLBRange));
+}
+
+void DG_(tlbsim_track)(Addr addr, SizeT len)
+{
+   DgTLBRange range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   VG_(memset)(&range, 0, sizeof(range));
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   VG_(addToXA)(ranges, &range);
+   if (range.active)
+      n_active_ranges++;
+}
+
+void DG_(tlbsim_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgTLBRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+/* Looks up a page, making it the most recently used of its set. Returns
+ * True on a miss, after replacing the least recently used.
+ */
+static Bool tlb_ref_is_miss(DgTLB *tlb, UWord page)
+{
+   UWord *set = &tlb->tags[(page & tlb->sets_min_1) * tlb->assoc];
+   Int i, j;
+
+   if (LIKELY(set[0] == page))
+      return False;
+   for (i = 1; i < tlb->assoc; i++)
+      if (set[i] == page)
+      {
+         for (j = i; j > 0; j--)
+            set[j] = set[j - 1];
+         set[0] = page;
+         return False;
+      }
+   for (j = tlb->assoc - 1; j > 0; j--)
+      set[j] = set[j - 1];
+   set[0] = page;
+   return True;
+}
+
+static void add_counts(DgTLBCounts *counts, Bool m1, Bool m2)
+{
+   counts->refs++;
+   if (m1)
+      counts->l1_misses++;
+   if (m2)
+      counts->l2_misses++;
+}
+
+void DG_(tlbsim_ref)(UWord context_index, Word n_accesses, Word access,
+                     Addr addr, UChar size)
+{
+   DgTLBContext *ctx = last_context;
+   UWord first = addr >> page_shift;
+   UWord last = (addr + size - 1) >> page_shift;
+   UWord page;
+   Bool m1 = False, m2 = False;
+
+   if (ctx == NULL || ctx->key != context_index)
+   {
+      ctx = VG_(HT_lookup)(contexts, context_index);
+      if (ctx == NULL)
+      {
+         ctx = VG_(calloc)("datagrind.tlbsim.context", 1,
+                           sizeof(DgTLBContext) + n_accesses * sizeof(DgTLBCounts));
+         ctx->key = context_index;
+         ctx->n_accesses = n_accesses;
+         VG_(HT_add_node)(contexts, ctx);
+      }
+      last_context = ctx;
+   }
+   tl_assert(access < ctx->n_accesses);
+
+   /* An access that straddles two pages misses if either does */
+   for (page = first; page <= last; page++)
+      if (tlb_ref_is_miss(&tlb1, page))
+      {
+         m1 = True;
+         if (tlb_ref_is_miss(&tlb2, page))
+            m2 = True;
+      }
+
+   add_counts(&ctx->counts[access], m1, m2);
+   if (n_active_ranges > 0)
+   {
+      Word n = VG_(sizeXA)(ranges), i;
+
+      /* Counted for the first range containing the access */
+      for (i = 0; i < n; i++)
+      {
+         DgTLBRange *range = VG_(indexXA)(ranges, i);
+         if (range->active && addr - range->start < range->end - range->start)
+         {
+            add_counts(&range->counts, m1, m2);
+            break;
+         }
+      }
+   }
+}
+
+static Int cmp_context_ptr(const void *a, const void *b)
+{
+   const DgTLBContext *ca = *(DgTLBContext * const *) a;
+   const DgTLBContext *cb = *(DgTLBContext * const *) b;
+   if (ca->key != cb->key)
+      return ca->key < cb->key ? -1 : 1;
+   return 0;
+}
+
+static void out_tlb_config(void)
+{
+   UChar payload[5 * DG_MAX_UVARINT_BYTES];
+   UChar *p = payload;
+
+   p = encode_uvarint(p, page_shift);
+   p = encode_uvarint(p, tlb1.entries);
+   p = encode_uvarint(p, tlb1.assoc);
+   p = encode_uvarint(p, tlb2.entries);
+   p = encode_uvarint(p, tlb2.assoc);
+   out_byte(DG_R_TLB_CONFIG);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+}
+
+static UChar *encode_counts(UChar *p, const DgTLBCounts *counts)
+{
+   p = encode_uvarint64(p, counts->refs);
+   p = encode_uvarint64(p, counts->l1_misses);
+   p = encode_uvarint64(p, counts->l2_misses);
+   return p;
+}
+
+void DG_(tlbsim_finish)(void)
+{
+   DgTLBContext **nodes;
+   UInt n_nodes, i;
+   Word n_ranges, r;
+
+   if (contexts == NULL)
+      return;
+
+   out_tlb_config();
+   nodes = (DgTLBContext **) VG_(HT_to_array)(contexts, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgTLBContext *), cmp_context_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgTLBContext *ctx = nodes[i];
+      UChar *payload, *p;
+      Word j;
+
+      payload = VG_(malloc)("datagrind.tlbsim.payload",
+                            1 + 2 * DG_MAX_UVARINT_BYTES + ctx->n_accesses * 3 * 10);
+      p = payload;
+      *p++ = DG_TLB_CONTEXT;
+      p = encode_uvarint(p, ctx->key);
+      p = encode_uvarint(p, ctx->n_accesses);
+      for (j = 0; j < ctx->n_accesses; j++)
+         p = encode_counts(p, &ctx->counts[j]);
+      out_byte(DG_R_TLB_MISSES);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+      VG_(free)(payload);
+   }
+   VG_(free)(nodes);
+
+   n_ranges = VG_(sizeXA)(ranges);
+   for (r = 0; r < n_ranges; r++)
+   {
+      const DgTLBRange *range = VG_(indexXA)(ranges, r);
+      UChar payload[1 + 2 * DG_MAX_UVARINT_BYTES + 3 * 10];
+      UChar *p = payload;
+
+      if (range->counts.refs == 0)
+         continue;
+      *p++ = DG_TLB_RANGE;
+      p = encode_uvarint(p, r);
+      p = encode_uvarint(p, 1);
+      p = encode_counts(p, &range->counts);
+      out_byte(DG_R_TLB_MISSES);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+   }
+
+   VG_(HT_destruct)(contexts, VG_(free));
+   contexts = NULL;
+   last_context = NULL;
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+   VG_(free)(tlb1.tags);
+   VG_(free)(tlb2.tags);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
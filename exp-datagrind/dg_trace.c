@@ -0,0 +1,2209 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: reader library for traces.              dg_trace.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* This is built with the host's C library, like cg_merge, rather than
+ * as part of the tool.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dg_trace.h"
+
+/* The decompressor is the core's, as for the writer */
+#include "../coregrind/m_debuginfo/minilzo-inl.c"
+
+#define DGT_HEADER_MAGIC     "DATAGRIND1"
+#define DGT_FOOTER_MAGIC     "DGINDEX"
+
+/* Contexts are kept in blocks of this many, so that they never move */
+#define DGT_CONTEXT_BLOCK    4096
+
+struct dgt_file
+{
+   char *name;
+   dgt_header header;
+   const uint8_t *stream;
+   uint64_t stream_size;
+   uint64_t header_size;     /* Of the header record */
+   void *map;                /* The mapped file */
+   size_t map_size;
+   uint8_t *inflated;        /* The stream, if decompressed */
+   int swap;                 /* The file's byte order is not the host's */
+   int has_index;            /* Read from the trace, or rebuilt */
+   int finished;             /* The index was read */
+   uint64_t dropped;         /* Bytes cut short at the end */
+   uint64_t index_offset;
+   size_t n_chunks;
+   dgt_chunk *chunks;
+};
+
+/* A block definition, with what is needed to decode its runs */
+typedef struct
+{
+   dgt_bbdef def;
+   uint32_t n_dynamic;       /* Accesses that are not static */
+   uint32_t *dynamic;        /* Definition index of each of those */
+} dgt_bbdef_entry;
+
+struct dgt_defs
+{
+   dgt_bbdef_entry **bbdefs;
+   uint64_t n_bbdefs;
+   uint64_t bbdefs_size;
+   dgt_context **context_blocks;
+   uint64_t n_contexts;
+   uint64_t context_blocks_size;
+   dgt_file **parents;       /* Whose definitions are used, kept open */
+   uint64_t n_parents;
+   uint64_t parents_size;
+};
+
+/* The stride of a position of a block, kept as the writer does */
+typedef struct
+{
+   uint64_t delta;
+   uint8_t hits;
+   uint8_t shift;
+} dgt_stride;
+
+struct dgt_decoder
+{
+   const dgt_file *file;
+   dgt_cursor cursor;
+   uint64_t end;             /* Stream offset at which to stop */
+   uint64_t mask;            /* Of an address */
+
+   const dgt_defs *defs;
+   dgt_defs *own;            /* defs, if read by this rather than shared */
+
+   /* Per block definition, the last address at each position and the
+    * chunk in which it was valid. Only allocated once the block runs.
+    */
+   uint64_t **prev;
+   uint64_t *prev_chunk;
+   uint64_t prev_size;
+   /* Likewise the strides at each dynamic position, if the trace has them */
+   int strided;
+   dgt_stride **strides;
+   int fetches;              /* Whether runs give their instruction fetches */
+
+   uint64_t chunk;           /* Number of chunk records seen */
+   uint32_t tid;
+   uint32_t pid;
+   uint64_t instrs;
+
+   dgt_access *accesses;     /* Of the current run */
+   uint32_t accesses_size;
+
+   /* The last run record, for its repeats: the positions (in the
+    * definition if filtered, else among the dynamic accesses) and deltas
+    * of its addresses.
+    */
+   uint64_t last_context;
+   uint32_t last_instrs;
+   int last_filtered;
+   uint64_t *last_mask;      /* Of each address, if a DG_R_BBRUN_LINES */
+   int last_lines;
+   /* A DG_R_BBRUN_STRIDED depends on the strides when it is decoded, so
+    * the part of it after the instruction count is kept to decode again
+    * for each repeat.
+    */
+   const uint8_t *last_strided;
+   const uint8_t *last_end;
+   uint32_t n_last;
+   uint32_t *last_pos;
+   uint64_t *last_delta;
+   uint32_t last_size;
+   int have_last;
+   uint8_t repeats_left;
+   dgt_record repeat_record;
+};
+
+const char *dgt_strerror(int err)
+{
+   switch (err)
+   {
+   case DGT_OK:
+      return "success";
+   case DGT_ERR_IO:
+      return strerror(errno);
+   case DGT_ERR_NOMEM:
+      return "out of memory";
+   case DGT_ERR_FORMAT:
+      return "not a valid datagrind trace";
+   case DGT_ERR_VERSION:
+      return "unsupported datagrind trace version";
+   case DGT_ERR_TRUNCATED:
+      return "datagrind trace is truncated";
+   case DGT_ERR_INVALID:
+      return "invalid argument";
+   default:
+      return "unknown error";
+   }
+}
+
+static uint64_t load(const dgt_file *file, const uint8_t *p, size_t size)
+{
+   uint64_t value = 0;
+   size_t i;
+
+   if (file->header.big_endian)
+      for (i = 0; i < size; i++)
+         value = (value << 8) | p[i];
+   else
+      for (i = size; i > 0; i--)
+         value = (value << 8) | p[i - 1];
+   return value;
+}
+
+uint64_t dgt_get_word(const dgt_file *file, const uint8_t *p)
+{
+   if (!file->swap)
+   {
+      if (file->header.word_size == 8)
+      {
+         uint64_t value;
+         memcpy(&value, p, sizeof(value));
+         return value;
+      }
+      else
+      {
+         uint32_t value;
+         memcpy(&value, p, sizeof(value));
+         return value;
+      }
+   }
+   return load(file, p, file->header.word_size);
+}
+
+const uint8_t *dgt_get_uvarint(const uint8_t *p, const uint8_t *end, uint64_t *value)
+{
+   uint64_t v = 0;
+   unsigned int shift = 0;
+
+   while (p < end)
+   {
+      uint8_t c = *p++;
+
+      if (shift < 64)
+         v |= (uint64_t) (c & 0x7f) << shift;
+      shift += 7;
+      if (c < 0x80)
+      {
+         *value = v;
+         return p;
+      }
+   }
+   return NULL;
+}
+
+const uint8_t *dgt_get_svarint(const uint8_t *p, const uint8_t *end, int64_t *value)
+{
+   uint64_t z;
+
+   p = dgt_get_uvarint(p, end, &z);
+   if (p != NULL)
+      *value = (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+   return p;
+}
+
+uint64_t dgt_context_ip(const dgt_file *file, const dgt_context *context, uint32_t i)
+{
+   return dgt_get_word(file, context->stack + (size_t) i * file->header.word_size);
+}
+
+static const uint8_t *get_event_counts(const uint8_t *p, const uint8_t *end,
+                                       uint32_t *n, dgt_event_count *counts)
+{
+   uint64_t value, i;
+
+   if ((p = dgt_get_uvarint(p, end, &value)) == NULL || value > DG_EVENT_TOP_MAX)
+      return NULL;
+   *n = value;
+   for (i = 0; i < *n && p != NULL; i++)
+   {
+      p = dgt_get_uvarint(p, end, &counts[i].key);
+      if (p != NULL)
+         p = dgt_get_uvarint(p, end, &counts[i].accesses);
+   }
+   return p;
+}
+
+int dgt_parse_event(const dgt_record *record, dgt_event *event)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   const uint8_t *nul;
+
+   memset(event, 0, sizeof(*event));
+   if (record->type != DG_R_START_EVENT && record->type != DG_R_END_EVENT)
+      return DGT_ERR_INVALID;
+   if ((p = dgt_get_uvarint(p, end, &event->instrs)) == NULL
+       || (nul = memchr(p, '\0', end - p)) == NULL)
+      return DGT_ERR_FORMAT;
+   event->label = (const char *) p;
+   event->label_len = nul - p;
+   p = nul + 1;
+   if (p == end)
+      return DGT_OK;
+
+   event->has_summary = 1;
+   if ((p = dgt_get_uvarint(p, end, &event->reads)) == NULL
+       || (p = dgt_get_uvarint(p, end, &event->writes)) == NULL
+       || (p = dgt_get_uvarint(p, end, &event->read_bytes)) == NULL
+       || (p = dgt_get_uvarint(p, end, &event->write_bytes)) == NULL
+       || (p = dgt_get_uvarint(p, end, &event->lines)) == NULL
+       || (p = get_event_counts(p, end, &event->n_contexts, event->contexts)) == NULL
+       || (p = get_event_counts(p, end, &event->n_ranges, event->ranges)) == NULL
+       || p != end)
+      return DGT_ERR_FORMAT;
+   return DGT_OK;
+}
+
+int dgt_parse_bulk(const dgt_file *file, const dgt_record *record, dgt_bulk *bulk)
+{
+   size_t ws = file->header.word_size;
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+
+   memset(bulk, 0, sizeof(*bulk));
+   if (record->type != DG_R_BULK_ACCESS)
+      return DGT_ERR_INVALID;
+   if (record->length < 1 + ws)
+      return DGT_ERR_FORMAT;
+   bulk->op = p[0];
+   bulk->dst = dgt_get_word(file, p + 1);
+   p += 1 + ws;
+   if (bulk->op == DG_BULK_COPY)
+   {
+      if ((size_t) (end - p) < ws)
+         return DGT_ERR_FORMAT;
+      bulk->src = dgt_get_word(file, p);
+      p += ws;
+   }
+   else if (bulk->op != DG_BULK_SET)
+      return DGT_ERR_FORMAT;
+   if ((p = dgt_get_uvarint(p, end, &bulk->size)) == NULL || p != end)
+      return DGT_ERR_FORMAT;
+   return DGT_OK;
+}
+
+int dgt_parse_lock(const dgt_file *file, const dgt_record *record, dgt_lock *lock)
+{
+   const uint8_t *p = record->payload;
+
+   memset(lock, 0, sizeof(*lock));
+   if (record->type != DG_R_LOCK)
+      return DGT_ERR_INVALID;
+   if (record->length != 1 + file->header.word_size)
+      return DGT_ERR_FORMAT;
+   lock->action = DG_LOCK_ACTION(p[0]);
+   lock->kind = DG_LOCK_KIND(p[0]);
+   if (lock->action > DG_LOCK_RELEASE)
+      return DGT_ERR_FORMAT;
+   lock->addr = dgt_get_word(file, p + 1);
+   return DGT_OK;
+}
+
+int dgt_parse_fork_defs(const dgt_record *record, dgt_fork_defs *fork)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   uint64_t pid;
+
+   memset(fork, 0, sizeof(*fork));
+   if (record->type != DG_R_FORK_DEFS)
+      return DGT_ERR_INVALID;
+   if ((p = dgt_get_uvarint(p, end, &pid)) == NULL
+       || (p = dgt_get_uvarint(p, end, &fork->end)) == NULL
+       || (p = dgt_get_uvarint(p, end, &fork->n_bbdefs)) == NULL
+       || (p = dgt_get_uvarint(p, end, &fork->n_contexts)) == NULL
+       || p == end || end[-1] != '\0' || memchr(p, '\0', end - p) != end - 1)
+      return DGT_ERR_FORMAT;
+   fork->parent_pid = pid;
+   fork->parent = (const char *) p;
+   return DGT_OK;
+}
+
+int dgt_open_parent(const dgt_file *file, const dgt_fork_defs *fork, dgt_file **parent_out)
+{
+   const char *base = strrchr(fork->parent, '/');
+   const char *dir_end = strrchr(file->name, '/');
+   int dir_len = dir_end != NULL ? (int) (dir_end - file->name) + 1 : 0;
+   char moved[PATH_MAX];
+   int err = dgt_open(fork->parent, parent_out);
+
+   if (err == DGT_ERR_IO && errno == ENOENT && base != NULL
+       && snprintf(moved, sizeof(moved), "%.*s%s", dir_len, file->name, base + 1)
+          < (int) sizeof(moved))
+      err = dgt_open(moved, parent_out);
+   if (err != DGT_OK)
+      return err;
+   if ((*parent_out)->header.big_endian != file->header.big_endian
+       || (*parent_out)->header.word_size != file->header.word_size)
+   {
+      dgt_close(*parent_out);
+      *parent_out = NULL;
+      return DGT_ERR_FORMAT;
+   }
+   return DGT_OK;
+}
+
+/* Decompresses the frames after the header into file->inflated. The raw
+ * sizes are added up first, so that the stream is allocated once.
+ */
+static int inflate_stream(dgt_file *file)
+{
+   const uint8_t *data = file->map;
+   size_t size = file->map_size;
+   size_t pos;
+   uint64_t total = file->header_size;
+   uint8_t *out;
+
+   /* A frame cut short by the end of the file is left out */
+   for (pos = file->header_size; pos < size; )
+   {
+      uint64_t raw, stored;
+
+      if (size - pos < 8
+          || (stored = load(file, data + pos + 4, 4)) > size - pos - 8)
+      {
+         file->dropped = size - pos;
+         size = pos;
+         break;
+      }
+      raw = load(file, data + pos, 4);
+      pos += 8 + stored;
+      total += raw;
+   }
+
+   file->inflated = out = malloc(total > 0 ? total : 1);
+   if (out == NULL)
+      return DGT_ERR_NOMEM;
+   memcpy(out, data, file->header_size);
+   out += file->header_size;
+   for (pos = file->header_size; pos < size; )
+   {
+      uint64_t raw = load(file, data + pos, 4);
+      uint64_t stored = load(file, data + pos + 4, 4);
+
+      pos += 8;
+      if (raw == stored)
+         memcpy(out, data + pos, raw);
+      else
+      {
+         lzo_uint out_len = raw;
+         if (lzo1x_decompress_safe(data + pos, stored, out, &out_len, NULL) != LZO_E_OK
+             || out_len != raw)
+            return DGT_ERR_FORMAT;
+      }
+      out += raw;
+      pos += stored;
+   }
+   file->stream = file->inflated;
+   file->stream_size = total;
+   return DGT_OK;
+}
+
+static int grow(void *array_ptr, uint64_t n, uint64_t *size, size_t elem_size)
+{
+   void **array = array_ptr;
+
+   if (n == *size)
+   {
+      uint64_t new_size = *size > 0 ? *size * 2 : 256;
+      void *grown = realloc(*array, new_size * elem_size);
+
+      if (grown == NULL)
+         return DGT_ERR_NOMEM;
+      *array = grown;
+      *size = new_size;
+   }
+   return DGT_OK;
+}
+
+/* Reads the index through the footer. A trace that was not finished has
+ * neither, which is not an error.
+ */
+static int read_index(dgt_file *file)
+{
+   const uint8_t *footer, *p, *end;
+   uint64_t index_offset, n, i;
+   dgt_cursor cursor;
+   dgt_record record;
+
+   if (file->stream_size < file->header_size + DG_FOOTER_SIZE)
+      return DGT_OK;
+   footer = file->stream + file->stream_size - DG_FOOTER_SIZE;
+   if (footer[0] != DG_R_FOOTER || footer[1] != DG_FOOTER_SIZE - 2
+       || memcmp(footer + 10, DGT_FOOTER_MAGIC, sizeof(DGT_FOOTER_MAGIC)) != 0)
+      return DGT_OK;
+   index_offset = load(file, footer + 2, 8);
+   if (index_offset < file->header_size || index_offset >= file->stream_size)
+      return DGT_ERR_FORMAT;
+
+   dgt_cursor_init(&cursor, file);
+   dgt_cursor_seek(&cursor, index_offset);
+   if (dgt_cursor_next(&cursor, &record) != 1 || record.type != DG_R_INDEX)
+      return DGT_ERR_FORMAT;
+   p = record.payload;
+   end = p + record.length;
+   if ((p = dgt_get_uvarint(p, end, &n)) == NULL || n > record.length)
+      return DGT_ERR_FORMAT;
+   file->chunks = calloc(n > 0 ? n : 1, sizeof(dgt_chunk));
+   if (file->chunks == NULL)
+      return DGT_ERR_NOMEM;
+   for (i = 0; i < n; i++)
+   {
+      dgt_chunk *chunk = &file->chunks[i];
+      uint64_t n_labels, j;
+
+      if ((p = dgt_get_uvarint(p, end, &chunk->offset)) == NULL
+          || (p = dgt_get_uvarint(p, end, &chunk->instrs)) == NULL
+          || (p = dgt_get_uvarint(p, end, &n_labels)) == NULL
+          || n_labels > (uint64_t) (end - p))
+         return DGT_ERR_FORMAT;
+      chunk->n_labels = n_labels;
+      chunk->labels = (const char *) p;
+      for (j = 0; j < n_labels; j++)
+      {
+         const uint8_t *nul = memchr(p, '\0', end - p);
+         if (nul == NULL)
+            return DGT_ERR_FORMAT;
+         p = nul + 1;
+      }
+   }
+   file->n_chunks = n;
+   file->index_offset = index_offset;
+   file->has_index = 1;
+   file->finished = 1;
+   return DGT_OK;
+}
+
+/* For a trace that was not finished, as when Valgrind was killed, rebuilds
+ * the index from the chunk records, and leaves out a record cut short by
+ * the end of the file, so that every whole record can still be read.
+ */
+static int recover_index(dgt_file *file)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   uint64_t n = 0, size = 0;
+   int ret;
+
+   dgt_cursor_init(&cursor, file);
+   while ((ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      const uint8_t *p = record.payload;
+      const uint8_t *end = p + record.length;
+      dgt_chunk *chunk;
+      uint64_t index;
+
+      if (record.type != DG_R_CHUNK)
+         continue;
+      if ((ret = grow(&file->chunks, n, &size, sizeof(dgt_chunk))) != DGT_OK)
+         return ret;
+      chunk = &file->chunks[n];
+      memset(chunk, 0, sizeof(*chunk));
+      chunk->offset = record.offset;
+      if ((p = dgt_get_uvarint(p, end, &index)) == NULL
+          || dgt_get_uvarint(p, end, &chunk->instrs) == NULL)
+         return DGT_ERR_FORMAT;
+      n++;
+   }
+   if (ret == DGT_ERR_TRUNCATED)
+   {
+      file->dropped += file->stream_size - cursor.pos;
+      file->stream_size = cursor.pos;
+   }
+   else if (ret != 0)
+      return ret;
+   if (n > 0)
+   {
+      file->n_chunks = n;
+      file->index_offset = file->stream_size;
+      file->has_index = 1;
+   }
+   return DGT_OK;
+}
+
+static int parse_header(dgt_file *file)
+{
+   const uint8_t *data = file->map;
+   const uint8_t *end, *p, *nul;
+   size_t len;
+   uint64_t flags;
+   static const uint16_t one = 1;
+   int host_big_endian = *(const uint8_t *) &one == 0;
+
+   if (file->map_size < 2 || data[0] != DG_R_HEADER)
+      return DGT_ERR_FORMAT;
+   len = data[1];
+   if (len < sizeof(DGT_HEADER_MAGIC) + 3 || file->map_size < 2 + len
+       || memcmp(data + 2, DGT_HEADER_MAGIC, sizeof(DGT_HEADER_MAGIC)) != 0)
+      return DGT_ERR_FORMAT;
+   end = data + 2 + len;
+   data += 2 + sizeof(DGT_HEADER_MAGIC);
+   file->header.version = data[0];
+   file->header.big_endian = data[1];
+   file->header.word_size = data[2];
+   file->header_size = 2 + len;
+   if (file->header.version != DGT_FILE_VERSION)
+      return DGT_ERR_VERSION;
+   if (len < sizeof(DGT_HEADER_MAGIC) + 4)
+      return DGT_ERR_FORMAT;
+   file->header.compression = data[3];
+   /* Flags this library does not know are left for the caller */
+   p = dgt_get_uvarint(data + 4, end, &flags);
+   nul = p != NULL ? memchr(p, '\0', end - p) : NULL;
+   if (file->header.big_endian > 1
+       || (file->header.word_size != 4 && file->header.word_size != 8)
+       || file->header.compression > DG_COMPRESS_LZO
+       || nul == NULL)
+      return DGT_ERR_FORMAT;
+   file->header.flags = flags;
+   len = nul - p;
+   if (len >= sizeof(file->header.tool_version))
+      len = sizeof(file->header.tool_version) - 1;
+   memcpy(file->header.tool_version, p, len);
+   file->header.tool_version[len] = '\0';
+   file->swap = file->header.big_endian != host_big_endian;
+   return DGT_OK;
+}
+
+/* Maps the whole of a file, which must not be empty, for reading */
+static int map_file(const char *filename, void **map, size_t *map_size)
+{
+   struct stat st;
+   int fd, err;
+
+   fd = open(filename, O_RDONLY);
+   if (fd < 0 || fstat(fd, &st) < 0)
+   {
+      err = errno;
+      if (fd >= 0)
+         close(fd);
+      errno = err;
+      return DGT_ERR_IO;
+   }
+   if (st.st_size == 0)
+   {
+      close(fd);
+      return DGT_ERR_FORMAT;
+   }
+   *map_size = st.st_size;
+   *map = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   err = errno;
+   close(fd);
+   if (*map == MAP_FAILED)
+   {
+      errno = err;
+      return DGT_ERR_IO;
+   }
+   return DGT_OK;
+}
+
+int dgt_open(const char *filename, dgt_file **file_out)
+{
+   dgt_file *file;
+   int err;
+
+   *file_out = NULL;
+   file = calloc(1, sizeof(dgt_file));
+   if (file != NULL && (file->name = strdup(filename)) == NULL)
+   {
+      free(file);
+      file = NULL;
+   }
+   if (file == NULL)
+      return DGT_ERR_NOMEM;
+
+   err = map_file(filename, &file->map, &file->map_size);
+   if (err != DGT_OK)
+   {
+      int saved = errno;
+
+      free(file->name);
+      free(file);
+      errno = saved;
+      return err;
+   }
+
+   err = parse_header(file);
+   if (err == DGT_OK)
+   {
+      if (file->header.compression != DG_COMPRESS_NONE)
+      {
+         err = inflate_stream(file);
+         if (err == DGT_OK)
+         {
+            /* Only the stream is needed from now on */
+            munmap(file->map, file->map_size);
+            file->map = NULL;
+         }
+      }
+      else
+      {
+         file->stream = file->map;
+         file->stream_size = file->map_size;
+         madvise(file->map, file->map_size, MADV_SEQUENTIAL);
+      }
+   }
+   if (err == DGT_OK)
+      err = read_index(file);
+   if (err == DGT_OK && !file->finished)
+      err = recover_index(file);
+   if (err != DGT_OK)
+   {
+      dgt_close(file);
+      return err;
+   }
+   *file_out = file;
+   return DGT_OK;
+}
+
+void dgt_close(dgt_file *file)
+{
+   if (file == NULL)
+      return;
+   if (file->map != NULL)
+      munmap(file->map, file->map_size);
+   free(file->inflated);
+   free(file->chunks);
+   free(file->name);
+   free(file);
+}
+
+const dgt_header *dgt_file_header(const dgt_file *file)
+{
+   return &file->header;
+}
+
+const uint8_t *dgt_file_stream(const dgt_file *file)
+{
+   return file->stream;
+}
+
+uint64_t dgt_file_stream_size(const dgt_file *file)
+{
+   return file->stream_size;
+}
+
+int dgt_file_has_index(const dgt_file *file)
+{
+   return file->has_index;
+}
+
+int dgt_file_finished(const dgt_file *file)
+{
+   return file->finished;
+}
+
+uint64_t dgt_file_dropped(const dgt_file *file)
+{
+   return file->dropped;
+}
+
+size_t dgt_file_n_chunks(const dgt_file *file)
+{
+   return file->n_chunks;
+}
+
+const dgt_chunk *dgt_file_chunk(const dgt_file *file, size_t i)
+{
+   return i < file->n_chunks ? &file->chunks[i] : NULL;
+}
+
+void dgt_cursor_init(dgt_cursor *cursor, const dgt_file *file)
+{
+   cursor->file = file;
+   cursor->pos = file->header_size;
+}
+
+void dgt_cursor_seek(dgt_cursor *cursor, uint64_t offset)
+{
+   cursor->pos = offset;
+}
+
+int dgt_cursor_next(dgt_cursor *cursor, dgt_record *record)
+{
+   const dgt_file *file = cursor->file;
+   const uint8_t *p = file->stream + cursor->pos;
+   uint64_t left = file->stream_size - cursor->pos;
+   uint64_t head, length;
+
+   if (cursor->pos >= file->stream_size)
+      return 0;
+   if (left < 2)
+      return DGT_ERR_TRUNCATED;
+   if (p[0] >= 128)
+   {
+      head = 1;
+      length = 1;
+   }
+   else if (p[1] == 255)
+   {
+      if (left < 10)
+         return DGT_ERR_TRUNCATED;
+      head = 10;
+      length = load(file, p + 2, 8);
+   }
+   else
+   {
+      head = 2;
+      length = p[1];
+   }
+   if (length > left - head)
+      return DGT_ERR_TRUNCATED;
+   record->type = p[0];
+   record->offset = cursor->pos;
+   record->length = length;
+   record->payload = p + head;
+   cursor->pos += head + length;
+   return 1;
+}
+
+/* Grows an array of pointers to hold n + 1 */
+static const dgt_context *defs_context(const dgt_defs *defs, uint64_t index)
+{
+   return &defs->context_blocks[index / DGT_CONTEXT_BLOCK][index % DGT_CONTEXT_BLOCK];
+}
+
+/* Frees the tables, and the definitions in them if entries is set */
+static void defs_clear(dgt_defs *defs, int entries)
+{
+   uint64_t i;
+
+   if (entries)
+   {
+      for (i = 0; i < defs->n_bbdefs; i++)
+         free(defs->bbdefs[i]);
+      for (i = 0; i < defs->n_parents; i++)
+         dgt_close(defs->parents[i]);
+   }
+   free(defs->bbdefs);
+   free(defs->parents);
+   for (i = 0; i * DGT_CONTEXT_BLOCK < defs->n_contexts; i++)
+      free(defs->context_blocks[i]);
+   free(defs->context_blocks);
+   memset(defs, 0, sizeof(*defs));
+}
+
+/* Stores a block definition, in one allocation with its arrays */
+static int add_bbdef(const dgt_file *file, dgt_defs *defs, const dgt_record *record)
+{
+   size_t ws = file->header.word_size;
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   const uint8_t *q;
+   uint64_t n_instrs, n_accesses, n_static = 0, i, size = 0, iseq = 0;
+   dgt_bbdef_entry *bbd;
+   dgt_instr *instrs;
+   dgt_access_def *accesses;
+   char *mem;
+   int err;
+
+   if ((p = dgt_get_uvarint(p, end, &n_instrs)) == NULL || (uint64_t) (end - p) < ws)
+      return DGT_ERR_FORMAT;
+   n_accesses = dgt_get_word(file, p);
+   p += ws;
+   if (n_instrs > record->length || n_accesses > record->length
+       || (uint64_t) (end - p) < n_instrs * (ws + 1) + n_accesses * 3)
+      return DGT_ERR_FORMAT;
+   /* Each access is its direction, varint size and varint instruction */
+   q = p + n_instrs * (ws + 1);
+   for (i = 0; i < n_accesses; i++)
+   {
+      if (end - q < 3)
+         return DGT_ERR_FORMAT;
+      if (q[0] & DG_ACC_STATIC)
+         n_static++;
+      if ((q = dgt_get_uvarint(q + 1, end, &size)) == NULL || size == 0 || size > UINT32_MAX
+          || (q = dgt_get_uvarint(q, end, &iseq)) == NULL || iseq >= n_instrs)
+         return DGT_ERR_FORMAT;
+   }
+   if ((uint64_t) (end - q) != n_static * ws)
+      return DGT_ERR_FORMAT;
+
+   err = grow(&defs->bbdefs, defs->n_bbdefs, &defs->bbdefs_size, sizeof(dgt_bbdef_entry *));
+   if (err != DGT_OK)
+      return err;
+   mem = malloc(sizeof(dgt_bbdef_entry)
+                + n_instrs * sizeof(dgt_instr)
+                + n_accesses * (sizeof(dgt_access_def) + sizeof(uint32_t)));
+   if (mem == NULL)
+      return DGT_ERR_NOMEM;
+   bbd = (dgt_bbdef_entry *) mem;
+   mem += sizeof(dgt_bbdef_entry);
+   accesses = (dgt_access_def *) mem;
+   mem += n_accesses * sizeof(dgt_access_def);
+   instrs = (dgt_instr *) mem;
+   mem += n_instrs * sizeof(dgt_instr);
+   bbd->dynamic = (uint32_t *) mem;
+
+   for (i = 0; i < n_instrs; i++)
+   {
+      instrs[i].addr = dgt_get_word(file, p);
+      instrs[i].size = p[ws];
+      p += ws + 1;
+   }
+   bbd->n_dynamic = 0;
+   for (i = 0; i < n_accesses; i++)
+   {
+      accesses[i].dir = p[0] & ~DG_ACC_STATIC;
+      accesses[i].is_static = (p[0] & DG_ACC_STATIC) != 0;
+      accesses[i].static_addr = 0;
+      p = dgt_get_uvarint(p + 1, end, &size);
+      accesses[i].size = size;
+      p = dgt_get_uvarint(p, end, &iseq);
+      accesses[i].iseq = iseq;
+      if (!accesses[i].is_static)
+         bbd->dynamic[bbd->n_dynamic++] = i;
+   }
+   for (i = 0; i < n_accesses; i++)
+      if (accesses[i].is_static)
+      {
+         accesses[i].static_addr = dgt_get_word(file, p);
+         p += ws;
+      }
+
+   bbd->def.n_instrs = n_instrs;
+   bbd->def.n_accesses = n_accesses;
+   bbd->def.instrs = instrs;
+   bbd->def.accesses = accesses;
+   defs->bbdefs[defs->n_bbdefs++] = bbd;
+   return DGT_OK;
+}
+
+static int append_context(dgt_defs *defs, const dgt_context *context)
+{
+   uint64_t block = defs->n_contexts / DGT_CONTEXT_BLOCK;
+   int err;
+
+   if (defs->n_contexts % DGT_CONTEXT_BLOCK == 0)
+   {
+      err = grow(&defs->context_blocks, block, &defs->context_blocks_size,
+                 sizeof(dgt_context *));
+      if (err != DGT_OK)
+         return err;
+      defs->context_blocks[block] = malloc(DGT_CONTEXT_BLOCK * sizeof(dgt_context));
+      if (defs->context_blocks[block] == NULL)
+         return DGT_ERR_NOMEM;
+   }
+   defs->context_blocks[block][defs->n_contexts % DGT_CONTEXT_BLOCK] = *context;
+   defs->n_contexts++;
+   return DGT_OK;
+}
+
+static int parse_context(const dgt_file *file, const dgt_record *record,
+                         dgt_context *context)
+{
+   size_t ws = file->header.word_size;
+   const uint8_t *end = record->payload + record->length;
+   const uint8_t *p;
+   uint64_t n_stack;
+
+   if (record->length < ws + 1
+       || (p = dgt_get_uvarint(record->payload + ws, end, &n_stack)) == NULL
+       || n_stack > record->length || (uint64_t) (end - p) != n_stack * ws)
+      return DGT_ERR_FORMAT;
+   context->bbdef_index = dgt_get_word(file, record->payload);
+   context->n_stack = n_stack;
+   context->stack = p;
+   return DGT_OK;
+}
+
+/* Stores a context. Its block definition is only checked if check is
+ * set, since a prescan of part of the trace may not have it.
+ */
+static int add_context(const dgt_file *file, dgt_defs *defs, const dgt_record *record,
+                       int check)
+{
+   dgt_context context;
+   int err = parse_context(file, record, &context);
+
+   if (err != DGT_OK)
+      return err;
+   if (check && context.bbdef_index >= defs->n_bbdefs)
+      return DGT_ERR_FORMAT;
+   return append_context(defs, &context);
+}
+
+/* Reads the definitions that a DG_R_FORK_DEFS takes from the parent's
+ * trace, and so any that it takes from its own parent. They come before
+ * those of file itself.
+ */
+static int add_fork_defs(const dgt_file *file, dgt_defs *defs, const dgt_record *record)
+{
+   dgt_fork_defs fork;
+   dgt_file *parent;
+   dgt_cursor cursor;
+   dgt_record r;
+   int ret = 0, err;
+
+   err = dgt_parse_fork_defs(record, &fork);
+   if (err != DGT_OK)
+      return err;
+   if (defs->n_bbdefs != 0 || defs->n_contexts != 0)
+      return DGT_ERR_FORMAT;
+   err = dgt_open_parent(file, &fork, &parent);
+   if (err != DGT_OK)
+      return err;
+   err = grow(&defs->parents, defs->n_parents, &defs->parents_size, sizeof(dgt_file *));
+   if (err != DGT_OK)
+   {
+      dgt_close(parent);
+      return err;
+   }
+   /* Contexts point into its stream, so it is closed with them */
+   defs->parents[defs->n_parents++] = parent;
+
+   dgt_cursor_init(&cursor, parent);
+   while (err == DGT_OK && cursor.pos < fork.end
+          && (ret = dgt_cursor_next(&cursor, &r)) == 1)
+   {
+      if (r.type == DG_R_BBDEF)
+         err = add_bbdef(parent, defs, &r);
+      else if (r.type == DG_R_CONTEXT)
+         err = add_context(parent, defs, &r, 1);
+      else if (r.type == DG_R_FORK_DEFS)
+         err = add_fork_defs(parent, defs, &r);
+   }
+   if (err == DGT_OK && ret < 0)
+      err = ret;
+   if (err == DGT_OK
+       && (defs->n_bbdefs != fork.n_bbdefs || defs->n_contexts != fork.n_contexts))
+      err = DGT_ERR_FORMAT;
+   return err;
+}
+
+/* Runs tasks 0 to n_tasks - 1 on n_threads threads, the calling thread
+ * being one of them, each taking the next task that nobody has taken yet.
+ * The first error stops the others from starting new tasks.
+ */
+typedef int (*dgt_task_fn)(void *arg, unsigned int worker, size_t task);
+
+typedef struct
+{
+   dgt_task_fn fn;
+   void *arg;
+   size_t n_tasks;
+   size_t next;
+   int err;
+} dgt_pool;
+
+typedef struct
+{
+   dgt_pool *pool;
+   unsigned int worker;
+} dgt_pool_worker;
+
+static void *pool_worker(void *arg)
+{
+   dgt_pool_worker *w = arg;
+   dgt_pool *pool = w->pool;
+
+   while (__atomic_load_n(&pool->err, __ATOMIC_RELAXED) == DGT_OK)
+   {
+      size_t task = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+      int err;
+
+      if (task >= pool->n_tasks)
+         break;
+      err = pool->fn(pool->arg, w->worker, task);
+      if (err != DGT_OK)
+      {
+         int expected = DGT_OK;
+         __atomic_compare_exchange_n(&pool->err, &expected, err, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+      }
+   }
+   return NULL;
+}
+
+static unsigned int pool_threads(unsigned int n_threads, size_t n_tasks)
+{
+   if (n_threads == 0)
+   {
+      long n = sysconf(_SC_NPROCESSORS_ONLN);
+      n_threads = n > 0 ? n : 1;
+   }
+   if (n_threads > n_tasks)
+      n_threads = n_tasks > 0 ? n_tasks : 1;
+   return n_threads;
+}
+
+static int run_pool(unsigned int n_threads, size_t n_tasks, dgt_task_fn fn, void *arg)
+{
+   dgt_pool pool;
+   dgt_pool_worker *workers;
+   pthread_t *threads;
+   unsigned int i, started;
+
+   pool.fn = fn;
+   pool.arg = arg;
+   pool.n_tasks = n_tasks;
+   pool.next = 0;
+   pool.err = DGT_OK;
+   workers = malloc(n_threads * sizeof(dgt_pool_worker));
+   threads = malloc(n_threads * sizeof(pthread_t));
+   if (workers == NULL || threads == NULL)
+   {
+      free(workers);
+      free(threads);
+      return DGT_ERR_NOMEM;
+   }
+   for (i = 0; i < n_threads; i++)
+   {
+      workers[i].pool = &pool;
+      workers[i].worker = i;
+   }
+   /* If a thread cannot be started, the others do its share */
+   for (started = 1; started < n_threads; started++)
+      if (pthread_create(&threads[started], NULL, pool_worker, &workers[started]) != 0)
+         break;
+   pool_worker(&workers[0]);
+   for (i = 1; i < started; i++)
+      pthread_join(threads[i], NULL);
+   free(workers);
+   free(threads);
+   return pool.err;
+}
+
+/* The stretches of the stream that are scanned or decoded separately:
+ * with an index, what comes before the first chunk and then each chunk,
+ * otherwise everything.
+ */
+static size_t n_stretches(const dgt_file *file)
+{
+   return file->has_index ? file->n_chunks + 1 : 1;
+}
+
+static void stretch(const dgt_file *file, size_t i, uint64_t *start, uint64_t *end)
+{
+   if (!file->has_index)
+   {
+      *start = file->header_size;
+      *end = file->stream_size;
+      return;
+   }
+   *start = i == 0 ? file->header_size : file->chunks[i - 1].offset;
+   if (i < file->n_chunks)
+      *end = file->chunks[i].offset;
+   else
+      *end = file->index_offset;
+}
+
+typedef struct
+{
+   const dgt_file *file;
+   dgt_defs *parts;          /* The definitions in each stretch */
+} dgt_prescan;
+
+static int prescan_task(void *arg, unsigned int worker, size_t task)
+{
+   dgt_prescan *prescan = arg;
+   dgt_defs *part = &prescan->parts[task];
+   dgt_cursor cursor;
+   dgt_record record;
+   uint64_t end;
+   int ret = 0;
+
+   (void) worker;
+   dgt_cursor_init(&cursor, prescan->file);
+   stretch(prescan->file, task, &cursor.pos, &end);
+   while (cursor.pos < end && (ret = dgt_cursor_next(&cursor, &record)) == 1)
+   {
+      if (record.type == DG_R_BBDEF)
+         ret = add_bbdef(prescan->file, part, &record);
+      else if (record.type == DG_R_CONTEXT)
+         ret = add_context(prescan->file, part, &record, 0);
+      else if (record.type == DG_R_FORK_DEFS)
+         ret = add_fork_defs(prescan->file, part, &record);
+      else
+         continue;
+      if (ret != DGT_OK)
+         return ret;
+   }
+   return ret < 0 ? ret : DGT_OK;
+}
+
+int dgt_defs_new(const dgt_file *file, unsigned int n_threads, dgt_defs **defs_out)
+{
+   dgt_prescan prescan;
+   dgt_defs *defs;
+   size_t n = n_stretches(file), i;
+   uint64_t j;
+   int err;
+
+   *defs_out = NULL;
+   defs = calloc(1, sizeof(dgt_defs));
+   prescan.file = file;
+   prescan.parts = calloc(n, sizeof(dgt_defs));
+   if (defs == NULL || prescan.parts == NULL)
+   {
+      free(defs);
+      free(prescan.parts);
+      return DGT_ERR_NOMEM;
+   }
+   err = run_pool(pool_threads(n_threads, n), n, prescan_task, &prescan);
+
+   /* Definitions are numbered in the order of the stream, so the parts
+    * are joined in order. The block definitions themselves are handed
+    * over; the contexts are small enough to copy.
+    */
+   for (i = 0; i < n; i++)
+   {
+      dgt_defs *part = &prescan.parts[i];
+
+      for (j = 0; err == DGT_OK && j < part->n_bbdefs; j++)
+      {
+         err = grow(&defs->bbdefs, defs->n_bbdefs, &defs->bbdefs_size,
+                    sizeof(dgt_bbdef_entry *));
+         if (err == DGT_OK)
+         {
+            defs->bbdefs[defs->n_bbdefs++] = part->bbdefs[j];
+            part->bbdefs[j] = NULL;
+         }
+      }
+      for (j = 0; err == DGT_OK && j < part->n_contexts; j++)
+      {
+         const dgt_context *context = defs_context(part, j);
+
+         if (context->bbdef_index >= defs->n_bbdefs)
+            err = DGT_ERR_FORMAT;
+         else
+            err = append_context(defs, context);
+      }
+      for (j = 0; j < part->n_parents; j++)
+      {
+         if (grow(&defs->parents, defs->n_parents, &defs->parents_size,
+                  sizeof(dgt_file *)) != DGT_OK)
+         {
+            dgt_close(part->parents[j]);
+            err = DGT_ERR_NOMEM;
+         }
+         else
+            defs->parents[defs->n_parents++] = part->parents[j];
+      }
+      /* Entries not handed over are NULL or left for freeing here */
+      for (j = 0; j < part->n_bbdefs; j++)
+         free(part->bbdefs[j]);
+      defs_clear(part, 0);
+   }
+   free(prescan.parts);
+   if (err != DGT_OK)
+   {
+      dgt_defs_free(defs);
+      return err;
+   }
+   *defs_out = defs;
+   return DGT_OK;
+}
+
+void dgt_defs_free(dgt_defs *defs)
+{
+   if (defs == NULL)
+      return;
+   defs_clear(defs, 1);
+   free(defs);
+}
+
+uint64_t dgt_defs_n_bbdefs(const dgt_defs *defs)
+{
+   return defs->n_bbdefs;
+}
+
+uint64_t dgt_defs_n_contexts(const dgt_defs *defs)
+{
+   return defs->n_contexts;
+}
+
+static int decoder_new(const dgt_file *file, const dgt_defs *defs, dgt_defs *own,
+                       dgt_decoder **decoder_out)
+{
+   dgt_decoder *decoder = calloc(1, sizeof(dgt_decoder));
+
+   *decoder_out = NULL;
+   if (decoder == NULL)
+      return DGT_ERR_NOMEM;
+   decoder->file = file;
+   dgt_cursor_init(&decoder->cursor, file);
+   decoder->end = file->stream_size;
+   decoder->mask = file->header.word_size == 8 ? ~(uint64_t) 0 : 0xFFFFFFFFU;
+   decoder->defs = defs;
+   decoder->own = own;
+   decoder->strided = (file->header.flags & DG_HEADER_STRIDED) != 0;
+   decoder->fetches = (file->header.flags & DG_HEADER_INSTRS) != 0;
+   decoder->tid = 1;
+   *decoder_out = decoder;
+   return DGT_OK;
+}
+
+int dgt_decoder_new(const dgt_file *file, dgt_decoder **decoder_out)
+{
+   dgt_defs *defs = calloc(1, sizeof(dgt_defs));
+   int err;
+
+   if (defs == NULL)
+   {
+      *decoder_out = NULL;
+      return DGT_ERR_NOMEM;
+   }
+   err = decoder_new(file, defs, defs, decoder_out);
+   if (err != DGT_OK)
+      free(defs);
+   return err;
+}
+
+int dgt_decoder_new_shared(const dgt_file *file, const dgt_defs *defs,
+                           dgt_decoder **decoder_out)
+{
+   return decoder_new(file, defs, NULL, decoder_out);
+}
+
+int dgt_decoder_seek_chunk(dgt_decoder *decoder, size_t chunk)
+{
+   uint64_t start;
+
+   if (decoder->own != NULL || !decoder->file->has_index || chunk >= decoder->file->n_chunks)
+      return DGT_ERR_INVALID;
+   stretch(decoder->file, chunk + 1, &start, &decoder->end);
+   decoder->cursor.pos = start;
+   decoder->have_last = 0;
+   decoder->repeats_left = 0;
+   return DGT_OK;
+}
+
+void dgt_decoder_free(dgt_decoder *decoder)
+{
+   uint64_t i;
+
+   if (decoder == NULL)
+      return;
+   dgt_defs_free(decoder->own);
+   for (i = 0; i < decoder->prev_size; i++)
+   {
+      free(decoder->prev[i]);
+      if (decoder->strides != NULL)
+         free(decoder->strides[i]);
+   }
+   free(decoder->prev);
+   free(decoder->strides);
+   free(decoder->prev_chunk);
+   free(decoder->accesses);
+   free(decoder->last_pos);
+   free(decoder->last_delta);
+   free(decoder->last_mask);
+   free(decoder);
+}
+
+uint64_t dgt_decoder_n_bbdefs(const dgt_decoder *decoder)
+{
+   return decoder->defs->n_bbdefs;
+}
+
+uint64_t dgt_decoder_n_contexts(const dgt_decoder *decoder)
+{
+   return decoder->defs->n_contexts;
+}
+
+const dgt_bbdef *dgt_decoder_bbdef(const dgt_decoder *decoder, uint64_t index)
+{
+   return index < decoder->defs->n_bbdefs ? &decoder->defs->bbdefs[index]->def : NULL;
+}
+
+const dgt_context *dgt_decoder_context(const dgt_decoder *decoder, uint64_t index)
+{
+   return index < decoder->defs->n_contexts ? defs_context(decoder->defs, index) : NULL;
+}
+
+uint32_t dgt_decoder_tid(const dgt_decoder *decoder)
+{
+   return decoder->tid;
+}
+
+uint32_t dgt_decoder_pid(const dgt_decoder *decoder)
+{
+   return decoder->pid;
+}
+
+uint64_t dgt_decoder_instrs(const dgt_decoder *decoder)
+{
+   return decoder->instrs;
+}
+
+static int reserve_run(dgt_decoder *decoder, uint64_t bbdef_index, uint32_t n,
+                       uint32_t n_out)
+{
+   if (bbdef_index >= decoder->prev_size)
+   {
+      uint64_t size = decoder->defs->n_bbdefs;
+      uint64_t **prev = realloc(decoder->prev, size * sizeof(uint64_t *));
+      uint64_t *prev_chunk;
+
+      if (prev == NULL)
+         return DGT_ERR_NOMEM;
+      decoder->prev = prev;
+      if (decoder->strided)
+      {
+         dgt_stride **strides = realloc(decoder->strides, size * sizeof(dgt_stride *));
+
+         if (strides == NULL)
+            return DGT_ERR_NOMEM;
+         decoder->strides = strides;
+         memset(strides + decoder->prev_size, 0,
+                (size - decoder->prev_size) * sizeof(dgt_stride *));
+      }
+      prev_chunk = realloc(decoder->prev_chunk, size * sizeof(uint64_t));
+      if (prev_chunk == NULL)
+         return DGT_ERR_NOMEM;
+      decoder->prev_chunk = prev_chunk;
+      memset(prev + decoder->prev_size, 0, (size - decoder->prev_size) * sizeof(uint64_t *));
+      decoder->prev_size = size;
+   }
+   if (decoder->prev[bbdef_index] == NULL)
+   {
+      decoder->prev[bbdef_index] = calloc(n > 0 ? n : 1, sizeof(uint64_t));
+      if (decoder->prev[bbdef_index] == NULL)
+         return DGT_ERR_NOMEM;
+      if (decoder->strided)
+      {
+         decoder->strides[bbdef_index] = calloc(n > 0 ? n : 1, sizeof(dgt_stride));
+         if (decoder->strides[bbdef_index] == NULL)
+            return DGT_ERR_NOMEM;
+      }
+      decoder->prev_chunk[bbdef_index] = decoder->chunk;
+   }
+
+   if (n_out > decoder->accesses_size)
+   {
+      dgt_access *accesses = realloc(decoder->accesses, n_out * sizeof(dgt_access));
+      if (accesses == NULL)
+         return DGT_ERR_NOMEM;
+      decoder->accesses = accesses;
+      decoder->accesses_size = n_out;
+   }
+   if (n > decoder->last_size)
+   {
+      uint32_t *pos = realloc(decoder->last_pos, n * sizeof(uint32_t));
+      uint64_t *delta, *mask;
+
+      if (pos == NULL)
+         return DGT_ERR_NOMEM;
+      decoder->last_pos = pos;
+      delta = realloc(decoder->last_delta, n * sizeof(uint64_t));
+      if (delta == NULL)
+         return DGT_ERR_NOMEM;
+      decoder->last_delta = delta;
+      mask = realloc(decoder->last_mask, n * sizeof(uint64_t));
+      if (mask == NULL)
+         return DGT_ERR_NOMEM;
+      decoder->last_mask = mask;
+      decoder->last_size = n;
+   }
+   return DGT_OK;
+}
+
+/* Adds the static accesses of its reached instructions with definition
+ * indices from *next up to (excluding) stop.
+ */
+static void add_statics(dgt_decoder *decoder, const dgt_bbdef *def, uint32_t n_instrs,
+                        uint32_t *next, uint32_t stop, uint32_t *n)
+{
+   for (; *next < stop; (*next)++)
+   {
+      const dgt_access_def *a = &def->accesses[*next];
+
+      if (a->is_static && a->iseq < n_instrs)
+      {
+         dgt_access *out = &decoder->accesses[(*n)++];
+         out->addr = a->static_addr;
+         out->iaddr = def->instrs[a->iseq].addr;
+         out->dir = a->dir;
+         out->size = a->size;
+         out->index = *next;
+         out->line_mask = 0;
+      }
+   }
+}
+
+/* Merges the fetches of the first n_instrs instructions into the n
+ * accesses of the run, each before the accesses of its instruction, and
+ * returns the new number of accesses.
+ */
+static uint32_t add_fetches(dgt_decoder *decoder, const dgt_bbdef *def, uint32_t n_instrs,
+                            uint32_t n)
+{
+   dgt_access *accesses = decoder->accesses;
+   uint32_t total = n + n_instrs;
+   uint32_t w = total;
+
+   /* From the end, so that the accesses are moved at most once */
+   while (n_instrs > 0)
+   {
+      dgt_access *out = &accesses[--w];
+
+      if (n > 0 && def->accesses[accesses[n - 1].index].iseq >= n_instrs - 1)
+         *out = accesses[--n];
+      else
+      {
+         const dgt_instr *instr = &def->instrs[--n_instrs];
+
+         out->addr = instr->addr;
+         out->iaddr = instr->addr;
+         out->dir = DG_ACC_EXEC;
+         out->size = instr->size;
+         out->index = n_instrs;
+         out->line_mask = 0;
+      }
+   }
+   return total;
+}
+
+static int stride_held(const dgt_stride *s)
+{
+   return s->hits >= (DG_STRIDE_MIN_HITS << s->shift);
+}
+
+/* As in the writer, which this must match exactly */
+static void stride_update(dgt_stride *s, uint64_t delta)
+{
+   if (delta == s->delta)
+   {
+      if (s->hits < 255)
+         s->hits++;
+   }
+   else
+   {
+      if (stride_held(s) && s->shift < DG_STRIDE_MAX_SHIFT)
+         s->shift++;
+      s->delta = delta;
+      s->hits = 0;
+   }
+}
+
+/* Decodes the last DG_R_BBRUN_STRIDED into the stored positions and
+ * deltas, with the strided positions that did not break taking their
+ * stride, and brings the strides up to date.
+ */
+static int read_strided(dgt_decoder *decoder, const dgt_bbdef_entry *bbd, dgt_stride *strides)
+{
+   const uint8_t *p = decoder->last_strided;
+   const uint8_t *end = decoder->last_end;
+   const uint8_t *breaks;
+   uint64_t head, n_slots, n_breaks, skip, next_break, i;
+
+   if ((p = dgt_get_uvarint(p, end, &head)) == NULL)
+      return DGT_ERR_FORMAT;
+   n_breaks = head >> 1;
+   n_slots = bbd->n_dynamic;
+   if ((head & 1) && (p = dgt_get_uvarint(p, end, &n_slots)) == NULL)
+      return DGT_ERR_FORMAT;
+   if (n_slots > bbd->n_dynamic || n_breaks > n_slots)
+      return DGT_ERR_FORMAT;
+   /* The positions of the breaks come before all the deltas */
+   breaks = p;
+   for (i = 0; i < n_breaks; i++)
+      if ((p = dgt_get_uvarint(p, end, &skip)) == NULL)
+         return DGT_ERR_FORMAT;
+   next_break = UINT64_MAX;
+   if (n_breaks > 0)
+   {
+      breaks = dgt_get_uvarint(breaks, end, &next_break);
+      n_breaks--;
+   }
+
+   for (i = 0; i < n_slots; i++)
+   {
+      dgt_stride *s = &strides[i];
+      int64_t delta;
+
+      if (i == next_break)
+      {
+         if (!stride_held(s))
+            return DGT_ERR_FORMAT;
+         next_break = UINT64_MAX;
+         if (n_breaks > 0)
+         {
+            breaks = dgt_get_uvarint(breaks, end, &skip);
+            next_break = i + 1 + skip;
+            n_breaks--;
+         }
+         if ((p = dgt_get_svarint(p, end, &delta)) == NULL)
+            return DGT_ERR_FORMAT;
+      }
+      else if (stride_held(s))
+         delta = (int64_t) s->delta;
+      else if ((p = dgt_get_svarint(p, end, &delta)) == NULL)
+         return DGT_ERR_FORMAT;
+      decoder->last_pos[i] = i;
+      decoder->last_delta[i] = (uint64_t) delta;
+      stride_update(s, (uint64_t) delta);
+   }
+   if (p != end || next_break != UINT64_MAX)
+      return DGT_ERR_FORMAT;
+   decoder->n_last = n_slots;
+   return DGT_OK;
+}
+
+/* Applies the stored positions and deltas of the last run record, which
+ * is how a run is decoded and also how each of its repeats is.
+ */
+static int replay_run(dgt_decoder *decoder, const dgt_record *record, dgt_run *run)
+{
+   const dgt_context *context = defs_context(decoder->defs, decoder->last_context);
+   const dgt_bbdef_entry *bbd = decoder->defs->bbdefs[context->bbdef_index];
+   const dgt_bbdef *def = &bbd->def;
+   uint64_t *prev = decoder->prev[context->bbdef_index];
+   dgt_stride *strides = decoder->strided ? decoder->strides[context->bbdef_index] : NULL;
+   uint32_t n = 0, next = 0, i;
+
+   if (decoder->prev_chunk[context->bbdef_index] != decoder->chunk)
+   {
+      memset(prev, 0, def->n_accesses * sizeof(uint64_t));
+      if (strides != NULL)
+         memset(strides, 0, def->n_accesses * sizeof(dgt_stride));
+      decoder->prev_chunk[context->bbdef_index] = decoder->chunk;
+   }
+   if (decoder->last_strided != NULL)
+   {
+      int err;
+
+      if (strides == NULL)
+         return DGT_ERR_FORMAT;
+      err = read_strided(decoder, bbd, strides);
+      if (err != DGT_OK)
+         return err;
+   }
+   else if (strides != NULL && !decoder->last_filtered)
+      for (i = 0; i < decoder->n_last; i++)
+         stride_update(&strides[i], decoder->last_delta[i]);
+   for (i = 0; i < decoder->n_last; i++)
+   {
+      uint32_t pos = decoder->last_pos[i];
+      uint32_t index = decoder->last_filtered ? pos : bbd->dynamic[pos];
+      const dgt_access_def *a = &def->accesses[index];
+      dgt_access *out;
+
+      add_statics(decoder, def, decoder->last_instrs, &next, index, &n);
+      out = &decoder->accesses[n++];
+      prev[pos] = (prev[pos] + decoder->last_delta[i]) & decoder->mask;
+      out->addr = prev[pos];
+      out->iaddr = def->instrs[a->iseq].addr;
+      out->dir = a->dir;
+      out->size = a->size;
+      out->index = index;
+      out->line_mask = decoder->last_lines ? decoder->last_mask[i] : 0;
+      if (out->line_mask != 0)
+      {
+         int lo = __builtin_ctzll(out->line_mask);
+
+         out->addr += lo;
+         out->size = 64 - lo - __builtin_clzll(out->line_mask);
+      }
+      next = index + 1;
+   }
+   add_statics(decoder, def, decoder->last_instrs, &next, def->n_accesses, &n);
+   if (decoder->fetches)
+      n = add_fetches(decoder, def, decoder->last_instrs, n);
+
+   run->offset = record->offset;
+   run->context_index = decoder->last_context;
+   run->bbdef_index = context->bbdef_index;
+   run->context = context;
+   run->bbdef = def;
+   run->tid = decoder->tid;
+   run->n_instrs = decoder->last_instrs;
+   run->n_accesses = n;
+   run->accesses = decoder->accesses;
+   decoder->instrs += decoder->last_instrs;
+   return DGT_OK;
+}
+
+/* Parses a run record into the stored positions and deltas */
+static int read_run(dgt_decoder *decoder, const dgt_record *record)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   const dgt_context *context;
+   const dgt_bbdef_entry *bbd;
+   uint64_t context_index, n_instrs;
+   uint32_t n = 0, limit;
+   uint64_t pos = 0;
+   int lines = record->type == DG_R_BBRUN_LINES;
+   int filtered = record->type == DG_R_BBRUN_FILTERED || lines;
+   int err;
+
+   decoder->last_strided = NULL;
+   if ((p = dgt_get_uvarint(p, end, &context_index)) == NULL || p == end
+       || context_index >= decoder->defs->n_contexts)
+      return DGT_ERR_FORMAT;
+   context = defs_context(decoder->defs, context_index);
+   bbd = decoder->defs->bbdefs[context->bbdef_index];
+   if ((p = dgt_get_uvarint(p, end, &n_instrs)) == NULL || n_instrs > bbd->def.n_instrs)
+      return DGT_ERR_FORMAT;
+   decoder->last_instrs = n_instrs;
+   limit = filtered ? bbd->def.n_accesses : bbd->n_dynamic;
+   err = reserve_run(decoder, context->bbdef_index, bbd->def.n_accesses,
+                     bbd->def.n_accesses + (decoder->fetches ? bbd->def.n_instrs : 0));
+   if (err != DGT_OK)
+      return err;
+   if (record->type == DG_R_BBRUN_STRIDED)
+   {
+      /* Decoded by replay_run, once the strides are known */
+      decoder->last_strided = p;
+      decoder->last_end = end;
+      end = p;
+   }
+
+   while (p < end)
+   {
+      int64_t delta;
+
+      if (filtered)
+      {
+         uint64_t skip;
+         if ((p = dgt_get_uvarint(p, end, &skip)) == NULL)
+            return DGT_ERR_FORMAT;
+         pos += skip;
+      }
+      if (pos >= limit || (p = dgt_get_svarint(p, end, &delta)) == NULL)
+         return DGT_ERR_FORMAT;
+      if (lines)
+      {
+         uint64_t form, mask = 0;
+
+         if ((p = dgt_get_uvarint(p, end, &form)) == NULL)
+            return DGT_ERR_FORMAT;
+         if (form & 1)
+         {
+            /* Contiguous bytes, as (first << 6 | count - 1) */
+            unsigned int lo = (form >> 7) & 63, len = ((form >> 1) & 63) + 1;
+
+            if (form >> 13 || lo + len > 64)
+               return DGT_ERR_FORMAT;
+            mask = (len == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << len) - 1) << lo;
+         }
+         else if (form == 2)
+         {
+            if ((p = dgt_get_uvarint(p, end, &mask)) == NULL || mask == 0)
+               return DGT_ERR_FORMAT;
+         }
+         else if (form != 0)
+            return DGT_ERR_FORMAT;
+         decoder->last_mask[n] = mask;
+      }
+      decoder->last_pos[n] = pos;
+      decoder->last_delta[n] = (uint64_t) delta;
+      n++;
+      pos++;
+   }
+   decoder->last_context = context_index;
+   decoder->last_filtered = filtered;
+   decoder->last_lines = lines;
+   decoder->n_last = n;
+   decoder->have_last = 1;
+   return DGT_OK;
+}
+
+static int read_chunk(dgt_decoder *decoder, const dgt_record *record)
+{
+   const uint8_t *p = record->payload;
+   const uint8_t *end = p + record->length;
+   uint64_t chunk, instrs, tid;
+
+   if ((p = dgt_get_uvarint(p, end, &chunk)) == NULL
+       || (p = dgt_get_uvarint(p, end, &instrs)) == NULL
+       || (p = dgt_get_uvarint(p, end, &tid)) == NULL)
+      return DGT_ERR_FORMAT;
+   decoder->chunk++;
+   decoder->instrs = instrs;
+   decoder->tid = tid;
+   decoder->have_last = 0;
+   return DGT_OK;
+}
+
+int dgt_decoder_next(dgt_decoder *decoder, dgt_record *record, dgt_run *run)
+{
+   int ret, err = DGT_OK;
+   uint64_t value;
+
+   if (decoder->repeats_left > 0)
+   {
+      decoder->repeats_left--;
+      *record = decoder->repeat_record;
+      err = replay_run(decoder, record, run);
+      return err != DGT_OK ? err : DGT_ITEM_RUN;
+   }
+
+   if (decoder->cursor.pos >= decoder->end)
+      return 0;
+   ret = dgt_cursor_next(&decoder->cursor, record);
+   if (ret != 1)
+      return ret;
+   switch (record->type)
+   {
+   case DG_R_BBDEF:
+      if (decoder->own != NULL)
+         err = add_bbdef(decoder->file, decoder->own, record);
+      break;
+   case DG_R_CONTEXT:
+      if (decoder->own != NULL)
+         err = add_context(decoder->file, decoder->own, record, 1);
+      break;
+   case DG_R_FORK_DEFS:
+      if (decoder->own != NULL)
+         err = add_fork_defs(decoder->file, decoder->own, record);
+      break;
+   case DG_R_CHUNK:
+      err = read_chunk(decoder, record);
+      break;
+   case DG_R_THREAD:
+      if (dgt_get_uvarint(record->payload, record->payload + record->length, &value) == NULL)
+         err = DGT_ERR_FORMAT;
+      else
+         decoder->tid = value;
+      break;
+   case DG_R_PROCESS:
+      if (dgt_get_uvarint(record->payload, record->payload + record->length, &value) == NULL)
+         err = DGT_ERR_FORMAT;
+      else
+         decoder->pid = value;
+      break;
+   case DG_R_BBRUN:
+   case DG_R_BBRUN_FILTERED:
+   case DG_R_BBRUN_STRIDED:
+   case DG_R_BBRUN_LINES:
+      err = read_run(decoder, record);
+      if (err == DGT_OK)
+         err = replay_run(decoder, record, run);
+      if (err != DGT_OK)
+         break;
+      return DGT_ITEM_RUN;
+   case DG_R_BBREPEAT:
+      if (!decoder->have_last || record->payload[0] == 0)
+      {
+         err = DGT_ERR_FORMAT;
+         break;
+      }
+      decoder->repeats_left = record->payload[0] - 1;
+      decoder->repeat_record = *record;
+      err = replay_run(decoder, record, run);
+      if (err != DGT_OK)
+         break;
+      return DGT_ITEM_RUN;
+   default:
+      break;
+   }
+   if (err != DGT_OK)
+   {
+      /* Leave the cursor on the bad record */
+      decoder->cursor.pos = record->offset;
+      return err;
+   }
+   return DGT_ITEM_RECORD;
+}
+
+static int grow_column(void *array_ptr, uint64_t capacity, size_t elem_size)
+{
+   void **array = array_ptr;
+   void *grown = realloc(*array, capacity * elem_size);
+
+   if (grown == NULL)
+      return DGT_ERR_NOMEM;
+   *array = grown;
+   return DGT_OK;
+}
+
+/* Makes room for n rows in every column */
+static int columns_reserve(dgt_columns *c, uint64_t n)
+{
+   uint64_t capacity = c->capacity > 0 ? c->capacity : 65536;
+
+   if (n <= c->capacity)
+      return DGT_OK;
+   while (capacity < n)
+      capacity *= 2;
+   if (grow_column(&c->addr, capacity, sizeof(*c->addr)) != DGT_OK
+       || grow_column(&c->size, capacity, sizeof(*c->size)) != DGT_OK
+       || grow_column(&c->dir, capacity, sizeof(*c->dir)) != DGT_OK
+       || grow_column(&c->context, capacity, sizeof(*c->context)) != DGT_OK
+       || grow_column(&c->instrs, capacity, sizeof(*c->instrs)) != DGT_OK
+       || grow_column(&c->tid, capacity, sizeof(*c->tid)) != DGT_OK)
+      return DGT_ERR_NOMEM;
+   c->capacity = capacity;
+   return DGT_OK;
+}
+
+int dgt_decode_columns(dgt_decoder *decoder, dgt_columns *columns)
+{
+   dgt_record record;
+   dgt_run run;
+   int ret;
+
+   columns->n_rows = 0;
+   while ((ret = dgt_decoder_next(decoder, &record, &run)) > 0)
+   {
+      uint64_t instrs, n;
+      uint32_t j;
+
+      if (ret != DGT_ITEM_RUN)
+         continue;
+      n = columns->n_rows;
+      ret = columns_reserve(columns, n + run.n_accesses);
+      if (ret != DGT_OK)
+         return ret;
+      instrs = dgt_decoder_instrs(decoder) - run.n_instrs;
+      for (j = 0; j < run.n_accesses; j++)
+      {
+         const dgt_access *a = &run.accesses[j];
+
+         columns->addr[n + j] = a->addr;
+         columns->size[n + j] = a->size;
+         columns->dir[n + j] = a->dir;
+         columns->context[n + j] = run.context_index;
+         columns->instrs[n + j] = instrs;
+         columns->tid[n + j] = run.tid;
+      }
+      columns->n_rows = n + run.n_accesses;
+   }
+   return ret;
+}
+
+void dgt_columns_free(dgt_columns *columns)
+{
+   free(columns->addr);
+   free(columns->size);
+   free(columns->dir);
+   free(columns->context);
+   free(columns->instrs);
+   free(columns->tid);
+   memset(columns, 0, sizeof(*columns));
+}
+
+typedef struct
+{
+   const dgt_file *file;
+   const dgt_defs *defs;
+   const dgt_parallel_ops *ops;
+   dgt_decoder **decoders;   /* One per worker */
+   void **workers;
+} dgt_parallel;
+
+static int parallel_task(void *arg, unsigned int worker, size_t task)
+{
+   dgt_parallel *par = arg;
+   dgt_decoder *decoder = par->decoders[worker];
+   dgt_record record;
+   dgt_run run;
+   int ret;
+
+   if (par->file->has_index)
+   {
+      ret = dgt_decoder_seek_chunk(decoder, task);
+      if (ret != DGT_OK)
+         return ret;
+   }
+   while ((ret = dgt_decoder_next(decoder, &record, &run)) > 0)
+   {
+      int stop = par->ops->item(par->workers[worker], decoder, ret, &record, &run);
+      if (stop != 0)
+         return stop;
+   }
+   return ret;
+}
+
+int dgt_decode_parallel(const dgt_file *file, const dgt_defs *defs, unsigned int n_threads,
+                        const dgt_parallel_ops *ops)
+{
+   dgt_parallel par;
+   size_t n_tasks = file->has_index ? file->n_chunks : 1;
+   unsigned int i;
+   int err = DGT_OK;
+
+   n_threads = pool_threads(n_threads, n_tasks);
+   par.file = file;
+   par.defs = defs;
+   par.ops = ops;
+   par.decoders = calloc(n_threads, sizeof(dgt_decoder *));
+   par.workers = calloc(n_threads, sizeof(void *));
+   if (par.decoders == NULL || par.workers == NULL)
+      err = DGT_ERR_NOMEM;
+   for (i = 0; err == DGT_OK && i < n_threads; i++)
+   {
+      err = dgt_decoder_new_shared(file, defs, &par.decoders[i]);
+      if (err == DGT_OK && (par.workers[i] = ops->worker_new(ops->arg)) == NULL)
+         err = DGT_ERR_NOMEM;
+   }
+   if (err == DGT_OK && n_tasks > 0)
+      err = run_pool(n_threads, n_tasks, parallel_task, &par);
+   for (i = 0; par.workers != NULL && i < n_threads; i++)
+      if (par.workers[i] != NULL)
+         ops->merge(ops->arg, par.workers[i]);
+   for (i = 0; par.decoders != NULL && i < n_threads; i++)
+      dgt_decoder_free(par.decoders[i]);
+   free(par.decoders);
+   free(par.workers);
+   return err;
+}
+
+struct dgt_addr_index
+{
+   const dgt_file *file;
+   void *map;
+   size_t map_size;
+   unsigned int page_shift;
+   uint64_t n_contexts;
+   uint64_t n_pages;
+   const uint8_t *contexts;  /* Offset of the record of each context */
+   const uint8_t *pages;     /* {page, offset of its postings}, by page */
+   const uint8_t *postings;
+   uint64_t postings_size;
+};
+
+/* The index is always little-endian, whatever the trace is */
+static uint64_t get_le64(const uint8_t *p)
+{
+   uint64_t value = 0;
+   int i;
+
+   for (i = 7; i >= 0; i--)
+      value = (value << 8) | p[i];
+   return value;
+}
+
+int dgt_addr_index_open(const char *filename, const dgt_file *file,
+                        dgt_addr_index **index_out)
+{
+   dgt_addr_index *index;
+   const uint8_t *h;
+   uint64_t contexts_offset, pages_offset, postings_end;
+   int err;
+
+   *index_out = NULL;
+   index = calloc(1, sizeof(dgt_addr_index));
+   if (index == NULL)
+      return DGT_ERR_NOMEM;
+   err = map_file(filename, &index->map, &index->map_size);
+   if (err != DGT_OK)
+   {
+      int saved = errno;
+
+      free(index);
+      errno = saved;
+      return err;
+   }
+   index->file = file;
+   h = index->map;
+   if (index->map_size < DGT_ADDR_INDEX_HEADER_SIZE
+       || memcmp(h, DGT_ADDR_INDEX_MAGIC, 8) != 0)
+   {
+      dgt_addr_index_close(index);
+      return DGT_ERR_FORMAT;
+   }
+   /* Built for another trace, or before the trace was written again */
+   if (get_le64(h + 8) != file->stream_size || get_le64(h + 16) != file->n_chunks)
+   {
+      dgt_addr_index_close(index);
+      return DGT_ERR_INVALID;
+   }
+   index->n_contexts = get_le64(h + 24);
+   index->n_pages = get_le64(h + 32);
+   index->page_shift = (unsigned int) get_le64(h + 40);
+   contexts_offset = get_le64(h + 48);
+   pages_offset = get_le64(h + 56);
+   postings_end = get_le64(h + 64);
+   if (index->page_shift >= 64
+       || contexts_offset > index->map_size
+       || index->n_contexts > (index->map_size - contexts_offset) / 8
+       || pages_offset > index->map_size
+       || index->n_pages > (index->map_size - pages_offset) / 16
+       || postings_end > index->map_size
+       || postings_end < pages_offset + index->n_pages * 16)
+   {
+      dgt_addr_index_close(index);
+      return DGT_ERR_FORMAT;
+   }
+   index->contexts = h + contexts_offset;
+   index->pages = h + pages_offset;
+   index->postings = index->pages + index->n_pages * 16;
+   index->postings_size = postings_end - (pages_offset + index->n_pages * 16);
+   *index_out = index;
+   return DGT_OK;
+}
+
+void dgt_addr_index_close(dgt_addr_index *index)
+{
+   if (index == NULL)
+      return;
+   if (index->map != NULL)
+      munmap(index->map, index->map_size);
+   free(index);
+}
+
+unsigned int dgt_addr_index_page_shift(const dgt_addr_index *index)
+{
+   return index->page_shift;
+}
+
+uint64_t dgt_addr_index_n_contexts(const dgt_addr_index *index)
+{
+   return index->n_contexts;
+}
+
+static int cmp_posting(const void *a, const void *b)
+{
+   const dgt_posting *pa = a, *pb = b;
+
+   if (pa->chunk != pb->chunk)
+      return pa->chunk < pb->chunk ? -1 : 1;
+   if (pa->context != pb->context)
+      return pa->context < pb->context ? -1 : 1;
+   return 0;
+}
+
+/* Appends the postings of page i, which are in order */
+static int read_postings(const dgt_addr_index *index, uint64_t i, dgt_posting **postings,
+                         size_t *n, uint64_t *size)
+{
+   uint64_t start = get_le64(index->pages + i * 16 + 8);
+   uint64_t stop = i + 1 < index->n_pages
+                   ? get_le64(index->pages + (i + 1) * 16 + 8) : index->postings_size;
+   const uint8_t *p = index->postings + start;
+   const uint8_t *end = index->postings + stop;
+   uint64_t chunk = 0;
+
+   if (start > stop || stop > index->postings_size)
+      return DGT_ERR_FORMAT;
+   while (p < end)
+   {
+      uint64_t delta, n_contexts, context = 0;
+
+      if ((p = dgt_get_uvarint(p, end, &delta)) == NULL
+          || (p = dgt_get_uvarint(p, end, &n_contexts)) == NULL
+          || n_contexts > (uint64_t) (end - p))
+         return DGT_ERR_FORMAT;
+      chunk += delta;
+      while (n_contexts-- > 0)
+      {
+         int err;
+
+         if ((p = dgt_get_uvarint(p, end, &delta)) == NULL)
+            return DGT_ERR_FORMAT;
+         context += delta;
+         if (context >= index->n_contexts)
+            return DGT_ERR_FORMAT;
+         err = grow(postings, *n, size, sizeof(dgt_posting));
+         if (err != DGT_OK)
+            return err;
+         (*postings)[*n].chunk = chunk;
+         (*postings)[*n].context = context;
+         (*n)++;
+      }
+   }
+   return DGT_OK;
+}
+
+int dgt_addr_index_query(const dgt_addr_index *index, uint64_t lo, uint64_t hi,
+                         dgt_posting **postings_out, size_t *n_out)
+{
+   uint64_t first, last, l = 0, r = index->n_pages, size = 0;
+   dgt_posting *postings = NULL;
+   size_t n = 0, pages = 0, i, j;
+   int err = DGT_OK;
+
+   *postings_out = NULL;
+   *n_out = 0;
+   if (hi <= lo)
+      return DGT_ERR_INVALID;
+   first = lo >> index->page_shift;
+   last = (hi - 1) >> index->page_shift;
+   /* The first page listed that is not before the range */
+   while (l < r)
+   {
+      uint64_t mid = l + (r - l) / 2;
+
+      if (get_le64(index->pages + mid * 16) < first)
+         l = mid + 1;
+      else
+         r = mid;
+   }
+   for (; err == DGT_OK && l < index->n_pages
+          && get_le64(index->pages + l * 16) <= last; l++, pages++)
+      err = read_postings(index, l, &postings, &n, &size);
+   if (err != DGT_OK)
+   {
+      free(postings);
+      return err;
+   }
+   /* Each page is in order by itself, but they overlap */
+   if (pages > 1)
+   {
+      qsort(postings, n, sizeof(dgt_posting), cmp_posting);
+      for (i = j = 0; i < n; i++)
+         if (j == 0 || cmp_posting(&postings[j - 1], &postings[i]) != 0)
+            postings[j++] = postings[i];
+      n = j;
+   }
+   *postings_out = postings;
+   *n_out = n;
+   return DGT_OK;
+}
+
+int dgt_addr_index_context(const dgt_addr_index *index, uint64_t i, dgt_context *context)
+{
+   dgt_cursor cursor;
+   dgt_record record;
+   int ret;
+
+   if (i >= index->n_contexts)
+      return DGT_ERR_INVALID;
+   dgt_cursor_init(&cursor, index->file);
+   dgt_cursor_seek(&cursor, get_le64(index->contexts + i * 8));
+   ret = dgt_cursor_next(&cursor, &record);
+   if (ret < 0)
+      return ret;
+   if (ret == 0 || record.type != DG_R_CONTEXT)
+      return DGT_ERR_FORMAT;
+   return parse_context(index->file, &record, context);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
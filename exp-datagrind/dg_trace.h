@@ -0,0 +1,441 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: reader library for traces.              dg_trace.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+/* libdgtrace reads the files written by Datagrind, so that programs that
+ * analyse them need not parse the format themselves. It is an ordinary
+ * host library, not part of the tool.
+ *
+ * A dgt_file maps the trace into memory, and records are handed out as
+ * pointers into the mapping rather than copied. A compressed trace is
+ * decompressed into memory when it is opened, so only an uncompressed
+ * trace is read without copying. A dgt_cursor walks the records, and a
+ * dgt_decoder additionally keeps the block definitions and contexts, and
+ * turns each run (including each repeat of one) into the list of its
+ * accesses, with the direction, size and instruction of each. If the
+ * trace was written with --datagrind-trace-instr=yes, the list also has
+ * the fetch of each instruction, before its accesses.
+ *
+ * An open dgt_file is never modified, so several threads may read it at
+ * once, each with its own cursors and decoders. dgt_decode_parallel does
+ * that for a trace with an index: the block definitions and contexts are
+ * first gathered into a dgt_defs, which is shared by all the decoders
+ * without locking, and then the chunks are handed out to a pool of
+ * threads. Programs using it must be linked with -pthread.
+ *
+ * dgt_decode_columns instead gathers the accesses of a chunk into an array
+ * per field, which is what dgtrace.py hands to Python as NumPy arrays,
+ * through libdgtrace.so.
+ *
+ * Functions that can fail return a DGT_ERR_* code, which is negative.
+ */
+
+#ifndef __DG_TRACE_H
+#define __DG_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dg_record.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DGT_OK              0
+#define DGT_ERR_IO         -1   /* errno gives the reason */
+#define DGT_ERR_NOMEM      -2
+#define DGT_ERR_FORMAT     -3   /* Not a Datagrind trace, or corrupt */
+#define DGT_ERR_VERSION    -4   /* A version this library does not read */
+#define DGT_ERR_TRUNCATED  -5   /* The trace ends part way through a record */
+#define DGT_ERR_INVALID    -6
+
+/* The file version that is read */
+#define DGT_FILE_VERSION    12
+
+typedef struct dgt_file dgt_file;
+typedef struct dgt_decoder dgt_decoder;
+typedef struct dgt_defs dgt_defs;
+
+typedef struct
+{
+   uint8_t version;
+   uint8_t big_endian;
+   uint8_t word_size;        /* 4 or 8 */
+   uint8_t compression;      /* DG_COMPRESS_NONE or DG_COMPRESS_LZO */
+   uint64_t flags;           /* DG_HEADER_* */
+   char tool_version[32];    /* Of the Valgrind that wrote it, cut short */
+} dgt_header;
+
+typedef struct
+{
+   uint8_t type;             /* DG_R_* */
+   uint64_t offset;          /* Of the record in the stream */
+   uint64_t length;          /* Of the payload */
+   const uint8_t *payload;   /* Points into the stream */
+} dgt_record;
+
+typedef struct
+{
+   const dgt_file *file;
+   uint64_t pos;
+} dgt_cursor;
+
+/* An entry of the index */
+typedef struct
+{
+   uint64_t offset;          /* Of the DG_R_CHUNK record */
+   uint64_t instrs;
+   uint32_t n_labels;
+   const char *labels;       /* n_labels nul-terminated strings, in a row */
+} dgt_chunk;
+
+typedef struct
+{
+   uint64_t addr;
+   uint8_t size;
+} dgt_instr;
+
+typedef struct
+{
+   uint8_t dir;              /* DG_ACC_READ, DG_ACC_WRITE or DG_ACC_ATOMIC */
+   uint32_t size;
+   uint32_t iseq;            /* Index of the instruction */
+   uint8_t is_static;        /* At static_addr in every run */
+   uint64_t static_addr;
+} dgt_access_def;
+
+typedef struct
+{
+   uint32_t n_instrs;
+   uint32_t n_accesses;
+   const dgt_instr *instrs;
+   const dgt_access_def *accesses;
+} dgt_bbdef;
+
+typedef struct
+{
+   uint64_t bbdef_index;
+   uint32_t n_stack;
+   const uint8_t *stack;     /* n_stack words, as in the file; see dgt_context_ip */
+} dgt_context;
+
+typedef struct
+{
+   uint64_t addr;
+   uint64_t iaddr;           /* Of the instruction making the access */
+   uint8_t dir;              /* DG_ACC_EXEC for the fetch of an instruction */
+   uint32_t size;
+   uint32_t index;           /* In the block definition, of the instruction if a fetch */
+   /* For accesses merged by --datagrind-granularity=line, the bytes of the
+    * line touched, of which addr and size give the span. Otherwise 0.
+    */
+   uint64_t line_mask;
+} dgt_access;
+
+typedef struct
+{
+   uint64_t offset;          /* Of the run record, or of the repeat */
+   uint64_t context_index;
+   uint64_t bbdef_index;
+   const dgt_context *context;
+   const dgt_bbdef *bbdef;
+   uint32_t tid;
+   uint32_t n_instrs;        /* Instructions executed in the run */
+   uint32_t n_accesses;
+   const dgt_access *accesses;  /* Valid until the decoder is next used */
+} dgt_run;
+
+typedef struct
+{
+   uint64_t key;             /* Context index, or range number from 0 */
+   uint64_t accesses;
+} dgt_event_count;
+
+/* A DG_R_START_EVENT or DG_R_END_EVENT, with the summary of the event
+ * if it is an end written with --datagrind-event-stats=yes.
+ */
+typedef struct
+{
+   uint64_t instrs;
+   const char *label;        /* Points into the record; not nul-terminated */
+   size_t label_len;
+   int has_summary;
+   uint64_t reads, writes;
+   uint64_t read_bytes, write_bytes;
+   uint64_t lines;           /* Distinct 64-byte lines touched */
+   uint32_t n_contexts;      /* Those with the most accesses, most first */
+   uint32_t n_ranges;
+   dgt_event_count contexts[DG_EVENT_TOP_MAX];
+   dgt_event_count ranges[DG_EVENT_TOP_MAX];
+} dgt_event;
+
+/* A DG_R_BULK_ACCESS: a memcpy, memmove or memset of size bytes */
+typedef struct
+{
+   uint8_t op;               /* DG_BULK_COPY or DG_BULK_SET */
+   uint64_t dst;             /* Written */
+   uint64_t src;             /* Read, for DG_BULK_COPY */
+   uint64_t size;
+} dgt_bulk;
+
+/* A DG_R_FORK_DEFS: the trace of a forked child takes the definitions
+ * written before the fork from its parent's trace, or one written with
+ * --datagrind-defs-cache (with a parent_pid of 0) those of the cache.
+ */
+typedef struct
+{
+   uint32_t parent_pid;
+   uint64_t end;             /* Stream offset in the parent's trace */
+   uint64_t n_bbdefs;        /* Definitions the parent had by then */
+   uint64_t n_contexts;
+   const char *parent;       /* File name; points into the record */
+} dgt_fork_defs;
+
+/* A DG_R_LOCK: a lock taken or given up, in the thread of the decoder */
+typedef struct
+{
+   uint8_t action;           /* DG_LOCK_ACQUIRE, _ACQUIRE_SHARED or _RELEASE */
+   uint8_t kind;             /* DG_LOCK_MUTEX, _RWLOCK or _SPIN */
+   uint64_t addr;
+} dgt_lock;
+
+/* The accesses of a stretch of runs, one array per field, in the order
+ * of the runs, as dg_convert writes them. The arrays belong to the
+ * columns and are grown as needed; instrs is the number of instructions
+ * executed before the run making the access.
+ */
+typedef struct
+{
+   uint64_t n_rows;
+   uint64_t capacity;
+   uint64_t *addr;
+   uint32_t *size;
+   uint8_t *dir;
+   uint64_t *context;
+   uint64_t *instrs;
+   uint32_t *tid;
+} dgt_columns;
+
+/* What dgt_decoder_next returns, other than 0 at the end or an error */
+#define DGT_ITEM_RECORD     1
+#define DGT_ITEM_RUN        2
+
+const char *dgt_strerror(int err);
+
+/* Opening and closing */
+int dgt_open(const char *filename, dgt_file **file);
+void dgt_close(dgt_file *file);
+
+const dgt_header *dgt_file_header(const dgt_file *file);
+/* The record stream is the header followed by the records, without any
+ * compression frames. Offsets in the trace are positions in it.
+ */
+const uint8_t *dgt_file_stream(const dgt_file *file);
+uint64_t dgt_file_stream_size(const dgt_file *file);
+
+/* The index is read from the trace if it was finished properly. For one
+ * that was not, as when Valgrind was killed, it is rebuilt from the chunk
+ * records, and dgt_file_dropped gives the bytes at the end that were cut
+ * short and are left out of the stream. n_chunks is the number of entries,
+ * and has_index is 0 if there are none.
+ */
+int dgt_file_has_index(const dgt_file *file);
+int dgt_file_finished(const dgt_file *file);
+uint64_t dgt_file_dropped(const dgt_file *file);
+size_t dgt_file_n_chunks(const dgt_file *file);
+const dgt_chunk *dgt_file_chunk(const dgt_file *file, size_t i);
+
+/* Values in payloads, in the file's byte order and word size. A uvarint
+ * or svarint is decoded from p, which must be before end, and the
+ * position after it is returned, or NULL if it does not end before end.
+ */
+uint64_t dgt_get_word(const dgt_file *file, const uint8_t *p);
+const uint8_t *dgt_get_uvarint(const uint8_t *p, const uint8_t *end, uint64_t *value);
+const uint8_t *dgt_get_svarint(const uint8_t *p, const uint8_t *end, int64_t *value);
+uint64_t dgt_context_ip(const dgt_file *file, const dgt_context *context, uint32_t i);
+/* Reads a DG_R_START_EVENT or DG_R_END_EVENT record */
+int dgt_parse_event(const dgt_record *record, dgt_event *event);
+/* Reads a DG_R_BULK_ACCESS record */
+int dgt_parse_bulk(const dgt_file *file, const dgt_record *record, dgt_bulk *bulk);
+/* Reads a DG_R_LOCK record */
+int dgt_parse_lock(const dgt_file *file, const dgt_record *record, dgt_lock *lock);
+/* Reads a DG_R_FORK_DEFS record */
+int dgt_parse_fork_defs(const dgt_record *record, dgt_fork_defs *fork);
+/* Opens the parent's trace named by a DG_R_FORK_DEFS of file: as named,
+ * or else by its last component in the directory of file, where the
+ * traces may have been moved together. It must have the same byte order
+ * and word size.
+ */
+int dgt_open_parent(const dgt_file *file, const dgt_fork_defs *fork, dgt_file **parent);
+
+/* Records. dgt_cursor_init places the cursor at the first record after
+ * the header; dgt_cursor_seek at any record. dgt_cursor_next returns 1
+ * and fills in record, 0 at the end of the stream, or an error.
+ */
+void dgt_cursor_init(dgt_cursor *cursor, const dgt_file *file);
+void dgt_cursor_seek(dgt_cursor *cursor, uint64_t offset);
+int dgt_cursor_next(dgt_cursor *cursor, dgt_record *record);
+
+/* Decoding from the start of the trace. dgt_decoder_next returns
+ * DGT_ITEM_RUN for each run and each repeat of one, filling in run and
+ * record (the run or repeat record), and DGT_ITEM_RECORD for each other
+ * record, after using it to keep the decoder's state up to date.
+ * Definitions stay valid until the decoder is freed. Those of a
+ * DG_R_FORK_DEFS are read from the parent's trace, which stays open with
+ * them.
+ */
+int dgt_decoder_new(const dgt_file *file, dgt_decoder **decoder);
+void dgt_decoder_free(dgt_decoder *decoder);
+int dgt_decoder_next(dgt_decoder *decoder, dgt_record *record, dgt_run *run);
+
+uint64_t dgt_decoder_n_bbdefs(const dgt_decoder *decoder);
+uint64_t dgt_decoder_n_contexts(const dgt_decoder *decoder);
+const dgt_bbdef *dgt_decoder_bbdef(const dgt_decoder *decoder, uint64_t index);
+const dgt_context *dgt_decoder_context(const dgt_decoder *decoder, uint64_t index);
+/* The thread of the next run */
+uint32_t dgt_decoder_tid(const dgt_decoder *decoder);
+/* The process of the last DG_R_PROCESS read, or 0. In a merged trace one
+ * follows every chunk record.
+ */
+uint32_t dgt_decoder_pid(const dgt_decoder *decoder);
+/* Instructions executed so far, counting the runs since the last chunk.
+ * Runs left out by sampling are not counted after the chunk.
+ */
+uint64_t dgt_decoder_instrs(const dgt_decoder *decoder);
+
+/* The block definitions and contexts of the whole trace, gathered by
+ * n_threads threads (0 for one per processor), each taking a chunk at a
+ * time. A trace without an index is scanned by one thread.
+ */
+int dgt_defs_new(const dgt_file *file, unsigned int n_threads, dgt_defs **defs);
+void dgt_defs_free(dgt_defs *defs);
+uint64_t dgt_defs_n_bbdefs(const dgt_defs *defs);
+uint64_t dgt_defs_n_contexts(const dgt_defs *defs);
+
+/* A decoder using defs, which must outlive it, rather than reading the
+ * definitions itself. It can start at any chunk, rather than only at the
+ * start of the trace, and then stops at the end of that chunk.
+ */
+int dgt_decoder_new_shared(const dgt_file *file, const dgt_defs *defs, dgt_decoder **decoder);
+int dgt_decoder_seek_chunk(dgt_decoder *decoder, size_t chunk);
+
+/* Decodes the rest of what the decoder would return (a chunk after
+ * dgt_decoder_seek_chunk, or else the rest of the trace) into columns,
+ * which must be zeroed before their first use. Earlier rows are replaced.
+ * dgt_columns_free frees the arrays, leaving the columns empty.
+ */
+int dgt_decode_columns(dgt_decoder *decoder, dgt_columns *columns);
+void dgt_columns_free(dgt_columns *columns);
+
+typedef struct
+{
+   void *arg;
+   /* Returns the aggregation of one thread, or NULL if out of memory */
+   void *(*worker_new)(void *arg);
+   /* Called with each item of a chunk, as from dgt_decoder_next. Chunks
+    * are taken by whichever thread is free, so a thread sees them out of
+    * order. A nonzero return stops the decode, and is returned.
+    */
+   int (*item)(void *worker, const dgt_decoder *decoder, int kind,
+               const dgt_record *record, const dgt_run *run);
+   /* Called for each aggregation in turn, on the calling thread, once all
+    * the threads have finished (even after an error). It is responsible
+    * for freeing it.
+    */
+   void (*merge)(void *arg, void *worker);
+} dgt_parallel_ops;
+
+/* Decodes every chunk of the trace on n_threads threads (0 for one per
+ * processor). Records before the first chunk, which hold only definitions
+ * and (in a ring dump) the live heap blocks, are not decoded.
+ */
+int dgt_decode_parallel(const dgt_file *file, const dgt_defs *defs, unsigned int n_threads,
+                        const dgt_parallel_ops *ops);
+
+/* An address index, which dg_addrindex writes next to a trace, gives
+ * for each page the chunks in which it was read or written and the
+ * contexts that did so, so that the accesses to an address can be found
+ * without decoding the trace. It is mapped rather than read, so a query
+ * only touches the pages of the index that it needs. The file, which is
+ * little-endian, is made of
+ *
+ *    the magic "DGADDRS1";
+ *    the size of the trace's stream and its number of chunks, for
+ *    telling whether the index is out of date;
+ *    the number of contexts, the number of pages and the page shift;
+ *    the offsets in the file of the contexts, of the pages and of the
+ *    end of the postings, each of these being a 64-bit word;
+ *    the offset in the trace's stream of the record of each context;
+ *    for each page in order, the page (an address shifted right by the
+ *    page shift) and the offset of its postings from the end of the
+ *    pages;
+ *    the postings of each page: for each chunk in order, the difference
+ *    from the previous chunk, the number of contexts, and the difference
+ *    of each context from the previous one (the first from 0), as
+ *    uvarints.
+ *
+ * Chunks are numbered as in the trace's index; a trace without one is a
+ * single chunk 0.
+ */
+#define DGT_ADDR_INDEX_MAGIC        "DGADDRS1"
+#define DGT_ADDR_INDEX_HEADER_SIZE  72
+
+typedef struct dgt_addr_index dgt_addr_index;
+
+typedef struct
+{
+   uint64_t chunk;
+   uint64_t context;
+} dgt_posting;
+
+/* Fails with DGT_ERR_INVALID if the index was not built for the trace as
+ * it now is. The trace must stay open until the index is closed.
+ */
+int dgt_addr_index_open(const char *filename, const dgt_file *file, dgt_addr_index **index);
+void dgt_addr_index_close(dgt_addr_index *index);
+unsigned int dgt_addr_index_page_shift(const dgt_addr_index *index);
+uint64_t dgt_addr_index_n_contexts(const dgt_addr_index *index);
+/* The chunks and contexts accessing any page that holds a byte from lo up
+ * to (not including) hi, in order of chunk and then context, in an array
+ * that the caller frees
+ */
+int dgt_addr_index_query(const dgt_addr_index *index, uint64_t lo, uint64_t hi,
+                         dgt_posting **postings, size_t *n);
+/* Reads a context from its record, so that no definitions are needed */
+int dgt_addr_index_context(const dgt_addr_index *index, uint64_t i, dgt_context *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DG_TRACE_H */
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
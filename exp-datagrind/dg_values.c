@@ -0,0 +1,186 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: locality of stored values.            dg_values.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_hashtable.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-value-stats=yes, the data of each store is classed the
+ * way a compressed cache would see it: zero, one byte repeated across the
+ * whole value, narrow (the sign extension of its low half), or anything
+ * else. Each store is also compared with the last one of the same context,
+ * which counts the values that a last-value scheme would get for free. Only
+ * the counts are kept, per context, so the cost does not grow with the
+ * run, and a record is written per context at exit. Stores wider than 8
+ * bytes are classed as 8-byte pieces.
+ */
+
+typedef struct DgValueContext
+{
+   struct DgValueContext *next;
+   UWord key;          /* Context index */
+   ULong last;         /* Masked to last_size */
+   UChar last_size;    /* 0 before the first store */
+   ULong stores;
+   ULong bytes;
+   ULong same;
+   ULong counts[DG_N_VALUES];
+} DgValueContext;
+
+Bool DG_(clo_value_stats) = False;
+
+static VgHashTable *contexts = NULL;   /* DgValueContext */
+static DgValueContext *last_context = NULL;
+
+Bool DG_(values_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BOOL_CLO(arg, "--datagrind-value-stats", DG_(clo_value_stats))) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(values_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-value-stats=yes|no   class stored values as zero, repeated\n"
+"                                     or narrow, per context [no]\n"
+   );
+}
+
+void DG_(values_init)(void)
+{
+   if (!DG_(clo_value_stats))
+      return;
+   contexts = VG_(HT_construct)("datagrind.values.contexts");
+}
+
+/* Classes a value of size bytes, which has been masked to them */
+static Int classify(ULong value, UInt size)
+{
+   UInt bits = size * 8;
+   ULong mask = bits == 64 ? ~0ULL : (1ULL << bits) - 1;
+   ULong top;
+
+   if (value == 0)
+      return DG_VALUE_ZERO;
+   if (size == 1)
+      return DG_VALUE_OTHER;
+   /* mask / 0xFF has a 1 in the bottom of each byte */
+   if (value == (value & 0xFF) * (mask / 0xFF))
+      return DG_VALUE_REPEATED;
+   /* The top half and the top bit of the bottom half */
+   top = value >> (bits / 2 - 1);
+   if (top == 0 || top == mask >> (bits / 2 - 1))
+      return DG_VALUE_NARROW;
+   return DG_VALUE_OTHER;
+}
+
+void DG_(values_store)(UWord context_index, ULong value, UChar size)
+{
+   DgValueContext *ctx = last_context;
+
+   tl_assert(size >= 1 && size <= 8);
+   if (ctx == NULL || ctx->key != context_index)
+   {
+      ctx = VG_(HT_lookup)(contexts, context_index);
+      if (ctx == NULL)
+      {
+         ctx = VG_(calloc)("datagrind.values.context", 1, sizeof(DgValueContext));
+         ctx->key = context_index;
+         VG_(HT_add_node)(contexts, ctx);
+      }
+      last_context = ctx;
+   }
+
+   if (size < 8)
+      value &= (1ULL << (size * 8)) - 1;
+   ctx->counts[classify(value, size)]++;
+   if (ctx->last_size == size && ctx->last == value)
+      ctx->same++;
+   ctx->last = value;
+   ctx->last_size = size;
+   ctx->stores++;
+   ctx->bytes += size;
+}
+
+static Int cmp_context_ptr(const void *a, const void *b)
+{
+   const DgValueContext *ca = *(DgValueContext * const *) a;
+   const DgValueContext *cb = *(DgValueContext * const *) b;
+   if (ca->key != cb->key)
+      return ca->key < cb->key ? -1 : 1;
+   return 0;
+}
+
+void DG_(values_finish)(void)
+{
+   DgValueContext **nodes;
+   UInt n_nodes, i;
+
+   if (contexts == NULL)
+      return;
+
+   nodes = (DgValueContext **) VG_(HT_to_array)(contexts, &n_nodes);
+   VG_(ssort)(nodes, n_nodes, sizeof(DgValueContext *), cmp_context_ptr);
+   for (i = 0; i < n_nodes; i++)
+   {
+      const DgValueContext *ctx = nodes[i];
+      UChar payload[DG_MAX_UVARINT_BYTES + (DG_N_VALUES + 3) * 10];
+      UChar *p = payload;
+      Int j;
+
+      p = encode_uvarint(p, ctx->key);
+      p = encode_uvarint64(p, ctx->stores);
+      p = encode_uvarint64(p, ctx->bytes);
+      for (j = 0; j < DG_N_VALUES; j++)
+         p = encode_uvarint64(p, ctx->counts[j]);
+      p = encode_uvarint64(p, ctx->same);
+      out_byte(DG_R_VALUE_STATS);
+      out_length(p - payload);
+      out_bytes(payload, p - payload);
+   }
+   VG_(free)(nodes);
+
+   VG_(HT_destruct)(contexts, VG_(free));
+   contexts = NULL;
+   last_context = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,407 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: working set sizes over time.             dg_wss.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_threadstate.h"
+#include "pub_tool_xarray.h"
+
+#include "dg_include.h"
+#include "dg_record.h"
+
+/* With --datagrind-wss-interval=<n>, the instructions are cut into
+ * windows of n, and in each window the distinct cache lines and pages
+ * touched are estimated with HyperLogLog sketches, one pair for each
+ * thread and each tracked range, as dg_stat does for its intervals after
+ * the fact. The bytes read and written, and the instructions each thread
+ * ran, are counted alongside, which makes a bandwidth time series. The
+ * whole process is estimated from the union of the thread sketches. A
+ * record is written at the end of each window with any accesses. An
+ * access is counted for the line and page of its first byte, and for the
+ * first tracked range containing it.
+ */
+
+#define DG_WSS_BITS        10
+#define DG_WSS_SIZE        (1 << DG_WSS_BITS)
+#define DG_WSS_LINE_SHIFT  6
+#define DG_WSS_PAGE_SHIFT  12
+
+/* Kinds of entry in a DG_R_WORKING_SET */
+#define DG_WSS_THREAD      0
+#define DG_WSS_RANGE       1
+#define DG_WSS_PROCESS     2
+
+typedef struct
+{
+   Bool used;          /* Touched in this window */
+   ULong instrs;       /* Only for threads */
+   ULong read_bytes;
+   ULong write_bytes;
+   UChar lines[DG_WSS_SIZE];
+   UChar pages[DG_WSS_SIZE];
+} DgWssSketch;
+
+typedef struct
+{
+   Addr start;
+   Addr end;           /* One past the last byte */
+   Bool active;
+   DgWssSketch *sketch;
+} DgWssRange;
+
+Long DG_(clo_wss_interval) = 0;
+
+static DgWssSketch **threads = NULL;   /* By thread, allocated on first use */
+static XArray *ranges = NULL;          /* DgWssRange, as registered */
+static Word n_active_ranges = 0;
+static ULong window_start = 0;
+static double inv_pow2[65];            /* 2^-i, for the estimates */
+
+Bool DG_(wss_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_BINT_CLO(arg, "--datagrind-wss-interval", DG_(clo_wss_interval),
+                   0, 1000000000000LL)) {}
+   else
+      return False;
+   return True;
+}
+
+void DG_(wss_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-wss-interval=<n>     estimate the lines and pages touched\n"
+"                                     in each <n> instructions [0 = off]\n"
+   );
+}
+
+void DG_(wss_init)(void)
+{
+   Int i;
+
+   if (DG_(clo_wss_interval) == 0)
+      return;
+   threads = VG_(calloc)("datagrind.wss.threads", VG_N_THREADS, sizeof(DgWssSketch *));
+   ranges = VG_(newXA)(VG_(malloc), "datagrind.wss.ranges", VG_(free),
+                       sizeof(DgWssRange));
+   inv_pow2[0] = 1.0;
+   for (i = 1; i <= 64; i++)
+      inv_pow2[i] = inv_pow2[i - 1] * 0.5;
+}
+
+void DG_(wss_track)(Addr addr, SizeT len)
+{
+   DgWssRange range;
+
+   if (ranges == NULL)
+      return;
+   /* Empty ranges are kept too, so that ranges are numbered like their
+    * records.
+    */
+   VG_(memset)(&range, 0, sizeof(range));
+   range.start = addr;
+   range.end = addr + len;
+   range.active = len > 0;
+   if (range.active)
+   {
+      range.sketch = VG_(calloc)("datagrind.wss.sketch", 1, sizeof(DgWssSketch));
+      n_active_ranges++;
+   }
+   VG_(addToXA)(ranges, &range);
+}
+
+void DG_(wss_untrack)(Addr addr, SizeT len)
+{
+   Word n, i;
+
+   if (ranges == NULL)
+      return;
+   n = VG_(sizeXA)(ranges);
+   for (i = 0; i < n; i++)
+   {
+      DgWssRange *range = VG_(indexXA)(ranges, i);
+      if (range->active && range->start == addr && range->end == addr + len)
+      {
+         /* The sketch is kept until the end of the window */
+         range->active = False;
+         n_active_ranges--;
+         return;
+      }
+   }
+}
+
+static inline ULong wss_hash(ULong x)
+{
+   x += 0x9E3779B97F4A7C15ULL;
+   x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+   return x ^ (x >> 31);
+}
+
+static inline void sketch_add(UChar *regs, ULong value)
+{
+   ULong h = wss_hash(value);
+   ULong rest = (h << DG_WSS_BITS) | (1ULL << (DG_WSS_BITS - 1));
+   UChar rank = __builtin_clzll(rest) + 1;
+   UChar *reg = &regs[h >> (64 - DG_WSS_BITS)];
+
+   if (rank > *reg)
+      *reg = rank;
+}
+
+static void sketch_access(DgWssSketch *s, Addr addr, UChar size, UChar dir)
+{
+   s->used = True;
+   if (DG_ACC_IS_WRITE(dir))
+      s->write_bytes += size;
+   else
+      s->read_bytes += size;
+   sketch_add(s->lines, addr >> DG_WSS_LINE_SHIFT);
+   sketch_add(s->pages, addr >> DG_WSS_PAGE_SHIFT);
+}
+
+/* Natural logarithm, for the small-range correction */
+static double wss_log(double x)
+{
+   const double ln2 = 0.69314718055994530942;
+   double y, y2, term, sum = 0.0;
+   Int e = 0, k;
+
+   tl_assert(x > 0.0);
+   while (x > 1.5)
+   {
+      x *= 0.5;
+      e++;
+   }
+   while (x < 0.75)
+   {
+      x *= 2.0;
+      e--;
+   }
+   /* ln x = 2 atanh((x - 1) / (x + 1)), with |y| < 0.2 */
+   y = (x - 1.0) / (x + 1.0);
+   y2 = y * y;
+   term = y;
+   for (k = 1; k < 30; k += 2)
+   {
+      sum += term / k;
+      term *= y2;
+   }
+   return 2.0 * sum + e * ln2;
+}
+
+static ULong sketch_estimate(const UChar *regs)
+{
+   double sum = 0.0, m = DG_WSS_SIZE, estimate;
+   Int zeros = 0, i;
+
+   for (i = 0; i < DG_WSS_SIZE; i++)
+   {
+      sum += inv_pow2[regs[i]];
+      if (regs[i] == 0)
+         zeros++;
+   }
+   estimate = 0.7213 / (1.0 + 1.079 / m) * m * m / sum;
+   if (estimate <= 2.5 * m && zeros > 0)
+      estimate = m * wss_log(m / zeros);
+   return (ULong) (estimate + 0.5);
+}
+
+static UChar *encode_entry(UChar *p, UChar kind, UWord index, const DgWssSketch *s)
+{
+   *p++ = kind;
+   p = encode_uvarint(p, index);
+   p = encode_uvarint64(p, sketch_estimate(s->lines));
+   p = encode_uvarint64(p, sketch_estimate(s->pages));
+   p = encode_uvarint64(p, s->instrs);
+   p = encode_uvarint64(p, s->read_bytes);
+   p = encode_uvarint64(p, s->write_bytes);
+   return p;
+}
+
+/* Writes out the window that started at window_start, if it had any
+ * accesses, and empties the sketches.
+ */
+static void wss_flush(ULong now)
+{
+   DgWssSketch total;
+   Word n_ranges = VG_(sizeXA)(ranges), r;
+   Word n_entries = 1;
+   ThreadId tid;
+   UChar *payload, *p;
+   Int i;
+
+   VG_(memset)(&total, 0, sizeof(total));
+   for (tid = 0; tid < VG_N_THREADS; tid++)
+   {
+      const DgWssSketch *s = threads[tid];
+      if (s == NULL || !s->used)
+         continue;
+      total.used = True;
+      total.instrs += s->instrs;
+      total.read_bytes += s->read_bytes;
+      total.write_bytes += s->write_bytes;
+      n_entries++;
+      for (i = 0; i < DG_WSS_SIZE; i++)
+      {
+         if (s->lines[i] > total.lines[i])
+            total.lines[i] = s->lines[i];
+         if (s->pages[i] > total.pages[i])
+            total.pages[i] = s->pages[i];
+      }
+   }
+   if (!total.used)
+      return;
+   for (r = 0; r < n_ranges; r++)
+   {
+      const DgWssRange *range = VG_(indexXA)(ranges, r);
+      if (range->sketch != NULL && range->sketch->used)
+         n_entries++;
+   }
+
+   payload = VG_(malloc)("datagrind.wss.payload",
+                         3 * 10 + n_entries * (1 + DG_MAX_UVARINT_BYTES + 5 * 10));
+   p = payload;
+   p = encode_uvarint64(p, window_start);
+   /* The last window may be cut short */
+   p = encode_uvarint64(p, now - window_start < (ULong) DG_(clo_wss_interval)
+                           ? now - window_start : (ULong) DG_(clo_wss_interval));
+   p = encode_uvarint(p, n_entries);
+   p = encode_entry(p, DG_WSS_PROCESS, 0, &total);
+   for (tid = 0; tid < VG_N_THREADS; tid++)
+   {
+      DgWssSketch *s = threads[tid];
+      if (s == NULL || !s->used)
+         continue;
+      p = encode_entry(p, DG_WSS_THREAD, tid, s);
+      VG_(memset)(s, 0, sizeof(*s));
+   }
+   for (r = 0; r < n_ranges; r++)
+   {
+      DgWssRange *range = VG_(indexXA)(ranges, r);
+      if (range->sketch == NULL)
+         continue;
+      if (range->sketch->used)
+      {
+         p = encode_entry(p, DG_WSS_RANGE, r, range->sketch);
+         VG_(memset)(range->sketch, 0, sizeof(DgWssSketch));
+      }
+      if (!range->active)
+      {
+         VG_(free)(range->sketch);
+         range->sketch = NULL;
+      }
+   }
+   out_byte(DG_R_WORKING_SET);
+   out_length(p - payload);
+   out_bytes(payload, p - payload);
+   VG_(free)(payload);
+}
+
+/* Closes the window if now is past it, and returns the sketch of the
+ * thread.
+ */
+static DgWssSketch *wss_thread(ThreadId tid, ULong now)
+{
+   DgWssSketch *s;
+
+   if (UNLIKELY(now - window_start >= (ULong) DG_(clo_wss_interval)))
+   {
+      wss_flush(now);
+      window_start = now - now % DG_(clo_wss_interval);
+   }
+
+   s = threads[tid];
+   if (UNLIKELY(s == NULL))
+      s = threads[tid] = VG_(calloc)("datagrind.wss.sketch", 1, sizeof(DgWssSketch));
+   return s;
+}
+
+void DG_(wss_run)(ThreadId tid, ULong n_instrs, ULong now)
+{
+   DgWssSketch *s = wss_thread(tid, now);
+
+   s->used = True;
+   s->instrs += n_instrs;
+}
+
+void DG_(wss_access)(ThreadId tid, Addr addr, UChar size, UChar dir, ULong now)
+{
+   DgWssSketch *s = wss_thread(tid, now);
+
+   sketch_access(s, addr, size, dir);
+
+   if (n_active_ranges > 0)
+   {
+      Word n = VG_(sizeXA)(ranges), i;
+
+      /* Counted for the first range containing the access */
+      for (i = 0; i < n; i++)
+      {
+         DgWssRange *range = VG_(indexXA)(ranges, i);
+         if (range->active && addr - range->start < range->end - range->start)
+         {
+            sketch_access(range->sketch, addr, size, dir);
+            break;
+         }
+      }
+   }
+}
+
+void DG_(wss_finish)(ULong now)
+{
+   ThreadId tid;
+   Word n_ranges, r;
+
+   if (threads == NULL)
+      return;
+   wss_flush(now);
+   for (tid = 0; tid < VG_N_THREADS; tid++)
+      if (threads[tid] != NULL)
+         VG_(free)(threads[tid]);
+   VG_(free)(threads);
+   threads = NULL;
+   n_ranges = VG_(sizeXA)(ranges);
+   for (r = 0; r < n_ranges; r++)
+   {
+      DgWssRange *range = VG_(indexXA)(ranges, r);
+      if (range->sketch != NULL)
+         VG_(free)(range->sketch);
+   }
+   VG_(deleteXA)(ranges);
+   ranges = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
@@ -0,0 +1,201 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Datagrind: per-context costs as an xtree.       dg_xtree.c   ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Datagrind, a tool for tracking data accesses.
+
+   Copyright (C) 2010, 2020 Bruce Merry
+      bmerry@users.sourceforge.net
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_basics.h"
+
+#include "pub_tool_basics.h"
+#include "pub_tool_tooliface.h"
+#include "pub_tool_mallocfree.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcfile.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_options.h"
+#include "pub_tool_xarray.h"
+#include "pub_tool_xtree.h"
+
+#include "dg_include.h"
+
+/* With --datagrind-xtree=<file>, the reads and writes of each context are
+ * summed in an XTree of the core, keyed by the ExeContext that was
+ * unwound for the context, and written in callgrind format at exit, so
+ * that KCachegrind shows the memory traffic by call path. Checkpoints
+ * write the whole tree so far to a temporary file, which is then renamed
+ * over the file, so that the file is never seen half written.
+ *
+ * A context only ever has one ExeContext, so its Xecu is looked up by
+ * context index, and each run adds its totals to it in one call.
+ */
+
+typedef struct
+{
+   ULong reads, writes;
+   ULong read_bytes, write_bytes;
+} DgXTreeCost;
+
+Bool DG_(clo_xtree) = False;
+static const HChar *clo_xtree_file = NULL;
+
+static XTree *xtree = NULL;
+static XArray *xecus = NULL;    /* Xecu, indexed by context */
+
+Bool DG_(xtree_process_cmd_line_option)(const HChar *arg)
+{
+   if (VG_STR_CLO(arg, "--datagrind-xtree", clo_xtree_file))
+      DG_(clo_xtree) = True;
+   else
+      return False;
+   return True;
+}
+
+void DG_(xtree_print_usage)(void)
+{
+   VG_(printf)(
+"    --datagrind-xtree=<file>         write the accesses per call stack to\n"
+"                                     <file> in callgrind format [none]\n"
+   );
+}
+
+static void cost_init(void *value)
+{
+   VG_(memset)(value, 0, sizeof(DgXTreeCost));
+}
+
+static void cost_add(void *to, const void *value)
+{
+   DgXTreeCost *t = to;
+   const DgXTreeCost *v = value;
+
+   t->reads += v->reads;
+   t->writes += v->writes;
+   t->read_bytes += v->read_bytes;
+   t->write_bytes += v->write_bytes;
+}
+
+static void cost_sub(void *from, const void *value)
+{
+   DgXTreeCost *f = from;
+   const DgXTreeCost *v = value;
+
+   f->reads -= v->reads;
+   f->writes -= v->writes;
+   f->read_bytes -= v->read_bytes;
+   f->write_bytes -= v->write_bytes;
+}
+
+void DG_(xtree_init)(void)
+{
+   if (!DG_(clo_xtree))
+      return;
+   xtree = VG_(XT_create)(VG_(malloc), "datagrind.xtree", VG_(free),
+                          sizeof(DgXTreeCost), cost_init, cost_add, cost_sub,
+                          VG_(XT_filter_maybe_below_main));
+   xecus = VG_(newXA)(VG_(malloc), "datagrind.xtree.xecus", VG_(free),
+                      sizeof(Xecu));
+}
+
+void DG_(xtree_context)(UWord context_index, ExeContext *ec)
+{
+   DgXTreeCost zero;
+   Xecu xecu;
+
+   if (xtree == NULL)
+      return;
+   tl_assert(context_index == VG_(sizeXA)(xecus));
+   cost_init(&zero);
+   xecu = VG_(XT_add_to_ec)(xtree, ec, &zero);
+   VG_(addToXA)(xecus, &xecu);
+}
+
+void DG_(xtree_add)(UWord context_index, ULong reads, ULong writes,
+                    ULong read_bytes, ULong write_bytes)
+{
+   DgXTreeCost cost;
+
+   if (reads == 0 && writes == 0)
+      return;
+   cost.reads = reads;
+   cost.writes = writes;
+   cost.read_bytes = read_bytes;
+   cost.write_bytes = write_bytes;
+   VG_(XT_add_to_xecu)(xtree, *(Xecu *) VG_(indexXA)(xecus, context_index), &cost);
+}
+
+static const HChar *cost_image(const void *value)
+{
+   static HChar buf[4 * 21];
+   const DgXTreeCost *c = value;
+
+   if (c->reads == 0 && c->writes == 0)
+      return NULL;
+   VG_(snprintf)(buf, sizeof(buf), "%llu %llu %llu %llu",
+                 c->reads, c->writes, c->read_bytes, c->write_bytes);
+   return buf;
+}
+
+static void print_tree(const HChar *name)
+{
+   VG_(XT_callgrind_print)(xtree, name,
+                           "Rd : reads,Wr : writes,"
+                           "RdB : bytes read,WrB : bytes written",
+                           cost_image);
+}
+
+void DG_(xtree_checkpoint)(void)
+{
+   HChar *name, *tmp;
+
+   if (xtree == NULL)
+      return;
+   name = VG_(expand_file_name)("--datagrind-xtree", clo_xtree_file);
+   tmp = VG_(malloc)("datagrind.xtree.tmp", VG_(strlen)(name) + 5);
+   VG_(sprintf)(tmp, "%s.tmp", name);
+   print_tree(tmp);
+   VG_(rename)(tmp, name);
+   VG_(free)(tmp);
+   VG_(free)(name);
+}
+
+void DG_(xtree_finish)(void)
+{
+   HChar *name;
+
+   if (xtree == NULL)
+      return;
+   name = VG_(expand_file_name)("--datagrind-xtree", clo_xtree_file);
+   print_tree(name);
+   VG_(free)(name);
+   VG_(XT_delete)(xtree);
+   VG_(deleteXA)(xecus);
+   xtree = NULL;
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                                          ---*/
+/*--------------------------------------------------------------------*/
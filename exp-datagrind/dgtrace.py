@@ -0,0 +1,238 @@
+#
+# Datagrind: reading traces from Python.                     dgtrace.py
+#
+# This file is part of Datagrind, a tool for tracking data accesses.
+#
+# Copyright (C) 2010, 2020 Bruce Merry
+#    bmerry@users.sourceforge.net
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+# 02111-1307, USA.
+#
+# The GNU General Public License is contained in the file COPYING.
+
+"""Reads Datagrind traces through libdgtrace, a chunk at a time.
+
+The accesses of each chunk are decoded by libdgtrace into one array per
+field, as dg_convert --columns writes them, and handed out as NumPy arrays
+over the library's own memory, without copying:
+
+    import dgtrace
+    with dgtrace.Trace("datagrind.out") as trace:
+        for chunk in trace.chunks():
+            writes = chunk.addr[chunk.dir == dgtrace.ACC_WRITE]
+
+The arrays of a chunk keep its memory alive, so they may outlive the chunk
+and the trace. libdgtrace.so is looked for in $DGTRACE_LIBRARY, next to
+this file, and then where the system keeps libraries.
+"""
+
+import ctypes
+import ctypes.util
+import os
+
+import numpy
+
+ACC_READ = 0
+ACC_WRITE = 1
+ACC_EXEC = 2
+ACC_ATOMIC = 3
+
+COLUMNS = (
+    ("addr", numpy.uint64),
+    ("size", numpy.uint32),
+    ("dir", numpy.uint8),
+    ("context", numpy.uint64),
+    ("instrs", numpy.uint64),
+    ("tid", numpy.uint32),
+)
+
+
+class Error(Exception):
+    """A DGT_ERR_* code from libdgtrace, with its message."""
+
+    def __init__(self, code, filename=None):
+        message = _lib.dgt_strerror(code).decode()
+        if filename is not None:
+            message = "%s: %s" % (filename, message)
+        super().__init__(message)
+        self.code = code
+
+
+class _Columns(ctypes.Structure):
+    _fields_ = [
+        ("n_rows", ctypes.c_uint64),
+        ("capacity", ctypes.c_uint64),
+        ("addr", ctypes.POINTER(ctypes.c_uint64)),
+        ("size", ctypes.POINTER(ctypes.c_uint32)),
+        ("dir", ctypes.POINTER(ctypes.c_uint8)),
+        ("context", ctypes.POINTER(ctypes.c_uint64)),
+        ("instrs", ctypes.POINTER(ctypes.c_uint64)),
+        ("tid", ctypes.POINTER(ctypes.c_uint32)),
+    ]
+
+
+class _Context(ctypes.Structure):
+    _fields_ = [
+        ("bbdef_index", ctypes.c_uint64),
+        ("n_stack", ctypes.c_uint32),
+        ("stack", ctypes.c_void_p),
+    ]
+
+
+def _load():
+    names = [os.environ.get("DGTRACE_LIBRARY"),
+             os.path.join(os.path.dirname(os.path.abspath(__file__)), "libdgtrace.so"),
+             ctypes.util.find_library("dgtrace")]
+    for name in names:
+        if name and (os.path.sep not in name or os.path.exists(name)):
+            lib = ctypes.CDLL(name)
+            break
+    else:
+        raise ImportError("libdgtrace.so not found; set DGTRACE_LIBRARY")
+
+    p = ctypes.c_void_p
+    lib.dgt_strerror.argtypes = [ctypes.c_int]
+    lib.dgt_strerror.restype = ctypes.c_char_p
+    lib.dgt_open.argtypes = [ctypes.c_char_p, ctypes.POINTER(p)]
+    lib.dgt_close.argtypes = [p]
+    lib.dgt_close.restype = None
+    lib.dgt_file_has_index.argtypes = [p]
+    lib.dgt_file_n_chunks.argtypes = [p]
+    lib.dgt_file_n_chunks.restype = ctypes.c_size_t
+    lib.dgt_defs_new.argtypes = [p, ctypes.c_uint, ctypes.POINTER(p)]
+    lib.dgt_defs_free.argtypes = [p]
+    lib.dgt_defs_free.restype = None
+    lib.dgt_decoder_new.argtypes = [p, ctypes.POINTER(p)]
+    lib.dgt_decoder_new_shared.argtypes = [p, p, ctypes.POINTER(p)]
+    lib.dgt_decoder_free.argtypes = [p]
+    lib.dgt_decoder_free.restype = None
+    lib.dgt_decoder_seek_chunk.argtypes = [p, ctypes.c_size_t]
+    lib.dgt_decoder_n_contexts.argtypes = [p]
+    lib.dgt_decoder_n_contexts.restype = ctypes.c_uint64
+    lib.dgt_decoder_context.argtypes = [p, ctypes.c_uint64]
+    lib.dgt_decoder_context.restype = ctypes.POINTER(_Context)
+    lib.dgt_context_ip.argtypes = [p, ctypes.POINTER(_Context), ctypes.c_uint32]
+    lib.dgt_context_ip.restype = ctypes.c_uint64
+    lib.dgt_decode_columns.argtypes = [p, ctypes.POINTER(_Columns)]
+    lib.dgt_columns_free.argtypes = [ctypes.POINTER(_Columns)]
+    lib.dgt_columns_free.restype = None
+    return lib
+
+
+_lib = _load()
+
+
+class _Owner:
+    """Frees the arrays of a dgt_columns once no NumPy array uses them."""
+
+    def __init__(self, columns):
+        self.columns = columns
+
+    def __del__(self):
+        _lib.dgt_columns_free(ctypes.byref(self.columns))
+
+
+class Chunk:
+    """The accesses of a chunk, as arrays of n_rows: addr, size, dir
+    (an ACC_* value), context (its index), instrs (the instructions
+    executed before the run making the access) and tid."""
+
+    def __init__(self, columns):
+        owner = _Owner(columns)
+        self.n_rows = columns.n_rows
+        for name, dtype in COLUMNS:
+            if self.n_rows == 0:
+                setattr(self, name, numpy.empty(0, dtype))
+                continue
+            ctype = getattr(columns, name)._type_ * self.n_rows
+            buf = ctype.from_address(ctypes.addressof(getattr(columns, name).contents))
+            buf._owner = owner
+            setattr(self, name, numpy.frombuffer(buf, dtype))
+
+    def __len__(self):
+        return self.n_rows
+
+
+class Trace:
+    """An open trace. With an index it is read a chunk at a time, and
+    without one (--datagrind-chunk-size=0) as a single chunk."""
+
+    def __init__(self, filename, threads=0):
+        self._file = ctypes.c_void_p()
+        self._defs = ctypes.c_void_p()
+        self._decoder = ctypes.c_void_p()
+        self.filename = filename
+        self._check(_lib.dgt_open(os.fsencode(filename), ctypes.byref(self._file)))
+        try:
+            self.has_index = bool(_lib.dgt_file_has_index(self._file))
+            self.n_chunks = _lib.dgt_file_n_chunks(self._file) if self.has_index else 1
+            if self.has_index:
+                self._check(_lib.dgt_defs_new(self._file, threads, ctypes.byref(self._defs)))
+                self._check(_lib.dgt_decoder_new_shared(self._file, self._defs,
+                                                        ctypes.byref(self._decoder)))
+        except Exception:
+            self.close()
+            raise
+
+    def _check(self, ret):
+        if ret < 0:
+            raise Error(ret, self.filename)
+        return ret
+
+    def close(self):
+        _lib.dgt_decoder_free(self._decoder)
+        _lib.dgt_defs_free(self._defs)
+        _lib.dgt_close(self._file)
+        self._decoder = ctypes.c_void_p()
+        self._defs = ctypes.c_void_p()
+        self._file = ctypes.c_void_p()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def chunk(self, i):
+        """Decodes chunk i, returning a Chunk."""
+        columns = _Columns()
+        if not 0 <= i < self.n_chunks:
+            raise IndexError(i)
+        if self.has_index:
+            self._check(_lib.dgt_decoder_seek_chunk(self._decoder, i))
+        else:
+            # A decoder of its own reads the definitions from the start
+            _lib.dgt_decoder_free(self._decoder)
+            self._decoder = ctypes.c_void_p()
+            self._check(_lib.dgt_decoder_new(self._file, ctypes.byref(self._decoder)))
+        ret = _lib.dgt_decode_columns(self._decoder, ctypes.byref(columns))
+        if ret < 0:
+            _lib.dgt_columns_free(ctypes.byref(columns))
+            self._check(ret)
+        return Chunk(columns)
+
+    def chunks(self):
+        """Decodes each chunk in turn."""
+        for i in range(self.n_chunks):
+            yield self.chunk(i)
+
+    def stack(self, context):
+        """The instruction addresses of a context, innermost first. Without
+        an index, only the contexts of a decoded trace are known."""
+        if not self._decoder or context >= _lib.dgt_decoder_n_contexts(self._decoder):
+            raise IndexError(context)
+        ctx = _lib.dgt_decoder_context(self._decoder, context)
+        return [_lib.dgt_context_ip(self._file, ctx, i) for i in range(ctx.contents.n_stack)]
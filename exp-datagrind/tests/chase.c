@@ -0,0 +1,49 @@
+/* Pointer chase: a walk around one random cycle through cache-line sized
+ * nodes, where each load depends on the one before
+ */
+
+#include "kernel.h"
+
+#define NODES (1 << 16)
+#define STEPS (1 << 20)
+
+typedef struct node
+{
+    struct node *next;
+    uint64_t value;
+    char pad[48];
+} node;
+
+int main(int argc, char **argv)
+{
+    node *nodes = malloc(NODES * sizeof(node));
+    int *order = malloc(NODES * sizeof(int));
+    uint64_t state = 88172645463325252ULL, checksum = 0;
+    node *p;
+
+    for (int i = 0; i < NODES; i++)
+        order[i] = i;
+    for (int i = NODES - 1; i > 0; i--)
+    {
+        int j = kernel_random(&state) % (i + 1);
+        int t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; i < NODES; i++)
+    {
+        nodes[order[i]].next = &nodes[order[(i + 1) % NODES]];
+        nodes[order[i]].value = i;
+    }
+    kernel_begin();
+    p = &nodes[order[0]];
+    for (int i = 0; i < STEPS; i++)
+    {
+        checksum += p->value;
+        p = p->next;
+    }
+    kernel_end(argc, argv, checksum);
+    free(order);
+    free(nodes);
+    return 0;
+}
@@ -0,0 +1,34 @@
+/* malloc churn: a pool of live blocks of random sizes, each replaced in
+ * turn, so that most of the trace is heap blocks being made and freed
+ */
+
+#include "kernel.h"
+
+#define LIVE 1024
+#define OPS (1 << 17)
+
+int main(int argc, char **argv)
+{
+    unsigned char *blocks[LIVE] = { NULL };
+    uint64_t state = 362436069ULL, checksum = 0;
+
+    kernel_begin();
+    for (int i = 0; i < OPS; i++)
+    {
+        int slot = kernel_random(&state) % LIVE;
+        size_t size = 16 + kernel_random(&state) % 512;
+
+        if (blocks[slot] != NULL)
+        {
+            checksum += blocks[slot][0];
+            free(blocks[slot]);
+        }
+        blocks[slot] = malloc(size);
+        blocks[slot][0] = i;
+        blocks[slot][size - 1] = i;
+    }
+    for (int i = 0; i < LIVE; i++)
+        free(blocks[i]);
+    kernel_end(argc, argv, checksum);
+    return 0;
+}
@@ -0,0 +1,36 @@
+/* memcpy-heavy: copies and fills of many sizes, between random places in
+ * buffers larger than the caches
+ */
+
+#include <string.h>
+
+#include "kernel.h"
+
+#define BUF (1 << 20)
+#define COPIES (1 << 16)
+
+int main(int argc, char **argv)
+{
+    unsigned char *src = malloc(BUF), *dst = malloc(BUF);
+    uint64_t state = 1234567ULL, checksum = 0;
+
+    for (int i = 0; i < BUF; i++)
+        src[i] = i * 7;
+    kernel_begin();
+    for (int i = 0; i < COPIES; i++)
+    {
+        size_t size = 1 << (kernel_random(&state) % 13);
+        size_t from = kernel_random(&state) % (BUF - size);
+        size_t to = kernel_random(&state) % (BUF - size);
+
+        if (i % 4 == 3)
+            memset(dst + to, i, size);
+        else
+            memcpy(dst + to, src + from, size);
+        checksum += dst[to];
+    }
+    kernel_end(argc, argv, checksum);
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,38 @@
+/* Hash probe: lookups in an open-addressed table with linear probing, half
+ * of them for keys that are not there
+ */
+
+#include "kernel.h"
+
+#define SLOTS (1 << 17)
+#define KEYS (SLOTS / 2)
+#define LOOKUPS (1 << 19)
+
+static uint64_t *table;
+
+static uint64_t *probe(uint64_t key)
+{
+    uint64_t i = (key * 0x9e3779b97f4a7c15ULL) >> (64 - 17);
+
+    while (table[i] != 0 && table[i] != key)
+        i = (i + 1) & (SLOTS - 1);
+    return &table[i];
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t state = 2463534242ULL, checksum = 0;
+
+    table = calloc(SLOTS, sizeof(uint64_t));
+    for (int i = 0; i < KEYS; i++)
+        *probe(2 * (uint64_t) i + 2) = 2 * (uint64_t) i + 2;
+    kernel_begin();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        uint64_t key = kernel_random(&state) % (2 * KEYS) + 1;
+        checksum += *probe(key) == key;
+    }
+    kernel_end(argc, argv, checksum);
+    free(table);
+    return 0;
+}
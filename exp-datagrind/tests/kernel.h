@@ -0,0 +1,51 @@
+/* Shared by the budget kernels. Each kernel times its own loop, so that
+ * the slowdown check leaves out the start-up of Valgrind, and writes the
+ * microseconds to the file named by its first argument, if there is one.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double kernel_start;
+
+static double kernel_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void kernel_begin(void)
+{
+    kernel_start = kernel_now();
+}
+
+static void kernel_end(int argc, char **argv, uint64_t checksum)
+{
+    double usecs = kernel_now() - kernel_start;
+
+    if (argc > 1)
+    {
+        FILE *f = fopen(argv[1], "w");
+        if (f == NULL)
+        {
+            perror(argv[1]);
+            exit(1);
+        }
+        fprintf(f, "%.0f\n", usecs);
+        fclose(f);
+    }
+    printf("checksum %llx\n", (unsigned long long) checksum);
+}
+
+/* A fixed sequence, so that the traces are the same from run to run */
+static inline uint64_t kernel_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
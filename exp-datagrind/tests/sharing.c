@@ -0,0 +1,51 @@
+/* Multi-threaded sharing: threads counting into adjacent words of one
+ * line, and into a shared table under a lock
+ */
+
+#include <pthread.h>
+
+#include "kernel.h"
+
+#define THREADS 4
+#define ITERS (1 << 17)
+#define TABLE 256
+
+static volatile uint64_t counters[THREADS];
+static uint64_t table[TABLE];
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *worker(void *arg)
+{
+    int id = (int) (intptr_t) arg;
+    uint64_t state = 521288629ULL + id;
+
+    for (int i = 0; i < ITERS; i++)
+    {
+        counters[id]++;
+        if (i % 16 == 0)
+        {
+            pthread_mutex_lock(&lock);
+            table[kernel_random(&state) % TABLE]++;
+            pthread_mutex_unlock(&lock);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[THREADS];
+    uint64_t checksum = 0;
+
+    kernel_begin();
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, (void *) (intptr_t) i);
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    for (int i = 0; i < THREADS; i++)
+        checksum += counters[i];
+    for (int i = 0; i < TABLE; i++)
+        checksum += table[i];
+    kernel_end(argc, argv, checksum);
+    return 0;
+}
@@ -0,0 +1,31 @@
+/* Streaming: the triad of STREAM over arrays larger than the caches */
+
+#include "kernel.h"
+
+#define N (1 << 18)
+#define REPS 4
+
+int main(int argc, char **argv)
+{
+    double *a = malloc(N * sizeof(double));
+    double *b = malloc(N * sizeof(double));
+    double *c = malloc(N * sizeof(double));
+    uint64_t checksum = 0;
+
+    for (int i = 0; i < N; i++)
+    {
+        b[i] = i;
+        c[i] = N - i;
+    }
+    kernel_begin();
+    for (int r = 0; r < REPS; r++)
+        for (int i = 0; i < N; i++)
+            a[i] = b[i] + 3.0 * c[i];
+    for (int i = 0; i < N; i++)
+        checksum += (uint64_t) a[i];
+    kernel_end(argc, argv, checksum);
+    free(a);
+    free(b);
+    free(c);
+    return 0;
+}
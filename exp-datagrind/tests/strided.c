@@ -0,0 +1,26 @@
+/* Strided: a column-major walk over a row-major matrix, so that each
+ * access is a row apart and falls on a page of its own
+ */
+
+#include "kernel.h"
+
+#define ROWS 1024
+#define COLS 1024
+#define REPS 2
+
+int main(int argc, char **argv)
+{
+    int *m = malloc(ROWS * COLS * sizeof(int));
+    uint64_t checksum = 0;
+
+    for (int i = 0; i < ROWS * COLS; i++)
+        m[i] = i;
+    kernel_begin();
+    for (int r = 0; r < REPS; r++)
+        for (int j = 0; j < COLS; j++)
+            for (int i = 0; i < ROWS; i++)
+                checksum += m[i * COLS + j];
+    kernel_end(argc, argv, checksum);
+    free(m);
+    return 0;
+}
@@ -586,6 +586,38 @@ static inline Bool is_sane_SecMap ( SecMap* sm ) {
    return sm != NULL && sm->magic == SecMap_MAGIC;
 }
 
+/* A SecMap in which every byte has the same SVal can instead be held
+   as a SecMapU, which takes 16 bytes rather than several KB.  This is
+   common for big heap blocks: libhb_srange_new gives the whole block
+   one SVal, and it stays that way until another thread, or the same
+   thread after a synchronisation, touches it.  A range that is all
+   SVal_NOACCESS needs no SecMap at all, so a SecMapU never holds that.
+
+   A SecMapU sits in map_shmem in place of a SecMap, and is told apart
+   by its magic, so anything fetched from map_shmem must be checked
+   with is_SecMapU before its .linesZ are used.
+
+   RC obligations: a SecMapU holds one reference to .sv. */
+typedef
+   struct {
+      UInt magic;
+      SVal sv;
+   }
+   SecMapU;
+
+// (UInt) `echo "Uniform SecMap" | md5sum`
+#define SecMapU_MAGIC 0x2f2d6c83U
+
+static PoolAlloc* SecMapU_pool_allocator;
+
+static inline Bool is_SecMapU ( const SecMap* sm ) {
+   return sm->magic == SecMapU_MAGIC;
+}
+static inline SecMapU* SecMapU_of ( SecMap* sm ) {
+   tl_assert(is_SecMapU(sm));
+   return (SecMapU*)sm;
+}
+
 /* ------ Cache ------ */
 
 #define N_WAY_BITS 16
@@ -623,6 +655,9 @@ static UWord stats__secmaps_search       = 0; // # SM finds
 static UWord stats__secmaps_search_slow  = 0; // # SM lookupFMs
 static UWord stats__secmaps_allocd       = 0; // # SecMaps issued
 static UWord stats__secmaps_in_map_shmem = 0; // # SecMaps 'live'
+static UWord stats__secmapsU_in_map_shmem = 0; // .. of which SecMapUs
+static UWord stats__secmaps_compacted    = 0; // # SecMaps made SecMapUs
+static UWord stats__secmaps_expanded     = 0; // # SecMapUs made SecMaps
 static UWord stats__secmaps_scanGC       = 0; // # nr of scan GC done.
 static UWord stats__secmaps_scanGCed     = 0; // # SecMaps GC-ed via scan
 static UWord stats__secmaps_ssetGCed     = 0; // # SecMaps GC-ed via setnoaccess
@@ -633,6 +668,8 @@ static UWord stats__cache_Z_fetches      = 0; // # Z lines fetched
 static UWord stats__cache_Z_wbacks       = 0; // # Z lines written back
 static UWord stats__cache_F_fetches      = 0; // # F lines fetched
 static UWord stats__cache_F_wbacks       = 0; // # F lines written back
+static UWord stats__cache_U_fetches      = 0; // # lines fetched w/o a SecMap
+static UWord stats__cache_U_wbacks       = 0; // # lines w/o SecMap unchanged
 static UWord stats__cache_flushes_invals = 0; // # cache flushes and invals
 static UWord stats__cache_totrefs        = 0; // # total accesses
 static UWord stats__cache_totmisses      = 0; // # misses
@@ -844,113 +881,183 @@ static SecMap* shmem__find_SecMap ( Addr ga )
    return sm;
 }
 
-/* Scan the SecMap and count the SecMap that can be GC-ed.
-   If really, really does the GC of the SecMap. */
+/* Point any smCache entry for the SecMap at gaKey to sm instead, or
+   drop it if sm is NULL. */
+static void shmem__smCache_update ( Addr gaKey, SecMap* sm )
+{
+   UWord i;
+   STATIC_ASSERT (3 == sizeof(smCache)/sizeof(smCache[0]));
+   for (i = 0; i < 3; i++) {
+      if (smCache[i].gaKey == gaKey) {
+         smCache[i].gaKey = sm ? gaKey : 1;
+         smCache[i].sm    = sm;
+      }
+   }
+}
+
+static SecMap* shmem__expand_SecMapU ( Addr gaKey, SecMap* smU );
+static void shmem__set_SecMap_uniform ( Addr gaKey, SVal sv );
+
+/* Returns the SVal held by every byte of the SecMap sm, or SVal_INVALID
+   if they are not all the same. */
+static SVal shmem__SecMap_uniform_SVal ( SecMap* sm )
+{
+   SVal  sv = SVal_INVALID;
+   UWord i, j;
+
+   for (i = 0; i < N_SECMAP_ZLINES; i++) {
+      LineZ* lineZ = &sm->linesZ[i];
+      SVal   lsv;
+      if (lineZ->dict[0] != SVal_INVALID) {
+         lsv = lineZ->dict[0];
+         for (j = 1; j < 4; j++)
+            if (lineZ->dict[j] != SVal_INVALID && lineZ->dict[j] != lsv)
+               return SVal_INVALID;
+      } else {
+         LineF *lineF = LineF_Ptr(lineZ);
+         lsv = lineF->w64s[0];
+         for (j = 1; j < N_LINE_ARANGE; j++)
+            if (lineF->w64s[j] != lsv)
+               return SVal_INVALID;
+      }
+      if (i == 0)
+         sv = lsv;
+      else if (lsv != sv)
+         return SVal_INVALID;
+   }
+   return sv;
+}
+
+/* Scan GC of the SecMaps.  A SecMap holding only SVal_NOACCESS is
+   freed, and one holding only some other single SVal is compacted into
+   a SecMapU.  Either way it goes on the free list.
+
+   A big shadow memory is not scanned in one go: each call of
+   shmem__SecMap_GC_step examines at most N_SECMAP_GC_STEP SecMaps,
+   carrying on where the previous one stopped, until a cycle over all
+   of map_shmem is complete.  The cache need not be flushed first, as a
+   cached line is written back by address: that expands or reallocates
+   whatever then holds its SecMap. */
 /* NOT TO BE CALLED FROM WITHIN libzsm. */
+#define N_SECMAP_GC_STEP 1024
 static UWord next_SecMap_GC_at = 1000;
-__attribute__((noinline))
-static UWord shmem__SecMap_do_GC(Bool really)
+static Bool  SecMap_GC_running = False; // is a cycle under way?
+static Addr  SecMap_GC_resume  = 0;     // .. if so, continues from here,
+static UWord SecMap_GC_cycle_examined = 0; // .. has examined so many,
+static UWord SecMap_GC_cycle_GCed = 0;  // .. and has GC-ed so many.
+
+/* Examines at most 'budget' SecMaps, from key *resume on, adding to
+   *examined and to *ok_GCed the nr that can be GC-ed.  If really, GCs
+   them.  Returns True if the end of map_shmem was reached, otherwise
+   sets *resume to the next key to examine. */
+static Bool shmem__SecMap_GC_scan ( Bool really, /*MOD*/Addr* resume,
+                                    UWord budget,
+                                    /*MOD*/UWord* examined,
+                                    /*MOD*/UWord* ok_GCed )
 {
    UWord secmapW = 0;
    Addr  gaKey;
-   UWord examined = 0;
-   UWord ok_GCed = 0;
-
-   /* First invalidate the smCache */
-   smCache[0].gaKey = 1;
-   smCache[1].gaKey = 1;
-   smCache[2].gaKey = 1;
-   STATIC_ASSERT (3 == sizeof(smCache)/sizeof(smCache[0]));
+   Bool  done = True;
 
-   VG_(initIterFM)( map_shmem );
+   VG_(initIterAtFM)( map_shmem, *resume );
    while (VG_(nextIterFM)( map_shmem, &gaKey, &secmapW )) {
-      UWord   i;
-      UWord   j;
-      UWord   n_linesF = 0;
       SecMap* sm = (SecMap*)secmapW;
-      tl_assert(sm->magic == SecMap_MAGIC);
-      Bool ok_to_GC = True;
+      SVal    sv;
 
-      examined++;
-
-      /* Deal with the LineZs and the possible LineF of a LineZ. */
-      for (i = 0; i < N_SECMAP_ZLINES && ok_to_GC; i++) {
-         LineZ* lineZ = &sm->linesZ[i];
-         if (lineZ->dict[0] != SVal_INVALID) {
-            ok_to_GC = lineZ->dict[0] == SVal_NOACCESS
-               && !SVal__isC (lineZ->dict[1])
-               && !SVal__isC (lineZ->dict[2])
-               && !SVal__isC (lineZ->dict[3]);
-         } else {
-            LineF *lineF = LineF_Ptr(lineZ);
-            n_linesF++;
-            for (j = 0; j < N_LINE_ARANGE && ok_to_GC; j++)
-               ok_to_GC = lineF->w64s[j] == SVal_NOACCESS;
-         }
+      if (budget == 0) {
+         *resume = gaKey;
+         done = False;
+         break;
       }
-      if (ok_to_GC)
-         ok_GCed++;
-      if (ok_to_GC && really) {
-        SecMap *fm_sm;
-        Addr fm_gaKey;
-        /* We cannot remove a SecMap from map_shmem while iterating.
-           So, stop iteration, remove from map_shmem, recreate the iteration
-           on the next SecMap. */
+      budget--;
+      (*examined)++;
+
+      if (is_SecMapU(sm))
+         continue;
+      tl_assert(sm->magic == SecMap_MAGIC);
+      sv = shmem__SecMap_uniform_SVal(sm);
+      if (sv == SVal_INVALID)
+         continue;
+
+      (*ok_GCed)++;
+      if (really) {
+        /* We cannot change map_shmem while iterating.  So, stop
+           iteration, GC the SecMap, and recreate the iteration on the
+           next SecMap. */
         VG_(doneIterFM) ( map_shmem );
-        /* No need to rcdec linesZ or linesF, these are all SVal_NOACCESS.
-           We just need to free the lineF referenced by the linesZ. */
-        if (n_linesF > 0) {
-           for (i = 0; i < N_SECMAP_ZLINES && n_linesF > 0; i++) {
-              LineZ* lineZ = &sm->linesZ[i];
-              if (lineZ->dict[0] == SVal_INVALID) {
-                 VG_(freeEltPA)( LineF_pool_allocator, LineF_Ptr(lineZ) );
-                 n_linesF--;
-              }
-           }
-        }
-        if (!VG_(delFromFM)(map_shmem, &fm_gaKey, (UWord*)&fm_sm, gaKey))
-          tl_assert (0);
-        stats__secmaps_in_map_shmem--;
-        tl_assert (gaKey == fm_gaKey);
-        tl_assert (sm == fm_sm);
-        stats__secmaps_scanGCed++;
-        push_SecMap_on_freelist (sm);
+        if (sv == SVal_NOACCESS)
+           stats__secmaps_scanGCed++;
+        else
+           stats__secmaps_compacted++;
+        shmem__set_SecMap_uniform (gaKey, sv);
         VG_(initIterAtFM) (map_shmem, gaKey + N_SECMAP_ARANGE);
       }
    }
    VG_(doneIterFM)( map_shmem );
 
-   if (really) {
-      stats__secmaps_scanGC++;
-      /* Next GC when we approach the max allocated */
-      next_SecMap_GC_at = stats__secmaps_allocd - 1000;
-      /* Unless we GCed less than 10%. We then allow to alloc 10%
-         more before GCing. This avoids doing a lot of costly GC
-         for the worst case : the 'growing phase' of an application
-         that allocates a lot of memory.
-         Worst can can be reproduced e.g. by
-             perf/memrw -t 30000000 -b 1000 -r 1 -l 1 
-         that allocates around 30Gb of memory. */
-      if (ok_GCed < stats__secmaps_allocd/10)
-         next_SecMap_GC_at = stats__secmaps_allocd + stats__secmaps_allocd/10;
+   return done;
+}
 
+/* Returns the nr of SecMaps a GC would free or compact.  This scans
+   all of map_shmem, so is to be used for statistics only. */
+__attribute__((noinline))
+static UWord shmem__SecMap_GC_count ( void )
+{
+   Addr  resume   = 0;
+   UWord examined = 0;
+   UWord ok_GCed  = 0;
+
+   shmem__SecMap_GC_scan (False, &resume, ~(UWord)0, &examined, &ok_GCed);
+   return ok_GCed;
+}
+
+/* Do one step of the current GC cycle, starting one if needed. */
+__attribute__((noinline))
+static void shmem__SecMap_GC_step ( void )
+{
+   if (!SecMap_GC_running) {
+      SecMap_GC_running = True;
+      SecMap_GC_resume = 0;
+      SecMap_GC_cycle_examined = 0;
+      SecMap_GC_cycle_GCed = 0;
    }
 
-   if (VG_(clo_stats) && really) {
+   if (!shmem__SecMap_GC_scan (True, &SecMap_GC_resume, N_SECMAP_GC_STEP,
+                               &SecMap_GC_cycle_examined,
+                               &SecMap_GC_cycle_GCed))
+      return;
+
+   /* The cycle is complete. */
+   SecMap_GC_running = False;
+   stats__secmaps_scanGC++;
+   /* Next GC when we approach the max allocated */
+   next_SecMap_GC_at = stats__secmaps_allocd - 1000;
+   /* Unless we GCed less than 10%. We then allow to alloc 10%
+      more before GCing. This avoids doing a lot of costly GC
+      for the worst case : the 'growing phase' of an application
+      that allocates a lot of memory.
+      Worst can can be reproduced e.g. by
+          perf/memrw -t 30000000 -b 1000 -r 1 -l 1 
+      that allocates around 30Gb of memory. */
+   if (SecMap_GC_cycle_GCed < stats__secmaps_allocd/10)
+      next_SecMap_GC_at = stats__secmaps_allocd + stats__secmaps_allocd/10;
+
+   if (VG_(clo_stats)) {
       VG_(message)(Vg_DebugMsg,
                   "libhb: SecMap GC: #%lu scanned %lu, GCed %lu,"
                    " next GC at %lu\n",
-                   stats__secmaps_scanGC, examined, ok_GCed,
-                   next_SecMap_GC_at);
+                   stats__secmaps_scanGC, SecMap_GC_cycle_examined,
+                   SecMap_GC_cycle_GCed, next_SecMap_GC_at);
    }
-
-   return ok_GCed;
 }
 
 static SecMap* shmem__find_or_alloc_SecMap ( Addr ga )
 {
    SecMap* sm = shmem__find_SecMap ( ga );
    if (LIKELY(sm)) {
+      /* The caller wants to get at the lines. */
+      if (UNLIKELY(is_SecMapU(sm)))
+         sm = shmem__expand_SecMapU( shmem__round_to_SecMap_base(ga), sm );
       if (CHECK_ZSM) tl_assert(is_sane_SecMap(sm));
       return sm;
    } else {
@@ -978,6 +1085,8 @@ static UWord shmem__SecMap_used_linesF(void)
    while (VG_(nextIterFM)( map_shmem, &gaKey, &secmapW )) {
       UWord   i;
       SecMap* sm = (SecMap*)secmapW;
+      if (is_SecMapU(sm))
+         continue;
       tl_assert(sm->magic == SecMap_MAGIC);
 
       for (i = 0; i < N_SECMAP_ZLINES; i++) {
@@ -1083,6 +1192,88 @@ static inline void clear_LineF_of_Z (LineZ *lineZ)
    lineZ->dict[1] = SVal_INVALID;
 }
 
+/* Drop the references held by sm, the SecMap or SecMapU at gaKey, and
+   take it out of map_shmem.  A SecMap goes on the free list. */
+static void shmem__remove_SecMap ( Addr gaKey, SecMap* sm )
+{
+   Addr    fm_gaKey;
+   SecMap* fm_sm;
+
+   if (!VG_(delFromFM)(map_shmem, &fm_gaKey, (UWord*)&fm_sm, gaKey))
+      tl_assert (0);
+   tl_assert (gaKey == fm_gaKey);
+   tl_assert (sm == fm_sm);
+   stats__secmaps_in_map_shmem--;
+   shmem__smCache_update (gaKey, NULL);
+
+   if (is_SecMapU(sm)) {
+      SVal__rcdec(SecMapU_of(sm)->sv);
+      VG_(freeEltPA)( SecMapU_pool_allocator, sm );
+      stats__secmapsU_in_map_shmem--;
+   } else {
+      UInt lz;
+      if (CHECK_ZSM) tl_assert(is_sane_SecMap(sm));
+      for (lz = 0; lz < N_SECMAP_ZLINES; lz++) {
+         LineZ *lineZ = &sm->linesZ[lz];
+         if (LIKELY(lineZ->dict[0] != SVal_INVALID))
+            rcdec_LineZ(lineZ);
+         else
+            clear_LineF_of_Z(lineZ);
+      }
+      push_SecMap_on_freelist (sm);
+   }
+}
+
+/* Make every byte of the SecMap range at gaKey hold sv, whatever it
+   held before.  Uses a SecMapU, or no SecMap for SVal_NOACCESS.  The
+   caller must make sure that no cache line in the range is written
+   back over this afterwards. */
+static void shmem__set_SecMap_uniform ( Addr gaKey, SVal sv )
+{
+   SecMap*  sm  = shmem__find_SecMap (gaKey);
+   SecMapU* smU = NULL;
+
+   tl_assert (sv != SVal_INVALID);
+   if (sv != SVal_NOACCESS) {
+      /* Take the new reference first, in case sm holds the only one. */
+      smU = VG_(allocEltPA)( SecMapU_pool_allocator );
+      smU->magic = SecMapU_MAGIC;
+      smU->sv    = sv;
+      SVal__rcinc(sv);
+   }
+   if (sm)
+      shmem__remove_SecMap (gaKey, sm);
+   if (smU) {
+      VG_(addToFM)( map_shmem, (UWord)gaKey, (UWord)smU );
+      stats__secmaps_in_map_shmem++;
+      stats__secmapsU_in_map_shmem++;
+   }
+}
+
+/* Replace smU, the SecMapU at gaKey, by an equivalent SecMap, so that
+   its lines can be changed one by one.  Returns the SecMap. */
+static SecMap* shmem__expand_SecMapU ( Addr gaKey, SecMap* smU )
+{
+   SVal    sv = SecMapU_of(smU)->sv;
+   SecMap* sm = shmem__alloc_or_recycle_SecMap();
+   UWord   i;
+
+   for (i = 0; i < N_SECMAP_ZLINES; i++) {
+      /* The other dict entries and ix2s are as allocated. */
+      sm->linesZ[i].dict[0] = sv;
+      rcinc_LineZ(&sm->linesZ[i]);
+   }
+   SVal__rcdec(sv);
+   VG_(freeEltPA)( SecMapU_pool_allocator, smU );
+
+   if (!VG_(addToFM)( map_shmem, (UWord)gaKey, (UWord)sm ))
+      tl_assert (0); /* it replaces smU */
+   stats__secmapsU_in_map_shmem--;
+   stats__secmaps_expanded++;
+   shmem__smCache_update (gaKey, sm);
+   return sm;
+}
+
 /* Given address 'tag', find either the Z or F line containing relevant
    data, so it can be read into the cache.
 */
@@ -1511,6 +1702,33 @@ static __attribute__((noinline)) void cacheline_wback ( UWord wix )
    if (!is_valid_scache_tag(tag))
       return;
 
+   /* Generate the data to be stored */
+   if (CHECK_ZSM)
+      tl_assert(is_sane_CacheLine(cl)); /* EXPENSIVE */
+
+   csvalsUsed = -1;
+   sequentialise_CacheLine( csvals, &csvalsUsed, 
+                            N_LINE_ARANGE, cl );
+   tl_assert(csvalsUsed >= 1 && csvalsUsed <= N_LINE_ARANGE);
+   if (0) VG_(printf)("%ld ", csvalsUsed);
+
+   /* If the line holds the value its whole SecMap range is known to
+      hold (SVal_NOACCESS if there is no SecMap), then there is nothing
+      to write back.  This keeps lines which were only read from
+      expanding SecMapUs or allocating SecMaps. */
+   sv = csvals[0].sval;
+   for (k = 1; k < csvalsUsed; k++)
+      if (csvals[k].sval != sv)
+         break;
+   if (k == csvalsUsed) {
+      sm = shmem__find_SecMap(tag);
+      if (sm == NULL ? sv == SVal_NOACCESS
+                     : is_SecMapU(sm) && SecMapU_of(sm)->sv == sv) {
+         stats__cache_U_wbacks++;
+         return;
+      }
+   }
+
    /* Where are we going to put it? */
    sm         = NULL;
    lineZ      = NULL;
@@ -1525,16 +1743,6 @@ static __attribute__((noinline)) void cacheline_wback ( UWord wix )
    tl_assert(zix >= 0 && zix < N_SECMAP_ZLINES);
    lineZ = &sm->linesZ[zix];
 
-   /* Generate the data to be stored */
-   if (CHECK_ZSM)
-      tl_assert(is_sane_CacheLine(cl)); /* EXPENSIVE */
-
-   csvalsUsed = -1;
-   sequentialise_CacheLine( csvals, &csvalsUsed, 
-                            N_LINE_ARANGE, cl );
-   tl_assert(csvalsUsed >= 1 && csvalsUsed <= N_LINE_ARANGE);
-   if (0) VG_(printf)("%ld ", csvalsUsed);
-
    lineZ->dict[0] = lineZ->dict[1] 
                   = lineZ->dict[2] = lineZ->dict[3] = SVal_INVALID;
 
@@ -1637,6 +1845,7 @@ static __attribute__((noinline)) void cacheline_fetch ( UWord wix )
    CacheLine* cl;
    LineZ*     lineZ;
    LineF*     lineF;
+   SecMap*    sm;
 
    if (0)
    VG_(printf)("scache fetch line %d\n", (Int)wix);
@@ -1649,6 +1858,19 @@ static __attribute__((noinline)) void cacheline_fetch ( UWord wix )
    /* reject nonsense requests */
    tl_assert(is_valid_scache_tag(tag));
 
+   /* A line of a SecMapU, or of no SecMap at all, is read without
+      creating or expanding anything: cacheline_wback only does that
+      if the line gets changed. */
+   sm = shmem__find_SecMap(tag);
+   if (sm == NULL || is_SecMapU(sm)) {
+      SVal sv = sm == NULL ? SVal_NOACCESS : SecMapU_of(sm)->sv;
+      for (i = 0; i < N_LINE_ARANGE; i++)
+         cl->svals[i] = sv;
+      stats__cache_U_fetches++;
+      normalise_CacheLine( cl );
+      return;
+   }
+
    lineZ = NULL;
    lineF = NULL;
    find_ZF_for_reading( &lineZ, &lineF, tag );
@@ -2000,6 +2222,14 @@ static void zsm_init ( void )
                              HG_(free)
                           );
 
+   SecMapU_pool_allocator = VG_(newPA) (
+                               sizeof(SecMapU),
+                               1000,
+                               HG_(zalloc),
+                               "libhb.SecMapU_storage.pool",
+                               HG_(free)
+                            );
+
    /* a SecMap must contain an integral number of CacheLines */
    tl_assert(0 == (N_SECMAP_ARANGE % N_LINE_ARANGE));
    /* also ... a CacheLine holds an integral number of trees */
@@ -2119,12 +2349,14 @@ static void verydead_thread_table_sort_and_check (XArray* thrids)
 /* A VTS contains .ts, its vector clock, and also .id, a field to hold
    a backlink for the caller's convenience.  Since we have no idea
    what to set that to in the library, it always gets set to
-   VtsID_INVALID. */
+   VtsID_INVALID.  .hash caches a hash of .ts for VTS__cmp_structural;
+   it is only valid for VTSs in vts_set, or on their way into it. */
 typedef
    struct {
       VtsID    id;
       UInt     usedTS;
       UInt     sizeTS;
+      UInt     hash;
       ScalarTS ts[0];
    }
    VTS;
@@ -2176,9 +2408,13 @@ static UInt VTS__cmpLEQ ( VTS* a, VTS* b );
 
 /* Compute an arbitrary structural (total) ordering on the two args,
    based on their VCs, so they can be looked up in a table, tree, etc.
-   Returns -1, 0 or 1. */
+   Both must have had their .hash set by VTS__rehash.  Returns -1, 0
+   or 1. */
 static Word VTS__cmp_structural ( VTS* a, VTS* b );
 
+/* Recompute vts->hash from vts->ts. */
+static void VTS__rehash ( VTS* vts );
+
 /* Debugging only.  Display the given VTS. */
 static void VTS__show ( const VTS* vts );
 
@@ -2243,6 +2479,7 @@ static VTS* VTS__clone ( const HChar* who, VTS* vts )
    clone->id = vts->id;
    clone->sizeTS = nTS;
    clone->usedTS = nTS;
+   clone->hash = vts->hash;
    UInt i;
    for (i = 0; i < nTS; i++) {
       clone->ts[i] = vts->ts[i];
@@ -2283,6 +2520,7 @@ static VTS* VTS__subtract ( const HChar* who, VTS* vts, XArray* thridsToDel )
    tl_assert(j == nReq);
    tl_assert(j == res->sizeTS);
    res->usedTS = j;
+   VTS__rehash(res);
    tl_assert( *(ULong*)(&res->ts[j]) == 0x0ddC0ffeeBadF00dULL);
    return res;
 }
@@ -2605,6 +2843,12 @@ Word VTS__cmp_structural ( VTS* a, VTS* b )
    tl_assert(a);
    tl_assert(b);
 
+   /* With many threads, the VTSs in the set tend to be long and to
+      share long prefixes, so comparing the hashes first saves walking
+      most of them on every step down the tree. */
+   if (a->hash != b->hash)
+      return a->hash < b->hash ? -1 : 1;
+
    ctsa = &a->ts[0]; useda = a->usedTS;
    ctsb = &b->ts[0]; usedb = b->usedTS;
 
@@ -2644,6 +2888,25 @@ Word VTS__cmp_structural ( VTS* a, VTS* b )
 }
 
 
+/* Recompute vts->hash.  This is only done when a VTS is looked up in,
+   or added to, a VTS set, so it doesn't need to be blindingly fast,
+   but it should spread VTSs which differ in just one entry.
+*/
+static void VTS__rehash ( VTS* vts )
+{
+   UWord i;
+   UInt  h = vts->usedTS;
+   for (i = 0; i < vts->usedTS; i++) {
+      const ScalarTS *st = &vts->ts[i];
+      ULong tym = st->tym;
+      h = (h << 5) ^ (h >> 27) ^ st->thrid;
+      h = (h << 5) ^ (h >> 27) ^ (UInt)tym;
+      h = (h << 5) ^ (h >> 27) ^ (UInt)(tym >> 32);
+   }
+   vts->hash = h;
+}
+
+
 /* Debugging only.  Display the given VTS.
 */
 static void VTS__show ( const VTS* vts )
@@ -2749,6 +3012,7 @@ static Bool vts_set__find__or__clone_and_add ( /*OUT*/VTS** res, VTS* cand )
    UWord keyW, valW;
    stats__vts_set__focaa++;
    tl_assert(cand->id == VtsID_INVALID);
+   VTS__rehash(cand);
    /* lookup cand (by value) */
    if (VG_(lookupFM)( vts_set, &keyW, &valW, (UWord)cand )) {
       /* found it */
@@ -3266,6 +3530,10 @@ static void vts_tab__do_GC ( Bool show_stats )
    while (VG_(nextIterFM)( map_shmem, NULL, &secmapW )) {
       UWord   j;
       SecMap* sm = (SecMap*)secmapW;
+      if (is_SecMapU(sm)) {
+         remap_VtsIDs_in_SVal(vts_tab, new_tab, &SecMapU_of(sm)->sv);
+         continue;
+      }
       tl_assert(sm->magic == SecMap_MAGIC);
       /* Deal with the LineZs */
       for (i = 0; i < N_SECMAP_ZLINES; i++) {
@@ -6148,6 +6416,17 @@ static void zsm_sset_range ( Addr a, SizeT len, SVal svNew )
          if (aligned_start >= after_start)
             break;
          tl_assert(get_cacheline_offset(aligned_start) == 0);
+         if (shmem__get_SecMap_offset(aligned_start) == 0
+             && after_start - aligned_start >= N_SECMAP_ARANGE) {
+            /* A whole SecMap range: its lines all become svNew, so it
+               can be made uniform without looking at them.  Cached
+               lines must not be written back over it. */
+            shmem__invalidate_scache_range (aligned_start, N_SECMAP_ARANGE);
+            shmem__set_SecMap_uniform (aligned_start, svNew);
+            aligned_start += N_SECMAP_ARANGE;
+            aligned_len -= N_SECMAP_ARANGE;
+            continue;
+         }
          tag = aligned_start & ~(N_LINE_ARANGE - 1);
          wix = (aligned_start >> N_LINE_BITS) & (N_WAY_NENT - 1);
          if (tag == cache_shmem.tags0[wix]) {
@@ -6647,7 +6926,7 @@ void libhb_shutdown ( Bool show_stats )
       VG_(printf)(" secmaps: %'10lu in map (can be scanGCed %'5lu)"
                   " #%lu scanGC \n",
                   stats__secmaps_in_map_shmem,
-                  shmem__SecMap_do_GC(False /* really do GC */),
+                  shmem__SecMap_GC_count(),
                   stats__secmaps_scanGC);
       tl_assert (VG_(sizeFM) (map_shmem) == stats__secmaps_in_map_shmem);
       VG_(printf)(" secmaps: %'10lu in freelist,"
@@ -6655,6 +6934,11 @@ void libhb_shutdown ( Bool show_stats )
                   SecMap_freelist_length(),
                   stats__secmaps_scanGCed,
                   stats__secmaps_ssetGCed);
+      VG_(printf)(" secmaps: %'10lu uniform in map"
+                  " (%'lu compacted, %'lu expanded)\n",
+                  stats__secmapsU_in_map_shmem,
+                  stats__secmaps_compacted,
+                  stats__secmaps_expanded);
       VG_(printf)(" secmaps: %'10lu searches (%'12lu slow)\n",
                   stats__secmaps_search, stats__secmaps_search_slow);
 
@@ -6665,6 +6949,8 @@ void libhb_shutdown ( Bool show_stats )
                   stats__cache_Z_fetches, stats__cache_F_fetches );
       VG_(printf)("   cache: %'14lu Z-wback,    %'14lu F-wback\n",
                   stats__cache_Z_wbacks, stats__cache_F_wbacks );
+      VG_(printf)("   cache: %'14lu U-fetch,    %'14lu U-wback\n",
+                  stats__cache_U_fetches, stats__cache_U_wbacks );
       VG_(printf)("   cache: %'14lu flushes_invals\n",
                   stats__cache_flushes_invals );
       VG_(printf)("   cache: %'14llu arange_New  %'14llu direct-to-Zreps\n",
@@ -7125,6 +7411,16 @@ static void zsm_sset_range_noaccess_in_secmap(Addr a, SizeT len)
    UWord zix_start = shmem__get_SecMap_offset(a          ) >> N_LINE_BITS;
    UWord zix_end   = shmem__get_SecMap_offset(a + len - 1) >> N_LINE_BITS;
 
+   if (sm1 && is_SecMapU(sm1)) {
+      SecMap* smU = sm1;
+      sm1 = shmem__expand_SecMapU (shmem__round_to_SecMap_base(a), smU);
+      if (sm2 == smU)
+         sm2 = sm1;
+   }
+   if (sm2 && is_SecMapU(sm2))
+      sm2 = shmem__expand_SecMapU (shmem__round_to_SecMap_base(a + len - 1),
+                                   sm2);
+
    if (sm1) {
       if (CHECK_ZSM) tl_assert(is_sane_SecMap(sm1));
       zsm_secmap_line_range_noaccess (sm1, zix_start,
@@ -7229,44 +7525,13 @@ static void zsm_sset_range_noaccess (Addr addr, SizeT len)
       while (sm_start < AFC) {
          SecMap *sm = shmem__find_SecMap (sm_start);
          if (sm) {
-            Addr gaKey;
-            SecMap *fm_sm;
-
-            if (CHECK_ZSM) tl_assert(is_sane_SecMap(sm));
-            for (UInt lz = 0; lz < N_SECMAP_ZLINES; lz++) {
-               LineZ *lineZ = &sm->linesZ[lz];
-               if (LIKELY(lineZ->dict[0] != SVal_INVALID))
-                  rcdec_LineZ(lineZ);
-               else
-                  clear_LineF_of_Z(lineZ);
-            }
-            if (!VG_(delFromFM)(map_shmem, &gaKey, (UWord*)&fm_sm, sm_start))
-               tl_assert (0);
-            stats__secmaps_in_map_shmem--;
-            tl_assert (gaKey == sm_start);
-            tl_assert (sm == fm_sm);
+            /* This also drops any smCache entry for it. */
+            shmem__remove_SecMap (sm_start, sm);
             stats__secmaps_ssetGCed++;
-            push_SecMap_on_freelist (sm);
          }
          sm_start += N_SECMAP_ARANGE;
       }
       tl_assert (sm_start == AFC);
-
-      /* The above loop might have kept copies of freed SecMap in the smCache.
-         => clear them. */
-      if (address_in_range(smCache[0].gaKey, FSM, FSMlen)) {
-         smCache[0].gaKey = 1;
-         smCache[0].sm = NULL;
-      }
-      if (address_in_range(smCache[1].gaKey, FSM, FSMlen)) {
-         smCache[1].gaKey = 1;
-         smCache[1].sm = NULL;
-      }
-      if (address_in_range(smCache[2].gaKey, FSM, FSMlen)) {
-         smCache[2].gaKey = 1;
-         smCache[2].sm = NULL;
-      }
-      STATIC_ASSERT (3 == sizeof(smCache)/sizeof(SMCacheEnt));
    }
 }
 
@@ -7324,6 +7589,8 @@ UWord libhb_srange_get_abits (Addr a, UChar *abits, SizeT len)
          LineZ *lineZ;
          if (sm == NULL)
             sv = SVal_NOACCESS;
+         else if (is_SecMapU(sm))
+            sv = SecMapU_of(sm)->sv;
          else {
             UWord zix = shmem__get_SecMap_offset(b) >> N_LINE_BITS;
             lineZ = &sm->linesZ[zix];
@@ -7409,14 +7676,13 @@ void libhb_maybe_GC ( void )
 
    /* scan GC the SecMaps when
           (1) no SecMap in the freelist
-      and (2) the current nr of live secmaps exceeds the threshold. */
-   if (UNLIKELY(SecMap_freelist == NULL
-                && stats__secmaps_in_map_shmem >= next_SecMap_GC_at)) {
-      // If we did a vts tab GC, then no need to flush the cache again.
-      if (!vts_tab_GC)
-         zsm_flush_cache();
-      shmem__SecMap_do_GC(True);
-   }
+      and (2) the current nr of live full secmaps exceeds the threshold,
+      or carry on with the GC cycle already under way. */
+   if (UNLIKELY(SecMap_GC_running
+                || (SecMap_freelist == NULL
+                    && stats__secmaps_in_map_shmem
+                       - stats__secmapsU_in_map_shmem >= next_SecMap_GC_at)))
+      shmem__SecMap_GC_step();
 
    /* Check the reference counts (expensive) */
    if (CHECK_CEM)
@@ -74,6 +74,45 @@ extern Int  VG_(fork)   ( void);
 extern void VG_(execv)  ( const HChar* filename, const HChar** argv );
 extern Int  VG_(sysctl) ( Int *name, UInt namelen, void *oldp, SizeT *oldlenp, void *newp, SizeT newlen );
 
+/* ---------------------------------------------------------------------
+   Writer processes
+   ------------------------------------------------------------------ */
+
+// Forks a helper process to do a tool's output writing, so that the guest
+// only waits for data to be copied into a pipe, never for the disk.  The
+// returned descriptor (or -1 if the writer could not be started) is the
+// pipe's write end; VG_(write) to it blocks while the pipe is full, which
+// throttles the guest to the writer's pace.  'pipe_szB', if nonzero, asks
+// for a pipe of that size, where the kernel allows it.  The helper runs
+// 'body' with the read end and 'out_fd', and exits when it returns; a
+// NULL body just copies everything to 'out_fd' until end of file.  The
+// helper shares 'out_fd', including its file offset, with the caller.
+extern Int  VG_(start_writer)  ( Int out_fd, SizeT pipe_szB,
+                                 void (*body)(Int in_fd, Int out_fd),
+                                 /*OUT*/Int* pid );
+// Closes the pipe and waits for the writer to finish.  Returns its wait
+// status, or -1 if it could not be waited for.
+extern Int  VG_(finish_writer) ( Int fd, Int pid );
+// Closes the pipe without waiting.  For the child of a guest fork, which
+// inherits the pipe but must not keep the parent's writer alive.
+extern void VG_(abandon_writer) ( Int fd );
+
+/* ---------------------------------------------------------------------
+   Helper processes
+   ------------------------------------------------------------------ */
+
+// Forks a helper process that runs 'body' on a copy-on-write snapshot of
+// our memory and sends its results back through a pipe: 'body' gets the
+// pipe's write end and 'opaque', and the helper exits when it returns.
+// Asynchronous signals are blocked in the helper, but faults are still
+// delivered, so fault catchers keep working.  Returns the pipe's read end,
+// or -1 if the helper could not be started.
+extern Int  VG_(start_helper)  ( void (*body)(Int out_fd, void* opaque),
+                                 void* opaque, /*OUT*/Int* pid );
+// Closes the pipe and waits for the helper to finish.  Returns its wait
+// status, or -1 if it could not be waited for.
+extern Int  VG_(finish_helper) ( Int fd, Int pid );
+
 /* ---------------------------------------------------------------------
    Resource limits and capabilities
    ------------------------------------------------------------------ */
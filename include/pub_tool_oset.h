@@ -117,6 +117,10 @@ extern void  VG_(OSetWord_Destroy) ( OSet* os );
 // * Insert: Inserts a new element into the set.  Duplicates are forbidden,
 //   and will cause assertion failures.
 //
+// * BulkLoad: Inserts the n values of vals[], which must be in strictly
+//   increasing order, into an empty set.  This builds a balanced tree
+//   directly, which is much quicker than n Inserts.
+//
 // * Remove: Removes the value from the set, if present.  Returns a Bool
 //   indicating if the value was removed.
 //
@@ -144,7 +148,9 @@ extern void  VG_(OSetWord_Destroy) ( OSet* os );
 
 extern Word  VG_(OSetWord_Size)         ( const OSet* os );
 extern void  VG_(OSetWord_Insert)       ( OSet* os, UWord val );
-extern Bool  VG_(OSetWord_Contains)     ( const OSet* os, UWord val );
+extern void  VG_(OSetWord_BulkLoad)     ( OSet* os, const UWord* vals,
+                                          Word n );
+extern Bool  VG_(OSetWord_Contains)     ( OSet* os, UWord val );
 extern Bool  VG_(OSetWord_Remove)       ( OSet* os, UWord val );
 extern void  VG_(OSetWord_ResetIter)    ( OSet* os );
 extern Bool  VG_(OSetWord_Next)         ( OSet* os, /*OUT*/UWord* val );
@@ -257,10 +263,18 @@ extern OSet* VG_(OSetGen_EmptyClone) (const OSet* os);
 //   get assertion failures about "bad magic".  Duplicates are forbidden,
 //   and will also cause assertion failures.
 //
+// * BulkLoad: Inserts the n elements of elems[] into an empty set.  The
+//   elements must be allocated as for Insert, and their keys must be in
+//   strictly increasing order, which is checked.  This builds a balanced
+//   tree directly, in O(n) time rather than the O(n log n) of n Inserts.
+//
 // * Contains: Determines if any element in the OSet matches the key.
 //
 // * Lookup: Returns a pointer to the element matching the key, if there is
-//   one, otherwise returns NULL.
+//   one, otherwise returns NULL.  The element found last is checked before
+//   searching the tree, so repeated lookups of the same key are cheap.
+//   Remembering it updates the OSet, so Lookup and Contains take a
+//   non-const OSet.
 //
 // * LookupWithCmp: Like Lookup, but you specify the comparison function,
 //   which overrides the OSet's normal one.
@@ -295,8 +309,10 @@ extern OSet* VG_(OSetGen_EmptyClone) (const OSet* os);
 
 extern UInt  VG_(OSetGen_Size)         ( const OSet* os );
 extern void  VG_(OSetGen_Insert)       ( OSet* os, void* elem );
-extern Bool  VG_(OSetGen_Contains)     ( const OSet* os, const void* key );
-extern void* VG_(OSetGen_Lookup)       ( const OSet* os, const void* key );
+extern void  VG_(OSetGen_BulkLoad)     ( OSet* os, void* const* elems,
+                                         Word n );
+extern Bool  VG_(OSetGen_Contains)     ( OSet* os, const void* key );
+extern void* VG_(OSetGen_Lookup)       ( OSet* os, const void* key );
 extern void* VG_(OSetGen_LookupWithCmp)( OSet* os,
                                          const void* key, OSetCmp_t cmp );
 extern void* VG_(OSetGen_Remove)       ( OSet* os, const void* key );
@@ -58,17 +58,31 @@ void VG_(deleteRangeMap) ( RangeMap* );
 /* Bind the range [key_min, key_max] to val, overwriting any other
    bindings existing in the range.  Asserts if key_min > key_max.  If
    as a result of this addition, there come to be multiple adjacent
-   ranges with the same value, these ranges are merged together.  Note
-   that this is slow: O(N) in the number of existing ranges. */
+   ranges with the same value, these ranges are merged together.  Only
+   the neighbourhood of the new range is examined for merging, but
+   splitting and merging still move the ranges above it, so this is
+   O(N) in the number of existing ranges in the worst case.  To bind
+   many ranges at once use VG_(bindRangeMapSorted). */
 void VG_(bindRangeMap) ( RangeMap* rm,
                          UWord key_min, UWord key_max, UWord val );
 
+/* Equivalent to calling VG_(bindRangeMap) for [key_mins[i],
+   key_maxs[i]] -> vals[i] with i = 0 .. n-1 in turn, but the new
+   ranges must be in ascending order and must not overlap (this is
+   asserted).  The map is rebuilt in a single pass, so this takes
+   O(N + n) time rather than O(N * n). */
+void VG_(bindRangeMapSorted) ( RangeMap* rm, Word n,
+                               const UWord* key_mins, const UWord* key_maxs,
+                               const UWord* vals );
+
 /* Looks up |key| in the array and returns the associated value and
    the key bounds.  Can never fail since the RangeMap covers the
    entire key space.  This is fast: O(log N) in the number of
-   ranges. */
+   ranges, and O(1) when the range is the same as that of the
+   previous lookup, which the map remembers, hence the non-const
+   map. */
 void VG_(lookupRangeMap) ( /*OUT*/UWord* key_min, /*OUT*/UWord* key_max,
-                           /*OUT*/UWord* val, const RangeMap* rm, UWord key );
+                           /*OUT*/UWord* val, RangeMap* rm, UWord key );
 
 /* How many elements are there in the map? */
 UInt VG_(sizeRangeMap) ( const RangeMap* rm );
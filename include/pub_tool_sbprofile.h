@@ -0,0 +1,49 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Superblock profiles from earlier runs.  pub_tool_sbprofile.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2012-2017 Mozilla Foundation
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PUB_TOOL_SBPROFILE_H
+#define __PUB_TOOL_SBPROFILE_H
+
+#include "pub_tool_basics.h"   // VG_ macro and primitive types
+
+/* Returns the number of times the superblock starting at guest
+   address 'addr' was executed, according to the profile loaded with
+   --profile-sbs-in=, or 0 if no profile was loaded or the block is
+   not in it.  The profile is written by --profile-sbs-out= from an
+   earlier run of the same program; since Valgrind's address space
+   layout is deterministic, addresses match from run to run.  Tools
+   can call this from their instrumentation function to treat known
+   hot blocks specially from their first translation. */
+extern ULong VG_(get_SB_profile_count) ( Addr addr );
+
+#endif   // __PUB_TOOL_SBPROFILE_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                     pub_tool_sbprofile.h ---*/
+/*--------------------------------------------------------------------*/
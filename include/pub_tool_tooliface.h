@@ -469,6 +469,14 @@ extern void VG_(needs_info_location) (
 /* Do we need to see variable type and location information? */
 extern void VG_(needs_var_info) ( void );
 
+/* Can the reading of an object's symbols and debug info be put off until
+   the first query that needs them?  Tools that only symbolise at output
+   time should say so; start-up then no longer pays for reading every
+   object mapped.  Until an object has been queried,
+   VG_(next_DebugInfo) still lists it, but with no text or data
+   sections. */
+extern void VG_(needs_lazy_debuginfo) ( void );
+
 /* Does the tool replace malloc() and friends with its own versions?
    This has to be combined with the use of a vgpreload_<tool>.so module
    or it won't work.  See massif/Makefile.am for how to build it. */
@@ -130,7 +130,9 @@ extern Int VG_(XT_offset_main_or_below_main)(DiEpoch ep, Addr* ips, Int n_ips);
 
    Note: to spare memory, some data is shared between an xt and all its
    snapshots. This memory is released when the last XTree using this memory
-   is deleted. */
+   is deleted.  The data values are also shared, and copied by chunks only
+   when xt modifies them, so taking a snapshot is cheap and its memory is
+   mostly the data that changed since the previous snapshot. */
 extern XTree* VG_(XT_snapshot)(XTree* xt);
 
 /*  Non frozen dup currently not needed : 
@@ -5122,6 +5122,112 @@ struct vki_bpf_btf_info {
 	__vki_u32 id;
 } __attribute__((aligned(8)));
 
+//----------------------------------------------------------------------
+// From linux-5.4/include/uapi/linux/io_uring.h
+//----------------------------------------------------------------------
+
+struct vki_io_uring_sqe {
+	__vki_u8	opcode;		/* type of operation for this sqe */
+	__vki_u8	flags;		/* IOSQE_ flags */
+	__vki_u16	ioprio;		/* ioprio for the request */
+	__vki_s32	fd;		/* file descriptor to do IO on */
+	__vki_u64	off;		/* offset into file */
+	__vki_u64	addr;		/* pointer to buffer or iovecs */
+	__vki_u32	len;		/* buffer size or number of iovecs */
+	__vki_u32	op_flags;	/* rw_flags, fsync_flags, msg_flags ... */
+	__vki_u64	user_data;	/* data to be passed back at completion time */
+	__vki_u64	__pad2[3];	/* buf_index */
+};
+
+#define VKI_IOSQE_BUFFER_SELECT		(1U << 5)
+
+#define VKI_IORING_SETUP_SQPOLL		(1U << 1)
+
+#define VKI_IORING_OP_NOP		0
+#define VKI_IORING_OP_READV		1
+#define VKI_IORING_OP_WRITEV		2
+#define VKI_IORING_OP_FSYNC		3
+#define VKI_IORING_OP_READ_FIXED	4
+#define VKI_IORING_OP_WRITE_FIXED	5
+#define VKI_IORING_OP_POLL_ADD		6
+#define VKI_IORING_OP_POLL_REMOVE	7
+#define VKI_IORING_OP_SYNC_FILE_RANGE	8
+#define VKI_IORING_OP_SENDMSG		9
+#define VKI_IORING_OP_RECVMSG		10
+#define VKI_IORING_OP_TIMEOUT		11
+#define VKI_IORING_OP_TIMEOUT_REMOVE	12
+#define VKI_IORING_OP_ACCEPT		13
+#define VKI_IORING_OP_ASYNC_CANCEL	14
+#define VKI_IORING_OP_LINK_TIMEOUT	15
+#define VKI_IORING_OP_CONNECT		16
+#define VKI_IORING_OP_FALLOCATE		17
+#define VKI_IORING_OP_OPENAT		18
+#define VKI_IORING_OP_CLOSE		19
+#define VKI_IORING_OP_FILES_UPDATE	20
+#define VKI_IORING_OP_STATX		21
+#define VKI_IORING_OP_READ		22
+#define VKI_IORING_OP_WRITE		23
+#define VKI_IORING_OP_FADVISE		24
+#define VKI_IORING_OP_MADVISE		25
+#define VKI_IORING_OP_SEND		26
+#define VKI_IORING_OP_RECV		27
+
+#define VKI_IORING_OFF_SQ_RING		0ULL
+#define VKI_IORING_OFF_CQ_RING		0x8000000ULL
+#define VKI_IORING_OFF_SQES		0x10000000ULL
+
+struct vki_io_sqring_offsets {
+	__vki_u32 head;
+	__vki_u32 tail;
+	__vki_u32 ring_mask;
+	__vki_u32 ring_entries;
+	__vki_u32 flags;
+	__vki_u32 dropped;
+	__vki_u32 array;
+	__vki_u32 resv1;
+	__vki_u64 resv2;
+};
+
+struct vki_io_cqring_offsets {
+	__vki_u32 head;
+	__vki_u32 tail;
+	__vki_u32 ring_mask;
+	__vki_u32 ring_entries;
+	__vki_u32 overflow;
+	__vki_u32 cqes;
+	__vki_u64 resv[2];
+};
+
+#define VKI_IORING_ENTER_GETEVENTS	(1U << 0)
+#define VKI_IORING_ENTER_SQ_WAKEUP	(1U << 1)
+
+struct vki_io_uring_params {
+	__vki_u32 sq_entries;
+	__vki_u32 cq_entries;
+	__vki_u32 flags;
+	__vki_u32 sq_thread_cpu;
+	__vki_u32 sq_thread_idle;
+	__vki_u32 features;
+	__vki_u32 resv[4];
+	struct vki_io_sqring_offsets sq_off;
+	struct vki_io_cqring_offsets cq_off;
+};
+
+#define VKI_IORING_REGISTER_BUFFERS		0
+#define VKI_IORING_UNREGISTER_BUFFERS		1
+#define VKI_IORING_REGISTER_FILES		2
+#define VKI_IORING_UNREGISTER_FILES		3
+#define VKI_IORING_REGISTER_EVENTFD		4
+#define VKI_IORING_UNREGISTER_EVENTFD		5
+#define VKI_IORING_REGISTER_FILES_UPDATE	6
+#define VKI_IORING_REGISTER_EVENTFD_ASYNC	7
+
+struct vki_io_uring_files_update {
+	__vki_u32 offset;
+	__vki_u32 resv;
+	__vki_aligned_u64 /* __s32 * */ fds;
+};
+
 /*--------------------------------------------------------------------*/
 /*--- end                                                          ---*/
 /*--------------------------------------------------------------------*/
@@ -414,6 +414,9 @@
 #define __NR_pkey_alloc         330
 #define __NR_pkey_free          331
 #define __NR_statx              332
+#define __NR_io_uring_setup     425
+#define __NR_io_uring_enter     426
+#define __NR_io_uring_register  427
 
 #endif /* __VKI_SCNUMS_AMD64_LINUX_H */
 
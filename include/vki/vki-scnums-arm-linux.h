@@ -434,6 +434,9 @@
 #define __NR_pkey_alloc                 395
 #define __NR_pkey_free                  396
 #define __NR_statx                      397
+#define __NR_io_uring_setup             425
+#define __NR_io_uring_enter             426
+#define __NR_io_uring_register          427
 
 
 
@@ -343,6 +343,10 @@
 #define __NR_statx			379
 #define __NR_s390_sthyi			380
 
+#define __NR_io_uring_setup		425
+#define __NR_io_uring_enter		426
+#define __NR_io_uring_register		427
+
 #define NR_syscalls 381
 
 /* 
@@ -420,6 +420,10 @@
 #define __NR_statx              383
 #define __NR_arch_prctl         384
 
+#define __NR_io_uring_setup     425
+#define __NR_io_uring_enter     426
+#define __NR_io_uring_register  427
+
 #endif /* __VKI_SCNUMS_X86_LINUX_H */
 
 /*--------------------------------------------------------------------*/
@@ -163,6 +163,7 @@ Number of snapshots: 50
 #include "pub_tool_machine.h"
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
+#include "pub_tool_oset.h"
 #include "pub_tool_poolalloc.h"
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_stacktrace.h"
@@ -1444,38 +1445,146 @@ static SizeT ms_malloc_usable_size ( ThreadId tid, void* p )
 //--- Page handling                                        ---//
 //------------------------------------------------------------//
 
+// With --pages-as-heap=yes, each mapped range is one Page_Chunk rather
+// than one HP_Chunk per page, so that a mapping costs one stack trace and
+// one XTree update however big it is.  Adjacent ranges mapped from the
+// same context are coalesced, and unmapping the middle of a range just
+// splits it in two.  The chunks never overlap, so page_chunks can look
+// up the one holding any address.
+typedef
+   struct {
+      Addr  data;       // First byte of the range
+      SizeT szB;        // Size of the range, a multiple of the page size
+      Xecu  where;      // Where mapped; XTree xecu from heap_xt
+   }
+   Page_Chunk;
+
+static OSet* page_chunks = NULL;   // Page_Chunks
+
+static Word page_chunk_cmp ( const void* key, const void* elem )
+{
+   Addr              a  = *(const Addr*)key;
+   const Page_Chunk* pc = elem;
+   if (a < pc->data)            return -1;
+   if (a - pc->data >= pc->szB) return  1;
+   return 0;
+}
+
+static void ms_unrecord_page_mem( Addr a, SizeT len );
+
+static void add_page_chunk ( Addr a, SizeT szB, Xecu where )
+{
+   Page_Chunk* pc = VG_(OSetGen_AllocNode)(page_chunks, sizeof(Page_Chunk));
+   pc->data  = a;
+   pc->szB   = szB;
+   pc->where = where;
+   VG_(OSetGen_Insert)(page_chunks, pc);
+}
+
 static
 void ms_record_page_mem ( Addr a, SizeT len )
 {
-   ThreadId tid = VG_(get_running_tid)();
-   Addr end;
+   ThreadId    tid   = VG_(get_running_tid)();
+   Addr        end   = a + len;
+   Addr        below = a - 1;
+   Page_Chunk* prev;
+   Page_Chunk* next;
+   Xecu        where;
    tl_assert(VG_IS_PAGE_ALIGNED(len));
    tl_assert(len >= VKI_PAGE_SIZE);
-   // Record the first N-1 pages as blocks, but don't do any snapshots.
-   for (end = a + len - VKI_PAGE_SIZE; a < end; a += VKI_PAGE_SIZE) {
-      record_block( tid, (void*)a, VKI_PAGE_SIZE, /*slop_szB*/0,
-                    /*exclude_first_entry*/False, /*maybe_snapshot*/False );
+
+   // A mapping placed over pages we still hold replaces them.  The chunks
+   // must not overlap, so drop the old ones first.
+   VG_(OSetGen_ResetIterAt)(page_chunks, &a);
+   next = VG_(OSetGen_Next)(page_chunks);
+   if (next && next->data < end)
+      ms_unrecord_page_mem(a, len);
+
+   VERB(3, "<<< record_page_mem (%#lx, %lu)\n", a, len);
+   where = add_heap_xt( tid, len, /*exclude_first_entry*/False );
+
+   // Coalesce with the neighbouring ranges if they come from the same
+   // place.  The one above has to be re-keyed, so take it out first.
+   prev = a > 0 ? VG_(OSetGen_Lookup)(page_chunks, &below) : NULL;
+   next = VG_(OSetGen_Lookup)(page_chunks, &end);
+   if (next && next->data == end && next->where == where) {
+      VG_(OSetGen_Remove)(page_chunks, &end);
+      len += next->szB;
+      VG_(OSetGen_FreeNode)(page_chunks, next);
+   }
+   if (prev && prev->data + prev->szB == a && prev->where == where) {
+      prev->szB += len;
+   } else {
+      add_page_chunk(a, len, where);
    }
-   // Record the last page as a block, and maybe do a snapshot afterwards.
-   record_block( tid, (void*)a, VKI_PAGE_SIZE, /*slop_szB*/0,
-                 /*exclude_first_entry*/False, /*maybe_snapshot*/True );
+
+   if (VG_(XT_n_ips_sel)(heap_xt, where) > 0) {
+      n_heap_allocs++;
+      update_heap_stats(end - a, 0);
+      maybe_take_snapshot(Normal, "  alloc");
+   } else {
+      n_ignored_heap_allocs++;
+      VERB(3, "(ignored)\n");
+   }
+   VERB(3, ">>>\n");
 }
 
 static
 void ms_unrecord_page_mem( Addr a, SizeT len )
 {
-   Addr end;
+   Addr  end  = a + len;
+   Addr  cur  = a;
+   Bool  seen = False;
    tl_assert(VG_IS_PAGE_ALIGNED(len));
    tl_assert(len >= VKI_PAGE_SIZE);
-   // Unrecord the first page. This might be the peak, so do a snapshot.
-   unrecord_block((void*)a, /*maybe_snapshot*/True,
-                  /*exclude_first_entry*/False);
-   a += VKI_PAGE_SIZE;
-   // Then unrecord the remaining pages, but without snapshots.
-   for (end = a + len - VKI_PAGE_SIZE; a < end; a += VKI_PAGE_SIZE) {
-      unrecord_block((void*)a, /*maybe_snapshot*/False,
-                     /*exclude_first_entry*/False);
+
+   VERB(3, "<<< unrecord_page_mem (%#lx, %lu)\n", a, len);
+   // Visit each range overlapping [a, end) in turn.  Removing or splitting
+   // one clears the iterator, so restart it from where we have got to.
+   while (cur < end) {
+      Page_Chunk* pc;
+      Addr        lo, hi, pc_end;
+      VG_(OSetGen_ResetIterAt)(page_chunks, &cur);
+      pc = VG_(OSetGen_Next)(page_chunks);
+      if (pc == NULL || pc->data >= end)
+         break;
+      pc_end = pc->data + pc->szB;
+      lo     = pc->data < a  ? a   : pc->data;
+      hi     = pc_end   > end ? end : pc_end;
+
+      if (VG_(XT_n_ips_sel)(heap_xt, pc->where) > 0) {
+         // The first removal might be from the peak, so do a snapshot.
+         if (!seen)
+            maybe_take_snapshot(Peak, "de-PEAK");
+         seen = True;
+         n_heap_frees++;
+         update_heap_stats(-(SSizeT)(hi - lo), 0);
+         sub_heap_xt(pc->where, hi - lo, /*exclude_first_entry*/False);
+      } else {
+         n_ignored_heap_frees++;
+         VERB(3, "(ignored)\n");
+      }
+
+      // Keep whatever is left of the range below lo and above hi.
+      if (lo > pc->data) {
+         pc->szB = lo - pc->data;
+         if (hi < pc_end)
+            add_page_chunk(hi, pc_end - hi, pc->where);
+      } else {
+         VG_(OSetGen_Remove)(page_chunks, &pc->data);
+         if (hi < pc_end) {
+            pc->data = hi;
+            pc->szB  = pc_end - hi;
+            VG_(OSetGen_Insert)(page_chunks, pc);
+         } else {
+            VG_(OSetGen_FreeNode)(page_chunks, pc);
+         }
+      }
+      cur = hi;
    }
+   if (seen)
+      maybe_take_snapshot(Normal, "dealloc");
+   VERB(3, ">>>\n");
 }
 
 //------------------------------------------------------------//
@@ -1855,11 +1964,17 @@ static void handle_all_snapshots_monitor_command (const HChar *filename)
 
 static void xtmemory_report_next_block(XT_Allocs* xta, ExeContext** ec_alloc)
 {
-   const HP_Chunk* hc = VG_(HT_Next)(malloc_list);
+   const HP_Chunk*   hc = VG_(HT_Next)(malloc_list);
+   const Page_Chunk* pc;
    if (hc) {
       xta->nbytes = hc->req_szB;
       xta->nblocks = 1;
       *ec_alloc = VG_(XT_get_ec_from_xecu)(heap_xt, hc->where);
+   } else if ((pc = VG_(OSetGen_Next)(page_chunks))) {
+      // Report pages as blocks, as they were each one before.
+      xta->nbytes = pc->szB;
+      xta->nblocks = pc->szB / VKI_PAGE_SIZE;
+      *ec_alloc = VG_(XT_get_ec_from_xecu)(heap_xt, pc->where);
    } else
       xta->nblocks = 0;
 }
@@ -1867,6 +1982,7 @@ static void ms_xtmemory_report ( const HChar* filename, Bool fini )
 { 
    // Make xtmemory_report_next_block ready to be called.
    VG_(HT_ResetIter)(malloc_list);
+   VG_(OSetGen_ResetIter)(page_chunks);
    VG_(XTMemory_report)(filename, fini, xtmemory_report_next_block,
                         VG_(XT_filter_maybe_below_main));
    /* As massif already filters one top function, use as filter
@@ -2130,6 +2246,10 @@ static void ms_pre_clo_init(void)
        "massif MC_Chunk pool",
        VG_(free));
    malloc_list = VG_(HT_construct)( "Massif's malloc list" );
+   page_chunks = VG_(OSetGen_Create)( offsetof(Page_Chunk, data),
+                                      page_chunk_cmp,
+                                      VG_(malloc), "ms.page_chunks",
+                                      VG_(free) );
 
    // Heap XTree
    heap_xt = VG_(XT_create)(VG_(malloc),
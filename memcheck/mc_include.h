@@ -252,6 +252,8 @@ enum {
    MCPE_STOREV32_SLOW2,
    MCPE_STOREV32_SLOW3,
    MCPE_STOREV32_SLOW4,
+   MCPE_STOREV_128_OR_256_DEFINED,
+   MCPE_STOREV_128_OR_256_DEFINED_SLOW,
    MCPE_STOREV64,
    MCPE_STOREV64_SLOW1,
    MCPE_STOREV64_SLOW2,
@@ -669,6 +671,10 @@ typedef
    Default : all heuristics. */
 extern UInt MC_(clo_leak_check_heuristics);
 
+/* Nr of processes scanning the root set during a leak search.
+   Default : 1. */
+extern Int MC_(clo_leak_check_jobs);
+
 /* Assume accesses immediately below %esp are due to gcc-2.96 bugs.
  * default: NO */
 extern Bool MC_(clo_workaround_gcc296_bugs);
@@ -721,6 +727,12 @@ extern KeepStacktraces MC_(clo_keep_stacktraces);
 */
 extern Int MC_(clo_mc_level);
 
+/* How much memory the origin-tag cache holds the origins of, in MB,
+   and the nr of lines in each of its sets (a power of 2).  Only used
+   if MC_(clo_mc_level) is 3.  Default : 64 and 2. */
+extern Int MC_(clo_ocache_size);
+extern Int MC_(clo_ocache_assoc);
+
 /* Should we show mismatched frees?  Default: YES */
 extern Bool MC_(clo_show_mismatched_frees);
 
@@ -776,6 +788,8 @@ VG_REGPARM(2) void MC_(helperc_STOREV32le) ( Addr, UWord );
 VG_REGPARM(2) void MC_(helperc_STOREV16be) ( Addr, UWord );
 VG_REGPARM(2) void MC_(helperc_STOREV16le) ( Addr, UWord );
 VG_REGPARM(2) void MC_(helperc_STOREV8)    ( Addr, UWord );
+VG_REGPARM(1) void MC_(helperc_STOREV256_defined) ( Addr );
+VG_REGPARM(1) void MC_(helperc_STOREV128_defined) ( Addr );
 
 VG_REGPARM(2) void  MC_(helperc_LOADV256be) ( /*OUT*/V256*, Addr );
 VG_REGPARM(2) void  MC_(helperc_LOADV256le) ( /*OUT*/V256*, Addr );
@@ -36,7 +36,9 @@
 #include "pub_tool_hashtable.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcassert.h"
+#include "pub_tool_libcfile.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_libcproc.h"
 #include "pub_tool_libcsignal.h"
 #include "pub_tool_machine.h"
 #include "pub_tool_mallocfree.h"
@@ -464,6 +466,20 @@ static SizeT lc_chunks_n_frees_marker;
 // lc_extras[i] describe the same block).
 static LC_Extra* lc_extras;
 
+// A quick filter for lc_is_a_chunk_ptr, built together with lc_chunks.
+// Most scanned words do not point into a chunk, so before the binary search
+// in lc_chunks, words are checked against the lowest and highest chunk
+// addresses, and then against a bitmap with one bit per 2^lc_filter_shift
+// bytes of that range, set if some chunk overlaps these bytes.  The bitmap
+// has at most LC_FILTER_MAX_BITS bits, which fixes the granularity for
+// big heaps.
+#define LC_FILTER_MIN_SHIFT 4
+#define LC_FILTER_MAX_BITS  (1 << 26)
+static Addr   lc_filter_min = 1;   // lowest chunk byte
+static Addr   lc_filter_max = 0;   // highest chunk byte
+static UInt   lc_filter_shift;
+static UChar* lc_filter_bitmap;
+
 // chunks will be converted and merged in loss record, maintained in lr_table
 // lr_table elements are kept from one leak_search to another to implement
 // the "print new/changed leaks" client request
@@ -521,6 +537,50 @@ static SizeT MC_(bytes_heuristically_reachable)[N_LEAK_CHECK_HEURISTICS]
 static SizeT MC_(blocks_heuristically_reachable)[N_LEAK_CHECK_HEURISTICS]
                                                 = {0,0,0,0};
 
+// (Re)builds the quick filter of lc_is_a_chunk_ptr for lc_chunks.
+static void lc_build_filter(void)
+{
+   Int i;
+   Addr a, last;
+   UWord n_bits, bit, bit_end;
+
+   if (lc_filter_bitmap) {
+      VG_(free)(lc_filter_bitmap);
+      lc_filter_bitmap = NULL;
+   }
+   lc_filter_min = 1;
+   lc_filter_max = 0;
+   if (lc_n_chunks == 0)
+      return;
+
+   // lc_chunks is sorted on data, but the last chunk does not necessarily
+   // end last (see the overlap checks in MC_(detect_memory_leaks)).
+   // Zero-sized chunks are treated as having size 1, as in find_chunk_for.
+   lc_filter_min = lc_chunks[0]->data;
+   for (i = 0; i < lc_n_chunks; i++) {
+      last = lc_chunks[i]->data + lc_chunks[i]->szB
+         - (lc_chunks[i]->szB == 0 ? 0 : 1);
+      if (last > lc_filter_max)
+         lc_filter_max = last;
+   }
+
+   lc_filter_shift = LC_FILTER_MIN_SHIFT;
+   while (((lc_filter_max - lc_filter_min) >> lc_filter_shift)
+          >= LC_FILTER_MAX_BITS)
+      lc_filter_shift++;
+   n_bits = ((lc_filter_max - lc_filter_min) >> lc_filter_shift) + 1;
+
+   lc_filter_bitmap = VG_(malloc)("mc.lbf.1", (n_bits + 7) / 8);
+   VG_(memset)(lc_filter_bitmap, 0, (n_bits + 7) / 8);
+   for (i = 0; i < lc_n_chunks; i++) {
+      a = lc_chunks[i]->data;
+      last = a + lc_chunks[i]->szB - (lc_chunks[i]->szB == 0 ? 0 : 1);
+      bit_end = (last - lc_filter_min) >> lc_filter_shift;
+      for (bit = (a - lc_filter_min) >> lc_filter_shift; bit <= bit_end; bit++)
+         lc_filter_bitmap[bit >> 3] |= 1 << (bit & 7);
+   }
+}
+
 // Determines if a pointer is to a chunk.  Returns the chunk number et al
 // via call-by-reference.
 static Bool
@@ -529,6 +589,14 @@ lc_is_a_chunk_ptr(Addr ptr, Int* pch_no, MC_Chunk** pch, LC_Extra** pex)
    Int ch_no;
    MC_Chunk* ch;
    LC_Extra* ex;
+   UWord bit;
+
+   // Quickest filters: outside of all chunks, or of the chunks near ptr.
+   if (ptr < lc_filter_min || ptr > lc_filter_max)
+      return False;
+   bit = (ptr - lc_filter_min) >> lc_filter_shift;
+   if (!(lc_filter_bitmap[bit >> 3] & (1 << (bit & 7))))
+      return False;
 
    // Quick filter. Note: implemented with am, not with get_vabits2
    // as ptr might be random data pointing anywhere. On 64 bit
@@ -1912,25 +1980,30 @@ Bool MC_(print_block_list) ( UInt loss_record_nr_from,
    return True;
 }
 
-// If searched = 0, scan memory root set, pushing onto the mark stack the blocks
-// encountered.
-// Otherwise (searched != 0), scan the memory root set searching for ptr
-// pointing inside [searched, searched+szB[.
-static void scan_memory_root_set(Addr searched, SizeT szB)
+// A client segment that is part of the memory root set.
+typedef
+   struct {
+      Addr  start;
+      SizeT szB;
+   }
+   LC_RootSeg;
+
+// Returns the segments making up the memory root set, in address order.
+static LC_RootSeg* get_root_segments(/*OUT*/Int* n_segs)
 {
    Int   i;
    Int   n_seg_starts;
    Addr* seg_starts = VG_(get_segment_starts)( SkFileC | SkAnonC | SkShmC,
                                                &n_seg_starts );
+   LC_RootSeg* segs;
 
    tl_assert(seg_starts && n_seg_starts > 0);
 
-   lc_scanned_szB = 0;
-   lc_sig_skipped_szB = 0;
+   segs = VG_(malloc)("mc.grs.1", n_seg_starts * sizeof(LC_RootSeg));
+   *n_segs = 0;
 
    // VG_(am_show_nsegments)( 0, "leakcheck");
    for (i = 0; i < n_seg_starts; i++) {
-      SizeT seg_size;
       NSegment const* seg = VG_(am_find_nsegment)( seg_starts[i] );
       tl_assert(seg);
       tl_assert(seg->kind == SkFileC || seg->kind == SkAnonC ||
@@ -1956,19 +2029,243 @@ static void scan_memory_root_set(Addr searched, SizeT szB)
       if (0)
          VG_(printf)("ACCEPT %2d  %#lx %#lx\n", i, seg->start, seg->end);
 
+      segs[*n_segs].start = seg->start;
+      segs[*n_segs].szB   = seg->end - seg->start + 1;
+      (*n_segs)++;
+   }
+   VG_(free)(seg_starts);
+   return segs;
+}
+
+// Scan the bytes [from, to[ of the root set, counting offsets as if the
+// root segments followed each other.  See scan_memory_root_set for
+// 'searched' and 'szB'.
+static void scan_root_segments(const LC_RootSeg* segs, Int n_segs,
+                               SizeT from, SizeT to,
+                               Addr searched, SizeT szB)
+{
+   Int   i;
+   SizeT pos = 0;
+
+   for (i = 0; i < n_segs; pos += segs[i].szB, i++) {
+      SizeT lo = from > pos ? from - pos : 0;
+      SizeT hi = to - pos < segs[i].szB ? to - pos : segs[i].szB;
+
+      if (to <= pos || lo >= hi)
+         continue;
+
       // Scan the segment.  We use -1 for the clique number, because this
       // is a root-set.
-      seg_size = seg->end - seg->start + 1;
       if (VG_(clo_verbosity) > 2) {
          VG_(message)(Vg_DebugMsg,
                       "  Scanning root segment: %#lx..%#lx (%lu)\n",
-                      seg->start, seg->end, seg_size);
+                      segs[i].start + lo, segs[i].start + hi - 1, hi - lo);
       }
-      lc_scan_memory(seg->start, seg_size, /*is_prior_definite*/True,
+      lc_scan_memory(segs[i].start + lo, hi - lo, /*is_prior_definite*/True,
                      /*clique*/-1, /*cur_clique*/-1,
                      searched, szB);
    }
-   VG_(free)(seg_starts);
+}
+
+// If searched = 0, scan memory root set, pushing onto the mark stack the blocks
+// encountered.
+// Otherwise (searched != 0), scan the memory root set searching for ptr
+// pointing inside [searched, searched+szB[.
+static void scan_memory_root_set(Addr searched, SizeT szB)
+{
+   Int         n_segs;
+   LC_RootSeg* segs = get_root_segments(&n_segs);
+
+   lc_scanned_szB = 0;
+   lc_sig_skipped_szB = 0;
+
+   scan_root_segments(segs, n_segs, 0, ~(SizeT)0, searched, szB);
+   VG_(free)(segs);
+}
+
+// With --leak-check-jobs=N, the root set is split into up to N parts of
+// about the same size, and all parts but the first are handed to helper
+// processes, forked once lc_chunks and lc_extras are set up.  Each helper
+// traces the blocks reachable from its part, as the mark stack processing
+// of a single process search would, and sends back the state of every
+// block.  A block is reachable from the root set if it is reachable from
+// any part of it, so merging the states by keeping the most reachable one
+// gives the same result as a search by a single process.  A part whose
+// helper failed is just scanned again by us.
+typedef
+   struct {
+      SizeT from;    // bytes [from, to[ of the root set, as for
+      SizeT to;      //   scan_root_segments
+      Int   fd;      // read end of the helper's pipe, or -1
+      Int   pid;
+   }
+   LC_RootPart;
+
+// Part of the root set below which forking a helper isn't worth it.
+#define LC_MIN_PART_SZB (16 * 1024 * 1024)
+
+static const LC_RootSeg* lc_part_segs;
+static Int               lc_part_n_segs;
+
+// What a helper sends back: its lc_scanned_szB and lc_sig_skipped_szB,
+// then a byte per chunk holding its state and, above it, its heuristic.
+#define LC_PART_BUF_SZB (64 * 1024)
+
+static Bool lc_write_all(Int fd, const void* buf, Int n)
+{
+   while (n > 0) {
+      Int w = VG_(write)(fd, buf, n);
+      if (w == -VKI_EINTR)
+         continue;
+      if (w <= 0)
+         return False;
+      buf = (const UChar*)buf + w;
+      n -= w;
+   }
+   return True;
+}
+
+static Bool lc_read_all(Int fd, void* buf, Int n)
+{
+   while (n > 0) {
+      Int r = VG_(read)(fd, buf, n);
+      if (r == -VKI_EINTR)
+         continue;
+      if (r <= 0)
+         return False;
+      buf = (UChar*)buf + r;
+      n -= r;
+   }
+   return True;
+}
+
+static void lc_scan_part_helper(Int out_fd, void* opaque)
+{
+   const LC_RootPart* part = opaque;
+   SizeT  szBs[2];
+   UChar* buf;
+   Int    i, n = 0;
+
+   scan_root_segments(lc_part_segs, lc_part_n_segs, part->from, part->to,
+                      /*searched*/0, 0);
+   lc_process_markstack(/*clique*/-1);
+
+   szBs[0] = lc_scanned_szB;
+   szBs[1] = lc_sig_skipped_szB;
+   if (!lc_write_all(out_fd, szBs, sizeof(szBs)))
+      return;
+   buf = VG_(malloc)("mc.lsph.1", LC_PART_BUF_SZB);
+   for (i = 0; i < lc_n_chunks; i++) {
+      buf[n++] = lc_extras[i].state | (lc_extras[i].heuristic << 2);
+      if (n == LC_PART_BUF_SZB || i == lc_n_chunks - 1) {
+         if (!lc_write_all(out_fd, buf, n))
+            break;
+         n = 0;
+      }
+   }
+   VG_(free)(buf);
+}
+
+// Merges the block states sent back by a helper into lc_extras.  Returns
+// False if they could not all be read; those that were are still right.
+static Bool lc_merge_part(Int fd)
+{
+   SizeT  szBs[2];
+   UChar* buf;
+   Int    i, j, n;
+
+   if (!lc_read_all(fd, szBs, sizeof(szBs)))
+      return False;
+   buf = VG_(malloc)("mc.lmp.1", LC_PART_BUF_SZB);
+   for (i = 0; i < lc_n_chunks; i += n) {
+      n = lc_n_chunks - i < LC_PART_BUF_SZB ? lc_n_chunks - i
+                                            : LC_PART_BUF_SZB;
+      if (!lc_read_all(fd, buf, n)) {
+         VG_(free)(buf);
+         return False;
+      }
+      for (j = 0; j < n; j++) {
+         LC_Extra*   ex        = &lc_extras[i + j];
+         Reachedness state     = (Reachedness)(buf[j] & 3);
+         UInt        heuristic = buf[j] >> 2;
+
+         // Lower states are more reachable.  A block found reachable
+         // through a pointer to its start needs no heuristic.
+         if (state < ex->state) {
+            ex->state     = state;
+            ex->heuristic = heuristic;
+         } else if (state == Reachable && ex->state == Reachable
+                    && heuristic == LchNone) {
+            ex->heuristic = LchNone;
+         }
+      }
+   }
+   VG_(free)(buf);
+   lc_scanned_szB += szBs[0];
+   lc_sig_skipped_szB += szBs[1];
+   return True;
+}
+
+// As scan_memory_root_set(0, 0) followed by lc_process_markstack(-1), but
+// with up to n_jobs processes.
+static void scan_memory_root_set_in_parallel(Int n_jobs)
+{
+   Int          i, n_segs, n_parts;
+   SizeT        total_szB = 0;
+   LC_RootSeg*  segs = get_root_segments(&n_segs);
+   LC_RootPart* parts;
+
+   lc_scanned_szB = 0;
+   lc_sig_skipped_szB = 0;
+
+   for (i = 0; i < n_segs; i++)
+      total_szB += segs[i].szB;
+   n_parts = total_szB / LC_MIN_PART_SZB < n_jobs
+      ? total_szB / LC_MIN_PART_SZB : n_jobs;
+   if (n_parts < 1)
+      n_parts = 1;
+
+   parts = VG_(malloc)("mc.smrsip.1", n_parts * sizeof(LC_RootPart));
+   for (i = 0; i < n_parts; i++) {
+      parts[i].from = i == 0 ? 0 : parts[i-1].to;
+      parts[i].to = i == n_parts - 1
+         ? total_szB : VG_PGROUNDDN(total_szB / n_parts * (i + 1));
+      parts[i].fd = -1;
+   }
+
+   // Start the helpers before scanning anything ourselves, so that they
+   // all begin from the same state.
+   lc_part_segs = segs;
+   lc_part_n_segs = n_segs;
+   for (i = 1; i < n_parts; i++)
+      parts[i].fd = VG_(start_helper)(lc_scan_part_helper, &parts[i],
+                                      &parts[i].pid);
+
+   scan_root_segments(segs, n_segs, parts[0].from, parts[0].to,
+                      /*searched*/0, 0);
+   lc_process_markstack(/*clique*/-1);
+
+   for (i = 1; i < n_parts; i++) {
+      Bool ok = False;
+
+      if (parts[i].fd >= 0) {
+         ok = lc_merge_part(parts[i].fd);
+         if (VG_(finish_helper)(parts[i].fd, parts[i].pid) != 0)
+            ok = False;
+      }
+      if (!ok) {
+         if (VG_(clo_verbosity) > 1)
+            VG_(message)(Vg_DebugMsg,
+                         "leak search helper %d failed, scanning its part\n",
+                         i);
+         scan_root_segments(segs, n_segs, parts[i].from, parts[i].to,
+                            /*searched*/0, 0);
+         lc_process_markstack(/*clique*/-1);
+      }
+   }
+
+   VG_(free)(parts);
+   VG_(free)(segs);
 }
 
 static MC_Mempool *find_mp_of_chunk (MC_Chunk* mc_search)
@@ -2022,6 +2319,7 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
    lc_chunks_n_frees_marker = MC_(get_cmalloc_n_frees)();
    if (lc_n_chunks == 0) {
       tl_assert(lc_chunks == NULL);
+      lc_build_filter();
       if (lr_table != NULL) {
          // forget the previous recorded LossRecords as next leak search
          // can in any case just create new leaks.
@@ -2145,6 +2443,8 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       }
    }
 
+   lc_build_filter();
+
    // Initialise lc_extras.
    if (lc_extras) {
       VG_(free)(lc_extras);
@@ -2172,8 +2472,12 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
    }
 
    // Scan the memory root-set, pushing onto the mark stack any blocks
-   // pointed to.
-   scan_memory_root_set(/*searched*/0, 0);
+   // pointed to.  The helpers of a parallel scan also trace the blocks
+   // they find; the rest are traced below.
+   if (MC_(clo_leak_check_jobs) > 1)
+      scan_memory_root_set_in_parallel(MC_(clo_leak_check_jobs));
+   else
+      scan_memory_root_set(/*searched*/0, 0);
 
    // Scan GP registers for chunk pointers.
    VG_(apply_to_GP_regs)(lc_push_if_a_chunk_ptr_register);
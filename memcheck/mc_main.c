@@ -255,11 +255,19 @@ static void ocache_sarp_Clear_Origins ( Addr, UWord ); /* fwds */
 
 // These represent 128 bits of memory.
 #define VA_BITS32_UNDEFINED   0x55555555  // 01_01_01_01b x 4
+#define VA_BITS32_DEFINED     0xaaaaaaaa  // 10_10_10_10b x 4
+
+// These represent 256 bits of memory.
+#define VA_BITS64_NOACCESS    0x0000000000000000ULL  // 00_00_00_00b x 8
+#define VA_BITS64_UNDEFINED   0x5555555555555555ULL  // 01_01_01_01b x 8
+#define VA_BITS64_DEFINED     0xaaaaaaaaaaaaaaaaULL  // 10_10_10_10b x 8
 
 
 #define SM_CHUNKS             16384    // Each SM covers 64k of memory.
 #define SM_OFF(aaa)           (((aaa) & 0xffff) >> 2)
 #define SM_OFF_16(aaa)        (((aaa) & 0xffff) >> 3)
+#define SM_OFF_32(aaa)        (((aaa) & 0xffff) >> 4)
+#define SM_OFF_64(aaa)        (((aaa) & 0xffff) >> 5)
 
 // Paranoia:  it's critical for performance that the requested inlining
 // occurs.  So try extra hard.
@@ -278,6 +286,8 @@ typedef
    union {
       UChar vabits8[SM_CHUNKS];
       UShort vabits16[SM_CHUNKS/2];
+      UInt vabits32[SM_CHUNKS/4];
+      ULong vabits64[SM_CHUNKS/8];
    }
    SecMap;
 
@@ -333,7 +343,7 @@ static Int   max_non_DSM_SMs   = 0;
 static ULong n_auxmap_L1_searches  = 0;
 static ULong n_auxmap_L1_cmps      = 0;
 /* # of searches that missed in auxmap_L1 and therefore had to
-   be handed to auxmap_L2. And the number of nodes inserted. */
+   be handed to auxmap_L2. And the number of nodes in it. */
 static ULong n_auxmap_L2_searches  = 0;
 static ULong n_auxmap_L2_nodes     = 0;
 
@@ -385,11 +395,13 @@ MC_MAIN_STATIC SecMap* primary_map[N_PRIMARY_MAP];
 /* An entry in the auxiliary primary map.  base must be a 64k-aligned
    value, and sm points at the relevant secondary map.  As with the
    main primary map, the secondary may be either a real secondary, or
-   one of the three distinguished secondaries.  DO NOT CHANGE THIS
-   LAYOUT: the first word has to be the key for OSet fast lookups.
+   one of the three distinguished secondaries.  A 64k chunk without an
+   entry is noaccess.  DO NOT CHANGE THIS LAYOUT: it has to start like
+   a VgHashNode, with base as the key.
 */
 typedef
-   struct { 
+   struct _AuxMapEnt {
+      struct _AuxMapEnt* next;
       Addr    base;
       SecMap* sm;
    }
@@ -408,7 +420,11 @@ static struct {
        } 
        auxmap_L1[N_AUXMAP_L1];
 
-static OSet* auxmap_L2 = NULL;
+/* The auxiliary primary map proper.  Nothing needs its entries in
+   address order, so it is a hash table rather than a tree: with
+   sparse use of a huge address space it gets very big, and a tree
+   lookup would then chase a long chain of pointers. */
+static VgHashTable* auxmap_L2 = NULL;
 
 static void init_auxmap_L1_L2 ( void )
 {
@@ -418,11 +434,9 @@ static void init_auxmap_L1_L2 ( void )
       auxmap_L1[i].ent  = NULL;
    }
 
-   tl_assert(0 == offsetof(AuxMapEnt,base));
+   tl_assert(offsetof(VgHashNode,key) == offsetof(AuxMapEnt,base));
    tl_assert(sizeof(Addr) == sizeof(void*));
-   auxmap_L2 = VG_(OSetGen_Create)( /*keyOff*/  offsetof(AuxMapEnt,base),
-                                    /*fastCmp*/ NULL,
-                                    VG_(malloc), "mc.iaLL.1", VG_(free) );
+   auxmap_L2 = VG_(HT_construct)( "mc.iaLL.1" );
 }
 
 /* Check representation invariants; if OK return NULL; else a
@@ -451,7 +465,7 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
    *n_secmaps_found = 0;
    if (sizeof(void*) == 4) {
       /* 32-bit platform */
-      if (VG_(OSetGen_Size)(auxmap_L2) != 0)
+      if (VG_(HT_count_nodes)(auxmap_L2) != 0)
          return "32-bit: auxmap_L2 is non-empty";
       for (i = 0; i < N_AUXMAP_L1; i++) 
         if (auxmap_L1[i].base != 0 || auxmap_L1[i].ent != NULL)
@@ -460,10 +474,9 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
       /* 64-bit platform */
       UWord elems_seen = 0;
       AuxMapEnt *elem, *res;
-      AuxMapEnt key;
       /* L2 table */
-      VG_(OSetGen_ResetIter)(auxmap_L2);
-      while ( (elem = VG_(OSetGen_Next)(auxmap_L2)) ) {
+      VG_(HT_ResetIter)(auxmap_L2);
+      while ( (elem = VG_(HT_Next)(auxmap_L2)) ) {
          elems_seen++;
          if (0 != (elem->base & (Addr)0xFFFF))
             return "64-bit: nonzero .base & 0xFFFF in auxmap_L2";
@@ -489,9 +502,7 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
          if (auxmap_L1[i].ent->base != auxmap_L1[i].base)
             return "64-bit: _L1 and _L2 bases are inconsistent";
          /* Look it up in auxmap_L2. */
-         key.base = auxmap_L1[i].base;
-         key.sm   = 0;
-         res = VG_(OSetGen_Lookup)(auxmap_L2, &key);
+         res = VG_(HT_lookup)(auxmap_L2, auxmap_L1[i].base);
          if (res == NULL)
             return "64-bit: _L1 .base not found in _L2";
          if (res != auxmap_L1[i].ent)
@@ -525,7 +536,6 @@ static void insert_into_auxmap_L1_at ( Word rank, AuxMapEnt* ent )
 
 static INLINE AuxMapEnt* maybe_find_in_auxmap ( Addr a )
 {
-   AuxMapEnt  key;
    AuxMapEnt* res;
    Word       i;
 
@@ -574,10 +584,7 @@ static INLINE AuxMapEnt* maybe_find_in_auxmap ( Addr a )
    n_auxmap_L2_searches++;
 
    /* First see if we already have it. */
-   key.base = a;
-   key.sm   = 0;
-
-   res = VG_(OSetGen_Lookup)(auxmap_L2, &key);
+   res = VG_(HT_lookup)(auxmap_L2, a);
    if (res)
       insert_into_auxmap_L1_at( AUXMAP_L1_INSERT_IX, res );
    return res;
@@ -596,15 +603,32 @@ static AuxMapEnt* find_or_alloc_in_auxmap ( Addr a )
       to allocate one. */
    a &= ~(Addr)0xFFFF;
 
-   nyu = (AuxMapEnt*) VG_(OSetGen_AllocNode)( auxmap_L2, sizeof(AuxMapEnt) );
+   nyu = VG_(malloc)( "mc.faia.1", sizeof(AuxMapEnt) );
    nyu->base = a;
    nyu->sm   = &sm_distinguished[SM_DIST_NOACCESS];
-   VG_(OSetGen_Insert)( auxmap_L2, nyu );
+   VG_(HT_add_node)( auxmap_L2, nyu );
    insert_into_auxmap_L1_at( AUXMAP_L1_INSERT_IX, nyu );
    n_auxmap_L2_nodes++;
    return nyu;
 }
 
+/* Removes ent, whose 64k chunk must be noaccess, from the auxiliary
+   primary map. */
+static void remove_from_auxmap ( AuxMapEnt* ent )
+{
+   Word i;
+   tl_assert(ent->sm == &sm_distinguished[SM_DIST_NOACCESS]);
+   for (i = 0; i < N_AUXMAP_L1; i++) {
+      if (auxmap_L1[i].ent == ent) {
+         auxmap_L1[i].base = 0;
+         auxmap_L1[i].ent  = NULL;
+      }
+   }
+   VG_(HT_remove)( auxmap_L2, ent->base );
+   VG_(free)( ent );
+   n_auxmap_L2_nodes--;
+}
+
 /* --------------- SecMap fundamentals --------------- */
 
 // In all these, 'low' means it's definitely in the main primary map,
@@ -645,7 +669,8 @@ static INLINE SecMap* get_secmap_for_reading_low ( Addr a )
 
 static INLINE SecMap* get_secmap_for_reading_high ( Addr a )
 {
-   return *get_secmap_high_ptr(a);
+   AuxMapEnt* am = maybe_find_in_auxmap(a);
+   return am ? am->sm : &sm_distinguished[SM_DIST_NOACCESS];
 }
 
 static INLINE SecMap* get_secmap_for_writing_low(Addr a)
@@ -690,6 +715,18 @@ static INLINE SecMap* get_secmap_for_writing ( Addr a )
           : get_secmap_for_writing_high(a) );
 }
 
+/* As get_secmap_ptr, but when making a chunk above the main primary map
+   noaccess, produce NULL rather than adding an auxiliary map entry for
+   it: a missing entry already means noaccess. */
+static INLINE SecMap** get_secmap_ptr_for_sarp ( Addr a, UWord dsm_num )
+{
+   if (a > MAX_PRIMARY_ADDRESS && dsm_num == SM_DIST_NOACCESS) {
+      AuxMapEnt* am = maybe_find_in_auxmap(a);
+      return am ? &am->sm : NULL;
+   }
+   return get_secmap_ptr(a);
+}
+
 /* If 'a' has a SecMap, produce it.  Else produce NULL.  But don't
    allocate one if one doesn't already exist.  This is used by the
    leak checker.
@@ -704,6 +741,100 @@ static SecMap* maybe_get_secmap_for ( Addr a )
    }
 }
 
+/* --------------- Secondary map sharing --------------- */
+
+/* A secondary that is all noaccess, all undefined or all defined can
+   be replaced by the matching distinguished secondary.
+   set_address_range_perms does that when it sets a whole secondary,
+   but secondaries also get filled up bit by bit, by smaller ranges
+   and by stores.  So each time the number of non-distinguished
+   secondaries has doubled, dedup_secmaps looks for uniform ones and
+   frees them. */
+#define SM_DEDUP_MIN 1024
+
+static Int   sm_dedup_at       = SM_DEDUP_MIN;
+static ULong n_sm_dedup_passes = 0;
+static ULong n_sm_dedups       = 0;
+
+/* The distinguished secondary with the same contents as sm, or NULL. */
+static SecMap* uniform_dsm ( const SecMap* sm )
+{
+   ULong w = sm->vabits64[0];
+   UWord i;
+
+   if (w != VA_BITS64_NOACCESS && w != VA_BITS64_UNDEFINED
+       && w != VA_BITS64_DEFINED)
+      return NULL;
+   for (i = 1; i < SM_CHUNKS/8; i++) {
+      if (sm->vabits64[i] != w)
+         return NULL;
+   }
+   if (w == VA_BITS64_NOACCESS)  return &sm_distinguished[SM_DIST_NOACCESS];
+   if (w == VA_BITS64_UNDEFINED) return &sm_distinguished[SM_DIST_UNDEFINED];
+   return &sm_distinguished[SM_DIST_DEFINED];
+}
+
+static void dedup_secmap ( SecMap** sm_ptr )
+{
+   SecMap* dsm;
+   SysRes  sres;
+
+   if (is_distinguished_sm(*sm_ptr))
+      return;
+   dsm = uniform_dsm(*sm_ptr);
+   if (dsm == NULL)
+      return;
+   sres = VG_(am_munmap_valgrind)((Addr)*sm_ptr, sizeof(SecMap));
+   tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+   update_SM_counts(*sm_ptr, dsm);
+   *sm_ptr = dsm;
+   n_sm_dedups++;
+}
+
+/* Nobody may hold on to a SecMap pointer across a call of this, as is
+   already the case for set_address_range_perms. */
+static void dedup_secmaps ( void )
+{
+   UWord      i;
+   AuxMapEnt* elem;
+
+   n_sm_dedup_passes++;
+   for (i = 0; i < N_PRIMARY_MAP; i++)
+      dedup_secmap(&primary_map[i]);
+   VG_(HT_ResetIter)(auxmap_L2);
+   while ( (elem = VG_(HT_Next)(auxmap_L2)) )
+      dedup_secmap(&elem->sm);
+
+   sm_dedup_at = 2 * n_non_DSM_SMs;
+   if (sm_dedup_at < SM_DEDUP_MIN)
+      sm_dedup_at = SM_DEDUP_MIN;
+}
+
+/* Makes the whole 64k chunks in [a, a+len) noaccess, when they are all
+   above the main primary map, by going through the auxiliary map
+   entries rather than the chunks: for a big range of a sparse address
+   space, there are far fewer. */
+static void make_auxmap_range_noaccess ( Addr a, SizeT len )
+{
+   UInt         i, n_ents;
+   VgHashNode** ents = VG_(HT_to_array)(auxmap_L2, &n_ents);
+
+   tl_assert(a > MAX_PRIMARY_ADDRESS && is_start_of_sm(a));
+   for (i = 0; i < n_ents; i++) {
+      AuxMapEnt* ent = (AuxMapEnt*)ents[i];
+      if (ent->base < a || ent->base - a >= len)
+         continue;
+      if (!is_distinguished_sm(ent->sm)) {
+         SysRes sres = VG_(am_munmap_valgrind)((Addr)ent->sm, sizeof(SecMap));
+         tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+      }
+      update_SM_counts(ent->sm, &sm_distinguished[SM_DIST_NOACCESS]);
+      ent->sm = &sm_distinguished[SM_DIST_NOACCESS];
+      remove_from_auxmap(ent);
+   }
+   VG_(free)(ents);
+}
+
 /* --------------- Fundamental functions --------------- */
 
 static INLINE
@@ -1686,6 +1817,9 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    if (lenT == 0)
       return;
 
+   if (UNLIKELY(n_non_DSM_SMs >= sm_dedup_at))
+      dedup_secmaps();
+
    if (lenT > 256 * 1024 * 1024) {
       if (VG_(clo_verbosity) > 0 && !VG_(clo_xml)) {
          const HChar* s = "unknown???";
@@ -1748,8 +1882,11 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    // sec-map (lenA), and the rest (lenB);   lenT == lenA + lenB.
    aNext = start_of_this_sm(a) + SM_SIZE;
    len_to_next_secmap = aNext - a;
-   if ( lenT <= len_to_next_secmap ) {
+   if ( lenT < len_to_next_secmap
+        || (lenT == len_to_next_secmap && !is_start_of_sm(a)) ) {
       // Range entirely within one sec-map.  Covers almost all cases.
+      // A range that is exactly one whole sec-map goes to Part 2, so
+      // that it can get a distinguished secondary.
       PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_SINGLE_SECMAP);
       lenA = lenT;
       lenB = 0;
@@ -1775,9 +1912,9 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    //------------------------------------------------------------------------
 
    // If it's distinguished, make it undistinguished if necessary.
-   sm_ptr = get_secmap_ptr(a);
-   if (is_distinguished_sm(*sm_ptr)) {
-      if (*sm_ptr == example_dsm) {
+   sm_ptr = get_secmap_ptr_for_sarp(a, dsm_num);
+   if (sm_ptr == NULL || is_distinguished_sm(*sm_ptr)) {
+      if (sm_ptr == NULL || *sm_ptr == example_dsm) {
          // Sec-map already has the V+A bits that we want, so skip.
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_DIST_SM1_QUICK);
          a    = aNext;
@@ -1787,7 +1924,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
          *sm_ptr = copy_for_writing(*sm_ptr);
       }
    }
-   sm = *sm_ptr;
+   sm = sm_ptr ? *sm_ptr : NULL;
 
    // 1 byte steps
    while (True) {
@@ -1833,7 +1970,23 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
       if (lenB < SM_SIZE) break;
       tl_assert(is_start_of_sm(a));
       PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP64K);
-      sm_ptr = get_secmap_ptr(a);
+      if (dsm_num == SM_DIST_NOACCESS && a > MAX_PRIMARY_ADDRESS
+          && lenB / SM_SIZE > n_auxmap_L2_nodes) {
+         // More chunks than auxiliary map entries: do the remaining
+         // whole chunks by going through the entries.
+         SizeT lenW = lenB & ~(SizeT)SM_MASK;
+         make_auxmap_range_noaccess(a, lenW);
+         lenB -= lenW;
+         a    += lenW;
+         break;
+      }
+      sm_ptr = get_secmap_ptr_for_sarp(a, dsm_num);
+      if (sm_ptr == NULL) {
+         // No auxiliary map entry, so already noaccess.
+         lenB -= SM_SIZE;
+         a    += SM_SIZE;
+         continue;
+      }
       if (!is_distinguished_sm(*sm_ptr)) {
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP64K_FREE_DIST_SM);
          // Free the non-distinguished sec-map that we're replacing.  This
@@ -1844,6 +1997,8 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
       update_SM_counts(*sm_ptr, example_dsm);
       // Make the sec-map entry point to the example DSM
       *sm_ptr = example_dsm;
+      if (dsm_num == SM_DIST_NOACCESS && a > MAX_PRIMARY_ADDRESS)
+         remove_from_auxmap(maybe_find_in_auxmap(a));
       lenB -= SM_SIZE;
       a    += SM_SIZE;
    }
@@ -1859,9 +2014,9 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    tl_assert(is_start_of_sm(a) && lenB < SM_SIZE);
 
    // If it's distinguished, make it undistinguished if necessary.
-   sm_ptr = get_secmap_ptr(a);
-   if (is_distinguished_sm(*sm_ptr)) {
-      if (*sm_ptr == example_dsm) {
+   sm_ptr = get_secmap_ptr_for_sarp(a, dsm_num);
+   if (sm_ptr == NULL || is_distinguished_sm(*sm_ptr)) {
+      if (sm_ptr == NULL || *sm_ptr == example_dsm) {
          // Sec-map already has the V+A bits that we want, so stop.
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_DIST_SM2_QUICK);
          return;
@@ -1990,6 +2145,18 @@ static void make_mem_defined_if_noaccess ( Addr a, SizeT len )
    UChar vabits2;
    DEBUG("make_mem_defined_if_noaccess(%p, %llu)\n", a, (ULong)len);
    for (i = 0; i < len; i++) {
+      /* Everything up to the end of a secondary that is still the
+         noaccess DSM can go through set_address_range_perms in one go,
+         which turns a whole such secondary into the defined DSM rather
+         than a private copy full of defined bytes. */
+      if (get_secmap_for_reading(a+i) == &sm_distinguished[SM_DIST_NOACCESS]) {
+         SizeT n = SM_SIZE - ((a+i) & SM_MASK);
+         if (n > len - i)
+            n = len - i;
+         MC_(make_mem_defined)( a+i, n );
+         i += n - 1;
+         continue;
+      }
       vabits2 = get_vabits2( a+i );
       if (LIKELY(VA_BITS2_NOACCESS == vabits2)) {
          set_vabits2(a+i, VA_BITS2_DEFINED);
@@ -2420,15 +2587,17 @@ static INLINE Bool is_valid_oc_tag ( Addr tag ) {
    return 0 == (tag & ((1 << OC_BITS_PER_LINE) - 1));
 }
 
-#define OC_LINES_PER_SET 2
-
-#define OC_N_SET_BITS    20
-#define OC_N_SETS        (1 << OC_N_SET_BITS)
-
-/* These settings give:
+/* The cache has oc_n_sets sets of 2^oc_lines_per_set_bits lines, both
+   powers of 2, from --ocache-size and --ocache-assoc.  The defaults, 64MB and 2, give
+   2^20 sets of 2 lines:
    64 bit host: ocache:  100,663,296 sizeB    67,108,864 useful
    32 bit host: ocache:   92,274,688 sizeB    67,108,864 useful
 */
+static UWord oc_n_sets;
+static UWord oc_lines_per_set_bits;
+
+#define OC_N_SETS        oc_n_sets
+#define OC_LINES_PER_SET ((UWord)1 << oc_lines_per_set_bits)
 
 #define OC_MOVE_FORWARDS_EVERY_BITS 7
 
@@ -2458,49 +2627,53 @@ static UChar classify_OCacheLine ( OCacheLine* line )
    return 'z'; /* ZERO - no useful info */
 }
 
-typedef
-   struct {
-      OCacheLine line[OC_LINES_PER_SET];
-   }
-   OCacheSet;
+/* The sets, one after the other.  Within a set, lines are kept roughly
+   in most recently used first order. */
+static OCacheLine* ocacheL1 = NULL;
+static UWord       ocacheL1_event_ctr = 0;
 
-typedef
-   struct {
-      OCacheSet set[OC_N_SETS];
-   }
-   OCache;
+static INLINE OCacheLine* get_OCacheSet ( UWord setno ) {
+   return &ocacheL1[setno << oc_lines_per_set_bits];
+}
 
-static OCache* ocacheL1 = NULL;
-static UWord   ocacheL1_event_ctr = 0;
+static SizeT sizeof_OCache ( void ) {
+   return sizeof(OCacheLine) * OC_N_SETS * OC_LINES_PER_SET;
+}
 
 static void init_ocacheL2 ( void ); /* fwds */
 static void init_OCache ( void )
 {
-   UWord line, set;
+   UWord line, n_lines;
    tl_assert(MC_(clo_mc_level) >= 3);
    tl_assert(ocacheL1 == NULL);
-   ocacheL1 = VG_(am_shadow_alloc)(sizeof(OCache));
+
+   /* Each line holds the origins of 4 * OC_W32S_PER_LINE bytes. */
+   oc_lines_per_set_bits = VG_(log2)( MC_(clo_ocache_assoc) );
+   n_lines = (UWord)MC_(clo_ocache_size) * ((1 << 20) / (4 * OC_W32S_PER_LINE));
+   oc_n_sets = 1;
+   while ((oc_n_sets << (oc_lines_per_set_bits + 1)) <= n_lines)
+      oc_n_sets <<= 1;
+
+   ocacheL1 = VG_(am_shadow_alloc)(sizeof_OCache());
    if (ocacheL1 == NULL) {
       VG_(out_of_memory_NORETURN)( "memcheck:allocating ocacheL1", 
-                                   sizeof(OCache) );
+                                   sizeof_OCache() );
    }
    tl_assert(ocacheL1 != NULL);
-   for (set = 0; set < OC_N_SETS; set++) {
-      for (line = 0; line < OC_LINES_PER_SET; line++) {
-         ocacheL1->set[set].line[line].tag = 1/*invalid*/;
-      }
+   for (line = 0; line < OC_N_SETS * OC_LINES_PER_SET; line++) {
+      ocacheL1[line].tag = 1/*invalid*/;
    }
    init_ocacheL2();
 }
 
-static void moveLineForwards ( OCacheSet* set, UWord lineno )
+static void moveLineForwards ( OCacheLine* set, UWord lineno )
 {
    OCacheLine tmp;
    stats_ocacheL1_movefwds++;
    tl_assert(lineno > 0 && lineno < OC_LINES_PER_SET);
-   tmp = set->line[lineno-1];
-   set->line[lineno-1] = set->line[lineno];
-   set->line[lineno] = tmp;
+   tmp = set[lineno-1];
+   set[lineno-1] = set[lineno];
+   set[lineno] = tmp;
 }
 
 static void zeroise_OCacheLine ( OCacheLine* line, Addr tag ) {
@@ -2585,17 +2758,18 @@ static void ocacheL2_add_line ( OCacheLine* line )
 __attribute__((noinline))
 static OCacheLine* find_OCacheLine_SLOW ( Addr a )
 {
-   OCacheLine *victim, *inL2;
+   OCacheLine *set, *victim, *inL2;
    UChar c;
    UWord line;
    UWord setno   = (a >> OC_BITS_PER_LINE) & (OC_N_SETS - 1);
    UWord tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
    UWord tag     = a & tagmask;
    tl_assert(setno >= 0 && setno < OC_N_SETS);
+   set = get_OCacheSet(setno);
 
    /* we already tried line == 0; skip therefore. */
    for (line = 1; line < OC_LINES_PER_SET; line++) {
-      if (ocacheL1->set[setno].line[line].tag == tag) {
+      if (set[line].tag == tag) {
          if (line == 1) {
             stats_ocacheL1_found_at_1++;
          } else {
@@ -2603,10 +2777,10 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
          }
          if (UNLIKELY(0 == (ocacheL1_event_ctr++ 
                             & ((1<<OC_MOVE_FORWARDS_EVERY_BITS)-1)))) {
-            moveLineForwards( &ocacheL1->set[setno], line );
+            moveLineForwards( set, line );
             line--;
          }
-         return &ocacheL1->set[setno].line[line];
+         return &set[line];
       }
    }
 
@@ -2618,7 +2792,7 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
    tl_assert(line > 0);
 
    /* First, move the to-be-ejected line to the L2 cache. */
-   victim = &ocacheL1->set[setno].line[line];
+   victim = &set[line];
    c = classify_OCacheLine(victim);
    switch (c) {
       case 'e':
@@ -2647,25 +2821,28 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
          tl_assert(0);
    }
 
+   /* The new line goes first in the set, the others move back one.
+      With only two lines, this is just moving it one forwards; with
+      more, a line that missed would otherwise have to be hit many
+      times to climb out of the last slots before being ejected. */
+   tl_assert(tag != victim->tag); /* stay sane */
+   for (; line > 0; line--)
+      set[line] = set[line-1];
+
    /* Now we must reload the L1 cache from the backing tree, if
       possible. */
-   tl_assert(tag != victim->tag); /* stay sane */
    inL2 = ocacheL2_find_tag( tag );
    if (inL2) {
       /* We're in luck.  It's in the L2. */
-      ocacheL1->set[setno].line[line] = *inL2;
+      set[0] = *inL2;
    } else {
       /* Missed at both levels of the cache hierarchy.  We have to
          declare it as full of zeroes (unknown origins). */
       stats__ocacheL2_misses++;
-      zeroise_OCacheLine( &ocacheL1->set[setno].line[line], tag );
+      zeroise_OCacheLine( &set[0], tag );
    }
 
-   /* Move it one forwards */
-   moveLineForwards( &ocacheL1->set[setno], line );
-   line--;
-
-   return &ocacheL1->set[setno].line[line];
+   return &set[0];
 }
 
 static INLINE OCacheLine* find_OCacheLine ( Addr a )
@@ -2681,8 +2858,8 @@ static INLINE OCacheLine* find_OCacheLine ( Addr a )
       tl_assert(0 == (tag & (4 * OC_W32S_PER_LINE - 1)));
    }
 
-   if (LIKELY(ocacheL1->set[setno].line[0].tag == tag)) {
-      return &ocacheL1->set[setno].line[0];
+   if (LIKELY(get_OCacheSet(setno)[0].tag == tag)) {
+      return get_OCacheSet(setno);
    }
 
    return find_OCacheLine_SLOW( a );
@@ -4802,6 +4979,18 @@ STATIC_ASSERT(V_BITS8_UNDEFINED == 0xFF);
 /*--- LOADV256 and LOADV128                                ---*/
 /*------------------------------------------------------------*/
 
+/* Whether the nBits (128 or 256) of memory at a, which must be aligned to
+   nBits/8 and so entirely in sm, are all addressable and defined.  Their
+   V+A bits are next to each other, so this is a single comparison. */
+static INLINE
+Bool is_defined_128_or_256 ( SecMap* sm, Addr a, SizeT nBits )
+{
+   if (nBits == 128)
+      return sm->vabits32[SM_OFF_32(a)] == VA_BITS32_DEFINED;
+   else
+      return sm->vabits64[SM_OFF_64(a)] == VA_BITS64_DEFINED;
+}
+
 static INLINE
 void mc_LOADV_128_or_256 ( /*OUT*/ULong* res,
                            Addr a, SizeT nBits, Bool isBigEndian )
@@ -4824,6 +5013,14 @@ void mc_LOADV_128_or_256 ( /*OUT*/ULong* res,
          return;
       }
 
+      /* Handle the commonest case, all of it defined, in one go. */
+      sm = get_secmap_for_reading_low(a);
+      if (LIKELY(is_defined_128_or_256(sm, a, nBits))) {
+         for (j = 0; j < nULongs; j++)
+            res[j] = V_BITS64_DEFINED;
+         return;
+      }
+
       /* Handle common cases quickly: a (and a+8 and a+16 etc.) is
          suitably aligned, is mapped, and addressible. */
       for (j = 0; j < nULongs; j++) {
@@ -4868,6 +5065,60 @@ VG_REGPARM(2) void MC_(helperc_LOADV128le) ( /*OUT*/V128* res, Addr a )
    mc_LOADV_128_or_256(&res->w64[0], a, 128, False);
 }
 
+/*------------------------------------------------------------*/
+/*--- STOREV256 and STOREV128 of defined data              ---*/
+/*------------------------------------------------------------*/
+
+/* Vector stores whose V bits are all defined, by far the most frequent
+   case, are done by one call to these rather than by a STOREV64 per 64
+   bits.  All defined data looks the same in either endianness. */
+static INLINE
+void mc_STOREV_128_or_256_defined ( Addr a, SizeT nBits )
+{
+   UWord nULongs = nBits / 64;
+   UWord j;
+
+   PROF_EVENT(MCPE_STOREV_128_OR_256_DEFINED);
+
+#ifdef PERF_FAST_STOREV
+   if (LIKELY( !UNALIGNED_OR_HIGH(a,nBits) )) {
+      SecMap* sm       = get_secmap_for_reading_low(a);
+      UWord   sm_off16 = SM_OFF_16(a);
+
+      if (LIKELY(is_defined_128_or_256(sm, a, nBits)))
+         return;
+
+      // As in mc_STOREV64, memory that is addressable but undefined can
+      // be made defined in place, unless sm is a distinguished map.
+      if (!is_distinguished_sm(sm)) {
+         for (j = 0; j < nULongs; j++) {
+            UWord vabits16 = sm->vabits16[sm_off16 + j];
+            if (vabits16 != VA_BITS16_DEFINED
+                && vabits16 != VA_BITS16_UNDEFINED)
+               break;
+         }
+         if (j == nULongs) {
+            for (j = 0; j < nULongs; j++)
+               sm->vabits16[sm_off16 + j] = VA_BITS16_DEFINED;
+            return;
+         }
+      }
+   }
+   PROF_EVENT(MCPE_STOREV_128_OR_256_DEFINED_SLOW);
+#endif
+   for (j = 0; j < nULongs; j++)
+      mc_STOREVn_slow( a + 8*j, 64, V_BITS64_DEFINED, False );
+}
+
+VG_REGPARM(1) void MC_(helperc_STOREV256_defined) ( Addr a )
+{
+   mc_STOREV_128_or_256_defined(a, 256);
+}
+VG_REGPARM(1) void MC_(helperc_STOREV128_defined) ( Addr a )
+{
+   mc_STOREV_128_or_256_defined(a, 128);
+}
+
 /*------------------------------------------------------------*/
 /*--- LOADV64                                              ---*/
 /*------------------------------------------------------------*/
@@ -5945,6 +6196,7 @@ UInt          MC_(clo_leak_check_heuristics)  =   H2S(LchStdString)
                                                 | H2S( LchLength64)
                                                 | H2S( LchNewArray)
                                                 | H2S( LchMultipleInheritance);
+Int           MC_(clo_leak_check_jobs)        = 1;
 Bool          MC_(clo_xtree_leak)             = False;
 const HChar*  MC_(clo_xtree_leak_file) = "xtleak.kcg.%p";
 Bool          MC_(clo_workaround_gcc296_bugs) = False;
@@ -5952,6 +6204,8 @@ Int           MC_(clo_malloc_fill)            = -1;
 Int           MC_(clo_free_fill)              = -1;
 KeepStacktraces MC_(clo_keep_stacktraces)     = KS_alloc_and_free;
 Int           MC_(clo_mc_level)               = 2;
+Int           MC_(clo_ocache_size)            = 64;
+Int           MC_(clo_ocache_assoc)           = 2;
 Bool          MC_(clo_show_mismatched_frees)  = True;
 
 ExpensiveDefinednessChecks
@@ -6020,6 +6274,8 @@ static Bool mc_process_cmd_line_options(const HChar* arg)
    else if VG_USET_CLO(arg, "--leak-check-heuristics",
                        MC_(parse_leak_heuristics_tokens),
                        MC_(clo_leak_check_heuristics)) {}
+   else if VG_BINT_CLO(arg, "--leak-check-jobs",
+                       MC_(clo_leak_check_jobs), 1, 64) {}
    else if (VG_BOOL_CLO(arg, "--show-reachable", tmp_show)) {
       if (tmp_show) {
          MC_(clo_show_leak_kinds) = MC_(all_Reachedness)();
@@ -6156,6 +6412,15 @@ static Bool mc_process_cmd_line_options(const HChar* arg)
    else if VG_XACT_CLO(arg, "--expensive-definedness-checks=yes",
                             MC_(clo_expensive_definedness_checks), EdcYES) {}
 
+   else if VG_BINT_CLO(arg, "--ocache-size",
+                       MC_(clo_ocache_size), 1, 4096) {}
+   else if VG_BINT_CLO(arg, "--ocache-assoc",
+                       MC_(clo_ocache_assoc), 2, 16) {
+      if (VG_(log2)(MC_(clo_ocache_assoc)) < 0)
+         VG_(fmsg_bad_option)(arg,
+            "--ocache-assoc must be a power of 2.\n");
+   }
+
    else if VG_BOOL_CLO(arg, "--xtree-leak",
                        MC_(clo_xtree_leak)) {}
    else if VG_STR_CLO (arg, "--xtree-leak-file",
@@ -6187,6 +6452,8 @@ static void mc_print_usage(void)
 "        improving leak search false positive [all]\n"
 "        where heur is one of:\n"
 "          stdstring length64 newarray multipleinheritance all none\n"
+"    --leak-check-jobs=<number>       nr of processes scanning the root set\n"
+"                                     during leak searches [1]\n"
 "    --show-reachable=yes             same as --show-leak-kinds=all\n"
 "    --show-reachable=no --show-possibly-lost=yes\n"
 "                                     same as --show-leak-kinds=definite,possible\n"
@@ -6196,6 +6463,9 @@ static void mc_print_usage(void)
 "    --xtree-leak-file=<file>         xtree leak report file [xtleak.kcg.%%p]\n"
 "    --undef-value-errors=no|yes      check for undefined value errors [yes]\n"
 "    --track-origins=no|yes           show origins of undefined values? [no]\n"
+"    --ocache-size=<number>           MB of memory whose origins are cached\n"
+"                                     with --track-origins=yes [64]\n"
+"    --ocache-assoc=2|4|8|16          associativity of that cache [2]\n"
 "    --partial-loads-ok=no|yes        too hard to explain here; see manual [yes]\n"
 "    --expensive-definedness-checks=no|auto|yes\n"
 "                                     Use extra-precise definedness tracking [auto]\n"
@@ -7278,6 +7548,8 @@ static const HChar* MC_(event_ctr_name)[MCPE_LAST] = {
    [MCPE_LOADV64]        = "LOADV64",
    [MCPE_LOADV64_SLOW1]  = "LOADV64-slow1",
    [MCPE_LOADV64_SLOW2]  = "LOADV64-slow2",
+   [MCPE_STOREV_128_OR_256_DEFINED]      = "STOREV_128_or_256_defined",
+   [MCPE_STOREV_128_OR_256_DEFINED_SLOW] = "STOREV_128_or_256_defined-slow",
    [MCPE_STOREV64]       = "STOREV64",
    [MCPE_STOREV64_SLOW1] = "STOREV64-slow1",
    [MCPE_STOREV64_SLOW2] = "STOREV64-slow2",
@@ -7913,6 +8185,10 @@ static void mc_print_stats (void)
       " memcheck: auxmaps_L2: %llu searches, %llu nodes\n",
       n_auxmap_L2_searches, n_auxmap_L2_nodes
    );   
+   VG_(message)(Vg_DebugMsg,
+      " memcheck: SMs: %llu shared with a DSM in %llu passes\n",
+      n_sm_dedups, n_sm_dedup_passes
+   );   
 
    print_SM_info("n_issued     ", n_issued_SMs);
    print_SM_info("n_deissued   ", n_deissued_SMs);
@@ -7961,9 +8237,18 @@ static void mc_print_stats (void)
                    " ocacheL1: %'12lu at 2+  %'12lu move-fwds\n",
                    stats_ocacheL1_found_at_N,
                    stats_ocacheL1_movefwds );
+      {  /* in hundredths of a percent */
+         UWord miss_rate = stats_ocacheL1_find == 0 ? 0 :
+            (UWord)((ULong)stats_ocacheL1_misses * 10000
+                    / stats_ocacheL1_find);
+         VG_(message)(Vg_DebugMsg,
+                      " ocacheL1: %'9lu.%02lu%% miss rate  %'lu sets of %lu\n",
+                      miss_rate / 100, miss_rate % 100,
+                      OC_N_SETS, OC_LINES_PER_SET );
+      }
       VG_(message)(Vg_DebugMsg,
-                   " ocacheL1: %'12lu sizeB  %'12d useful\n",
-                   (SizeT)sizeof(OCache),
+                   " ocacheL1: %'12lu sizeB  %'12lu useful\n",
+                   sizeof_OCache(),
                    4 * OC_W32S_PER_LINE * OC_LINES_PER_SET * OC_N_SETS );
       VG_(message)(Vg_DebugMsg,
                    " ocacheL2: %'12lu refs   %'12lu misses\n",
@@ -1424,6 +1424,15 @@ static void setHelperAnns ( MCEnv* mce, IRDirty* di ) {
    di->fxState[1].repeatLen = 0;
 }
 
+/* AND together two Ity_I1 helper call guards. */
+static IRAtom* mkAnd1 ( MCEnv* mce, IRAtom* g1, IRAtom* g2 )
+{
+   IRAtom *w1 = assignNew('V', mce, Ity_I32, unop(Iop_1Uto32, g1));
+   IRAtom *w2 = assignNew('V', mce, Ity_I32, unop(Iop_1Uto32, g2));
+   IRAtom *e  = assignNew('V', mce, Ity_I32, binop(Iop_And32, w1, w2));
+   return assignNew('V', mce, Ity_I1, unop(Iop_32to1, e));
+}
+
 
 /* Check the supplied *original* |atom| for undefinedness, and emit a
    complaint if so.  Once that happens, mark it as defined.  This is
@@ -1582,12 +1591,8 @@ static void complainIfUndefined ( MCEnv* mce, IRAtom* atom, IRExpr *guard )
 
    /* If the complaint is to be issued under a guard condition, AND
       that into the guard condition for the helper call. */
-   if (guard) {
-      IRAtom *g1 = assignNew('V', mce, Ity_I32, unop(Iop_1Uto32, di->guard));
-      IRAtom *g2 = assignNew('V', mce, Ity_I32, unop(Iop_1Uto32, guard));
-      IRAtom *e  = assignNew('V', mce, Ity_I32, binop(Iop_And32, g1, g2));
-      di->guard  = assignNew('V', mce, Ity_I1,  unop(Iop_32to1, e));
-   }
+   if (guard)
+      di->guard = mkAnd1(mce, di->guard, guard);
 
    setHelperAnns( mce, di );
    stmt( 'V', mce, IRStmt_Dirty(di));
@@ -5813,6 +5818,64 @@ void do_shadow_Store ( MCEnv* mce,
       }
    }
 
+   if (ty == Ity_V256 || ty == Ity_V128) {
+      /* Vector stores of all defined data, much the most frequent kind,
+         are done by a single helper call.  Otherwise, the stores of the
+         64-bit lanes below are done instead: AND the test for some
+         undefined bit into their guard. */
+      IRAtom  *lanes, *undef, *notUndef, *addrAct;
+      IRDirty *diDef;
+
+      if (ty == Ity_V256) {
+         IRAtom* lanes01
+            = assignNew('V', mce, Ity_I64,
+                        binop(Iop_Or64,
+                              assignNew('V', mce, Ity_I64,
+                                        unop(Iop_V256to64_0, vdata)),
+                              assignNew('V', mce, Ity_I64,
+                                        unop(Iop_V256to64_1, vdata))));
+         IRAtom* lanes23
+            = assignNew('V', mce, Ity_I64,
+                        binop(Iop_Or64,
+                              assignNew('V', mce, Ity_I64,
+                                        unop(Iop_V256to64_2, vdata)),
+                              assignNew('V', mce, Ity_I64,
+                                        unop(Iop_V256to64_3, vdata))));
+         lanes = assignNew('V', mce, Ity_I64,
+                           binop(Iop_Or64, lanes01, lanes23));
+      } else {
+         lanes = assignNew('V', mce, Ity_I64,
+                           binop(Iop_Or64,
+                                 assignNew('V', mce, Ity_I64,
+                                           unop(Iop_V128to64, vdata)),
+                                 assignNew('V', mce, Ity_I64,
+                                           unop(Iop_V128HIto64, vdata))));
+      }
+      undef    = assignNew('V', mce, Ity_I1, unop(Iop_CmpNEZ64, lanes));
+      notUndef = assignNew('V', mce, Ity_I1, unop(Iop_Not1, undef));
+
+      if (bias == 0) {
+         addrAct = addr;
+      } else {
+         IRAtom* eBias   = tyAddr==Ity_I32 ? mkU32(bias) : mkU64(bias);
+         addrAct = assignNew('V', mce, tyAddr, binop(mkAdd, addr, eBias));
+      }
+      diDef = ty == Ity_V256
+         ? unsafeIRDirty_0_N(
+              1/*regparms*/, "MC_(helperc_STOREV256_defined)",
+              VG_(fnptr_to_fnentry)( &MC_(helperc_STOREV256_defined) ),
+              mkIRExprVec_1( addrAct ))
+         : unsafeIRDirty_0_N(
+              1/*regparms*/, "MC_(helperc_STOREV128_defined)",
+              VG_(fnptr_to_fnentry)( &MC_(helperc_STOREV128_defined) ),
+              mkIRExprVec_1( addrAct ));
+      diDef->guard = guard ? mkAnd1(mce, guard, notUndef) : notUndef;
+      setHelperAnns( mce, diDef );
+      stmt( 'V', mce, IRStmt_Dirty(diDef) );
+
+      guard = guard ? mkAnd1(mce, guard, undef) : undef;
+   }
+
    if (UNLIKELY(ty == Ity_V256)) {
 
       /* V256-bit case -- phrased in terms of 64 bit units (Qs), with
@@ -7870,6 +7933,8 @@ void MC_(do_instrumentation_startup_checks)( void )
    CHECK(False, "MC_(helperc_STOREV32le)");
    CHECK(False, "MC_(helperc_STOREV64le)");
    CHECK(False, "MC_(helperc_STOREV8)");
+   CHECK(False, "MC_(helperc_STOREV128_defined)");
+   CHECK(False, "MC_(helperc_STOREV256_defined)");
    CHECK(False, "track_die_mem_stack_8");
    CHECK(False, "track_new_mem_stack_8_w_ECU");
    CHECK(False, "MC_(helperc_MAKE_STACK_UNINIT_w_o)");
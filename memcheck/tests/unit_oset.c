@@ -595,6 +595,106 @@ void example2(void)
    VG_(OSetGen_Destroy)(oset);
 }
 
+//-----------------------------------------------------------------------
+// Bulk loading
+//-----------------------------------------------------------------------
+
+// Checks the AVL invariants of the subtree at n, and returns its height.
+static Int check_avl(const AvlNode* n)
+{
+   Int hl, hr;
+   if (n == NULL) return 0;
+   hl = check_avl(n->left);
+   hr = check_avl(n->right);
+   vg_assert( n->balance == hr - hl );
+   vg_assert( n->balance >= -1 && n->balance <= 1 );
+   return 1 + (hl > hr ? hl : hr);
+}
+
+void example3(void)
+{
+   Int   i, n;
+   UWord   v;
+   RegWord k, prev;
+   UWord   vals[NN];
+   void*   es[NN];
+
+   // Bulk-load OSets of every size up to a few levels' worth, and check
+   // that the trees are balanced and hold exactly what was loaded.
+   for (n = 0; n < 70; n++) {
+      OSet* oset = VG_(OSetWord_Create)(allocate_node, "oset_test.3",
+                                        free_node);
+      for (i = 0; i < n; i++) {
+         vals[i] = 2*i;
+      }
+      VG_(OSetWord_BulkLoad)(oset, vals, n);
+      vg_assert( n == VG_(OSetWord_Size)(oset) );
+      check_avl(oset->root);
+      for (i = 0; i < 2*n; i++) {
+         vg_assert( (i % 2 == 0) == VG_(OSetWord_Contains)(oset, i) );
+      }
+      i = 0;
+      VG_(OSetWord_ResetIter)(oset);
+      while ( VG_(OSetWord_Next)(oset, &v) ) {
+         vg_assert( v == vals[i++] );
+      }
+      vg_assert( i == n );
+
+      // The result must be an ordinary tree as far as the other
+      // operations are concerned.
+      VG_(OSetWord_Insert)(oset, 1);
+      check_avl(oset->root);
+      vg_assert( VG_(OSetWord_Remove)(oset, 1) );
+      for (i = 0; i < n; i += 2) {
+         vg_assert( VG_(OSetWord_Remove)(oset, vals[i]) );
+         check_avl(oset->root);
+      }
+      VG_(OSetWord_Destroy)(oset);
+   }
+
+   // Now a generic OSet with a comparison function, loaded with
+   // NN elements, looked up repeatedly to exercise the last-hit cache.
+   {
+      OSet* oset = VG_(OSetGen_Create)(offsetof(Block, first), blockCmp,
+                                       allocate_node, "oset_test.4",
+                                       free_node);
+      for (i = 0; i < NN; i++) {
+         Block* b = VG_(OSetGen_AllocNode)(oset, sizeof(Block));
+         b->b1    = i;
+         b->first = 3*i;
+         b->b2    = i*2;
+         b->last  = 3*i + 2;
+         es[i]    = b;
+      }
+      VG_(OSetGen_BulkLoad)(oset, es, NN);
+      vg_assert( NN == VG_(OSetGen_Size)(oset) );
+      check_avl(oset->root);
+      for (i = 0; i < 3*NN; i++) {
+         k = i;
+         vg_assert( es[i/3] == VG_(OSetGen_Lookup)(oset, &k) );
+         vg_assert( es[i/3] == VG_(OSetGen_Lookup)(oset, &k) );
+      }
+      // A removed element must not be found through the cache.
+      k = 30;
+      vg_assert( es[10] == VG_(OSetGen_Lookup)(oset, &k) );
+      vg_assert( es[10] == VG_(OSetGen_Remove)(oset, &k) );
+      vg_assert( ! VG_(OSetGen_Lookup)(oset, &k) );
+      k = 31;
+      vg_assert( ! VG_(OSetGen_Lookup)(oset, &k) );
+      VG_(OSetGen_FreeNode)(oset, es[10]);
+      prev = 0;
+      i = 0;
+      VG_(OSetGen_ResetIter)(oset);
+      while ( (es[0] = VG_(OSetGen_Next)(oset)) ) {
+         vg_assert( i == 0 || ((Block*)es[0])->first > prev );
+         prev = ((Block*)es[0])->first;
+         i++;
+      }
+      vg_assert( i == NN - 1 );
+      VG_(OSetGen_Destroy)(oset);
+   }
+}
+
 //-----------------------------------------------------------------------
 // main()
 //-----------------------------------------------------------------------
@@ -604,5 +704,6 @@ int main(void)
    example1();
    example1b();
    example2();
+   example3();
    return 0;
 }
@@ -251,6 +251,8 @@ int main(int argc, char **argv)
    vta.traceflags                 = 0xFFFFFFFF;
    vta.sigill_diag                = False;
    vta.addProfInc                 = False;
+   vta.phase_clock                = NULL;
+   vta.phase_stats                = NULL;
    vta.disp_cp_chain_me_to_slowEP = failure_dispcalled;
    vta.disp_cp_chain_me_to_fastEP = failure_dispcalled;
    vta.disp_cp_xindir             = failure_dispcalled;
@@ -0,0 +1,81 @@
+// bigdebug is a large program with a lot of debug info:  4096 functions,
+// each with its own nested struct and union types, nested lexical blocks
+// and a chain of inlined helpers, so there are megabytes of code and
+// deep DWARF trees to read at start-up.  Every function is run once, so
+// all of the code is also translated.  With an arg, the functions are
+// run that many times.
+//
+// It's a stress test for start-up time with big binaries, particularly
+// with --read-var-info=yes, which reads all the type and variable
+// information.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define INLINE static inline __attribute__((always_inline))
+INLINE long h1(long x) { return x * 7 + (x >> 3); }
+INLINE long h2(long x) { long y = h1(x); return y ^ h1(y + 1); }
+INLINE long h3(long x) { long y = h2(x); return y + h2(y - x); }
+
+#define DEFINE_FN(id)                                        \
+   struct s_##id {                                           \
+      struct {                                               \
+         struct { int a[4]; double d; } in2;                 \
+         long l;                                             \
+      } in1;                                                 \
+      union { int i; float f; } u;                           \
+      char name[8];                                          \
+   };                                                        \
+   static __attribute__((noinline)) long fn_##id(long x)     \
+   {                                                         \
+      struct s_##id s;                                       \
+      int k;                                                 \
+      for (k = 0; k < 4; k++)                                \
+         s.in1.in2.a[k] = (int) (x + k);                     \
+      s.in1.in2.d = (double) x;                              \
+      s.in1.l = 0;                                           \
+      s.u.i = (int) x;                                       \
+      s.name[0] = #id[0];                                    \
+      for (k = 0; k < 4; k++) {                              \
+         struct s_##id t = s;                                \
+         {                                                   \
+            long y = t.in1.in2.a[k] + h3(k + x);             \
+            {                                                \
+               long z = y * 3 + (long) t.in1.in2.d;          \
+               s.in1.l += h3(z) + t.name[0];                 \
+            }                                                \
+         }                                                   \
+      }                                                      \
+      return s.in1.l + s.u.i;                                \
+   }
+
+#define FN_ADDR(id) fn_##id,
+
+#define X1(M, p) M(p##0) M(p##1) M(p##2) M(p##3) M(p##4) M(p##5) M(p##6) \
+                 M(p##7) M(p##8) M(p##9) M(p##a) M(p##b) M(p##c) M(p##d) \
+                 M(p##e) M(p##f)
+#define X2(M, p) X1(M, p##0) X1(M, p##1) X1(M, p##2) X1(M, p##3) \
+                 X1(M, p##4) X1(M, p##5) X1(M, p##6) X1(M, p##7) \
+                 X1(M, p##8) X1(M, p##9) X1(M, p##a) X1(M, p##b) \
+                 X1(M, p##c) X1(M, p##d) X1(M, p##e) X1(M, p##f)
+#define X3(M, p) X2(M, p##0) X2(M, p##1) X2(M, p##2) X2(M, p##3) \
+                 X2(M, p##4) X2(M, p##5) X2(M, p##6) X2(M, p##7) \
+                 X2(M, p##8) X2(M, p##9) X2(M, p##a) X2(M, p##b) \
+                 X2(M, p##c) X2(M, p##d) X2(M, p##e) X2(M, p##f)
+
+X3(DEFINE_FN, f)
+
+static long (* const fns[])(long) = { X3(FN_ADDR, f) };
+
+int main(int argc, char* argv[])
+{
+   int reps = argc > 1 ? atoi(argv[1]) : 1;
+   long sum = 0;
+   int r, i;
+
+   for (r = 0; r < reps; r++)
+      for (i = 0; i < sizeof(fns) / sizeof(fns[0]); i++)
+         sum += fns[i](i + r);
+   printf("%ld\n", sum);
+   return 0;
+}
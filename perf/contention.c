@@ -0,0 +1,42 @@
+// contention runs 32 threads that each take and release one shared mutex
+// in a tight loop, doing very little work while holding it.  Nearly every
+// lock operation finds the mutex taken, so threads block in futex calls
+// and are woken all the time, and Valgrind switches between them much
+// more often than its usual scheduling time slice.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 32
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static long counter;
+static long iters;
+
+static void *worker(void *arg)
+{
+   long id = (long) arg;
+   long i;
+
+   for (i = 0; i < iters; i++) {
+      pthread_mutex_lock(&lock);
+      counter += id + (counter & 3);
+      pthread_mutex_unlock(&lock);
+   }
+   return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+   pthread_t threads[NTHREADS];
+   long i;
+
+   iters = argc > 1 ? atol(argv[1]) : 200000;
+   for (i = 0; i < NTHREADS; i++)
+      pthread_create(&threads[i], NULL, worker, (void *) i);
+   for (i = 0; i < NTHREADS; i++)
+      pthread_join(threads[i], NULL);
+   printf("%ld\n", counter);
+   return 0;
+}
@@ -0,0 +1,46 @@
+// dg-calls makes deep and varied call stacks. Datagrind keeps a shadow
+// stack and starts a new context wherever a block runs with a different
+// stack, so this is a stress test for the bookkeeping at the start of each
+// block rather than for the accesses.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define DEPTH 200
+
+typedef int (*fn)(int depth, int x);
+
+static int f0(int depth, int x);
+static int f1(int depth, int x);
+static int f2(int depth, int x);
+static int f3(int depth, int x);
+
+static fn fns[4] = { f0, f1, f2, f3 };
+
+// Each level calls one of the four, chosen by x, so stacks differ
+static int step(int depth, int x)
+{
+   volatile int local[4];
+
+   if (depth == 0)
+      return x;
+   local[x & 3] = x;
+   return fns[(x >> depth % 8) & 3](depth - 1, x * 3 + 1) + local[x & 3];
+}
+
+static int f0(int depth, int x) { return step(depth, x + 1); }
+static int f1(int depth, int x) { return step(depth, x ^ 0x55); }
+static int f2(int depth, int x) { return step(depth, x * 7); }
+static int f3(int depth, int x) { return step(depth, x - 3); }
+
+int main(int argc, char *argv[])
+{
+   int reps = argc > 1 ? atoi(argv[1]) : 20000;
+   int sum = 0;
+   int i;
+
+   for (i = 0; i < reps; i++)
+      sum += step(DEPTH, i);
+   printf("%d\n", sum);
+   return 0;
+}
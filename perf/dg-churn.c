@@ -0,0 +1,44 @@
+// dg-churn allocates and frees many short-lived blocks of varied sizes
+// from several places, with only a few live at once. Datagrind writes a
+// record for each allocation and free, and with allocation stacks on,
+// looks up the stack of each.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NLIVE 256
+
+static char *live[NLIVE];
+
+static char *alloc_a(size_t n) { return malloc(n); }
+static char *alloc_b(size_t n) { return calloc(1, n); }
+static char *alloc_c(size_t n) { return realloc(NULL, n); }
+
+int main(int argc, char *argv[])
+{
+   int iters = argc > 1 ? atoi(argv[1]) : 1000000;
+   unsigned int x = 1;
+   long sum = 0;
+   int i;
+
+   for (i = 0; i < iters; i++) {
+      int j = i % NLIVE;
+      size_t n;
+
+      x = x * 1103515245 + 12345;
+      n = 8 + (x >> 16) % 256;
+      free(live[j]);
+      switch (x % 3) {
+      case 0: live[j] = alloc_a(n); break;
+      case 1: live[j] = alloc_b(n); break;
+      default: live[j] = alloc_c(n); break;
+      }
+      memset(live[j], i, n);
+      sum += live[j][n / 2];
+   }
+   for (i = 0; i < NLIVE; i++)
+      free(live[i]);
+   printf("%ld\n", sum);
+   return 0;
+}
@@ -0,0 +1,37 @@
+// dg-dense makes as many data accesses as it can in a few simple loops,
+// which is where Datagrind spends most of its time: sequential reads,
+// strided writes, scattered reads and block copies over arrays larger than
+// the caches.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N (1 << 20)
+
+static int a[N], b[N];
+
+int main(int argc, char *argv[])
+{
+   int reps = argc > 1 ? atoi(argv[1]) : 10;
+   unsigned int x = 1;
+   long sum = 0;
+   int r, i, j;
+
+   for (i = 0; i < N; i++)
+      a[i] = i;
+   for (r = 0; r < reps; r++) {
+      for (i = 0; i < N; i++)
+         sum += a[i];
+      for (j = 0; j < 16; j++)
+         for (i = j; i < N; i += 16)
+            b[i] = a[i] + r;
+      for (i = 0; i < N; i++) {
+         x = x * 1103515245 + 12345;
+         sum += a[x % N];
+      }
+      memcpy(a, b, sizeof(a));
+   }
+   printf("%ld\n", sum);
+   return 0;
+}
@@ -0,0 +1,51 @@
+// dg-threads runs many threads that each work on their own array and on a
+// shared one. Valgrind switches between them often, and Datagrind writes
+// a record at every switch and keeps a shadow stack per thread.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NTHREADS 16
+#define N (1 << 16)
+
+static int shared[N];
+static int loops;
+
+static void *worker(void *arg)
+{
+   int *own = malloc(N * sizeof(int));
+   long id = (long) arg;
+   long sum = 0;
+   int l, i;
+
+   for (i = 0; i < N; i++)
+      own[i] = i + id;
+   for (l = 0; l < loops; l++)
+      for (i = 0; i < N; i++) {
+         sum += own[i] + shared[(i * 17 + id) % N];
+         own[i] = (int) sum;
+      }
+   free(own);
+   return (void *) sum;
+}
+
+int main(int argc, char *argv[])
+{
+   pthread_t threads[NTHREADS];
+   long sum = 0;
+   long i;
+
+   loops = argc > 1 ? atoi(argv[1]) : 32;
+   for (i = 0; i < N; i++)
+      shared[i] = (int) i;
+   for (i = 0; i < NTHREADS; i++)
+      pthread_create(&threads[i], NULL, worker, (void *) i);
+   for (i = 0; i < NTHREADS; i++) {
+      void *ret;
+      pthread_join(threads[i], &ret);
+      sum += (long) ret;
+   }
+   printf("%ld\n", sum);
+   return 0;
+}
@@ -0,0 +1,95 @@
+// many-maps creates 100000 separate mappings (fewer if the kernel's
+// vm.max_map_count does not allow that many), then repeatedly changes the
+// protection of some of them, replaces others, and touches all of them,
+// before unmapping them all.  Valgrind has to track every mapping and
+// look them up on every mmap, mprotect and munmap.
+//
+// Adjacent mappings alternate between read-write and read-only, so that
+// the kernel cannot merge them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tests/sys_mman.h"
+
+#define N_DEFAULT 100000
+#define N_ROUNDS  4
+
+// Leave room for the mappings of the program itself and of Valgrind.
+#define MAP_MARGIN 2000
+
+static long max_maps(void)
+{
+   FILE *f = fopen("/proc/sys/vm/max_map_count", "r");
+   long n = -1;
+
+   if (f) {
+      if (fscanf(f, "%ld", &n) != 1)
+         n = -1;
+      fclose(f);
+   }
+   return n;
+}
+
+static int prot_of(long i)
+{
+   return (i & 1) ? PROT_READ : PROT_READ | PROT_WRITE;
+}
+
+int main(int argc, char *argv[])
+{
+   long n = argc > 1 ? atol(argv[1]) : N_DEFAULT;
+   long limit = max_maps();
+   long page = sysconf(_SC_PAGESIZE);
+   char **maps;
+   long i, r, sum = 0;
+
+   if (limit > MAP_MARGIN && n > limit - MAP_MARGIN)
+      n = limit - MAP_MARGIN;
+   maps = malloc(n * sizeof(char *));
+
+   // Map twice as much as needed and unmap every other page, so that
+   // the mappings are separated by holes as well as by protections.
+   char *area = mmap(NULL, 2 * n * page, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (area == MAP_FAILED) {
+      perror("mmap");
+      return 1;
+   }
+   for (i = 0; i < n; i++) {
+      maps[i] = mmap(area + 2 * i * page, page, prot_of(i),
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+      if (maps[i] == MAP_FAILED) {
+         perror("mmap");
+         return 1;
+      }
+      munmap(area + (2 * i + 1) * page, page);
+   }
+
+   for (r = 0; r < N_ROUNDS; r++) {
+      for (i = r; i < n; i += 7)
+         mprotect(maps[i], page, PROT_READ | PROT_WRITE);
+      for (i = r; i < n; i += 13) {
+         munmap(maps[i], page);
+         maps[i] = mmap(maps[i], page, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+         if (maps[i] == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+         }
+      }
+      for (i = 0; i < n; i++) {
+         if (i % 7 == r || i % 13 == r || !(i & 1))
+            maps[i][0] = (char) (i + r);
+         sum += maps[i][0];
+      }
+      for (i = r; i < n; i += 7)
+         mprotect(maps[i], page, prot_of(i));
+   }
+
+   for (i = 0; i < n; i++)
+      munmap(maps[i], page);
+   free(maps);
+   printf("%ld\n", sum);
+   return 0;
+}